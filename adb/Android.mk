@@ -30,6 +30,8 @@ ADB_COMMON_CFLAGS := \
 LIBADB_SRC_FILES := \
     adb.cpp \
     adb_auth.cpp \
+    adb_compress.cpp \
+    adb_delta.cpp \
     adb_io.cpp \
     adb_listeners.cpp \
     adb_utils.cpp \
@@ -39,6 +41,8 @@ LIBADB_SRC_FILES := \
     transport_usb.cpp \
 
 LIBADB_TEST_SRCS := \
+    adb_compress_test.cpp \
+    adb_delta_test.cpp \
     adb_io_test.cpp \
     adb_utils_test.cpp \
     transport_test.cpp \
@@ -105,7 +109,7 @@ LOCAL_CLANG := true
 LOCAL_MODULE := adbd_test
 LOCAL_CFLAGS := -DADB_HOST=0 $(LIBADB_CFLAGS)
 LOCAL_SRC_FILES := $(LIBADB_TEST_SRCS)
-LOCAL_STATIC_LIBRARIES := libadbd
+LOCAL_STATIC_LIBRARIES := libadbd libmincrypt libz
 LOCAL_SHARED_LIBRARIES := liblog libbase libcutils
 include $(BUILD_NATIVE_TEST)
 
@@ -119,6 +123,8 @@ LOCAL_STATIC_LIBRARIES := \
     libadb \
     libcrypto_static \
     libcutils \
+    libmincrypt \
+    libz \
 
 ifeq ($(HOST_OS),linux)
   LOCAL_LDLIBS += -lrt -ldl -lpthread
@@ -140,11 +146,66 @@ LOCAL_MODULE := adb_device_tracker_test
 LOCAL_CFLAGS := -DADB_HOST=1 $(LIBADB_CFLAGS)
 LOCAL_SRC_FILES := test_track_devices.cpp
 LOCAL_SHARED_LIBRARIES := liblog libbase
-LOCAL_STATIC_LIBRARIES := libadb libcrypto_static libcutils
+LOCAL_STATIC_LIBRARIES := libadb libcrypto_static libcutils libmincrypt libz
 LOCAL_LDLIBS += -lrt -ldl -lpthread
 include $(BUILD_HOST_EXECUTABLE)
 endif
 
+# fdevent benchmark, built against the default backend and against select()
+# =========================================================
+
+ifneq ($(HOST_OS),windows)
+include $(CLEAR_VARS)
+LOCAL_CLANG := $(adb_host_clang)
+LOCAL_MODULE := adb_fdevent_benchmark
+LOCAL_CFLAGS := -DADB_HOST=1 $(LIBADB_CFLAGS)
+LOCAL_SRC_FILES := fdevent_benchmark.cpp
+LOCAL_SHARED_LIBRARIES := liblog libbase
+LOCAL_STATIC_LIBRARIES := libadb libcrypto_static libcutils libmincrypt libz
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lrt -ldl -lpthread
+endif
+ifeq ($(HOST_OS),darwin)
+  LOCAL_LDLIBS += -framework CoreFoundation -framework IOKit
+endif
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_CLANG := $(adb_host_clang)
+LOCAL_MODULE := adb_fdevent_benchmark_select
+LOCAL_CFLAGS := -DADB_HOST=1 -DADB_FDEVENT_SELECT $(LIBADB_CFLAGS)
+LOCAL_SRC_FILES := fdevent_benchmark.cpp fdevent.cpp
+LOCAL_SHARED_LIBRARIES := liblog libbase
+LOCAL_STATIC_LIBRARIES := libadb libcrypto_static libcutils libmincrypt libz
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lrt -ldl -lpthread
+endif
+ifeq ($(HOST_OS),darwin)
+  LOCAL_LDLIBS += -framework CoreFoundation -framework IOKit
+endif
+include $(BUILD_HOST_EXECUTABLE)
+endif
+
+# adb benchmark, run against a device through the adb server
+# =========================================================
+
+ifneq ($(HOST_OS),windows)
+include $(CLEAR_VARS)
+LOCAL_CLANG := $(adb_host_clang)
+LOCAL_MODULE := adb_benchmark
+LOCAL_CFLAGS := -DADB_HOST=1 $(LIBADB_CFLAGS)
+LOCAL_SRC_FILES := adb_benchmark.cpp adb_client.cpp services.cpp
+LOCAL_SHARED_LIBRARIES := liblog libbase
+LOCAL_STATIC_LIBRARIES := libadb libcrypto_static libcutils libmincrypt libz
+ifeq ($(HOST_OS),linux)
+  LOCAL_LDLIBS += -lrt -ldl -lpthread
+endif
+ifeq ($(HOST_OS),darwin)
+  LOCAL_LDLIBS += -framework CoreFoundation -framework IOKit
+endif
+include $(BUILD_HOST_EXECUTABLE)
+endif
+
 # adb host tool
 # =========================================================
 include $(CLEAR_VARS)
@@ -188,6 +249,8 @@ LOCAL_STATIC_LIBRARIES := \
     libcrypto_static \
     libcutils \
     liblog \
+    libmincrypt \
+    libz \
     $(EXTRA_STATIC_LIBS) \
 
 # libc++ not available on windows yet
@@ -259,5 +322,6 @@ LOCAL_STATIC_LIBRARIES := \
     libmincrypt \
     libselinux \
     libext4_utils_static \
+    libz \
 
 include $(BUILD_EXECUTABLE)
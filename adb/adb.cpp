@@ -30,6 +30,7 @@
 #include <sys/time.h>
 #include <time.h>
 
+#include <algorithm>
 #include <string>
 
 #include <base/stringprintf.h>
@@ -198,22 +199,116 @@ void adb_trace_init() {
 #endif
 }
 
-apacket* get_apacket(void)
+/* Packets pass through the transport threads at a high rate, so freed
+** packets and MAX_PAYLOAD buffers are kept for reuse, up to a bound.
+** Pooled packets are chained through next, pooled buffers through their
+** first word.
+*/
+#define APACKET_POOL_MAX 256
+#define APACKET_BUFFER_POOL_MAX 16
+
+ADB_MUTEX_DEFINE( apacket_lock );
+static apacket* apacket_pool;
+static void* apacket_buffer_pool;
+static apacket_stats apacket_counters;
+
+static void put_apacket_buffer(apacket* p)
+{
+    if (p->data == p->inline_data) {
+        return;
+    }
+    if (p->capacity == MAX_PAYLOAD) {
+        adb_mutex_lock(&apacket_lock);
+        if (apacket_counters.buffers_pooled < APACKET_BUFFER_POOL_MAX) {
+            *reinterpret_cast<void**>(p->data) = apacket_buffer_pool;
+            apacket_buffer_pool = p->data;
+            apacket_counters.buffers_pooled++;
+            p->data = nullptr;
+        }
+        adb_mutex_unlock(&apacket_lock);
+    }
+    free(p->data);
+}
+
+apacket* get_apacket(size_t payload)
 {
-    apacket* p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+    adb_mutex_lock(&apacket_lock);
+    apacket* p = apacket_pool;
+    if (p != nullptr) {
+        apacket_pool = p->next;
+        apacket_counters.pooled--;
+        apacket_counters.reused++;
+    } else {
+        apacket_counters.allocated++;
+    }
+    adb_mutex_unlock(&apacket_lock);
+
     if (p == nullptr) {
-      fatal("failed to allocate an apacket");
+        p = reinterpret_cast<apacket*>(malloc(sizeof(apacket)));
+        if (p == nullptr) {
+          fatal("failed to allocate an apacket");
+        }
     }
 
-    memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
+    memset(p, 0, offsetof(apacket, inline_data));
+    p->data = p->inline_data;
+    p->capacity = MAX_PAYLOAD_V1;
+    apacket_reserve(p, payload);
     return p;
 }
 
+void apacket_reserve(apacket *p, size_t size)
+{
+    if (size <= p->capacity) {
+        return;
+    }
+    put_apacket_buffer(p);
+
+    /* heap buffers are all MAX_PAYLOAD, so that they can be shared */
+    unsigned char* data = nullptr;
+    if (size <= MAX_PAYLOAD) {
+        size = MAX_PAYLOAD;
+        adb_mutex_lock(&apacket_lock);
+        data = reinterpret_cast<unsigned char*>(apacket_buffer_pool);
+        if (data != nullptr) {
+            apacket_buffer_pool = *reinterpret_cast<void**>(data);
+            apacket_counters.buffers_pooled--;
+        }
+        adb_mutex_unlock(&apacket_lock);
+    }
+    if (data == nullptr) {
+        data = reinterpret_cast<unsigned char*>(malloc(size));
+        if (data == nullptr) {
+          fatal("failed to allocate an apacket payload");
+        }
+    }
+    p->data = data;
+    p->capacity = size;
+}
+
 void put_apacket(apacket *p)
 {
+    put_apacket_buffer(p);
+
+    adb_mutex_lock(&apacket_lock);
+    if (apacket_counters.pooled < APACKET_POOL_MAX) {
+        p->next = apacket_pool;
+        apacket_pool = p;
+        apacket_counters.pooled++;
+        p = nullptr;
+    }
+    adb_mutex_unlock(&apacket_lock);
     free(p);
 }
 
+apacket_stats get_apacket_stats()
+{
+    adb_mutex_lock(&apacket_lock);
+    apacket_stats stats = apacket_counters;
+    adb_mutex_unlock(&apacket_lock);
+    return stats;
+}
+
 void handle_online(atransport *t)
 {
     D("adb: online\n");
@@ -327,7 +422,7 @@ void send_connect(atransport *t)
     cp->msg.arg0 = A_VERSION;
     cp->msg.arg1 = MAX_PAYLOAD;
     cp->msg.data_length = fill_connect_data((char *)cp->data,
-                                            sizeof(cp->data));
+                                            cp->capacity);
     send_packet(cp, t);
 }
 
@@ -414,12 +509,22 @@ void handle_packet(apacket *p, atransport *t)
         return;
 
     case A_CNXN: /* CONNECT(version, maxdata, "system-id-string") */
-            /* XXX verify version, etc */
         if(t->connection_state != CS_OFFLINE) {
             t->connection_state = CS_OFFLINE;
             handle_offline(t);
         }
 
+        /* Older peers offer A_VERSION_MIN and MAX_PAYLOAD_V1, and the
+        ** device answers after it has taken these in, so neither end
+        ** sends anything the other does not expect.
+        */
+        t->protocol_version = std::min(std::max(p->msg.arg0, (unsigned) A_VERSION_MIN),
+                                       (unsigned) A_VERSION);
+        t->max_payload = std::min(std::max((size_t) p->msg.arg1, (size_t) MAX_PAYLOAD_V1),
+                                  (size_t) MAX_PAYLOAD);
+        D("adb: protocol version %x, max payload %zu\n",
+          t->protocol_version, t->max_payload);
+
         parse_banner(reinterpret_cast<const char*>(p->data), t);
 
         if (HOST || !auth_required) {
@@ -808,6 +913,13 @@ int handle_host_request(char *service, transport_type ttype, char* serial, int r
     }
 
 #if ADB_HOST
+    // return the counters of all transports, or of the one with the given serial
+    if (!strcmp(service, "transport-stats")) {
+        SendOkay(reply_fd);
+        SendProtocolString(reply_fd, format_transport_stats(serial));
+        return 0;
+    }
+
     atransport *transport = NULL;
     // "transport:" is used for switching transport with a specified serial number
     // "transport-usb:" is used for switching transport to the only USB transport
@@ -18,12 +18,16 @@
 #define __ADB_H
 
 #include <limits.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "adb_trace.h"
 #include "fdevent.h"
 
-#define MAX_PAYLOAD 4096
+// Payload limit of the original protocol, and of every packet until the
+// CNXN handshake has settled on a larger one.
+#define MAX_PAYLOAD_V1 (4 * 1024)
+#define MAX_PAYLOAD (256 * 1024)
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -33,8 +37,16 @@
 #define A_WRTE 0x45545257
 #define A_AUTH 0x48545541
 
-// ADB protocol version.
-#define A_VERSION 0x01000000
+// Sent only over tcp, ahead of CNXN, to stripe a transport over several
+// connections; see protocol.txt.
+#define A_STRP 0x50525453
+
+// ADB protocol version. Both ends use the lower of the versions they
+// offer in CNXN; from A_VERSION_SKIP_CHECKSUM on, packets other than
+// CNXN and AUTH go without a data checksum.
+#define A_VERSION_MIN 0x01000000
+#define A_VERSION_SKIP_CHECKSUM 0x01000001
+#define A_VERSION 0x01000001
 
 // Used for help/version information.
 #define ADB_VERSION_MAJOR 1
@@ -45,6 +57,7 @@
 
 struct atransport;
 struct usb_handle;
+struct stripe_set;
 
 struct amessage {
     unsigned command;       /* command identifier constant      */
@@ -62,8 +75,17 @@ struct apacket
     unsigned len;
     unsigned char *ptr;
 
+        /* payload, either inline_data or a heap buffer of up
+        ** to MAX_PAYLOAD bytes
+        */
+    unsigned char *data;
+    size_t capacity;
+
+        /* inline_data follows msg directly, so that a small
+        ** packet is one contiguous write
+        */
     amessage msg;
-    unsigned char data[MAX_PAYLOAD];
+    unsigned char inline_data[MAX_PAYLOAD_V1];
 };
 
 /* An asocket represents one half of a connection between a local and
@@ -108,6 +130,14 @@ struct asocket {
     apacket *pkt_first;
     apacket *pkt_last;
 
+        /* for local sockets, a read shorter than coalesce_bytes is held
+        ** in coalesced for up to coalesce_ms, so that a run of small ones
+        ** goes out as one packet; see local_socket_coalesce()
+        */
+    int coalesce_ms;
+    size_t coalesce_bytes;
+    apacket *coalesced;
+
         /* enqueue is called by our peer when it has data
         ** for us.  It should return 0 if we can accept more
         ** data or 1 if not.  If we return 1, we must call
@@ -170,6 +200,46 @@ enum transport_type {
 
 #define TOKEN_SIZE 20
 
+    /* write latencies are counted in power of two millisecond buckets,
+    ** under 1ms, under 2ms, ... under 1024ms, and longer
+    */
+#define TRANSPORT_LATENCY_BUCKETS 12
+
+    /* a write taking longer than this counts as a stall */
+#define TRANSPORT_STALL_MS 250
+
+/* Counters kept for each transport, for "adb devices -l" and the
+** host:transport-stats service. All are updated under
+** transport_stats_lock.
+*/
+struct transport_stats
+{
+        /* packets and bytes, headers included, from and to the device */
+    uint64_t packets_in;
+    uint64_t bytes_in;
+    uint64_t packets_out;
+    uint64_t bytes_out;
+
+        /* how long output_thread took to pass each packet from the device
+        ** on, and input_thread to write each packet to the device
+        */
+    unsigned latency_in[TRANSPORT_LATENCY_BUCKETS];
+    unsigned latency_out[TRANSPORT_LATENCY_BUCKETS];
+    unsigned stalls_in;
+    unsigned stalls_out;
+
+        /* packets sent and waiting for input_thread, and the most there
+        ** have been
+        */
+    unsigned queued;
+    unsigned queued_max;
+
+        /* packets from the device that a local socket could not take at
+        ** once, holding up the stream until it drained
+        */
+    unsigned backlogs;
+};
+
 struct atransport
 {
     atransport *next;
@@ -189,10 +259,17 @@ struct atransport
     int online;
     transport_type type;
 
+        /* settled on in the CNXN handshake, see send_connect() */
+    unsigned protocol_version;
+    size_t max_payload;
+
         /* usb handle or socket fd as needed */
     usb_handle *usb;
     int sfd;
 
+        /* the further tcp connections a striped transport uses */
+    stripe_set *stripes;
+
         /* used to identify transports for clients */
     char *serial;
     char *product;
@@ -210,6 +287,8 @@ struct atransport
     fdevent auth_fde;
     unsigned failed_auth_attempts;
 
+    transport_stats stats;
+
     const char* connection_state_name() const;
 };
 
@@ -246,6 +325,7 @@ void remove_socket(asocket *s);
 void close_all_sockets(atransport *t);
 
 asocket *create_local_socket(int fd);
+void local_socket_coalesce(asocket *s, const char *service);
 asocket *create_local_service_socket(const char *destination);
 
 asocket *create_remote_socket(unsigned id, atransport *t);
@@ -265,7 +345,7 @@ int adb_main(int is_daemon, int server_port);
 #if ADB_HOST
 int get_available_local_transport_index();
 #endif
-int  init_socket_transport(atransport *t, int s, int port, int local);
+int  init_socket_transport(atransport *t, int s, int port, int local, stripe_set *stripes);
 void init_usb_transport(atransport *t, usb_handle *usb, int state);
 
 #if ADB_HOST
@@ -280,7 +360,7 @@ asocket *host_service_to_socket(const char*  name, const char *serial);
 #if !ADB_HOST
 int       init_jdwp(void);
 asocket*  create_jdwp_service_socket();
-asocket*  create_jdwp_tracker_service_socket();
+asocket*  create_jdwp_tracker_service_socket(bool delta);
 int       create_jdwp_connection_fd(int  jdwp_pid);
 #endif
 
@@ -288,12 +368,24 @@ int handle_forward_request(const char* service, transport_type ttype, char* seri
 
 #if !ADB_HOST
 void framebuffer_service(int fd, void *cookie);
+void framebuffer_stream_service(int fd, void *cookie);
 void set_verity_enabled_state_service(int fd, void* cookie);
 #endif
 
 /* packet allocator */
-apacket *get_apacket(void);
+/* returns a packet able to hold payload bytes of data */
+apacket *get_apacket(size_t payload = MAX_PAYLOAD_V1);
 void put_apacket(apacket *p);
+/* makes room for size bytes of data, the current contents are lost */
+void apacket_reserve(apacket *p, size_t size);
+
+struct apacket_stats {
+    size_t allocated;       /* packets get_apacket() had to malloc */
+    size_t reused;          /* ... and took from the pool instead */
+    size_t pooled;          /* packets in the pool now */
+    size_t buffers_pooled;  /* MAX_PAYLOAD buffers in the pool now */
+};
+apacket_stats get_apacket_stats();
 
 // Define it if you want to dump packets.
 #define DEBUG_PACKETS 0
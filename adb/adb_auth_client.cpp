@@ -23,6 +23,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "cutils/list.h"
 #include "cutils/sockets.h"
 #include "mincrypt/rsa.h"
@@ -43,6 +47,25 @@ static const char *key_paths[] = {
     NULL
 };
 
+#define KEY_PATHS (sizeof(key_paths) / sizeof(key_paths[0]) - 1)
+
+/* The keys of key_paths, converted for RSA_verify() and kept until one of
+** the files changes, so that a reconnect does not parse them all again.
+*/
+struct cached_key {
+    std::string fingerprint;
+    RSAPublicKey key;
+};
+
+static std::vector<cached_key> cached_keys;
+static std::unordered_map<std::string, size_t> cached_key_index;
+static struct stat cached_key_stats[KEY_PATHS];
+static bool cached_key_present[KEY_PATHS];
+static bool keys_loaded = false;
+
+/* The key that verified last, tried first. */
+static std::string last_fingerprint;
+
 static fdevent listener_fde;
 static int framework_fd = -1;
 
@@ -54,7 +77,7 @@ static bool needs_retry = false;
 static void read_keys(const char *file, struct listnode *list)
 {
     FILE *f;
-    char buf[MAX_PAYLOAD];
+    char buf[MAX_PAYLOAD_V1];
     char *sep;
     int ret;
 
@@ -138,29 +161,85 @@ int adb_auth_generate_token(void *token, size_t token_size)
     return ret * token_size;
 }
 
-int adb_auth_verify(uint8_t* token, uint8_t* sig, int siglen)
+static bool keys_changed()
+{
+    bool changed = !keys_loaded;
+
+    for (size_t i = 0; i < KEY_PATHS; i++) {
+        struct stat st;
+        bool present = !stat(key_paths[i], &st);
+        const struct stat& old = cached_key_stats[i];
+        if (present != cached_key_present[i] ||
+            (present && (st.st_dev != old.st_dev || st.st_ino != old.st_ino ||
+                         st.st_size != old.st_size ||
+                         st.st_mtim.tv_sec != old.st_mtim.tv_sec ||
+                         st.st_mtim.tv_nsec != old.st_mtim.tv_nsec))) {
+            changed = true;
+        }
+        cached_key_present[i] = present;
+        if (present) cached_key_stats[i] = st;
+    }
+    return changed;
+}
+
+static void reload_keys()
 {
     struct listnode *item;
     struct listnode key_list;
-    int ret = 0;
-    RSAPublicKey rsa_key;
+    uint8_t digest[SHA_DIGEST_SIZE];
 
-    if (siglen != RSANUMBYTES)
-        return 0;
+    cached_keys.clear();
+    cached_key_index.clear();
 
     load_keys(&key_list);
 
     list_for_each(item, &key_list) {
         adb_public_key* key = node_to_item(item, struct adb_public_key, node);
-        RSA_key_convert2048(&key->key, &rsa_key);
-        ret = RSA_verify(&rsa_key, sig, siglen, token, SHA_DIGEST_SIZE);
-        if (ret)
-            break;
+        SHA_hash(&key->key, sizeof(key->key), digest);
+        std::string fingerprint(reinterpret_cast<char*>(digest), sizeof(digest));
+        if (cached_key_index.count(fingerprint)) {
+            continue;
+        }
+
+        cached_key k;
+        k.fingerprint = fingerprint;
+        RSA_key_convert2048(&key->key, &k.key);
+        cached_key_index[fingerprint] = cached_keys.size();
+        cached_keys.push_back(k);
     }
 
     free_keys(&key_list);
 
-    return ret;
+    keys_loaded = true;
+    D("Loaded %zu keys\n", cached_keys.size());
+}
+
+int adb_auth_verify(uint8_t* token, uint8_t* sig, int siglen)
+{
+    if (siglen != RSANUMBYTES)
+        return 0;
+
+    if (keys_changed())
+        reload_keys();
+
+    size_t last = cached_keys.size();
+    auto it = cached_key_index.find(last_fingerprint);
+    if (it != cached_key_index.end()) {
+        last = it->second;
+        if (RSA_verify(&cached_keys[last].key, sig, siglen, token, SHA_DIGEST_SIZE))
+            return 1;
+    }
+
+    for (size_t i = 0; i < cached_keys.size(); i++) {
+        if (i == last)
+            continue;
+        if (RSA_verify(&cached_keys[i].key, sig, siglen, token, SHA_DIGEST_SIZE)) {
+            last_fingerprint = cached_keys[i].fingerprint;
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
 static void usb_disconnected(void* unused, atransport* t)
@@ -193,7 +272,7 @@ static void adb_auth_event(int fd, unsigned events, void *data)
 
 void adb_auth_confirm_key(unsigned char *key, size_t len, atransport *t)
 {
-    char msg[MAX_PAYLOAD];
+    char msg[MAX_PAYLOAD_V1];
     int ret;
 
     if (!usb_transport) {
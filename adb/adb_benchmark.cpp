@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures adb end to end, through the running adb server and a device,
+// so that changes to the transports and the packet path can be compared
+// over USB and over a local (tcp or emulator) transport:
+//
+//   push     a sync: SEND of -S MiB to /data/local/tmp
+//   pull     a sync: RECV of that file back
+//   latency  -n round trips of -b bytes through exec:cat
+//   fanout   -k exec:cat streams at once, each echoing -K MiB
+//
+// The device is picked as with adb, -d, -e or -s. The server is not
+// started, run "adb start-server" first. adbd holds back short reads from
+// exec: for a moment to coalesce them, set service.adb.coalesce.exec to
+// 0 on the device to measure latency without that.
+//
+//   adb_benchmark [-d|-e|-s serial] [-m push,pull,latency,fanout]
+//                 [-S MiB] [-n round trips] [-b bytes] [-k streams] [-K MiB]
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "adb_client.h"
+#include "adb_io.h"
+#include "adb_trace.h"
+#include "file_sync_service.h"
+
+#define REMOTE_PATH "/data/local/tmp/adb_benchmark"
+#define MiB (1024 * 1024)
+
+static int megabytes = 64;
+static int round_trips = 1000;
+static int message_size = 64;
+static int streams = 16;
+static int stream_megabytes = 4;
+
+static double now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+static void die(const char* what) {
+    fprintf(stderr, "%s failed: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static int connect_service(const std::string& service) {
+    std::string error;
+    int fd = _adb_connect(service, &error);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", service.c_str(), error.c_str());
+        exit(1);
+    }
+    return fd;
+}
+
+static void report(const char* name, uint64_t bytes, double ms) {
+    printf("%s: %.1f MiB in %.1f ms (%.1f MiB/s)\n", name,
+           bytes / double(MiB), ms, bytes / double(MiB) / (ms / 1000.0));
+}
+
+static void sync_request(int fd, unsigned id, const char* path) {
+    syncmsg msg;
+    size_t len = strlen(path);
+    msg.req.id = id;
+    msg.req.namelen = htoll(len);
+    if (!WriteFdExactly(fd, &msg.req, sizeof(msg.req)) || !WriteFdExactly(fd, path, len)) {
+        die("sync request");
+    }
+}
+
+static void sync_failed(int fd, const syncmsg& msg, const char* what) {
+    std::string reason = "unexpected reply";
+    if (msg.status.id == ID_FAIL) {
+        reason.resize(ltohl(msg.status.msglen));
+        if (!ReadFdExactly(fd, &reason[0], reason.size())) {
+            reason = "connection lost";
+        }
+    }
+    fprintf(stderr, "%s: %s\n", what, reason.c_str());
+    exit(1);
+}
+
+static void bench_push(int fd, bool verbose) {
+    // Not worth compressing, in case the transport ever does.
+    std::vector<char> chunk(SYNC_DATA_MAX);
+    srandom(1);
+    for (size_t i = 0; i < chunk.size(); i++) {
+        chunk[i] = random();
+    }
+
+    uint64_t total = uint64_t(megabytes) * MiB;
+    double start = now_ms();
+    sync_request(fd, ID_SEND, REMOTE_PATH ",0644");
+
+    syncmsg msg;
+    for (uint64_t sent = 0; sent < total; ) {
+        unsigned len = std::min<uint64_t>(chunk.size(), total - sent);
+        msg.data.id = ID_DATA;
+        msg.data.size = htoll(len);
+        if (!WriteFdExactly(fd, &msg.data, sizeof(msg.data)) ||
+            !WriteFdExactly(fd, chunk.data(), len)) {
+            die("push");
+        }
+        sent += len;
+    }
+    msg.data.id = ID_DONE;
+    msg.data.size = htoll(time(NULL));
+    if (!WriteFdExactly(fd, &msg.data, sizeof(msg.data)) ||
+        !ReadFdExactly(fd, &msg.status, sizeof(msg.status))) {
+        die("push");
+    }
+    if (msg.status.id != ID_OKAY) {
+        sync_failed(fd, msg, "push");
+    }
+    if (verbose) {
+        report("push", total, now_ms() - start);
+    }
+}
+
+static void bench_pull(int fd) {
+    std::vector<char> chunk(SYNC_DATA_MAX);
+    uint64_t total = 0;
+    double start = now_ms();
+    sync_request(fd, ID_RECV, REMOTE_PATH);
+
+    syncmsg msg;
+    for (;;) {
+        if (!ReadFdExactly(fd, &msg.data, sizeof(msg.data))) {
+            die("pull");
+        }
+        if (msg.data.id == ID_DONE) {
+            break;
+        }
+        unsigned len = ltohl(msg.data.size);
+        if (msg.data.id != ID_DATA || len > chunk.size()) {
+            sync_failed(fd, msg, "pull");
+        }
+        if (!ReadFdExactly(fd, chunk.data(), len)) {
+            die("pull");
+        }
+        total += len;
+    }
+    report("pull", total, now_ms() - start);
+}
+
+static void bench_latency() {
+    int fd = connect_service("exec:cat");
+    std::vector<char> out(message_size, 'x');
+    std::vector<char> in(message_size);
+    std::vector<double> times;
+
+    for (int i = 0; i < round_trips; i++) {
+        double start = now_ms();
+        if (!WriteFdExactly(fd, out.data(), out.size()) ||
+            !ReadFdExactly(fd, in.data(), in.size())) {
+            die("latency");
+        }
+        times.push_back(now_ms() - start);
+    }
+    adb_close(fd);
+
+    std::sort(times.begin(), times.end());
+    printf("latency: %d round trips of %d bytes, min %.3f ms, median %.3f ms, "
+           "99%% %.3f ms, max %.3f ms\n", round_trips, message_size,
+           times.front(), times[times.size() / 2], times[times.size() * 99 / 100],
+           times.back());
+}
+
+struct stream {
+    int fd;
+    uint64_t sent;
+    uint64_t received;
+};
+
+static void bench_fanout() {
+    uint64_t each = uint64_t(stream_megabytes) * MiB;
+    std::vector<stream> all(streams);
+    std::vector<char> chunk(SYNC_DATA_MAX, 'x');
+    std::vector<char> buffer(SYNC_DATA_MAX);
+
+    double start = now_ms();
+    for (stream& s : all) {
+        s.fd = connect_service("exec:cat");
+        s.sent = s.received = 0;
+        fcntl(s.fd, F_SETFL, fcntl(s.fd, F_GETFL) | O_NONBLOCK);
+    }
+    double opened = now_ms();
+
+    // Writes and reads are interleaved over all the streams, or cat would
+    // stop reading once the output it can not write fills its pipe.
+    int open_streams = streams;
+    std::vector<pollfd> pfds(streams);
+    while (open_streams > 0) {
+        for (int i = 0; i < streams; i++) {
+            pfds[i].fd = all[i].fd;
+            pfds[i].events = POLLIN | (all[i].sent < each ? POLLOUT : 0);
+            pfds[i].revents = 0;
+        }
+        if (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+        for (int i = 0; i < streams; i++) {
+            stream& s = all[i];
+            if (s.fd < 0) {
+                continue;
+            }
+            if (pfds[i].revents & POLLOUT) {
+                size_t len = std::min<uint64_t>(chunk.size(), each - s.sent);
+                int n = adb_write(s.fd, chunk.data(), len);
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) die("fanout write");
+                if (n > 0) s.sent += n;
+            }
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                int n = adb_read(s.fd, buffer.data(), buffer.size());
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    fprintf(stderr, "fanout: stream %d closed after %llu bytes\n", i,
+                            (unsigned long long) s.received);
+                    exit(1);
+                }
+                if (n > 0) s.received += n;
+            }
+            if (s.received == each) {
+                adb_close(s.fd);
+                s.fd = -1;
+                open_streams--;
+            }
+        }
+    }
+    double ms = now_ms() - opened;
+
+    printf("fanout: %d streams opened in %.1f ms, ", streams, opened - start);
+    report("echoed", each * streams, ms);
+}
+
+static void remove_remote() {
+    int fd = connect_service("exec:rm -f " REMOTE_PATH);
+    char buf[256];
+    while (adb_read(fd, buf, sizeof(buf)) > 0) {
+    }
+    adb_close(fd);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-d|-e|-s serial] [-m push,pull,latency,fanout]\n"
+            "       [-S MiB] [-n round trips] [-b bytes] [-k streams] [-K MiB]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    transport_type transport = kTransportAny;
+    const char* serial = NULL;
+    std::string modes = "push,pull,latency,fanout";
+    int c;
+    while ((c = getopt(argc, argv, "des:m:S:n:b:k:K:")) != -1) {
+        switch (c) {
+        case 'd': transport = kTransportUsb; break;
+        case 'e': transport = kTransportLocal; break;
+        case 's': serial = optarg; break;
+        case 'm': modes = optarg; break;
+        case 'S': megabytes = atoi(optarg); break;
+        case 'n': round_trips = atoi(optarg); break;
+        case 'b': message_size = atoi(optarg); break;
+        case 'k': streams = atoi(optarg); break;
+        case 'K': stream_megabytes = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || megabytes < 1 || round_trips < 1 || message_size < 1 ||
+        streams < 1 || stream_megabytes < 1) {
+        usage(argv[0]);
+    }
+    modes = "," + modes + ",";
+    bool push = modes.find(",push,") != std::string::npos;
+    bool pull = modes.find(",pull,") != std::string::npos;
+    bool latency = modes.find(",latency,") != std::string::npos;
+    bool fanout = modes.find(",fanout,") != std::string::npos;
+
+    adb_trace_init();
+    adb_set_transport(transport, serial);
+
+    if (push || pull) {
+        // Pulling needs a file, the pushed one is only reported if asked for.
+        int fd = connect_service("sync:");
+        bench_push(fd, push);
+        if (pull) {
+            bench_pull(fd);
+        }
+        syncmsg msg;
+        msg.req.id = ID_QUIT;
+        msg.req.namelen = 0;
+        WriteFdExactly(fd, &msg.req, sizeof(msg.req));
+        adb_close(fd);
+        remove_remote();
+    }
+    if (latency) {
+        bench_latency();
+    }
+    if (fanout) {
+        bench_fanout();
+    }
+    return 0;
+}
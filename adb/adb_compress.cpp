@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define TRACE_TAG TRACE_RWX
+
+#include "adb_compress.h"
+
+#include <string.h>
+
+#include "adb_io.h"
+#include "adb_trace.h"
+#include "sysdeps.h"
+
+size_t CompressChunk(const void* in, size_t len, void* out, size_t out_len) {
+    uLongf out_size = out_len;
+    if (compress2(reinterpret_cast<Bytef*>(out), &out_size,
+                  reinterpret_cast<const Bytef*>(in), len, Z_BEST_SPEED) != Z_OK) {
+        return 0;
+    }
+    if (out_size > len - len / 8) {
+        return 0;
+    }
+    return out_size;
+}
+
+bool UncompressChunk(const void* in, size_t len, void* out, size_t out_len) {
+    uLongf out_size = out_len;
+    return uncompress(reinterpret_cast<Bytef*>(out), &out_size,
+                      reinterpret_cast<const Bytef*>(in), len) == Z_OK &&
+           out_size == out_len;
+}
+
+StreamDeflater::StreamDeflater() {
+    memset(&stream_, 0, sizeof(stream_));
+    ok_ = deflateInit(&stream_, Z_BEST_SPEED) == Z_OK;
+}
+
+StreamDeflater::~StreamDeflater() {
+    if (ok_) deflateEnd(&stream_);
+}
+
+bool StreamDeflater::Deflate(int fd, int flush) {
+    char buf[16 * 1024];
+    do {
+        stream_.next_out = reinterpret_cast<Bytef*>(buf);
+        stream_.avail_out = sizeof(buf);
+        int ret = deflate(&stream_, flush);
+        if (ret == Z_STREAM_ERROR) {
+            D("deflate failed: %s\n", stream_.msg ? stream_.msg : "?");
+            return false;
+        }
+        size_t n = sizeof(buf) - stream_.avail_out;
+        if (n > 0 && !WriteFdExactly(fd, buf, n)) {
+            return false;
+        }
+    } while (stream_.avail_out == 0);
+    return true;
+}
+
+bool StreamDeflater::Write(int fd, const void* data, size_t len) {
+    if (!ok_) return false;
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+    stream_.avail_in = len;
+    return Deflate(fd, Z_SYNC_FLUSH);
+}
+
+bool StreamDeflater::Finish(int fd) {
+    if (!ok_) return false;
+    stream_.next_in = nullptr;
+    stream_.avail_in = 0;
+    return Deflate(fd, Z_FINISH);
+}
+
+StreamInflater::StreamInflater() {
+    memset(&stream_, 0, sizeof(stream_));
+    ok_ = inflateInit(&stream_) == Z_OK;
+}
+
+StreamInflater::~StreamInflater() {
+    if (ok_) inflateEnd(&stream_);
+}
+
+bool StreamInflater::Inflate(const void* in, size_t len, std::string* out) {
+    char buf[32 * 1024];
+
+    out->clear();
+    if (!ok_) return false;
+
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(in));
+    stream_.avail_in = len;
+    do {
+        stream_.next_out = reinterpret_cast<Bytef*>(buf);
+        stream_.avail_out = sizeof(buf);
+        int ret = inflate(&stream_, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            D("inflate failed: %s\n", stream_.msg ? stream_.msg : "?");
+            inflateEnd(&stream_);
+            ok_ = false;
+            return false;
+        }
+        out->append(buf, sizeof(buf) - stream_.avail_out);
+        if (ret == Z_STREAM_END) {
+            // Anything after the end of the stream is ignored.
+            break;
+        }
+    } while (stream_.avail_out == 0);
+    return true;
+}
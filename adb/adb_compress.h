@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ADB_COMPRESS_H
+#define ADB_COMPRESS_H
+
+#include <sys/types.h>
+
+#include <string>
+
+#include <zlib.h>
+
+// Compression of sync data chunks and of shell and exec output. Both use
+// deflate at its fastest level, which keeps up with USB 2 and most TCP
+// links on the device side while still taking logs and text to a third.
+
+// Compresses len bytes from in into out, which holds out_len bytes.
+//
+// Returns the compressed size, or 0 if the data did not shrink by at least
+// an eighth and is better sent as it is. An out_len of len is thus always
+// enough.
+size_t CompressChunk(const void* in, size_t len, void* out, size_t out_len);
+
+// Expands a chunk made by CompressChunk() into exactly out_len bytes.
+bool UncompressChunk(const void* in, size_t len, void* out, size_t out_len);
+
+// Deflates a byte stream written to fd. Each Write() is flushed through,
+// so that what has been written can be inflated at the other end without
+// waiting for more.
+class StreamDeflater {
+  public:
+    StreamDeflater();
+    ~StreamDeflater();
+
+    bool Write(int fd, const void* data, size_t len);
+
+    // Ends the stream.
+    bool Finish(int fd);
+
+  private:
+    bool Deflate(int fd, int flush);
+
+    z_stream stream_;
+    bool ok_;
+};
+
+// Inflates a byte stream from a StreamDeflater.
+class StreamInflater {
+  public:
+    StreamInflater();
+    ~StreamInflater();
+
+    // Inflates len more bytes of the stream, replacing *out with what they
+    // expand to. Returns false if the stream is corrupt.
+    bool Inflate(const void* in, size_t len, std::string* out);
+
+  private:
+    z_stream stream_;
+    bool ok_;
+};
+
+#endif  // ADB_COMPRESS_H
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "adb_compress.h"
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "sysdeps.h"
+
+static std::string text(size_t len) {
+  std::string s;
+  while (s.size() < len) {
+    s += "I/ActivityManager( 1234): Start proc com.example for activity\n";
+  }
+  s.resize(len);
+  return s;
+}
+
+TEST(compress, chunk_round_trip) {
+  std::string in = text(64 * 1024);
+  std::string out(in.size(), '\0');
+  size_t size = CompressChunk(in.data(), in.size(), &out[0], out.size());
+  ASSERT_NE(0U, size);
+  ASSERT_LT(size, in.size() / 4);
+
+  std::string back(in.size(), '\0');
+  ASSERT_TRUE(UncompressChunk(out.data(), size, &back[0], back.size()));
+  ASSERT_EQ(in, back);
+
+  // The expanded size must match exactly.
+  ASSERT_FALSE(UncompressChunk(out.data(), size, &back[0], back.size() - 1));
+}
+
+TEST(compress, chunk_incompressible) {
+  std::string in(64 * 1024, '\0');
+  srandom(1);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = random();
+  }
+  std::string out(in.size(), '\0');
+  ASSERT_EQ(0U, CompressChunk(in.data(), in.size(), &out[0], out.size()));
+}
+
+TEST(compress, chunk_corrupt) {
+  std::string in = text(4096);
+  std::string out(in.size(), '\0');
+  size_t size = CompressChunk(in.data(), in.size(), &out[0], out.size());
+  ASSERT_NE(0U, size);
+  out[size / 2] ^= 0x55;
+  std::string back(in.size(), '\0');
+  ASSERT_FALSE(UncompressChunk(out.data(), size, &back[0], back.size()));
+}
+
+TEST(compress, stream_round_trip) {
+  int fds[2];
+  ASSERT_EQ(0, adb_socketpair(fds));
+
+  StreamDeflater deflater;
+  StreamInflater inflater;
+  std::string inflated;
+
+  // Each write can be inflated on its own, without waiting for more.
+  for (const char* line : { "hello\n", "world\n" }) {
+    ASSERT_TRUE(deflater.Write(fds[0], line, strlen(line)));
+    char buf[256];
+    int n = adb_read(fds[1], buf, sizeof(buf));
+    ASSERT_GT(n, 0);
+    ASSERT_TRUE(inflater.Inflate(buf, n, &inflated));
+    ASSERT_EQ(line, inflated);
+  }
+
+  std::string big = text(200 * 1024);
+  ASSERT_TRUE(deflater.Write(fds[0], big.data(), big.size()));
+  ASSERT_TRUE(deflater.Finish(fds[0]));
+  adb_close(fds[0]);
+
+  std::string all;
+  char buf[1000];
+  int n;
+  while ((n = adb_read(fds[1], buf, sizeof(buf))) > 0) {
+    ASSERT_TRUE(inflater.Inflate(buf, n, &inflated));
+    all += inflated;
+  }
+  adb_close(fds[1]);
+  ASSERT_EQ(big, all);
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "adb_delta.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <unordered_map>
+
+#include <mincrypt/sha.h>
+
+#define DELTA_BLOCK_MIN 2048
+#define DELTA_BLOCK_MAX (64 * 1024)
+
+size_t DeltaBlockSize(uint64_t file_size) {
+    size_t size = static_cast<size_t>(sqrt(static_cast<double>(file_size)));
+    size = (size + 1023) & ~1023;
+    if (size < DELTA_BLOCK_MIN) return DELTA_BLOCK_MIN;
+    if (size > DELTA_BLOCK_MAX) return DELTA_BLOCK_MAX;
+    return size;
+}
+
+// The checksum is that of rsync: a is the sum of the bytes and b the sum
+// of the running values of a, each kept to 16 bits.
+static inline uint32_t weak_value(uint32_t a, uint32_t b) {
+    return (a & 0xffff) | (b << 16);
+}
+
+uint32_t DeltaWeakChecksum(const uint8_t* data, size_t len) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += data[i];
+        b += a;
+    }
+    return weak_value(a, b);
+}
+
+void DeltaStrongHash(const uint8_t* data, size_t len, uint8_t* strong) {
+    uint8_t digest[SHA_DIGEST_SIZE];
+    SHA_hash(data, len, digest);
+    memcpy(strong, digest, DELTA_STRONG_SIZE);
+}
+
+static void add_literal(std::vector<DeltaOp>* ops, uint64_t offset, uint64_t end) {
+    if (end > offset) {
+        DeltaOp op = { false, offset, end - offset, 0, 0 };
+        ops->push_back(op);
+    }
+}
+
+static void add_copy(std::vector<DeltaOp>* ops, uint32_t block) {
+    if (!ops->empty()) {
+        DeltaOp& last = ops->back();
+        if (last.copy && last.block + last.count == block) {
+            last.count++;
+            return;
+        }
+    }
+    DeltaOp op = { true, 0, 0, block, 1 };
+    ops->push_back(op);
+}
+
+std::vector<DeltaOp> ComputeDelta(const uint8_t* data, size_t len, size_t block_size,
+                                  const std::vector<BlockSignature>& signatures) {
+    std::vector<DeltaOp> ops;
+    size_t literal = 0;
+    size_t i = 0;
+
+    std::unordered_multimap<uint32_t, uint32_t> blocks;
+    blocks.reserve(signatures.size());
+    for (size_t n = 0; n < signatures.size(); n++) {
+        blocks.insert(std::make_pair(signatures[n].weak, static_cast<uint32_t>(n)));
+    }
+
+    bool fresh = true;
+    uint32_t a = 0, b = 0;
+    while (!blocks.empty() && block_size > 0 && i + block_size <= len) {
+        if (fresh) {
+            a = b = 0;
+            for (size_t n = 0; n < block_size; n++) {
+                a += data[i + n];
+                b += a;
+            }
+            fresh = false;
+        }
+
+        auto range = blocks.equal_range(weak_value(a, b));
+        if (range.first != range.second) {
+            uint8_t strong[DELTA_STRONG_SIZE];
+            DeltaStrongHash(data + i, block_size, strong);
+
+            // Prefer the block following the last one copied, which keeps
+            // runs of unchanged blocks together in one op.
+            uint32_t next = UINT32_MAX;
+            if (!ops.empty() && ops.back().copy && literal == i) {
+                next = ops.back().block + ops.back().count;
+            }
+            bool found = false;
+            uint32_t match = 0;
+            for (auto it = range.first; it != range.second; ++it) {
+                if (memcmp(signatures[it->second].strong, strong, DELTA_STRONG_SIZE) == 0) {
+                    if (!found || it->second == next) match = it->second;
+                    found = true;
+                }
+            }
+            if (found) {
+                add_literal(&ops, literal, i);
+                add_copy(&ops, match);
+                i += block_size;
+                literal = i;
+                fresh = true;
+                continue;
+            }
+        }
+
+        if (i + block_size == len) break;
+
+        // Slide the window on by a byte.
+        uint8_t out = data[i];
+        uint8_t in = data[i + block_size];
+        a += in - out;
+        b += a - block_size * out;
+        i++;
+    }
+
+    add_literal(&ops, literal, len);
+    return ops;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ADB_DELTA_H
+#define ADB_DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Block matching for delta pushes, in the manner of rsync. The device
+// signs each whole block of the file it has with a rolling checksum and a
+// strong hash, and the client sends only what does not match those.
+
+#define DELTA_STRONG_SIZE 16
+
+struct BlockSignature {
+    uint32_t weak;
+    uint8_t strong[DELTA_STRONG_SIZE];
+};
+
+// The block size used to sign a file of the given size, about its square
+// root so that the signatures and the literal data around a change both
+// stay small.
+size_t DeltaBlockSize(uint64_t file_size);
+
+// The rolling checksum of len bytes.
+uint32_t DeltaWeakChecksum(const uint8_t* data, size_t len);
+
+// The strong hash of len bytes, a truncated SHA-1.
+void DeltaStrongHash(const uint8_t* data, size_t len, uint8_t* strong);
+
+// A step in rebuilding a file: either len bytes of it from offset, sent
+// as they are, or count blocks of the old file from block.
+struct DeltaOp {
+    bool copy;
+    uint64_t offset;
+    uint64_t len;
+    uint32_t block;
+    uint32_t count;
+};
+
+// Works out how to rebuild the len bytes of data from the blocks of the
+// old file with the given signatures. Runs of consecutive blocks make a
+// single op.
+std::vector<DeltaOp> ComputeDelta(const uint8_t* data, size_t len, size_t block_size,
+                                  const std::vector<BlockSignature>& signatures);
+
+#endif  // ADB_DELTA_H
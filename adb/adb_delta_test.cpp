@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "adb_delta.h"
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+
+#include <string>
+
+static std::string random_data(size_t len, unsigned seed) {
+  std::string s(len, '\0');
+  srandom(seed);
+  for (size_t i = 0; i < len; i++) {
+    s[i] = random();
+  }
+  return s;
+}
+
+static std::vector<BlockSignature> sign(const std::string& old, size_t block_size) {
+  std::vector<BlockSignature> signatures;
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(old.data());
+  for (size_t i = 0; i + block_size <= old.size(); i += block_size) {
+    BlockSignature s;
+    s.weak = DeltaWeakChecksum(data + i, block_size);
+    DeltaStrongHash(data + i, block_size, s.strong);
+    signatures.push_back(s);
+  }
+  return signatures;
+}
+
+// Rebuilds the new file from the old one and the delta, as adbd does.
+static std::string apply(const std::string& old, const std::string& now, size_t block_size,
+                         const std::vector<DeltaOp>& ops, size_t* literal) {
+  std::string out;
+  *literal = 0;
+  for (const DeltaOp& op : ops) {
+    if (op.copy) {
+      out.append(old, op.block * block_size, op.count * block_size);
+    } else {
+      out.append(now, op.offset, op.len);
+      *literal += op.len;
+    }
+  }
+  return out;
+}
+
+TEST(delta, block_size) {
+  ASSERT_EQ(2048U, DeltaBlockSize(0));
+  ASSERT_EQ(2048U, DeltaBlockSize(1024 * 1024));
+  ASSERT_EQ(10240U, DeltaBlockSize(100 * 1024 * 1024));
+  ASSERT_EQ(65536U, DeltaBlockSize(1ULL << 40));
+}
+
+TEST(delta, unchanged) {
+  std::string old = random_data(1024 * 1024, 1);
+  size_t block_size = DeltaBlockSize(old.size());
+  std::vector<DeltaOp> ops = ComputeDelta(reinterpret_cast<const uint8_t*>(old.data()),
+                                          old.size(), block_size, sign(old, block_size));
+  ASSERT_EQ(1U, ops.size());
+  ASSERT_TRUE(ops[0].copy);
+  ASSERT_EQ(0U, ops[0].block);
+  ASSERT_EQ(old.size() / block_size, ops[0].count);
+}
+
+TEST(delta, insert_and_change) {
+  std::string old = random_data(1024 * 1024 + 100, 2);
+  std::string now = old;
+  now.insert(300000, "inserted bytes");
+  now[700000] ^= 1;
+  now.erase(900000, 5000);
+
+  size_t block_size = DeltaBlockSize(old.size());
+  std::vector<DeltaOp> ops = ComputeDelta(reinterpret_cast<const uint8_t*>(now.data()),
+                                          now.size(), block_size, sign(old, block_size));
+  size_t literal;
+  ASSERT_EQ(now, apply(old, now, block_size, ops, &literal));
+  // Each change costs about two blocks, plus the tail that is not signed.
+  ASSERT_LT(literal, 8 * block_size);
+}
+
+TEST(delta, nothing_matches) {
+  std::string old = random_data(100000, 3);
+  std::string now = random_data(100000, 4);
+  size_t block_size = DeltaBlockSize(old.size());
+  std::vector<DeltaOp> ops = ComputeDelta(reinterpret_cast<const uint8_t*>(now.data()),
+                                          now.size(), block_size, sign(old, block_size));
+  ASSERT_EQ(1U, ops.size());
+  ASSERT_FALSE(ops[0].copy);
+  ASSERT_EQ(now.size(), ops[0].len);
+}
+
+TEST(delta, no_signatures) {
+  std::string now = random_data(5000, 5);
+  std::vector<DeltaOp> ops = ComputeDelta(reinterpret_cast<const uint8_t*>(now.data()),
+                                          now.size(), 2048, std::vector<BlockSignature>());
+  size_t literal;
+  ASSERT_EQ(now, apply(now, now, 2048, ops, &literal));
+  ASSERT_EQ(now.size(), literal);
+}
@@ -75,6 +75,7 @@ void listener_event_func(int _fd, unsigned ev, void* _l)
         s = create_local_socket(fd);
         if (s) {
             s->transport = listener->transport;
+            local_socket_coalesce(s, listener->connect_to);
             connect_to_remote(s, listener->connect_to);
             return;
         }
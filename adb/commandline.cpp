@@ -32,6 +32,7 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 #include <base/stringprintf.h>
 
@@ -43,9 +44,11 @@
 #include "adb.h"
 #include "adb_auth.h"
 #include "adb_client.h"
+#include "adb_compress.h"
 #include "adb_io.h"
 #include "adb_utils.h"
 #include "file_sync_service.h"
+#include "framebuffer_service.h"
 
 static int install_app(transport_type t, const char* serial, int argc, const char** argv);
 static int install_multiple_app(transport_type t, const char* serial, int argc, const char** argv);
@@ -92,27 +95,34 @@ static void help() {
         " -H                            - Name of adb server host (default: localhost)\n"
         " -P                            - Port of adb server (default: 5037)\n"
         " devices [-l]                  - list all connected devices\n"
-        "                                 ('-l' will also list device qualifiers)\n"
-        " connect <host>[:<port>]       - connect to a device via TCP/IP\n"
+        "                                 ('-l' will also list device qualifiers, and bytes\n"
+        "                                 transferred and stalls once there are any)\n"
+        " connect [-n <connections>] <host>[:<port>]\n"
+        "                               - connect to a device via TCP/IP\n"
         "                                 Port 5555 is used by default if no port number is specified.\n"
+        "                                 ('-n' stripes the connection over up to that many\n"
+        "                                 TCP connections, where the device supports it)\n"
         " disconnect [<host>[:<port>]]  - disconnect from a TCP/IP device.\n"
         "                                 Port 5555 is used by default if no port number is specified.\n"
         "                                 Using this command with no additional arguments\n"
         "                                 will disconnect from all connected TCP/IP devices.\n"
         "\n"
         "device commands:\n"
-        "  adb push [-p] <local> <remote>\n"
+        "  adb push [-p] [-Z] <local> <remote>\n"
         "                               - copy file/dir to device\n"
         "                                 ('-p' to display the transfer progress)\n"
-        "  adb pull [-p] [-a] <remote> [<local>]\n"
+        "                                 ('-Z' to not compress the transfer)\n"
+        "  adb pull [-p] [-a] [-Z] <remote> [<local>]\n"
         "                               - copy file/dir from device\n"
         "                                 ('-p' to display the transfer progress)\n"
         "                                 ('-a' means copy timestamp and mode)\n"
+        "                                 ('-Z' to not compress the transfer)\n"
         "  adb sync [ <directory> ]     - copy host->device only if changed\n"
         "                                 (-l means list but don't copy)\n"
         "                                 (see 'adb help all')\n"
         "  adb shell                    - run remote shell interactively\n"
-        "  adb shell <command>          - run remote shell command\n"
+        "  adb shell [-Z] <command>     - run remote shell command\n"
+        "                                 ('-Z' to not compress the output)\n"
         "  adb emu <command>            - run emulator console command\n"
         "  adb logcat [ <filter-spec> ] - View device log\n"
         "  adb forward --list           - list all forward socket connections.\n"
@@ -146,7 +156,7 @@ static void help() {
         "  adb reverse --remove-all     - remove all reversed socket connections from device\n"
         "  adb jdwp                     - list PIDs of processes hosting a JDWP transport\n"
         "  adb install [-lrtsdg] <file>\n"
-        "                               - push this package file to the device and install it\n"
+        "                               - stream this package file to the device and install it\n"
         "                                 (-l: forward lock application)\n"
         "                                 (-r: replace existing application)\n"
         "                                 (-t: allow test packages)\n"
@@ -166,6 +176,13 @@ static void help() {
         "                                 ('-k' means keep the data and cache directories)\n"
         "  adb bugreport                - return all information from the device\n"
         "                                 that should be included in a bug report.\n"
+        "  adb framebuffer-stream [-Z] [-r <fps>] [-n <frames>]\n"
+        "                               - write screen captures to stdout as they change, each\n"
+        "                                 a raw image header and its pixels; only changed tiles\n"
+        "                                 cross the wire\n"
+        "                                 (-Z: disable compression)\n"
+        "                                 (-r: frames per second, default 10)\n"
+        "                                 (-n: stop after this many frames)\n"
         "\n"
         "  adb backup [-f <file>] [-apk|-noapk] [-obb|-noobb] [-shared|-noshared] [-all] [-system|-nosystem] [<packages...>]\n"
         "                               - write an archive of the device's data to <file>.\n"
@@ -204,6 +221,8 @@ static void help() {
         "  adb get-state                - prints: offline | bootloader | device\n"
         "  adb get-serialno             - prints: <serial-number>\n"
         "  adb get-devpath              - prints: <device-path>\n"
+        "  adb transport-stats          - prints packet counts, write latencies and stalls\n"
+        "                                 of each transport, or of the one selected by -s\n"
         "  adb remount                  - remounts the /system, /vendor (if present) and /oem (if present) partitions on the device read-write\n"
         "  adb reboot [bootloader|recovery]\n"
         "                               - reboots the device, optionally into the bootloader or recovery program.\n"
@@ -271,7 +290,9 @@ static void stdin_raw_restore(int fd) {
 }
 #endif
 
-static void read_and_dump(int fd) {
+// Copies fd to stdout, inflating what is read if an inflater is given.
+static void read_and_dump(int fd, StreamInflater* inflater = nullptr) {
+    std::string inflated;
     while (fd >= 0) {
         D("read_and_dump(): pre adb_read(fd=%d)\n", fd);
         char buf[BUFSIZ];
@@ -281,9 +302,120 @@ static void read_and_dump(int fd) {
             break;
         }
 
-        fwrite(buf, 1, len, stdout);
+        if (inflater != nullptr) {
+            if (!inflater->Inflate(buf, len, &inflated)) {
+                fprintf(stderr, "error: corrupt compressed output\n");
+                break;
+            }
+            fwrite(inflated.data(), 1, inflated.size(), stdout);
+        } else {
+            fwrite(buf, 1, len, stdout);
+        }
+        fflush(stdout);
+    }
+}
+
+// Connects to service ("shell" or "exec") to run command. If *compress is
+// set the output is asked for compressed, through "shell,z:" or "exec,z:".
+// Devices that do not compress refuse those, the plain service is used then
+// and *compress cleared.
+static int adb_connect_command_output(const char* service, const std::string& command,
+                                      bool* compress, std::string* error) {
+    if (*compress) {
+        int fd = adb_connect(android::base::StringPrintf("%s,z:%s", service, command.c_str()),
+                             error);
+        if (fd >= 0) {
+            return fd;
+        }
+        D("%s,z: refused (%s), not compressing\n", service, error->c_str());
+        *compress = false;
+    }
+    return adb_connect(android::base::StringPrintf("%s:%s", service, command.c_str()), error);
+}
+
+/* Reassembles the frames of framebuffer-stream, writing each out whole. */
+static int framebuffer_stream(int argc, const char** argv) {
+    bool compress = true;
+    int fps = 10;
+    long frames = -1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-Z")) {
+            compress = false;
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            fps = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else {
+            return usage();
+        }
+    }
+
+    std::string error;
+    int fd = adb_connect_command_output("framebuffer-stream", android::base::StringPrintf("%d", fps), &compress,
+                                        &error);
+    if (fd < 0) {
+        fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    fbinfo info;
+    if (!ReadFdExactly(fd, &info, sizeof(info))) {
+        fprintf(stderr, "error: no frames, is screencap there?\n");
+        adb_close(fd);
+        return 1;
+    }
+    size_t pixel = info.bpp / 8;
+    size_t stride = info.width * pixel;
+    std::vector<char> frame(info.size);
+    std::vector<char> data, raw;
+
+    int ret = 0;
+    while (frames != 0) {
+        fbframe header;
+        if (!ReadFdExactly(fd, &header, sizeof(header))) break;
+        if (header.magic != FB_FRAME_MAGIC) {
+            fprintf(stderr, "error: bad framebuffer-stream frame\n");
+            ret = 1;
+            break;
+        }
+
+        for (uint32_t i = 0; i < header.tiles; i++) {
+            fbtile tile;
+            if (!ReadFdExactly(fd, &tile, sizeof(tile))) goto done;
+            size_t row = tile.width * pixel;
+            if (tile.x + tile.width > info.width || tile.y + tile.height > info.height ||
+                tile.rawsize != row * tile.height || tile.size > tile.rawsize) {
+                fprintf(stderr, "error: bad framebuffer-stream tile\n");
+                ret = 1;
+                goto done;
+            }
+            data.resize(tile.size);
+            if (!ReadFdExactly(fd, data.data(), data.size())) goto done;
+            if (tile.size < tile.rawsize) {
+                raw.resize(tile.rawsize);
+                if (!UncompressChunk(data.data(), data.size(), raw.data(), raw.size())) {
+                    fprintf(stderr, "error: corrupt framebuffer-stream tile\n");
+                    ret = 1;
+                    goto done;
+                }
+                data.swap(raw);
+            }
+            for (uint32_t r = 0; r < tile.height; r++) {
+                memcpy(&frame[(tile.y + r) * stride + tile.x * pixel], &data[r * row], row);
+            }
+        }
+
+        if (fwrite(&info, sizeof(info), 1, stdout) != 1 ||
+            fwrite(frame.data(), 1, frame.size(), stdout) != frame.size()) {
+            break;
+        }
         fflush(stdout);
+        if (frames > 0) frames--;
     }
+
+done:
+    adb_close(fd);
+    return ret;
 }
 
 static void read_status_line(int fd, char* buf, size_t count)
@@ -304,12 +436,13 @@ static void read_status_line(int fd, char* buf, size_t count)
     *buf = '\0';
 }
 
-static void copy_to_file(int inFd, int outFd) {
+static void copy_to_file(int inFd, int outFd, StreamInflater* inflater = nullptr) {
     const size_t BUFSIZE = 32 * 1024;
     char* buf = (char*) malloc(BUFSIZE);
     if (buf == nullptr) fatal("couldn't allocate buffer for copy_to_file");
     int len;
     long total = 0;
+    std::string inflated;
 
     D("copy_to_file(%d -> %d)\n", inFd, outFd);
 
@@ -335,7 +468,18 @@ static void copy_to_file(int inFd, int outFd) {
             D("copy_to_file() : error %d\n", errno);
             break;
         }
-        if (outFd == STDOUT_FILENO) {
+        if (inflater != nullptr) {
+            if (!inflater->Inflate(buf, len, &inflated)) {
+                fprintf(stderr, "error: corrupt compressed output\n");
+                break;
+            }
+            if (outFd == STDOUT_FILENO) {
+                fwrite(inflated.data(), 1, inflated.size(), stdout);
+                fflush(stdout);
+            } else {
+                adb_write(outFd, inflated.data(), inflated.size());
+            }
+        } else if (outFd == STDOUT_FILENO) {
             fwrite(buf, 1, len, stdout);
             fflush(stdout);
         } else {
@@ -901,15 +1045,18 @@ static std::string find_product_out_path(const char* hint) {
 
 static void parse_push_pull_args(const char **arg, int narg, char const **path1,
                                  char const **path2, int *show_progress,
-                                 int *copy_attrs) {
+                                 int *copy_attrs, bool *compress) {
     *show_progress = 0;
     *copy_attrs = 0;
+    *compress = true;
 
     while (narg > 0) {
         if (!strcmp(*arg, "-p")) {
             *show_progress = 1;
         } else if (!strcmp(*arg, "-a")) {
             *copy_attrs = 1;
+        } else if (!strcmp(*arg, "-Z")) {
+            *compress = false;
         } else {
             break;
         }
@@ -1125,12 +1272,21 @@ int adb_commandline(int argc, const char **argv) {
         return adb_query_command(query);
     }
     else if (!strcmp(argv[0], "connect")) {
-        if (argc != 2) {
-            fprintf(stderr, "Usage: adb connect <host>[:<port>]\n");
+        int stripes = 1;
+        if (argc == 4 && !strcmp(argv[1], "-n")) {
+            stripes = atoi(argv[2]);
+            argc -= 2;
+            argv += 2;
+        }
+        if (argc != 2 || stripes < 1) {
+            fprintf(stderr, "Usage: adb connect [-n <connections>] <host>[:<port>]\n");
             return 1;
         }
 
         std::string query = android::base::StringPrintf("host:connect:%s", argv[1]);
+        if (stripes > 1) {
+            query += android::base::StringPrintf(",%d", stripes);
+        }
         return adb_query_command(query);
     }
     else if (!strcmp(argv[0], "disconnect")) {
@@ -1164,9 +1320,16 @@ int adb_commandline(int argc, const char **argv) {
             return r;
         }
 
-        std::string cmd = "shell:";
+        bool compress = true;
         --argc;
         ++argv;
+        if (!strcmp(*argv, "-Z") && argc > 1) {
+            compress = false;
+            --argc;
+            ++argv;
+        }
+
+        std::string cmd;
         while (argc-- > 0) {
             // We don't escape here, just like ssh(1). http://b/20564385.
             cmd += *argv++;
@@ -1176,11 +1339,12 @@ int adb_commandline(int argc, const char **argv) {
         while (true) {
             D("interactive shell loop. cmd=%s\n", cmd.c_str());
             std::string error;
-            int fd = adb_connect(cmd, &error);
+            int fd = adb_connect_command_output("shell", cmd, &compress, &error);
             int r;
             if (fd >= 0) {
                 D("about to read_and_dump(fd=%d)\n", fd);
-                read_and_dump(fd);
+                StreamInflater inflater;
+                read_and_dump(fd, compress ? &inflater : nullptr);
                 D("read_and_dump() done.\n");
                 adb_close(fd);
                 r = 0;
@@ -1206,8 +1370,16 @@ int adb_commandline(int argc, const char **argv) {
     else if (!strcmp(argv[0], "exec-in") || !strcmp(argv[0], "exec-out")) {
         int exec_in = !strcmp(argv[0], "exec-in");
 
-        std::string cmd = "exec:";
-        cmd += argv[1];
+        // Only output is compressed, exec-in always goes as it is.
+        bool compress = !exec_in;
+        if (argc > 2 && !strcmp(argv[1], "-Z")) {
+            compress = false;
+            --argc;
+            ++argv;
+        }
+        if (argc < 2) return usage();
+
+        std::string cmd = argv[1];
         argc -= 2;
         argv += 2;
         while (argc-- > 0) {
@@ -1215,7 +1387,7 @@ int adb_commandline(int argc, const char **argv) {
         }
 
         std::string error;
-        int fd = adb_connect(cmd, &error);
+        int fd = adb_connect_command_output("exec", cmd, &compress, &error);
         if (fd < 0) {
             fprintf(stderr, "error: %s\n", error.c_str());
             return -1;
@@ -1224,12 +1396,16 @@ int adb_commandline(int argc, const char **argv) {
         if (exec_in) {
             copy_to_file(STDIN_FILENO, fd);
         } else {
-            copy_to_file(fd, STDOUT_FILENO);
+            StreamInflater inflater;
+            copy_to_file(fd, STDOUT_FILENO, compress ? &inflater : nullptr);
         }
 
         adb_close(fd);
         return 0;
     }
+    else if (!strcmp(argv[0], "framebuffer-stream")) {
+        return framebuffer_stream(argc, argv);
+    }
     else if (!strcmp(argv[0], "kill-server")) {
         std::string error;
         int fd = _adb_connect("host:kill", &error);
@@ -1363,12 +1539,14 @@ int adb_commandline(int argc, const char **argv) {
     else if (!strcmp(argv[0], "push")) {
         int show_progress = 0;
         int copy_attrs = 0; // unused
+        bool compress = true;
         const char* lpath = NULL, *rpath = NULL;
 
-        parse_push_pull_args(&argv[1], argc - 1, &lpath, &rpath, &show_progress, &copy_attrs);
+        parse_push_pull_args(&argv[1], argc - 1, &lpath, &rpath, &show_progress, &copy_attrs,
+                             &compress);
 
         if ((lpath != NULL) && (rpath != NULL)) {
-            return do_sync_push(lpath, rpath, show_progress);
+            return do_sync_push(lpath, rpath, show_progress, compress);
         }
 
         return usage();
@@ -1376,12 +1554,14 @@ int adb_commandline(int argc, const char **argv) {
     else if (!strcmp(argv[0], "pull")) {
         int show_progress = 0;
         int copy_attrs = 0;
+        bool compress = true;
         const char* rpath = NULL, *lpath = ".";
 
-        parse_push_pull_args(&argv[1], argc - 1, &rpath, &lpath, &show_progress, &copy_attrs);
+        parse_push_pull_args(&argv[1], argc - 1, &rpath, &lpath, &show_progress, &copy_attrs,
+                             &compress);
 
         if (rpath != NULL) {
-            return do_sync_pull(rpath, lpath, show_progress, copy_attrs);
+            return do_sync_pull(rpath, lpath, show_progress, copy_attrs, compress);
         }
 
         return usage();
@@ -1446,7 +1626,8 @@ int adb_commandline(int argc, const char **argv) {
     /* passthrough commands */
     else if (!strcmp(argv[0],"get-state") ||
         !strcmp(argv[0],"get-serialno") ||
-        !strcmp(argv[0],"get-devpath"))
+        !strcmp(argv[0],"get-devpath") ||
+        !strcmp(argv[0],"transport-stats"))
     {
         return adb_query_command(format_host_command(argv[0], ttype, serial));
     }
@@ -1536,97 +1717,19 @@ static const char* get_basename(const char* filename)
     }
 }
 
-static int install_app(transport_type transport, const char* serial, int argc,
-                       const char** argv)
+/* Creates a package manager install session for total_size bytes of APKs,
+** passing it the options in argv[1, end). Returns its id, or -1 with the
+** device's reply in buf if it could not.
+*/
+static int create_install_session(uint64_t total_size, int end, const char** argv,
+                                  char* buf, size_t buf_size)
 {
-    static const char *const DATA_DEST = "/data/local/tmp/%s";
-    static const char *const SD_DEST = "/sdcard/tmp/%s";
-    const char* where = DATA_DEST;
-    int i;
-    struct stat sb;
-
-    for (i = 1; i < argc; i++) {
-        if (!strcmp(argv[i], "-s")) {
-            where = SD_DEST;
-        }
-    }
-
-    // Find last APK argument.
-    // All other arguments passed through verbatim.
-    int last_apk = -1;
-    for (i = argc - 1; i >= 0; i--) {
-        const char* file = argv[i];
-        char* dot = strrchr(file, '.');
-        if (dot && !strcasecmp(dot, ".apk")) {
-            if (stat(file, &sb) == -1 || !S_ISREG(sb.st_mode)) {
-                fprintf(stderr, "Invalid APK file: %s\n", file);
-                return -1;
-            }
-
-            last_apk = i;
-            break;
-        }
-    }
-
-    if (last_apk == -1) {
-        fprintf(stderr, "Missing APK file\n");
-        return -1;
-    }
-
-    const char* apk_file = argv[last_apk];
-    char apk_dest[PATH_MAX];
-    snprintf(apk_dest, sizeof apk_dest, where, get_basename(apk_file));
-    int err = do_sync_push(apk_file, apk_dest, 0 /* no show progress */);
-    if (err) {
-        goto cleanup_apk;
-    } else {
-        argv[last_apk] = apk_dest; /* destination name, not source location */
-    }
-
-    err = pm_command(transport, serial, argc, argv);
-
-cleanup_apk:
-    delete_file(transport, serial, apk_dest);
-    return err;
-}
-
-static int install_multiple_app(transport_type transport, const char* serial, int argc,
-                                const char** argv)
-{
-    int i;
-    struct stat sb;
-    uint64_t total_size = 0;
-
-    // Find all APK arguments starting at end.
-    // All other arguments passed through verbatim.
-    int first_apk = -1;
-    for (i = argc - 1; i >= 0; i--) {
-        const char* file = argv[i];
-        char* dot = strrchr(file, '.');
-        if (dot && !strcasecmp(dot, ".apk")) {
-            if (stat(file, &sb) == -1 || !S_ISREG(sb.st_mode)) {
-                fprintf(stderr, "Invalid APK file: %s\n", file);
-                return -1;
-            }
-
-            total_size += sb.st_size;
-            first_apk = i;
-        } else {
-            break;
-        }
-    }
-
-    if (first_apk == -1) {
-        fprintf(stderr, "Missing APK file\n");
-        return 1;
-    }
-
 #if defined(_WIN32) // Remove when we're using clang for Win32.
     std::string cmd = android::base::StringPrintf("exec:pm install-create -S %u", (unsigned) total_size);
 #else
     std::string cmd = android::base::StringPrintf("exec:pm install-create -S %" PRIu64, total_size);
 #endif
-    for (i = 1; i < first_apk; i++) {
+    for (int i = 1; i < end; i++) {
         cmd += " " + escape_arg(argv[i]);
     }
 
@@ -1634,11 +1737,10 @@ static int install_multiple_app(transport_type transport, const char* serial, in
     std::string error;
     int fd = adb_connect(cmd, &error);
     if (fd < 0) {
-        fprintf(stderr, "Connect error for create: %s\n", error.c_str());
+        snprintf(buf, buf_size, "Connect error for create: %s\n", error.c_str());
         return -1;
     }
-    char buf[BUFSIZ];
-    read_status_line(fd, buf, sizeof(buf));
+    read_status_line(fd, buf, buf_size);
     adb_close(fd);
 
     int session_id = -1;
@@ -1650,15 +1752,21 @@ static int install_multiple_app(transport_type transport, const char* serial, in
             session_id = strtol(start + 1, NULL, 10);
         }
     }
-    if (session_id < 0) {
-        fprintf(stderr, "Failed to create session\n");
-        fputs(buf, stderr);
-        return -1;
-    }
+    return session_id;
+}
+
+/* Streams the APKs in argv[first_apk, end) straight into the install
+** session, then commits it, or abandons it if any of them failed.
+*/
+static int write_install_session(int session_id, int first_apk, int end, const char** argv)
+{
+    char buf[BUFSIZ];
+    struct stat sb;
+    int i;
 
     // Valid session, now stream the APKs
     int success = 1;
-    for (i = first_apk; i < argc; i++) {
+    for (i = first_apk; i < end; i++) {
         const char* file = argv[i];
         if (stat(file, &sb) == -1) {
             fprintf(stderr, "Failed to stat %s\n", file);
@@ -1711,7 +1819,8 @@ finalize_session:
     std::string service =
             android::base::StringPrintf("exec:pm install-%s %d",
                                         success ? "commit" : "abandon", session_id);
-    fd = adb_connect(service, &error);
+    std::string error;
+    int fd = adb_connect(service, &error);
     if (fd < 0) {
         fprintf(stderr, "Connect error for finalize: %s\n", error.c_str());
         return -1;
@@ -1721,10 +1830,115 @@ finalize_session:
 
     if (!strncmp("Success", buf, 7)) {
         fputs(buf, stderr);
-        return 0;
+        return success ? 0 : -1;
     } else {
         fprintf(stderr, "Failed to finalize session\n");
         fputs(buf, stderr);
         return -1;
     }
 }
+
+static int install_app(transport_type transport, const char* serial, int argc,
+                       const char** argv)
+{
+    static const char *const DATA_DEST = "/data/local/tmp/%s";
+    static const char *const SD_DEST = "/sdcard/tmp/%s";
+    const char* where = DATA_DEST;
+    int i;
+    struct stat sb;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-s")) {
+            where = SD_DEST;
+        }
+    }
+
+    // Find last APK argument.
+    // All other arguments passed through verbatim.
+    int last_apk = -1;
+    for (i = argc - 1; i >= 0; i--) {
+        const char* file = argv[i];
+        char* dot = strrchr(file, '.');
+        if (dot && !strcasecmp(dot, ".apk")) {
+            if (stat(file, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+                fprintf(stderr, "Invalid APK file: %s\n", file);
+                return -1;
+            }
+
+            last_apk = i;
+            break;
+        }
+    }
+
+    if (last_apk == -1) {
+        fprintf(stderr, "Missing APK file\n");
+        return -1;
+    }
+
+    // Stream the APK straight into an install session where the device
+    // has them, rather than pushing a copy to install from.
+    char buf[BUFSIZ];
+    int session_id = create_install_session(sb.st_size, last_apk, argv, buf, sizeof(buf));
+    if (session_id >= 0) {
+        return write_install_session(session_id, last_apk, last_apk + 1, argv);
+    }
+    D("no install session (%s), pushing the APK instead\n", buf);
+
+    const char* apk_file = argv[last_apk];
+    char apk_dest[PATH_MAX];
+    snprintf(apk_dest, sizeof apk_dest, where, get_basename(apk_file));
+    int err = do_sync_push(apk_file, apk_dest, 0 /* no show progress */, true);
+    if (err) {
+        goto cleanup_apk;
+    } else {
+        argv[last_apk] = apk_dest; /* destination name, not source location */
+    }
+
+    err = pm_command(transport, serial, argc, argv);
+
+cleanup_apk:
+    delete_file(transport, serial, apk_dest);
+    return err;
+}
+
+static int install_multiple_app(transport_type transport, const char* serial, int argc,
+                                const char** argv)
+{
+    int i;
+    struct stat sb;
+    uint64_t total_size = 0;
+
+    // Find all APK arguments starting at end.
+    // All other arguments passed through verbatim.
+    int first_apk = -1;
+    for (i = argc - 1; i >= 0; i--) {
+        const char* file = argv[i];
+        char* dot = strrchr(file, '.');
+        if (dot && !strcasecmp(dot, ".apk")) {
+            if (stat(file, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+                fprintf(stderr, "Invalid APK file: %s\n", file);
+                return -1;
+            }
+
+            total_size += sb.st_size;
+            first_apk = i;
+        } else {
+            break;
+        }
+    }
+
+    if (first_apk == -1) {
+        fprintf(stderr, "Missing APK file\n");
+        return 1;
+    }
+
+    char buf[BUFSIZ];
+    int session_id = create_install_session(total_size, first_apk, argv, buf, sizeof(buf));
+    if (session_id < 0) {
+        fprintf(stderr, "Failed to create session\n");
+        fputs(buf, stderr);
+        return -1;
+    }
+
+    return write_install_session(session_id, first_apk, argc, argv);
+}
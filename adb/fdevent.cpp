@@ -30,6 +30,10 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
 #include "adb_io.h"
 #include "adb_trace.h"
 
@@ -77,6 +81,10 @@ static void dump_fde(fdevent *fde, const char *info)
 #define FDE_ACTIVE     0x0100
 #define FDE_PENDING    0x0200
 #define FDE_CREATED    0x0400
+#define FDE_UNPOLLABLE 0x0800  /* refused by the kernel event queue */
+#define FDE_WATCHED    0x1000  /* in the epoll set */
+#define FDE_WATCHED_READ  0x1000  /* kqueue filters registered */
+#define FDE_WATCHED_WRITE 0x2000
 
 static void fdevent_plist_enqueue(fdevent *node);
 static void fdevent_plist_remove(fdevent *node);
@@ -92,145 +100,334 @@ static fdevent list_pending = {
     .events = 0,
     .func = nullptr,
     .arg = nullptr,
+    .deadline = 0,
 };
 
 static fdevent **fd_table = 0;
 static int fd_table_max = 0;
 
-#ifdef CRAPTASTIC
-//HAVE_EPOLL
+/* fdevents with a timeout set; there are only ever a few */
+static std::vector<fdevent*>& timed_fdes = *new std::vector<fdevent*>();
 
-#include <sys/epoll.h>
+static int64_t fdevent_now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-static int epoll_fd = -1;
+/* how long the backend may wait for events, -1 for as long as it takes */
+static int fdevent_wait_ms()
+{
+    if(timed_fdes.empty()) return -1;
 
-static void fdevent_init()
+    int64_t next = timed_fdes[0]->deadline;
+    for(fdevent* fde : timed_fdes) {
+        next = std::min(next, fde->deadline);
+    }
+    int64_t wait = next - fdevent_now_ms();
+    return wait < 0 ? 0 : static_cast<int>(std::min<int64_t>(wait, INT32_MAX));
+}
+
+static void fdevent_expire_timeouts()
 {
-        /* XXX: what's a good size for the passed in hint? */
-    epoll_fd = epoll_create(256);
+    if(timed_fdes.empty()) return;
 
-    if(epoll_fd < 0) {
-        perror("epoll_create() failed");
-        exit(1);
+    int64_t now = fdevent_now_ms();
+    for(size_t i = 0; i < timed_fdes.size(); ) {
+        fdevent *fde = timed_fdes[i];
+        if(fde->deadline > now) {
+            i++;
+            continue;
+        }
+        fde->deadline = 0;
+        timed_fdes.erase(timed_fdes.begin() + i);
+
+        fde->events |= FDE_TIMEOUT;
+        if(!(fde->state & FDE_PENDING)) {
+            fde->state |= FDE_PENDING;
+            fdevent_plist_enqueue(fde);
+        }
     }
+}
 
-        /* mark for close-on-exec */
-    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+#if defined(__linux__) && !defined(ADB_FDEVENT_SELECT)
+#define FDEVENT_EPOLL 1
+#elif defined(__APPLE__) && !defined(ADB_FDEVENT_SELECT)
+#define FDEVENT_KQUEUE 1
+#endif
+
+#if FDEVENT_EPOLL || FDEVENT_KQUEUE
+
+/* Kernel event queue backends. Only fds with events wanted are known to
+** the kernel; an fd the kernel refuses to watch (a regular file, for
+** one) is marked FDE_UNPOLLABLE and treated as always ready, which is
+** what select() does for such fds.
+**
+** The kernel reports fds rather than fdevents, and these are looked up
+** in fd_table, so a report racing with fdevent_remove() goes nowhere.
+*/
+
+static int unpollable_count = 0;
+
+static void fdevent_signal(fdevent *fde, unsigned events)
+{
+    fde->events |= events;
+    D("got events fde->fd=%d events=%04x, state=%04x\n",
+      fde->fd, fde->events, fde->state);
+    if(fde->state & FDE_PENDING) return;
+    fde->state |= FDE_PENDING;
+    fdevent_plist_enqueue(fde);
 }
 
-static void fdevent_connect(fdevent *fde)
+static fdevent *fdevent_lookup(int fd)
 {
-    struct epoll_event ev;
+    if((fd < 0) || (fd >= fd_table_max)) return 0;
+    fdevent *fde = fd_table[fd];
+    if((fde == 0) || !(fde->state & FDE_ACTIVE)) return 0;
+    return fde;
+}
 
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
+static void fdevent_set_unpollable(fdevent *fde, bool unpollable)
+{
+    if(unpollable == !!(fde->state & FDE_UNPOLLABLE)) return;
+    if(unpollable) {
+        D("fd %d can not be polled, treating it as always ready\n", fde->fd);
+        fde->state |= FDE_UNPOLLABLE;
+        unpollable_count++;
+    } else {
+        fde->state &= ~FDE_UNPOLLABLE;
+        unpollable_count--;
+    }
+}
 
-#if 0
-    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-        perror("epoll_ctl() failed\n");
-        exit(1);
+static void fdevent_signal_unpollable()
+{
+    for(int i = 0; i < fd_table_max; i++) {
+        fdevent *fde = fd_table[i];
+        if(fde && (fde->state & FDE_UNPOLLABLE)) {
+            unsigned events = fde->state & (FDE_READ | FDE_WRITE);
+            if(events) fdevent_signal(fde, events);
+        }
     }
-#endif
 }
 
-static void fdevent_disconnect(fdevent *fde)
+/* Error and hangup conditions are reported on whatever is being waited
+** for, the read or write then fails and the owner cleans up.
+*/
+static unsigned fdevent_error_events(fdevent *fde)
 {
-    struct epoll_event ev;
+    return fde->state & (FDE_READ | FDE_WRITE | FDE_ERROR);
+}
 
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
+#endif
 
-        /* technically we only need to delete if we
-        ** were actively monitoring events, but let's
-        ** be aggressive and do it anyway, just in case
-        ** something's out of sync
-        */
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev);
+#if FDEVENT_EPOLL
+
+#include <sys/epoll.h>
+
+static int epoll_fd = -1;
+
+static void fdevent_init()
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0) {
+        FATAL("epoll_create1() failed: %s\n", strerror(errno));
+    }
+}
+
+static void fdevent_connect(fdevent * /* fde */)
+{
+}
+
+static void fdevent_disconnect(fdevent *fde)
+{
+    fdevent_set_unpollable(fde, false);
+    if(fde->state & FDE_WATCHED) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, NULL);
+        fde->state &= ~FDE_WATCHED;
+    }
 }
 
 static void fdevent_update(fdevent *fde, unsigned events)
 {
     struct epoll_event ev;
-    int active;
-
-    active = (fde->state & FDE_EVENTMASK) != 0;
 
     memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
-
+    ev.data.fd = fde->fd;
     if(events & FDE_READ) ev.events |= EPOLLIN;
     if(events & FDE_WRITE) ev.events |= EPOLLOUT;
-    if(events & FDE_ERROR) ev.events |= (EPOLLERR | EPOLLHUP);
+    if(events & FDE_EDGE) ev.events |= EPOLLET;
+    /* EPOLLERR and EPOLLHUP are always reported */
 
     fde->state = (fde->state & FDE_STATEMASK) | events;
 
-    if(active) {
-            /* we're already active. if we're changing to *no*
-            ** events being monitored, we need to delete, otherwise
-            ** we need to just modify
+    if(fde->state & FDE_UNPOLLABLE) return;
+
+    if(!(events & (FDE_READ | FDE_WRITE | FDE_ERROR))) {
+            /* a hung up fd would be reported over and over,
+            ** so drop it from the set instead of clearing events
             */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        } else {
+        if(fde->state & FDE_WATCHED) {
             if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
+                FATAL("epoll_ctl(DEL, %d) failed: %s\n", fde->fd, strerror(errno));
             }
+            fde->state &= ~FDE_WATCHED;
         }
+        return;
+    }
+
+    int op = (fde->state & FDE_WATCHED) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if(epoll_ctl(epoll_fd, op, fde->fd, &ev) == 0) {
+        fde->state |= FDE_WATCHED;
+    } else if(errno == EPERM) {
+        fdevent_set_unpollable(fde, true);
     } else {
-            /* we're not active.  if we're watching events, we need
-            ** to add, otherwise we can just do nothing
-            */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        }
+        FATAL("epoll_ctl(%d) failed: %s\n", fde->fd, strerror(errno));
     }
 }
 
 static void fdevent_process()
 {
     struct epoll_event events[256];
-    fdevent *fde;
     int i, n;
 
-    n = epoll_wait(epoll_fd, events, 256, -1);
+    n = epoll_wait(epoll_fd, events, 256, unpollable_count ? 0 : fdevent_wait_ms());
+    D("epoll_wait() returned n=%d, errno=%d\n", n, n<0?errno:0);
 
     if(n < 0) {
         if(errno == EINTR) return;
-        perror("epoll_wait");
-        exit(1);
+        FATAL("epoll_wait() failed: %s\n", strerror(errno));
     }
 
     for(i = 0; i < n; i++) {
         struct epoll_event *ev = events + i;
-        fde = ev->data.ptr;
+        fdevent *fde = fdevent_lookup(ev->data.fd);
+        unsigned got = 0;
 
-        if(ev->events & EPOLLIN) {
-            fde->events |= FDE_READ;
-        }
-        if(ev->events & EPOLLOUT) {
-            fde->events |= FDE_WRITE;
-        }
-        if(ev->events & (EPOLLERR | EPOLLHUP)) {
-            fde->events |= FDE_ERROR;
-        }
-        if(fde->events) {
-            if(fde->state & FDE_PENDING) continue;
-            fde->state |= FDE_PENDING;
-            fdevent_plist_enqueue(fde);
+        if(fde == 0) continue;
+
+        if(ev->events & EPOLLIN) got |= FDE_READ;
+        if(ev->events & EPOLLOUT) got |= FDE_WRITE;
+        if(ev->events & (EPOLLERR | EPOLLHUP)) got |= fdevent_error_events(fde);
+
+        if(got) fdevent_signal(fde, got);
+    }
+
+    if(unpollable_count) fdevent_signal_unpollable();
+}
+
+#elif FDEVENT_KQUEUE
+
+#include <sys/event.h>
+
+static int kqueue_fd = -1;
+
+static void fdevent_init()
+{
+    kqueue_fd = kqueue();
+    if(kqueue_fd < 0) {
+        FATAL("kqueue() failed: %s\n", strerror(errno));
+    }
+    fcntl(kqueue_fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void fdevent_connect(fdevent * /* fde */)
+{
+}
+
+static void fdevent_disconnect(fdevent *fde)
+{
+    struct kevent changes[2];
+    int n = 0;
+
+    fdevent_set_unpollable(fde, false);
+    if(fde->state & FDE_WATCHED_READ) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    }
+    if(fde->state & FDE_WATCHED_WRITE) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    }
+    if(n) kevent(kqueue_fd, changes, n, NULL, 0, NULL);
+    fde->state &= ~(FDE_WATCHED_READ | FDE_WATCHED_WRITE);
+}
+
+static void fdevent_update(fdevent *fde, unsigned events)
+{
+    struct kevent changes[2];
+    int n = 0;
+    u_short flags = EV_ADD | ((events & FDE_EDGE) ? EV_CLEAR : 0);
+
+    fde->state = (fde->state & FDE_STATEMASK) | events;
+
+    if(fde->state & FDE_UNPOLLABLE) return;
+
+        /* there is no filter for errors alone, they come with
+        ** EV_EOF on the read and write filters
+        */
+    if(events & FDE_READ) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_READ, flags, 0, 0, NULL);
+    } else if(fde->state & FDE_WATCHED_READ) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    }
+    if(events & FDE_WRITE) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_WRITE, flags, 0, 0, NULL);
+    } else if(fde->state & FDE_WATCHED_WRITE) {
+        EV_SET(&changes[n++], fde->fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    }
+
+    if(n && kevent(kqueue_fd, changes, n, NULL, 0, NULL)) {
+        if(errno != EINVAL && errno != ENODEV && errno != EPERM) {
+            FATAL("kevent(%d) failed: %s\n", fde->fd, strerror(errno));
         }
+        fdevent_disconnect(fde);
+        fdevent_set_unpollable(fde, true);
+        return;
     }
+
+    fde->state &= ~(FDE_WATCHED_READ | FDE_WATCHED_WRITE);
+    if(events & FDE_READ) fde->state |= FDE_WATCHED_READ;
+    if(events & FDE_WRITE) fde->state |= FDE_WATCHED_WRITE;
 }
 
+static void fdevent_process()
+{
+    struct kevent events[256];
+    struct timespec timeout = { 0, 0 };
+    int wait_ms = unpollable_count ? 0 : fdevent_wait_ms();
+    int i, n;
+
+    if(wait_ms > 0) {
+        timeout.tv_sec = wait_ms / 1000;
+        timeout.tv_nsec = (wait_ms % 1000) * 1000000;
+    }
+    n = kevent(kqueue_fd, NULL, 0, events, 256, (wait_ms >= 0) ? &timeout : NULL);
+    D("kevent() returned n=%d, errno=%d\n", n, n<0?errno:0);
+
+    if(n < 0) {
+        if(errno == EINTR) return;
+        FATAL("kevent() failed: %s\n", strerror(errno));
+    }
+
+    for(i = 0; i < n; i++) {
+        struct kevent *ev = events + i;
+        fdevent *fde = fdevent_lookup(ev->ident);
+        unsigned got = 0;
+
+        if(fde == 0) continue;
+
+        if(ev->flags & (EV_EOF | EV_ERROR)) {
+            got |= fdevent_error_events(fde);
+        } else if(ev->filter == EVFILT_READ) {
+            got |= fde->state & FDE_READ;
+        } else if(ev->filter == EVFILT_WRITE) {
+            got |= FDE_WRITE;
+        }
+
+        if(got) fdevent_signal(fde, got);
+    }
+
+    if(unpollable_count) fdevent_signal_unpollable();
+}
 #else /* USE_SELECT */
 
 #ifdef HAVE_WINSOCK
@@ -370,7 +567,13 @@ static void fdevent_process()
 
     dump_all_fds("pre select()");
 
-    n = select(select_n, &rfd, &wfd, &efd, NULL);
+    struct timeval timeout;
+    int wait_ms = fdevent_wait_ms();
+    if(wait_ms >= 0) {
+        timeout.tv_sec = wait_ms / 1000;
+        timeout.tv_usec = (wait_ms % 1000) * 1000;
+    }
+    n = select(select_n, &rfd, &wfd, &efd, (wait_ms >= 0) ? &timeout : NULL);
     int saved_errno = errno;
     D("select() returned n=%d, errno=%d\n", n, n<0?saved_errno:0);
 
@@ -443,7 +646,7 @@ static void fdevent_register(fdevent *fde)
         if(fd_table == 0) {
             FATAL("could not expand fd_table to %d entries\n", fd_table_max);
         }
-        memset(fd_table + oldmax, 0, sizeof(int) * (fd_table_max - oldmax));
+        memset(fd_table + oldmax, 0, sizeof(fdevent*) * (fd_table_max - oldmax));
     }
 
     fd_table[fde->fd] = fde;
@@ -611,6 +814,7 @@ void fdevent_remove(fdevent *fde)
     if(fde->state & FDE_PENDING) {
         fdevent_plist_remove(fde);
     }
+    fdevent_set_timeout(fde, -1);
 
     if(fde->state & FDE_ACTIVE) {
         fdevent_disconnect(fde);
@@ -661,6 +865,19 @@ void fdevent_del(fdevent *fde, unsigned events)
         fde, (fde->state & FDE_EVENTMASK) & (~(events & FDE_EVENTMASK)));
 }
 
+void fdevent_set_timeout(fdevent *fde, int64_t timeout_ms)
+{
+    if(fde->deadline) {
+        timed_fdes.erase(std::find(timed_fdes.begin(), timed_fdes.end(), fde));
+        fde->deadline = 0;
+    }
+    if(timeout_ms >= 0) {
+            /* 0 means no deadline, and the clock is well past it */
+        fde->deadline = std::max<int64_t>(fdevent_now_ms() + timeout_ms, 1);
+        timed_fdes.push_back(fde);
+    }
+}
+
 void fdevent_subproc_setup()
 {
     int s[2];
@@ -687,6 +904,7 @@ void fdevent_loop()
         D("--- ---- waiting for events\n");
 
         fdevent_process();
+        fdevent_expire_timeouts();
 
         while((fde = fdevent_plist_dequeue())) {
             fdevent_call_fdfunc(fde);
@@ -27,6 +27,11 @@
 
 /* features that may be set (via the events set/add/del interface) */
 #define FDE_DONT_CLOSE        0x0080
+/* only report fds that became ready since the last report where the
+** kernel supports it (epoll, kqueue); the callback must then read or
+** write until EAGAIN
+*/
+#define FDE_EDGE              0x0040
 
 struct fdevent;
 
@@ -58,6 +63,10 @@ void fdevent_set(fdevent *fde, unsigned events);
 void fdevent_add(fdevent *fde, unsigned events);
 void fdevent_del(fdevent *fde, unsigned events);
 
+/* Deliver FDE_TIMEOUT once, timeout_ms from now, unless set again
+** first. A timeout_ms below 0 cancels it. Timeouts are only supported
+** by the POSIX event loop, the win32 one ignores them.
+*/
 void fdevent_set_timeout(fdevent *fde, int64_t  timeout_ms);
 
 /* loop forever, handling events.
@@ -76,6 +85,9 @@ struct fdevent {
 
     fd_func func;
     void *arg;
+
+    /* when FDE_TIMEOUT is due, in steady clock milliseconds, or 0 */
+    int64_t deadline;
 };
 
 #endif
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the cost of dispatching fdevents with many fds registered and
+// few of them active, as with an adb server forwarding for many devices.
+// A byte is passed around between socketpairs, each read hands it on to
+// the next active pair, until the requested number of events has been
+// dispatched. Build with ADB_FDEVENT_SELECT to measure the select()
+// backend instead of epoll or kqueue; select() is limited to FD_SETSIZE
+// fds, keep -n below half of it there.
+//
+//   adb_fdevent_benchmark [-n pairs] [-a active] [-e events] [-E]
+
+#include "sysdeps.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adb_trace.h"
+#include "fdevent.h"
+
+#if defined(ADB_FDEVENT_SELECT) || !(defined(__linux__) || defined(__APPLE__))
+static const char* backend = "select";
+#elif defined(__linux__)
+static const char* backend = "epoll";
+#else
+static const char* backend = "kqueue";
+#endif
+
+static int pairs = 500;
+static int active = 10;
+static long events = 1000000;
+static bool edge = false;
+
+static int (*fds)[2];
+static long dispatched;
+static long written;
+static struct timespec start;
+
+static double elapsed_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+static void pass_on(int index) {
+    if (written >= events) {
+        return;
+    }
+    // Stride over the idle pairs so the active ones are spread out.
+    int next = (index + pairs / active + 1) % pairs;
+    char c = 0;
+    if (adb_write(fds[next][1], &c, 1) != 1) {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    written++;
+}
+
+static void ready(int fd, unsigned ev, void* arg) {
+    int index = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+    char buffer[64];
+    ssize_t n;
+
+    // Drained to EAGAIN whatever the mode, as FDE_EDGE requires.
+    while ((n = adb_read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            dispatched++;
+            pass_on(index);
+        }
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        fprintf(stderr, "read failed: %s\n", n ? strerror(errno) : "eof");
+        exit(1);
+    }
+
+    if (dispatched >= events) {
+        double ms = elapsed_ms();
+        printf("%s%s: %d pairs, %d active, %ld events in %.1f ms (%.3f us/event)\n",
+               backend, edge ? " (edge)" : "", pairs, active, dispatched,
+               ms, ms * 1000.0 / dispatched);
+        exit(0);
+    }
+}
+
+int main(int argc, char** argv) {
+    int c;
+    while ((c = getopt(argc, argv, "n:a:e:E")) != -1) {
+        switch (c) {
+        case 'n': pairs = atoi(optarg); break;
+        case 'a': active = atoi(optarg); break;
+        case 'e': events = atol(optarg); break;
+        case 'E': edge = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-n pairs] [-a active] [-e events] [-E]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (pairs < 1 || active < 1 || active > pairs || events < 1) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    adb_trace_init();
+
+    fds = reinterpret_cast<int(*)[2]>(calloc(pairs, sizeof(*fds)));
+    for (int i = 0; i < pairs; i++) {
+        if (adb_socketpair(fds[i])) {
+            fprintf(stderr, "socketpair %d failed: %s\n", i, strerror(errno));
+            return 1;
+        }
+        fdevent* fde = fdevent_create(fds[i][0], ready, reinterpret_cast<void*>(i));
+        fdevent_add(fde, FDE_READ | (edge ? FDE_EDGE : 0));
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < active; i++) {
+        pass_on(i * (pairs / active));
+    }
+
+    fdevent_loop();
+    return 0;
+}
@@ -26,16 +26,28 @@
 #include <time.h>
 #include <utime.h>
 
+#include <string>
+#include <vector>
+
+#include <base/file.h>
+
 #include "sysdeps.h"
 
 #include "adb.h"
 #include "adb_client.h"
+#include "adb_compress.h"
+#include "adb_delta.h"
 #include "adb_io.h"
 #include "file_sync_service.h"
+#include "mincrypt/sha.h"
 
 static unsigned long long total_bytes;
+static unsigned long long wire_bytes;   /* of file data, once compressed */
 static long long start_time;
 
+/* the device takes and sends ZDAT chunks, see sync_compress() */
+static bool sync_compressed;
+
 static long long NOW()
 {
     struct timeval tv;
@@ -47,6 +59,7 @@ static long long NOW()
 static void BEGIN()
 {
     total_bytes = 0;
+    wire_bytes = 0;
     start_time = NOW();
 }
 
@@ -58,19 +71,35 @@ static void END()
     if (t == 0)  /* prevent division by 0 :-) */
         t = 1000000;
 
+    if (wire_bytes > 0 && wire_bytes < total_bytes) {
+        fprintf(stderr,"%lld KB/s (%lld bytes in %lld.%03llds, compressed %.1fx)\n",
+                ((total_bytes * 1000000LL) / t) / 1024LL,
+                total_bytes, (t / 1000000LL), (t % 1000000LL) / 1000LL,
+                (double) total_bytes / wire_bytes);
+        return;
+    }
+
     fprintf(stderr,"%lld KB/s (%lld bytes in %lld.%03llds)\n",
             ((total_bytes * 1000000LL) / t) / 1024LL,
             total_bytes, (t / 1000000LL), (t % 1000000LL) / 1000LL);
 }
 
 static const char* transfer_progress_format = "\rTransferring: %llu/%llu (%d%%)";
+static const char* transfer_progress_compressed_format =
+        "\rTransferring: %llu/%llu (%d%%, compressed %.1fx)";
 
 static void print_transfer_progress(unsigned long long bytes_current,
                                     unsigned long long bytes_total) {
     if (bytes_total == 0) return;
 
-    fprintf(stderr, transfer_progress_format, bytes_current, bytes_total,
-            (int) (bytes_current * 100 / bytes_total));
+    if (wire_bytes > 0 && wire_bytes < total_bytes) {
+        fprintf(stderr, transfer_progress_compressed_format, bytes_current, bytes_total,
+                (int) (bytes_current * 100 / bytes_total),
+                (double) total_bytes / wire_bytes);
+    } else {
+        fprintf(stderr, transfer_progress_format, bytes_current, bytes_total,
+                (int) (bytes_current * 100 / bytes_total));
+    }
 
     if (bytes_current == bytes_total) {
         fputc('\n', stderr);
@@ -91,10 +120,9 @@ void sync_quit(int fd)
 
 typedef void (*sync_ls_cb)(unsigned mode, unsigned size, unsigned time, const char *name, void *cookie);
 
-int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
+static int sync_start_ls(int fd, const char *path)
 {
     syncmsg msg;
-    char buf[257];
     int len;
 
     len = strlen(path);
@@ -107,6 +135,18 @@ int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
        !WriteFdExactly(fd, path, len)) {
         goto fail;
     }
+    return 0;
+
+fail:
+    adb_close(fd);
+    return -1;
+}
+
+static int sync_finish_ls(int fd, sync_ls_cb func, void *cookie)
+{
+    syncmsg msg;
+    char buf[257];
+    int len;
 
     for(;;) {
         if(!ReadFdExactly(fd, &msg.dent, sizeof(msg.dent))) break;
@@ -125,11 +165,16 @@ int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
              buf, cookie);
     }
 
-fail:
     adb_close(fd);
     return -1;
 }
 
+int sync_ls(int fd, const char *path, sync_ls_cb func, void *cookie)
+{
+    if(sync_start_ls(fd, path)) return -1;
+    return sync_finish_ls(fd, func, cookie);
+}
+
 struct syncsendbuf {
     unsigned id;
     unsigned size;
@@ -138,6 +183,70 @@ struct syncsendbuf {
 
 static syncsendbuf send_buffer;
 
+struct synczbuf {
+    unsigned id;
+    unsigned size;
+    unsigned rawsize;
+    char data[SYNC_DATA_MAX];
+};
+
+static synczbuf zdata_buffer;
+
+/* Sends the first len bytes of sbuf->data as a DATA chunk, or as a ZDAT
+** chunk if compressing and they compress.
+*/
+static bool write_data_chunk(int fd, syncsendbuf *sbuf, unsigned len)
+{
+    if (sync_compressed) {
+        synczbuf *zbuf = &zdata_buffer;
+        size_t size = CompressChunk(sbuf->data, len, zbuf->data, sizeof(zbuf->data));
+        if (size > 0) {
+            zbuf->id = ID_ZDAT;
+            zbuf->size = htoll(size);
+            zbuf->rawsize = htoll(len);
+            wire_bytes += size;
+            return WriteFdExactly(fd, zbuf, sizeof(unsigned) * 3 + size);
+        }
+    }
+
+    sbuf->id = ID_DATA;
+    sbuf->size = htoll(len);
+    wire_bytes += len;
+    return WriteFdExactly(fd, sbuf, sizeof(unsigned) * 2 + len);
+}
+
+/* Reads the rest of a ZDAT chunk whose first eight bytes are in msg and
+** expands it into buffer, returning its size there or -1.
+*/
+static int read_zdata_chunk(int fd, syncmsg *msg, char *buffer)
+{
+    synczbuf *zbuf = &zdata_buffer;
+    unsigned size, len;
+
+    if(!ReadFdExactly(fd, &msg->zdata.rawsize, sizeof(msg->zdata.rawsize)))
+        return -1;
+    size = ltohl(msg->zdata.size);
+    len = ltohl(msg->zdata.rawsize);
+    if(size > SYNC_DATA_MAX || len > SYNC_DATA_MAX) {
+        fprintf(stderr,"data overrun\n");
+        return -1;
+    }
+    if(!ReadFdExactly(fd, zbuf->data, size))
+        return -1;
+    if(!UncompressChunk(zbuf->data, size, buffer, len)) {
+        fprintf(stderr,"corrupt compressed data\n");
+        return -1;
+    }
+    wire_bytes += size;
+    return len;
+}
+
+/* Requests sent ahead of reading the replies when working through a
+** directory, few enough for the requests to fit in the socket buffers
+** while the device is still busy writing out the first replies.
+*/
+#define SYNC_REQUESTS_MAX 32
+
 int sync_readtime(int fd, const char *path, unsigned int *timestamp,
                   unsigned int *mode)
 {
@@ -246,7 +355,6 @@ static int write_data_file(int fd, const char *path, syncsendbuf *sbuf, int show
         size = st.st_size;
     }
 
-    sbuf->id = ID_DATA;
     for(;;) {
         int ret;
 
@@ -261,8 +369,7 @@ static int write_data_file(int fd, const char *path, syncsendbuf *sbuf, int show
             break;
         }
 
-        sbuf->size = htoll(ret);
-        if(!WriteFdExactly(fd, sbuf, sizeof(unsigned) * 2 + ret)){
+        if(!write_data_chunk(fd, sbuf, ret)) {
             err = -1;
             break;
         }
@@ -283,7 +390,6 @@ static int write_data_buffer(int fd, char* file_buffer, int size, syncsendbuf *s
     int err = 0;
     int total = 0;
 
-    sbuf->id = ID_DATA;
     while (total < size) {
         int count = size - total;
         if (count > SYNC_DATA_MAX) {
@@ -291,8 +397,7 @@ static int write_data_buffer(int fd, char* file_buffer, int size, syncsendbuf *s
         }
 
         memcpy(sbuf->data, &file_buffer[total], count);
-        sbuf->size = htoll(count);
-        if(!WriteFdExactly(fd, sbuf, sizeof(unsigned) * 2 + count)){
+        if(!write_data_chunk(fd, sbuf, count)) {
             err = -1;
             break;
         }
@@ -334,8 +439,11 @@ static int write_data_link(int fd, const char *path, syncsendbuf *sbuf)
 }
 #endif
 
-static int sync_send(int fd, const char *lpath, const char *rpath,
-                     unsigned mtime, mode_t mode, int show_progress)
+/* Sends the file, up to and including the DONE, without waiting for
+** the device to take it
+*/
+static int sync_start_send(int fd, const char *lpath, const char *rpath,
+                           unsigned mtime, mode_t mode, int show_progress)
 {
     syncmsg msg;
     int len, r;
@@ -374,6 +482,20 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     if(!WriteFdExactly(fd, &msg.data, sizeof(msg.data)))
         goto fail;
 
+    return 0;
+
+fail:
+    fprintf(stderr,"protocol failure\n");
+    adb_close(fd);
+    return -1;
+}
+
+static int sync_finish_send(int fd, const char *lpath, const char *rpath)
+{
+    syncmsg msg;
+    syncsendbuf *sbuf = &send_buffer;
+    int len;
+
     if(!ReadFdExactly(fd, &msg.status, sizeof(msg.status)))
         return -1;
 
@@ -393,11 +515,194 @@ static int sync_send(int fd, const char *lpath, const char *rpath,
     }
 
     return 0;
+}
 
-fail:
-    fprintf(stderr,"protocol failure\n");
-    adb_close(fd);
-    return -1;
+static int sync_send(int fd, const char *lpath, const char *rpath,
+                     unsigned mtime, mode_t mode, int show_progress)
+{
+    if(sync_start_send(fd, lpath, rpath, mtime, mode, show_progress))
+        return -1;
+    return sync_finish_send(fd, lpath, rpath);
+}
+
+/* Pushes the file as a delta against the one already at rpath, if it is
+** large enough. Returns 0 once pushed, 1 if the file is better sent whole
+** and -1 if the connection is lost. A device that does not know SIGS
+** fails it and drops the connection, *fd is then a new connection.
+*/
+static int sync_send_delta(int *fd, const char *lpath, const char *rpath,
+                           unsigned mtime, mode_t mode, int show_progress)
+{
+    syncmsg msg;
+    syncsendbuf *sbuf = &send_buffer;
+    int len = strlen(rpath);
+    char tmp[64];
+    int r;
+
+    if(len > 1024) return 1;
+
+    msg.req.id = ID_SIGS;
+    msg.req.namelen = htoll(len);
+    if(!WriteFdExactly(*fd, &msg.req, sizeof(msg.req)) ||
+       !WriteFdExactly(*fd, rpath, len) ||
+       !ReadFdExactly(*fd, &msg.status, sizeof(msg.status))) {
+        return -1;
+    }
+    if(msg.sigs.id == ID_FAIL) {
+        adb_close(*fd);
+        std::string error;
+        *fd = adb_connect("sync:", &error);
+        if(*fd < 0) {
+            fprintf(stderr,"error: %s\n", error.c_str());
+            return -1;
+        }
+        return 1;
+    }
+    if(msg.sigs.id != ID_SIGS ||
+       !ReadFdExactly(*fd, &msg.sigs.count, sizeof(msg.sigs.count))) {
+        return -1;
+    }
+
+    size_t block_size = ltohl(msg.sigs.block_size);
+    std::vector<BlockSignature> signatures(ltohl(msg.sigs.count));
+    if(!signatures.empty() &&
+       !ReadFdExactly(*fd, &signatures[0], signatures.size() * sizeof(BlockSignature))) {
+        return -1;
+    }
+    for(size_t i = 0; i < signatures.size(); i++) {
+        signatures[i].weak = ltohl(signatures[i].weak);
+    }
+    if(signatures.empty()) return 1;
+
+    std::string content;
+    if(!android::base::ReadFileToString(lpath, &content)) return 1;
+    const uint8_t *data = reinterpret_cast<const uint8_t*>(content.data());
+    std::vector<DeltaOp> ops = ComputeDelta(data, content.size(), block_size, signatures);
+
+    unsigned long long saved_total = total_bytes, saved_wire = wire_bytes;
+
+    snprintf(tmp, sizeof(tmp), ",%d", mode);
+    r = strlen(tmp);
+    msg.req.id = ID_DLTA;
+    msg.req.namelen = htoll(len + r);
+    if(!WriteFdExactly(*fd, &msg.req, sizeof(msg.req)) ||
+       !WriteFdExactly(*fd, rpath, len) || !WriteFdExactly(*fd, tmp, r)) {
+        return -1;
+    }
+
+    for(size_t i = 0; i < ops.size(); i++) {
+        const DeltaOp& op = ops[i];
+        if(op.copy) {
+            msg.copy.id = ID_COPY;
+            msg.copy.block = htoll(op.block);
+            msg.copy.count = htoll(op.count);
+            if(!WriteFdExactly(*fd, &msg.copy, sizeof(msg.copy))) return -1;
+            total_bytes += (unsigned long long) op.count * block_size;
+        } else {
+            for(uint64_t done = 0; done < op.len; ) {
+                unsigned count = (op.len - done > SYNC_DATA_MAX) ? SYNC_DATA_MAX : op.len - done;
+                memcpy(sbuf->data, data + op.offset + done, count);
+                if(!write_data_chunk(*fd, sbuf, count)) return -1;
+                done += count;
+                total_bytes += count;
+            }
+        }
+        if (show_progress) {
+            print_transfer_progress(total_bytes - saved_total, content.size());
+        }
+    }
+
+    uint8_t digest[SHA_DIGEST_SIZE];
+    SHA_hash(data, content.size(), digest);
+    msg.data.id = ID_HASH;
+    msg.data.size = htoll(SHA_DIGEST_SIZE);
+    if(!WriteFdExactly(*fd, &msg.data, sizeof(msg.data)) ||
+       !WriteFdExactly(*fd, digest, SHA_DIGEST_SIZE)) {
+        return -1;
+    }
+    msg.data.id = ID_DONE;
+    msg.data.size = htoll(mtime);
+    if(!WriteFdExactly(*fd, &msg.data, sizeof(msg.data)) ||
+       !ReadFdExactly(*fd, &msg.status, sizeof(msg.status))) {
+        return -1;
+    }
+    if(msg.status.id == ID_OKAY) return 0;
+    if(msg.status.id != ID_FAIL) return -1;
+
+    len = ltohl(msg.status.msglen);
+    if(len > 256) len = 256;
+    if(!ReadFdExactly(*fd, sbuf->data, len)) return -1;
+    sbuf->data[len] = 0;
+    fprintf(stderr,"delta push of '%s' failed: %s, sending it whole\n", lpath, sbuf->data);
+    total_bytes = saved_total;
+    wire_bytes = saved_wire;
+    return 1;
+}
+
+/* Asks the device to take SENDs without acknowledging each, returns the
+** number it will take before an ACKS. A device that does not know PIPE
+** fails it and drops the connection, *fd is then a new connection and
+** 0 returned. Returns -1 if the connection is lost.
+*/
+static int sync_pipeline(int *fd)
+{
+    syncmsg msg;
+
+    msg.req.id = ID_PIPE;
+    msg.req.namelen = 0;
+    if(!WriteFdExactly(*fd, &msg.req, sizeof(msg.req)) ||
+       !ReadFdExactly(*fd, &msg.status, sizeof(msg.status))) {
+        return -1;
+    }
+    if(msg.status.id == ID_OKAY) {
+        return ltohl(msg.status.msglen);
+    }
+    if(msg.status.id != ID_FAIL) {
+        return -1;
+    }
+
+    adb_close(*fd);
+    std::string error;
+    *fd = adb_connect("sync:", &error);
+    if(*fd < 0) {
+        fprintf(stderr,"error: %s\n", error.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/* Asks the device to take and send ZDAT chunks. A device that does not
+** know CMPR fails it and drops the connection, *fd is then a new
+** connection and transfers go uncompressed. Returns -1 if the connection
+** is lost.
+*/
+static int sync_compress(int *fd)
+{
+    syncmsg msg;
+
+    sync_compressed = false;
+    msg.req.id = ID_CMPR;
+    msg.req.namelen = 0;
+    if(!WriteFdExactly(*fd, &msg.req, sizeof(msg.req)) ||
+       !ReadFdExactly(*fd, &msg.status, sizeof(msg.status))) {
+        return -1;
+    }
+    if(msg.status.id == ID_OKAY) {
+        sync_compressed = true;
+        return 0;
+    }
+    if(msg.status.id != ID_FAIL) {
+        return -1;
+    }
+
+    adb_close(*fd);
+    std::string error;
+    *fd = adb_connect("sync:", &error);
+    if(*fd < 0) {
+        fprintf(stderr,"error: %s\n", error.c_str());
+        return -1;
+    }
+    return 0;
 }
 
 static int mkdirs(const char *name)
@@ -419,51 +724,38 @@ static int mkdirs(const char *name)
     return 0;
 }
 
-int sync_recv(int fd, const char *rpath, const char *lpath, int show_progress)
+static int sync_start_recv(int fd, const char *rpath)
 {
     syncmsg msg;
     int len;
-    int lfd = -1;
-    char *buffer = send_buffer.data;
-    unsigned id;
-    unsigned long long size = 0;
 
     len = strlen(rpath);
     if(len > 1024) return -1;
 
-    if (show_progress) {
-        // Determine remote file size.
-        syncmsg stat_msg;
-        stat_msg.req.id = ID_STAT;
-        stat_msg.req.namelen = htoll(len);
-
-        if (!WriteFdExactly(fd, &stat_msg.req, sizeof(stat_msg.req)) ||
-            !WriteFdExactly(fd, rpath, len)) {
-            return -1;
-        }
-
-        if (!ReadFdExactly(fd, &stat_msg.stat, sizeof(stat_msg.stat))) {
-            return -1;
-        }
-
-        if (stat_msg.stat.id != ID_STAT) return -1;
-
-        size = ltohl(stat_msg.stat.size);
-    }
-
     msg.req.id = ID_RECV;
     msg.req.namelen = htoll(len);
     if(!WriteFdExactly(fd, &msg.req, sizeof(msg.req)) ||
        !WriteFdExactly(fd, rpath, len)) {
         return -1;
     }
+    return 0;
+}
+
+static int sync_finish_recv(int fd, const char *rpath, const char *lpath,
+                            unsigned long long size, int show_progress)
+{
+    syncmsg msg;
+    int len;
+    int lfd = -1;
+    char *buffer = send_buffer.data;
+    unsigned id;
 
     if(!ReadFdExactly(fd, &msg.data, sizeof(msg.data))) {
         return -1;
     }
     id = msg.data.id;
 
-    if((id == ID_DATA) || (id == ID_DONE)) {
+    if((id == ID_DATA) || (id == ID_ZDAT) || (id == ID_DONE)) {
         adb_unlink(lpath);
         mkdirs(lpath);
         lfd = adb_creat(lpath, 0644);
@@ -485,16 +777,25 @@ int sync_recv(int fd, const char *rpath, const char *lpath, int show_progress)
     handle_data:
         len = ltohl(msg.data.size);
         if(id == ID_DONE) break;
-        if(id != ID_DATA) goto remote_error;
-        if(len > SYNC_DATA_MAX) {
-            fprintf(stderr,"data overrun\n");
-            adb_close(lfd);
-            return -1;
-        }
+        if(id == ID_ZDAT && sync_compressed) {
+            len = read_zdata_chunk(fd, &msg, buffer);
+            if(len < 0) {
+                adb_close(lfd);
+                return -1;
+            }
+        } else {
+            if(id != ID_DATA) goto remote_error;
+            if(len > SYNC_DATA_MAX) {
+                fprintf(stderr,"data overrun\n");
+                adb_close(lfd);
+                return -1;
+            }
 
-        if(!ReadFdExactly(fd, buffer, len)) {
-            adb_close(lfd);
-            return -1;
+            if(!ReadFdExactly(fd, buffer, len)) {
+                adb_close(lfd);
+                return -1;
+            }
+            wire_bytes += len;
         }
 
         if(!WriteFdExactly(lfd, buffer, len)) {
@@ -532,6 +833,24 @@ remote_error:
     return 0;
 }
 
+int sync_recv(int fd, const char *rpath, const char *lpath, int show_progress)
+{
+    unsigned long long size = 0;
+
+    if (show_progress) {
+        // Determine remote file size.
+        unsigned int timestamp, mode, remote_size;
+        if (sync_start_readtime(fd, rpath) ||
+            sync_finish_readtime(fd, &timestamp, &mode, &remote_size)) {
+            return -1;
+        }
+        size = remote_size;
+    }
+
+    if (sync_start_recv(fd, rpath)) return -1;
+    return sync_finish_recv(fd, rpath, lpath, size, show_progress);
+}
+
 /* --- */
 static void do_sync_ls_cb(unsigned mode, unsigned size, unsigned time,
                           const char *name, void *cookie)
@@ -670,12 +989,64 @@ static int local_build_list(copyinfo **filelist,
 }
 
 
-static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, int checktimestamps, int listonly)
+/* Collects the outcome of the SENDs of a window, the files of which are
+** kept in sent until then, and reports those that failed. Returns -1 if
+** any did or the connection is lost.
+*/
+static int sync_ack_window(int fd, std::vector<copyinfo*>* sent_files)
+{
+    const std::vector<copyinfo*>& sent = *sent_files;
+    syncmsg msg;
+    char *buffer = send_buffer.data;
+    unsigned failed;
+
+    msg.req.id = ID_ACKS;
+    msg.req.namelen = 0;
+    if(!WriteFdExactly(fd, &msg.req, sizeof(msg.req)) ||
+       !ReadFdExactly(fd, &msg.acks, sizeof(msg.acks))) {
+        return -1;
+    }
+    if(msg.acks.id != ID_ACKS || ltohl(msg.acks.count) != sent.size()) {
+        fprintf(stderr,"protocol failure\n");
+        return -1;
+    }
+
+    failed = ltohl(msg.acks.failed);
+    for(unsigned i = 0; i < failed; i++) {
+        unsigned index;
+        int len;
+
+        if(!ReadFdExactly(fd, &msg.failure, sizeof(msg.failure)) ||
+           msg.failure.id != ID_FAIL) {
+            return -1;
+        }
+        index = ltohl(msg.failure.index);
+        len = ltohl(msg.failure.msglen);
+        if(index >= sent.size() || len > SYNC_DATA_MAX - 1 ||
+           !ReadFdExactly(fd, buffer, len)) {
+            return -1;
+        }
+        buffer[len] = 0;
+        fprintf(stderr,"failed to copy '%s' to '%s': %s\n",
+                sent[index]->src, sent[index]->dst, buffer);
+    }
+
+    for(size_t i = 0; i < sent.size(); i++) free(sent[i]);
+    sent_files->clear();
+    return failed ? -1 : 0;
+}
+
+/* Pushes the files one after the other, or pipelined if the device
+** supports it, sync_pipeline() may replace *fd with a new connection.
+*/
+static int copy_local_dir_remote(int *fd, const char *lpath, const char *rpath, int checktimestamps, int listonly)
 {
     copyinfo *filelist = 0;
     copyinfo *ci, *next;
     int pushed = 0;
     int skipped = 0;
+    int window = 0;
+    std::vector<copyinfo*> sent;
 
     if((lpath[0] == 0) || (rpath[0] == 0)) return -1;
     if(lpath[strlen(lpath) - 1] != '/') {
@@ -698,37 +1069,65 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
     }
 
     if(checktimestamps){
-        for(ci = filelist; ci != 0; ci = ci->next) {
-            if(sync_start_readtime(fd, ci->dst)) {
-                return 1;
+        copyinfo *batch = filelist;
+        ci = filelist;
+        while(ci != 0) {
+            for(int count = 0; batch != 0 && count < SYNC_REQUESTS_MAX; count++) {
+                if(sync_start_readtime(*fd, batch->dst)) {
+                    return 1;
+                }
+                batch = batch->next;
             }
-        }
-        for(ci = filelist; ci != 0; ci = ci->next) {
-            unsigned int timestamp, mode, size;
-            if(sync_finish_readtime(fd, &timestamp, &mode, &size))
-                return 1;
-            if(size == ci->size) {
-                /* for links, we cannot update the atime/mtime */
-                if((S_ISREG(ci->mode & mode) && timestamp == ci->time) ||
-                    (S_ISLNK(ci->mode & mode) && timestamp >= ci->time))
-                    ci->flag = 1;
+            for(; ci != batch; ci = ci->next) {
+                unsigned int timestamp, mode, size;
+                if(sync_finish_readtime(*fd, &timestamp, &mode, &size))
+                    return 1;
+                if(size == ci->size) {
+                    /* for links, we cannot update the atime/mtime */
+                    if((S_ISREG(ci->mode & mode) && timestamp == ci->time) ||
+                        (S_ISLNK(ci->mode & mode) && timestamp >= ci->time))
+                        ci->flag = 1;
+                }
             }
         }
     }
+    if(!listonly) {
+        for(ci = filelist; ci != 0 && ci->flag; ci = ci->next);
+        if(ci != 0 && (window = sync_pipeline(fd)) < 0) {
+            return 1;
+        }
+    }
+
     for(ci = filelist; ci != 0; ci = next) {
         next = ci->next;
-        if(ci->flag == 0) {
-            fprintf(stderr,"%spush: %s -> %s\n", listonly ? "would " : "", ci->src, ci->dst);
-            if(!listonly &&
-               sync_send(fd, ci->src, ci->dst, ci->time, ci->mode,
+        if(ci->flag != 0) {
+            skipped++;
+            free(ci);
+            continue;
+        }
+        fprintf(stderr,"%spush: %s -> %s\n", listonly ? "would " : "", ci->src, ci->dst);
+        pushed++;
+        if(listonly) {
+            free(ci);
+        } else if(window == 0) {
+            if(sync_send(*fd, ci->src, ci->dst, ci->time, ci->mode,
                          0 /* no show progress */)) {
                 return 1;
             }
-            pushed++;
+            free(ci);
         } else {
-            skipped++;
+            if(sync_start_send(*fd, ci->src, ci->dst, ci->time, ci->mode,
+                               0 /* no show progress */)) {
+                return 1;
+            }
+            sent.push_back(ci);
+            if(sent.size() == (size_t) window && sync_ack_window(*fd, &sent)) {
+                return 1;
+            }
         }
-        free(ci);
+    }
+    if(!sent.empty() && sync_ack_window(*fd, &sent)) {
+        return 1;
     }
 
     fprintf(stderr,"%d file%s pushed. %d file%s skipped.\n",
@@ -739,7 +1138,7 @@ static int copy_local_dir_remote(int fd, const char *lpath, const char *rpath, i
 }
 
 
-int do_sync_push(const char *lpath, const char *rpath, int show_progress)
+int do_sync_push(const char *lpath, const char *rpath, int show_progress, bool compress)
 {
     struct stat st;
     unsigned mode;
@@ -750,6 +1149,10 @@ int do_sync_push(const char *lpath, const char *rpath, int show_progress)
         fprintf(stderr,"error: %s\n", error.c_str());
         return 1;
     }
+    sync_compressed = false;
+    if (compress && sync_compress(&fd)) {
+        return 1;
+    }
 
     if(stat(lpath, &st)) {
         fprintf(stderr,"cannot stat '%s': %s\n", lpath, strerror(errno));
@@ -759,7 +1162,7 @@ int do_sync_push(const char *lpath, const char *rpath, int show_progress)
 
     if(S_ISDIR(st.st_mode)) {
         BEGIN();
-        if(copy_local_dir_remote(fd, lpath, rpath, 0, 0)) {
+        if(copy_local_dir_remote(&fd, lpath, rpath, 0, 0)) {
             return 1;
         } else {
             END();
@@ -787,6 +1190,18 @@ int do_sync_push(const char *lpath, const char *rpath, int show_progress)
             rpath = tmp;
         }
         BEGIN();
+        if(S_ISREG(st.st_mode) && st.st_size >= SYNC_DELTA_MIN) {
+            int r = sync_send_delta(&fd, lpath, rpath, st.st_mtime, st.st_mode, show_progress);
+            if(r < 0) {
+                fprintf(stderr,"protocol failure\n");
+                return 1;
+            }
+            if(r == 0) {
+                END();
+                sync_quit(fd);
+                return 0;
+            }
+        }
         if(sync_send(fd, lpath, rpath, st.st_mtime, st.st_mode, show_progress)) {
             return 1;
         } else {
@@ -843,27 +1258,43 @@ sync_ls_build_list_cb(unsigned mode, unsigned size, unsigned time,
 static int remote_build_list(int syncfd, copyinfo **filelist,
                              const char *rpath, const char *lpath)
 {
-    copyinfo *dirlist = NULL;
+    copyinfo *dirlist = mkcopyinfo(rpath, lpath, "", 0);
     sync_ls_build_list_cb_args args;
 
     args.filelist = filelist;
-    args.dirlist = &dirlist;
-    args.rpath = rpath;
-    args.lpath = lpath;
 
-    /* Put the files/dirs in rpath on the lists. */
-    if (sync_ls(syncfd, rpath, sync_ls_build_list_cb, (void *)&args)) {
-        return 1;
-    }
-
-    /* Recurse into each directory we found. */
     while (dirlist != NULL) {
-        copyinfo *next = dirlist->next;
-        if (remote_build_list(syncfd, filelist, dirlist->src, dirlist->dst)) {
-            return 1;
+        copyinfo *found = NULL;
+        copyinfo *ci;
+        int count = 0;
+
+        /* List a batch of the directories found so far at once. */
+        for (ci = dirlist; ci != NULL && count < SYNC_REQUESTS_MAX; ci = ci->next) {
+            if (sync_start_ls(syncfd, ci->src)) {
+                return 1;
+            }
+            count++;
+        }
+
+        /* Put the files/dirs in each on the lists. */
+        args.dirlist = &found;
+        while (count-- > 0) {
+            ci = dirlist;
+            args.rpath = ci->src;
+            args.lpath = ci->dst;
+            if (sync_finish_ls(syncfd, sync_ls_build_list_cb, (void *)&args)) {
+                return 1;
+            }
+            dirlist = ci->next;
+            free(ci);
+        }
+
+        /* And go on with the directories found in them. */
+        if (found != NULL) {
+            for (ci = found; ci->next != NULL; ci = ci->next);
+            ci->next = dirlist;
+            dirlist = found;
         }
-        free(dirlist);
-        dirlist = next;
     }
 
     return 0;
@@ -901,7 +1332,8 @@ static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
                                  int copy_attrs)
 {
     copyinfo *filelist = 0;
-    copyinfo *ci, *next;
+    copyinfo *ci, *next, *requested;
+    int inflight = 0;
     int pulled = 0;
     int skipped = 0;
     char *rpath_clean = NULL;
@@ -932,14 +1364,26 @@ static int copy_remote_dir_local(int fd, const char *rpath, const char *lpath,
         goto finish;
     }
 
+    /* Keep some RECVs queued up behind the file being pulled. */
+    requested = filelist;
     for (ci = filelist; ci != 0; ci = next) {
         next = ci->next;
         if (ci->flag == 0) {
+            for (; requested != 0 && inflight < SYNC_REQUESTS_MAX; requested = requested->next) {
+                if (requested->flag) continue;
+                if (sync_start_recv(fd, requested->src)) {
+                    ret = -1;
+                    goto finish;
+                }
+                inflight++;
+            }
+
             fprintf(stderr, "pull: %s -> %s\n", ci->src, ci->dst);
-            if (sync_recv(fd, ci->src, ci->dst, 0 /* no show progress */)) {
+            if (sync_finish_recv(fd, ci->src, ci->dst, 0, 0 /* no show progress */)) {
                 ret = -1;
                 goto finish;
             }
+            inflight--;
 
             if (copy_attrs && set_time_and_mode(ci->dst, ci->time, ci->mode)) {
                 ret = -1;
@@ -962,7 +1406,8 @@ finish:
     return ret;
 }
 
-int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int copy_attrs)
+int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int copy_attrs,
+                 bool compress)
 {
     unsigned mode, time;
     struct stat st;
@@ -973,6 +1418,10 @@ int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int co
         fprintf(stderr,"error: %s\n", error.c_str());
         return 1;
     }
+    sync_compressed = false;
+    if (compress && sync_compress(&fd)) {
+        return 1;
+    }
 
     if(sync_readtime(fd, rpath, &time, &mode)) {
         return 1;
@@ -1036,9 +1485,13 @@ int do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_o
         fprintf(stderr, "error: %s\n", error.c_str());
         return 1;
     }
+    sync_compressed = false;
+    if (!list_only && sync_compress(&fd)) {
+        return 1;
+    }
 
     BEGIN();
-    if (copy_local_dir_remote(fd, lpath.c_str(), rpath.c_str(), 1, list_only)) {
+    if (copy_local_dir_remote(&fd, lpath.c_str(), rpath.c_str(), 1, list_only)) {
         return 1;
     } else {
         END();
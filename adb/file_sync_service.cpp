@@ -21,19 +21,91 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <selinux/android.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <utime.h>
 
+#include <string>
+#include <vector>
+
 #include "adb.h"
+#include "adb_compress.h"
+#include "adb_delta.h"
 #include "adb_io.h"
+#include "mincrypt/sha.h"
 #include "private/android_filesystem_config.h"
 
+/* A SEND of a window that failed, by its position in the window */
+struct sync_failure {
+    unsigned index;
+    std::string reason;
+};
+
+struct sync_session {
+    int s;
+    char *buffer;           /* file data, SYNC_DATA_MAX */
+
+        /* replies are gathered here and only written out once the buffer
+        ** fills or the client has no further requests queued, so that a
+        ** run of pipelined STATs or a long LIST goes back in a few writes
+        */
+    char *reply;            /* SYNC_DATA_MAX */
+    size_t reply_len;
+
+        /* after a PIPE request SENDs are not acknowledged one by one, the
+        ** client asks for the outcome of up to SYNC_WINDOW of them at once
+        */
+    bool pipelined;
+    unsigned files;         /* SENDs since the last ACKS */
+    bool failed;            /* the SEND in progress has failed */
+    std::vector<sync_failure> failures;
+
+        /* after a CMPR request the client may send ZDAT chunks, and
+        ** RECVs are answered with ZDAT where the data compresses
+        */
+    bool compressed;
+    char *zbuffer;          /* SYNC_DATA_MAX, compressed data */
+
+        /* the COPYs of a DLTA refer to blocks of the size in the
+        ** last SIGS reply
+        */
+    size_t delta_block_size;
+};
+
+static bool sync_flush(sync_session *ss)
+{
+    size_t len = ss->reply_len;
+
+    ss->reply_len = 0;
+    return len == 0 || WriteFdExactly(ss->s, ss->reply, len);
+}
+
+static bool sync_reply(sync_session *ss, const void *data, size_t len)
+{
+    if(ss->reply_len + len > SYNC_DATA_MAX && !sync_flush(ss))
+        return false;
+    if(len > SYNC_DATA_MAX)
+        return WriteFdExactly(ss->s, data, len);
+    memcpy(ss->reply + ss->reply_len, data, len);
+    ss->reply_len += len;
+    return true;
+}
+
+/* Whether the client has sent more than we have read */
+static bool sync_pending(int s)
+{
+    struct pollfd pfd = { s, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+}
+
 static bool should_use_fs_config(const char* path) {
     // TODO: use fs_config to configure permissions on /data.
     return strncmp("/system/", path, strlen("/system/")) == 0 ||
@@ -77,7 +149,7 @@ static int mkdirs(char *name)
     return 0;
 }
 
-static int do_stat(int s, const char *path)
+static int do_stat(sync_session *ss, const char *path)
 {
     syncmsg msg;
     struct stat st;
@@ -94,10 +166,10 @@ static int do_stat(int s, const char *path)
         msg.stat.time = htoll(st.st_mtime);
     }
 
-    return WriteFdExactly(s, &msg.stat, sizeof(msg.stat)) ? 0 : -1;
+    return sync_reply(ss, &msg.stat, sizeof(msg.stat)) ? 0 : -1;
 }
 
-static int do_list(int s, const char *path)
+static int do_list(sync_session *ss, const char *path)
 {
     DIR *d;
     struct dirent *de;
@@ -132,8 +204,8 @@ static int do_list(int s, const char *path)
             msg.dent.time = htoll(st.st_mtime);
             msg.dent.namelen = htoll(len);
 
-            if(!WriteFdExactly(s, &msg.dent, sizeof(msg.dent)) ||
-               !WriteFdExactly(s, de->d_name, len)) {
+            if(!sync_reply(ss, &msg.dent, sizeof(msg.dent)) ||
+               !sync_reply(ss, de->d_name, len)) {
                 closedir(d);
                 return -1;
             }
@@ -148,10 +220,10 @@ done:
     msg.dent.size = 0;
     msg.dent.time = 0;
     msg.dent.namelen = 0;
-    return WriteFdExactly(s, &msg.dent, sizeof(msg.dent)) ? 0 : -1;
+    return sync_reply(ss, &msg.dent, sizeof(msg.dent)) ? 0 : -1;
 }
 
-static int fail_message(int s, const char *reason)
+static int fail_message(sync_session *ss, const char *reason)
 {
     syncmsg msg;
     int len = strlen(reason);
@@ -160,30 +232,149 @@ static int fail_message(int s, const char *reason)
 
     msg.data.id = ID_FAIL;
     msg.data.size = htoll(len);
-    if(!WriteFdExactly(s, &msg.data, sizeof(msg.data)) ||
-       !WriteFdExactly(s, reason, len)) {
+    if(!sync_reply(ss, &msg.data, sizeof(msg.data)) ||
+       !sync_reply(ss, reason, len) || !sync_flush(ss)) {
         return -1;
     } else {
         return 0;
     }
 }
 
-static int fail_errno(int s)
+static int fail_errno(sync_session *ss)
+{
+    return fail_message(ss, strerror(errno));
+}
+
+/* The file being sent could not be written. Reported right away unless
+** pipelined, then kept for the next ACKS, the first failure of each file
+** only. The connection stays up either way.
+*/
+static int fail_file(sync_session *ss)
 {
-    return fail_message(s, strerror(errno));
+    if(!ss->pipelined) return fail_errno(ss);
+    if(!ss->failed) {
+        sync_failure f = { ss->files - 1, strerror(errno) };
+        D("sync: failure of file %u: %s\n", f.index, f.reason.c_str());
+        ss->failures.push_back(f);
+        ss->failed = true;
+    }
+    return 0;
 }
 
-static int handle_send_file(int s, char *path, uid_t uid,
-        gid_t gid, mode_t mode, char *buffer, bool do_unlink)
+static int okay_file(sync_session *ss)
 {
     syncmsg msg;
+
+    if(ss->pipelined) return 0;
+    msg.status.id = ID_OKAY;
+    msg.status.msglen = 0;
+    return sync_reply(ss, &msg.status, sizeof(msg.status)) ? 0 : -1;
+}
+
+/* Data chunks at least this large are spliced from the socket into the
+** file rather than copied through the buffer.
+*/
+#define SPLICE_MIN (16*1024)
+
+/* Large pushes are preallocated ahead of the data and the page cache
+** for what has been written is dropped as we go, past the first MB.
+*/
+#define PUSH_LARGE (1024*1024)
+#define PUSH_PREALLOCATE (32*1024*1024)
+#define PUSH_WRITEBACK (8*1024*1024)
+
+/* Moves len bytes from the socket s into fd through the pipe p, or
+** through buffer if the file can not be spliced to. Returns 1 if the
+** socket can not be spliced from and nothing was read, 0 on success,
+** -1 if the socket failed. A failure to write leaves errno set in
+** *file_errno, the data is consumed regardless.
+*/
+static int splice_data(int s, int fd, int p[2], size_t len, char *buffer,
+                       bool *use_splice, int *file_errno)
+{
+    size_t in = 0, out = 0;
+    ssize_t n;
+
+    while(in < len) {
+        n = splice(s, NULL, p[1], NULL, len - in, SPLICE_F_MOVE);
+        if(n > 0) {
+            in += n;
+        } else if(n < 0 && errno == EINTR) {
+            continue;
+        } else if(n < 0 && in == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            *use_splice = false;
+            return 1;
+        } else {
+            return -1;
+        }
+    }
+
+    while(out < in) {
+        n = splice(p[0], NULL, fd, NULL, in - out, SPLICE_F_MOVE);
+        if(n > 0) {
+            out += n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR) continue;
+
+            /* drain the pipe, then write what was left the old way
+            ** if the file just does not take splices
+            */
+        int saved_errno = errno;
+        if(!ReadFdExactly(p[0], buffer, in - out)) return -1;
+        if(n < 0 && saved_errno == EINVAL) {
+            *use_splice = false;
+            if(!WriteFdExactly(fd, buffer, in - out)) *file_errno = errno;
+        } else {
+            *file_errno = n < 0 ? saved_errno : EIO;
+        }
+        break;
+    }
+    return 0;
+}
+
+/* Reads the rest of a ZDAT chunk whose first eight bytes are in msg and
+** expands it into the buffer, setting *len to its size there.
+*/
+static int read_zdata(sync_session *ss, syncmsg *msg, unsigned *len)
+{
+    unsigned size;
+
+    if(!ReadFdExactly(ss->s, &msg->zdata.rawsize, sizeof(msg->zdata.rawsize)))
+        return -1;
+    size = ltohl(msg->zdata.size);
+    *len = ltohl(msg->zdata.rawsize);
+    if(*len > SYNC_DATA_MAX || size > SYNC_DATA_MAX) {
+        fail_message(ss, "oversize data message");
+        return -1;
+    }
+    if(!ReadFdExactly(ss->s, ss->zbuffer, size))
+        return -1;
+    if(!UncompressChunk(ss->zbuffer, size, ss->buffer, *len)) {
+        fail_message(ss, "corrupt compressed data");
+        return -1;
+    }
+    return 0;
+}
+
+static int handle_send_file(sync_session *ss, char *path, uid_t uid,
+        gid_t gid, mode_t mode, bool do_unlink)
+{
+    int s = ss->s;
+    char *buffer = ss->buffer;
+    syncmsg msg;
     unsigned int timestamp = 0;
     int fd;
+    int p[2] = { -1, -1 };
+    off64_t offset = 0, allocated = 0, written_back = 0;
+    bool use_splice = true;
+    bool use_fallocate = true;
+    struct stat st;
 
     fd = adb_open_mode(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
     if(fd < 0 && errno == ENOENT) {
         if(mkdirs(path) != 0) {
-            if(fail_errno(s))
+            if(fail_file(ss))
                 return -1;
             fd = -1;
         } else {
@@ -194,12 +385,12 @@ static int handle_send_file(int s, char *path, uid_t uid,
         fd = adb_open_mode(path, O_WRONLY | O_CLOEXEC, mode);
     }
     if(fd < 0) {
-        if(fail_errno(s))
+        if(fail_file(ss))
             return -1;
         fd = -1;
     } else {
         if(fchown(fd, uid, gid) != 0) {
-            fail_errno(s);
+            fail_file(ss);
             errno = 0;
         }
 
@@ -209,69 +400,136 @@ static int handle_send_file(int s, char *path, uid_t uid,
          * by all filesystems. b/12441485
          */
         fchmod(fd, mode);
+
+        /* only preallocate and splice into regular files */
+        if(fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+            use_splice = false;
+            use_fallocate = false;
+        }
     }
 
     for(;;) {
         unsigned int len;
+        int file_errno = 0;
 
         if(!ReadFdExactly(s, &msg.data, sizeof(msg.data)))
             goto fail;
 
-        if(msg.data.id != ID_DATA) {
+        if(msg.data.id == ID_ZDAT && ss->compressed) {
+            if(read_zdata(ss, &msg, &len))
+                goto fail;
+        } else if(msg.data.id != ID_DATA) {
             if(msg.data.id == ID_DONE) {
                 timestamp = ltohl(msg.data.size);
                 break;
             }
-            fail_message(s, "invalid data message");
+            fail_message(ss, "invalid data message");
             goto fail;
+        } else {
+            len = ltohl(msg.data.size);
+            if(len > SYNC_DATA_MAX) {
+                fail_message(ss, "oversize data message");
+                goto fail;
+            }
         }
-        len = ltohl(msg.data.size);
-        if(len > SYNC_DATA_MAX) {
-            fail_message(s, "oversize data message");
-            goto fail;
+
+        if(fd >= 0 && offset >= PUSH_LARGE) {
+            if(use_fallocate && offset + len > allocated) {
+                if(fallocate64(fd, 0, offset, PUSH_PREALLOCATE) == 0) {
+                    allocated = offset + PUSH_PREALLOCATE;
+                } else {
+                    use_fallocate = false;
+                }
+            }
+            if(offset - written_back >= PUSH_WRITEBACK) {
+                posix_fadvise64(fd, written_back, offset - written_back,
+                              POSIX_FADV_DONTNEED);
+                written_back = offset;
+            }
         }
-        if(!ReadFdExactly(s, buffer, len))
-            goto fail;
 
-        if(fd < 0)
-            continue;
-        if(!WriteFdExactly(fd, buffer, len)) {
-            int saved_errno = errno;
+        if(fd >= 0 && use_splice && len >= SPLICE_MIN && p[0] < 0) {
+            if(pipe2(p, O_CLOEXEC) ||
+               fcntl(p[1], F_SETPIPE_SZ, SYNC_DATA_MAX) < SYNC_DATA_MAX) {
+                if(p[0] >= 0) adb_close(p[0]);
+                if(p[1] >= 0) adb_close(p[1]);
+                p[0] = p[1] = -1;
+                use_splice = false;
+            }
+        }
+
+        int r = 1;
+        if(msg.data.id == ID_ZDAT) {
+                /* already expanded into the buffer */
+            if(fd >= 0 && !WriteFdExactly(fd, buffer, len))
+                file_errno = errno;
+            r = 0;
+        } else if(fd >= 0 && use_splice && len >= SPLICE_MIN) {
+            r = splice_data(s, fd, p, len, buffer, &use_splice, &file_errno);
+            if(r < 0) goto fail;
+        }
+        if(r > 0) {
+            if(!ReadFdExactly(s, buffer, len))
+                goto fail;
+            if(fd >= 0 && !WriteFdExactly(fd, buffer, len))
+                file_errno = errno;
+        }
+        offset += len;
+
+        if(file_errno) {
             adb_close(fd);
             if (do_unlink) adb_unlink(path);
             fd = -1;
-            errno = saved_errno;
-            if(fail_errno(s)) return -1;
+            errno = file_errno;
+            if(fail_file(ss)) goto fail;
         }
     }
 
+    if(p[0] >= 0) {
+        adb_close(p[0]);
+        adb_close(p[1]);
+    }
+
     if(fd >= 0) {
         struct utimbuf u;
+        if(allocated > offset && ftruncate64(fd, offset)) {
+            int saved_errno = errno;
+            adb_close(fd);
+            if (do_unlink) adb_unlink(path);
+            errno = saved_errno;
+            return fail_file(ss) ? -1 : 0;
+        }
         adb_close(fd);
         selinux_android_restorecon(path, 0);
         u.actime = timestamp;
         u.modtime = timestamp;
         utime(path, &u);
 
-        msg.status.id = ID_OKAY;
-        msg.status.msglen = 0;
-        if(!WriteFdExactly(s, &msg.status, sizeof(msg.status)))
+        if(okay_file(ss))
             return -1;
     }
     return 0;
 
 fail:
-    if(fd >= 0)
+    if(p[0] >= 0) {
+        adb_close(p[0]);
+        adb_close(p[1]);
+    }
+    if(fd >= 0) {
+        if(allocated > offset) ftruncate64(fd, offset);
         adb_close(fd);
+    }
     if (do_unlink) adb_unlink(path);
     return -1;
 }
 
 #if defined(_WIN32)
-extern int handle_send_link(int s, char *path, char *buffer) __attribute__((error("no symlinks on Windows")));
+extern int handle_send_link(sync_session *ss, char *path) __attribute__((error("no symlinks on Windows")));
 #else
-static int handle_send_link(int s, char *path, char *buffer)
+static int handle_send_link(sync_session *ss, char *path)
 {
+    int s = ss->s;
+    char *buffer = ss->buffer;
     syncmsg msg;
     unsigned int len;
     int ret;
@@ -280,13 +538,13 @@ static int handle_send_link(int s, char *path, char *buffer)
         return -1;
 
     if(msg.data.id != ID_DATA) {
-        fail_message(s, "invalid data message: expected ID_DATA");
+        fail_message(ss, "invalid data message: expected ID_DATA");
         return -1;
     }
 
     len = ltohl(msg.data.size);
     if(len > SYNC_DATA_MAX) {
-        fail_message(s, "oversize data message");
+        fail_message(ss, "oversize data message");
         return -1;
     }
     if(!ReadFdExactly(s, buffer, len))
@@ -294,27 +552,23 @@ static int handle_send_link(int s, char *path, char *buffer)
 
     ret = symlink(buffer, path);
     if(ret && errno == ENOENT) {
-        if(mkdirs(path) != 0) {
-            fail_errno(s);
-            return -1;
-        }
-        ret = symlink(buffer, path);
+        ret = mkdirs(path);
+        if(ret == 0) ret = symlink(buffer, path);
     }
     if(ret) {
-        fail_errno(s);
-        return -1;
+            /* only a window can carry on past the DONE we have not read */
+        fail_file(ss);
+        if(!ss->pipelined) return -1;
     }
 
     if(!ReadFdExactly(s, &msg.data, sizeof(msg.data)))
         return -1;
 
     if(msg.data.id == ID_DONE) {
-        msg.status.id = ID_OKAY;
-        msg.status.msglen = 0;
-        if(!WriteFdExactly(s, &msg.status, sizeof(msg.status)))
+        if(!ret && okay_file(ss))
             return -1;
     } else {
-        fail_message(s, "invalid data message: expected ID_DONE");
+        fail_message(ss, "invalid data message: expected ID_DONE");
         return -1;
     }
 
@@ -322,12 +576,35 @@ static int handle_send_link(int s, char *path, char *buffer)
 }
 #endif
 
-static int do_send(int s, char *path, char *buffer)
+/* The owner and mode a file sent to path is given */
+static void send_file_attrs(const char *path, unsigned *mode, uid_t *uid, gid_t *gid)
+{
+    uint64_t cap = 0;
+
+    /* copy user permission bits to "group" and "other" permissions */
+    *mode |= ((*mode >> 3) & 0070);
+    *mode |= ((*mode >> 3) & 0007);
+
+    if (should_use_fs_config(path)) {
+        fs_config(path[0] == '/' ? path + 1 : path, 0, NULL, uid, gid, mode, &cap);
+    }
+}
+
+static int do_send(sync_session *ss, char *path)
 {
     unsigned int mode;
     bool is_link = false;
     bool do_unlink;
 
+    if(ss->pipelined) {
+        if(ss->files >= SYNC_WINDOW) {
+            fail_message(ss, "too many files in flight");
+            return -1;
+        }
+        ss->files++;
+        ss->failed = false;
+    }
+
     char* tmp = strrchr(path,',');
     if(tmp) {
         *tmp = 0;
@@ -350,45 +627,149 @@ static int do_send(int s, char *path, char *buffer)
     }
 
     if (is_link) {
-        return handle_send_link(s, path, buffer);
+        return handle_send_link(ss, path);
     }
 
     uid_t uid = -1;
     gid_t gid = -1;
-    uint64_t cap = 0;
+    send_file_attrs(path, &mode, &uid, &gid);
+    return handle_send_file(ss, path, uid, gid, mode, do_unlink);
+}
 
-    /* copy user permission bits to "group" and "other" permissions */
-    mode |= ((mode >> 3) & 0070);
-    mode |= ((mode >> 3) & 0007);
+/* Sends up to size bytes of the file with sendfile(), one DATA chunk at
+** a time, stopping early if the file can not be sent from. Returns -1 if
+** the socket failed or the file came up short of a chunk already
+** announced, the read loop goes on from the file position otherwise.
+*/
+static int sendfile_data(int s, int fd, off64_t size, char *buffer)
+{
+    syncmsg msg;
+    off64_t sent = 0;
 
-    tmp = path;
-    if(*tmp == '/') {
-        tmp++;
+    msg.data.id = ID_DATA;
+    while(sent < size) {
+        size_t len = (size - sent > SYNC_DATA_MAX) ? SYNC_DATA_MAX : size - sent;
+        size_t done = 0;
+
+        msg.data.size = htoll(len);
+        if(!WriteFdExactly(s, &msg.data, sizeof(msg.data))) return -1;
+
+        while(done < len) {
+            ssize_t n = sendfile(s, fd, NULL, len - done);
+            if(n > 0) {
+                done += n;
+            } else if(n < 0 && errno == EINTR) {
+                continue;
+            } else if(n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    /* finish the chunk through the buffer */
+                if(!ReadFdExactly(fd, buffer, len - done) ||
+                   !WriteFdExactly(s, buffer, len - done)) {
+                    return -1;
+                }
+                return 0;
+            } else {
+                return -1;
+            }
+        }
+        sent += len;
     }
-    if (should_use_fs_config(path)) {
-        fs_config(tmp, 0, NULL, &uid, &gid, &mode, &cap);
+    return 0;
+}
+
+/* Incompressible chunks in a row after which a RECV stops compressing */
+#define RECV_INCOMPRESSIBLE_MAX 4
+
+/* Sends the file from its current position, compressing each chunk that
+** shrinks, until the end or until the data does not look compressible.
+** Returns how much was sent, or -1 if the socket or the file failed.
+*/
+static off64_t send_compressed(sync_session *ss, int fd)
+{
+    syncmsg msg;
+    off64_t sent = 0;
+    int misses = 0;
+
+    while(misses < RECV_INCOMPRESSIBLE_MAX) {
+        int r = adb_read(fd, ss->buffer, SYNC_DATA_MAX);
+        if(r == 0) break;
+        if(r < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+
+        size_t size = CompressChunk(ss->buffer, r, ss->zbuffer, SYNC_DATA_MAX);
+        if(size > 0) {
+            msg.zdata.id = ID_ZDAT;
+            msg.zdata.size = htoll(size);
+            msg.zdata.rawsize = htoll(r);
+            if(!WriteFdExactly(ss->s, &msg.zdata, sizeof(msg.zdata)) ||
+               !WriteFdExactly(ss->s, ss->zbuffer, size)) {
+                return -1;
+            }
+            misses = 0;
+        } else {
+            msg.data.id = ID_DATA;
+            msg.data.size = htoll(r);
+            if(!WriteFdExactly(ss->s, &msg.data, sizeof(msg.data)) ||
+               !WriteFdExactly(ss->s, ss->buffer, r)) {
+                return -1;
+            }
+            misses++;
+        }
+        sent += r;
     }
-    return handle_send_file(s, path, uid, gid, mode, buffer, do_unlink);
+    return sent;
 }
 
-static int do_recv(int s, const char *path, char *buffer)
+static int do_recv(sync_session *ss, const char *path)
 {
+    int s = ss->s;
+    char *buffer = ss->buffer;
     syncmsg msg;
+    struct stat st;
     int fd, r;
 
     fd = adb_open(path, O_RDONLY | O_CLOEXEC);
     if(fd < 0) {
-        if(fail_errno(s)) return -1;
+        if(fail_errno(ss)) return -1;
         return 0;
     }
 
+    if(!sync_flush(ss)) {
+        adb_close(fd);
+        return -1;
+    }
+
+        /* regular files go out through sendfile(), the read loop then
+        ** picks up whatever is left, if they grew or can not be sent from.
+        ** When compressing they are read through the buffer until it is
+        ** clear the data does not compress.
+        */
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off64_t sent = 0;
+
+        posix_fadvise64(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if(ss->compressed) {
+            sent = send_compressed(ss, fd);
+            if(sent < 0) {
+                adb_close(fd);
+                return -1;
+            }
+        }
+        if(sent < st.st_size &&
+           sendfile_data(s, fd, st.st_size - sent, buffer) < 0) {
+            adb_close(fd);
+            return -1;
+        }
+    }
+
     msg.data.id = ID_DATA;
     for(;;) {
         r = adb_read(fd, buffer, SYNC_DATA_MAX);
         if(r <= 0) {
             if(r == 0) break;
             if(errno == EINTR) continue;
-            r = fail_errno(s);
+            r = fail_errno(ss);
             adb_close(fd);
             return r;
         }
@@ -404,10 +785,265 @@ static int do_recv(int s, const char *path, char *buffer)
 
     msg.data.id = ID_DONE;
     msg.data.size = 0;
-    if(!WriteFdExactly(s, &msg.data, sizeof(msg.data))) {
+    if(!sync_reply(ss, &msg.data, sizeof(msg.data))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Signs each whole block of the file for a delta push. A file that can
+** not be read, is not regular or is too large has no blocks.
+*/
+static int do_sigs(sync_session *ss, const char *path)
+{
+    syncmsg msg;
+    struct stat st;
+    BlockSignature sig;
+    size_t block_size = 0;
+    unsigned count = 0;
+    int fd;
+
+    fd = adb_open(path, O_RDONLY | O_CLOEXEC);
+    if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size <= UINT_MAX) {
+        block_size = DeltaBlockSize(st.st_size);
+        count = st.st_size / block_size;
+        posix_fadvise64(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    ss->delta_block_size = block_size;
+
+    msg.sigs.id = ID_SIGS;
+    msg.sigs.block_size = htoll(block_size);
+    msg.sigs.count = htoll(count);
+    if(!sync_reply(ss, &msg.sigs, sizeof(msg.sigs))) {
+        if(fd >= 0) adb_close(fd);
+        return -1;
+    }
+
+    bool readable = true;
+    for(unsigned i = 0; i < count; i++) {
+            /* a file that shrank meanwhile gets signatures nothing matches */
+        if(readable && !ReadFdExactly(fd, ss->buffer, block_size)) readable = false;
+        if(readable) {
+            const uint8_t *block = reinterpret_cast<const uint8_t*>(ss->buffer);
+            sig.weak = htoll(DeltaWeakChecksum(block, block_size));
+            DeltaStrongHash(block, block_size, sig.strong);
+        } else {
+            memset(&sig, 0, sizeof(sig));
+        }
+        if(!sync_reply(ss, &sig, sizeof(sig))) {
+            adb_close(fd);
+            return -1;
+        }
+    }
+
+    if(fd >= 0) adb_close(fd);
+    return 0;
+}
+
+/* Rebuilds the file at path from literal data and blocks of the file
+** there, into a temporary file that replaces it once complete and found
+** to match the hash the client sent. The outcome is always reported
+** right away, whether pipelined or not.
+*/
+static int do_delta(sync_session *ss, char *path)
+{
+    int s = ss->s;
+    char *buffer = ss->buffer;
+    size_t block_size = ss->delta_block_size;
+    syncmsg msg;
+    unsigned mode = 0644;
+    unsigned timestamp = 0;
+    uid_t uid = -1;
+    gid_t gid = -1;
+    SHA_CTX sha;
+    uint8_t expected[SHA_DIGEST_SIZE];
+    bool have_hash = false;
+    const char *reason = NULL;
+    int file_errno = 0;
+
+    char *tmp = strrchr(path, ',');
+    if(tmp) {
+        *tmp = 0;
+        mode = strtoul(tmp + 1, NULL, 0) & 0777;
+    }
+    send_file_attrs(path, &mode, &uid, &gid);
+
+    std::string temp = std::string(path) + ".adbdelta";
+    int base = adb_open(path, O_RDONLY | O_CLOEXEC);
+    int fd = -1;
+    if(base < 0 || block_size == 0) {
+        file_errno = base < 0 ? errno : EINVAL;
+    } else {
+        fd = adb_open_mode(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+        if(fd < 0) file_errno = errno;
+    }
+    SHA_init(&sha);
+
+    for(;;) {
+        unsigned len = 0;
+
+        if(!ReadFdExactly(s, &msg.data, sizeof(msg.data)))
+            goto fail;
+
+        if(msg.data.id == ID_DONE) {
+            timestamp = ltohl(msg.data.size);
+            break;
+        } else if(msg.data.id == ID_HASH) {
+            if(ltohl(msg.data.size) != SHA_DIGEST_SIZE) {
+                fail_message(ss, "invalid hash message");
+                goto fail;
+            }
+            if(!ReadFdExactly(s, expected, SHA_DIGEST_SIZE))
+                goto fail;
+            have_hash = true;
+            continue;
+        } else if(msg.data.id == ID_COPY) {
+            if(!ReadFdExactly(s, &msg.copy.count, sizeof(msg.copy.count)))
+                goto fail;
+            unsigned block = ltohl(msg.copy.block);
+            unsigned count = ltohl(msg.copy.count);
+            for(unsigned i = 0; i < count && fd >= 0; i++) {
+                off64_t offset = (off64_t) (block + i) * block_size;
+                if(pread64(base, buffer, block_size, offset) != (ssize_t) block_size) {
+                    reason = "file on device changed during push";
+                    break;
+                }
+                SHA_update(&sha, buffer, block_size);
+                if(!WriteFdExactly(fd, buffer, block_size)) {
+                    file_errno = errno;
+                    break;
+                }
+            }
+        } else if(msg.data.id == ID_ZDAT && ss->compressed) {
+            if(read_zdata(ss, &msg, &len))
+                goto fail;
+        } else if(msg.data.id == ID_DATA) {
+            len = ltohl(msg.data.size);
+            if(len > SYNC_DATA_MAX) {
+                fail_message(ss, "oversize data message");
+                goto fail;
+            }
+            if(!ReadFdExactly(s, buffer, len))
+                goto fail;
+        } else {
+            fail_message(ss, "invalid data message");
+            goto fail;
+        }
+
+        if(len > 0 && fd >= 0) {
+            SHA_update(&sha, buffer, len);
+            if(!WriteFdExactly(fd, buffer, len)) file_errno = errno;
+        }
+        if((file_errno || reason) && fd >= 0) {
+            adb_close(fd);
+            adb_unlink(temp.c_str());
+            fd = -1;
+        }
+    }
+
+    if(base >= 0) adb_close(base);
+    if(fd >= 0 && (!have_hash || memcmp(SHA_final(&sha), expected, SHA_DIGEST_SIZE))) {
+        reason = "delta does not match";
+    }
+    if(fd >= 0 && !reason) {
+        if(fchown(fd, uid, gid) != 0) {
+            file_errno = errno;
+        } else {
+                /* fchown clears the setuid bit, as for SEND */
+            fchmod(fd, mode);
+        }
+    }
+    if(fd >= 0) {
+        adb_close(fd);
+        if(!reason && !file_errno && rename(temp.c_str(), path) != 0) {
+            file_errno = errno;
+        }
+        if(reason || file_errno) adb_unlink(temp.c_str());
+    }
+    if(reason) return fail_message(ss, reason);
+    if(file_errno) {
+        errno = file_errno;
+        return fail_errno(ss);
+    }
+
+    struct utimbuf u;
+    selinux_android_restorecon(path, 0);
+    u.actime = timestamp;
+    u.modtime = timestamp;
+    utime(path, &u);
+
+    msg.status.id = ID_OKAY;
+    msg.status.msglen = 0;
+    return sync_reply(ss, &msg.status, sizeof(msg.status)) ? 0 : -1;
+
+fail:
+    if(base >= 0) adb_close(base);
+    if(fd >= 0) {
+        adb_close(fd);
+        adb_unlink(temp.c_str());
+    }
+    return -1;
+}
+
+static int do_cmpr(sync_session *ss)
+{
+    syncmsg msg;
+
+    if(ss->zbuffer == 0) {
+        ss->zbuffer = reinterpret_cast<char*>(malloc(SYNC_DATA_MAX));
+        if(ss->zbuffer == 0) {
+            fail_message(ss, "out of memory");
+            return -1;
+        }
+    }
+    ss->compressed = true;
+    msg.status.id = ID_OKAY;
+    msg.status.msglen = 0;
+    return sync_reply(ss, &msg.status, sizeof(msg.status)) ? 0 : -1;
+}
+
+static int do_pipe(sync_session *ss)
+{
+    syncmsg msg;
+
+    ss->pipelined = true;
+    msg.status.id = ID_OKAY;
+    msg.status.msglen = htoll(SYNC_WINDOW);
+    return sync_reply(ss, &msg.status, sizeof(msg.status)) ? 0 : -1;
+}
+
+/* Acknowledges the SENDs since the last ACKS, followed by a record for
+** each one that failed
+*/
+static int do_acks(sync_session *ss)
+{
+    syncmsg msg;
+
+    if(!ss->pipelined) {
+        fail_message(ss, "not pipelined");
+        return -1;
+    }
+
+    msg.acks.id = ID_ACKS;
+    msg.acks.count = htoll(ss->files);
+    msg.acks.failed = htoll(ss->failures.size());
+    if(!sync_reply(ss, &msg.acks, sizeof(msg.acks)))
         return -1;
+
+    for(size_t i = 0; i < ss->failures.size(); i++) {
+        const std::string& reason = ss->failures[i].reason;
+        msg.failure.id = ID_FAIL;
+        msg.failure.index = htoll(ss->failures[i].index);
+        msg.failure.msglen = htoll(reason.size());
+        if(!sync_reply(ss, &msg.failure, sizeof(msg.failure)) ||
+           !sync_reply(ss, reason.data(), reason.size())) {
+            return -1;
+        }
     }
 
+    ss->files = 0;
+    ss->failures.clear();
     return 0;
 }
 
@@ -416,24 +1052,36 @@ void file_sync_service(int fd, void *cookie)
     syncmsg msg;
     char name[1025];
     unsigned namelen;
-
-    char *buffer = reinterpret_cast<char*>(malloc(SYNC_DATA_MAX));
-    if(buffer == 0) goto fail;
+    sync_session ss;
+
+    ss.s = fd;
+    ss.buffer = reinterpret_cast<char*>(malloc(SYNC_DATA_MAX));
+    ss.reply = reinterpret_cast<char*>(malloc(SYNC_DATA_MAX));
+    ss.reply_len = 0;
+    ss.pipelined = false;
+    ss.files = 0;
+    ss.failed = false;
+    ss.compressed = false;
+    ss.zbuffer = 0;
+    ss.delta_block_size = 0;
+    if(ss.buffer == 0 || ss.reply == 0) goto fail;
 
     for(;;) {
+        if(!sync_pending(fd) && !sync_flush(&ss)) break;
+
         D("sync: waiting for command\n");
 
         if(!ReadFdExactly(fd, &msg.req, sizeof(msg.req))) {
-            fail_message(fd, "command read failure");
+            fail_message(&ss, "command read failure");
             break;
         }
         namelen = ltohl(msg.req.namelen);
         if(namelen > 1024) {
-            fail_message(fd, "invalid namelen");
+            fail_message(&ss, "invalid namelen");
             break;
         }
         if(!ReadFdExactly(fd, name, namelen)) {
-            fail_message(fd, "filename read failure");
+            fail_message(&ss, "filename read failure");
             break;
         }
         name[namelen] = 0;
@@ -443,27 +1091,44 @@ void file_sync_service(int fd, void *cookie)
 
         switch(msg.req.id) {
         case ID_STAT:
-            if(do_stat(fd, name)) goto fail;
+            if(do_stat(&ss, name)) goto fail;
             break;
         case ID_LIST:
-            if(do_list(fd, name)) goto fail;
+            if(do_list(&ss, name)) goto fail;
             break;
         case ID_SEND:
-            if(do_send(fd, name, buffer)) goto fail;
+            if(do_send(&ss, name)) goto fail;
             break;
         case ID_RECV:
-            if(do_recv(fd, name, buffer)) goto fail;
+            if(do_recv(&ss, name)) goto fail;
+            break;
+        case ID_PIPE:
+            if(do_pipe(&ss)) goto fail;
+            break;
+        case ID_ACKS:
+            if(do_acks(&ss)) goto fail;
+            break;
+        case ID_CMPR:
+            if(do_cmpr(&ss)) goto fail;
+            break;
+        case ID_SIGS:
+            if(do_sigs(&ss, name)) goto fail;
+            break;
+        case ID_DLTA:
+            if(do_delta(&ss, name)) goto fail;
             break;
         case ID_QUIT:
             goto fail;
         default:
-            fail_message(fd, "unknown command");
+            fail_message(&ss, "unknown command");
             goto fail;
         }
     }
 
 fail:
-    if(buffer != 0) free(buffer);
+    free(ss.zbuffer);
+    free(ss.reply);
+    free(ss.buffer);
     D("sync: done\n");
     adb_close(fd);
 }
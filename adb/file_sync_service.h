@@ -35,6 +35,14 @@
 #define ID_OKAY MKID('O','K','A','Y')
 #define ID_FAIL MKID('F','A','I','L')
 #define ID_QUIT MKID('Q','U','I','T')
+#define ID_PIPE MKID('P','I','P','E')
+#define ID_ACKS MKID('A','C','K','S')
+#define ID_CMPR MKID('C','M','P','R')
+#define ID_ZDAT MKID('Z','D','A','T')
+#define ID_SIGS MKID('S','I','G','S')
+#define ID_DLTA MKID('D','L','T','A')
+#define ID_COPY MKID('C','O','P','Y')
+#define ID_HASH MKID('H','A','S','H')
 
 union syncmsg {
     unsigned id;
@@ -59,19 +67,52 @@ union syncmsg {
         unsigned id;
         unsigned size;
     } data;
+    struct {
+        unsigned id;
+        unsigned size;
+        unsigned rawsize;
+    } zdata;
     struct {
         unsigned id;
         unsigned msglen;
     } status;
+    struct {
+        unsigned id;
+        unsigned count;
+        unsigned failed;
+    } acks;
+    struct {
+        unsigned id;
+        unsigned index;
+        unsigned msglen;
+    } failure;
+    struct {
+        unsigned id;
+        unsigned block_size;
+        unsigned count;
+    } sigs;
+    struct {
+        unsigned id;
+        unsigned block;
+        unsigned count;
+    } copy;
 } ;
 
 
 void file_sync_service(int fd, void *cookie);
 int do_sync_ls(const char *path);
-int do_sync_push(const char *lpath, const char *rpath, int show_progress);
+int do_sync_push(const char *lpath, const char *rpath, int show_progress, bool compress);
 int do_sync_sync(const std::string& lpath, const std::string& rpath, bool list_only);
-int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int pullTime);
+int do_sync_pull(const char *rpath, const char *lpath, int show_progress, int pullTime, bool compress);
 
 #define SYNC_DATA_MAX (64*1024)
 
+/* SENDs the device takes without acknowledging once pipelined */
+#define SYNC_WINDOW 256
+
+/* Files at least this large, when already on the device, are pushed as
+** a delta against what is there
+*/
+#define SYNC_DELTA_MIN (1024*1024)
+
 #endif
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#define TRACE_TAG TRACE_SERVICES
+
 #include <errno.h>
 #include <fcntl.h>
 #include <linux/fb.h>
@@ -24,52 +26,39 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "sysdeps.h"
 
 #include "adb.h"
+#include "adb_compress.h"
 #include "adb_io.h"
 #include "fdevent.h"
+#include "framebuffer_service.h"
 
 /* TODO:
 ** - sync with vsync to avoid tearing
 */
-/* This version number defines the format of the fbinfo struct.
-   It must match versioning in ddms where this data is consumed. */
-#define DDMS_RAWIMAGE_VERSION 1
-struct fbinfo {
-    unsigned int version;
-    unsigned int bpp;
-    unsigned int size;
-    unsigned int width;
-    unsigned int height;
-    unsigned int red_offset;
-    unsigned int red_length;
-    unsigned int blue_offset;
-    unsigned int blue_length;
-    unsigned int green_offset;
-    unsigned int green_length;
-    unsigned int alpha_offset;
-    unsigned int alpha_length;
-} __attribute__((packed));
 
-void framebuffer_service(int fd, void *cookie)
+/* Starts screencap with its output on a pipe, returning the read end. */
+static int start_screencap(pid_t* pid)
 {
-    struct fbinfo fbinfo;
-    unsigned int i, bsize;
-    char buf[640];
-    int fd_screencap;
-    int w, h, f;
     int fds[2];
-    pid_t pid;
 
-    if (pipe2(fds, O_CLOEXEC) < 0) goto pipefail;
+    if (pipe2(fds, O_CLOEXEC) < 0) return -1;
 
-    pid = fork();
-    if (pid < 0) goto done;
+    *pid = fork();
+    if (*pid < 0) {
+        adb_close(fds[0]);
+        adb_close(fds[1]);
+        return -1;
+    }
 
-    if (pid == 0) {
+    if (*pid == 0) {
         dup2(fds[1], STDOUT_FILENO);
         adb_close(fds[0]);
         adb_close(fds[1]);
@@ -80,89 +69,109 @@ void framebuffer_service(int fd, void *cookie)
     }
 
     adb_close(fds[1]);
-    fd_screencap = fds[0];
+    return fds[0];
+}
+
+/* Reads the w, h & format screencap starts with into fbinfo. */
+static bool read_screencap_header(int fd_screencap, struct fbinfo* fbinfo)
+{
+    int w, h, f;
 
-    /* read w, h & format */
-    if(!ReadFdExactly(fd_screencap, &w, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &h, 4)) goto done;
-    if(!ReadFdExactly(fd_screencap, &f, 4)) goto done;
+    if(!ReadFdExactly(fd_screencap, &w, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &h, 4)) return false;
+    if(!ReadFdExactly(fd_screencap, &f, 4)) return false;
 
-    fbinfo.version = DDMS_RAWIMAGE_VERSION;
+    fbinfo->version = DDMS_RAWIMAGE_VERSION;
     /* see hardware/hardware.h */
     switch (f) {
         case 1: /* RGBA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
             break;
         case 2: /* RGBX_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
             break;
         case 3: /* RGB_888 */
-            fbinfo.bpp = 24;
-            fbinfo.size = w * h * 3;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 0;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 16;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 24;
+            fbinfo->size = w * h * 3;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 0;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 16;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 0;
             break;
         case 4: /* RGB_565 */
-            fbinfo.bpp = 16;
-            fbinfo.size = w * h * 2;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 11;
-            fbinfo.red_length = 5;
-            fbinfo.green_offset = 5;
-            fbinfo.green_length = 6;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 5;
-            fbinfo.alpha_offset = 0;
-            fbinfo.alpha_length = 0;
+            fbinfo->bpp = 16;
+            fbinfo->size = w * h * 2;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 11;
+            fbinfo->red_length = 5;
+            fbinfo->green_offset = 5;
+            fbinfo->green_length = 6;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 5;
+            fbinfo->alpha_offset = 0;
+            fbinfo->alpha_length = 0;
             break;
         case 5: /* BGRA_8888 */
-            fbinfo.bpp = 32;
-            fbinfo.size = w * h * 4;
-            fbinfo.width = w;
-            fbinfo.height = h;
-            fbinfo.red_offset = 16;
-            fbinfo.red_length = 8;
-            fbinfo.green_offset = 8;
-            fbinfo.green_length = 8;
-            fbinfo.blue_offset = 0;
-            fbinfo.blue_length = 8;
-            fbinfo.alpha_offset = 24;
-            fbinfo.alpha_length = 8;
+            fbinfo->bpp = 32;
+            fbinfo->size = w * h * 4;
+            fbinfo->width = w;
+            fbinfo->height = h;
+            fbinfo->red_offset = 16;
+            fbinfo->red_length = 8;
+            fbinfo->green_offset = 8;
+            fbinfo->green_length = 8;
+            fbinfo->blue_offset = 0;
+            fbinfo->blue_length = 8;
+            fbinfo->alpha_offset = 24;
+            fbinfo->alpha_length = 8;
            break;
         default:
-            goto done;
+            return false;
     }
+    return true;
+}
+
+void framebuffer_service(int fd, void *cookie)
+{
+    struct fbinfo fbinfo;
+    unsigned int i, bsize;
+    char buf[640];
+    int fd_screencap;
+    pid_t pid;
+
+    fd_screencap = start_screencap(&pid);
+    if (fd_screencap < 0) goto pipefail;
+
+    if(!read_screencap_header(fd_screencap, &fbinfo)) goto done;
 
     /* write header */
     if(!WriteFdExactly(fd, &fbinfo, sizeof(fbinfo))) goto done;
@@ -177,9 +186,119 @@ void framebuffer_service(int fd, void *cookie)
     }
 
 done:
-    adb_close(fds[0]);
+    adb_close(fd_screencap);
 
     TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
 pipefail:
     adb_close(fd);
 }
+
+/* Appends the tiles of frame that differ from prev, all of them if prev
+** is empty, to msg, returning how many there were.
+*/
+static unsigned append_changed_tiles(const struct fbinfo& fbinfo,
+                                     const std::vector<char>& prev,
+                                     const std::vector<char>& frame, bool compress,
+                                     std::vector<char>* msg)
+{
+    size_t pixel = fbinfo.bpp / 8;
+    size_t stride = fbinfo.width * pixel;
+    std::vector<char> raw;
+    unsigned tiles = 0;
+
+    for (unsigned y = 0; y < fbinfo.height; y += FB_TILE_SIZE) {
+        unsigned h = std::min<unsigned>(FB_TILE_SIZE, fbinfo.height - y);
+        for (unsigned x = 0; x < fbinfo.width; x += FB_TILE_SIZE) {
+            unsigned w = std::min<unsigned>(FB_TILE_SIZE, fbinfo.width - x);
+            size_t row = w * pixel;
+
+            bool changed = prev.empty();
+            for (unsigned r = 0; !changed && r < h; r++) {
+                size_t offset = (y + r) * stride + x * pixel;
+                changed = memcmp(&prev[offset], &frame[offset], row) != 0;
+            }
+            if (!changed) continue;
+
+            raw.resize(row * h);
+            for (unsigned r = 0; r < h; r++) {
+                memcpy(&raw[r * row], &frame[(y + r) * stride + x * pixel], row);
+            }
+
+            struct fbtile tile = { x, y, w, h, 0, static_cast<uint32_t>(raw.size()) };
+            size_t at = msg->size();
+            msg->resize(at + sizeof(tile) + raw.size());
+            char* data = &(*msg)[at + sizeof(tile)];
+            size_t size = compress ? CompressChunk(raw.data(), raw.size(), data, raw.size()) : 0;
+            if (size == 0) {
+                memcpy(data, raw.data(), raw.size());
+                size = raw.size();
+            }
+            msg->resize(at + sizeof(tile) + size);
+            tile.size = size;
+            memcpy(&(*msg)[at], &tile, sizeof(tile));
+            tiles++;
+        }
+    }
+    return tiles;
+}
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Captures frames at up to the requested rate, sending only the tiles
+** that changed since the last one.
+*/
+void framebuffer_stream_service(int fd, void *cookie)
+{
+    framebuffer_stream_args* args = reinterpret_cast<framebuffer_stream_args*>(cookie);
+    int fps = std::max(1, std::min(args->fps, FB_STREAM_FPS_MAX));
+    bool compress = args->compress;
+    free(args);
+
+    struct fbinfo fbinfo;
+    std::vector<char> prev, frame, msg;
+
+    for (;;) {
+        int64_t start = now_ms();
+        struct fbinfo current;
+        pid_t pid;
+        int fd_screencap = start_screencap(&pid);
+        if (fd_screencap < 0) break;
+
+        bool ok = read_screencap_header(fd_screencap, &current);
+        if (ok) {
+            frame.resize(current.size);
+            ok = ReadFdExactly(fd_screencap, frame.data(), frame.size());
+        }
+        adb_close(fd_screencap);
+        TEMP_FAILURE_RETRY(waitpid(pid, NULL, 0));
+        if (!ok) break;
+
+        if (prev.empty()) {
+            fbinfo = current;
+            if (!WriteFdExactly(fd, &fbinfo, sizeof(fbinfo))) break;
+        } else if (memcmp(&current, &fbinfo, sizeof(fbinfo))) {
+            /* the display changed shape, the client has to start over */
+            D("framebuffer-stream: format changed, ending stream\n");
+            break;
+        }
+
+        msg.resize(sizeof(fbframe));
+        struct fbframe header;
+        header.magic = FB_FRAME_MAGIC;
+        header.tiles = append_changed_tiles(fbinfo, prev, frame, compress, &msg);
+        memcpy(msg.data(), &header, sizeof(header));
+        if (!WriteFdExactly(fd, msg.data(), msg.size())) break;
+
+        prev.swap(frame);
+
+        int64_t wait = start + 1000 / fps - now_ms();
+        if (wait > 0) adb_sleep_ms(wait);
+    }
+
+    adb_close(fd);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEBUFFER_SERVICE_H_
+#define _FRAMEBUFFER_SERVICE_H_
+
+#include <stdint.h>
+
+/* This version number defines the format of the fbinfo struct.
+   It must match versioning in ddms where this data is consumed. */
+#define DDMS_RAWIMAGE_VERSION 1
+struct fbinfo {
+    unsigned int version;
+    unsigned int bpp;
+    unsigned int size;
+    unsigned int width;
+    unsigned int height;
+    unsigned int red_offset;
+    unsigned int red_length;
+    unsigned int blue_offset;
+    unsigned int blue_length;
+    unsigned int green_offset;
+    unsigned int green_length;
+    unsigned int alpha_offset;
+    unsigned int alpha_length;
+} __attribute__((packed));
+
+/* framebuffer-stream: sends the fbinfo once, then for each frame an
+** fbframe followed by that many tiles of it that changed, each an fbtile
+** and its pixels, row by row. A tile is deflated when its size is less
+** than its rawsize. See SERVICES.TXT.
+*/
+#define FB_TILE_SIZE 64
+#define FB_STREAM_FPS_MAX 60
+
+#define FB_FRAME_MAGIC 0x4d415246  /* "FRAM" */
+
+struct fbframe {
+    uint32_t magic;
+    uint32_t tiles;
+} __attribute__((packed));
+
+struct fbtile {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    uint32_t size;
+    uint32_t rawsize;
+} __attribute__((packed));
+
+/* what framebuffer_stream_service() takes as its cookie, freed by it */
+struct framebuffer_stream_args {
+    int fps;
+    bool compress;
+};
+
+#endif
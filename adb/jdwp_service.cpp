@@ -25,6 +25,12 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include <base/stringprintf.h>
+
 #include "adb.h"
 
 /* here's how these things work.
@@ -137,42 +143,40 @@ struct JdwpProcess {
 
 static JdwpProcess  _jdwp_list;
 
-static int
-jdwp_process_list( char*  buffer, int  bufferlen )
-{
-    char*         end  = buffer + bufferlen;
-    char*         p    = buffer;
-    JdwpProcess*  proc = _jdwp_list.next;
-
-    for ( ; proc != &_jdwp_list; proc = proc->next ) {
-        int  len;
+/* the processes that have told us their pid, by pid */
+static std::unordered_map<int, JdwpProcess*>  _jdwp_pids;
 
-        /* skip transient connections */
-        if (proc->pid < 0)
-            continue;
+/* the pids, one per line, rebuilt on demand after a change */
+static std::string  _jdwp_pid_list;
+static bool         _jdwp_pid_list_valid;
 
-        len = snprintf(p, end-p, "%d\n", proc->pid);
-        if (p + len >= end)
-            break;
-        p += len;
+static const std::string&
+jdwp_process_list()
+{
+    if (!_jdwp_pid_list_valid) {
+        JdwpProcess*  proc = _jdwp_list.next;
+
+        _jdwp_pid_list.clear();
+        for ( ; proc != &_jdwp_list; proc = proc->next ) {
+            /* skip transient connections */
+            if (proc->pid < 0)
+                continue;
+            android::base::StringAppendF(&_jdwp_pid_list, "%d\n", proc->pid);
+        }
+        _jdwp_pid_list_valid = true;
     }
-    p[0] = 0;
-    return (p - buffer);
+    return _jdwp_pid_list;
 }
 
 
-static int
-jdwp_process_list_msg( char*  buffer, int  bufferlen )
+static std::string
+jdwp_process_list_msg( const std::string&  body )
 {
-    char  head[5];
-    int   len = jdwp_process_list( buffer+4, bufferlen-4 );
-    snprintf(head, sizeof head, "%04x", len);
-    memcpy(buffer, head, 4);
-    return len + 4;
+    return android::base::StringPrintf("%04zx", body.size()) + body;
 }
 
 
-static void  jdwp_process_list_updated(void);
+static void  jdwp_process_list_updated(int  pid, bool  added);
 
 static void
 jdwp_process_free( JdwpProcess*  proc )
@@ -193,16 +197,22 @@ jdwp_process_free( JdwpProcess*  proc )
             fdevent_destroy(proc->fde);
             proc->fde = NULL;
         }
-        proc->pid = -1;
 
         for (n = 0; n < proc->out_count; n++) {
             adb_close(proc->out_fds[n]);
         }
         proc->out_count = 0;
 
+        int  pid = proc->pid;
+        auto  it = _jdwp_pids.find(pid);
+        bool  listed = (it != _jdwp_pids.end() && it->second == proc);
+        if (listed)
+            _jdwp_pids.erase(it);
+
         free(proc);
 
-        jdwp_process_list_updated();
+        if (listed)
+            jdwp_process_list_updated(pid, false);
     }
 }
 
@@ -294,7 +304,8 @@ jdwp_process_event( int  socket, unsigned  events, void*  _proc )
 
             /* all is well, keep reading to detect connection closure */
             D("Adding pid %d to jdwp process list\n", proc->pid);
-            jdwp_process_list_updated();
+            _jdwp_pids[proc->pid] = proc;
+            jdwp_process_list_updated(proc->pid, true);
         }
         else
         {
@@ -409,18 +420,16 @@ jdwp_process_event( int  socket, unsigned  events, void*  _proc )
 int
 create_jdwp_connection_fd(int  pid)
 {
-    JdwpProcess*  proc = _jdwp_list.next;
+    JdwpProcess*  proc;
 
     D("looking for pid %d in JDWP process list\n", pid);
-    for ( ; proc != &_jdwp_list; proc = proc->next ) {
-        if (proc->pid == pid) {
-            goto FoundIt;
-        }
+    auto  it = _jdwp_pids.find(pid);
+    if (it == _jdwp_pids.end()) {
+        D("search failed !!\n");
+        return -1;
     }
-    D("search failed !!\n");
-    return -1;
+    proc = it->second;
 
-FoundIt:
     {
         int  fds[2];
 
@@ -569,8 +578,9 @@ static JdwpControl   _jdwp_control;
  **/
 
 struct JdwpSocket {
-    asocket  socket;
-    int      pass;
+    asocket      socket;
+    std::string  list;   /* what is left to send */
+    bool         done;
 };
 
 static void
@@ -584,7 +594,7 @@ jdwp_socket_close( asocket*  s )
         peer->peer = NULL;
         peer->close(peer);
     }
-    free(s);
+    delete (JdwpSocket*)s;
 }
 
 static int
@@ -597,20 +607,39 @@ jdwp_socket_enqueue( asocket*  s, apacket*  p )
 }
 
 
+/* Sends as much of out as one packet to the peer of s takes. */
+static void
+jdwp_socket_send( asocket*  s, std::string*  out )
+{
+    asocket*  peer = s->peer;
+    size_t    payload = MAX_PAYLOAD_V1;
+
+    if (peer->transport)
+        payload = peer->transport->max_payload;
+
+    apacket*  p = get_apacket(payload);
+    p->len = std::min(out->size(), payload);
+    memcpy(p->data, out->data(), p->len);
+    out->erase(0, p->len);
+    peer->enqueue(peer, p);
+}
+
+
 static void
 jdwp_socket_ready( asocket*  s )
 {
     JdwpSocket*  jdwp = (JdwpSocket*)s;
     asocket*     peer = jdwp->socket.peer;
 
-   /* on the first call, send the list of pids,
-    * on the second one, close the connection
+   /* send the list of pids, as of the first call, then close the
+    * connection
     */
-    if (jdwp->pass == 0) {
-        apacket*  p = get_apacket();
-        p->len = jdwp_process_list((char*)p->data, MAX_PAYLOAD);
-        peer->enqueue(peer, p);
-        jdwp->pass = 1;
+    if (!jdwp->done) {
+        jdwp->list = jdwp_process_list();
+        jdwp->done = true;
+    }
+    if (!jdwp->list.empty()) {
+        jdwp_socket_send(s, &jdwp->list);
     }
     else {
         peer->close(peer);
@@ -620,51 +649,92 @@ jdwp_socket_ready( asocket*  s )
 asocket*
 create_jdwp_service_socket( void )
 {
-    JdwpSocket* s = reinterpret_cast<JdwpSocket*>(calloc(sizeof(*s), 1));
-
-    if (s == NULL)
-        return NULL;
+    JdwpSocket* s = new JdwpSocket();
 
     install_local_socket(&s->socket);
 
     s->socket.ready   = jdwp_socket_ready;
     s->socket.enqueue = jdwp_socket_enqueue;
     s->socket.close   = jdwp_socket_close;
-    s->pass           = 0;
+    s->done           = false;
 
     return &s->socket;
 }
 
 /** "track-jdwp" local service implementation
- ** this periodically sends the list of known JDWP process pids
- ** to the client...
+ ** this sends the list of known JDWP process pids to the client
+ ** whenever it changes...
+ **
+ ** "track-jdwp-delta" sends the list once, then only the pids that
+ ** come and go, which is what keeps a tracker cheap with hundreds of
+ ** processes.
+ **
+ ** either way, a tracker only has one packet in flight: changes made
+ ** while its peer is busy are sent together once it is ready again.
  **/
 
+/* a delta tracker that falls this far behind is sent the list again */
+#define  JDWP_DELTA_MAX  16384
+
 struct JdwpTracker {
     asocket       socket;
     JdwpTracker*  next;
     JdwpTracker*  prev;
-    int           need_update;
+    int           need_update;  /* the whole list is due */
+    bool          delta;
+    bool          busy;         /* waiting for the peer to be ready */
+    std::string   changes;      /* "+pid"/"-pid" lines not sent yet */
+    std::string   out;          /* the message being sent */
 };
 
 static JdwpTracker   _jdwp_trackers_list;
 
 
 static void
-jdwp_process_list_updated(void)
+jdwp_tracker_send( JdwpTracker*  t )
+{
+    if (t->busy || t->socket.peer == NULL)
+        return;
+
+    if (t->out.empty()) {
+        if (t->need_update) {
+            std::string  body = jdwp_process_list();
+            if (t->delta)
+                body = "=\n" + body;
+            t->out = jdwp_process_list_msg(body);
+            t->need_update = 0;
+            t->changes.clear();
+        } else if (!t->changes.empty()) {
+            t->out = jdwp_process_list_msg(t->changes);
+            t->changes.clear();
+        } else {
+            return;
+        }
+    }
+
+    t->busy = true;
+    jdwp_socket_send(&t->socket, &t->out);
+}
+
+
+static void
+jdwp_process_list_updated( int  pid, bool  added )
 {
-    char             buffer[1024];
-    int              len;
     JdwpTracker*  t = _jdwp_trackers_list.next;
 
-    len = jdwp_process_list_msg(buffer, sizeof(buffer));
+    _jdwp_pid_list_valid = false;
 
     for ( ; t != &_jdwp_trackers_list; t = t->next ) {
-        apacket*  p    = get_apacket();
-        asocket*  peer = t->socket.peer;
-        memcpy(p->data, buffer, len);
-        p->len = len;
-        peer->enqueue( peer, p );
+        if (t->delta && !t->need_update) {
+            android::base::StringAppendF(&t->changes, "%c%d\n", added ? '+' : '-', pid);
+            if (t->changes.size() > JDWP_DELTA_MAX) {
+                t->changes.clear();
+                t->need_update = 1;
+            }
+        } else {
+            t->need_update = 1;
+        }
+        jdwp_tracker_send(t);
     }
 }
 
@@ -684,7 +754,7 @@ jdwp_tracker_close( asocket*  s )
     tracker->prev->next = tracker->next;
     tracker->next->prev = tracker->prev;
 
-    free(s);
+    delete tracker;
 }
 
 static void
@@ -692,12 +762,8 @@ jdwp_tracker_ready( asocket*  s )
 {
     JdwpTracker*  t = (JdwpTracker*) s;
 
-    if (t->need_update) {
-        apacket*  p = get_apacket();
-        t->need_update = 0;
-        p->len = jdwp_process_list_msg((char*)p->data, sizeof(p->data));
-        s->peer->enqueue(s->peer, p);
-    }
+    t->busy = false;
+    jdwp_tracker_send(t);
 }
 
 static int
@@ -711,12 +777,9 @@ jdwp_tracker_enqueue( asocket*  s, apacket*  p )
 
 
 asocket*
-create_jdwp_tracker_service_socket( void )
+create_jdwp_tracker_service_socket( bool  delta )
 {
-    JdwpTracker* t = reinterpret_cast<JdwpTracker*>(calloc(sizeof(*t), 1));
-
-    if (t == NULL)
-        return NULL;
+    JdwpTracker* t = new JdwpTracker();
 
     t->next = &_jdwp_trackers_list;
     t->prev = t->next->prev;
@@ -730,6 +793,8 @@ create_jdwp_tracker_service_socket( void )
     t->socket.enqueue = jdwp_tracker_enqueue;
     t->socket.close   = jdwp_tracker_close;
     t->need_update    = 1;
+    t->delta          = delta;
+    t->busy           = true;   /* until the peer is first ready */
 
     return &t->socket;
 }
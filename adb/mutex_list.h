@@ -7,10 +7,14 @@
 #error ADB_MUTEX not defined when including this file
 #endif
 ADB_MUTEX(transport_lock)
+ADB_MUTEX(transport_stats_lock)
+ADB_MUTEX(transport_snapshot_lock)
 #if ADB_HOST
 ADB_MUTEX(local_transports_lock)
 #endif
+ADB_MUTEX(local_stripes_lock)
 ADB_MUTEX(usb_lock)
+ADB_MUTEX(apacket_lock)
 
 // Sadly logging to /data/adb/adb-... is not thread safe.
 //  After modifying adb.h::D() to count invocations:
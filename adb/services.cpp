@@ -27,6 +27,7 @@
 #ifndef _WIN32
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 #endif
@@ -41,8 +42,10 @@
 #endif
 
 #include "adb.h"
+#include "adb_compress.h"
 #include "adb_io.h"
 #include "file_sync_service.h"
+#include "framebuffer_service.h"
 #include "remount_service.h"
 #include "transport.h"
 
@@ -379,7 +382,68 @@ static void subproc_waiter_service(int fd, void *cookie)
     }
 }
 
-static int create_subproc_thread(const char *name, const subproc_mode mode)
+struct subproc_relay {
+    int fd;         /* the pty or socket of the subprocess */
+    pid_t pid;
+};
+
+/* Passes what comes from the client on to the subprocess as it is, and
+** what the subprocess writes back deflated, until the subprocess closes
+** its end or the client goes away.
+*/
+static void subproc_compress_service(int fd, void *cookie)
+{
+    subproc_relay* relay = reinterpret_cast<subproc_relay*>(cookie);
+    StreamDeflater deflater;
+    char buf[16 * 1024];
+    bool input_open = true;
+
+    D("compressing output of pid=%d fd=%d to fd=%d\n", relay->pid, relay->fd, fd);
+    while (true) {
+        pollfd pfds[2] = {
+            { relay->fd, POLLIN, 0 },
+            { fd, static_cast<short>(input_open ? POLLIN : 0), 0 },
+        };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfds[1].revents) {
+            int n = adb_read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                D("client of pid=%d went away\n", relay->pid);
+                break;
+            }
+            if (!WriteFdExactly(relay->fd, buf, n)) {
+                input_open = false;
+            }
+        }
+
+        if (pfds[0].revents) {
+            // A pty reads EIO once the last of the slave side has closed.
+            int n = adb_read(relay->fd, buf, sizeof(buf));
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                deflater.Finish(fd);
+                break;
+            }
+            if (!deflater.Write(fd, buf, n)) break;
+        }
+    }
+
+    adb_close(relay->fd);
+    int status = 0;
+    while (waitpid(relay->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    D("compressed subprocess pid=%d exited, status %04x\n", relay->pid, status);
+    adb_close(fd);
+    delete relay;
+}
+
+static int create_subproc_thread(const char *name, const subproc_mode mode,
+                                 bool compress = false)
 {
     adb_thread_t t;
     int ret_fd;
@@ -413,6 +477,18 @@ static int create_subproc_thread(const char *name, const subproc_mode mode)
     }
     D("create_subproc ret_fd=%d pid=%d\n", ret_fd, pid);
 
+    if (compress && ret_fd >= 0) {
+        subproc_relay* relay = new subproc_relay;
+        relay->fd = ret_fd;
+        relay->pid = pid;
+        int fd = create_service_thread(subproc_compress_service, relay);
+        if (fd < 0) {
+            adb_close(ret_fd);
+            delete relay;
+        }
+        return fd;
+    }
+
     stinfo* sti = reinterpret_cast<stinfo*>(malloc(sizeof(stinfo)));
     if(sti == 0) fatal("cannot allocate stinfo");
     sti->func = subproc_waiter_service;
@@ -468,12 +544,24 @@ int service_to_fd(const char *name)
         ret = unix_open(name + 4, O_RDWR | O_CLOEXEC);
     } else if(!strncmp(name, "framebuffer:", 12)) {
         ret = create_service_thread(framebuffer_service, 0);
+    } else if(!strncmp(name, "framebuffer-stream:", 19) ||
+              !strncmp(name, "framebuffer-stream,z:", 21)) {
+        framebuffer_stream_args* args =
+            reinterpret_cast<framebuffer_stream_args*>(malloc(sizeof(framebuffer_stream_args)));
+        if (args == nullptr) fatal("cannot allocate framebuffer-stream args");
+        args->compress = name[18] == ',';
+        args->fps = atoi(strchr(name, ':') + 1);
+        ret = create_service_thread(framebuffer_stream_service, args);
     } else if (!strncmp(name, "jdwp:", 5)) {
         ret = create_jdwp_connection_fd(atoi(name+5));
     } else if(!HOST && !strncmp(name, "shell:", 6)) {
         ret = create_subproc_thread(name + 6, SUBPROC_PTY);
     } else if(!HOST && !strncmp(name, "exec:", 5)) {
         ret = create_subproc_thread(name + 5, SUBPROC_RAW);
+    } else if(!HOST && !strncmp(name, "shell,z:", 8)) {
+        ret = create_subproc_thread(name + 8, SUBPROC_PTY, true);
+    } else if(!HOST && !strncmp(name, "exec,z:", 7)) {
+        ret = create_subproc_thread(name + 7, SUBPROC_RAW, true);
     } else if(!strncmp(name, "sync:", 5)) {
         ret = create_service_thread(file_sync_service, NULL);
     } else if(!strncmp(name, "remount:", 8)) {
@@ -555,7 +643,18 @@ static void connect_device(const std::string& host, std::string* response) {
         return;
     }
 
-    std::vector<std::string> pieces = android::base::Split(host, ":");
+    // A ",<count>" suffix asks for the transport to be striped over that
+    // many connections.
+    int stripe_count = 1;
+    std::vector<std::string> options = android::base::Split(host, ",");
+    if (options.size() > 1) {
+        if (sscanf(options[1].c_str(), "%d", &stripe_count) != 1 || stripe_count < 1) {
+            *response = android::base::StringPrintf("bad stripe count %s", options[1].c_str());
+            return;
+        }
+    }
+
+    std::vector<std::string> pieces = android::base::Split(options[0], ":");
     const std::string& hostname = pieces[0];
 
     int port = DEFAULT_ADB_LOCAL_TRANSPORT_PORT;
@@ -579,10 +678,19 @@ static void connect_device(const std::string& host, std::string* response) {
 
     D("client: connected on remote on fd %d\n", fd);
     close_on_exec(fd);
-    disable_tcp_nagle(fd);
+    tune_tcp_socket(fd);
+
+    stripe_set* stripes;
+    if (local_stripe_connect(fd, hostname.c_str(), port, stripe_count, &stripes) < 0) {
+        adb_close(fd);
+        *response = android::base::StringPrintf("unable to stripe connection to %s:%d",
+                                                hostname.c_str(), port);
+        return;
+    }
 
-    int ret = register_socket_transport(fd, serial.c_str(), port, 0);
+    int ret = register_socket_transport(fd, serial.c_str(), port, 0, stripes);
     if (ret < 0) {
+        local_stripe_release(stripes);
         adb_close(fd);
         *response = android::base::StringPrintf("already connected to %s", serial.c_str());
     } else {
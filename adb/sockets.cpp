@@ -28,6 +28,7 @@
 #include <algorithm>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #if !ADB_HOST
@@ -51,6 +52,11 @@ static asocket local_socket_list = {
     .prev = &local_socket_list,
 };
 
+// The sockets of local_socket_list by id, as every packet from a
+// transport is routed by id and there can be hundreds of streams open.
+static std::unordered_map<unsigned, asocket*>& local_socket_ids =
+        *new std::unordered_map<unsigned, asocket*>();
+
 /* the the list of currently closing local sockets.
 ** these have no peer anymore, but still packets to
 ** write to their fd.
@@ -60,25 +66,22 @@ static asocket local_socket_closing_list = {
     .prev = &local_socket_closing_list,
 };
 
-// Parse the global list of sockets to find one with id |local_id|.
+// Find the socket with id |local_id|.
 // If |peer_id| is not 0, also check that it is connected to a peer
 // with id |peer_id|. Returns an asocket handle on success, NULL on failure.
 asocket *find_local_socket(unsigned local_id, unsigned peer_id)
 {
-    asocket *s;
-    asocket *result = NULL;
-
     std::lock_guard<recursive_mutex> lock(local_socket_list_lock);
-    for (s = local_socket_list.next; s != &local_socket_list; s = s->next) {
-        if (s->id != local_id)
-            continue;
-        if (peer_id == 0 || (s->peer && s->peer->id == peer_id)) {
-            result = s;
-        }
-        break;
+    auto it = local_socket_ids.find(local_id);
+    if (it == local_socket_ids.end()) {
+        return NULL;
     }
 
-    return result;
+    asocket *s = it->second;
+    if (peer_id == 0 || (s->peer && s->peer->id == peer_id)) {
+        return s;
+    }
+    return NULL;
 }
 
 static void
@@ -101,13 +104,20 @@ void install_local_socket(asocket* s) {
     }
 
     insert_local_socket(s, &local_socket_list);
+    local_socket_ids[s->id] = s;
 }
 
 void remove_socket(asocket *s)
 {
-    // socket_list_lock should already be held
+    // local_socket_list_lock is usually held already, but not by jdwp
+    std::lock_guard<recursive_mutex> lock(local_socket_list_lock);
     if (s->prev && s->next)
     {
+        // a closing socket has left the table along with its id
+        auto it = local_socket_ids.find(s->id);
+        if (it != local_socket_ids.end() && it->second == s) {
+            local_socket_ids.erase(it);
+        }
         s->prev->next = s->next;
         s->next->prev = s->prev;
         s->next = 0;
@@ -171,6 +181,9 @@ static int local_socket_enqueue(asocket *s, apacket *p)
     }
 
 enqueue:
+    if (s->peer && s->peer->transport) {
+        transport_stats_backlog(s->peer->transport);
+    }
     p->next = 0;
     if(s->pkt_first) {
         s->pkt_last->next = p;
@@ -211,6 +224,9 @@ static void local_socket_destroy(asocket  *s)
         n = p->next;
         put_apacket(p);
     }
+    if (s->coalesced) {
+        put_apacket(s->coalesced);
+    }
     remove_socket(s);
     free(s);
 
@@ -257,6 +273,23 @@ static void local_socket_close(asocket* s) {
     insert_local_socket(s, &local_socket_closing_list);
 }
 
+// Passes data read from the socket on to its peer. Returns what the
+// peer's enqueue did.
+static int local_socket_send(asocket* s, apacket* p)
+{
+    int r = s->peer->enqueue(s->peer, p);
+    D("LS(%d): fd=%d post peer->enqueue(). r=%d\n", s->id, s->fd, r);
+
+    if (r > 0) {
+            /* if the remote cannot accept further events,
+            ** we disable notification of READs.  They'll
+            ** be enabled again when we get a call to ready()
+            */
+        fdevent_del(&s->fde, FDE_READ);
+    }
+    return r;
+}
+
 static void local_socket_event_func(int fd, unsigned ev, void* _s)
 {
     asocket* s = reinterpret_cast<asocket*>(_s);
@@ -315,11 +348,38 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
     }
 
 
+    if ((ev & FDE_TIMEOUT) && !(ev & FDE_READ) && s->coalesced) {
+        apacket* p = s->coalesced;
+        s->coalesced = nullptr;
+        if (s->peer) {
+            D("LS(%d): sending %u coalesced bytes\n", s->id, p->len);
+                /* a negative return means we were closed */
+            if (local_socket_send(s, p) < 0) return;
+        } else {
+            put_apacket(p);
+        }
+    }
+
     if (ev & FDE_READ) {
-        apacket *p = get_apacket();
-        unsigned char *x = p->data;
-        size_t avail = MAX_PAYLOAD;
-        int r;
+        /* fill packets as large as the transport we feed takes, carrying
+        ** on from any data held back to coalesce
+        */
+        size_t payload = MAX_PAYLOAD_V1;
+        if (s->peer && s->peer->transport) {
+            payload = s->peer->transport->max_payload;
+        }
+        apacket *p = s->coalesced;
+        size_t held = 0;
+        if (p) {
+            s->coalesced = nullptr;
+            held = p->len;
+            payload = std::min(payload, p->capacity);
+        } else {
+            p = get_apacket(payload);
+        }
+        unsigned char *x = p->data + held;
+        size_t avail = payload - held;
+        int r = 0;
         int is_eof = 0;
 
         while (avail > 0) {
@@ -342,15 +402,26 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
         }
         D("LS(%d): fd=%d post avail loop. r=%d is_eof=%d forced_eof=%d\n",
           s->id, s->fd, r, is_eof, s->fde.force_eof);
-        if ((avail == MAX_PAYLOAD) || (s->peer == 0)) {
+        if ((avail == payload) || (s->peer == 0)) {
             put_apacket(p);
+        } else if (!is_eof && !s->fde.force_eof && !(ev & FDE_TIMEOUT) && avail > 0 &&
+                   payload - avail < s->coalesce_bytes) {
+                /* short, and more may well follow: hold on to it, but
+                ** for no longer than coalesce_ms from the first byte
+                */
+            p->len = payload - avail;
+            s->coalesced = p;
+            if (!held) {
+                fdevent_set_timeout(&s->fde, s->coalesce_ms);
+            }
+            return;
         } else {
-            p->len = MAX_PAYLOAD - avail;
-
-            r = s->peer->enqueue(s->peer, p);
-            D("LS(%d): fd=%d post peer->enqueue(). r=%d\n", s->id, s->fd,
-              r);
+            p->len = payload - avail;
+            if (held) {
+                fdevent_set_timeout(&s->fde, -1);
+            }
 
+            r = local_socket_send(s, p);
             if (r < 0) {
                     /* error return means they closed us as a side-effect
                     ** and we must return immediately.
@@ -362,14 +433,6 @@ static void local_socket_event_func(int fd, unsigned ev, void* _s)
                     */
                 return;
             }
-
-            if (r > 0) {
-                    /* if the remote cannot accept further events,
-                    ** we disable notification of READs.  They'll
-                    ** be enabled again when we get a call to ready()
-                    */
-                fdevent_del(&s->fde, FDE_READ);
-            }
         }
         /* Don't allow a forced eof if data is still there */
         if ((s->fde.force_eof && !r) || is_eof) {
@@ -406,6 +469,58 @@ asocket *create_local_socket(int fd)
     return s;
 }
 
+// Interactive streams are coalesced by default, as shell echo and logcat
+// lines would otherwise each go out as a packet of their own and wait for
+// its OKAY. Forwards often carry requests that wait on each reply, which
+// coalescing only slows, so are left alone unless asked. Either can be
+// tuned, in milliseconds with 0 for off, by service.adb.coalesce.<kind>
+// on the device or $ADB_COALESCE_<KIND> on the host.
+#define COALESCE_BYTES 4096
+
+struct coalesce_kind {
+    const char* prefix;
+    const char* name;
+    int default_ms;
+};
+
+static const coalesce_kind coalesce_kinds[] = {
+    { "shell", "shell", 2 },  // shell: and shell,z:
+    { "exec:", "shell", 2 },
+    { "tcp:", "forward", 0 },
+    { "local", "forward", 0 },  // local:, localabstract: and the like
+    { "dev:", "forward", 0 },
+    { "jdwp:", "forward", 0 },
+};
+
+void local_socket_coalesce(asocket *s, const char *service)
+{
+#if !defined(_WIN32)  // the win32 event loop has no timeouts
+    for (const coalesce_kind& kind : coalesce_kinds) {
+        if (strncmp(service, kind.prefix, strlen(kind.prefix))) {
+            continue;
+        }
+
+        int ms = kind.default_ms;
+#if ADB_HOST
+        std::string env = std::string("ADB_COALESCE_") + kind.name;
+        std::transform(env.begin(), env.end(), env.begin(), ::toupper);
+        const char* value = getenv(env.c_str());
+        if (value && *value) ms = atoi(value);
+#else
+        char value[PROPERTY_VALUE_MAX];
+        std::string key = std::string("service.adb.coalesce.") + kind.name;
+        if (property_get(key.c_str(), value, "") > 0) ms = atoi(value);
+#endif
+        if (ms > 0) {
+            D("LS(%d): coalescing reads for %dms\n", s->id, ms);
+            s->coalesce_ms = ms;
+            s->coalesce_bytes = COALESCE_BYTES;
+        }
+        return;
+    }
+#endif
+}
+
 asocket *create_local_service_socket(const char *name)
 {
 #if !ADB_HOST
@@ -413,7 +528,10 @@ asocket *create_local_service_socket(const char *name)
         return create_jdwp_service_socket();
     }
     if (!strcmp(name,"track-jdwp")) {
-        return create_jdwp_tracker_service_socket();
+        return create_jdwp_tracker_service_socket(false);
+    }
+    if (!strcmp(name,"track-jdwp-delta")) {
+        return create_jdwp_tracker_service_socket(true);
     }
 #endif
     int fd = service_to_fd(name);
@@ -421,6 +539,7 @@ asocket *create_local_service_socket(const char *name)
 
     asocket* s = create_local_socket(fd);
     D("LS(%d): bound to '%s' via %d\n", s->id, name, fd);
+    local_socket_coalesce(s, name);
 
 #if !ADB_HOST
     char debug[PROPERTY_VALUE_MAX];
@@ -559,7 +678,7 @@ void connect_to_remote(asocket *s, const char *destination)
     apacket *p = get_apacket();
     int len = strlen(destination) + 1;
 
-    if(len > (MAX_PAYLOAD-1)) {
+    if(len > (MAX_PAYLOAD_V1-1)) {
         fatal("destination oversized");
     }
 
@@ -688,7 +807,7 @@ static int smart_socket_enqueue(asocket *s, apacket *p)
         s->pkt_first = p;
         s->pkt_last = p;
     } else {
-        if((s->pkt_first->len + p->len) > MAX_PAYLOAD) {
+        if((s->pkt_first->len + p->len) > s->pkt_first->capacity) {
             D("SS(%d): overflow\n", s->id);
             put_apacket(p);
             goto fail;
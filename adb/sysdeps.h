@@ -199,6 +199,7 @@ extern int socket_inaddr_any_server(int port, int type);
 #define FDE_WRITE             0x0002
 #define FDE_ERROR             0x0004
 #define FDE_DONT_CLOSE        0x0080
+#define FDE_EDGE              0x0040
 
 typedef void (*fd_func)(int fd, unsigned events, void *userdata);
 
@@ -1923,6 +1923,11 @@ void fdevent_del(fdevent *fde, unsigned events)
         fde, (fde->state & FDE_EVENTMASK) & (~(events & FDE_EVENTMASK)));
 }
 
+void fdevent_set_timeout(fdevent* /* fde */, int64_t /* timeout_ms */)
+{
+    /* not supported here, see fdevent.h */
+}
+
 void fdevent_loop()
 {
     fdevent *fde;
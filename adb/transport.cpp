@@ -21,11 +21,17 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
 #include <base/stringprintf.h>
 
 #include "adb.h"
@@ -45,6 +51,66 @@ static atransport pending_list = {
 
 ADB_MUTEX_DEFINE( transport_lock );
 
+static void free_transport(atransport* t);
+
+/* Lookups and listings work from a snapshot of transport_list rather
+** than walking it under transport_lock, so that many clients picking
+** devices with -s do not queue up behind one another or behind
+** registration. Each change to the list publishes a new snapshot. A
+** transport that is removed is only freed once every snapshot that
+** still holds it is gone: each snapshot keeps the one after it alive,
+** and the one it was removed from frees it.
+*/
+struct transport_snapshot {
+    std::vector<atransport*> transports;
+    /* by serial number and by device path */
+    std::unordered_multimap<std::string, atransport*> names;
+    bool any_noperm = false;
+
+    std::vector<atransport*> retired;
+    std::shared_ptr<transport_snapshot> next;
+
+    ~transport_snapshot() {
+        for (atransport* t : retired) {
+            free_transport(t);
+        }
+    }
+};
+
+static std::shared_ptr<transport_snapshot> current_snapshot =
+        std::make_shared<transport_snapshot>();
+
+static std::shared_ptr<transport_snapshot> get_snapshot()
+{
+    adb_mutex_lock(&transport_snapshot_lock);
+    std::shared_ptr<transport_snapshot> snapshot = current_snapshot;
+    adb_mutex_unlock(&transport_snapshot_lock);
+    return snapshot;
+}
+
+/* call with transport_lock held after changing transport_list, passing
+** the transport if it was unlinked for good
+*/
+static void publish_transports_locked(atransport* removed = nullptr)
+{
+    std::shared_ptr<transport_snapshot> snapshot = std::make_shared<transport_snapshot>();
+    for (atransport* t = transport_list.next; t != &transport_list; t = t->next) {
+        snapshot->transports.push_back(t);
+        if (t->serial) snapshot->names.emplace(t->serial, t);
+        if (t->devpath) snapshot->names.emplace(t->devpath, t);
+        if (t->connection_state == CS_NOPERM) snapshot->any_noperm = true;
+    }
+
+    adb_mutex_lock(&transport_snapshot_lock);
+    std::shared_ptr<transport_snapshot> old = current_snapshot;
+    if (removed) {
+        old->retired.push_back(removed);
+    }
+    old->next = snapshot;
+    current_snapshot = snapshot;
+    adb_mutex_unlock(&transport_snapshot_lock);
+}
+
 void kick_transport(atransport* t)
 {
     if (t && !t->kicked)
@@ -200,6 +266,15 @@ static void transport_socket_events(int fd, unsigned events, void *_t)
     }
 }
 
+/* CNXN and AUTH are exchanged before the version is known to both ends,
+** so they always carry a checksum.
+*/
+static bool skip_checksum(const apacket *p, const atransport *t)
+{
+    return t && t->protocol_version >= A_VERSION_SKIP_CHECKSUM &&
+           p->msg.command != A_CNXN && p->msg.command != A_AUTH;
+}
+
 void send_packet(apacket *p, atransport *t)
 {
     unsigned char *x;
@@ -208,11 +283,13 @@ void send_packet(apacket *p, atransport *t)
 
     p->msg.magic = p->msg.command ^ 0xffffffff;
 
-    count = p->msg.data_length;
-    x = (unsigned char *) p->data;
     sum = 0;
-    while(count-- > 0){
-        sum += *x++;
+    if (!skip_checksum(p, t)) {
+        count = p->msg.data_length;
+        x = (unsigned char *) p->data;
+        while(count-- > 0){
+            sum += *x++;
+        }
     }
     p->msg.data_check = sum;
 
@@ -225,11 +302,54 @@ void send_packet(apacket *p, atransport *t)
         fatal_errno("Transport is null");
     }
 
+    adb_mutex_lock(&transport_stats_lock);
+    if (++t->stats.queued > t->stats.queued_max) {
+        t->stats.queued_max = t->stats.queued;
+    }
+    adb_mutex_unlock(&transport_stats_lock);
+
     if(write_packet(t->transport_socket, t->serial, &p)){
         fatal_errno("cannot enqueue packet on transport socket");
     }
 }
 
+static int64_t now_usec()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void transport_stats_write(atransport* t, bool in, size_t bytes, int64_t usec)
+{
+    int64_t ms = usec / 1000;
+    int bucket = 0;
+    while (bucket < TRANSPORT_LATENCY_BUCKETS - 1 && ms >= (1LL << bucket)) {
+        bucket++;
+    }
+
+    adb_mutex_lock(&transport_stats_lock);
+    transport_stats* st = &t->stats;
+    if (in) {
+        st->packets_in++;
+        st->bytes_in += bytes;
+        st->latency_in[bucket]++;
+        if (ms >= TRANSPORT_STALL_MS) st->stalls_in++;
+    } else {
+        st->packets_out++;
+        st->bytes_out += bytes;
+        st->latency_out[bucket]++;
+        if (ms >= TRANSPORT_STALL_MS) st->stalls_out++;
+    }
+    adb_mutex_unlock(&transport_stats_lock);
+}
+
+void transport_stats_backlog(atransport* t)
+{
+    adb_mutex_lock(&transport_stats_lock);
+    t->stats.backlogs++;
+    adb_mutex_unlock(&transport_stats_lock);
+}
+
 /* The transport is opened by transport_register_func before
 ** the input and output threads are started.
 **
@@ -268,11 +388,15 @@ static void *output_thread(void *_t)
         if(t->read_from_remote(p, t) == 0){
             D("%s: received remote packet, sending to transport\n",
               t->serial);
+                /* p belongs to the transport once written */
+            size_t bytes = sizeof(amessage) + p->msg.data_length;
+            int64_t start = now_usec();
             if(write_packet(t->fd, t->serial, &p)){
                 put_apacket(p);
                 D("%s: failed to write apacket to transport\n", t->serial);
                 goto oops;
             }
+            transport_stats_write(t, true, bytes, now_usec() - start);
         } else {
             D("%s: remote read failed for transport\n", t->serial);
             put_apacket(p);
@@ -313,6 +437,9 @@ static void *input_thread(void *_t)
                t->serial, t->fd );
             break;
         }
+        adb_mutex_lock(&transport_stats_lock);
+        t->stats.queued--;
+        adb_mutex_unlock(&transport_stats_lock);
         if(p->msg.command == A_SYNC){
             if(p->msg.arg0 == 0) {
                 D("%s: transport SYNC offline\n", t->serial);
@@ -330,7 +457,10 @@ static void *input_thread(void *_t)
         } else {
             if(active) {
                 D("%s: transport got packet, sending to remote\n", t->serial);
+                size_t bytes = sizeof(amessage) + p->msg.data_length;
+                int64_t start = now_usec();
                 t->write_to_remote(p, t);
+                transport_stats_write(t, false, bytes, now_usec() - start);
             } else {
                 D("%s: transport ignoring packet while offline\n", t->serial);
             }
@@ -414,7 +544,7 @@ device_tracker_enqueue( asocket*  socket, apacket*  p )
 }
 
 static int device_tracker_send(device_tracker* tracker, const std::string& string) {
-    apacket* p = get_apacket();
+    apacket* p = get_apacket(4 + string.size());
     asocket* peer = tracker->socket.peer;
 
     snprintf(reinterpret_cast<char*>(p->data), 5, "%04x", static_cast<int>(string.size()));
@@ -554,27 +684,17 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
         fdevent_remove(&(t->transport_fde));
         adb_close(t->fd);
 
+        run_transport_disconnects(t);
+
+            /* lookups may still be looking at t, it is freed once
+            ** they are done with it
+            */
         adb_mutex_lock(&transport_lock);
         t->next->prev = t->prev;
         t->prev->next = t->next;
+        publish_transports_locked(t);
         adb_mutex_unlock(&transport_lock);
 
-        run_transport_disconnects(t);
-
-        if (t->product)
-            free(t->product);
-        if (t->serial)
-            free(t->serial);
-        if (t->model)
-            free(t->model);
-        if (t->device)
-            free(t->device);
-        if (t->devpath)
-            free(t->devpath);
-
-        memset(t,0xee,sizeof(atransport));
-        free(t);
-
         update_transports();
         return;
     }
@@ -618,6 +738,7 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
     t->prev = transport_list.prev;
     t->next->prev = t;
     t->prev->next = t;
+    publish_transports_locked();
     adb_mutex_unlock(&transport_lock);
 
     t->disconnects.next = t->disconnects.prev = &t->disconnects;
@@ -625,6 +746,23 @@ static void transport_registration_func(int _fd, unsigned ev, void *data)
     update_transports();
 }
 
+static void free_transport(atransport* t)
+{
+    if (t->product)
+        free(t->product);
+    if (t->serial)
+        free(t->serial);
+    if (t->model)
+        free(t->model);
+    if (t->device)
+        free(t->device);
+    if (t->devpath)
+        free(t->devpath);
+
+    memset(t,0xee,sizeof(atransport));
+    free(t);
+}
+
 void init_transport_registration(void)
 {
     int s[2];
@@ -740,67 +878,95 @@ static int qual_match(const char *to_test,
     return !*to_test;
 }
 
+/* whether serial picks devices by product:, model: or device: rather
+** than naming one by serial number or device path
+*/
+static bool is_qualifier(const char *serial)
+{
+    return !strncmp(serial, "product:", 8) || !strncmp(serial, "model:", 6) ||
+           !strncmp(serial, "device:", 7);
+}
+
 atransport* acquire_one_transport(int state, transport_type ttype,
                                   const char* serial, std::string* error_out)
 {
-    atransport *t;
     atransport *result = NULL;
     int ambiguous = 0;
 
 retry:
     if (error_out) *error_out = android::base::StringPrintf("device '%s' not found", serial);
 
-    adb_mutex_lock(&transport_lock);
-    for (t = transport_list.next; t != &transport_list; t = t->next) {
-        if (t->connection_state == CS_NOPERM) {
-            if (error_out) *error_out = "insufficient permissions for device";
-            continue;
-        }
+    std::shared_ptr<transport_snapshot> snapshot = get_snapshot();
+    if (snapshot->any_noperm) {
+        if (error_out) *error_out = "insufficient permissions for device";
+    }
 
-        /* check for matching serial number */
-        if (serial) {
-            if ((t->serial && !strcmp(serial, t->serial)) ||
-                (t->devpath && !strcmp(serial, t->devpath)) ||
-                qual_match(serial, "product:", t->product, false) ||
-                qual_match(serial, "model:", t->model, true) ||
-                qual_match(serial, "device:", t->device, false)) {
-                if (result) {
-                    if (error_out) *error_out = "more than one device";
-                    ambiguous = 1;
-                    result = NULL;
-                    break;
-                }
-                result = t;
+    if (serial && !is_qualifier(serial)) {
+        auto range = snapshot->names.equal_range(serial);
+        for (auto it = range.first; it != range.second; ++it) {
+            atransport *t = it->second;
+            /* a device whose path is its serial number is listed twice */
+            if (t->connection_state == CS_NOPERM || t == result) {
+                continue;
             }
-        } else {
-            if (ttype == kTransportUsb && t->type == kTransportUsb) {
-                if (result) {
-                    if (error_out) *error_out = "more than one device";
-                    ambiguous = 1;
-                    result = NULL;
-                    break;
-                }
-                result = t;
-            } else if (ttype == kTransportLocal && t->type == kTransportLocal) {
-                if (result) {
-                    if (error_out) *error_out = "more than one emulator";
-                    ambiguous = 1;
-                    result = NULL;
-                    break;
+            if (result) {
+                if (error_out) *error_out = "more than one device";
+                ambiguous = 1;
+                result = NULL;
+                break;
+            }
+            result = t;
+        }
+    } else {
+        for (atransport* t : snapshot->transports) {
+            if (t->connection_state == CS_NOPERM) {
+                continue;
+            }
+
+            /* check for matching serial number */
+            if (serial) {
+                if ((t->serial && !strcmp(serial, t->serial)) ||
+                    (t->devpath && !strcmp(serial, t->devpath)) ||
+                    qual_match(serial, "product:", t->product, false) ||
+                    qual_match(serial, "model:", t->model, true) ||
+                    qual_match(serial, "device:", t->device, false)) {
+                    if (result) {
+                        if (error_out) *error_out = "more than one device";
+                        ambiguous = 1;
+                        result = NULL;
+                        break;
+                    }
+                    result = t;
                 }
-                result = t;
-            } else if (ttype == kTransportAny) {
-                if (result) {
-                    if (error_out) *error_out = "more than one device/emulator";
-                    ambiguous = 1;
-                    result = NULL;
-                    break;
+            } else {
+                if (ttype == kTransportUsb && t->type == kTransportUsb) {
+                    if (result) {
+                        if (error_out) *error_out = "more than one device";
+                        ambiguous = 1;
+                        result = NULL;
+                        break;
+                    }
+                    result = t;
+                } else if (ttype == kTransportLocal && t->type == kTransportLocal) {
+                    if (result) {
+                        if (error_out) *error_out = "more than one emulator";
+                        ambiguous = 1;
+                        result = NULL;
+                        break;
+                    }
+                    result = t;
+                } else if (ttype == kTransportAny) {
+                    if (result) {
+                        if (error_out) *error_out = "more than one device/emulator";
+                        ambiguous = 1;
+                        result = NULL;
+                        break;
+                    }
+                    result = t;
                 }
-                result = t;
             }
         }
     }
-    adb_mutex_unlock(&transport_lock);
 
     if (result) {
         if (result->connection_state == CS_UNAUTHORIZED) {
@@ -886,17 +1052,62 @@ static void append_transport(atransport* t, std::string* result, bool long_listi
         append_transport_info(result, "product:", t->product, false);
         append_transport_info(result, "model:", t->model, true);
         append_transport_info(result, "device:", t->device, false);
+
+        adb_mutex_lock(&transport_stats_lock);
+        if (t->stats.packets_in || t->stats.packets_out) {
+            android::base::StringAppendF(result, " rx:%" PRIu64 " tx:%" PRIu64 " stalls:%u",
+                                         t->stats.bytes_in, t->stats.bytes_out,
+                                         t->stats.stalls_in + t->stats.stalls_out);
+        }
+        adb_mutex_unlock(&transport_stats_lock);
     }
     *result += '\n';
 }
 
 std::string list_transports(bool long_listing) {
     std::string result;
-    adb_mutex_lock(&transport_lock);
-    for (atransport* t = transport_list.next; t != &transport_list; t = t->next) {
+    std::shared_ptr<transport_snapshot> snapshot = get_snapshot();
+    for (atransport* t : snapshot->transports) {
         append_transport(t, &result, long_listing);
     }
-    adb_mutex_unlock(&transport_lock);
+    return result;
+}
+
+static void append_latencies(std::string* result, const char* key, const unsigned* latency) {
+    *result += key;
+    for (int i = 0; i < TRANSPORT_LATENCY_BUCKETS; i++) {
+        android::base::StringAppendF(result, " %u", latency[i]);
+    }
+    *result += '\n';
+}
+
+std::string format_transport_stats(const char* serial) {
+    std::string result;
+    std::shared_ptr<transport_snapshot> snapshot = get_snapshot();
+    for (atransport* t : snapshot->transports) {
+        if (serial && (!t->serial || strcmp(serial, t->serial))) {
+            continue;
+        }
+
+        adb_mutex_lock(&transport_stats_lock);
+        transport_stats st = t->stats;
+        adb_mutex_unlock(&transport_stats_lock);
+
+        android::base::StringAppendF(&result, "serial: %s\n", t->serial ? t->serial : "");
+        android::base::StringAppendF(&result, "state: %s\n", t->connection_state_name());
+        android::base::StringAppendF(&result, "packets-in: %" PRIu64 "\n", st.packets_in);
+        android::base::StringAppendF(&result, "bytes-in: %" PRIu64 "\n", st.bytes_in);
+        android::base::StringAppendF(&result, "packets-out: %" PRIu64 "\n", st.packets_out);
+        android::base::StringAppendF(&result, "bytes-out: %" PRIu64 "\n", st.bytes_out);
+        append_latencies(&result, "latency-in:", st.latency_in);
+        append_latencies(&result, "latency-out:", st.latency_out);
+        android::base::StringAppendF(&result, "stalls-in: %u\n", st.stalls_in);
+        android::base::StringAppendF(&result, "stalls-out: %u\n", st.stalls_out);
+        android::base::StringAppendF(&result, "queued: %u\n", st.queued);
+        android::base::StringAppendF(&result, "queued-max: %u\n", st.queued_max);
+        android::base::StringAppendF(&result, "backlogs: %u\n", st.backlogs);
+        result += '\n';
+    }
     return result;
 }
 
@@ -914,7 +1125,8 @@ void close_usb_devices()
 }
 #endif // ADB_HOST
 
-int register_socket_transport(int s, const char *serial, int port, int local)
+int register_socket_transport(int s, const char *serial, int port, int local,
+                              stripe_set *stripes)
 {
     atransport *t = reinterpret_cast<atransport*>(calloc(1, sizeof(atransport)));
     if (t == nullptr) {
@@ -929,7 +1141,7 @@ int register_socket_transport(int s, const char *serial, int port, int local)
         serial = buff;
     }
     D("transport: %s init'ing for socket %d, on port %d\n", serial, s, port);
-    if (init_socket_transport(t, s, port, local) < 0) {
+    if (init_socket_transport(t, s, port, local, stripes) < 0) {
         free(t);
         return -1;
     }
@@ -965,20 +1177,15 @@ int register_socket_transport(int s, const char *serial, int port, int local)
 #if ADB_HOST
 atransport *find_transport(const char *serial)
 {
-    atransport *t;
-
-    adb_mutex_lock(&transport_lock);
-    for(t = transport_list.next; t != &transport_list; t = t->next) {
+    std::shared_ptr<transport_snapshot> snapshot = get_snapshot();
+    auto range = snapshot->names.equal_range(serial);
+    for (auto it = range.first; it != range.second; ++it) {
+        atransport* t = it->second;
         if (t->serial && !strcmp(serial, t->serial)) {
-            break;
+            return t;
         }
-     }
-    adb_mutex_unlock(&transport_lock);
-
-    if (t != &transport_list)
-        return t;
-    else
-        return 0;
+    }
+    return 0;
 }
 
 void unregister_transport(atransport *t)
@@ -986,6 +1193,7 @@ void unregister_transport(atransport *t)
     adb_mutex_lock(&transport_lock);
     t->next->prev = t->prev;
     t->prev->next = t->next;
+    publish_transports_locked();
     adb_mutex_unlock(&transport_lock);
 
     kick_transport(t);
@@ -1011,6 +1219,7 @@ void unregister_all_tcp_transports()
             transport_unref_locked(t);
         }
      }
+    publish_transports_locked();
 
     adb_mutex_unlock(&transport_lock);
 }
@@ -1053,6 +1262,7 @@ void unregister_usb_transport(usb_handle *usb)
             break;
         }
      }
+    publish_transports_locked();
     adb_mutex_unlock(&transport_lock);
 }
 
@@ -1074,11 +1284,15 @@ int check_header(apacket *p)
     return 0;
 }
 
-int check_data(apacket *p)
+int check_data(apacket *p, atransport *t)
 {
     unsigned count, sum;
     unsigned char *x;
 
+    if (skip_checksum(p, t)) {
+        return 0;
+    }
+
     count = p->msg.data_length;
     x = p->data;
     sum = 0;
@@ -48,7 +48,27 @@ void register_usb_transport(usb_handle* h, const char* serial,
                             const char* devpath, unsigned writeable);
 
 /* cause new transports to be init'd and added to the list */
-int register_socket_transport(int s, const char* serial, int port, int local);
+int register_socket_transport(int s, const char* serial, int port, int local,
+                              stripe_set* stripes = nullptr);
+
+/* Sets TCP_NODELAY and larger socket buffers on a tcp transport socket. */
+void tune_tcp_socket(int fd);
+
+#if ADB_HOST
+/* Asks the adbd at the other end of fd to stripe its transport over up
+** to count connections to host:port, and opens the others. Returns 1
+** with the set to register fd with in *stripes, 0 if adbd does not
+** stripe and fd is to be used alone, or -1 if the others could not be
+** opened; fd is unusable then.
+*/
+int local_stripe_connect(int fd, const char* host, int port, int count,
+                         stripe_set** stripes);
+#endif
+
+/* Closes the further connections of a set whose transport was not
+** registered after all, and frees it.
+*/
+void local_stripe_release(stripe_set* stripes);
 
 /* this should only be used for transports with connection_state == CS_NOPERM */
 void unregister_usb_transport(usb_handle* usb);
@@ -58,13 +78,20 @@ void unregister_transport(atransport* t);
 void unregister_all_tcp_transports();
 
 int check_header(apacket* p);
-int check_data(apacket* p);
+int check_data(apacket* p, atransport* t);
 
 /* for MacOS X cleanup */
 void close_usb_devices();
 
 void send_packet(apacket* p, atransport* t);
 
+/* records a packet written by output_thread (in) or input_thread (out) */
+void transport_stats_write(atransport* t, bool in, size_t bytes, int64_t usec);
+/* records a packet from t that a local socket had to queue */
+void transport_stats_backlog(atransport* t);
+/* the counters of the transport with the given serial, or of all */
+std::string format_transport_stats(const char* serial);
+
 asocket* create_device_tracker(void);
 
 #endif   /* __TRANSPORT_H */
@@ -25,6 +25,14 @@
 #include <string.h>
 #include <sys/types.h>
 
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
 #include <base/stringprintf.h>
 
 #if !ADB_HOST
@@ -46,9 +54,47 @@ ADB_MUTEX_DEFINE( local_transports_lock );
 static atransport*  local_transports[ ADB_LOCAL_TRANSPORT_MAX ];
 #endif /* ADB_HOST */
 
-static int remote_read(apacket *p, atransport *t)
+/* The socket buffers of tcp transports, large enough to keep a fast
+** link with some latency busy. Set on the listening socket as well, so
+** that accepted connections are given a window scale to match.
+*/
+#define TCP_BUFFER_SIZE (1024 * 1024)
+
+/* A striped transport sends its packets round robin over up to this many
+** tcp connections, each preceded by a sequence number, and puts them back
+** in order on receipt. Each connection has its own congestion window,
+** which lets a push approach line rate on lossy or long links.
+*/
+#define TCP_STRIPES_MAX 8
+
+/* How long a host waits for adbd to answer STRP before going on with the
+** one connection, as it must with an adbd that ignores it, and how long
+** adbd waits for the rest of a set to join.
+*/
+#define STRIPE_REPLY_MS 1000
+#define STRIPE_JOIN_MS 5000
+
+struct stripe_set {
+    int fds[TCP_STRIPES_MAX];
+    int count;
+    uint64_t token;
+    unsigned send_seq;  /* input thread only */
+    unsigned recv_seq;  /* output thread only */
+    std::map<unsigned, apacket*> early;  /* read ahead of their turn */
+};
+
+void tune_tcp_socket(int fd)
+{
+    int size = TCP_BUFFER_SIZE;
+
+    disable_tcp_nagle(fd);
+    adb_setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    adb_setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+static int read_packet(int fd, apacket *p, atransport *t)
 {
-    if(!ReadFdExactly(t->sfd, &p->msg, sizeof(amessage))){
+    if(!ReadFdExactly(fd, &p->msg, sizeof(amessage))){
         D("remote local: read terminated (message)\n");
         return -1;
     }
@@ -58,12 +104,14 @@ static int remote_read(apacket *p, atransport *t)
         return -1;
     }
 
-    if(!ReadFdExactly(t->sfd, p->data, p->msg.data_length)){
+    apacket_reserve(p, p->msg.data_length);
+
+    if(!ReadFdExactly(fd, p->data, p->msg.data_length)){
         D("remote local: terminated (data)\n");
         return -1;
     }
 
-    if(check_data(p)) {
+    if(check_data(p, t)) {
         D("bad data: terminated (data)\n");
         return -1;
     }
@@ -71,11 +119,17 @@ static int remote_read(apacket *p, atransport *t)
     return 0;
 }
 
-static int remote_write(apacket *p, atransport *t)
+static int write_packet(int fd, apacket *p)
 {
     int   length = p->msg.data_length;
 
-    if(!WriteFdExactly(t->sfd, &p->msg, sizeof(amessage) + length)) {
+    if (p->data == p->inline_data) {
+        if(!WriteFdExactly(fd, &p->msg, sizeof(amessage) + length)) {
+            D("remote local: write terminated\n");
+            return -1;
+        }
+    } else if(!WriteFdExactly(fd, &p->msg, sizeof(amessage)) ||
+              !WriteFdExactly(fd, p->data, length)) {
         D("remote local: write terminated\n");
         return -1;
     }
@@ -83,6 +137,156 @@ static int remote_write(apacket *p, atransport *t)
     return 0;
 }
 
+#if !defined(_WIN32)
+/* Reads the packet with the next sequence number from whichever of the
+** connections it arrives on, keeping those that overtake it.
+*/
+static int stripe_read(apacket *p, atransport *t)
+{
+    stripe_set *ss = t->stripes;
+    struct pollfd pfds[TCP_STRIPES_MAX];
+
+    for (;;) {
+        auto it = ss->early.find(ss->recv_seq);
+        if (it != ss->early.end()) {
+            apacket *q = it->second;
+            ss->early.erase(it);
+            p->msg = q->msg;
+            apacket_reserve(p, q->msg.data_length);
+            memcpy(p->data, q->data, q->msg.data_length);
+            put_apacket(q);
+            ss->recv_seq++;
+            return 0;
+        }
+
+        for (int i = 0; i < ss->count; i++) {
+            pfds[i].fd = ss->fds[i];
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+        if (poll(pfds, ss->count, -1) < 0) {
+            if (errno == EINTR) continue;
+            D("remote local: stripe poll failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for (int i = 0; i < ss->count; i++) {
+            if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+                D("remote local: stripe %d failed\n", i);
+                return -1;
+            }
+            if (!(pfds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+
+            unsigned seq;
+            if (!ReadFdExactly(ss->fds[i], &seq, sizeof(seq))) {
+                D("remote local: stripe %d terminated\n", i);
+                return -1;
+            }
+            if (seq == ss->recv_seq) {
+                if (read_packet(ss->fds[i], p, t)) return -1;
+                ss->recv_seq++;
+                return 0;
+            }
+            if (seq - ss->recv_seq > (1U << 24) || ss->early.count(seq)) {
+                D("remote local: stripe %d sent bad sequence %u\n", i, seq);
+                return -1;
+            }
+            apacket *q = get_apacket();
+            if (read_packet(ss->fds[i], q, t)) {
+                put_apacket(q);
+                return -1;
+            }
+            ss->early[seq] = q;
+        }
+    }
+}
+
+static int stripe_write(apacket *p, atransport *t)
+{
+    stripe_set *ss = t->stripes;
+    unsigned seq = ss->send_seq++;
+    int fd = ss->fds[seq % ss->count];
+
+    if (!WriteFdExactly(fd, &seq, sizeof(seq))) {
+        D("remote local: stripe write terminated\n");
+        return -1;
+    }
+    return write_packet(fd, p);
+}
+#endif
+
+static int remote_read(apacket *p, atransport *t)
+{
+#if !defined(_WIN32)
+    if (t->stripes) return stripe_read(p, t);
+#endif
+    return read_packet(t->sfd, p, t);
+}
+
+static int remote_write(apacket *p, atransport *t)
+{
+#if !defined(_WIN32)
+    if (t->stripes) return stripe_write(p, t);
+#endif
+    return write_packet(t->sfd, p);
+}
+
+void local_stripe_release(stripe_set *ss)
+{
+    if (ss == nullptr) return;
+
+    for (int i = 1; i < ss->count; i++) {
+        if (ss->fds[i] >= 0) adb_close(ss->fds[i]);
+    }
+    for (auto& it : ss->early) {
+        put_apacket(it.second);
+    }
+    delete ss;
+}
+
+#if !defined(_WIN32)
+/* STRP(count, index, token) asks for a transport striped over count
+** connections, this being the index-th of them; adbd answers the first
+** with the count it will take.
+*/
+static bool send_stripe_request(int fd, unsigned count, unsigned index, uint64_t token)
+{
+    amessage msg;
+    const unsigned char* x = reinterpret_cast<const unsigned char*>(&token);
+
+    msg.command = A_STRP;
+    msg.arg0 = count;
+    msg.arg1 = index;
+    msg.data_length = sizeof(token);
+    msg.data_check = 0;
+    for (size_t i = 0; i < sizeof(token); i++) {
+        msg.data_check += x[i];
+    }
+    msg.magic = msg.command ^ 0xffffffff;
+
+    return WriteFdExactly(fd, &msg, sizeof(msg)) && WriteFdExactly(fd, &token, sizeof(token));
+}
+
+static bool read_stripe_request(int fd, amessage* msg, uint64_t* token)
+{
+    return ReadFdExactly(fd, msg, sizeof(*msg)) &&
+           msg->command == A_STRP && msg->magic == (A_STRP ^ 0xffffffff) &&
+           msg->data_length == sizeof(*token) &&
+           ReadFdExactly(fd, token, sizeof(*token));
+}
+
+static stripe_set* new_stripe_set(int fd, unsigned count, uint64_t token)
+{
+    stripe_set* ss = new stripe_set();
+    ss->count = std::min(count, static_cast<unsigned>(TCP_STRIPES_MAX));
+    ss->token = token;
+    std::fill(ss->fds, ss->fds + TCP_STRIPES_MAX, -1);
+    ss->fds[0] = fd;
+    return ss;
+}
+#endif
 
 int local_connect(int port) {
     return local_connect_arbitrary_ports(port-1, port);
@@ -105,7 +309,7 @@ int local_connect_arbitrary_ports(int console_port, int adb_port)
     if (fd >= 0) {
         D("client: connected on remote on fd %d\n", fd);
         close_on_exec(fd);
-        disable_tcp_nagle(fd);
+        tune_tcp_socket(fd);
         std::string serial = android::base::StringPrintf("emulator-%d", console_port);
         register_socket_transport(fd, serial.c_str(), adb_port, 1);
         return 0;
@@ -132,6 +336,102 @@ static void *client_socket_thread(void *x)
     return 0;
 }
 
+#if !ADB_HOST
+/* Sets of connections waiting for the rest of them to join. */
+static std::vector<stripe_set*> pending_stripes;
+
+struct stripe_accept {
+    int fd;
+    int port;
+};
+
+/* Adds a connection to the set it names, if that is still waiting. */
+static void join_stripe_set(int fd, const amessage& msg, uint64_t token)
+{
+    bool joined = false;
+
+    adb_mutex_lock(&local_stripes_lock);
+    for (stripe_set* ss : pending_stripes) {
+        if (ss->token == token && msg.arg1 < static_cast<unsigned>(ss->count) &&
+            ss->fds[msg.arg1] < 0) {
+            ss->fds[msg.arg1] = fd;
+            joined = true;
+            break;
+        }
+    }
+    adb_mutex_unlock(&local_stripes_lock);
+
+    if (!joined) {
+        D("server: stripe %u joins no set\n", msg.arg1);
+        adb_close(fd);
+    }
+}
+
+/* Takes the first connection of a set, then waits for the others. */
+static void open_stripe_set(int fd, int port, const amessage& msg, uint64_t token)
+{
+    stripe_set* ss = new_stripe_set(fd, msg.arg0, token);
+    if (!send_stripe_request(fd, ss->count, 0, token) || ss->count < 2) {
+        local_stripe_release(ss);
+        register_socket_transport(fd, "host", port, 1);
+        return;
+    }
+
+    adb_mutex_lock(&local_stripes_lock);
+    pending_stripes.push_back(ss);
+    adb_mutex_unlock(&local_stripes_lock);
+
+    bool complete = false;
+    for (int waited = 0; !complete && waited < STRIPE_JOIN_MS; waited += 10) {
+        adb_sleep_ms(10);
+        adb_mutex_lock(&local_stripes_lock);
+        complete = std::find(ss->fds, ss->fds + ss->count, -1) == ss->fds + ss->count;
+        adb_mutex_unlock(&local_stripes_lock);
+    }
+
+    adb_mutex_lock(&local_stripes_lock);
+    pending_stripes.erase(std::find(pending_stripes.begin(), pending_stripes.end(), ss));
+    adb_mutex_unlock(&local_stripes_lock);
+
+    D("server: %s set of %d stripes\n", complete ? "registering" : "dropping", ss->count);
+    if (!complete || register_socket_transport(fd, "host", port, 1, ss) < 0) {
+        local_stripe_release(ss);
+        adb_close(fd);
+    }
+}
+
+/* Sees whether a new connection starts a transport or takes part in a
+** striped one. A host sends CNXN or STRP first thing, the peek only
+** waits long for clients that send nothing, on a thread of its own.
+*/
+static void *stripe_accept_thread(void * arg)
+{
+    stripe_accept* sa = reinterpret_cast<stripe_accept*>(arg);
+    int fd = sa->fd;
+    int port = sa->port;
+    delete sa;
+
+    amessage msg;
+    uint64_t token;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, STRIPE_JOIN_MS) == 1 &&
+        recv(fd, &msg, sizeof(msg), MSG_PEEK | MSG_WAITALL) == sizeof(msg) &&
+        msg.command == A_STRP) {
+        if (!read_stripe_request(fd, &msg, &token)) {
+            adb_close(fd);
+        } else if (msg.arg1 == 0) {
+            open_stripe_set(fd, port, msg, token);
+        } else {
+            join_stripe_set(fd, msg, token);
+        }
+        return 0;
+    }
+
+    register_socket_transport(fd, "host", port, 1);
+    return 0;
+}
+#endif
+
 static void *server_socket_thread(void * arg)
 {
     int serverfd, fd;
@@ -150,6 +450,7 @@ static void *server_socket_thread(void * arg)
                 continue;
             }
             close_on_exec(serverfd);
+            tune_tcp_socket(serverfd);
         }
 
         alen = sizeof(addr);
@@ -158,14 +459,86 @@ static void *server_socket_thread(void * arg)
         if(fd >= 0) {
             D("server: new connection on fd %d\n", fd);
             close_on_exec(fd);
-            disable_tcp_nagle(fd);
+            tune_tcp_socket(fd);
+#if !ADB_HOST
+            adb_thread_t thr;
+            stripe_accept* sa = new stripe_accept{ fd, port };
+            if (adb_thread_create(&thr, stripe_accept_thread, sa)) {
+                delete sa;
+                register_socket_transport(fd, "host", port, 1);
+            }
+#else
             register_socket_transport(fd, "host", port, 1);
+#endif
         }
     }
     D("transport: server_socket_thread() exiting\n");
     return 0;
 }
 
+#if ADB_HOST
+int local_stripe_connect(int fd, const char* host, int port, int count,
+                         stripe_set** stripes)
+{
+    *stripes = nullptr;
+#if defined(_WIN32)
+    return 0;
+#else
+    if (count < 2) return 0;
+
+    /* The token is all that ties the further connections to this one. */
+    uint64_t token;
+    int rfd = adb_open("/dev/urandom", O_RDONLY);
+    bool have_token = rfd >= 0 && ReadFdExactly(rfd, &token, sizeof(token));
+    if (rfd >= 0) adb_close(rfd);
+    if (!have_token) return 0;
+
+    stripe_set* ss = new_stripe_set(fd, count, token);
+    amessage msg;
+    uint64_t reply;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (!send_stripe_request(fd, ss->count, 0, token)) {
+        delete ss;
+        return -1;
+    }
+    if (poll(&pfd, 1, STRIPE_REPLY_MS) != 1) {
+        D("client: no STRP answer, not striping\n");
+        delete ss;
+        return 0;
+    }
+    if (!read_stripe_request(fd, &msg, &reply) || reply != token || msg.arg0 > (unsigned) ss->count) {
+        delete ss;
+        return -1;
+    }
+    if (msg.arg0 < 2) {
+        delete ss;
+        return 0;
+    }
+
+    ss->count = msg.arg0;
+    for (int i = 1; i < ss->count; i++) {
+        int sfd = socket_network_client_timeout(host, port, SOCK_STREAM, 10);
+        if (sfd < 0) {
+            D("client: cannot open stripe %d: %s\n", i, strerror(errno));
+            local_stripe_release(ss);
+            return -1;
+        }
+        close_on_exec(sfd);
+        tune_tcp_socket(sfd);
+        ss->fds[i] = sfd;
+        if (!send_stripe_request(sfd, ss->count, i, token)) {
+            local_stripe_release(ss);
+            return -1;
+        }
+    }
+
+    D("client: striping over %d connections\n", ss->count);
+    *stripes = ss;
+    return 1;
+#endif
+}
+#endif
+
 /* This is relevant only for ADB daemon running inside the emulator. */
 #if !ADB_HOST
 /*
@@ -317,6 +690,15 @@ static void remote_kick(atransport *t)
     adb_shutdown(fd);
     adb_close(fd);
 
+    /* the others are closed with the transport, the threads may still
+    ** be polling them
+    */
+    if (t->stripes) {
+        for (int i = 1; i < t->stripes->count; i++) {
+            adb_shutdown(t->stripes->fds[i]);
+        }
+    }
+
 #if ADB_HOST
     if(HOST) {
         int  nn;
@@ -335,6 +717,8 @@ static void remote_kick(atransport *t)
 static void remote_close(atransport *t)
 {
     adb_close(t->fd);
+    local_stripe_release(t->stripes);
+    t->stripes = nullptr;
 }
 
 
@@ -380,7 +764,8 @@ int get_available_local_transport_index()
 }
 #endif
 
-int init_socket_transport(atransport *t, int s, int adb_port, int local)
+int init_socket_transport(atransport *t, int s, int adb_port, int local,
+                          stripe_set *stripes)
 {
     int  fail = 0;
 
@@ -389,9 +774,12 @@ int init_socket_transport(atransport *t, int s, int adb_port, int local)
     t->read_from_remote = remote_read;
     t->write_to_remote = remote_write;
     t->sfd = s;
+    t->stripes = stripes;
     t->sync_token = 1;
     t->connection_state = CS_OFFLINE;
     t->type = kTransportLocal;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD_V1;
     t->adb_port = 0;
 
 #if ADB_HOST
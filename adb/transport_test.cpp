@@ -51,3 +51,75 @@ TEST(transport, DISABLED_run_transport_disconnects_zeroed_atransport) {
   atransport t = {};
   run_transport_disconnects(&t);
 }
+
+TEST(transport, check_data_skip_checksum) {
+  atransport t = {};
+  t.protocol_version = A_VERSION_MIN;
+  apacket* p = get_apacket();
+  p->msg.command = A_WRTE;
+  p->msg.data_length = 2;
+  p->data[0] = 1;
+  p->data[1] = 2;
+  p->msg.data_check = 0;
+  ASSERT_EQ(-1, check_data(p, &t));
+  p->msg.data_check = 3;
+  ASSERT_EQ(0, check_data(p, &t));
+
+  // Once negotiated, only CNXN and AUTH are still checked.
+  t.protocol_version = A_VERSION_SKIP_CHECKSUM;
+  p->msg.data_check = 0;
+  ASSERT_EQ(0, check_data(p, &t));
+  p->msg.command = A_CNXN;
+  ASSERT_EQ(-1, check_data(p, &t));
+  put_apacket(p);
+}
+
+TEST(transport, apacket_reserve) {
+  apacket* p = get_apacket();
+  ASSERT_EQ(p->inline_data, p->data);
+  ASSERT_EQ(static_cast<size_t>(MAX_PAYLOAD_V1), p->capacity);
+  apacket_reserve(p, MAX_PAYLOAD_V1);
+  ASSERT_EQ(p->inline_data, p->data);
+  apacket_reserve(p, MAX_PAYLOAD);
+  ASSERT_NE(p->inline_data, p->data);
+  ASSERT_EQ(static_cast<size_t>(MAX_PAYLOAD), p->capacity);
+  memset(p->data, 0, MAX_PAYLOAD);
+  put_apacket(p);
+}
+
+TEST(transport, apacket_pool) {
+  apacket* p = get_apacket(MAX_PAYLOAD);
+  unsigned char* buffer = p->data;
+  put_apacket(p);
+  apacket_stats before = get_apacket_stats();
+  ASSERT_LE(1U, before.pooled);
+  ASSERT_LE(1U, before.buffers_pooled);
+
+  // Both the packet and its payload buffer come back out of the pools.
+  apacket* q = get_apacket(MAX_PAYLOAD);
+  ASSERT_EQ(p, q);
+  ASSERT_EQ(buffer, q->data);
+  apacket_stats after = get_apacket_stats();
+  ASSERT_EQ(before.reused + 1, after.reused);
+  ASSERT_EQ(before.allocated, after.allocated);
+  ASSERT_EQ(before.pooled - 1, after.pooled);
+  ASSERT_EQ(before.buffers_pooled - 1, after.buffers_pooled);
+  put_apacket(q);
+}
+
+TEST(transport, stats_write) {
+  atransport t = {};
+  transport_stats_write(&t, true, 24, 500);
+  transport_stats_write(&t, true, 4120, 3000);
+  transport_stats_write(&t, false, 24, 2000 * 1000);
+  ASSERT_EQ(2U, t.stats.packets_in);
+  ASSERT_EQ(4144U, t.stats.bytes_in);
+  ASSERT_EQ(1U, t.stats.packets_out);
+
+  // Under 1ms, under 4ms, and longer than any bucket.
+  ASSERT_EQ(1U, t.stats.latency_in[0]);
+  ASSERT_EQ(1U, t.stats.latency_in[2]);
+  ASSERT_EQ(1U, t.stats.latency_out[TRANSPORT_LATENCY_BUCKETS - 1]);
+  ASSERT_EQ(0U, t.stats.stalls_in);
+  ASSERT_EQ(1U, t.stats.stalls_out);
+}
@@ -37,6 +37,8 @@ static int remote_read(apacket *p, atransport *t)
         return -1;
     }
 
+    apacket_reserve(p, p->msg.data_length);
+
     if(p->msg.data_length) {
         if(usb_read(t->usb, p->data, p->msg.data_length)){
             D("remote usb: terminated (data)\n");
@@ -44,7 +46,7 @@ static int remote_read(apacket *p, atransport *t)
         }
     }
 
-    if(check_data(p)) {
+    if(check_data(p, t)) {
         D("remote usb: check_data failed\n");
         return -1;
     }
@@ -61,7 +63,7 @@ static int remote_write(apacket *p, atransport *t)
         return -1;
     }
     if(p->msg.data_length == 0) return 0;
-    if(usb_write(t->usb, &p->data, size)) {
+    if(usb_write(t->usb, p->data, size)) {
         D("remote usb: 2 - write terminated\n");
         return -1;
     }
@@ -91,6 +93,8 @@ void init_usb_transport(atransport *t, usb_handle *h, int state)
     t->connection_state = state;
     t->type = kTransportUsb;
     t->usb = h;
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD_V1;
 
 #if ADB_HOST
     HOST = 1;
@@ -45,6 +45,13 @@
 
 ADB_MUTEX_DEFINE( usb_lock );
 
+/* Reads and writes go out as URBs of at most USB_URB_SIZE, all of them
+** queued at once so that the device is kept busy rather than waiting a
+** round trip between them. A whole packet of MAX_PAYLOAD fits.
+*/
+#define USB_URB_SIZE (16 * 1024)
+#define USB_URBS_MAX ((MAX_PAYLOAD + USB_URB_SIZE - 1) / USB_URB_SIZE)
+
 struct usb_handle
 {
     usb_handle *prev;
@@ -58,11 +65,14 @@ struct usb_handle
     unsigned zero_mask;
     unsigned writeable;
 
-    struct usbdevfs_urb urb_in;
-    struct usbdevfs_urb urb_out;
+    struct usbdevfs_urb urb_in[USB_URBS_MAX];
+    struct usbdevfs_urb urb_out[USB_URBS_MAX + 1];  /* and a zero length packet */
 
+    /* URBs submitted and not yet reaped, and the first error of those */
     int urb_in_busy;
     int urb_out_busy;
+    int urb_in_failed;
+    int urb_out_failed;
     int dead;
 
     adb_cond_t notify;
@@ -314,126 +324,181 @@ void usb_cleanup()
 {
 }
 
-static int usb_bulk_write(usb_handle *h, const void *data, int len)
+/* Submits len bytes of data as URBs of at most USB_URB_SIZE, the first
+** of them urbs[0], plus a zero length one if zero is set. Returns the
+** number submitted, fewer than asked for if the rest failed to submit.
+** Called with h->lock held.
+*/
+static int usb_submit_urbs(usb_handle *h, struct usbdevfs_urb *urbs, unsigned char endpoint,
+                           unsigned char *data, int len, bool zero)
 {
-    struct usbdevfs_urb *urb = &h->urb_out;
-    int res;
-    struct timeval tv;
-    struct timespec ts;
+    int count = (len + USB_URB_SIZE - 1) / USB_URB_SIZE + (zero ? 1 : 0);
+    int submitted;
+
+    for(submitted = 0; submitted < count; submitted++) {
+        struct usbdevfs_urb *urb = &urbs[submitted];
+        int offset = submitted * USB_URB_SIZE;
+        int res;
+
+        memset(urb, 0, sizeof(*urb));
+        urb->type = USBDEVFS_URB_TYPE_BULK;
+        urb->endpoint = endpoint;
+        urb->status = -1;
+        urb->buffer = data + offset;
+        urb->buffer_length = (len - offset > USB_URB_SIZE) ? USB_URB_SIZE :
+                             (len > offset) ? len - offset : 0;
+
+        do {
+            res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
+        } while((res < 0) && (errno == EINTR));
+        if(res < 0) {
+            D("[ submit urb %d of %d failed: %s ]\n", submitted, count, strerror(errno));
+            break;
+        }
+    }
+    return submitted;
+}
 
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_out;
-    urb->status = -1;
-    urb->buffer = (void*) data;
-    urb->buffer_length = len;
+/* Whether urb is one of the n starting at urbs */
+static inline bool urb_in_ring(struct usbdevfs_urb *urb, struct usbdevfs_urb *urbs, int n)
+{
+    return urb >= urbs && urb < urbs + n;
+}
 
-    D("++ write ++\n");
+/* Writes up to USB_URBS_MAX URBs worth of data, and a zero length packet
+** if zero is set, with all of the URBs queued at once. The reader reaps
+** them, this waits for it to have reaped them all.
+*/
+static int usb_bulk_write(usb_handle *h, const void *data, int len, bool zero)
+{
+    int res = -1;
+
+    D("++ write %d ++\n", len);
 
     adb_mutex_lock(&h->lock);
     if(h->dead) {
-        res = -1;
         goto fail;
     }
-    do {
-        res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
-    } while((res < 0) && (errno == EINTR));
 
-    if(res < 0) {
-        goto fail;
+    h->urb_out_failed = 0;
+    h->urb_out_busy = usb_submit_urbs(h, h->urb_out, h->ep_out,
+                                      (unsigned char*) data, len, zero);
+    if(h->urb_out_busy < (len + USB_URB_SIZE - 1) / USB_URB_SIZE + (zero ? 1 : 0)) {
+        h->urb_out_failed = errno ? errno : EIO;
+        for(int i = 0; i < h->urb_out_busy; i++) {
+            ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_out[i]);
+        }
     }
 
-    res = -1;
-    h->urb_out_busy = 1;
-    for(;;) {
-        /* time out after five seconds */
-        gettimeofday(&tv, NULL);
-        ts.tv_sec = tv.tv_sec + 5;
-        ts.tv_nsec = tv.tv_usec * 1000L;
-        res = pthread_cond_timedwait(&h->notify, &h->lock, &ts);
-        if(res < 0 || h->dead) {
-            break;
-        }
-        if(h->urb_out_busy == 0) {
-            if(urb->status == 0) {
-                res = urb->actual_length;
-            }
-            break;
-        }
+        /* what was submitted has to be reaped before the data is let go */
+    while(h->urb_out_busy > 0 && !h->dead) {
+        adb_cond_wait(&h->notify, &h->lock);
+    }
+    if(!h->dead && !h->urb_out_failed) {
+        res = 0;
+    } else if(h->urb_out_failed) {
+        errno = h->urb_out_failed;
     }
+
 fail:
     adb_mutex_unlock(&h->lock);
     D("-- write --\n");
     return res;
 }
 
-static int usb_bulk_read(usb_handle *h, void *data, int len)
+/* Reaps one URB, which may be one of the writer's. Called with h->lock
+** held, which is dropped while waiting.
+*/
+static int usb_reap_urb(usb_handle *h)
 {
-    struct usbdevfs_urb *urb = &h->urb_in;
     struct usbdevfs_urb *out = NULL;
     int res;
 
-    D("++ usb_bulk_read ++\n");
-    memset(urb, 0, sizeof(*urb));
-    urb->type = USBDEVFS_URB_TYPE_BULK;
-    urb->endpoint = h->ep_in;
-    urb->status = -1;
-    urb->buffer = data;
-    urb->buffer_length = len;
+    D("[ reap urb - wait ]\n");
+    h->reaper_thread = pthread_self();
+    adb_mutex_unlock(&h->lock);
+    res = ioctl(h->desc, USBDEVFS_REAPURB, &out);
+    int saved_errno = errno;
+    adb_mutex_lock(&h->lock);
+    h->reaper_thread = 0;
+    if(h->dead) {
+        return -1;
+    }
+    if(res < 0) {
+        if(saved_errno == EINTR) {
+            return 0;
+        }
+        D("[ reap urb - error ]\n");
+        errno = saved_errno;
+        return -1;
+    }
+    D("[ urb @%p status = %d, actual = %d ]\n",
+        out, out->status, out->actual_length);
 
+    if(urb_in_ring(out, h->urb_in, USB_URBS_MAX)) {
+        h->urb_in_busy--;
+            /* a transfer that ends short means the device sent less
+            ** than we were told to expect, the rest would be misread
+            */
+        if(!h->urb_in_failed &&
+           (out->status != 0 || out->actual_length != out->buffer_length)) {
+            h->urb_in_failed = out->status ? -out->status : EIO;
+        }
+    } else if(urb_in_ring(out, h->urb_out, USB_URBS_MAX + 1)) {
+        D("[ reap urb - OUT complete ]\n");
+        h->urb_out_busy--;
+        if(out->status != 0 && !h->urb_out_failed) {
+            h->urb_out_failed = -out->status;
+        }
+        if(h->urb_out_busy == 0) {
+            adb_cond_broadcast(&h->notify);
+        }
+    }
+    return 0;
+}
+
+/* Reads up to USB_URBS_MAX URBs worth of data, with all of the URBs
+** queued at once, reaping those of the writer as they come too.
+*/
+static int usb_bulk_read(usb_handle *h, void *data, int len)
+{
+    int res = -1;
+    int count = (len + USB_URB_SIZE - 1) / USB_URB_SIZE;
+    bool discarded = false;
+
+    D("++ usb_bulk_read %d ++\n", len);
 
     adb_mutex_lock(&h->lock);
     if(h->dead) {
-        res = -1;
         goto fail;
     }
-    do {
-        res = ioctl(h->desc, USBDEVFS_SUBMITURB, urb);
-    } while((res < 0) && (errno == EINTR));
 
-    if(res < 0) {
-        goto fail;
+    h->urb_in_failed = 0;
+    h->urb_in_busy = usb_submit_urbs(h, h->urb_in, h->ep_in,
+                                     (unsigned char*) data, len, false);
+    if(h->urb_in_busy < count) {
+        h->urb_in_failed = errno ? errno : EIO;
     }
 
-    h->urb_in_busy = 1;
-    for(;;) {
-        D("[ reap urb - wait ]\n");
-        h->reaper_thread = pthread_self();
-        adb_mutex_unlock(&h->lock);
-        res = ioctl(h->desc, USBDEVFS_REAPURB, &out);
-        int saved_errno = errno;
-        adb_mutex_lock(&h->lock);
-        h->reaper_thread = 0;
-        if(h->dead) {
-            res = -1;
-            break;
-        }
-        if(res < 0) {
-            if(saved_errno == EINTR) {
-                continue;
+    while(h->urb_in_busy > 0) {
+            /* once one fails the rest are no use, but still need reaping */
+        if(h->urb_in_failed && !discarded) {
+            for(int i = 0; i < count; i++) {
+                ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_in[i]);
             }
-            D("[ reap urb - error ]\n");
-            break;
+            discarded = true;
         }
-        D("[ urb @%p status = %d, actual = %d ]\n",
-            out, out->status, out->actual_length);
-
-        if(out == &h->urb_in) {
-            D("[ reap urb - IN complete ]\n");
-            h->urb_in_busy = 0;
-            if(urb->status == 0) {
-                res = urb->actual_length;
-            } else {
-                res = -1;
-            }
+        if(usb_reap_urb(h) < 0) {
+            if(!h->urb_in_failed) h->urb_in_failed = h->dead ? ENODEV : errno;
             break;
         }
-        if(out == &h->urb_out) {
-            D("[ reap urb - OUT compelete ]\n");
-            h->urb_out_busy = 0;
-            adb_cond_broadcast(&h->notify);
-        }
     }
+    if(!h->urb_in_failed) {
+        res = 0;
+    } else {
+        errno = h->urb_in_failed;
+    }
+
 fail:
     adb_mutex_unlock(&h->lock);
     D("-- usb_bulk_read --\n");
@@ -444,7 +509,6 @@ fail:
 int usb_write(usb_handle *h, const void *_data, int len)
 {
     unsigned char *data = (unsigned char*) _data;
-    int n;
     int need_zero = 0;
 
     D("++ usb_write ++\n");
@@ -459,12 +523,10 @@ int usb_write(usb_handle *h, const void *_data, int len)
     }
 
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > USB_URB_SIZE * USB_URBS_MAX) ? USB_URB_SIZE * USB_URBS_MAX : len;
 
-        n = usb_bulk_write(h, data, xfer);
-        if(n != xfer) {
-            D("ERROR: n = %d, errno = %d (%s)\n",
-                n, errno, strerror(errno));
+        if(usb_bulk_write(h, data, xfer, need_zero && xfer == len)) {
+            D("ERROR: errno = %d (%s)\n", errno, strerror(errno));
             return -1;
         }
 
@@ -472,11 +534,6 @@ int usb_write(usb_handle *h, const void *_data, int len)
         data += xfer;
     }
 
-    if(need_zero){
-        n = usb_bulk_write(h, _data, 0);
-        return n;
-    }
-
     D("-- usb_write --\n");
     return 0;
 }
@@ -484,26 +541,14 @@ int usb_write(usb_handle *h, const void *_data, int len)
 int usb_read(usb_handle *h, void *_data, int len)
 {
     unsigned char *data = (unsigned char*) _data;
-    int n;
 
     D("++ usb_read ++\n");
     while(len > 0) {
-        int xfer = (len > 4096) ? 4096 : len;
+        int xfer = (len > USB_URB_SIZE * USB_URBS_MAX) ? USB_URB_SIZE * USB_URBS_MAX : len;
 
         D("[ usb read %d fd = %d], fname=%s\n", xfer, h->desc, h->fname);
-        n = usb_bulk_read(h, data, xfer);
-        D("[ usb read %d ] = %d, fname=%s\n", xfer, n, h->fname);
-        if(n != xfer) {
-            if((errno == ETIMEDOUT) && (h->desc != -1)) {
-                D("[ timeout ]\n");
-                if(n > 0){
-                    data += n;
-                    len -= n;
-                }
-                continue;
-            }
-            D("ERROR: n = %d, errno = %d (%s)\n",
-                n, errno, strerror(errno));
+        if(usb_bulk_read(h, data, xfer)) {
+            D("ERROR: errno = %d (%s)\n", errno, strerror(errno));
             return -1;
         }
 
@@ -536,10 +581,14 @@ void usb_kick(usb_handle *h)
             ** but this ensures that a reader blocked on REAPURB
             ** will get unblocked
             */
-            ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_in);
-            ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_out);
-            h->urb_in.status = -ENODEV;
-            h->urb_out.status = -ENODEV;
+            for (int i = 0; i < USB_URBS_MAX; i++) {
+                ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_in[i]);
+            }
+            for (int i = 0; i < USB_URBS_MAX + 1; i++) {
+                ioctl(h->desc, USBDEVFS_DISCARDURB, &h->urb_out[i]);
+            }
+            h->urb_in_failed = ENODEV;
+            h->urb_out_failed = ENODEV;
             h->urb_in_busy = 0;
             h->urb_out_busy = 0;
             adb_cond_broadcast(&h->notify);
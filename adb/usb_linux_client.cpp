@@ -21,15 +21,19 @@
 #include <cutils/properties.h>
 #include <dirent.h>
 #include <errno.h>
+#include <linux/aio_abi.h>
 #include <linux/usb/ch9.h>
 #include <linux/usb/functionfs.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include "adb.h"
 #include "transport.h"
 
@@ -40,6 +44,20 @@
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
+// With FunctionFS, reads and writes are split into transfers of at most
+// USB_FFS_BULK_SIZE that are all queued on the endpoint at once through
+// AIO, so that the controller goes from one to the next without waiting
+// for adbd. A whole packet of MAX_PAYLOAD fits.
+#define USB_FFS_BULK_SIZE (16 * 1024)
+#define USB_FFS_NUM_BUFS ((MAX_PAYLOAD + USB_FFS_BULK_SIZE - 1) / USB_FFS_BULK_SIZE)
+
+struct aio_block {
+    aio_context_t ctx;
+    struct iocb iocb[USB_FFS_NUM_BUFS];
+    struct iocb* iocbs[USB_FFS_NUM_BUFS];
+    struct io_event events[USB_FFS_NUM_BUFS];
+};
+
 struct usb_handle
 {
     adb_cond_t notify;
@@ -56,6 +74,12 @@ struct usb_handle
     int control;
     int bulk_out; /* "out" from the host's perspective => source for adbd */
     int bulk_in;  /* "in" from the host's perspective => sink for adbd */
+
+    // Cleared if the kernel cannot do AIO on the endpoints, reads and
+    // writes then block on one transfer at a time.
+    bool use_aio;
+    aio_block read_aiob;
+    aio_block write_aiob;
 };
 
 struct func_desc {
@@ -256,16 +280,23 @@ static int usb_adb_write(usb_handle *h, const void *data, int len)
     return 0;
 }
 
-static int usb_adb_read(usb_handle *h, void *data, int len)
+static int usb_adb_read(usb_handle *h, void *_data, int len)
 {
+    unsigned char *data = reinterpret_cast<unsigned char*>(_data);
     int n;
 
     D("about to read (fd=%d, len=%d)\n", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
-            h->fd, n, errno, strerror(errno));
-        return -1;
+    // f_adb refuses reads larger than its 4K request buffer
+    while (len > 0) {
+        int xfer = (len > MAX_PAYLOAD_V1) ? MAX_PAYLOAD_V1 : len;
+        n = adb_read(h->fd, data, xfer);
+        if(n != xfer) {
+            D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
+                h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        data += xfer;
+        len -= xfer;
     }
     D("[ done fd=%d ]\n", h->fd);
     return 0;
@@ -442,9 +473,134 @@ static int bulk_write(int bulk_in, const uint8_t* buf, size_t length)
     return count;
 }
 
+static int io_setup(unsigned nr, aio_context_t* ctx)
+{
+    return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long nr, struct iocb** iocbs)
+{
+    return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr, struct io_event* events,
+                        struct timespec* timeout)
+{
+    return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static int io_cancel(aio_context_t ctx, struct iocb* iocb, struct io_event* result)
+{
+    return syscall(__NR_io_cancel, ctx, iocb, result);
+}
+
+static bool aio_block_init(aio_block* aiob)
+{
+    memset(aiob, 0, sizeof(*aiob));
+    if (io_setup(USB_FFS_NUM_BUFS, &aiob->ctx) != 0) {
+        D("[ aio: io_setup failed: errno=%d ]\n", errno);
+        return false;
+    }
+    for (int i = 0; i < USB_FFS_NUM_BUFS; i++) {
+        aiob->iocbs[i] = &aiob->iocb[i];
+    }
+    return true;
+}
+
+// Transfers len bytes on fd as transfers queued all at once and waits for
+// them all. Returns 1 if the endpoint does not take AIO and nothing was
+// queued, 0 once all of len is done and -1 on failure.
+static int usb_ffs_do_aio(aio_block* aiob, int fd, void* data, size_t len, bool read)
+{
+    uint8_t* buf = reinterpret_cast<uint8_t*>(data);
+    int num_bufs = (len + USB_FFS_BULK_SIZE - 1) / USB_FFS_BULK_SIZE;
+
+    if (num_bufs > USB_FFS_NUM_BUFS) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < num_bufs; i++) {
+        struct iocb* iocb = &aiob->iocb[i];
+        size_t offset = i * USB_FFS_BULK_SIZE;
+        memset(iocb, 0, sizeof(*iocb));
+        iocb->aio_fildes = fd;
+        iocb->aio_lio_opcode = read ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+        iocb->aio_buf = reinterpret_cast<uintptr_t>(buf + offset);
+        iocb->aio_nbytes = std::min(len - offset, (size_t) USB_FFS_BULK_SIZE);
+    }
+
+    int submitted = 0;
+    while (submitted < num_bufs) {
+        int n = io_submit(aiob->ctx, num_bufs - submitted, aiob->iocbs + submitted);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (submitted == 0 && errno == EINVAL) return 1;
+            D("[ aio: io_submit failed: errno=%d ]\n", errno);
+            break;
+        }
+        submitted += n;
+    }
+
+    // All that was queued has to complete, or be cancelled, before the
+    // buffer can be let go of. What was queued ahead of a failure to queue
+    // the rest is cancelled, and given a second to go.
+    int failed = submitted < num_bufs ? errno : 0;
+    struct timespec grace = { 1, 0 };
+    if (failed) {
+        for (int i = 0; i < submitted; i++) {
+            io_cancel(aiob->ctx, &aiob->iocb[i], &aiob->events[0]);
+        }
+    }
+    size_t done = 0;
+    int completed = 0;
+    while (completed < submitted) {
+        int n = io_getevents(aiob->ctx, 1, submitted - completed, aiob->events,
+                             failed ? &grace : nullptr);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            D("[ aio: io_getevents failed: errno=%d ]\n", errno);
+            errno = failed ? failed : errno;
+            return -1;
+        }
+        for (int i = 0; i < n; i++) {
+            const struct io_event& event = aiob->events[i];
+            const struct iocb* iocb = reinterpret_cast<const struct iocb*>(event.obj);
+            if (event.res < 0) {
+                if (!failed) failed = -event.res;
+            } else if ((size_t) event.res != iocb->aio_nbytes) {
+                // A transfer ended short, the host sent less than the
+                // packet said.
+                if (!failed) failed = EIO;
+            } else {
+                done += event.res;
+            }
+        }
+        completed += n;
+    }
+
+    if (failed || done != len) {
+        errno = failed ? failed : EIO;
+        return -1;
+    }
+    return 0;
+}
+
 static int usb_ffs_write(usb_handle* h, const void* data, int len)
 {
     D("about to write (fd=%d, len=%d)\n", h->bulk_in, len);
+    if (h->use_aio) {
+        int r = usb_ffs_do_aio(&h->write_aiob, h->bulk_in, const_cast<void*>(data), len, false);
+        if (r <= 0) {
+            if (r < 0) {
+                D("ERROR: fd = %d, aio write: %s\n", h->bulk_in, strerror(errno));
+                return -1;
+            }
+            D("[ done fd=%d ]\n", h->bulk_in);
+            return 0;
+        }
+        D("[ aio: not supported on fd=%d, blocking from now on ]\n", h->bulk_in);
+        h->use_aio = false;
+    }
     int n = bulk_write(h->bulk_in, reinterpret_cast<const uint8_t*>(data), len);
     if (n != len) {
         D("ERROR: fd = %d, n = %d: %s\n", h->bulk_in, n, strerror(errno));
@@ -478,6 +634,19 @@ static int bulk_read(int bulk_out, uint8_t* buf, size_t length)
 static int usb_ffs_read(usb_handle* h, void* data, int len)
 {
     D("about to read (fd=%d, len=%d)\n", h->bulk_out, len);
+    if (h->use_aio) {
+        int r = usb_ffs_do_aio(&h->read_aiob, h->bulk_out, data, len, true);
+        if (r <= 0) {
+            if (r < 0) {
+                D("ERROR: fd = %d, aio read: %s\n", h->bulk_out, strerror(errno));
+                return -1;
+            }
+            D("[ done fd=%d ]\n", h->bulk_out);
+            return 0;
+        }
+        D("[ aio: not supported on fd=%d, blocking from now on ]\n", h->bulk_out);
+        h->use_aio = false;
+    }
     int n = bulk_read(h->bulk_out, reinterpret_cast<uint8_t*>(data), len);
     if (n != len) {
         D("ERROR: fd = %d, n = %d: %s\n", h->bulk_out, n, strerror(errno));
@@ -525,7 +694,8 @@ static void usb_ffs_init()
     h->kick = usb_ffs_kick;
     h->control = -1;
     h->bulk_out = -1;
-    h->bulk_out = -1;
+    h->bulk_in = -1;
+    h->use_aio = aio_block_init(&h->read_aiob) && aio_block_init(&h->write_aiob);
 
     adb_cond_init(&h->notify, 0);
     adb_mutex_init(&h->lock, 0);
@@ -18,20 +18,48 @@
 #include <malloc.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
 #include <sys/resource.h>
 
+#include <atomic>
+
 #include <adf/adf.h>
 #include <adfhwc/adfhwc.h>
 
 #include <cutils/log.h>
 #include <utils/Vector.h>
 
+// SCHED_FIFO priority of the event thread in low-latency mode, just above
+// the lowest so that it does not starve other real-time display work
+#define ADF_HWC_FIFO_PRIORITY 2
+
+#define ADF_HWC_EVENT_BUF_SIZE 4096
+
+// Latest vsync of one display, as a seqlock: the event thread is the only
+// writer, readers retry while seq is odd or changes under them.
+struct adf_hwc_vsync_slot {
+    std::atomic<uint32_t> seq;
+    std::atomic<uint64_t> timestamp;
+    std::atomic<uint64_t> count;
+};
+
+// Bytes read from an interface fd, which may end part way into an event
+struct adf_hwc_event_buf {
+    uint8_t data[ADF_HWC_EVENT_BUF_SIZE];
+    size_t len;
+};
+
 struct adf_hwc_helper {
     adf_hwc_event_callbacks const *event_cb;
     void *event_cb_data;
+    uint32_t flags;
 
     pthread_t event_thread;
 
+    adf_hwc_vsync_slot *vsync_slots;
+    adf_hwc_event_buf *event_bufs;
+
     android::Vector<int> intf_fds;
     android::Vector<drm_mode_modeinfo> display_configs;
 };
@@ -166,47 +194,130 @@ int adf_getDisplayAttributes(struct adf_hwc_helper *dev, int disp,
     return 0;
 }
 
-static void handle_adf_event(struct adf_hwc_helper *dev, int disp)
+static void publish_vsync(adf_hwc_vsync_slot &slot, uint64_t timestamp)
 {
-    adf_event *event;
-    int err = adf_read_event(dev->intf_fds[disp], &event);
-    if (err < 0) {
-        ALOGE("error reading event from display %d: %s", disp, strerror(err));
-        return;
-    }
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timestamp.store(timestamp, std::memory_order_relaxed);
+    slot.count.store(slot.count.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+int adf_hwc_get_last_vsync(struct adf_hwc_helper *dev, int disp,
+        uint64_t *timestamp, uint64_t *count)
+{
+    if ((size_t)disp >= dev->intf_fds.size())
+        return -EINVAL;
 
-    void *vsync_temp;
-    adf_vsync_event *vsync;
-    adf_hotplug_event *hotplug;
+    adf_hwc_vsync_slot &slot = dev->vsync_slots[disp];
+    uint32_t seq;
+    uint64_t ts, n;
+    do {
+        seq = slot.seq.load(std::memory_order_acquire);
+        ts = slot.timestamp.load(std::memory_order_relaxed);
+        n = slot.count.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != slot.seq.load(std::memory_order_relaxed));
+
+    *timestamp = ts;
+    if (count)
+        *count = n;
+    return 0;
+}
+
+// Events sit unaligned in the read buffer, so fields are copied out of it
+// rather than read through a cast.
+static void dispatch_adf_event(struct adf_hwc_helper *dev, int disp,
+        const uint8_t *data, const adf_event &header)
+{
+    uint64_t timestamp;
+    uint8_t connected;
+    uint64_t custom[ADF_HWC_EVENT_BUF_SIZE / sizeof(uint64_t)];
 
-    switch (event->type) {
+    switch (header.type) {
     case ADF_EVENT_VSYNC:
-        vsync_temp = event;
-        vsync = static_cast<adf_vsync_event *>(vsync_temp);
-        // casting directly to adf_vsync_event * makes g++ warn about
-        // potential alignment issues that don't apply here
-        dev->event_cb->vsync(dev->event_cb_data, disp, vsync->timestamp);
+        if (header.length < sizeof(adf_vsync_event))
+            break;
+        memcpy(&timestamp, data + offsetof(adf_vsync_event, timestamp),
+                sizeof(timestamp));
+        publish_vsync(dev->vsync_slots[disp], timestamp);
+        if (dev->event_cb->vsync)
+            dev->event_cb->vsync(dev->event_cb_data, disp, timestamp);
         break;
     case ADF_EVENT_HOTPLUG:
-        hotplug = reinterpret_cast<adf_hotplug_event *>(event);
-        dev->event_cb->hotplug(dev->event_cb_data, disp, hotplug->connected);
+        if (header.length < sizeof(adf_hotplug_event))
+            break;
+        memcpy(&connected, data + offsetof(adf_hotplug_event, connected),
+                sizeof(connected));
+        dev->event_cb->hotplug(dev->event_cb_data, disp, connected);
         break;
     default:
-        if (event->type < ADF_EVENT_DEVICE_CUSTOM)
-            ALOGW("unrecognized event type %u", event->type);
+        if (header.type < ADF_EVENT_DEVICE_CUSTOM)
+            ALOGW("unrecognized event type %u", header.type);
         else if (!dev->event_cb || !dev->event_cb->custom_event)
-            ALOGW("unhandled event type %u", event->type);
-        else
-            dev->event_cb->custom_event(dev->event_cb_data, disp, event);
+            ALOGW("unhandled event type %u", header.type);
+        else {
+            memcpy(custom, data, header.length);
+            dev->event_cb->custom_event(dev->event_cb_data, disp,
+                    reinterpret_cast<adf_event *>(custom));
+        }
+    }
+}
+
+// Reads every event queued on the display with one read() and handles
+// them in order; an event cut short by the buffer is finished next time.
+static void handle_adf_events(struct adf_hwc_helper *dev, int disp)
+{
+    adf_hwc_event_buf &buf = dev->event_bufs[disp];
+    ssize_t n = read(dev->intf_fds[disp], buf.data + buf.len,
+            sizeof(buf.data) - buf.len);
+    if (n < 0) {
+        if (errno != EINTR && errno != EAGAIN)
+            ALOGE("error reading events from display %d: %s", disp,
+                    strerror(errno));
+        return;
+    }
+    buf.len += n;
+
+    size_t offset = 0;
+    while (buf.len - offset >= sizeof(adf_event)) {
+        adf_event header;
+        memcpy(&header, buf.data + offset, sizeof(header));
+        if (header.length < sizeof(header) || header.length > sizeof(buf.data)) {
+            ALOGE("bad event length %u from display %d", header.length, disp);
+            buf.len = 0;
+            return;
+        }
+        if (buf.len - offset < header.length)
+            break;
+        dispatch_adf_event(dev, disp, buf.data + offset, header);
+        offset += header.length;
     }
-    free(event);
+
+    memmove(buf.data, buf.data + offset, buf.len - offset);
+    buf.len -= offset;
+}
+
+static void set_event_thread_priority(struct adf_hwc_helper *dev)
+{
+    if (dev->flags & ADF_HWC_FLAG_LOW_LATENCY) {
+        sched_param param;
+        param.sched_priority = ADF_HWC_FIFO_PRIORITY;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (!err)
+            return;
+        ALOGW("failed to make event thread SCHED_FIFO: %s", strerror(err));
+    }
+    setpriority(PRIO_PROCESS, 0, HAL_PRIORITY_URGENT_DISPLAY);
 }
 
 static void *adf_event_thread(void *data)
 {
     adf_hwc_helper *dev = static_cast<adf_hwc_helper *>(data);
 
-    setpriority(PRIO_PROCESS, 0, HAL_PRIORITY_URGENT_DISPLAY);
+    set_event_thread_priority(dev);
 
     pollfd *fds = new pollfd[dev->intf_fds.size()];
     for (size_t i = 0; i < dev->intf_fds.size(); i++) {
@@ -220,7 +331,7 @@ static void *adf_event_thread(void *data)
         if (err > 0) {
             for (size_t i = 0; i < dev->intf_fds.size(); i++)
                 if (fds[i].revents & (POLLIN | POLLPRI))
-                    handle_adf_event(dev, i);
+                    handle_adf_events(dev, i);
         }
         else if (err == -1) {
             if (errno == EINTR)
@@ -236,6 +347,14 @@ static void *adf_event_thread(void *data)
 int adf_hwc_open(int *intf_fds, size_t n_intfs,
         const struct adf_hwc_event_callbacks *event_cb, void *event_cb_data,
         struct adf_hwc_helper **dev)
+{
+    return adf_hwc_open_flags(intf_fds, n_intfs, event_cb, event_cb_data, 0,
+            dev);
+}
+
+int adf_hwc_open_flags(int *intf_fds, size_t n_intfs,
+        const struct adf_hwc_event_callbacks *event_cb, void *event_cb_data,
+        uint32_t flags, struct adf_hwc_helper **dev)
 {
     if (!n_intfs)
         return -EINVAL;
@@ -243,6 +362,9 @@ int adf_hwc_open(int *intf_fds, size_t n_intfs,
     adf_hwc_helper *dev_ret = new adf_hwc_helper;
     dev_ret->event_cb = event_cb;
     dev_ret->event_cb_data = event_cb_data;
+    dev_ret->flags = flags;
+    dev_ret->vsync_slots = new adf_hwc_vsync_slot[n_intfs]();
+    dev_ret->event_bufs = new adf_hwc_event_buf[n_intfs]();
 
     int ret;
 
@@ -278,6 +400,8 @@ err:
     for (size_t i = 0; i < dev_ret->intf_fds.size(); i++)
         close(dev_ret->intf_fds[i]);
 
+    delete [] dev_ret->vsync_slots;
+    delete [] dev_ret->event_bufs;
     delete dev_ret;
     return ret;
 }
@@ -290,5 +414,7 @@ void adf_hwc_close(struct adf_hwc_helper *dev)
     for (size_t i = 0; i < dev->intf_fds.size(); i++)
         close(dev->intf_fds[i]);
 
+    delete [] dev->vsync_slots;
+    delete [] dev->event_bufs;
     delete dev;
 }
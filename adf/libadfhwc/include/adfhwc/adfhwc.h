@@ -28,7 +28,8 @@ struct adf_hwc_helper;
 
 struct adf_hwc_event_callbacks {
     /**
-     * Called on vsync (required)
+     * Called on vsync (required, unless vsyncs are read with
+     * adf_hwc_get_last_vsync() instead)
      */
     void (*vsync)(void *data, int disp, uint64_t timestamp);
     /**
@@ -103,6 +104,19 @@ int adf_hwc_open(int *intf_fds, size_t n_intfs,
         const struct adf_hwc_event_callbacks *event_cb, void *event_cb_data,
         struct adf_hwc_helper **dev);
 
+/**
+ * Runs the event thread SCHED_FIFO, falling back to the usual urgent-display
+ * nice level if that is not permitted.
+ */
+#define ADF_HWC_FLAG_LOW_LATENCY (1 << 0)
+
+/**
+ * Like adf_hwc_open(), with ADF_HWC_FLAG_* flags.
+ */
+int adf_hwc_open_flags(int *intf_fds, size_t n_intfs,
+        const struct adf_hwc_event_callbacks *event_cb, void *event_cb_data,
+        uint32_t flags, struct adf_hwc_helper **dev);
+
 /**
  * Destroys a HWC helper.
  */
@@ -124,6 +138,18 @@ int adf_getDisplayConfigs(struct adf_hwc_helper *dev, int disp,
 int adf_getDisplayAttributes(struct adf_hwc_helper *dev, int disp,
         uint32_t config, const uint32_t *attributes, int32_t *values);
 
+/**
+ * Returns the timestamp of the latest vsync on disp, and if count is not NULL
+ * the number of vsyncs seen on it so far.  Both are 0 before the first.
+ *
+ * Lock-free and safe to call from any thread, so compositors can sample
+ * vsync without waiting for the vsync callback.
+ *
+ * On error, returns -errno.
+ */
+int adf_hwc_get_last_vsync(struct adf_hwc_helper *dev, int disp,
+        uint64_t *timestamp, uint64_t *count);
+
 __END_DECLS
 
 #endif /* _LIBADFHWC_ADFHWC_H_ */
@@ -20,6 +20,9 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
 #include <string>
 
@@ -34,12 +37,30 @@ namespace base {
 bool ReadFdToString(int fd, std::string* content) {
   content->clear();
 
-  char buf[BUFSIZ];
-  ssize_t n;
-  while ((n = TEMP_FAILURE_RETRY(read(fd, &buf[0], sizeof(buf)))) > 0) {
-    content->append(buf, n);
+  // Start with room for the whole file, plus one byte so that we see EOF
+  // without growing, and read straight into the string. Files in /proc and
+  // /sys report a size of 0 or a page and pipes report 0, so keep going
+  // until read returns 0 whatever fstat said.
+  struct stat sb;
+  size_t size = BUFSIZ;
+  if (fstat(fd, &sb) != -1 && sb.st_size > 0) {
+    size = static_cast<size_t>(sb.st_size) + 1;
+  }
+  content->resize(size);
+
+  size_t pos = 0;
+  while (true) {
+    if (pos == content->size()) {
+      content->resize(pos * 2);
+    }
+    ssize_t n = TEMP_FAILURE_RETRY(
+        read(fd, &(*content)[pos], content->size() - pos));
+    if (n <= 0) {
+      content->resize(pos);
+      return n == 0;
+    }
+    pos += n;
   }
-  return (n == 0) ? true : false;
 }
 
 bool ReadFileToString(const std::string& path, std::string* content) {
@@ -55,6 +76,79 @@ bool ReadFileToString(const std::string& path, std::string* content) {
   return result;
 }
 
+ssize_t ReadFileToBuffer(const std::string& path, void* buffer, size_t size) {
+  int fd =
+      TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+  if (fd == -1) {
+    return -1;
+  }
+  uint8_t* p = reinterpret_cast<uint8_t*>(buffer);
+  size_t pos = 0;
+  while (pos < size) {
+    ssize_t n = TEMP_FAILURE_RETRY(read(fd, p + pos, size - pos));
+    if (n == -1) {
+      int saved_errno = errno;
+      close(fd);
+      errno = saved_errno;
+      return -1;
+    }
+    if (n == 0) break;
+    pos += n;
+  }
+  close(fd);
+  return pos;
+}
+
+#if !defined(_WIN32)
+FileView::FileView() : data_(nullptr), size_(0), map_(nullptr) {
+}
+
+FileView::~FileView() {
+  Reset();
+}
+
+void FileView::Reset() {
+  if (map_ != nullptr) {
+    munmap(map_, size_);
+    map_ = nullptr;
+  }
+  content_.clear();
+  data_ = nullptr;
+  size_ = 0;
+}
+
+bool FileView::Open(const std::string& path) {
+  Reset();
+
+  int fd =
+      TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+  if (fd == -1) {
+    return false;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) != -1 && S_ISREG(sb.st_mode) &&
+      sb.st_size >= static_cast<off_t>(kMinMappedSize)) {
+    void* map = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      close(fd);
+      map_ = map;
+      data_ = reinterpret_cast<const char*>(map);
+      size_ = sb.st_size;
+      return true;
+    }
+    // Not every file system can map files (sysfs attributes, for one), so
+    // fall back to reading.
+  }
+  bool result = ReadFdToString(fd, &content_);
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  data_ = content_.data();
+  size_ = content_.size();
+  return result;
+}
+#endif
+
 bool WriteStringToFd(const std::string& content, int fd) {
   const char* p = content.data();
   size_t left = content.size();
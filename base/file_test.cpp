@@ -104,3 +104,67 @@ TEST(file, WriteFully) {
   ASSERT_TRUE(android::base::ReadFileToString(tf.filename, &s)) << errno;
   EXPECT_EQ("abc", s);
 }
+
+TEST(file, ReadFileToString_large) {
+  // Bigger than the BUFSIZ chunks the old implementation read in.
+  std::string expected;
+  for (size_t i = 0; i < 100000; ++i) {
+    expected += static_cast<char>('a' + i % 26);
+  }
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  ASSERT_TRUE(android::base::WriteStringToFile(expected, tf.filename)) << errno;
+  std::string s("hello");
+  ASSERT_TRUE(android::base::ReadFileToString(tf.filename, &s)) << errno;
+  EXPECT_EQ(expected, s);
+}
+
+TEST(file, ReadFdToString_pipe) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds)) << strerror(errno);
+  std::string expected(BUFSIZ * 3 / 2, 'x');
+  ASSERT_TRUE(android::base::WriteStringToFd(expected, fds[1]));
+  close(fds[1]);
+  std::string s;
+  ASSERT_TRUE(android::base::ReadFdToString(fds[0], &s)) << errno;
+  EXPECT_EQ(expected, s);
+  close(fds[0]);
+}
+
+TEST(file, ReadFileToBuffer) {
+  char buf[64];
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ(5, android::base::ReadFileToBuffer("/proc/version", buf, 5));
+  ASSERT_STREQ("Linux", buf);
+
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  ASSERT_TRUE(android::base::WriteStringToFile("abc", tf.filename)) << errno;
+  ASSERT_EQ(3, android::base::ReadFileToBuffer(tf.filename, buf, sizeof(buf)));
+
+  errno = 0;
+  ASSERT_EQ(-1, android::base::ReadFileToBuffer("/proc/does-not-exist", buf,
+                                                sizeof(buf)));
+  EXPECT_EQ(ENOENT, errno);
+}
+
+TEST(file, FileView) {
+  TemporaryFile tf;
+  ASSERT_TRUE(tf.fd != -1);
+  ASSERT_TRUE(android::base::WriteStringToFile("abc", tf.filename)) << errno;
+
+  android::base::FileView view;
+  ASSERT_TRUE(view.Open(tf.filename)) << errno;
+  EXPECT_FALSE(view.mapped());
+  EXPECT_EQ("abc", std::string(view.data(), view.size()));
+
+  std::string large(android::base::FileView::kMinMappedSize + 1, 'y');
+  ASSERT_TRUE(android::base::WriteStringToFile(large, tf.filename)) << errno;
+  ASSERT_TRUE(view.Open(tf.filename)) << errno;
+  EXPECT_TRUE(view.mapped());
+  EXPECT_EQ(large, std::string(view.data(), view.size()));
+
+  ASSERT_TRUE(view.Open("/proc/version")) << errno;
+  EXPECT_FALSE(view.mapped());
+  EXPECT_EQ(0, memcmp("Linux", view.data(), 5));
+}
@@ -18,14 +18,53 @@
 #define BASE_FILE_H
 
 #include <sys/stat.h>
+#include <sys/types.h>
 #include <string>
 
+#include "base/macros.h"
+
 namespace android {
 namespace base {
 
 bool ReadFdToString(int fd, std::string* content);
 bool ReadFileToString(const std::string& path, std::string* content);
 
+// Reads at most size bytes of path into buffer. Returns the number of bytes
+// read, or -1 on error. Unlike ReadFileToString this never allocates, so it
+// suits code that reads the same small sysfs or procfs file over and over.
+ssize_t ReadFileToBuffer(const std::string& path, void* buffer, size_t size);
+
+#if !defined(_WIN32)
+// A read-only view of a whole file. Regular files of at least
+// kMinMappedSize bytes are mapped rather than copied; other files (small
+// ones, and those in /proc or /sys) are read into memory. The data is only
+// valid until the next Open or until the FileView is destroyed, and a
+// mapped file must not be truncated while it is in use.
+class FileView {
+ public:
+  static const size_t kMinMappedSize = 64 * 1024;
+
+  FileView();
+  ~FileView();
+
+  bool Open(const std::string& path);
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool mapped() const { return map_ != nullptr; }
+
+ private:
+  void Reset();
+
+  const char* data_;
+  size_t size_;
+  void* map_;
+  std::string content_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileView);
+};
+#endif
+
 bool WriteStringToFile(const std::string& content, const std::string& path);
 bool WriteStringToFd(const std::string& content, int fd);
 
@@ -62,6 +62,29 @@ class LogdLogger {
 };
 #endif
 
+// Wraps another logger so that logging does not wait for the write: messages
+// are put on a lock-free queue and a background thread passes them on. A
+// FATAL message is written by the caller, after everything queued before it,
+// so that it is not lost when the process aborts. If max_pending messages
+// are already waiting, new ones are dropped, and the number dropped is
+// logged once the queue drains. Copies share the same queue and thread.
+//
+//     SetLogger(AsyncLogger(LogdLogger()));
+class AsyncLogger {
+ public:
+  explicit AsyncLogger(LogFunction&& logger, size_t max_pending = 4096);
+
+  void operator()(LogId, LogSeverity, const char* tag, const char* file,
+                  unsigned int line, const char* message);
+
+  // Writes everything queued so far before returning.
+  void Flush();
+
+ private:
+  class Queue;
+  std::shared_ptr<Queue> queue_;
+};
+
 // Configure logging based on ANDROID_LOG_TAGS environment variable.
 // We need to parse a string that looks like
 //
@@ -25,11 +25,14 @@
 #include <errno.h>
 #endif
 
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <limits>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -121,6 +124,160 @@ void LogdLogger::operator()(LogId id, LogSeverity severity, const char* tag,
 }
 #endif
 
+// Producers push onto a singly linked stack with a compare-and-swap. The
+// flusher takes the whole stack with one exchange and reverses it, which
+// restores the order the messages were logged in and sidesteps ABA, since
+// nothing else ever pops. The mutex is only taken to sleep and to wake the
+// flusher when the stack goes from empty to non-empty.
+class AsyncLogger::Queue {
+ public:
+  Queue(LogFunction&& logger, size_t max_pending)
+      : logger_(std::move(logger)),
+        max_pending_(max_pending),
+        head_(nullptr),
+        pending_(0),
+        dropped_(0),
+        stopping_(false),
+        thread_(&Queue::Run, this) {
+  }
+
+  ~Queue() {
+    {
+      std::lock_guard<std::mutex> lock(wake_lock_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    Flush();
+  }
+
+  void Push(LogId id, LogSeverity severity, const char* tag, const char* file,
+            unsigned int line, const char* message) {
+    if (severity == FATAL) {
+      std::lock_guard<std::mutex> lock(write_lock_);
+      Drain();
+      logger_(id, severity, tag, file, line, message);
+      return;
+    }
+    if (pending_.fetch_add(1, std::memory_order_relaxed) >= max_pending_) {
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    Entry* entry = new Entry(id, severity, tag, file, line, message);
+    entry->next = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(entry->next, entry,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    }
+    if (entry->next == nullptr) {
+      // Taking the lock orders this push against the flusher's check of the
+      // stack before it sleeps, so the wakeup cannot be missed.
+      { std::lock_guard<std::mutex> lock(wake_lock_); }
+      wake_.notify_one();
+    }
+  }
+
+  void Flush() {
+    std::lock_guard<std::mutex> lock(write_lock_);
+    Drain();
+  }
+
+ private:
+  struct Entry {
+    Entry(LogId id, LogSeverity severity, const char* tag, const char* file,
+          unsigned int line, const char* message)
+        : next(nullptr),
+          id(id),
+          severity(severity),
+          line(line),
+          tag(tag),
+          file(file),
+          message(message) {
+    }
+
+    Entry* next;
+    LogId id;
+    LogSeverity severity;
+    unsigned int line;
+    std::string tag;
+    std::string file;
+    std::string message;
+  };
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(wake_lock_);
+    while (!stopping_) {
+      if (head_.load(std::memory_order_relaxed) == nullptr) {
+        wake_.wait(lock);
+        continue;
+      }
+      lock.unlock();
+      Flush();
+      lock.lock();
+    }
+  }
+
+  // Must be called with write_lock_ held.
+  void Drain() {
+    Entry* entry = head_.exchange(nullptr, std::memory_order_acquire);
+    Entry* reversed = nullptr;
+    while (entry != nullptr) {
+      Entry* next = entry->next;
+      entry->next = reversed;
+      reversed = entry;
+      entry = next;
+    }
+    while (reversed != nullptr) {
+      Entry* next = reversed->next;
+      logger_(reversed->id, reversed->severity, reversed->tag.c_str(),
+              reversed->file.c_str(), reversed->line,
+              reversed->message.c_str());
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      delete reversed;
+      reversed = next;
+    }
+    size_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped != 0) {
+      std::string message = std::to_string(dropped) + " log messages dropped";
+      logger_(DEFAULT, WARNING, ProgramInvocationName(), __FILE__, __LINE__,
+              message.c_str());
+    }
+  }
+
+  LogFunction logger_;
+  const size_t max_pending_;
+  std::atomic<Entry*> head_;
+  std::atomic<size_t> pending_;
+  std::atomic<size_t> dropped_;
+
+  // Held while messages are passed to logger_, so that they come out in
+  // order whether the flusher or a FATAL caller writes them.
+  std::mutex write_lock_;
+
+  std::mutex wake_lock_;
+  std::condition_variable wake_;
+  bool stopping_;
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(Queue);
+};
+
+AsyncLogger::AsyncLogger(LogFunction&& logger, size_t max_pending)
+    : queue_(std::make_shared<Queue>(std::move(logger), max_pending)) {
+}
+
+void AsyncLogger::operator()(LogId id, LogSeverity severity, const char* tag,
+                             const char* file, unsigned int line,
+                             const char* message) {
+  queue_->Push(id, severity, tag, file, line, message);
+}
+
+void AsyncLogger::Flush() {
+  queue_->Flush();
+}
+
 void InitLogging(char* argv[], LogFunction&& logger) {
   SetLogger(std::forward<LogFunction>(logger));
   InitLogging(argv);
@@ -186,13 +343,57 @@ void SetLogger(LogFunction&& logger) {
   gLogger = std::move(logger);
 }
 
+// Building a std::ostringstream (and its locale) for every LOG line is
+// expensive, so each thread keeps one to reuse. A message that is started
+// while another is being built on the same thread, from an operator<< for
+// example, gets a stream of its own.
+struct LogStream {
+  LogStream() : in_use(false) {
+  }
+
+  std::ostringstream stream;
+  bool in_use;
+};
+
+static thread_store_t gLogStreamStore = THREAD_STORE_INITIALIZER;
+
+static void DeleteLogStream(void* stream) {
+  delete reinterpret_cast<LogStream*>(stream);
+}
+
+static LogStream* AcquireLogStream() {
+  LogStream* stream =
+      reinterpret_cast<LogStream*>(thread_store_get(&gLogStreamStore));
+  if (stream == nullptr) {
+    stream = new LogStream;
+    thread_store_set(&gLogStreamStore, stream, DeleteLogStream);
+  } else if (stream->in_use) {
+    return new LogStream;
+  }
+  stream->in_use = true;
+  return stream;
+}
+
+static void ReleaseLogStream(LogStream* stream) {
+  if (!stream->in_use) {
+    delete stream;
+    return;
+  }
+  static const std::ostringstream default_format;
+  stream->stream.str(std::string());
+  stream->stream.clear();
+  stream->stream.copyfmt(default_format);
+  stream->in_use = false;
+}
+
 // This indirection greatly reduces the stack impact of having lots of
 // checks/logging in a function.
 class LogMessageData {
  public:
   LogMessageData(const char* file, unsigned int line, LogId id,
                  LogSeverity severity, int error)
-      : file_(file),
+      : buffer_(AcquireLogStream()),
+        file_(file),
         line_number_(line),
         id_(id),
         severity_(severity),
@@ -201,6 +402,10 @@ class LogMessageData {
     file = (last_slash == nullptr) ? file : last_slash + 1;
   }
 
+  ~LogMessageData() {
+    ReleaseLogStream(buffer_);
+  }
+
   const char* GetFile() const {
     return file_;
   }
@@ -222,15 +427,15 @@ class LogMessageData {
   }
 
   std::ostream& GetBuffer() {
-    return buffer_;
+    return buffer_->stream;
   }
 
   std::string ToString() const {
-    return buffer_.str();
+    return buffer_->stream.str();
   }
 
  private:
-  std::ostringstream buffer_;
+  LogStream* const buffer_;
   const char* const file_;
   const unsigned int line_number_;
   const LogId id_;
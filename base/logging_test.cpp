@@ -16,8 +16,11 @@
 
 #include "base/logging.h"
 
+#include <algorithm>
+#include <mutex>
 #include <regex>
 #include <string>
+#include <vector>
 
 #include "base/file.h"
 #include "base/stringprintf.h"
@@ -169,3 +172,67 @@ TEST(logging, UNIMPLEMENTED) {
     ASSERT_TRUE(std::regex_search(output, message_regex));
   }
 }
+
+TEST(logging, AsyncLogger) {
+  std::vector<std::string> lines;
+  android::base::AsyncLogger logger(
+      [&lines](android::base::LogId, android::base::LogSeverity, const char*,
+               const char*, unsigned int, const char* message) {
+        lines.push_back(message);
+      });
+  for (int i = 0; i < 100; ++i) {
+    logger(android::base::DEFAULT, android::base::INFO, "tag", __FILE__,
+           __LINE__, android::base::StringPrintf("%d", i).c_str());
+  }
+  logger.Flush();
+  ASSERT_EQ(100U, lines.size());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(android::base::StringPrintf("%d", i), lines[i]);
+  }
+}
+
+TEST(logging, AsyncLogger_dropped) {
+  std::vector<std::string> lines;
+  std::mutex lock;
+  lock.lock();  // Holds up the first write.
+  {
+    android::base::AsyncLogger logger(
+        [&lines, &lock](android::base::LogId, android::base::LogSeverity,
+                        const char*, const char*, unsigned int,
+                        const char* message) {
+          std::lock_guard<std::mutex> guard(lock);
+          lines.push_back(message);
+        },
+        2);
+    for (int i = 0; i < 10; ++i) {
+      logger(android::base::DEFAULT, android::base::INFO, "tag", __FILE__,
+             __LINE__, "foobar");
+    }
+    lock.unlock();
+  }
+  // Two were queued, the other eight were dropped.
+  ASSERT_EQ(3U, lines.size());
+  EXPECT_EQ(2, std::count(lines.begin(), lines.end(), "foobar"));
+  EXPECT_EQ(1, std::count(lines.begin(), lines.end(),
+                          "8 log messages dropped"));
+}
+
+TEST(logging, LOG_nested) {
+  CapturedStderr cap;
+  LOG(WARNING) << "outer " << [] {
+    LOG(WARNING) << "inner";
+    return 1;
+  }() << std::hex << 255;
+  LOG(WARNING) << 255;
+  ASSERT_EQ(0, lseek(cap.fd(), SEEK_SET, 0));
+
+  std::string output;
+  android::base::ReadFdToString(cap.fd(), &output);
+  ASSERT_TRUE(std::regex_search(
+      output, std::regex(make_log_pattern(android::base::WARNING, "inner"))));
+  ASSERT_TRUE(std::regex_search(
+      output, std::regex(make_log_pattern(android::base::WARNING, "outer 1ff"))));
+  // The std::hex above does not carry over to the next message.
+  ASSERT_TRUE(std::regex_search(
+      output, std::regex(make_log_pattern(android::base::WARNING, "255"))));
+}
@@ -11,6 +11,8 @@ LOCAL_MODULE := mkbootfs
 LOCAL_CFLAGS := -Werror
 
 LOCAL_SHARED_LIBRARIES := libcutils
+LOCAL_STATIC_LIBRARIES := libz
+LOCAL_LDLIBS := -lpthread
 
 include $(BUILD_HOST_EXECUTABLE)
 
@@ -11,6 +11,9 @@
 
 #include <stdarg.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+#include <zlib.h>
 
 #include <private/android_filesystem_config.h>
 
@@ -21,6 +24,9 @@
 ** - dotfiles are ignored
 ** - directories named 'root' are ignored
 ** - device notes, pipes, etc are not supported (error)
+** - the tree is walked first; files are then read by -j threads (the
+**   number of CPUs by default) while entries are written out in order
+** - -z gzips the output, compressing blocks on the same number of threads
 */
 
 void die(const char *why, ...)
@@ -41,7 +47,12 @@ struct fs_config_entry {
 };
 
 static struct fs_config_entry* canned_config = NULL;
+/* canned_config sorted by name, and then by position in the file */
+static struct fs_config_entry** canned_index = NULL;
+static int canned_count = 0;
+static struct fs_config_entry* canned_default = NULL;
 static char *target_out_path = NULL;
+static struct fs_config_index* fs_config_index = NULL;
 
 /* Each line in the canned file should be a path plus three ints (uid,
  * gid, mode). */
@@ -53,6 +64,28 @@ static char *target_out_path = NULL;
 
 static int verbose = 0;
 static int total_size = 0;
+static int threads = 1;
+static int gzip_output = 0;
+
+static void out_write(const void *data, size_t len);
+
+static void out_pad(int align)
+{
+    static const char zeros[256];
+
+    if (total_size & (align - 1)) {
+        int n = align - (total_size & (align - 1));
+        out_write(zeros, n);
+        total_size += n;
+    }
+}
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (p == NULL) die("cannot allocate %zu bytes", size);
+    return p;
+}
 
 static void fix_stat(const char *path, struct stat *s)
 {
@@ -61,26 +94,35 @@ static void fix_stat(const char *path, struct stat *s)
         // Use the list of file uid/gid/modes loaded from the file
         // given with -f.
 
-        struct fs_config_entry* empty_path_config = NULL;
-        struct fs_config_entry* p;
-        for (p = canned_config; p->name; ++p) {
-            if (!p->name[0]) {
-                empty_path_config = p;
-            }
-            if (strcmp(p->name, path) == 0) {
-                s->st_uid = p->uid;
-                s->st_gid = p->gid;
-                s->st_mode = p->mode | (s->st_mode & ~07777);
-                return;
+        // The first entry for the path wins; otherwise the last one with
+        // an empty path.
+        int lo = 0, hi = canned_count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (strcmp(canned_index[mid]->name, path) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
             }
         }
-        s->st_uid = empty_path_config->uid;
-        s->st_gid = empty_path_config->gid;
-        s->st_mode = empty_path_config->mode | (s->st_mode & ~07777);
+        struct fs_config_entry* p = canned_default;
+        if (lo < canned_count && strcmp(canned_index[lo]->name, path) == 0) {
+            p = canned_index[lo];
+        }
+        if (p == NULL) die("no canned config for '%s'", path);
+        s->st_uid = p->uid;
+        s->st_gid = p->gid;
+        s->st_mode = p->mode | (s->st_mode & ~07777);
     } else {
-        // Use the compiled-in fs_config() function.
+        // Use the compiled-in fs_config() rules, read once.
         unsigned st_mode = s->st_mode;
-        fs_config(path, S_ISDIR(s->st_mode), target_out_path,
+        if (!fs_config_index) {
+            fs_config_index = fs_config_index_create(target_out_path);
+            if (!fs_config_index) {
+                die("cannot create fs_config index");
+            }
+        }
+        fs_config_index_lookup(fs_config_index, path, S_ISDIR(s->st_mode),
                        &s->st_uid, &s->st_gid, &st_mode, &capabilities);
         s->st_mode = (typeof(s->st_mode)) st_mode;
     }
@@ -92,17 +134,16 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
     // approximate range that was being used already, and avoiding small
     // values which may be special.
     static unsigned next_inode = 300000;
+    char header[6 + 8*13 + 1];
 
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
-    }
+    out_pad(4);
 
     fix_stat(out, s);
 //    fprintf(stderr, "_eject %s: mode=0%o\n", out, s->st_mode);
 
-    printf("%06x%08x%08x%08x%08x%08x%08x"
-           "%08x%08x%08x%08x%08x%08x%08x%s%c",
+    snprintf(header, sizeof(header),
+           "%06x%08x%08x%08x%08x%08x%08x"
+           "%08x%08x%08x%08x%08x%08x%08x",
            0x070701,
            next_inode++,  //  s.st_ino,
            s->st_mode,
@@ -116,22 +157,19 @@ static void _eject(struct stat *s, char *out, int olen, char *data, unsigned dat
            0, // devmajor
            0, // devminor,
            olen + 1,
-           0,
-           out,
            0
            );
+    out_write(header, 6 + 8*13);
+    out_write(out, olen + 1);
 
     total_size += 6 + 8*13 + olen + 1;
 
     if(strlen(out) != (unsigned int)olen) die("ACK!");
 
-    while(total_size & 3) {
-        total_size++;
-        putchar(0);
-    }
+    out_pad(4);
 
     if(datasize) {
-        fwrite(data, datasize, 1, stdout);
+        out_write(data, datasize);
         total_size += datasize;
     }
 }
@@ -142,10 +180,143 @@ static void _eject_trailer()
     memset(&s, 0, sizeof(s));
     _eject(&s, "TRAILER!!!", 10, 0, 0);
 
-    while(total_size & 0xff) {
-        total_size++;
-        putchar(0);
+    out_pad(0x100);
+}
+
+/* Everything to be archived, in archive order.  Contents are filled in by
+ * the reader threads, at most READ_AHEAD entries ahead of the one being
+ * written out. */
+struct entry {
+    char *in;
+    char *out;
+    int olen;
+    struct stat s;
+    char *data;
+    unsigned datasize;
+    int loaded;
+};
+
+#define READ_AHEAD 256
+
+static struct entry *entries = NULL;
+static int entry_count = 0;
+static int entry_alloc = 0;
+
+static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_window = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t read_done = PTHREAD_COND_INITIALIZER;
+static int next_read = 0;
+static int next_emit = 0;
+
+static void add_entry(const char *in, const char *out, int olen, const struct stat *s)
+{
+    if (entry_count == entry_alloc) {
+        entry_alloc = entry_alloc ? entry_alloc * 2 : 256;
+        entries = realloc(entries, entry_alloc * sizeof(struct entry));
+        if (entries == NULL) die("cannot allocate %d entries", entry_alloc);
+    }
+    struct entry *e = &entries[entry_count++];
+    e->in = strdup(in);
+    e->out = strdup(out);
+    if (e->in == NULL || e->out == NULL) die("cannot allocate entry '%s'", in);
+    e->olen = olen;
+    e->s = *s;
+    e->data = NULL;
+    e->datasize = 0;
+    e->loaded = 0;
+}
+
+static void load_entry(struct entry *e)
+{
+    if(S_ISREG(e->s.st_mode)){
+        int fd;
+        off_t done = 0;
+
+        fd = open(e->in, O_RDONLY);
+        if(fd < 0) die("cannot open '%s' for read", e->in);
+
+        e->data = xmalloc(e->s.st_size);
+        while (done < e->s.st_size) {
+            ssize_t n = read(fd, e->data + done, e->s.st_size - done);
+            if (n <= 0) die("cannot read %d bytes", (int) e->s.st_size);
+            done += n;
+        }
+        e->datasize = e->s.st_size;
+
+        close(fd);
+    } else if(S_ISLNK(e->s.st_mode)) {
+        int size;
+        e->data = xmalloc(1024);
+        size = readlink(e->in, e->data, 1024);
+        if(size < 0) die("cannot read symlink '%s'", e->in);
+        e->datasize = size;
+    }
+}
+
+static void *reader_thread(void *arg __attribute__((unused)))
+{
+    pthread_mutex_lock(&read_lock);
+    while (next_read < entry_count) {
+        if (next_read >= next_emit + READ_AHEAD) {
+            pthread_cond_wait(&read_window, &read_lock);
+            continue;
+        }
+        struct entry *e = &entries[next_read++];
+        pthread_mutex_unlock(&read_lock);
+        load_entry(e);
+        pthread_mutex_lock(&read_lock);
+        e->loaded = 1;
+        pthread_cond_broadcast(&read_done);
+    }
+    pthread_mutex_unlock(&read_lock);
+    return NULL;
+}
+
+static void emit_entries(void)
+{
+    pthread_t *readers = NULL;
+    int nreaders = threads > 1 ? threads : 0;
+    int i;
+
+    if (nreaders) {
+        readers = xmalloc(nreaders * sizeof(pthread_t));
+        for (i = 0; i < nreaders; i++) {
+            if (pthread_create(&readers[i], NULL, reader_thread, NULL)) {
+                die("cannot create reader thread");
+            }
+        }
+    }
+
+    for (i = 0; i < entry_count; i++) {
+        struct entry *e = &entries[i];
+
+        if (nreaders) {
+            pthread_mutex_lock(&read_lock);
+            while (!e->loaded) {
+                pthread_cond_wait(&read_done, &read_lock);
+            }
+            next_emit = i + 1;
+            pthread_cond_broadcast(&read_window);
+            pthread_mutex_unlock(&read_lock);
+        } else {
+            load_entry(e);
+        }
+
+        _eject(&e->s, e->out, e->olen, e->data, e->datasize);
+
+        free(e->data);
+        free(e->in);
+        free(e->out);
+    }
+
+    for (i = 0; i < nreaders; i++) {
+        pthread_join(readers[i], NULL);
     }
+    free(readers);
+    free(entries);
+    entries = NULL;
+    entry_count = entry_alloc = 0;
+    next_read = next_emit = 0;
 }
 
 static void _archive(char *in, char *out, int ilen, int olen);
@@ -238,33 +409,11 @@ static void _archive(char *in, char *out, int ilen, int olen)
 
     if(lstat(in, &s)) die("could not stat '%s'\n", in);
 
-    if(S_ISREG(s.st_mode)){
-        char *tmp;
-        int fd;
-
-        fd = open(in, O_RDONLY);
-        if(fd < 0) die("cannot open '%s' for read", in);
-
-        tmp = (char*) malloc(s.st_size);
-        if(tmp == 0) die("cannot allocate %d bytes", s.st_size);
-
-        if(read(fd, tmp, s.st_size) != s.st_size) {
-            die("cannot read %d bytes", s.st_size);
-        }
-
-        _eject(&s, out, olen, tmp, s.st_size);
-
-        free(tmp);
-        close(fd);
+    if(S_ISREG(s.st_mode) || S_ISLNK(s.st_mode)){
+        add_entry(in, out, olen, &s);
     } else if(S_ISDIR(s.st_mode)) {
-        _eject(&s, out, olen, 0, 0);
+        add_entry(in, out, olen, &s);
         _archive_dir(in, out, ilen, olen);
-    } else if(S_ISLNK(s.st_mode)) {
-        char buf[1024];
-        int size;
-        size = readlink(in, buf, 1024);
-        if(size < 0) die("cannot read symlink '%s'", in);
-        _eject(&s, out, olen, buf, size);
     } else {
         die("Unknown '%s' (mode %d)?\n", in, s.st_mode);
     }
@@ -279,12 +428,22 @@ void archive(const char *start, const char *prefix)
     strcpy(out, prefix);
 
     _archive_dir(in, out, strlen(in), strlen(out));
+    emit_entries();
+}
+
+static int compare_canned(const void* a, const void* b) {
+    const struct fs_config_entry* x = *(const struct fs_config_entry* const*)a;
+    const struct fs_config_entry* y = *(const struct fs_config_entry* const*)b;
+    int ret = strcmp(x->name, y->name);
+    if (ret) return ret;
+    return x < y ? -1 : x > y;
 }
 
 static void read_canned_config(char* filename)
 {
     int allocated = 8;
     int used = 0;
+    int i;
 
     canned_config =
         (struct fs_config_entry*)malloc(allocated * sizeof(struct fs_config_entry));
@@ -322,28 +481,268 @@ static void read_canned_config(char* filename)
     canned_config[used].name = NULL;
 
     fclose(f);
+
+    canned_count = used;
+    canned_index = xmalloc(used * sizeof(struct fs_config_entry*));
+    for (i = 0; i < used; i++) {
+        canned_index[i] = &canned_config[i];
+        if (!canned_config[i].name[0]) {
+            canned_default = &canned_config[i];
+        }
+    }
+    qsort(canned_index, used, sizeof(struct fs_config_entry*), compare_canned);
+}
+
+/* With -z the archive is cut into GZ_BLOCK_SIZE blocks that are deflated on
+ * their own threads, each primed with the last 32K of the block before it,
+ * and written out in order as one gzip member: every block but the last
+ * ends with a sync flush, so the raw deflate streams join up.
+ */
+#define GZ_BLOCK_SIZE (128 * 1024)
+#define GZ_DICT_SIZE 32768
+
+struct gz_block {
+    unsigned char *in;
+    size_t in_len;
+    unsigned char dict[GZ_DICT_SIZE];
+    size_t dict_len;
+    unsigned char *out;
+    size_t out_len;
+    uLong crc;
+    int last;
+    int done;
+};
+
+static struct gz_block *gz_blocks = NULL;
+static int gz_slots = 0;
+static struct gz_block *gz_current = NULL;
+/* blocks handed out for filling, submitted, compressed, written */
+static unsigned gz_acquired = 0;
+static unsigned gz_submitted = 0;
+static unsigned gz_next_compress = 0;
+static unsigned gz_written = 0;
+static uLong gz_crc = 0;
+static uLong gz_size = 0;
+static int gz_stopping = 0;
+static pthread_t *gz_threads = NULL;
+static pthread_mutex_t gz_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gz_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gz_done = PTHREAD_COND_INITIALIZER;
+
+static void gz_compress(struct gz_block *b)
+{
+    z_stream zs;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        die("cannot initialize zlib");
+    }
+    if (b->dict_len && deflateSetDictionary(&zs, b->dict, b->dict_len) != Z_OK) {
+        die("cannot set deflate dictionary");
+    }
+    b->out = xmalloc(deflateBound(&zs, b->in_len) + 64);
+    zs.next_in = b->in;
+    zs.avail_in = b->in_len;
+    zs.next_out = b->out;
+    zs.avail_out = deflateBound(&zs, b->in_len) + 64;
+    if (deflate(&zs, b->last ? Z_FINISH : Z_SYNC_FLUSH) !=
+            (b->last ? Z_STREAM_END : Z_OK) || zs.avail_in != 0) {
+        die("deflate failed");
+    }
+    b->out_len = zs.next_out - b->out;
+    b->crc = crc32(0, b->in, b->in_len);
+    deflateEnd(&zs);
 }
 
+static void *gz_thread(void *arg __attribute__((unused)))
+{
+    pthread_mutex_lock(&gz_lock);
+    while (1) {
+        if (gz_next_compress == gz_submitted) {
+            if (gz_stopping) break;
+            pthread_cond_wait(&gz_work, &gz_lock);
+            continue;
+        }
+        struct gz_block *b = &gz_blocks[gz_next_compress++ % gz_slots];
+        pthread_mutex_unlock(&gz_lock);
+        gz_compress(b);
+        pthread_mutex_lock(&gz_lock);
+        b->done = 1;
+        pthread_cond_broadcast(&gz_done);
+    }
+    pthread_mutex_unlock(&gz_lock);
+    return NULL;
+}
+
+/* Writes out the oldest submitted block, waiting for it if need be. */
+static void gz_write_block(void)
+{
+    struct gz_block *b = &gz_blocks[gz_written % gz_slots];
+
+    pthread_mutex_lock(&gz_lock);
+    while (!b->done) {
+        pthread_cond_wait(&gz_done, &gz_lock);
+    }
+    pthread_mutex_unlock(&gz_lock);
+
+    if (fwrite(b->out, 1, b->out_len, stdout) != b->out_len) die("write failed");
+    gz_crc = crc32_combine(gz_crc, b->crc, b->in_len);
+    gz_size += b->in_len;
+    free(b->out);
+    b->out = NULL;
+    gz_written++;
+}
+
+static void gz_submit(int last)
+{
+    struct gz_block *b = gz_current;
+
+    b->last = last;
+    b->done = 0;
+    gz_current = NULL;
+    if (gz_threads == NULL) {
+        gz_compress(b);
+        b->done = 1;
+        gz_submitted++;
+        gz_write_block();
+        return;
+    }
+    pthread_mutex_lock(&gz_lock);
+    gz_submitted++;
+    pthread_cond_signal(&gz_work);
+    pthread_mutex_unlock(&gz_lock);
+}
+
+static void gz_acquire(void)
+{
+    struct gz_block *prev = gz_acquired ? &gz_blocks[(gz_acquired - 1) % gz_slots] : NULL;
+
+    while (gz_acquired - gz_written >= (unsigned) gz_slots) {
+        gz_write_block();
+    }
+    /* With a single slot, prev is the block being set up, so take the
+     * dictionary before clearing it. */
+    gz_current = &gz_blocks[gz_acquired++ % gz_slots];
+    gz_current->dict_len = 0;
+    if (prev) {
+        gz_current->dict_len = GZ_DICT_SIZE;
+        memcpy(gz_current->dict, prev->in + prev->in_len - GZ_DICT_SIZE, GZ_DICT_SIZE);
+    }
+    gz_current->in_len = 0;
+}
+
+static void gz_start(void)
+{
+    static const unsigned char header[10] = {
+        0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 3 /* OS_CODE unix */
+    };
+    int i;
+
+    gz_slots = threads > 1 ? threads * 2 : 1;
+    gz_blocks = xmalloc(gz_slots * sizeof(struct gz_block));
+    for (i = 0; i < gz_slots; i++) {
+        gz_blocks[i].in = xmalloc(GZ_BLOCK_SIZE);
+        gz_blocks[i].out = NULL;
+    }
+    gz_crc = crc32(0, NULL, 0);
+    if (threads > 1) {
+        gz_threads = xmalloc(threads * sizeof(pthread_t));
+        for (i = 0; i < threads; i++) {
+            if (pthread_create(&gz_threads[i], NULL, gz_thread, NULL)) {
+                die("cannot create compression thread");
+            }
+        }
+    }
+    if (fwrite(header, 1, sizeof(header), stdout) != sizeof(header)) die("write failed");
+}
+
+static void gz_finish(void)
+{
+    unsigned char trailer[8];
+    int i;
+
+    if (gz_current == NULL) gz_acquire();
+    gz_submit(1);
+    while (gz_written != gz_submitted) {
+        gz_write_block();
+    }
+    if (gz_threads) {
+        pthread_mutex_lock(&gz_lock);
+        gz_stopping = 1;
+        pthread_cond_broadcast(&gz_work);
+        pthread_mutex_unlock(&gz_lock);
+        for (i = 0; i < threads; i++) {
+            pthread_join(gz_threads[i], NULL);
+        }
+        free(gz_threads);
+    }
+    for (i = 0; i < 4; i++) {
+        trailer[i] = gz_crc >> (8 * i);
+        trailer[4 + i] = gz_size >> (8 * i);
+    }
+    if (fwrite(trailer, 1, sizeof(trailer), stdout) != sizeof(trailer)) die("write failed");
+    for (i = 0; i < gz_slots; i++) {
+        free(gz_blocks[i].in);
+    }
+    free(gz_blocks);
+}
+
+static void out_write(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    if (!gzip_output) {
+        if (fwrite(data, 1, len, stdout) != len) die("write failed");
+        return;
+    }
+    while (len > 0) {
+        if (gz_current == NULL) gz_acquire();
+        size_t n = GZ_BLOCK_SIZE - gz_current->in_len;
+        if (n > len) n = len;
+        memcpy(gz_current->in + gz_current->in_len, p, n);
+        gz_current->in_len += n;
+        p += n;
+        len -= n;
+        if (gz_current->in_len == GZ_BLOCK_SIZE) gz_submit(0);
+    }
+}
 
 int main(int argc, char *argv[])
 {
     argc--;
     argv++;
 
-    if (argc > 1 && strcmp(argv[0], "-d") == 0) {
-        target_out_path = argv[1];
-        argc -= 2;
-        argv += 2;
-    }
-
-    if (argc > 1 && strcmp(argv[0], "-f") == 0) {
-        read_canned_config(argv[1]);
-        argc -= 2;
-        argv += 2;
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+
+    while (argc > 0 && argv[0][0] == '-') {
+        if (argc > 1 && strcmp(argv[0], "-d") == 0) {
+            target_out_path = argv[1];
+            argc -= 2;
+            argv += 2;
+        } else if (argc > 1 && strcmp(argv[0], "-f") == 0) {
+            read_canned_config(argv[1]);
+            argc -= 2;
+            argv += 2;
+        } else if (argc > 1 && strcmp(argv[0], "-j") == 0) {
+            threads = atoi(argv[1]);
+            if (threads < 1) die("bad thread count '%s'", argv[1]);
+            argc -= 2;
+            argv += 2;
+        } else if (strcmp(argv[0], "-z") == 0) {
+            gzip_output = 1;
+            argc--;
+            argv++;
+        } else {
+            die("unknown option '%s'", argv[0]);
+        }
     }
 
     if(argc == 0) die("no directories to process?!");
 
+    if (gzip_output) gz_start();
+
     while(argc-- > 0){
         char *x = strchr(*argv, '=');
         if(x != 0) {
@@ -359,5 +758,7 @@ int main(int argc, char *argv[])
 
     _eject_trailer();
 
+    if (gzip_output) gz_finish();
+
     return 0;
 }
@@ -79,6 +79,7 @@ debuggerd_test_src_files := \
     utility.cpp \
     test/dump_maps_test.cpp \
     test/dump_memory_test.cpp \
+    test/dump_threads_test.cpp \
     test/elf_fake.cpp \
     test/log_fake.cpp \
     test/property_fake.cpp \
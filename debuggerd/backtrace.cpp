@@ -23,15 +23,17 @@
 #include <time.h>
 #include <errno.h>
 #include <limits.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/ptrace.h>
 
 #include <memory>
+#include <vector>
 
 #include <backtrace/Backtrace.h>
+#include <backtrace/BacktraceMap.h>
 
+#include <cutils/atomic.h>
 #include <log/log.h>
 
 #include "backtrace.h"
@@ -67,7 +69,7 @@ static void dump_process_footer(log_t* log, pid_t pid) {
   _LOG(log, logtype::BACKTRACE, "\n----- end %d -----\n", pid);
 }
 
-static void dump_thread(log_t* log, pid_t pid, pid_t tid, bool attached,
+static void dump_thread(log_t* log, pid_t pid, pid_t tid, BacktraceMap* map, bool attached,
                         bool* detach_failed, int* total_sleep_time_usec) {
   char path[PATH_MAX];
   char threadnamebuf[1024];
@@ -97,7 +99,7 @@ static void dump_thread(log_t* log, pid_t pid, pid_t tid, bool attached,
     return;
   }
 
-  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(tid, BACKTRACE_CURRENT_THREAD));
+  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, tid, map));
   if (backtrace->Unwind(0)) {
     dump_backtrace_to_log(backtrace.get(), log, "  ");
   } else {
@@ -110,6 +112,27 @@ static void dump_thread(log_t* log, pid_t pid, pid_t tid, bool attached,
   }
 }
 
+struct sibling_dump {
+  pid_t pid;
+  BacktraceMap* map;
+  int total_sleep_time_usec;
+  volatile int32_t sleep_time_usec;
+  volatile int32_t detach_failed;
+};
+
+static void dump_sibling_thread(log_t* log, pid_t tid, void* cookie) {
+  sibling_dump* dump = reinterpret_cast<sibling_dump*>(cookie);
+  int total_sleep_time_usec = dump->total_sleep_time_usec;
+  bool detach_failed = false;
+
+  dump_thread(log, dump->pid, tid, dump->map, false, &detach_failed, &total_sleep_time_usec);
+
+  android_atomic_add(total_sleep_time_usec - dump->total_sleep_time_usec, &dump->sleep_time_usec);
+  if (detach_failed) {
+    android_atomic_release_store(1, &dump->detach_failed);
+  }
+}
+
 void dump_backtrace(int fd, int amfd, pid_t pid, pid_t tid, bool* detach_failed,
                     int* total_sleep_time_usec) {
   log_t log;
@@ -117,27 +140,26 @@ void dump_backtrace(int fd, int amfd, pid_t pid, pid_t tid, bool* detach_failed,
   log.amfd = amfd;
 
   dump_process_header(&log, pid);
-  dump_thread(&log, pid, tid, true, detach_failed, total_sleep_time_usec);
-
-  char task_path[64];
-  snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
-  DIR* d = opendir(task_path);
-  if (d != NULL) {
-    struct dirent* de = NULL;
-    while ((de = readdir(d)) != NULL) {
-      if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
-        continue;
-      }
-
-      char* end;
-      pid_t new_tid = strtoul(de->d_name, &end, 10);
-      if (*end || new_tid == tid) {
-        continue;
-      }
 
-      dump_thread(&log, pid, new_tid, false, detach_failed, total_sleep_time_usec);
+  // All the threads share the maps, so parse them once.
+  std::unique_ptr<BacktraceMap> map(BacktraceMap::Create(pid));
+  dump_thread(&log, pid, tid, map.get(), true, detach_failed, total_sleep_time_usec);
+
+  std::vector<pid_t> tids;
+  if (get_sibling_tids(pid, tid, &tids)) {
+    // The threads are unwound concurrently, and reported in tid order.
+    sibling_dump dump;
+    dump.pid = pid;
+    dump.map = map.get();
+    dump.total_sleep_time_usec = *total_sleep_time_usec;
+    dump.sleep_time_usec = 0;
+    dump.detach_failed = 0;
+    dump_threads_in_parallel(&log, tids, dump_sibling_thread, &dump);
+
+    *total_sleep_time_usec += dump.sleep_time_usec;
+    if (dump.detach_failed) {
+      *detach_failed = true;
     }
-    closedir(d);
   }
 
   dump_process_footer(&log, pid);
@@ -38,6 +38,8 @@
 #include <cutils/properties.h>
 #include <cutils/debugger.h>
 
+#include <backtrace/Backtrace.h>
+
 #include <linux/input.h>
 
 #include <private/android_filesystem_config.h>
@@ -55,6 +57,9 @@
 #define SOCKET_NAME DEBUGGER_SOCKET_NAME
 #endif
 
+// Function names kept between requests, a few hundred bytes each.
+#define FUNCTION_NAME_CACHE_SIZE 4096
+
 struct debugger_request_t {
   debugger_action_t action;
   pid_t pid, tid;
@@ -429,9 +434,11 @@ static void handle_request(int fd) {
             case SIGSTOP:
               if (request.action == DEBUGGER_ACTION_DUMP_TOMBSTONE) {
                 ALOGV("stopped -- dumping to tombstone\n");
+                // The requester reads the tombstone as soon as it gets the
+                // path, so it must be complete by then.
                 tombstone_path = engrave_tombstone(request.pid, request.tid,
                                                    signal, request.original_si_code,
-                                                   request.abort_msg_address, true,
+                                                   request.abort_msg_address, true, false,
                                                    &detach_failed, &total_sleep_time_usec);
               } else if (request.action == DEBUGGER_ACTION_DUMP_BACKTRACE) {
                 ALOGV("stopped -- dumping to fd\n");
@@ -467,7 +474,7 @@ static void handle_request(int fd) {
               // makes the process less reliable, apparently...
               tombstone_path = engrave_tombstone(request.pid, request.tid,
                                                  signal, request.original_si_code,
-                                                 request.abort_msg_address, !attach_gdb,
+                                                 request.abort_msg_address, !attach_gdb, true,
                                                  &detach_failed, &total_sleep_time_usec);
               break;
 
@@ -559,6 +566,9 @@ static int do_server() {
     return 1;
   fcntl(s, F_SETFD, FD_CLOEXEC);
 
+  // Crash loops dump the same libraries over and over.
+  Backtrace::SetFunctionNameCacheSize(FUNCTION_NAME_CACHE_SIZE);
+
   ALOGI("debuggerd: starting\n");
 
   for (;;) {
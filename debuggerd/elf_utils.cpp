@@ -20,10 +20,15 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include <list>
+#include <map>
 #include <string>
+#include <tuple>
 
 #include <backtrace/Backtrace.h>
+#include <backtrace/BacktraceMap.h>
 #include <base/stringprintf.h>
 #include <log/log.h>
 
@@ -95,7 +100,7 @@ static bool get_build_id(
   return false;
 }
 
-bool elf_get_build_id(Backtrace* backtrace, uintptr_t addr, std::string* build_id) {
+static bool read_build_id(Backtrace* backtrace, uintptr_t addr, std::string* build_id) {
   // Read and verify the elf magic number first.
   uint8_t e_ident[EI_NIDENT];
   if (backtrace->Read(addr, e_ident, SELFMAG) != SELFMAG) {
@@ -119,3 +124,70 @@ bool elf_get_build_id(Backtrace* backtrace, uintptr_t addr, std::string* build_i
 
   return false;
 }
+
+// debuggerd keeps running between crashes, and a crash loop dumps the same
+// libraries again and again, so remember the build ids, or their absence, of
+// the last BUILD_ID_CACHE_SIZE mappings, keyed by the identity of the file
+// and the offset it is mapped at.
+struct build_id_key {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  uintptr_t offset;
+
+  bool operator<(const build_id_key& other) const {
+    return std::tie(dev, ino, size, mtime, offset) <
+        std::tie(other.dev, other.ino, other.size, other.mtime, other.offset);
+  }
+};
+
+struct build_id_entry {
+  build_id_key key;
+  bool found;
+  std::string build_id;
+};
+
+static const size_t BUILD_ID_CACHE_SIZE = 512;
+
+// Most recently used first.
+static std::list<build_id_entry> g_build_ids;
+static std::map<build_id_key, std::list<build_id_entry>::iterator> g_build_id_index;
+
+bool elf_get_build_id(Backtrace* backtrace, const backtrace_map_t& map, std::string* build_id) {
+  struct stat st;
+  if (map.name.empty() || map.name[0] != '/' || stat(map.name.c_str(), &st) != 0) {
+    return read_build_id(backtrace, map.start, build_id);
+  }
+
+  build_id_key key;
+  key.dev = st.st_dev;
+  key.ino = st.st_ino;
+  key.size = st.st_size;
+  key.mtime = st.st_mtime;
+  key.offset = map.offset;
+
+  auto it = g_build_id_index.find(key);
+  if (it != g_build_id_index.end()) {
+    g_build_ids.splice(g_build_ids.begin(), g_build_ids, it->second);
+    if (it->second->found) {
+      *build_id = it->second->build_id;
+    }
+    return it->second->found;
+  }
+
+  build_id_entry entry;
+  entry.key = key;
+  entry.found = read_build_id(backtrace, map.start, &entry.build_id);
+  g_build_ids.push_front(entry);
+  g_build_id_index[key] = g_build_ids.begin();
+  if (g_build_ids.size() > BUILD_ID_CACHE_SIZE) {
+    g_build_id_index.erase(g_build_ids.back().key);
+    g_build_ids.pop_back();
+  }
+
+  if (entry.found) {
+    *build_id = entry.build_id;
+  }
+  return entry.found;
+}
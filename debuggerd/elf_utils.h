@@ -21,7 +21,9 @@
 #include <string>
 
 class Backtrace;
+struct backtrace_map_t;
 
-bool elf_get_build_id(Backtrace*, uintptr_t, std::string*);
+// Reads the build id of the ELF file mapped by map, caching it by file.
+bool elf_get_build_id(Backtrace*, const backtrace_map_t&, std::string*);
 
 #endif // _DEBUGGERD_ELF_UTILS_H
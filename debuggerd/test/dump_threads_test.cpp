@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <base/file.h>
+#include <base/stringprintf.h>
+
+#include "log_fake.h"
+#include "utility.h"
+
+static void dump_fake_thread(log_t* log, pid_t tid, void*) {
+  // Finish out of order.
+  usleep((tid % 4) * 1000);
+  _LOG(log, logtype::THREAD, "tid %d, current_tid %d\n", tid, log->current_tid);
+  if (tid == 7) {
+    log->should_retrieve_logcat = false;
+  }
+}
+
+TEST(DumpThreadsTest, output_in_tid_order) {
+  FILE* tombstone = tmpfile();
+  ASSERT_TRUE(tombstone != nullptr);
+
+  log_t log;
+  log.tfd = fileno(tombstone);
+  log.crashed_tid = 1;
+  log.current_tid = 1;
+  resetLogs();
+
+  std::vector<pid_t> tids;
+  std::string expected;
+  for (pid_t tid = 2; tid < 20; tid++) {
+    tids.push_back(tid);
+    expected += android::base::StringPrintf("tid %d, current_tid %d\n", tid, tid);
+  }
+  dump_threads_in_parallel(&log, tids, dump_fake_thread, nullptr);
+
+  std::string tombstone_contents;
+  ASSERT_TRUE(lseek(log.tfd, 0, SEEK_SET) == 0);
+  ASSERT_TRUE(android::base::ReadFdToString(log.tfd, &tombstone_contents));
+  ASSERT_EQ(expected, tombstone_contents);
+  ASSERT_FALSE(log.should_retrieve_logcat);
+  ASSERT_EQ(1, log.current_tid);
+
+  // Only the crashing thread goes to logcat.
+  ASSERT_STREQ("", getFakeLogBuf().c_str());
+
+  fclose(tombstone);
+}
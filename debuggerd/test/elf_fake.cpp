@@ -19,6 +19,7 @@
 #include <string>
 
 class Backtrace;
+struct backtrace_map_t;
 
 std::string g_build_id;
 
@@ -26,7 +27,7 @@ void elf_set_fake_build_id(const std::string& build_id) {
   g_build_id = build_id;
 }
 
-bool elf_get_build_id(Backtrace*, uintptr_t, std::string* build_id) {
+bool elf_get_build_id(Backtrace*, const backtrace_map_t&, std::string* build_id) {
   if (g_build_id != "") {
     *build_id = g_build_id;
     return true;
@@ -17,10 +17,10 @@
 #define LOG_TAG "DEBUG"
 
 #include <arpa/inet.h>
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -34,10 +34,13 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <private/android_filesystem_config.h>
 
+#include <base/file.h>
 #include <base/stringprintf.h>
+#include <cutils/atomic.h>
 #include <cutils/properties.h>
 #include <log/log.h>
 #include <log/logger.h>
@@ -389,7 +392,7 @@ static void dump_all_maps(Backtrace* backtrace, BacktraceMap* map, log_t* log, p
       space_needed = false;
       line += "  " + it->name;
       std::string build_id;
-      if ((it->flags & PROT_READ) && elf_get_build_id(backtrace, it->start, &build_id)) {
+      if ((it->flags & PROT_READ) && elf_get_build_id(backtrace, *it, &build_id)) {
         line += " (BuildId: " + build_id + ")";
       }
     }
@@ -417,67 +420,73 @@ static void dump_backtrace_and_stack(Backtrace* backtrace, log_t* log) {
   }
 }
 
-// Return true if some thread is not detached cleanly
-static bool dump_sibling_thread_report(
-    log_t* log, pid_t pid, pid_t tid, int* total_sleep_time_usec, BacktraceMap* map) {
-  char task_path[64];
-
-  snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
-
-  DIR* d = opendir(task_path);
-  // Bail early if the task directory cannot be opened
-  if (d == NULL) {
-    ALOGE("Cannot open /proc/%d/task\n", pid);
-    return false;
+struct sibling_dump {
+  pid_t pid;
+  BacktraceMap* map;
+  int total_sleep_time_usec;
+  volatile int32_t sleep_time_usec;
+  volatile int32_t detach_failed;
+};
+
+static void dump_sibling_thread(log_t* log, pid_t tid, void* cookie) {
+  sibling_dump* dump = reinterpret_cast<sibling_dump*>(cookie);
+  pid_t pid = dump->pid;
+
+  // Skip this thread if cannot ptrace it
+  if (!ptrace_attach_thread(pid, tid)) {
+    _LOG(log, logtype::ERROR, "ptrace attach to %d failed: %s\n", tid, strerror(errno));
+    return;
   }
 
+  int total_sleep_time_usec = dump->total_sleep_time_usec;
   bool detach_failed = false;
-  struct dirent* de;
-  while ((de = readdir(d)) != NULL) {
-    // Ignore "." and ".."
-    if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) {
-      continue;
-    }
-
-    // The main thread at fault has been handled individually
-    char* end;
-    pid_t new_tid = strtoul(de->d_name, &end, 10);
-    if (*end || new_tid == tid) {
-      continue;
-    }
-
-    // Skip this thread if cannot ptrace it
-    if (!ptrace_attach_thread(pid, new_tid)) {
-      _LOG(log, logtype::ERROR, "ptrace attach to %d failed: %s\n", new_tid, strerror(errno));
-      continue;
-    }
-
-    if (wait_for_sigstop(new_tid, total_sleep_time_usec, &detach_failed) == -1) {
-      continue;
+  int stopped = wait_for_sigstop(tid, &total_sleep_time_usec, &detach_failed);
+  android_atomic_add(total_sleep_time_usec - dump->total_sleep_time_usec, &dump->sleep_time_usec);
+  if (stopped == -1) {
+    if (detach_failed) {
+      android_atomic_release_store(1, &dump->detach_failed);
     }
+    return;
+  }
 
-    log->current_tid = new_tid;
-    _LOG(log, logtype::THREAD, "--- --- --- --- --- --- --- --- --- --- --- --- --- --- --- ---\n");
-    dump_thread_info(log, pid, new_tid);
+  _LOG(log, logtype::THREAD, "--- --- --- --- --- --- --- --- --- --- --- --- --- --- --- ---\n");
+  dump_thread_info(log, pid, tid);
 
-    dump_registers(log, new_tid);
-    std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, new_tid, map));
-    if (backtrace->Unwind(0)) {
-      dump_backtrace_and_stack(backtrace.get(), log);
-    } else {
-      ALOGE("Unwind of sibling failed: pid = %d, tid = %d", pid, new_tid);
-    }
+  dump_registers(log, tid);
+  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(pid, tid, dump->map));
+  if (backtrace->Unwind(0)) {
+    dump_backtrace_and_stack(backtrace.get(), log);
+  } else {
+    ALOGE("Unwind of sibling failed: pid = %d, tid = %d", pid, tid);
+  }
 
-    log->current_tid = log->crashed_tid;
+  if (ptrace(PTRACE_DETACH, tid, 0, 0) != 0) {
+    _LOG(log, logtype::ERROR, "ptrace detach from %d failed: %s\n", tid, strerror(errno));
+    android_atomic_release_store(1, &dump->detach_failed);
+  }
+}
 
-    if (ptrace(PTRACE_DETACH, new_tid, 0, 0) != 0) {
-      _LOG(log, logtype::ERROR, "ptrace detach from %d failed: %s\n", new_tid, strerror(errno));
-      detach_failed = true;
-    }
+// Return true if some thread is not detached cleanly
+static bool dump_sibling_thread_report(
+    log_t* log, pid_t pid, pid_t tid, int* total_sleep_time_usec, BacktraceMap* map) {
+  std::vector<pid_t> tids;
+  // Bail early if the task directory cannot be opened
+  if (!get_sibling_tids(pid, tid, &tids)) {
+    ALOGE("Cannot open /proc/%d/task\n", pid);
+    return false;
   }
 
-  closedir(d);
-  return detach_failed;
+  // The threads are unwound concurrently, and reported in tid order.
+  sibling_dump dump;
+  dump.pid = pid;
+  dump.map = map;
+  dump.total_sleep_time_usec = *total_sleep_time_usec;
+  dump.sleep_time_usec = 0;
+  dump.detach_failed = 0;
+  dump_threads_in_parallel(log, tids, dump_sibling_thread, &dump);
+
+  *total_sleep_time_usec += dump.sleep_time_usec;
+  return dump.detach_failed;
 }
 
 // Reads the contents of the specified log device, filters out the entries
@@ -634,10 +643,25 @@ static void dump_abort_message(Backtrace* backtrace, log_t* log, uintptr_t addre
   _LOG(log, logtype::HEADER, "Abort message: '%s'\n", msg);
 }
 
-// Dumps all information about the specified pid to the tombstone.
+// A tombstone rendered in memory while the process was stopped, to be
+// completed with the logs and written out once it has been released.
+struct tombstone_job {
+  int fd;
+  char* path;
+  pid_t pid;
+  bool should_retrieve_logcat;
+  bool want_logs;
+  std::string text;
+  // Where in text the recent and the full logs go.
+  size_t recent_logs_offset;
+  size_t all_logs_offset;
+};
+
+// Dumps all information about the specified pid to the tombstone. If job is
+// not null, the output is in job->text and the logs are left for later.
 static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, int si_code,
                        uintptr_t abort_msg_address, bool dump_sibling_threads,
-                       int* total_sleep_time_usec) {
+                       int* total_sleep_time_usec, tombstone_job* job) {
   // don't copy log messages to tombstone unless this is a dev device
   char value[PROPERTY_VALUE_MAX];
   property_get("ro.debuggable", value, "0");
@@ -676,7 +700,10 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, int si_code
     dump_all_maps(backtrace.get(), map.get(), log, tid);
   }
 
-  if (want_logs) {
+  if (job) {
+    job->want_logs = want_logs;
+    job->recent_logs_offset = job->text.size();
+  } else if (want_logs) {
     dump_logs(log, pid, 5);
   }
 
@@ -685,7 +712,9 @@ static bool dump_crash(log_t* log, pid_t pid, pid_t tid, int signal, int si_code
     detach_failed = dump_sibling_thread_report(log, pid, tid, total_sleep_time_usec, map.get());
   }
 
-  if (want_logs) {
+  if (job) {
+    job->all_logs_offset = job->text.size();
+  } else if (want_logs) {
     dump_logs(log, pid, 0);
   }
 
@@ -780,9 +809,41 @@ static int activity_manager_connect() {
   return amfd;
 }
 
+static void* finish_tombstone(void* arg) {
+  tombstone_job* job = reinterpret_cast<tombstone_job*>(arg);
+
+  std::string recent_logs;
+  std::string all_logs;
+  if (job->want_logs) {
+    log_t log;
+    log.should_retrieve_logcat = job->should_retrieve_logcat;
+    log.output = &recent_logs;
+    dump_logs(&log, job->pid, 5);
+    log.output = &all_logs;
+    dump_logs(&log, job->pid, 0);
+  }
+
+  const std::string& text = job->text;
+  size_t recent = job->recent_logs_offset;
+  size_t all = job->all_logs_offset;
+  if (!android::base::WriteFully(job->fd, text.data(), recent) ||
+      !android::base::WriteFully(job->fd, recent_logs.data(), recent_logs.size()) ||
+      !android::base::WriteFully(job->fd, text.data() + recent, all - recent) ||
+      !android::base::WriteFully(job->fd, all_logs.data(), all_logs.size()) ||
+      !android::base::WriteFully(job->fd, text.data() + all, text.size() - all)) {
+    ALOGE("failed to write tombstone '%s': %s\n", job->path, strerror(errno));
+  }
+
+  close(job->fd);
+  free(job->path);
+  delete job;
+  return NULL;
+}
+
 char* engrave_tombstone(pid_t pid, pid_t tid, int signal, int original_si_code,
                         uintptr_t abort_msg_address, bool dump_sibling_threads,
-                        bool* detach_failed, int* total_sleep_time_usec) {
+                        bool background_write, bool* detach_failed,
+                        int* total_sleep_time_usec) {
 
   log_t log;
   log.current_tid = tid;
@@ -797,19 +858,44 @@ char* engrave_tombstone(pid_t pid, pid_t tid, int signal, int original_si_code,
     return NULL;
   }
 
+  // The process stays stopped until this returns. In the background mode,
+  // only what needs the process is done now: the tombstone is rendered in
+  // memory, and the logs are read and the file written on another thread.
+  tombstone_job* job = NULL;
+  if (background_write) {
+    job = new tombstone_job;
+    job->fd = fd;
+    job->path = strdup(path);
+    job->pid = pid;
+    log.output = &job->text;
+  }
+
   log.tfd = fd;
   // Preserve amfd since it can be modified through the calls below without
   // being closed.
   int amfd = activity_manager_connect();
   log.amfd = amfd;
   *detach_failed = dump_crash(&log, pid, tid, signal, original_si_code, abort_msg_address,
-                              dump_sibling_threads, total_sleep_time_usec);
+                              dump_sibling_threads, total_sleep_time_usec, job);
 
   _LOG(&log, logtype::BACKTRACE, "\nTombstone written to: %s\n", path);
 
   // Either of these file descriptors can be -1, any error is ignored.
   close(amfd);
-  close(fd);
+
+  if (job) {
+    job->should_retrieve_logcat = log.should_retrieve_logcat;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, finish_tombstone, job) != 0) {
+      finish_tombstone(job);
+    }
+    pthread_attr_destroy(&attr);
+  } else {
+    close(fd);
+  }
 
   return path;
 }
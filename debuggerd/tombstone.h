@@ -22,10 +22,12 @@
 #include <sys/types.h>
 
 /* Creates a tombstone file and writes the crash dump to it.
+ * If background_write is true, the file is completed on another thread after
+ * this returns, so that the process can be released sooner.
  * Returns the path of the tombstone, which must be freed using free(). */
 char* engrave_tombstone(pid_t pid, pid_t tid, int signal, int original_si_code,
                         uintptr_t abort_msg_address,
-                        bool dump_sibling_threads, bool* detach_failed,
-                        int* total_sleep_time_usec);
+                        bool dump_sibling_threads, bool background_write,
+                        bool* detach_failed, int* total_sleep_time_usec);
 
 #endif // _DEBUGGERD_TOMBSTONE_H
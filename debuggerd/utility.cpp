@@ -18,7 +18,9 @@
 
 #include "utility.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,13 +28,17 @@
 #include <sys/ptrace.h>
 #include <sys/wait.h>
 
+#include <algorithm>
+
 #include <backtrace/Backtrace.h>
 #include <base/file.h>
 #include <base/stringprintf.h>
+#include <cutils/atomic.h>
 #include <log/log.h>
 
 const int SLEEP_TIME_USEC = 50000;         // 0.05 seconds
 const int MAX_TOTAL_SLEEP_USEC = 10000000; // 10 seconds
+const size_t MAX_DUMP_THREADS = 4;
 
 // Whitelist output desired in the logcat output.
 bool is_allowed_in_logcat(enum logtype ltype) {
@@ -64,7 +70,9 @@ void _LOG(log_t* log, enum logtype ltype, const char* fmt, ...) {
     return;
   }
 
-  if (write_to_tombstone) {
+  if (log->output) {
+    log->output->append(buf, len);
+  } else if (write_to_tombstone) {
     TEMP_FAILURE_RETRY(write(log->tfd, buf, len));
   }
 
@@ -236,3 +244,92 @@ bool ptrace_attach_thread(pid_t pid, pid_t tid) {
 
   return true;
 }
+
+bool get_sibling_tids(pid_t pid, pid_t tid, std::vector<pid_t>* tids) {
+  char task_path[64];
+  snprintf(task_path, sizeof(task_path), "/proc/%d/task", pid);
+
+  DIR* d = opendir(task_path);
+  if (d == NULL) {
+    return false;
+  }
+
+  struct dirent* de;
+  while ((de = readdir(d)) != NULL) {
+    char* end;
+    pid_t new_tid = strtoul(de->d_name, &end, 10);
+    if (de->d_name[0] == '.' || *end || new_tid == tid) {
+      continue;
+    }
+    tids->push_back(new_tid);
+  }
+  closedir(d);
+
+  std::sort(tids->begin(), tids->end());
+  return true;
+}
+
+struct parallel_dump {
+  const std::vector<pid_t>* tids;
+  std::vector<log_t>* logs;
+  dump_thread_fn fn;
+  void* cookie;
+  volatile int32_t next;
+};
+
+static void* parallel_dump_worker(void* arg) {
+  parallel_dump* dump = reinterpret_cast<parallel_dump*>(arg);
+  for (;;) {
+    size_t i = android_atomic_inc(&dump->next);
+    if (i >= dump->tids->size()) {
+      return NULL;
+    }
+    dump->fn(&(*dump->logs)[i], (*dump->tids)[i], dump->cookie);
+  }
+}
+
+void dump_threads_in_parallel(log_t* log, const std::vector<pid_t>& tids,
+                              dump_thread_fn fn, void* cookie) {
+  std::vector<std::string> outputs(tids.size());
+  std::vector<log_t> logs(tids.size(), *log);
+  for (size_t i = 0; i < tids.size(); i++) {
+    logs[i].current_tid = tids[i];
+    logs[i].output = &outputs[i];
+  }
+
+  parallel_dump dump;
+  dump.tids = &tids;
+  dump.logs = &logs;
+  dump.fn = fn;
+  dump.cookie = cookie;
+  dump.next = 0;
+
+  // This thread works too, so start one fewer.
+  size_t thread_count = std::min(MAX_DUMP_THREADS, tids.size());
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0 && thread_count > static_cast<size_t>(cpus)) {
+    thread_count = cpus;
+  }
+  std::vector<pthread_t> threads;
+  for (size_t i = 1; i < thread_count; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, parallel_dump_worker, &dump) == 0) {
+      threads.push_back(thread);
+    }
+  }
+  parallel_dump_worker(&dump);
+  for (size_t i = 0; i < threads.size(); i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (size_t i = 0; i < tids.size(); i++) {
+    if (log->output) {
+      log->output->append(outputs[i]);
+    } else if (log->tfd != -1) {
+      android::base::WriteFully(log->tfd, outputs[i].data(), outputs[i].size());
+    }
+    if (!logs[i].should_retrieve_logcat) {
+      log->should_retrieve_logcat = false;
+    }
+  }
+}
@@ -21,6 +21,9 @@
 #include <stdbool.h>
 #include <sys/types.h>
 
+#include <string>
+#include <vector>
+
 #include <backtrace/Backtrace.h>
 
 // Figure out the abi based on defined macros.
@@ -52,9 +55,12 @@ struct log_t{
     pid_t current_tid;
     // logd daemon crash, can block asking for logcat data, allow suppression.
     bool should_retrieve_logcat;
+    // If set, what would be written to tfd is appended here instead.
+    std::string* output;
 
     log_t()
-        : tfd(-1), amfd(-1), crashed_tid(-1), current_tid(-1), should_retrieve_logcat(true) {}
+        : tfd(-1), amfd(-1), crashed_tid(-1), current_tid(-1), should_retrieve_logcat(true),
+          output(nullptr) {}
 };
 
 // List of types of logs to simplify the logging decision in _LOG
@@ -84,4 +90,16 @@ bool pid_contains_tid(pid_t pid, pid_t tid);
 // Attach to a thread, and verify that it's still a member of the given process
 bool ptrace_attach_thread(pid_t pid, pid_t tid);
 
+// Get the threads of pid other than tid, in ascending order.
+bool get_sibling_tids(pid_t pid, pid_t tid, std::vector<pid_t>* tids);
+
+// Call fn for each of tids, on several threads at once.  Each call gets its
+// own copy of log, with current_tid set and the output kept in memory; the
+// outputs are written to log in the order of tids once all calls are done.
+// Only the thread that attached to a tid can trace it, so fn must attach
+// and detach itself.
+typedef void (*dump_thread_fn)(log_t* log, pid_t tid, void* cookie);
+void dump_threads_in_parallel(log_t* log, const std::vector<pid_t>& tids,
+                              dump_thread_fn fn, void* cookie);
+
 #endif // _DEBUGGERD_UTILITY_H
@@ -31,6 +31,7 @@ LOCAL_CFLAGS += -DFASTBOOT_REVISION='"$(fastboot_version)"'
 
 ifeq ($(HOST_OS),linux)
   LOCAL_SRC_FILES += usb_linux.c util_linux.c
+  LOCAL_LDLIBS += -lpthread
 endif
 
 ifeq ($(HOST_OS),darwin)
@@ -59,6 +60,7 @@ LOCAL_STATIC_LIBRARIES := \
     libziparchive-host \
     libext4_utils_host \
     libsparse_host \
+    libmincrypt \
     libutils \
     liblog \
     libz \
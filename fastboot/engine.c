@@ -45,6 +45,10 @@
 #include <sys/mman.h>
 #endif
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 #ifndef __unused
 #define __unused __attribute__((__unused__))
 #endif
@@ -59,9 +63,13 @@
 #define OP_WAIT_FOR_DISCONNECT 6
 
 typedef struct Action Action;
+typedef struct Run Run;
 
 #define CMD_SIZE 64
 
+/* The queue is built once and may be run on several devices at once, so
+** an Action is not changed while it runs; what a run keeps is in its Run.
+*/
 struct Action
 {
     unsigned op;
@@ -73,14 +81,42 @@ struct Action
     unsigned size;
 
     const char *msg;
-    int (*func)(Action *a, int status, char *resp);
+    int (*func)(Action *a, Run *run, int status, char *resp);
+};
 
-    double start;
+struct Run
+{
+    usb_handle *usb;
+    const char *serial;     /* prefixes the output when running on several */
+    char product[FB_RESPONSE_SZ + 1];
+    double start;           /* of the action running */
+    struct fb_stats total;
+    int status;
 };
 
 static Action *action_list = 0;
 static Action *action_last = 0;
 
+static FILE *stats_file = 0;
+
+/* Prints a line of a run's output. Each is printed whole so that the
+** lines of devices running at once do not mix.
+*/
+static void run_print(Run *run, const char *fmt, ...)
+{
+    char line[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    if (run->serial) {
+        fprintf(stderr, "%s: %s", run->serial, line);
+    } else {
+        fputs(line, stderr);
+    }
+}
 
 
 
@@ -121,14 +157,14 @@ int fb_format_supported(usb_handle *usb, const char *partition, const char *type
     return !!fs_get_generator(fs_type);
 }
 
-static int cb_default(Action *a, int status, char *resp)
+static int cb_default(Action *a __unused, Run *run, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        run_print(run, "FAILED (%s)\n", resp);
     } else {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
-        a->start = split;
+        run_print(run, "OKAY [%7.3fs]\n", (split - run->start));
+        run->start = split;
     }
     return status;
 }
@@ -160,8 +196,6 @@ static Action *queue_action(unsigned op, const char *fmt, ...)
     a->op = op;
     a->func = cb_default;
 
-    a->start = -1;
-
     return a;
 }
 
@@ -222,24 +256,26 @@ static int match(char *str, const char **value, unsigned count)
 
 
 
-static int cb_check(Action *a, int status, char *resp, int invert)
+static int cb_check(Action *a, Run *run, int status, char *resp, int invert)
 {
     const char **value = a->data;
     unsigned count = a->size;
     unsigned n;
     int yes;
+    char values[256];
+    size_t len;
 
     if (status) {
-        fprintf(stderr,"FAILED (%s)\n", resp);
+        run_print(run, "FAILED (%s)\n", resp);
         return status;
     }
 
     if (a->prod) {
-        if (strcmp(a->prod, cur_product) != 0) {
+        if (strcmp(a->prod, run->product) != 0) {
             double split = now();
-            fprintf(stderr,"IGNORE, product is %s required only for %s [%7.3fs]\n",
-                    cur_product, a->prod, (split - a->start));
-            a->start = split;
+            run_print(run, "IGNORE, product is %s required only for %s [%7.3fs]\n",
+                      run->product, a->prod, (split - run->start));
+            run->start = split;
             return 0;
         }
     }
@@ -249,30 +285,30 @@ static int cb_check(Action *a, int status, char *resp, int invert)
 
     if (yes) {
         double split = now();
-        fprintf(stderr,"OKAY [%7.3fs]\n", (split - a->start));
-        a->start = split;
+        run_print(run, "OKAY [%7.3fs]\n", (split - run->start));
+        run->start = split;
         return 0;
     }
 
-    fprintf(stderr,"FAILED\n\n");
-    fprintf(stderr,"Device %s is '%s'.\n", a->cmd + 7, resp);
-    fprintf(stderr,"Update %s '%s'",
-            invert ? "rejects" : "requires", value[0]);
-    for (n = 1; n < count; n++) {
-        fprintf(stderr," or '%s'", value[n]);
+    len = snprintf(values, sizeof(values), "'%s'", value[0]);
+    for (n = 1; n < count && len < sizeof(values); n++) {
+        len += snprintf(values + len, sizeof(values) - len, " or '%s'", value[n]);
     }
-    fprintf(stderr,".\n\n");
+    run_print(run, "FAILED\n");
+    run_print(run, "Device %s is '%s'.\n", a->cmd + 7, resp);
+    run_print(run, "Update %s %s.\n", invert ? "rejects" : "requires", values);
+    fprintf(stderr, "\n");
     return -1;
 }
 
-static int cb_require(Action *a, int status, char *resp)
+static int cb_require(Action *a, Run *run, int status, char *resp)
 {
-    return cb_check(a, status, resp, 0);
+    return cb_check(a, run, status, resp, 0);
 }
 
-static int cb_reject(Action *a, int status, char *resp)
+static int cb_reject(Action *a, Run *run, int status, char *resp)
 {
-    return cb_check(a, status, resp, 1);
+    return cb_check(a, run, status, resp, 1);
 }
 
 void fb_queue_require(const char *prod, const char *var,
@@ -288,13 +324,13 @@ void fb_queue_require(const char *prod, const char *var,
     if (a->data == 0) die("out of memory");
 }
 
-static int cb_display(Action *a, int status, char *resp)
+static int cb_display(Action *a, Run *run, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        run_print(run, "%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
-    fprintf(stderr, "%s: %s\n", (char*) a->data, resp);
+    run_print(run, "%s: %s\n", (char*) a->data, resp);
     return 0;
 }
 
@@ -307,10 +343,10 @@ void fb_queue_display(const char *var, const char *prettyname)
     a->func = cb_display;
 }
 
-static int cb_save(Action *a, int status, char *resp)
+static int cb_save(Action *a, Run *run, int status, char *resp)
 {
     if (status) {
-        fprintf(stderr, "%s FAILED (%s)\n", a->cmd, resp);
+        run_print(run, "%s FAILED (%s)\n", a->cmd, resp);
         return status;
     }
     strncpy(a->data, resp, a->size);
@@ -326,9 +362,27 @@ void fb_queue_query_save(const char *var, char *dest, unsigned dest_size)
     a->func = cb_save;
 }
 
-static int cb_do_nothing(Action *a __unused, int status __unused, char *resp __unused)
+static int cb_save_product(Action *a, Run *run, int status, char *resp)
+{
+    if (status) {
+        run_print(run, "%s FAILED (%s)\n", a->cmd, resp);
+        return status;
+    }
+    strncpy(run->product, resp, sizeof(run->product) - 1);
+    return 0;
+}
+
+void fb_queue_query_product(void)
+{
+    Action *a;
+    a = queue_action(OP_QUERY, "getvar:product");
+    a->func = cb_save_product;
+}
+
+static int cb_do_nothing(Action *a __unused, Run *run, int status __unused,
+                         char *resp __unused)
 {
-    fprintf(stderr,"\n");
+    run_print(run, "\n");
     return 0;
 }
 
@@ -364,54 +418,179 @@ void fb_queue_wait_for_disconnect(void)
     queue_action(OP_WAIT_FOR_DISCONNECT, "");
 }
 
-int fb_execute_queue(usb_handle *usb)
+/* With --stats, each action and each run's total are written out as a
+** line of tab separated fields, under this header.
+*/
+#define STATS_HEADER "serial\top\tname\tstatus\tseconds\tbytes\tusb\tdevice\tsparse\n"
+
+void fb_set_stats_file(FILE *file)
 {
+    stats_file = file;
+    fputs(STATS_HEADER, stats_file);
+}
+
+static const char *op_name(unsigned op)
+{
+    switch (op) {
+    case OP_DOWNLOAD:               return "download";
+    case OP_COMMAND:                return "command";
+    case OP_QUERY:                  return "query";
+    case OP_DOWNLOAD_SPARSE:        return "download-sparse";
+    case OP_WAIT_FOR_DISCONNECT:    return "wait";
+    default:                        return "total";
+    }
+}
+
+static void write_stats(Run *run, Action *a, int status, double seconds,
+                        struct fb_stats *stats)
+{
+    const char *name = "";
+
+    if (!stats_file) return;
+    if (a) name = a->cmd[0] ? a->cmd : (a->msg ? a->msg : "");
+    fprintf(stats_file, "%s\t%s\t%s\t%d\t%.3f\t%llu\t%.3f\t%.3f\t%.3f\n",
+            run->serial ? run->serial : "-", op_name(a ? a->op : 0), name, status,
+            seconds, stats->bytes, stats->transfer, stats->device, stats->generate);
+}
+
+static int run_queue(Run *run)
+{
+    usb_handle *usb = run->usb;
     Action *a;
     char resp[FB_RESPONSE_SZ+1];
+    struct fb_stats stats;
     int status = 0;
 
-    a = action_list;
-    if (!a)
-        return status;
     resp[FB_RESPONSE_SZ] = 0;
 
     double start = -1;
     for (a = action_list; a; a = a->next) {
-        a->start = now();
-        if (start < 0) start = a->start;
+        run->start = now();
+        if (start < 0) start = run->start;
         if (a->msg) {
-            // fprintf(stderr,"%30s... ",a->msg);
-            fprintf(stderr,"%s...\n",a->msg);
+            run_print(run, "%s...\n", a->msg);
         }
+        if (a->op == OP_NOTICE) {
+            run_print(run, "%s\n", (char*)a->data);
+            continue;
+        }
+
+        double action_start = run->start;
+        fb_reset_stats();
         if (a->op == OP_DOWNLOAD) {
             status = fb_download_data(usb, a->data, a->size);
-            status = a->func(a, status, status ? fb_get_error() : "");
-            if (status) break;
+            status = a->func(a, run, status, status ? fb_get_error() : "");
         } else if (a->op == OP_COMMAND) {
             status = fb_command(usb, a->cmd);
-            status = a->func(a, status, status ? fb_get_error() : "");
-            if (status) break;
+            status = a->func(a, run, status, status ? fb_get_error() : "");
         } else if (a->op == OP_QUERY) {
             status = fb_command_response(usb, a->cmd, resp);
-            status = a->func(a, status, status ? fb_get_error() : resp);
-            if (status) break;
-        } else if (a->op == OP_NOTICE) {
-            fprintf(stderr,"%s\n",(char*)a->data);
+            status = a->func(a, run, status, status ? fb_get_error() : resp);
         } else if (a->op == OP_DOWNLOAD_SPARSE) {
             status = fb_download_data_sparse(usb, a->data);
-            status = a->func(a, status, status ? fb_get_error() : "");
-            if (status) break;
+            status = a->func(a, run, status, status ? fb_get_error() : "");
         } else if (a->op == OP_WAIT_FOR_DISCONNECT) {
             usb_wait_for_disconnect(usb);
         } else {
             die("bogus action");
         }
+
+        fb_get_stats(&stats);
+        run->total.transfer += stats.transfer;
+        run->total.device += stats.device;
+        run->total.generate += stats.generate;
+        run->total.bytes += stats.bytes;
+        write_stats(run, a, status, now() - action_start, &stats);
+        if (status) break;
     }
 
-    fprintf(stderr,"finished. total time: %.3fs\n", (now() - start));
+    double total = now() - start;
+    run_print(run, "finished. total time: %.3fs\n", total);
+    if (run->total.bytes && run->total.transfer > 0) {
+        run_print(run, "sent %.1f MB at %.1f MB/s; usb %.3fs, device %.3fs, sparse %.3fs\n",
+                  run->total.bytes / 1e6, run->total.bytes / 1e6 / run->total.transfer,
+                  run->total.transfer, run->total.device, run->total.generate);
+    }
+    write_stats(run, NULL, status, total, &run->total);
     return status;
 }
 
+int fb_execute_queue(usb_handle *usb)
+{
+    Run run;
+
+    if (!action_list)
+        return 0;
+
+    memset(&run, 0, sizeof(run));
+    run.usb = usb;
+    return run_queue(&run);
+}
+
+#if !defined(_WIN32)
+static void *run_queue_thread(void *arg)
+{
+    Run *run = arg;
+    run->status = run_queue(run);
+    return NULL;
+}
+#endif
+
+/* Runs the queue on each device on a thread of its own. The images the
+** queue holds, sparse or not, are only read while they are sent, so the
+** devices share them. Without threads (Windows) they are run in turn.
+*/
+int fb_execute_queue_all(usb_handle **usb, const char **serial, int count)
+{
+    Run *runs;
+    int failed = 0;
+    int i;
+
+    if (!action_list)
+        return 0;
+
+    runs = calloc(count, sizeof(Run));
+    if (runs == 0) die("out of memory");
+
+#if !defined(_WIN32)
+    pthread_t *threads = calloc(count, sizeof(pthread_t));
+    int *started = calloc(count, sizeof(int));
+    if (threads == 0 || started == 0) die("out of memory");
+#endif
+
+    for (i = 0; i < count; i++) {
+        runs[i].usb = usb[i];
+        runs[i].serial = serial[i];
+#if !defined(_WIN32)
+        if (pthread_create(&threads[i], NULL, run_queue_thread, &runs[i]) == 0) {
+            started[i] = 1;
+            continue;
+        }
+#endif
+        runs[i].status = run_queue(&runs[i]);
+    }
+
+    for (i = 0; i < count; i++) {
+#if !defined(_WIN32)
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+#endif
+        if (runs[i].status) {
+            fprintf(stderr, "%s: FAILED\n", serial[i]);
+            failed++;
+        }
+    }
+    fprintf(stderr, "finished on %d of %d devices\n", count - failed, count);
+
+#if !defined(_WIN32)
+    free(started);
+    free(threads);
+#endif
+    free(runs);
+    return failed ? -1 : 0;
+}
+
 int fb_queue_is_empty(void)
 {
     return (action_list == NULL);
@@ -44,6 +44,15 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <mincrypt/sha256.h>
 #include <sparse/sparse.h>
 #include <ziparchive/zip_archive.h>
 
@@ -57,8 +66,6 @@
 
 #define ARRAY_SIZE(a) (sizeof(a)/sizeof(*(a)))
 
-char cur_product[FB_RESPONSE_SZ + 1];
-
 static const char *serial = 0;
 static const char *product = 0;
 static const char *cmdline = 0;
@@ -66,6 +73,7 @@ static unsigned short vendor_id = 0;
 static int long_listing = 0;
 static int64_t sparse_limit = -1;
 static int64_t target_sparse_limit = -1;
+static int skip_unchanged = 0;
 
 unsigned page_size = 2048;
 unsigned base_addr      = 0x10000000;
@@ -149,6 +157,13 @@ static int64_t file_size(int fd)
     return ret ? -1 : st.st_size;
 }
 
+/* Images are mapped rather than read in, so that sending one starts
+** at once and pages of it are read as they are sent, without holding the
+** whole of every image in memory. The mapping is private and writable as
+** a few callers patch what they load (the boot image's cmdline, the
+** android-info.txt lines). Windows still reads images in. Neither is
+** ever released.
+*/
 static void *load_fd(int fd, unsigned *_sz)
 {
     char *data;
@@ -162,6 +177,21 @@ static void *load_fd(int fd, unsigned *_sz)
         goto oops;
     }
 
+#if !defined(_WIN32)
+    if (sz > 0) {
+        data = (char*) mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = 0;
+            goto oops;
+        }
+        madvise(data, sz, MADV_SEQUENTIAL);
+        close(fd);
+
+        if(_sz) *_sz = sz;
+        return data;
+    }
+#endif
+
     data = (char*) malloc(sz);
     if(data == 0) goto oops;
 
@@ -243,15 +273,13 @@ int list_devices_callback(usb_ifc_info *info)
     return -1;
 }
 
-usb_handle *open_device(void)
+static usb_handle *open_device_with(ifc_match_func match)
 {
-    static usb_handle *usb = 0;
+    usb_handle *usb;
     int announce = 1;
 
-    if(usb) return usb;
-
     for(;;) {
-        usb = usb_open(match_fastboot);
+        usb = usb_open(match);
         if(usb) return usb;
         if(announce) {
             announce = 0;
@@ -261,6 +289,49 @@ usb_handle *open_device(void)
     }
 }
 
+usb_handle *open_device(void)
+{
+    static usb_handle *usb = 0;
+
+    if(!usb) usb = open_device_with(match_fastboot);
+    return usb;
+}
+
+// With --all, the devices opened so far, by path (or serial number, where
+// there are no paths) so that usb_open() passes over them.
+static std::vector<std::string> opened_devices;
+static std::string opening_serial;
+
+static std::string device_key(usb_ifc_info *info)
+{
+    return info->device_path[0] ? info->device_path : info->serial_number;
+}
+
+static int match_unopened_fastboot(usb_ifc_info *info)
+{
+    if (match_fastboot_with_serial(info, NULL) != 0) return -1;
+    std::string key = device_key(info);
+    if (std::find(opened_devices.begin(), opened_devices.end(), key) != opened_devices.end()) {
+        return -1;
+    }
+    opened_devices.push_back(key);
+    opening_serial = info->serial_number[0] ? info->serial_number : key;
+    return 0;
+}
+
+// Opens every fastboot device there is, waiting for the first.
+static void open_all_devices(std::vector<usb_handle*>* usbs, std::vector<std::string>* serials)
+{
+    usbs->push_back(open_device_with(match_unopened_fastboot));
+    serials->push_back(opening_serial);
+
+    usb_handle* usb;
+    while ((usb = usb_open(match_unopened_fastboot)) != NULL) {
+        usbs->push_back(usb);
+        serials->push_back(opening_serial);
+    }
+}
+
 void list_devices(void) {
     // We don't actually open a USB device here,
     // just getting our callback called so we can
@@ -325,6 +396,15 @@ void usage(void)
             "                                           default: 2048\n"
             "  -S <size>[K|M|G]                         automatically sparse files greater\n"
             "                                           than size.  0 to disable\n"
+            "  --skip-unchanged                         with \"flashall\" and \"update\", do not\n"
+            "                                           flash partitions the device reports\n"
+            "                                           already hold the image\n"
+            "  --stats <file>                           write the time and throughput of\n"
+            "                                           each command to file (- for stdout)\n"
+            "                                           as tab separated fields\n"
+            "  --all                                    run the commands on every device\n"
+            "                                           at once, which must all be of the\n"
+            "                                           same kind as the first found\n"
         );
 }
 
@@ -697,6 +777,89 @@ static int load_buf(usb_handle *usb, const char *fname,
     return load_buf_fd(usb, fd, buf);
 }
 
+struct image_digest_state {
+    SHA256_CTX ctx;
+    int64_t left;
+};
+
+static int image_digest_write(void *priv, const void *data, int len)
+{
+    static const char zeros[4096] = {};
+    image_digest_state* state = reinterpret_cast<image_digest_state*>(priv);
+
+    len = std::min<int64_t>(len, state->left);
+    state->left -= len;
+    if (data) {
+        SHA256_update(&state->ctx, data, len);
+        return 0;
+    }
+    while (len > 0) {
+        int n = std::min<int>(len, sizeof(zeros));
+        SHA256_update(&state->ctx, zeros, n);
+        len -= n;
+    }
+    return 0;
+}
+
+/* The SHA-256 of the image in fd as it is written to the partition, with
+ * the regions a sparse image leaves alone taken as zeros.
+ */
+static int image_digest(int fd, uint8_t *digest, int64_t *size)
+{
+    struct sparse_file *s = sparse_file_import_auto(fd, false, false);
+    if (!s) {
+        return -1;
+    }
+
+    image_digest_state state;
+    SHA256_init(&state.ctx);
+    state.left = *size = sparse_file_len(s, false, false);
+    int r = sparse_file_callback(s, false, false, image_digest_write, &state);
+    sparse_file_destroy(s);
+    lseek(fd, 0, SEEK_SET);
+    if (r < 0) {
+        return -1;
+    }
+    memcpy(digest, SHA256_final(&state.ctx), SHA256_DIGEST_SIZE);
+    return 0;
+}
+
+/* With --skip-unchanged, asks the device for the digest of as much of the
+ * partition as the image in fd covers, and whether it is the image's. A
+ * device without the partition-hash variable has every image flashed.
+ */
+static bool partition_unchanged(usb_handle *usb, const char *pname, int fd)
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+    char var[FB_COMMAND_SZ];
+    char response[FB_RESPONSE_SZ + 1];
+    int64_t size;
+
+    if (!skip_unchanged) {
+        return false;
+    }
+    if (image_digest(fd, digest, &size)) {
+        return false;
+    }
+    // The variable has to fit in a getvar command.
+    int len = snprintf(var, sizeof(var), "partition-hash:%s:%" PRIx64, pname, size);
+    if (len < 0 || strlen("getvar:") + len >= FB_COMMAND_SZ) {
+        return false;
+    }
+    if (fb_getvar(usb, response, "%s", var)) {
+        return false;
+    }
+    for (size_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    if (strcasecmp(response, hex) != 0) {
+        return false;
+    }
+    fprintf(stderr, "skipping '%s', unchanged\n", pname);
+    return true;
+}
+
 static void flash_buf(const char *pname, struct fastboot_buffer *buf)
 {
     sparse_file** s;
@@ -740,7 +903,7 @@ void do_update(usb_handle *usb, const char *filename, int erase_first)
 {
     queue_info_dump();
 
-    fb_queue_query_save("product", cur_product, sizeof(cur_product));
+    fb_queue_query_product();
 
     ZipArchiveHandle zip;
     int error = OpenArchive(filename, &zip);
@@ -767,6 +930,10 @@ void do_update(usb_handle *usb, const char *filename, int erase_first)
             CloseArchive(zip);
             exit(1); // unzip_to_file already explained why.
         }
+        if (partition_unchanged(usb, images[i].part_name, fd)) {
+            close(fd);
+            continue;
+        }
         fastboot_buffer buf;
         int rc = load_buf_fd(usb, fd, &buf);
         if (rc) die("cannot load %s from flash", images[i].img_name);
@@ -806,7 +973,7 @@ void do_flashall(usb_handle *usb, int erase_first)
 {
     queue_info_dump();
 
-    fb_queue_query_save("product", cur_product, sizeof(cur_product));
+    fb_queue_query_product();
 
     char* fname = find_item("info", product);
     if (fname == 0) die("cannot find android-info.txt");
@@ -819,6 +986,12 @@ void do_flashall(usb_handle *usb, int erase_first)
 
     for (size_t i = 0; i < ARRAY_SIZE(images); i++) {
         fname = find_item(images[i].part_name, product);
+        if (skip_unchanged) {
+            int fd = open(fname, O_RDONLY | O_BINARY);
+            bool unchanged = fd >= 0 && partition_unchanged(usb, images[i].part_name, fd);
+            if (fd >= 0) close(fd);
+            if (unchanged) continue;
+        }
         fastboot_buffer buf;
         if (load_buf(usb, fname, &buf)) {
             if (images[i].is_optional)
@@ -1007,6 +1180,8 @@ int main(int argc, char **argv)
     int wants_wipe = 0;
     int wants_reboot = 0;
     int wants_reboot_bootloader = 0;
+    int wants_all = 0;
+    int serial_option = 0;
     int erase_first = 1;
     void *data;
     unsigned sz;
@@ -1023,6 +1198,9 @@ int main(int argc, char **argv)
         {"help", no_argument, 0, 'h'},
         {"unbuffered", no_argument, 0, 0},
         {"version", no_argument, 0, 0},
+        {"all", no_argument, 0, 0},
+        {"skip-unchanged", no_argument, 0, 0},
+        {"stats", required_argument, 0, 0},
         {0, 0, 0, 0}
     };
 
@@ -1075,6 +1253,7 @@ int main(int argc, char **argv)
             break;
         case 's':
             serial = optarg;
+            serial_option = 1;
             break;
         case 'S':
             sparse_limit = parse_num(optarg);
@@ -1097,6 +1276,14 @@ int main(int argc, char **argv)
             } else if (strcmp("version", longopts[longindex].name) == 0) {
                 fprintf(stdout, "fastboot version %s\n", FASTBOOT_REVISION);
                 return 0;
+            } else if (strcmp("all", longopts[longindex].name) == 0) {
+                wants_all = 1;
+            } else if (strcmp("skip-unchanged", longopts[longindex].name) == 0) {
+                skip_unchanged = 1;
+            } else if (strcmp("stats", longopts[longindex].name) == 0) {
+                FILE* file = strcmp(optarg, "-") ? fopen(optarg, "w") : stdout;
+                if (!file) die("cannot open '%s': %s", optarg, strerror(errno));
+                fb_set_stats_file(file);
             }
             break;
         default:
@@ -1123,7 +1310,19 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    usb_handle* usb = open_device();
+    // The queue is built against the first device, and run on the rest
+    // as it is.
+    std::vector<usb_handle*> usbs;
+    std::vector<std::string> serials;
+    if (wants_all) {
+        if (serial_option) die("--all and -s can not be used together");
+        // What is unchanged is only known for the first device.
+        if (skip_unchanged) die("--all and --skip-unchanged can not be used together");
+        open_all_devices(&usbs, &serials);
+    } else {
+        usbs.push_back(open_device());
+    }
+    usb_handle* usb = usbs[0];
 
     while (argc > 0) {
         if(!strcmp(*argv, "getvar")) {
@@ -1295,6 +1494,14 @@ int main(int argc, char **argv)
     if (fb_queue_is_empty())
         return 0;
 
-    status = fb_execute_queue(usb);
+    if (wants_all) {
+        std::vector<const char*> names;
+        for (const std::string& s : serials) {
+            names.push_back(s.c_str());
+        }
+        status = fb_execute_queue_all(usbs.data(), names.data(), usbs.size());
+    } else {
+        status = fb_execute_queue(usb);
+    }
     return (status) ? 1 : 0;
 }
@@ -29,6 +29,8 @@
 #ifndef _FASTBOOT_H_
 #define _FASTBOOT_H_
 
+#include <stdio.h>
+
 #include "usb.h"
 
 #if defined(__cplusplus)
@@ -37,12 +39,22 @@ extern "C" {
 
 struct sparse_file;
 
+/* Where the time of the commands since fb_reset_stats() went, per thread. */
+struct fb_stats {
+    double transfer;            /* sending data over USB */
+    double device;              /* waiting for the device to reply */
+    double generate;            /* generating sparse images */
+    unsigned long long bytes;   /* of data sent */
+};
+
 /* protocol.c - fastboot protocol */
 int fb_command(usb_handle *usb, const char *cmd);
 int fb_command_response(usb_handle *usb, const char *cmd, char *response);
 int fb_download_data(usb_handle *usb, const void *data, unsigned size);
 int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s);
 char *fb_get_error(void);
+void fb_reset_stats(void);
+void fb_get_stats(struct fb_stats *stats);
 
 #define FB_COMMAND_SZ 64
 #define FB_RESPONSE_SZ 64
@@ -58,13 +70,16 @@ void fb_queue_require(const char *prod, const char *var, int invert,
         unsigned nvalues, const char **value);
 void fb_queue_display(const char *var, const char *prettyname);
 void fb_queue_query_save(const char *var, char *dest, unsigned dest_size);
+void fb_queue_query_product(void);
 void fb_queue_reboot(void);
 void fb_queue_command(const char *cmd, const char *msg);
 void fb_queue_download(const char *name, void *data, unsigned size);
 void fb_queue_notice(const char *notice);
 void fb_queue_wait_for_disconnect(void);
 int fb_execute_queue(usb_handle *usb);
+int fb_execute_queue_all(usb_handle **usb, const char **serial, int count);
 int fb_queue_is_empty(void);
+void fb_set_stats_file(FILE *file);
 
 /* util stuff */
 double now();
@@ -73,9 +88,6 @@ __attribute__((__noreturn__)) void die(const char *fmt, ...);
 
 void get_my_path(char *path);
 
-/* Current product */
-extern char cur_product[FB_RESPONSE_SZ + 1];
-
 #if defined(__cplusplus)
 }
 #endif
@@ -28,26 +28,79 @@
 
 #define min(a, b) \
     ({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
-#define round_down(a, b) \
-    ({ typeof(a) _a = (a); typeof(b) _b = (b); _a - (_a % _b); })
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 #include <sparse/sparse.h>
 
 #include "fastboot.h"
 
-static char ERROR[128];
+#define ERROR_SIZE 128
+
+struct protocol_state {
+    char error[ERROR_SIZE];
+    struct fb_stats stats;
+};
+
+#if defined(_WIN32)
+static struct protocol_state state_buf;
+
+static struct protocol_state *protocol_state(void)
+{
+    return &state_buf;
+}
+#else
+/* Devices may run their queues on threads of their own, each with its
+** own error and statistics.
+*/
+static pthread_key_t state_key;
+static pthread_once_t state_once = PTHREAD_ONCE_INIT;
+
+static void state_key_create(void)
+{
+    pthread_key_create(&state_key, free);
+}
+
+static struct protocol_state *protocol_state(void)
+{
+    struct protocol_state *state;
+
+    pthread_once(&state_once, state_key_create);
+    state = pthread_getspecific(state_key);
+    if (state == NULL) {
+        state = calloc(1, sizeof(*state));
+        if (state == NULL) die("out of memory");
+        pthread_setspecific(state_key, state);
+    }
+    return state;
+}
+#endif
+
+#define ERROR (protocol_state()->error)
+#define STATS (protocol_state()->stats)
 
 char *fb_get_error(void)
 {
     return ERROR;
 }
 
-static int check_response(usb_handle *usb, unsigned int size, char *response)
+void fb_reset_stats(void)
+{
+    memset(&STATS, 0, sizeof(STATS));
+}
+
+void fb_get_stats(struct fb_stats *stats)
+{
+    *stats = STATS;
+}
+
+static int _check_response(usb_handle *usb, unsigned int size, char *response)
 {
     unsigned char status[65];
     int r;
@@ -106,6 +159,17 @@ static int check_response(usb_handle *usb, unsigned int size, char *response)
     return -1;
 }
 
+/* Waiting on the device is what is left of a command once its data is
+** sent: for "flash", writing the partition.
+*/
+static int check_response(usb_handle *usb, unsigned int size, char *response)
+{
+    double start = now();
+    int r = _check_response(usb, size, response);
+    STATS.device += now() - start;
+    return r;
+}
+
 static int _command_start(usb_handle *usb, const char *cmd, unsigned size,
                           char *response)
 {
@@ -132,8 +196,10 @@ static int _command_start(usb_handle *usb, const char *cmd, unsigned size,
 static int _command_data(usb_handle *usb, const void *data, unsigned size)
 {
     int r;
+    double start = now();
 
     r = usb_write(usb, data, size);
+    STATS.transfer += now() - start;
     if(r < 0) {
         sprintf(ERROR, "data transfer failure (%s)", strerror(errno));
         usb_close(usb);
@@ -145,6 +211,7 @@ static int _command_data(usb_handle *usb, const void *data, unsigned size)
         return -1;
     }
 
+    STATS.bytes += r;
     return r;
 }
 
@@ -216,70 +283,146 @@ int fb_download_data(usb_handle *usb, const void *data, unsigned size)
     }
 }
 
-#define USB_BUF_SIZE 1024
-static char usb_buf[USB_BUF_SIZE];
-static int usb_buf_len;
+/* Sparse images are generated into one buffer while the one before is
+** written out to USB by a thread of its own, so that neither the CPU nor
+** USB waits on the other. The buffers are large enough that each write
+** is a long run of bulk transfers. Without threads (Windows) the buffers
+** are written out in turn as they fill.
+*/
+#define SPARSE_BUF_SIZE (1024 * 1024)
+#define SPARSE_BUFS 2
+
+struct sparse_pipe {
+    usb_handle *usb;
+    char *buf[SPARSE_BUFS];
+    int len[SPARSE_BUFS];
+    int fill;       /* the buffer being filled */
+    int next;       /* the next buffer to write out */
+    int queued;     /* buffers filled and not written out yet */
+    int failed;
+    int done;       /* no more buffers will be queued */
+    int threaded;
+    char error[ERROR_SIZE]; /* of the writer thread, when it failed */
+    struct fb_stats stats;  /* of the writer thread */
+    double queue_time;      /* spent handing buffers on */
+#if !defined(_WIN32)
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+static int sparse_pipe_write(struct sparse_pipe *pipe, int n)
+{
+    return _command_data(pipe->usb, pipe->buf[n], pipe->len[n]) == pipe->len[n] ? 0 : -1;
+}
 
-static int fb_download_data_sparse_write(void *priv, const void *data, int len)
+#if !defined(_WIN32)
+static void *sparse_pipe_writer(void *arg)
 {
-    int r;
-    usb_handle *usb = priv;
-    int to_write;
-    const char *ptr = data;
+    struct sparse_pipe *pipe = arg;
 
-    if (usb_buf_len) {
-        to_write = min(USB_BUF_SIZE - usb_buf_len, len);
+    pthread_mutex_lock(&pipe->lock);
+    for (;;) {
+        while (!pipe->queued && !pipe->done && !pipe->failed) {
+            pthread_cond_wait(&pipe->cond, &pipe->lock);
+        }
+        if (pipe->failed || !pipe->queued) {
+            break;
+        }
 
-        memcpy(usb_buf + usb_buf_len, ptr, to_write);
-        usb_buf_len += to_write;
-        ptr += to_write;
-        len -= to_write;
-    }
+        int n = pipe->next;
+        pthread_mutex_unlock(&pipe->lock);
+        int r = sparse_pipe_write(pipe, n);
+        pthread_mutex_lock(&pipe->lock);
 
-    if (usb_buf_len == USB_BUF_SIZE) {
-        r = _command_data(usb, usb_buf, USB_BUF_SIZE);
-        if (r != USB_BUF_SIZE) {
-            return -1;
+        if (r < 0 && !pipe->failed) {
+            pipe->failed = 1;
+            strcpy(pipe->error, ERROR);
         }
-        usb_buf_len = 0;
+        pipe->next = (n + 1) % SPARSE_BUFS;
+        pipe->queued--;
+        pthread_cond_broadcast(&pipe->cond);
+    }
+    pipe->stats = STATS;
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+#endif
+
+/* Hands the buffer being filled on to be written out, and waits for
+** the next one to be free.
+*/
+static int sparse_pipe_queue(struct sparse_pipe *pipe)
+{
+    int r = 0;
+    double start = now();
+
+    if (!pipe->threaded) {
+        r = sparse_pipe_write(pipe, pipe->fill);
+        pipe->len[pipe->fill] = 0;
+        pipe->queue_time += now() - start;
+        return r;
     }
 
-    if (len > USB_BUF_SIZE) {
-        if (usb_buf_len > 0) {
-            sprintf(ERROR, "internal error: usb_buf not empty\n");
-            return -1;
-        }
-        to_write = round_down(len, USB_BUF_SIZE);
-        r = _command_data(usb, ptr, to_write);
-        if (r != to_write) {
-            return -1;
-        }
-        ptr += to_write;
-        len -= to_write;
+#if !defined(_WIN32)
+    pthread_mutex_lock(&pipe->lock);
+    pipe->queued++;
+    pipe->fill = (pipe->fill + 1) % SPARSE_BUFS;
+    pthread_cond_broadcast(&pipe->cond);
+    while (pipe->queued == SPARSE_BUFS && !pipe->failed) {
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
     }
+    r = pipe->failed ? -1 : 0;
+    pthread_mutex_unlock(&pipe->lock);
+    pipe->len[pipe->fill] = 0;
+    pipe->queue_time += now() - start;
+#endif
+    return r;
+}
 
-    if (len > 0) {
-        if (len > USB_BUF_SIZE) {
-            sprintf(ERROR, "internal error: too much left for usb_buf\n");
-            return -1;
+/* Waits for the writer to finish; failed stops it short. */
+static int sparse_pipe_finish(struct sparse_pipe *pipe, int failed)
+{
+#if !defined(_WIN32)
+    if (pipe->threaded) {
+        pthread_mutex_lock(&pipe->lock);
+        pipe->done = 1;
+        if (failed) {
+            pipe->failed = 1;
+        }
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->lock);
+        pthread_join(pipe->thread, NULL);
+        pthread_cond_destroy(&pipe->cond);
+        pthread_mutex_destroy(&pipe->lock);
+        if (pipe->error[0]) {
+            strcpy(ERROR, pipe->error);
         }
-        memcpy(usb_buf, ptr, len);
-        usb_buf_len = len;
+        STATS.transfer += pipe->stats.transfer;
+        STATS.bytes += pipe->stats.bytes;
     }
-
-    return 0;
+#endif
+    return (failed || pipe->failed) ? -1 : 0;
 }
 
-static int fb_download_data_sparse_flush(usb_handle *usb)
+static int fb_download_data_sparse_write(void *priv, const void *data, int len)
 {
-    int r;
+    struct sparse_pipe *pipe = priv;
+    const char *ptr = data;
+
+    while (len > 0) {
+        int n = pipe->fill;
+        int to_write = min(SPARSE_BUF_SIZE - pipe->len[n], len);
+
+        memcpy(pipe->buf[n] + pipe->len[n], ptr, to_write);
+        pipe->len[n] += to_write;
+        ptr += to_write;
+        len -= to_write;
 
-    if (usb_buf_len > 0) {
-        r = _command_data(usb, usb_buf, usb_buf_len);
-        if (r != usb_buf_len) {
+        if (pipe->len[n] == SPARSE_BUF_SIZE && sparse_pipe_queue(pipe) < 0) {
             return -1;
         }
-        usb_buf_len = 0;
     }
 
     return 0;
@@ -289,26 +432,58 @@ int fb_download_data_sparse(usb_handle *usb, struct sparse_file *s)
 {
     char cmd[64];
     int r;
+    int i;
     int size = sparse_file_len(s, true, false);
     if (size <= 0) {
         return -1;
     }
 
+    struct sparse_pipe pipe;
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.usb = usb;
+    for (i = 0; i < SPARSE_BUFS; i++) {
+        pipe.buf[i] = malloc(SPARSE_BUF_SIZE);
+        if (pipe.buf[i] == NULL) {
+            sprintf(ERROR, "out of memory for the sparse buffers");
+            r = -1;
+            goto done;
+        }
+    }
+
     sprintf(cmd, "download:%08x", size);
     r = _command_start(usb, cmd, size, 0);
     if (r < 0) {
-        return -1;
+        goto done;
     }
 
-    r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, usb);
-    if (r < 0) {
-        return -1;
+#if !defined(_WIN32)
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.cond, NULL);
+    if (pthread_create(&pipe.thread, NULL, sparse_pipe_writer, &pipe) == 0) {
+        pipe.threaded = 1;
+    } else {
+        pthread_cond_destroy(&pipe.cond);
+        pthread_mutex_destroy(&pipe.lock);
     }
-
-    r = fb_download_data_sparse_flush(usb);
-    if (r < 0) {
-        return -1;
+#endif
+
+    /* Generating the sparse data is what the callback does besides
+    ** handing buffers on to be written out.
+    */
+    double start = now();
+    r = sparse_file_callback(s, true, false, fb_download_data_sparse_write, &pipe);
+    STATS.generate += now() - start - pipe.queue_time;
+    if (r >= 0 && pipe.len[pipe.fill] > 0) {
+        r = sparse_pipe_queue(&pipe);
+    }
+    r = sparse_pipe_finish(&pipe, r < 0);
+    if (r >= 0) {
+        r = _command_end(usb);
     }
 
-    return _command_end(usb);
+done:
+    for (i = 0; i < SPARSE_BUFS; i++) {
+        free(pipe.buf[i]);
+    }
+    return r;
 }
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <time.h>
 #include <sys/swap.h>
 #include <dirent.h>
@@ -65,6 +67,12 @@
 
 #define ZRAM_CONF_DEV   "/sys/block/zram0/disksize"
 
+#define PARALLEL_CHECK_PROP "ro.fs_mgr.parallel_check"
+#define PARALLEL_VERITY_PROP "ro.fs_mgr.parallel_verity"
+
+/* Not a FS_MGR_SETUP_VERITY_* value: verity was not set up in advance. */
+#define VERITY_NOT_SET_UP 1
+
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
 
 /*
@@ -85,6 +93,15 @@ static time_t gettime(void)
     return ts.tv_sec;
 }
 
+/* Returns the time in milliseconds of the system's monotonic clock. */
+static int64_t gettime_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 static int wait_for_file(const char *filename, int timeout)
 {
     struct stat info;
@@ -292,6 +309,15 @@ static int device_is_force_encrypted() {
     return strcmp(value, "1") ? 0 : 1;
 }
 
+static int parallel_enabled(const char *prop) {
+    int ret = -1;
+    char value[PROP_VALUE_MAX];
+    ret = __system_property_get(prop, value);
+    if (ret < 0)
+        return 0;
+    return strcmp(value, "1") ? 0 : 1;
+}
+
 /*
  * Tries to mount any of the consecutive fstab entries that match
  * the mountpoint of the one given by fstab->recs[start_idx].
@@ -299,15 +325,18 @@ static int device_is_force_encrypted() {
  * end_idx: On return, will be the last rec that was looked at.
  * attempted_idx: On return, will indicate which fstab rec
  *     succeeded. In case of failure, it will be the start_idx.
+ * checked: If not NULL, the recs that were already checked.
  * Returns
  *   -1 on failure with errno set to match the 1st mount failure.
  *   0 on success.
  */
-static int mount_with_alternatives(struct fstab *fstab, int start_idx, int *end_idx, int *attempted_idx)
+static int mount_with_alternatives(struct fstab *fstab, int start_idx, int *end_idx, int *attempted_idx,
+                                   const char *checked)
 {
     int i;
     int mount_errno = 0;
     int mounted = 0;
+    int64_t start;
 
     if (!end_idx || !attempted_idx || start_idx >= fstab->num_entries) {
       errno = EINVAL;
@@ -332,11 +361,19 @@ static int mount_with_alternatives(struct fstab *fstab, int start_idx, int *end_
                 continue;
             }
 
-            if (fstab->recs[i].fs_mgr_flags & MF_CHECK) {
+            if ((fstab->recs[i].fs_mgr_flags & MF_CHECK) && !(checked && checked[i])) {
+                start = gettime_ms();
                 check_fs(fstab->recs[i].blk_device, fstab->recs[i].fs_type,
                          fstab->recs[i].mount_point);
+                NOTICE("%s(): checked %s (%s) in %lld ms\n", __func__,
+                       fstab->recs[i].mount_point, fstab->recs[i].blk_device,
+                       (long long) (gettime_ms() - start));
             }
+            start = gettime_ms();
             if (!__mount(fstab->recs[i].blk_device, fstab->recs[i].mount_point, &fstab->recs[i])) {
+                NOTICE("%s(): mounted %s (%s) in %lld ms\n", __func__,
+                       fstab->recs[i].mount_point, fstab->recs[i].blk_device,
+                       (long long) (gettime_ms() - start));
                 *attempted_idx = i;
                 mounted = 1;
                 if (i != start_idx) {
@@ -347,6 +384,9 @@ static int mount_with_alternatives(struct fstab *fstab, int start_idx, int *end_
             } else {
                 /* back up errno for crypto decisions */
                 mount_errno = errno;
+                NOTICE("%s(): mount of %s (%s) failed after %lld ms\n", __func__,
+                       fstab->recs[i].mount_point, fstab->recs[i].blk_device,
+                       (long long) (gettime_ms() - start));
             }
     }
 
@@ -562,6 +602,217 @@ out:
     return ret;
 }
 
+/* Whether mount point a is a proper ancestor of mount point b. */
+static int is_ancestor_mount_point(const char *a, const char *b)
+{
+    size_t len = strlen(a);
+
+    if (!strcmp(a, "/"))
+        return strcmp(b, "/") != 0;
+    return !strncmp(a, b, len) && b[len] == '/';
+}
+
+/*
+ * Runs check_fs() for the entries that fs_mgr_mount_all() is about to check,
+ * each in a child process, so that entries on different block devices are
+ * checked at the same time.  An entry waits while another one on the same
+ * block device, or one for an ancestor of its mount point, is being checked;
+ * the mounts themselves still happen one by one in fstab order afterwards.
+ *
+ * Entries with alternatives for their mount point and verified entries,
+ * whose block device is only known once verity is set up, are left to the
+ * serial path.  checked[i] is set for each entry that was checked here.
+ */
+static void check_fs_parallel(struct fstab *fstab, char *checked)
+{
+    enum { SKIP, PENDING, RUNNING };
+    int n = fstab->num_entries;
+    int *state = calloc(n, sizeof(*state));
+    pid_t *pids = calloc(n, sizeof(*pids));
+    dev_t *devs = calloc(n, sizeof(*devs));
+    int64_t *starts = calloc(n, sizeof(*starts));
+    int64_t start = gettime_ms();
+    int count = 0;
+    int running;
+    int i, j;
+
+    if (!state || !pids || !devs || !starts) {
+        ERROR("%s(): out of memory, checking serially\n", __func__);
+        goto out;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct fstab_rec *rec = &fstab->recs[i];
+        struct stat sb;
+
+        if (!(rec->fs_mgr_flags & MF_CHECK) ||
+            (rec->fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY | MF_VERIFY)))
+            continue;
+        if ((i > 0 && !strcmp(fstab->recs[i - 1].mount_point, rec->mount_point)) ||
+            (i + 1 < n && !strcmp(fstab->recs[i + 1].mount_point, rec->mount_point)))
+            continue;
+        if (strcmp(rec->fs_type, "ext2") && strcmp(rec->fs_type, "ext3") &&
+            strcmp(rec->fs_type, "ext4") && strcmp(rec->fs_type, "f2fs"))
+            continue;
+
+        /* The same preparation as fs_mgr_mount_all(), which is then a no-op there. */
+        if (strcmp(rec->fs_type, "f2fs") && translate_ext_labels(rec) < 0)
+            continue;
+        if (rec->fs_mgr_flags & MF_WAIT)
+            wait_for_file(rec->blk_device, WAIT_TIMEOUT);
+        if (stat(rec->blk_device, &sb) < 0)
+            continue;
+
+        devs[i] = sb.st_rdev;
+        state[i] = PENDING;
+    }
+
+    do {
+        /* Start whatever does not have to wait for another entry. */
+        for (i = 0; i < n; i++) {
+            int blocked = 0;
+
+            if (state[i] != PENDING)
+                continue;
+            for (j = 0; j < n && !blocked; j++) {
+                if (j == i || state[j] == SKIP)
+                    continue;
+                blocked = (state[j] == RUNNING && devs[j] == devs[i]) ||
+                          is_ancestor_mount_point(fstab->recs[j].mount_point,
+                                                  fstab->recs[i].mount_point);
+            }
+            if (blocked)
+                continue;
+
+            starts[i] = gettime_ms();
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                check_fs(fstab->recs[i].blk_device, fstab->recs[i].fs_type,
+                         fstab->recs[i].mount_point);
+                _exit(0);
+            }
+            if (pids[i] < 0) {
+                ERROR("%s(): fork failed (%s), checking %s in place\n", __func__,
+                      strerror(errno), fstab->recs[i].mount_point);
+                check_fs(fstab->recs[i].blk_device, fstab->recs[i].fs_type,
+                         fstab->recs[i].mount_point);
+                pids[i] = 0;
+            }
+            state[i] = RUNNING;
+        }
+
+        /*
+         * Only reap our own children: init has others, which it reaps itself.
+         */
+        running = 0;
+        for (i = 0; i < n; i++) {
+            if (state[i] != RUNNING)
+                continue;
+            if (pids[i] && TEMP_FAILURE_RETRY(waitpid(pids[i], NULL, WNOHANG)) == 0) {
+                running++;
+                continue;
+            }
+            NOTICE("%s(): checked %s (%s) in %lld ms\n", __func__,
+                   fstab->recs[i].mount_point, fstab->recs[i].blk_device,
+                   (long long) (gettime_ms() - starts[i]));
+            state[i] = SKIP;
+            checked[i] = 1;
+            count++;
+        }
+
+        for (i = 0; i < n && !running; i++) {
+            running = state[i] == PENDING;
+        }
+        if (running)
+            usleep(10000);
+    } while (running);
+
+    NOTICE("%s(): checked %d filesystems in %lld ms\n", __func__, count,
+           (long long) (gettime_ms() - start));
+
+out:
+    free(state);
+    free(pids);
+    free(devs);
+    free(starts);
+}
+
+struct verity_setup {
+    struct fstab_rec *rec;
+    int *result;
+    int64_t start;
+    pthread_t thread;
+};
+
+static void *setup_verity_thread(void *arg)
+{
+    struct verity_setup *setup = arg;
+    struct fstab_rec *rec = setup->rec;
+
+    /* The same preparation as fs_mgr_mount_all(), which is then a no-op there. */
+    if ((!strcmp(rec->fs_type, "ext2") || !strcmp(rec->fs_type, "ext3") ||
+         !strcmp(rec->fs_type, "ext4")) && translate_ext_labels(rec) < 0) {
+        return NULL;
+    }
+    if (rec->fs_mgr_flags & MF_WAIT) {
+        wait_for_file(rec->blk_device, WAIT_TIMEOUT);
+    }
+
+    *setup->result = fs_mgr_setup_verity(rec);
+    NOTICE("%s(): set up verity for %s in %lld ms\n", __func__, rec->mount_point,
+           (long long) (gettime_ms() - setup->start));
+    return NULL;
+}
+
+/*
+ * Sets up dm-verity for the verified entries that fs_mgr_mount_all() is
+ * about to mount, one thread each, so that reading the metadata, checking
+ * its signature and waiting for the dm device nodes overlap.  The result of
+ * fs_mgr_setup_verity() for entry i goes to results[i], which otherwise is
+ * left at VERITY_NOT_SET_UP.
+ */
+static void setup_verity_parallel(struct fstab *fstab, int *results)
+{
+    struct verity_setup *setups = calloc(fstab->num_entries, sizeof(*setups));
+    int64_t start = gettime_ms();
+    int count = 0;
+    int i;
+
+    if (!setups) {
+        ERROR("%s(): out of memory, setting up verity serially\n", __func__);
+        return;
+    }
+
+    for (i = 0; i < fstab->num_entries; i++) {
+        struct fstab_rec *rec = &fstab->recs[i];
+
+        if (!(rec->fs_mgr_flags & MF_VERIFY) ||
+            (rec->fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)))
+            continue;
+
+        setups[i].rec = rec;
+        setups[i].result = &results[i];
+        setups[i].start = gettime_ms();
+        if (pthread_create(&setups[i].thread, NULL, setup_verity_thread, &setups[i])) {
+            ERROR("%s(): pthread_create failed, setting up %s in place\n", __func__,
+                  rec->mount_point);
+            setup_verity_thread(&setups[i]);
+            setups[i].rec = NULL;
+        }
+        count++;
+    }
+
+    for (i = 0; i < fstab->num_entries; i++) {
+        if (setups[i].rec) {
+            pthread_join(setups[i].thread, NULL);
+        }
+    }
+
+    NOTICE("%s(): set up verity for %d partitions in %lld ms\n", __func__, count,
+           (long long) (gettime_ms() - start));
+    free(setups);
+}
+
 // Check to see if a mountable volume has encryption requirements
 static int handle_encryptable(struct fstab *fstab, const struct fstab_rec* rec)
 {
@@ -632,11 +883,30 @@ int fs_mgr_mount_all(struct fstab *fstab)
     int mret = -1;
     int mount_errno = 0;
     int attempted_idx = -1;
+    char *checked = NULL;
+    int *verity_results = NULL;
 
     if (!fstab) {
         return -1;
     }
 
+    if (parallel_enabled(PARALLEL_VERITY_PROP) && device_is_secure()) {
+        verity_results = malloc(fstab->num_entries * sizeof(*verity_results));
+        if (verity_results) {
+            for (i = 0; i < fstab->num_entries; i++) {
+                verity_results[i] = VERITY_NOT_SET_UP;
+            }
+            setup_verity_parallel(fstab, verity_results);
+        }
+    }
+
+    if (parallel_enabled(PARALLEL_CHECK_PROP)) {
+        checked = calloc(fstab->num_entries, 1);
+        if (checked) {
+            check_fs_parallel(fstab, checked);
+        }
+    }
+
     for (i = 0; i < fstab->num_entries; i++) {
         /* Don't mount entries that are managed by vold */
         if (fstab->recs[i].fs_mgr_flags & (MF_VOLDMANAGED | MF_RECOVERYONLY)) {
@@ -666,7 +936,8 @@ int fs_mgr_mount_all(struct fstab *fstab)
         }
 
         if ((fstab->recs[i].fs_mgr_flags & MF_VERIFY) && device_is_secure()) {
-            int rc = fs_mgr_setup_verity(&fstab->recs[i]);
+            int rc = verity_results && verity_results[i] != VERITY_NOT_SET_UP ?
+                    verity_results[i] : fs_mgr_setup_verity(&fstab->recs[i]);
             if (device_is_debuggable() && rc == FS_MGR_SETUP_VERITY_DISABLED) {
                 INFO("Verity disabled");
             } else if (rc != FS_MGR_SETUP_VERITY_SUCCESS) {
@@ -677,7 +948,7 @@ int fs_mgr_mount_all(struct fstab *fstab)
         int last_idx_inspected;
         int top_idx = i;
 
-        mret = mount_with_alternatives(fstab, i, &last_idx_inspected, &attempted_idx);
+        mret = mount_with_alternatives(fstab, i, &last_idx_inspected, &attempted_idx, checked);
         i = last_idx_inspected;
         mount_errno = errno;
 
@@ -687,6 +958,8 @@ int fs_mgr_mount_all(struct fstab *fstab)
 
             if (status == FS_MGR_MNTALL_FAIL) {
                 /* Fatal error - no point continuing */
+                free(checked);
+                free(verity_results);
                 return status;
             }
 
@@ -768,6 +1041,9 @@ int fs_mgr_mount_all(struct fstab *fstab)
         }
     }
 
+    free(checked);
+    free(verity_results);
+
     if (error_count) {
         return -1;
     } else {
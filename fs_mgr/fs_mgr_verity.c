@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <time.h>
 
 #include <private/android_filesystem_config.h>
@@ -112,6 +113,51 @@ static RSAPublicKey *load_key(char *path)
     return key;
 }
 
+/*
+ * The key, the device mapper control fd and whether the last boot was
+ * restarted by dm-verity are the same for every verified partition, so
+ * they are looked up once and shared, also by the threads that
+ * fs_mgr_mount_all() may set up several partitions with.
+ */
+static RSAPublicKey *verity_key;
+static pthread_once_t verity_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t dm_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static int dm_fd = -1;
+
+static int verity_restart;
+static pthread_once_t verity_restart_once = PTHREAD_ONCE_INIT;
+
+/* Serializes the accesses to the verity state in the metadata partition. */
+static pthread_mutex_t verity_state_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void load_verity_key(void)
+{
+    verity_key = load_key(VERITY_TABLE_RSA_KEY);
+}
+
+static RSAPublicKey *get_verity_key(void)
+{
+    pthread_once(&verity_key_once, load_verity_key);
+    return verity_key;
+}
+
+static int get_dm_fd(void)
+{
+    int fd;
+
+    pthread_mutex_lock(&dm_fd_lock);
+    if (dm_fd == -1) {
+        dm_fd = TEMP_FAILURE_RETRY(open("/dev/device-mapper", O_RDWR | O_CLOEXEC));
+        if (dm_fd == -1) {
+            ERROR("Error opening device mapper (%s)\n", strerror(errno));
+        }
+    }
+    fd = dm_fd;
+    pthread_mutex_unlock(&dm_fd_lock);
+    return fd;
+}
+
 static int verify_table(char *signature, char *table, int table_length)
 {
     RSAPublicKey *key;
@@ -122,7 +168,7 @@ static int verify_table(char *signature, char *table, int table_length)
     SHA256_hash((uint8_t*)table, table_length, hash_buf);
 
     // Now get the public key from the keyfile
-    key = load_key(VERITY_TABLE_RSA_KEY);
+    key = get_verity_key();
     if (!key) {
         ERROR("Couldn't load verity keys");
         goto out;
@@ -141,8 +187,6 @@ static int verify_table(char *signature, char *table, int table_length)
     retval = 0;
 
 out:
-    if (key)
-        free(key);
     return retval;
 }
 
@@ -236,6 +280,10 @@ static int get_fs_size(char *fs_type, char *blk_device, uint64_t *device_size) {
     return 0;
 }
 
+/*
+ * The metadata block is read with a single pread and then parsed in memory.
+ * If table is NULL, only the signature is returned.
+ */
 static int read_verity_metadata(uint64_t device_size, char *block_device, char **signature,
         char **table)
 {
@@ -244,8 +292,11 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
     int protocol_version;
     int device;
     int retval = FS_MGR_SETUP_VERITY_FAIL;
-    RSAPublicKey *key = NULL;
-    int sig_len = 0;
+    RSAPublicKey *key;
+    char *metadata = NULL;
+    size_t offset = 0;
+    size_t sig_len;
+    ssize_t size;
 
     *signature = NULL;
 
@@ -259,18 +310,22 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
         goto out;
     }
 
-    if (TEMP_FAILURE_RETRY(lseek64(device, device_size, SEEK_SET)) < 0) {
-        ERROR("Could not seek to start of verity metadata block.\n");
+    metadata = malloc(VERITY_METADATA_SIZE);
+    if (!metadata) {
+        ERROR("Couldn't allocate memory for verity metadata!\n");
         goto out;
     }
 
-    // check the magic number
-    if (TEMP_FAILURE_RETRY(read(device, &magic_number, sizeof(magic_number))) !=
-            sizeof(magic_number)) {
-        ERROR("Couldn't read magic number!\n");
+    size = TEMP_FAILURE_RETRY(pread64(device, metadata, VERITY_METADATA_SIZE, device_size));
+    if (size < (ssize_t) (sizeof(magic_number) + sizeof(protocol_version))) {
+        ERROR("Couldn't read verity metadata at offset %"PRIu64"!\n", device_size);
         goto out;
     }
 
+    // check the magic number
+    memcpy(&magic_number, metadata + offset, sizeof(magic_number));
+    offset += sizeof(magic_number);
+
 #ifdef ALLOW_ADBD_DISABLE_VERITY
     if (magic_number == VERITY_METADATA_MAGIC_DISABLE) {
         retval = FS_MGR_SETUP_VERITY_DISABLED;
@@ -285,30 +340,33 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
     }
 
     // check the protocol version
-    if (TEMP_FAILURE_RETRY(read(device, &protocol_version,
-            sizeof(protocol_version))) != sizeof(protocol_version)) {
-        ERROR("Couldn't read verity metadata protocol version!\n");
-        goto out;
-    }
+    memcpy(&protocol_version, metadata + offset, sizeof(protocol_version));
+    offset += sizeof(protocol_version);
     if (protocol_version != 0) {
         ERROR("Got unknown verity metadata protocol version %d!\n", protocol_version);
         goto out;
     }
 
-    /* We load key here once for getting key length */
-    key = load_key(VERITY_TABLE_RSA_KEY);
+    /* The signature is as long as the key */
+    key = get_verity_key();
+    if (!key) {
+        ERROR("Couldn't load verity keys\n");
+        goto out;
+    }
     sig_len = key->len * sizeof(uint32_t);
 
     // get the signature
+    if (sig_len > size - offset) {
+        ERROR("Couldn't read signature from verity metadata!\n");
+        goto out;
+    }
     *signature = (char*) malloc(sig_len);
     if (!*signature) {
         ERROR("Couldn't allocate memory for signature!\n");
         goto out;
     }
-    if (TEMP_FAILURE_RETRY(read(device, *signature, sig_len)) != sig_len) {
-        ERROR("Couldn't read signature from verity metadata!\n");
-        goto out;
-    }
+    memcpy(*signature, metadata + offset, sig_len);
+    offset += sig_len;
 
     if (!table) {
         retval = FS_MGR_SETUP_VERITY_SUCCESS;
@@ -316,23 +374,24 @@ static int read_verity_metadata(uint64_t device_size, char *block_device, char *
     }
 
     // get the size of the table
-    if (TEMP_FAILURE_RETRY(read(device, &table_length, sizeof(table_length))) !=
-            sizeof(table_length)) {
+    if (sizeof(table_length) > size - offset) {
         ERROR("Couldn't get the size of the verity table from metadata!\n");
         goto out;
     }
+    memcpy(&table_length, metadata + offset, sizeof(table_length));
+    offset += sizeof(table_length);
 
     // get the table + null terminator
+    if (table_length > size - offset) {
+        ERROR("Couldn't read the verity table from metadata!\n");
+        goto out;
+    }
     *table = malloc(table_length + 1);
     if (!*table) {
         ERROR("Couldn't allocate memory for verity table!\n");
         goto out;
     }
-    if (TEMP_FAILURE_RETRY(read(device, *table, table_length)) !=
-            (ssize_t)table_length) {
-        ERROR("Couldn't read the verity table from metadata!\n");
-        goto out;
-    }
+    memcpy(*table, metadata + offset, table_length);
 
     (*table)[table_length] = 0;
     retval = FS_MGR_SETUP_VERITY_SUCCESS;
@@ -341,8 +400,7 @@ out:
     if (device != -1)
         close(device);
 
-    if (key)
-        free(key);
+    free(metadata);
 
     if (retval != FS_MGR_SETUP_VERITY_SUCCESS) {
         free(*signature);
@@ -517,7 +575,7 @@ out:
     return rc;
 }
 
-static int was_verity_restart()
+static void check_verity_restarts(void)
 {
     static const char *files[] = {
         "/sys/fs/pstore/console-ramoops",
@@ -528,11 +586,16 @@ static int was_verity_restart()
 
     for (i = 0; files[i]; ++i) {
         if (check_verity_restart(files[i])) {
-            return 1;
+            verity_restart = 1;
+            return;
         }
     }
+}
 
-    return 0;
+static int was_verity_restart()
+{
+    pthread_once(&verity_restart_once, check_verity_restarts);
+    return verity_restart;
 }
 
 static int metadata_add(FILE *fp, long start, const char *tag,
@@ -717,10 +780,14 @@ out:
     return rc;
 }
 
-static int compare_last_signature(struct fstab_rec *fstab, int *match)
+/*
+ * If signature is NULL, it is read from the verity metadata of the
+ * partition.
+ */
+static int compare_last_signature(struct fstab_rec *fstab, const char *signature, int *match)
 {
     char tag[METADATA_TAG_MAX_LENGTH + 1];
-    char *signature = NULL;
+    char *read_signature = NULL;
     int fd = -1;
     int rc = -1;
     uint8_t curr[SHA256_DIGEST_SIZE];
@@ -730,15 +797,18 @@ static int compare_last_signature(struct fstab_rec *fstab, int *match)
 
     *match = 1;
 
-    // get verity filesystem size
-    if (get_fs_size(fstab->fs_type, fstab->blk_device, &device_size) < 0) {
-        ERROR("Failed to get filesystem size\n");
-        goto out;
-    }
+    if (!signature) {
+        // get verity filesystem size
+        if (get_fs_size(fstab->fs_type, fstab->blk_device, &device_size) < 0) {
+            ERROR("Failed to get filesystem size\n");
+            goto out;
+        }
 
-    if (read_verity_metadata(device_size, fstab->blk_device, &signature, NULL) < 0) {
-        ERROR("Failed to read verity signature from %s\n", fstab->mount_point);
-        goto out;
+        if (read_verity_metadata(device_size, fstab->blk_device, &read_signature, NULL) < 0) {
+            ERROR("Failed to read verity signature from %s\n", fstab->mount_point);
+            goto out;
+        }
+        signature = read_signature;
     }
 
     SHA256_hash(signature, RSANUMBYTES, curr);
@@ -783,7 +853,7 @@ static int compare_last_signature(struct fstab_rec *fstab, int *match)
     rc = 0;
 
 out:
-    free(signature);
+    free(read_signature);
 
     if (fd != -1) {
         close(fd);
@@ -806,7 +876,11 @@ static int get_verity_state_offset(struct fstab_rec *fstab, off64_t *offset)
                 offset);
 }
 
-static int load_verity_state(struct fstab_rec *fstab, int *mode)
+/*
+ * signature, if not NULL, is the signature in the verity metadata of the
+ * partition, which the caller already has.
+ */
+static int load_verity_state(struct fstab_rec *fstab, const char *signature, int *mode)
 {
     char propbuf[PROPERTY_VALUE_MAX];
     int match = 0;
@@ -840,7 +914,7 @@ static int load_verity_state(struct fstab_rec *fstab, int *mode)
         return write_verity_state(fstab->verity_loc, offset, *mode);
     }
 
-    if (!compare_last_signature(fstab, &match) && !match) {
+    if (!compare_last_signature(fstab, signature, &match) && !match) {
         /* partition has been reflashed, reset dm-verity state */
         *mode = VERITY_MODE_DEFAULT;
         return write_verity_state(fstab->verity_loc, offset, *mode);
@@ -877,7 +951,7 @@ int fs_mgr_load_verity_state(int *mode)
             continue;
         }
 
-        rc = load_verity_state(&fstab->recs[i], &current);
+        rc = load_verity_state(&fstab->recs[i], NULL, &current);
         if (rc < 0) {
             continue;
         }
@@ -923,10 +997,9 @@ int fs_mgr_update_verity_state(fs_mgr_verity_state_callback callback)
         use_state = false; /* state is kept by the bootloader */
     }
 
-    fd = TEMP_FAILURE_RETRY(open("/dev/device-mapper", O_RDWR | O_CLOEXEC));
+    fd = get_dm_fd();
 
     if (fd == -1) {
-        ERROR("Error opening device mapper (%s)\n", strerror(errno));
         goto out;
     }
 
@@ -982,10 +1055,6 @@ out:
         fs_mgr_free_fstab(fstab);
     }
 
-    if (fd) {
-        close(fd);
-    }
-
     return rc;
 }
 
@@ -1028,8 +1097,7 @@ int fs_mgr_setup_verity(struct fstab_rec *fstab) {
     verity_table_length = strlen(verity_table);
 
     // get the device mapper fd
-    if ((fd = open("/dev/device-mapper", O_RDWR)) < 0) {
-        ERROR("Error opening device mapper (%s)", strerror(errno));
+    if ((fd = get_dm_fd()) < 0) {
         goto out;
     }
 
@@ -1045,13 +1113,15 @@ int fs_mgr_setup_verity(struct fstab_rec *fstab) {
         goto out;
     }
 
-    if (load_verity_state(fstab, &mode) < 0) {
+    pthread_mutex_lock(&verity_state_lock);
+    if (load_verity_state(fstab, verity_table_signature, &mode) < 0) {
         /* if accessing or updating the state failed, switch to the default
          * safe mode. This makes sure the device won't end up in an endless
          * restart loop, and no corrupted data will be exposed to userspace
          * without a warning. */
         mode = VERITY_MODE_EIO;
     }
+    pthread_mutex_unlock(&verity_state_lock);
 
     // verify the signature on the table
     if (verify_table(verity_table_signature,
@@ -1098,10 +1168,6 @@ int fs_mgr_setup_verity(struct fstab_rec *fstab) {
     retval = FS_MGR_SETUP_VERITY_SUCCESS;
 
 out:
-    if (fd != -1) {
-        close(fd);
-    }
-
     free(verity_table);
     free(verity_table_signature);
     free(verity_blk_name);
@@ -24,6 +24,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <unordered_map>
+
 #include <cutils/log.h>
 #include <utils/Log.h>
 
@@ -80,10 +82,15 @@ public:
         int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
         if (fd < 0) {
             ALOGE("could not open file: %s: %s", filename, strerror(errno));
+            sid_cache.erase(uid);
             return;
         }
         write(fd, &sid, sizeof(sid));
         close(fd);
+
+        sid_entry_t &entry = sid_cache[uid];
+        entry.sid = sid;
+        entry.stored = true;
     }
 
     bool mark_cold_boot() {
@@ -101,22 +108,13 @@ public:
     }
 
     void maybe_store_sid(uint32_t uid, uint64_t sid) {
-        char filename[21];
-        sprintf(filename, "%u", uid);
-        if (access(filename, F_OK) == -1) {
+        if (!load_sid(uid).stored) {
             store_sid(uid, sid);
         }
     }
 
     uint64_t read_sid(uint32_t uid) {
-        char filename[21];
-        uint64_t sid;
-        sprintf(filename, "%u", uid);
-        int fd = open(filename, O_RDONLY);
-        if (fd < 0) return 0;
-        read(fd, &sid, sizeof(sid));
-        close(fd);
-        return sid;
+        return load_sid(uid).sid;
     }
 
     void clear_sid(uint32_t uid) {
@@ -125,7 +123,11 @@ public:
         if (remove(filename) < 0) {
             ALOGE("%s: could not remove file [%s], attempting 0 write", __func__, strerror(errno));
             store_sid(uid, 0);
+            return;
         }
+        sid_entry_t &entry = sid_cache[uid];
+        entry.sid = 0;
+        entry.stored = false;
     }
 
     virtual int enroll(uint32_t uid,
@@ -241,10 +243,7 @@ public:
         }
 
         if (ret == 0 && *auth_token != NULL && *auth_token_length > 0) {
-            // TODO: cache service?
-            sp<IServiceManager> sm = defaultServiceManager();
-            sp<IBinder> binder = sm->getService(String16("android.security.keystore"));
-            sp<IKeystoreService> service = interface_cast<IKeystoreService>(binder);
+            sp<IKeystoreService> service = get_keystore();
             if (service != NULL) {
                 status_t ret = service->addAuthToken(*auth_token, *auth_token_length);
                 if (ret != ResponseCode::NO_ERROR) {
@@ -316,6 +315,46 @@ public:
     }
 
 private:
+    // What the sid file of a uid holds. Only gatekeeperd touches these files,
+    // so once read they are answered from here, saving the open (or access)
+    // on every verify and every getSecureUserId. Binder transactions are
+    // handled on a single thread, see main(), so the cache needs no lock.
+    struct sid_entry_t {
+        uint64_t sid;
+        bool stored;    // the file exists
+    };
+
+    const sid_entry_t &load_sid(uint32_t uid) {
+        std::unordered_map<uint32_t, sid_entry_t>::iterator it = sid_cache.find(uid);
+        if (it != sid_cache.end()) return it->second;
+
+        char filename[21];
+        sid_entry_t &entry = sid_cache[uid];
+        entry.sid = 0;
+        entry.stored = false;
+        sprintf(filename, "%u", uid);
+        int fd = open(filename, O_RDONLY);
+        if (fd >= 0) {
+            uint64_t sid;
+            if (read(fd, &sid, sizeof(sid)) == sizeof(sid)) entry.sid = sid;
+            entry.stored = true;
+            close(fd);
+        }
+        return entry;
+    }
+
+    // Keystore is looked up once rather than on every successful verify,
+    // and again only if it has died since.
+    sp<IKeystoreService> get_keystore() {
+        if (keystore_binder == NULL || !keystore_binder->isBinderAlive()) {
+            sp<IServiceManager> sm = defaultServiceManager();
+            keystore_binder = sm->getService(String16("android.security.keystore"));
+        }
+        return interface_cast<IKeystoreService>(keystore_binder);
+    }
+
+    std::unordered_map<uint32_t, sid_entry_t> sid_cache;
+    sp<IBinder> keystore_binder;
     gatekeeper_device_t *device;
     UniquePtr<SoftGateKeeperDevice> soft_device;
     const hw_module_t *module;
@@ -99,18 +99,41 @@ int BatteryMonitor::getBatteryHealth(const char* status) {
     return ret;
 }
 
+int BatteryMonitor::openSysfsFile(const String8& path) {
+    ssize_t index = mSysfsFds.indexOfKey(path);
+    if (index >= 0)
+        return mSysfsFds.valueAt(index);
+
+    int fd = open(path.string(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1) {
+        KLOG_ERROR(LOG_TAG, "Could not open '%s'\n", path.string());
+        return -1;
+    }
+    mSysfsFds.add(path, fd);
+    return fd;
+}
+
+// The attributes are kept open and read again from offset 0, which makes
+// sysfs produce a fresh value, rather than opened and closed on every
+// update.  If the read fails, for instance because the supply went away
+// and came back, the attribute is opened again once.
 int BatteryMonitor::readFromFile(const String8& path, char* buf, size_t size) {
     char *cp = NULL;
 
     if (path.isEmpty())
         return -1;
-    int fd = open(path.string(), O_RDONLY, 0);
-    if (fd == -1) {
-        KLOG_ERROR(LOG_TAG, "Could not open '%s'\n", path.string());
+    int fd = openSysfsFile(path);
+    if (fd == -1)
         return -1;
-    }
 
-    ssize_t count = TEMP_FAILURE_RETRY(read(fd, buf, size));
+    ssize_t count = TEMP_FAILURE_RETRY(pread(fd, buf, size, 0));
+    if (count < 0) {
+        close(fd);
+        mSysfsFds.removeItem(path);
+        fd = openSysfsFile(path);
+        if (fd != -1)
+            count = TEMP_FAILURE_RETRY(pread(fd, buf, size, 0));
+    }
     if (count > 0)
             cp = (char *)memrchr(buf, '\n', count);
 
@@ -119,7 +142,6 @@ int BatteryMonitor::readFromFile(const String8& path, char* buf, size_t size) {
     else
         buf[0] = '\0';
 
-    close(fd);
     return count;
 }
 
@@ -224,17 +246,12 @@ bool BatteryMonitor::update(void) {
 
     unsigned int i;
 
-    for (i = 0; i < mChargerNames.size(); i++) {
-        String8 path;
-        path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH,
-                          mChargerNames[i].string());
+    for (i = 0; i < mChargers.size(); i++) {
+        const Charger& charger = mChargers[i];
 
-        if (readFromFile(path, buf, SIZE) > 0) {
+        if (readFromFile(charger.onlinePath, buf, SIZE) > 0) {
             if (buf[0] != '0') {
-                path.clear();
-                path.appendFormat("%s/%s/type", POWER_SUPPLY_SYSFS_PATH,
-                                  mChargerNames[i].string());
-                switch(readPowerSupplyType(path)) {
+                switch(readPowerSupplyType(charger.typePath)) {
                 case ANDROID_POWER_SUPPLY_TYPE_AC:
                     props.chargerAcOnline = true;
                     break;
@@ -246,13 +263,10 @@ bool BatteryMonitor::update(void) {
                     break;
                 default:
                     KLOG_WARNING(LOG_TAG, "%s: Unknown power supply type\n",
-                                 mChargerNames[i].string());
+                                 charger.name.string());
                 }
-                path.clear();
-                path.appendFormat("%s/%s/current_max", POWER_SUPPLY_SYSFS_PATH,
-                                  mChargerNames[i].string());
-                if (access(path.string(), R_OK) == 0) {
-                    int maxChargingCurrent = getIntField(path);
+                if (!charger.currentMaxPath.isEmpty()) {
+                    int maxChargingCurrent = getIntField(charger.currentMaxPath);
                     if (props.maxChargingCurrent < maxChargingCurrent) {
                         props.maxChargingCurrent = maxChargingCurrent;
                     }
@@ -442,8 +456,19 @@ void BatteryMonitor::init(struct healthd_config *hc) {
             case ANDROID_POWER_SUPPLY_TYPE_WIRELESS:
                 path.clear();
                 path.appendFormat("%s/%s/online", POWER_SUPPLY_SYSFS_PATH, name);
-                if (access(path.string(), R_OK) == 0)
-                    mChargerNames.add(String8(name));
+                if (access(path.string(), R_OK) == 0) {
+                    Charger charger;
+                    charger.name = String8(name);
+                    charger.onlinePath = path;
+                    charger.typePath.appendFormat("%s/%s/type",
+                                                  POWER_SUPPLY_SYSFS_PATH, name);
+                    path.clear();
+                    path.appendFormat("%s/%s/current_max",
+                                      POWER_SUPPLY_SYSFS_PATH, name);
+                    if (access(path.string(), R_OK) == 0)
+                        charger.currentMaxPath = path;
+                    mChargers.add(charger);
+                }
                 break;
 
             case ANDROID_POWER_SUPPLY_TYPE_BATTERY:
@@ -552,10 +577,16 @@ void BatteryMonitor::init(struct healthd_config *hc) {
         closedir(dir);
     }
 
+    // Only the attributes that update() reads need to stay open; those are
+    // opened again on the first update.
+    for (size_t i = 0; i < mSysfsFds.size(); i++)
+        close(mSysfsFds.valueAt(i));
+    mSysfsFds.clear();
+
     // This indicates that there is no charger driver registered.
     // Typically the case for devices which do not have a battery and
     // and are always plugged into AC mains.
-    if (!mChargerNames.size()) {
+    if (!mChargers.size()) {
         KLOG_ERROR(LOG_TAG, "No charger supplies found\n");
         mBatteryFixedCapacity = ALWAYS_PLUGGED_CAPACITY;
         mBatteryFixedTemperature = FAKE_BATTERY_TEMPERATURE;
@@ -19,6 +19,7 @@
 
 #include <batteryservice/BatteryService.h>
 #include <binder/IInterface.h>
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
@@ -43,8 +44,17 @@ class BatteryMonitor {
     void dumpState(int fd);
 
   private:
+    struct Charger {
+        String8 name;
+        String8 onlinePath;
+        String8 typePath;
+        String8 currentMaxPath;
+    };
+
     struct healthd_config *mHealthdConfig;
-    Vector<String8> mChargerNames;
+    Vector<Charger> mChargers;
+    // Open sysfs attributes, by path; see readFromFile().
+    KeyedVector<String8, int> mSysfsFds;
     bool mBatteryDevicePresent;
     bool mAlwaysPluggedDevice;
     int mBatteryFixedCapacity;
@@ -53,6 +63,7 @@ class BatteryMonitor {
 
     int getBatteryStatus(const char* status);
     int getBatteryHealth(const char* status);
+    int openSysfsFile(const String8& path);
     int readFromFile(const String8& path, char* buf, size_t size);
     PowerSupplyType readPowerSupplyType(const String8& path);
     bool getBooleanField(const String8& path);
@@ -31,6 +31,7 @@
 #include <cutils/uevent.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <utils/Errors.h>
 
 using namespace android;
@@ -74,6 +75,15 @@ static int wakealarm_wake_interval = DEFAULT_PERIODIC_CHORES_INTERVAL_FAST;
 
 static BatteryMonitor* gBatteryMonitor;
 
+// Plugging or unplugging a charger sends a burst of power_supply uevents,
+// one or more per supply; one update after the first of them has settled
+// covers the whole burst.
+#define UEVENT_COALESCE_MS 100
+#define MSEC_PER_SEC (1000LL)
+#define NSEC_PER_MSEC (1000000LL)
+static bool uevent_update_pending;
+static int64_t uevent_update_deadline;
+
 struct healthd_mode_ops *healthd_mode_ops;
 
 // Android mode
@@ -173,7 +183,16 @@ status_t healthd_get_property(int id, struct BatteryProperty *val) {
     return gBatteryMonitor->getProperty(id, val);
 }
 
+static int64_t curr_time_ms(void) {
+    struct timespec tm;
+    clock_gettime(CLOCK_MONOTONIC, &tm);
+    return tm.tv_sec * MSEC_PER_SEC + (tm.tv_nsec / NSEC_PER_MSEC);
+}
+
 void healthd_battery_update(void) {
+    // Whatever uevents were pending are covered by this update.
+    uevent_update_pending = false;
+
     // Fast wake interval when on charger (watch for overheat);
     // slow wake interval when on battery (watch for drained battery).
 
@@ -212,25 +231,28 @@ static void uevent_event(uint32_t /*epevents*/) {
     char *cp;
     int n;
 
-    n = uevent_kernel_multicast_recv(uevent_fd, msg, UEVENT_MSG_LEN);
-    if (n <= 0)
-        return;
-    if (n >= UEVENT_MSG_LEN)   /* overflow -- discard */
-        return;
-
-    msg[n] = '\0';
-    msg[n+1] = '\0';
-    cp = msg;
+    // Drains the socket, so that a burst costs one wakeup of the main loop.
+    while ((n = uevent_kernel_multicast_recv(uevent_fd, msg, UEVENT_MSG_LEN)) > 0) {
+        if (n >= UEVENT_MSG_LEN)   /* overflow -- discard */
+            continue;
+
+        msg[n] = '\0';
+        msg[n+1] = '\0';
+        cp = msg;
+
+        while (*cp) {
+            if (!strcmp(cp, "SUBSYSTEM=" POWER_SUPPLY_SUBSYSTEM)) {
+                if (!uevent_update_pending) {
+                    uevent_update_pending = true;
+                    uevent_update_deadline = curr_time_ms() + UEVENT_COALESCE_MS;
+                }
+                break;
+            }
 
-    while (*cp) {
-        if (!strcmp(cp, "SUBSYSTEM=" POWER_SUPPLY_SUBSYSTEM)) {
-            healthd_battery_update();
-            break;
+            /* advance to after the next \0 */
+            while (*cp++)
+                ;
         }
-
-        /* advance to after the next \0 */
-        while (*cp++)
-            ;
     }
 }
 
@@ -283,6 +305,13 @@ static void healthd_mainloop(void) {
         mode_timeout = healthd_mode_ops->preparetowait();
         if (timeout < 0 || (mode_timeout > 0 && mode_timeout < timeout))
             timeout = mode_timeout;
+        if (uevent_update_pending) {
+            int64_t remaining = uevent_update_deadline - curr_time_ms();
+            if (remaining < 0)
+                remaining = 0;
+            if (timeout < 0 || remaining < timeout)
+                timeout = remaining;
+        }
         nevents = epoll_wait(epollfd, events, eventct, timeout);
 
         if (nevents == -1) {
@@ -297,8 +326,12 @@ static void healthd_mainloop(void) {
                 (*(void (*)(int))events[n].data.ptr)(events[n].events);
         }
 
-        if (!nevents)
+        if (uevent_update_pending) {
+            if (curr_time_ms() >= uevent_update_deadline)
+                healthd_battery_update();
+        } else if (!nevents) {
             periodic_chores();
+        }
 
         healthd_mode_ops->heartbeat();
     }
@@ -105,6 +105,13 @@ struct animation {
     int capacity;
 };
 
+struct rect {
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
 struct charger {
     bool have_battery_state;
     bool charger_connected;
@@ -117,6 +124,13 @@ struct charger {
     struct animation *batt_anim;
     GRSurface* surf_unknown;
     int boot_min_cap;
+
+    /* What the display shows, so that a redraw only touches what changed.
+     * The framebuffer may be double buffered, so the areas drawn by the last
+     * two flips are kept: the back buffer holds the older one. */
+    GRSurface* surf_shown;
+    int full_clears;
+    struct rect drawn[2];
 };
 
 static struct frame batt_anim_frames[] = {
@@ -189,6 +203,21 @@ static void clear_screen(void)
     gr_clear();
 }
 
+static void clear_rect(const struct rect *r)
+{
+    if (r->w <= 0 || r->h <= 0)
+        return;
+    gr_color(0, 0, 0, 255);
+    gr_fill(r->x, r->y, r->x + r->w, r->y + r->h);
+}
+
+/* forget what is on the screen; the next redraw starts from scratch */
+static void invalidate_screen(struct charger *charger)
+{
+    charger->surf_shown = NULL;
+    charger->full_clears = 2;
+}
+
 #define MAX_KLOG_WRITE_BUF_SZ 256
 
 static void dump_last_kmsg(void)
@@ -274,7 +303,7 @@ static void android_green(void)
 }
 
 /* returns the last y-offset of where the surface ends */
-static int draw_surface_centered(struct charger* /*charger*/, GRSurface* surface)
+static int draw_surface_centered(struct charger* charger, GRSurface* surface)
 {
     int w;
     int h;
@@ -288,6 +317,12 @@ static int draw_surface_centered(struct charger* /*charger*/, GRSurface* surface
 
     LOGV("drawing surface %dx%d+%d+%d\n", w, h, x, y);
     gr_blit(surface, 0, 0, w, h, x, y);
+
+    charger->drawn[0] = charger->drawn[1];
+    charger->drawn[1].x = x;
+    charger->drawn[1].y = y;
+    charger->drawn[1].w = w;
+    charger->drawn[1].h = h;
     return y + h;
 }
 
@@ -319,15 +354,39 @@ static void draw_battery(struct charger *charger)
 static void redraw_screen(struct charger *charger)
 {
     struct animation *batt_anim = charger->batt_anim;
+    bool unknown = batt_anim->capacity < 0 || batt_anim->num_frames == 0;
+    GRSurface* surface = unknown ? charger->surf_unknown
+            : batt_anim->frames[batt_anim->cur_frame].surface;
+
+    /* the same picture is up already, leave the display (and CPU) alone */
+    if (surface && surface == charger->surf_shown) {
+        LOGV("frame unchanged, not redrawing\n");
+        return;
+    }
 
-    clear_screen();
+    /* Every buffer is black outside of the area last drawn into it, so only
+     * those areas need clearing; whole screens only after text or a blank. */
+    if (charger->full_clears > 0) {
+        clear_screen();
+        charger->full_clears--;
+    } else {
+        clear_rect(&charger->drawn[0]);
+        clear_rect(&charger->drawn[1]);
+    }
 
     /* try to display *something* */
-    if (batt_anim->capacity < 0 || batt_anim->num_frames == 0)
+    if (unknown)
         draw_unknown(charger);
     else
         draw_battery(charger);
     gr_flip();
+
+    if (surface) {
+        charger->surf_shown = surface;
+    } else {
+        /* text goes wherever it fits: clear both buffers whole next time */
+        invalidate_screen(charger);
+    }
 }
 
 static void kick_animation(struct animation *anim)
@@ -369,6 +428,7 @@ static void update_screen_state(struct charger *charger, int64_t now)
 #ifndef CHARGER_DISABLE_INIT_BLANK
         gr_fb_blank(true);
 #endif
+        invalidate_screen(charger);
         minui_inited = true;
     }
 
@@ -377,6 +437,7 @@ static void update_screen_state(struct charger *charger, int64_t now)
         reset_animation(batt_anim);
         charger->next_screen_transition = -1;
         gr_fb_blank(true);
+        invalidate_screen(charger);
         LOGV("[%" PRId64 "] animation done\n", now);
         if (charger->charger_connected)
             request_suspend(true);
@@ -71,10 +71,23 @@ public:
   // Get the current stack trace and store in the backtrace_ structure.
   virtual bool Unwind(size_t num_ignore_frames, ucontext_t* context = NULL) = 0;
 
+  // Get the current stack trace by following the saved frame pointers
+  // instead of the unwind tables. Only the pc, sp, stack size and map of
+  // each frame are filled in, and the trace ends at the first function
+  // built without a frame pointer. Returns false if frame pointers cannot
+  // be followed for this object, in which case use Unwind().
+  virtual bool UnwindFramePointers(size_t num_ignore_frames);
+
   // Get the function name and offset into the function given the pc.
   // If the string is empty, then no valid function name was found.
   virtual std::string GetFunctionName(uintptr_t pc, uintptr_t* offset);
 
+  // Keep up to entries function names, shared by all Backtrace objects in
+  // this process and keyed by the file they were found in, so that a
+  // long-lived process that unwinds the same libraries again and again
+  // looks each name up only once. The default of 0 disables the cache.
+  static void SetFunctionNameCacheSize(size_t entries);
+
   // Fill in the map data associated with the given pc.
   virtual void FillInMap(uintptr_t pc, backtrace_map_t* map);
 
@@ -29,6 +29,7 @@
 #include <sys/mman.h>
 #endif
 
+#include <atomic>
 #include <deque>
 #include <string>
 
@@ -95,8 +96,13 @@ protected:
 
   virtual bool ParseLine(const char* line, backtrace_map_t* map);
 
+  // Sorted by start address, without overlaps, as in /proc/<pid>/maps.
   std::deque<backtrace_map_t> maps_;
   pid_t pid_;
+
+private:
+  // Index in maps_ of the map found by the last successful FillIn.
+  std::atomic<size_t> last_index_;
 };
 
 #endif // _BACKTRACE_BACKTRACE_MAP_H
@@ -22,6 +22,28 @@ int ashmem_pin_region(int fd, size_t offset, size_t len);
 int ashmem_unpin_region(int fd, size_t offset, size_t len);
 int ashmem_get_size_region(int fd);
 
+/*
+ * A per-process pool of ashmem regions, for callers that create and destroy
+ * many short-lived regions.
+ *
+ * ashmem_pool_create_region() is like ashmem_create_region(), except that
+ * sizes up to 256 pages are rounded up to a power-of-two number of pages, and
+ * that a region released earlier may be handed out again instead of a new
+ * one.  Such a region keeps the name it was created with, and its contents
+ * are undefined: they are zero only if the kernel reclaimed its pages while
+ * it was in the pool.
+ *
+ * ashmem_pool_release_region() takes the place of close().  The caller must
+ * have unmapped the region and must not have shared the file descriptor with
+ * anyone.  Regions that cannot be reused are closed.  Regions in the pool are
+ * unpinned, so the kernel can reclaim their memory under pressure.
+ *
+ * ashmem_pool_trim() closes all regions in the pool.
+ */
+int ashmem_pool_create_region(const char *name, size_t size);
+void ashmem_pool_release_region(int fd);
+void ashmem_pool_trim(void);
+
 #ifdef __cplusplus
 }
 #endif
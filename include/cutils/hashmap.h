@@ -41,6 +41,23 @@ typedef struct Hashmap Hashmap;
 Hashmap* hashmapCreate(size_t initialCapacity,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
 
+/**
+ * Creates a new hash map that can be used from several threads at once.
+ * Returns NULL if memory allocation fails.
+ *
+ * The map is split into segments with a lock each, so threads working on
+ * different keys rarely wait for each other, and every function takes the
+ * locks it needs.  A thread that holds a lock may call into the map again,
+ * so callbacks of hashmapForEach() and hashmapMemoize() can use the map.
+ * hashmapForEach() only locks one segment at a time.
+ *
+ * @param initialCapacity number of expected entries
+ * @param hash function which hashes keys
+ * @param equals function which compares keys for equality
+ */
+Hashmap* hashmapCreateConcurrent(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB));
+
 /**
  * Frees the hash map. Does not free the keys or values themselves.
  */
@@ -107,6 +124,11 @@ void hashmapForEach(Hashmap* map,
 
 /**
  * Locks the hash map so only the current thread can access it.
+ *
+ * The functions of a map created by hashmapCreate() do not lock it
+ * themselves, so all threads must hold the lock while using it.  A map
+ * created by hashmapCreateConcurrent() locks itself; holding its lock makes
+ * a sequence of calls atomic.
  */
 void hashmapLock(Hashmap* map);
 
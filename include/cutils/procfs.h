@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CUTILS_PROCFS_H
+#define __CUTILS_PROCFS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Helpers for tools that snapshot processes from /proc.  Nothing here
+ * allocates: files are read into the caller's buffer and parsed in place.
+ */
+
+/*
+ * Opens /proc/<pid>, or /proc/<pid>/task/<tid> if tid is not 0, as a
+ * directory fd that procfs_read_at can read several files of without
+ * looking up the path again.  Returns -1 with errno set on failure.
+ */
+int procfs_open(pid_t pid, pid_t tid);
+
+/*
+ * Reads the file called name from a directory returned by procfs_open, or
+ * from /proc/<pid>[/task/<tid>], into buf, and terminates it with a NUL.
+ * At most size - 1 bytes are read.  Returns the length or -1 with errno set.
+ */
+ssize_t procfs_read_at(int dirfd, const char *name, char *buf, size_t size);
+ssize_t procfs_read(pid_t pid, pid_t tid, const char *name, char *buf, size_t size);
+
+/* Like procfs_read_at, but from the start of a file that the caller keeps open. */
+ssize_t procfs_pread(int fd, char *buf, size_t size);
+
+/*
+ * Returns the next space-separated field at *cursor, terminated in place,
+ * and moves *cursor past it; "" once there are no more.
+ */
+char *procfs_next_field(char **cursor);
+
+/* The fields of /proc/<pid>/stat that tools use; see proc(5). */
+struct procfs_stat {
+    const char *comm;       /* points into the parsed buffer */
+    char state;
+    pid_t ppid;
+    uint64_t utime;
+    uint64_t stime;
+    int priority;
+    int nice;
+    int num_threads;
+    uint64_t starttime;
+    uint64_t vsize;         /* bytes */
+    uint64_t rss;           /* pages */
+    uintptr_t kstkeip;
+    int processor;
+    unsigned rt_priority;
+    unsigned policy;
+};
+
+/*
+ * Parses the contents of a stat file, modifying buf.  Fields a kernel does
+ * not have are left 0.  Returns 0, or -1 if buf is not a stat line.
+ */
+int procfs_parse_stat(char *buf, struct procfs_stat *stat);
+
+/* Parses the first two fields of statm, in pages.  Returns 0 or -1. */
+int procfs_parse_statm(const char *buf, uint64_t *size, uint64_t *resident);
+
+/*
+ * Finds the "key:" line of a status file and returns its value with the
+ * leading blanks skipped, still followed by the rest of the buffer; NULL
+ * if there is no such line.
+ */
+const char *procfs_status_value(const char *buf, const char *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CUTILS_PROCFS_H */
@@ -103,6 +103,41 @@ int64_t property_get_int64(const char *key, int64_t default_value);
 **/
 int32_t property_get_int32(const char *key, int32_t default_value);
 
+/* cached_property: a handle on one property that is looked up once and
+** read again only when the property has changed, so polling it is cheap.
+** While no property at all has changed, a get costs a single atomic load
+** of the property area serial.
+**
+** Initialize a handle with CACHED_PROPERTY_INITIALIZER(key) or
+** cached_property_init().  The key must outlive the handle.  A handle is
+** not thread-safe; give each thread its own, or lock around it.
+*/
+struct cached_property {
+    const char *key;
+    const prop_info *pi;
+    uint32_t area_serial;
+    uint32_t serial;
+    char value[PROPERTY_VALUE_MAX];
+};
+
+#define CACHED_PROPERTY_INITIALIZER(key) \
+    { (key), NULL, (uint32_t) -1, (uint32_t) -1, { '\0' } }
+
+void cached_property_init(struct cached_property *prop, const char *key);
+
+/* cached_property_get: returns the value of the property, or default_value
+** if it is not set or empty.  The value stays valid until the next call on
+** the same handle.
+*/
+const char *cached_property_get(struct cached_property *prop, const char *default_value);
+
+/* cached_property_get_bool, cached_property_get_int64, cached_property_get_int32:
+** like property_get_bool(), property_get_int64() and property_get_int32().
+*/
+int8_t cached_property_get_bool(struct cached_property *prop, int8_t default_value);
+int64_t cached_property_get_int64(struct cached_property *prop, int64_t default_value);
+int32_t cached_property_get_int32(struct cached_property *prop, int32_t default_value);
+
 /* property_set: returns 0 on success, < 0 on failure
 */
 int property_set(const char *key, const char *value);
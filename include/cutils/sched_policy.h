@@ -17,6 +17,8 @@
 #ifndef __CUTILS_SCHED_POLICY_H
 #define __CUTILS_SCHED_POLICY_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -44,6 +46,23 @@ extern int set_cpuset_policy(int tid, SchedPolicy policy);
  */
 extern int set_sched_policy(int tid, SchedPolicy policy);
 
+/* Assign count threads to the cgroup associated with the specified policy,
+ * as set_sched_policy() does for each of tids, but with less work.
+ * If tgid is not zero, tids must hold every thread of process tgid (for
+ * example as listed in /proc/<tgid>/task); the whole process is then moved
+ * with a single write to the cgroup's cgroup.procs, which also catches
+ * threads started since tids was listed.  Otherwise, or if that write
+ * fails, the threads are moved one by one.
+ * If errors is not NULL, errors[i] receives 0 or -errno for tids[i].
+ * Return value: 0 if every thread was moved, or the first -errno.
+ */
+extern int set_sched_policy_batch(int tgid, const int *tids, size_t count,
+                                  SchedPolicy policy, int *errors);
+
+/* Like set_sched_policy_batch(), for set_cpuset_policy(). */
+extern int set_cpuset_policy_batch(int tgid, const int *tids, size_t count,
+                                   SchedPolicy policy, int *errors);
+
 /* Return the policy associated with the cgroup of thread tid via policy pointer.
  * On platforms which support gettid(), zero tid means current thread.
  * Return value: 0 for success, or -1 for error and set errno.
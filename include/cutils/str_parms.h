@@ -50,6 +50,8 @@ int str_parms_get_int(struct str_parms *str_parms, const char *key,
 int str_parms_get_float(struct str_parms *str_parms, const char *key,
                         float *out_val);
 
+// Returns "key=value;key=value..." with the keys in the order they were first
+// added.  The caller must free() the result.
 char *str_parms_to_str(struct str_parms *str_parms);
 
 /* debug */
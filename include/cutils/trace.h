@@ -108,6 +108,19 @@ void atrace_set_debuggable(bool debuggable);
  */
 void atrace_set_tracing_enabled(bool enabled);
 
+/**
+ * When the debug.atrace.buffer_dir property names a directory, trace events
+ * are not written to the kernel's trace_marker one at a time.  Each thread
+ * records them, with their own CLOCK_MONOTONIC timestamp and thread id, in a
+ * buffer of its own, and appends the buffer to <dir>/atrace-<pid> in one
+ * write when it fills up, when the thread exits, or when the thread calls
+ * this.  Each line is "<timestamp ns> <tid> <trace_marker message>".
+ *
+ * Threads that are about to block for a long time, or a process about to
+ * exit, can call this so that their events are not held back.
+ */
+void atrace_flush();
+
 /**
  * Flag indicating whether setup has been completed, initialized to 0.
  * Nonzero indicates setup has completed.
@@ -185,8 +198,8 @@ static inline void atrace_begin(uint64_t tag, const char* name)
 static inline void atrace_end(uint64_t tag)
 {
     if (CC_UNLIKELY(atrace_is_tag_enabled(tag))) {
-        char c = 'E';
-        write(atrace_marker_fd, &c, 1);
+        void atrace_end_body();
+        atrace_end_body();
     }
 }
 
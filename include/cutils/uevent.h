@@ -29,6 +29,21 @@ ssize_t uevent_kernel_multicast_recv(int socket, void *buffer, size_t length);
 ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length, uid_t *uid);
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid);
 
+#define UEVENT_RECV_BATCH_MAX 32
+
+/*
+ * Like uevent_kernel_recv(), but receives up to 'count' (at most
+ * UEVENT_RECV_BATCH_MAX) messages with a single system call, waiting only
+ * for the first.  Message i goes to the 'length' bytes at buffer + i * length,
+ * and its size to lengths[i].  Each message is checked on its own: one that
+ * does not come from the kernel has its slot cleared and lengths[i] set to -1.
+ * If uids is not NULL, uids[i] is set to the sender's uid, or -1 if unknown.
+ *
+ * Returns the number of messages received, or -1 with errno set.
+ */
+ssize_t uevent_kernel_recv_batch(int socket, void *buffer, size_t length, size_t count,
+                                 ssize_t *lengths, bool require_group, uid_t *uids);
+
 #ifdef __cplusplus
 }
 #endif
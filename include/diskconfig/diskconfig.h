@@ -110,9 +110,16 @@ struct write_list *wlist_add(struct write_list **lst, struct write_list *item);
 void wlist_free(struct write_list *lst);
 int wlist_commit(int fd, struct write_list *lst, int test);
 
+/* Flags for wlist_commit_regions and apply_disk_config_flags. */
+#define WLIST_COMMIT_TEST            0x1   /* only log what would be written */
+#define WLIST_COMMIT_VERIFY          0x2   /* read back the changed sectors */
+
+int wlist_commit_regions(int fd, struct write_list *lst, int sect_size, int flags);
+
 struct disk_info *load_diskconfig(const char *fn, char *path_override);
 int dump_disk_config(struct disk_info *dinfo);
 int apply_disk_config(struct disk_info *dinfo, int test);
+int apply_disk_config_flags(struct disk_info *dinfo, int flags);
 char *find_part_device(struct disk_info *dinfo, const char *name);
 int process_disk_config(struct disk_info *dinfo);
 struct part_info *find_part(struct disk_info *dinfo, const char *name);
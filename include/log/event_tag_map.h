@@ -43,6 +43,15 @@ void android_closeEventTagMap(EventTagMap* map);
  */
 const char* android_lookupEventTag(const EventTagMap* map, int tag);
 
+/*
+ * Generate the binary index android_openEventTagMap() prefers to the map
+ * file, run at build time over EVENT_TAG_MAP_FILE.  The index belongs next
+ * to the file, with ".idx" appended to its name.
+ *
+ * Returns 0 on success.
+ */
+int android_writeEventTagIndex(const char* fileName, const char* indexName);
+
 #ifdef __cplusplus
 }
 #endif
@@ -618,6 +618,29 @@ typedef enum log_id {
  */
 int __android_log_is_loggable(int prio, const char *tag, int def);
 
+/*
+ * Opt the process in to batched writes to logd. Each thread stages its
+ * messages and sends them together once the stage fills, a message
+ * arrives msecs after the oldest one staged, or a fatal or crash buffer
+ * message arrives. Staged messages are otherwise held until the thread
+ * exits or calls __android_log_flush(). A msecs of zero stops batching.
+ * Returns 0, or a negative errno such as -ENOSYS if unsupported.
+ */
+int __android_log_set_batching(unsigned msecs);
+/*
+ * Send any messages staged by the calling thread.
+ */
+int __android_log_flush(void);
+
+/*
+ * Send the process' messages to logd through a shared memory ring of at
+ * least size bytes instead of a datagram per message. Messages fall back
+ * to the socket while the ring is full, or for good should logd go
+ * away. Returns 0, or a negative errno if logd could not be set up to
+ * drain a ring. A forked child needs to open its own.
+ */
+int __android_log_open_ring(size_t size);
+
 int __android_log_error_write(int tag, const char *subTag, int32_t uid, const char *data,
                               uint32_t dataLen);
 
@@ -171,6 +171,10 @@ void android_logger_list_free(struct logger_list *logger_list);
 /* In the purest sense, the following two are orthogonal interfaces */
 int android_logger_list_read(struct logger_list *logger_list,
                              struct log_msg *log_msg);
+/* Up to count entries per call, returns the number read or -errno */
+int android_logger_list_read_batch(struct logger_list *logger_list,
+                                   struct log_msg *log_msgs,
+                                   size_t count);
 
 /* Multiple log_id_t opens */
 struct logger *android_logger_open(struct logger_list *logger_list,
@@ -75,6 +75,21 @@ void memtrack_proc_destroy(struct memtrack_proc *p);
  */
 int memtrack_proc_get(struct memtrack_proc *p, pid_t pid);
 
+/**
+ * memtrack_proc_get_batch
+ *
+ * Fill procs[i] with data about pids[i], for each of the count pids, as
+ * memtrack_proc_get does.  Meant for sweeps over every process: memory types
+ * the HAL does not support are only asked about once, and handles that are
+ * reused from one sweep to the next keep their record buffers.  If results
+ * is not NULL, results[i] is set to what memtrack_proc_get returned for
+ * pids[i].
+ *
+ * Returns the number of pids that succeeded, -errno on error.
+ */
+int memtrack_proc_get_batch(struct memtrack_proc **procs, const pid_t *pids,
+        size_t count, int *results);
+
 /**
  * memtrack_proc_graphics_total
  *
@@ -64,6 +64,14 @@ int RSA_verify(const RSAPublicKey *key,
                const uint8_t* hash,
                const int hash_len);
 
+int RSA_verify_batch(const RSAPublicKey *key,
+                     const uint8_t* const* signatures,
+                     const int len,
+                     const uint8_t* const* hashes,
+                     const int hash_len,
+                     const int count,
+                     int* results);
+
 void RSA_key_convert2048(const RSAPublicKey2048 *key,
                          RSAPublicKey *new_key);
 
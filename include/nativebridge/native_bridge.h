@@ -19,6 +19,7 @@
 
 #include "jni.h"
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -64,9 +65,33 @@ bool NativeBridgeInitialized();
 // Load a shared library that is supported by the native bridge.
 void* NativeBridgeLoadLibrary(const char* libpath, int flag);
 
-// Get a native bridge trampoline for specified native method.
+// Get a native bridge trampoline for specified native method. Answers are cached per handle, so
+// only the first lookup of a method goes to the bridge.
 void* NativeBridgeGetTrampoline(void* handle, const char* name, const char* shorty, uint32_t len);
 
+// One method of a NativeBridgeGetTrampolines batch, as for NativeBridgeGetTrampoline.
+struct NativeBridgeTrampolineRequest {
+  const char* name;
+  const char* shorty;
+  uint32_t len;
+};
+
+// Get the trampolines for count methods of one library at once, e.g. for a RegisterNatives call,
+// into trampolines[0..count). Takes the cache lock once for the batch rather than per method.
+// Returns the number of methods resolved to a non-null trampoline.
+size_t NativeBridgeGetTrampolines(void* handle, const NativeBridgeTrampolineRequest* requests,
+                                  size_t count, void** trampolines);
+
+struct NativeBridgeTrampolineCacheStats {
+  uint64_t lookups;  // Methods asked for.
+  uint64_t hits;     // Of those, answered from the cache.
+  uint64_t misses;   // Of those, passed on to the bridge.
+  size_t entries;    // Methods cached, over all handles.
+};
+
+// Snapshot of the trampoline cache counters, which are reset by UnloadNativeBridge.
+void NativeBridgeGetTrampolineCacheStats(NativeBridgeTrampolineCacheStats* stats);
+
 // True if native library is valid and is for an ABI that is supported by native bridge.
 bool NativeBridgeIsSupported(const char* libpath);
 
@@ -217,6 +217,26 @@ void fs_config(const char *path, int dir, const char *target_out_path,
 
 ssize_t fs_config_generate(char *buffer, size_t length, const struct fs_path_config *pc);
 
+/*
+ * A compiled form of the rules fs_config() applies, for tools that look up
+ * many paths.  fs_config_index_create() reads the override files once
+ * (from target_out_path like fs_config(), if given) and
+ * fs_config_index_lookup() then gives the same results as fs_config()
+ * without allocating or making system calls.  Changes to the override files
+ * made after the index was created are not seen.
+ *
+ * fs_config_index_create() returns NULL if memory allocation fails.
+ */
+struct fs_config_index;
+
+struct fs_config_index *fs_config_index_create(const char *target_out_path);
+
+void fs_config_index_lookup(const struct fs_config_index *index, const char *path, int dir,
+                            unsigned *uid, unsigned *gid, unsigned *mode,
+                            uint64_t *capabilities);
+
+void fs_config_index_destroy(struct fs_config_index *index);
+
 __END_DECLS
 
 #endif
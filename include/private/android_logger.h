@@ -95,4 +95,44 @@ typedef struct __attribute__((__packed__)) {
     char data[];
 } android_log_event_string_t;
 
+/*
+ * Shared memory ring transport to logd (opt-in, per process)
+ *
+ * The process maps an ashmem region holding an android_log_ring_t with
+ * the ring data following it, then hands logd the region and one end of
+ * a socketpair, the doorbell, as SCM_RIGHTS on an
+ * android_log_ring_register_t datagram to the logdw socket. logd binds
+ * the ring to the credentials of that datagram.
+ *
+ * Each record in the ring is a uint16_t length followed by that many
+ * bytes of android_log_header_t and payload, exactly what would have
+ * been sent as a datagram. Records do not wrap: when one does not fit
+ * before the end, a length of LOGGER_RING_PAD (or fewer than two bytes
+ * left) skips to the start of the ring.
+ *
+ * head and tail are free running byte counts, head advanced by the
+ * process and tail by logd, accessed with __atomic builtins. logd sets
+ * waiting before it sleeps; the process clears it and writes a byte
+ * to the doorbell once it has published a record. logd notices the
+ * process exiting as the doorbell hanging up.
+ */
+#define LOGGER_RING_MAGIC 0x474e4952 /* "RING" */
+#define LOGGER_RING_PAD   0xFFFF
+#define LOGGER_RING_MIN   (16 * 1024)
+#define LOGGER_RING_MAX   (1024 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;    /* bytes of ring data, a power of two */
+    uint32_t head;
+    uint32_t tail;
+    uint32_t waiting;
+    uint32_t reserved[3];
+} android_log_ring_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t magic;   /* LOGGER_RING_MAGIC */
+    uint32_t size;    /* as in android_log_ring_t */
+} android_log_ring_register_t;
+
 #endif
@@ -16,6 +16,8 @@
 #ifndef _FRAMEWORKSOCKETLISTENER_H
 #define _FRAMEWORKSOCKETLISTENER_H
 
+#include <cutils/hashmap.h>
+
 #include "SocketListener.h"
 #include "FrameworkCommand.h"
 
@@ -32,6 +34,7 @@ private:
     int mCommandCount;
     bool mWithSeq;
     FrameworkCommandCollection *mCommands;
+    Hashmap *mCommandMap;  // command name -> FrameworkCommand
 
 public:
     FrameworkListener(const char *socketName);
@@ -38,15 +38,20 @@ public:
 
 private:
     int  mSeq;
-    char *mPath;
+    const char *mPath;
     Action mAction;
-    char *mSubsystem;
+    const char *mSubsystem;
     char *mParams[NL_PARAMS_MAX];
+    bool mParamsOwned;
 
 public:
     NetlinkEvent();
     virtual ~NetlinkEvent();
 
+    /*
+     * An ASCII uevent is parsed in place: its path, subsystem and parameters
+     * point into buffer, so they are only valid as long as the buffer is.
+     */
     bool decode(char *buffer, int size, int format = NetlinkListener::NETLINK_FORMAT_ASCII);
     const char *findParam(const char *paramName);
 
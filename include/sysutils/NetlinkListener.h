@@ -21,7 +21,12 @@
 class NetlinkEvent;
 
 class NetlinkListener : public SocketListener {
-    char mBuffer[64 * 1024] __attribute__((aligned(4)));
+    // Up to kRecvBatch messages are received per wakeup, one per slot.
+    // Multicast netlink messages are at most 8KB (NLMSG_GOODSIZE).
+    static const int kRecvSlotSize = 8 * 1024;
+    static const int kRecvBatch = 8;
+
+    char mBuffer[kRecvBatch * kRecvSlotSize] __attribute__((aligned(4)));
     int mFormat;
 
 public:
@@ -30,6 +30,14 @@ class SocketListener {
     int                     mCtrlPipe[2];
     pthread_t               mThread;
     bool                    mUseCmdNum;
+    int                     mEpollFd;
+
+    int                     mWorkerCount;
+    pthread_t               *mWorkers;
+    SocketClientCollection  *mWorkQueue;
+    pthread_mutex_t         mWorkLock;
+    pthread_cond_t          mWorkCond;
+    bool                    mWorkersExit;
 
 public:
     SocketListener(const char *socketName, bool listen);
@@ -47,6 +55,16 @@ public:
 
     bool release(SocketClient *c) { return release(c, true); }
 
+    /*
+     * Calls onDataAvailable() on a pool of count threads instead of the
+     * listener thread, so that a slow command only holds up its own client.
+     * Each client still has at most one call in progress, so its commands
+     * are handled in order.  onDataAvailable() must then be safe to call
+     * for different clients at the same time.  Must be called before
+     * startListener().
+     */
+    void setWorkerThreads(int count);
+
 protected:
     virtual bool onDataAvailable(SocketClient *c) = 0;
 
@@ -54,6 +72,11 @@ private:
     bool release(SocketClient *c, bool wakeup);
     static void *threadStart(void *obj);
     void runListener();
+    static void *workerStart(void *obj);
+    void runWorker();
+    void dispatch(SocketClient *c);
+    int watch(int fd, bool oneShot);
+    void rearm(SocketClient *c);
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
 #endif
@@ -22,6 +22,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include <linux/version.h>
 #if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 20)
@@ -32,6 +33,7 @@ extern "C" {
 
 struct usb_host_context;
 struct usb_endpoint_descriptor;
+struct usb_request_ring;
 
 struct usb_descriptor_iter {
     unsigned char*  config;
@@ -229,14 +231,70 @@ void usb_request_free(struct usb_request *req);
 /* Submits a read or write request on the specified device */
 int usb_request_queue(struct usb_request *req);
 
+/* Submits a bulk request whose data is scattered over iovcnt buffers, of
+ * any size, ignoring req->buffer.  The data goes out as one transfer of
+ * several URBs; a short read ends it early.  The request completes once,
+ * with actual_length the total transferred, when all of them are done.
+ * Returns 0, or -1 with errno set.  If some URBs were already submitted,
+ * they are cancelled and the request must still be waited for.
+ */
+int usb_request_queue_sg(struct usb_request *req, const struct iovec *iov, int iovcnt);
+
  /* Waits for the results of a previous usb_request_queue operation.
   * Returns a usb_request, or NULL for error.
   */
 struct usb_request *usb_request_wait(struct usb_device *dev);
 
+/* Like usb_request_wait(), but does not block: returns NULL with errno set
+ * to EAGAIN if no request has completed yet.  The fd from
+ * usb_device_get_fd() polls as writable (POLLOUT, EPOLLOUT) while
+ * completed requests are waiting to be reaped, so this can be driven from
+ * a poll or epoll loop.
+ */
+struct usb_request *usb_request_reap(struct usb_device *dev);
+
 /* Cancels a pending usb_request_queue() operation. */
 int usb_request_cancel(struct usb_request *req);
 
+/* Returns true between queueing a request and it being returned by
+ * usb_request_wait() or usb_request_reap().
+ */
+int usb_request_is_queued(struct usb_request *req);
+
+/* Creates count requests on one endpoint, each with its own buffer of
+ * buffer_length bytes, for keeping several transfers in flight at once.
+ * Buffers larger than a single URB allows are queued with
+ * usb_request_queue_sg().
+ */
+struct usb_request_ring *usb_request_ring_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc, int count, int buffer_length);
+
+/* Releases the ring and its requests, none of which may still be queued. */
+void usb_request_ring_free(struct usb_request_ring *ring);
+
+/* Returns the number of requests in the ring. */
+int usb_request_ring_get_count(struct usb_request_ring *ring);
+
+/* Returns a request of the ring, so its buffer_length (for writes) and
+ * client_data can be set.
+ */
+struct usb_request *usb_request_ring_get_request(struct usb_request_ring *ring, int index);
+
+/* Queues every request of the ring that is not already queued, typically
+ * after handling the ones usb_request_reap() returned.
+ * Returns the number queued, or -1 for error.
+ */
+int usb_request_ring_queue(struct usb_request_ring *ring);
+
+/* Returns the number of requests of the ring that are queued. */
+int usb_request_ring_get_pending(struct usb_request_ring *ring);
+
+/* Cancels every queued request of the ring.  They are still returned by
+ * usb_request_wait() or usb_request_reap(), and must be before the ring
+ * is freed.
+ */
+void usb_request_ring_cancel(struct usb_request_ring *ring);
+
 #ifdef __cplusplus
 }
 #endif
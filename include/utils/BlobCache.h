@@ -19,9 +19,10 @@
 
 #include <stddef.h>
 
+#include <utils/FlatHashMap.h>
 #include <utils/Flattenable.h>
 #include <utils/RefBase.h>
-#include <utils/SortedVector.h>
+#include <utils/Vector.h>
 #include <utils/threads.h>
 
 namespace android {
@@ -101,6 +102,13 @@ public:
     //
     status_t unflatten(void const* buffer, size_t size);
 
+    // unflattenInPlace is like unflatten, except that the cache refers to
+    // the keys and values in 'buffer' instead of copying them, so that a
+    // cache file can be mmap'd and used without reading all of it.  The
+    // memory pointed to by 'buffer' must remain valid and unchanged until the
+    // cache is destroyed or unflattened again.
+    status_t unflattenInPlace(void const* buffer, size_t size);
+
 private:
     // Copying is disallowed.
     BlobCache(const BlobCache&);
@@ -117,14 +125,33 @@ private:
     // to have some effect, and false otherwise.
     bool isCleanable() const;
 
+    // isCacheable returns true if a key/value pair of the given sizes can be
+    // put in the cache, and false otherwise.
+    bool isCacheable(size_t keySize, size_t valueSize) const;
+
+    // setEntry implements set for a key whose hash is already known.  If
+    // copyData is false then the new cache entry refers to the key and value
+    // memory instead of copying it.
+    void setEntry(const void* key, size_t keySize, uint32_t keyHash,
+            const void* value, size_t valueSize, bool copyData);
+
+    // unflattenEntries implements unflatten and unflattenInPlace.
+    status_t unflattenEntries(void const* buffer, size_t size, bool copyData);
+
+    // removeEntryAt removes the cache entry at the given index of
+    // mCacheEntries by moving the last entry in its place.
+    void removeEntryAt(size_t index);
+
+    // hashKey returns the hash of a key, as stored in the index and in the
+    // serialized cache.
+    static uint32_t hashKey(const void* key, size_t keySize);
+
     // A Blob is an immutable sized unstructured data blob.
     class Blob : public RefBase {
     public:
         Blob(const void* data, size_t size, bool copyData);
         ~Blob();
 
-        bool operator<(const Blob& rhs) const;
-
         const void* getData() const;
         size_t getSize() const;
 
@@ -148,13 +175,13 @@ private:
     class CacheEntry {
     public:
         CacheEntry();
-        CacheEntry(const sp<Blob>& key, const sp<Blob>& value);
+        CacheEntry(const sp<Blob>& key, uint32_t keyHash, const sp<Blob>& value);
         CacheEntry(const CacheEntry& ce);
 
-        bool operator<(const CacheEntry& rhs) const;
         const CacheEntry& operator=(const CacheEntry&);
 
         sp<Blob> getKey() const;
+        uint32_t getKeyHash() const;
         sp<Blob> getValue() const;
 
         void setValue(const sp<Blob>& value);
@@ -164,10 +191,34 @@ private:
         // mKey is the key that identifies the cache entry.
         sp<Blob> mKey;
 
+        // mKeyHash is the hash of the key data.
+        uint32_t mKeyHash;
+
         // mValue is the cached data associated with the key.
         sp<Blob> mValue;
     };
 
+public:
+    // A CacheKey refers to the data of a key, either a key in the cache or
+    // one that is being looked up, so that lookups need not create a Blob.
+    // It is public only so that hash_type can be specialized for it.
+    struct CacheKey {
+        const void* mData;
+        size_t mSize;
+        uint32_t mHash;
+
+        CacheKey(const void* data, size_t size, uint32_t hash) :
+                mData(data), mSize(size), mHash(hash) {
+        }
+
+        bool operator==(const CacheKey& rhs) const {
+            return mHash == rhs.mHash && mSize == rhs.mSize &&
+                    memcmp(mData, rhs.mData, mSize) == 0;
+        }
+    };
+
+private:
+
     // A Header is the header for the entire BlobCache serialization format. No
     // need to make this portable, so we simply write the struct out.
     struct Header {
@@ -195,7 +246,8 @@ private:
 
     // An EntryHeader is the header for a serialized cache entry.  No need to
     // make this portable, so we simply write the struct out.  Each EntryHeader
-    // is followed imediately by the key data and then the value data.
+    // is followed imediately by the key data and then the value data, so the
+    // serialized entries can be used in place by unflattenInPlace.
     //
     // The beginning of each serialized EntryHeader is 4-byte aligned, so the
     // number of bytes that a serialized cache entry will occupy is:
@@ -209,6 +261,10 @@ private:
         // mValueSize is the size of the entry value in bytes.
         size_t mValueSize;
 
+        // mKeyHash is the hash of the key, so that the cache can be indexed
+        // without reading the keys.
+        uint32_t mKeyHash;
+
         // mData contains both the key and value data for the cache entry.  The
         // key comes first followed immediately by the value.
         uint8_t mData[];
@@ -240,10 +296,18 @@ private:
     unsigned short mRandState[3];
 
     // mCacheEntries stores all the cache entries that are resident in memory.
-    // Cache entries are added to it by the 'set' method.
-    SortedVector<CacheEntry> mCacheEntries;
+    // Cache entries are added to it by the 'set' method.  They are in no
+    // particular order.
+    Vector<CacheEntry> mCacheEntries;
+
+    // mIndex maps the key of each cache entry to its index in mCacheEntries.
+    FlatHashMap<CacheKey, size_t> mIndex;
 };
 
+template<> inline hash_t hash_type(const BlobCache::CacheKey& key) {
+    return key.mHash;
+}
+
 }
 
 #endif // ANDROID_BLOB_CACHE_H
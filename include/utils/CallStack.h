@@ -46,6 +46,19 @@ public:
     // The default is to dump the stack of the current call.
     void update(int32_t ignoreDepth=1, pid_t tid=BACKTRACE_CURRENT_THREAD);
 
+    // Collect the stack trace of the calling thread by following frame
+    // pointers, without looking up function names.  Cheap enough to call on
+    // every reference count change; the frames still carry the library and
+    // relative pc needed to symbolize them offline.  Falls back to the
+    // update() unwinder where frame pointers cannot be followed.
+    void updateFast(int32_t ignoreDepth=1);
+
+    // Drop the map of the process shared by all call stacks; the next
+    // update() reads it again.  The shared map picks up libraries loaded
+    // after it was read, but still names unloaded ones, so call this after
+    // dlclose() if later stacks may point at reused addresses.
+    static void invalidateMapCache();
+
     // Dump a stack trace to the log using the supplied logtag.
     void log(const char* logtag,
              android_LogPriority priority = ANDROID_LOG_DEBUG,
@@ -20,6 +20,7 @@
 #ifndef __LIBS_FILE_MAP_H
 #define __LIBS_FILE_MAP_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <utils/Compat.h>
@@ -63,6 +64,22 @@ public:
     bool create(const char* origFileName, int fd,
                 off64_t offset, size_t length, bool readOnly);
 
+    /*
+     * Flags for create().
+     */
+    enum CreateFlags {
+        // Read the whole range in before create() returns, where supported,
+        // rather than faulting it in a page at a time later.  Only worth it
+        // when all of it is about to be touched.
+        POPULATE = 0x1,
+    };
+
+    /*
+     * Like create() above, with CreateFlags.
+     */
+    bool create(const char* origFileName, int fd,
+                off64_t offset, size_t length, bool readOnly, uint32_t flags);
+
     ~FileMap(void);
 
     /*
@@ -90,7 +107,10 @@ public:
      * including <sys/mman.h> everywhere.
      */
     enum MapAdvice {
-        NORMAL, RANDOM, SEQUENTIAL, WILLNEED, DONTNEED
+        NORMAL, RANDOM, SEQUENTIAL, WILLNEED, DONTNEED,
+        // Transparent huge pages, for maps of files on tmpfs; the kernel
+        // ignores them for other files.
+        HUGEPAGE, NOHUGEPAGE
     };
 
     /*
@@ -100,6 +120,33 @@ public:
      */
     int advise(MapAdvice advice);
 
+    /*
+     * Apply an madvise() call to the pages holding "length" bytes at
+     * "offset" in the data.  The range is clipped to the data.
+     *
+     * Returns 0 on success, -1 on failure.
+     */
+    int advise(MapAdvice advice, size_t offset, size_t length);
+
+    /*
+     * Start reading in the pages holding "length" bytes at "offset" in the
+     * data, without waiting for them.  Use this just ahead of touching a
+     * part of a large map, such as one entry of an archive.
+     *
+     * Returns 0 on success, -1 on failure.
+     */
+    int prefetch(size_t offset, size_t length) { return advise(WILLNEED, offset, length); }
+
+    /*
+     * Count how many of the pages holding "length" bytes at "offset" in the
+     * data are in memory, so a caller can tell whether touching them will
+     * block.  The total number of pages goes to "outPageCount" if not NULL.
+     *
+     * Returns the number of resident pages, or -1 on failure.
+     */
+    ssize_t getResidentPageCount(size_t offset, size_t length,
+                                 size_t* outPageCount = NULL) const;
+
 protected:
 
 private:
@@ -107,6 +154,11 @@ private:
     FileMap(const FileMap& src);
     const FileMap& operator=(const FileMap& src);
 
+    // Gives the page aligned part of the map holding a range of the data.
+    // Returns false if the range is empty.
+    bool getPageRange(size_t offset, size_t length,
+                      void** outStart, size_t* outLength) const;
+
     char*       mFileName;      // original file name, if known
     void*       mBasePtr;       // base of mmap area; page aligned
     size_t      mBaseLength;    // length, measured from "mBasePtr"
@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FLAT_HASH_MAP_H
+#define ANDROID_FLAT_HASH_MAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <cutils/log.h>
+#include <utils/Errors.h>
+#include <utils/TypeHelpers.h>
+
+namespace android {
+
+/*
+ * A FlatHashMap maps keys to values in a single open-addressed array, so a
+ * lookup usually touches one cache line of control bytes and one slot.
+ *
+ * Each slot has a control byte that says whether the slot is empty, holds
+ * a removed item or holds an item, and in that case also holds 7 bits of
+ * the item's hash code. Lookups examine the control bytes of 8 slots at a
+ * time with 64-bit arithmetic and compare keys only on a match.
+ *
+ * Indices returned by indexOfKey(), add() and next() stay valid until the
+ * map is rehashed, which add() does only when hasMoreRoom() returns false.
+ * Removing items never moves the others.
+ *
+ * TKey must support operator== and have a hash_type() specialization.
+ *
+ * Unlike KeyedVector, copies of a FlatHashMap do not share their storage.
+ * This class is not thread-safe.
+ */
+template <typename TKey, typename TValue>
+class FlatHashMap {
+public:
+    /* Creates a map that can hold at least minimumCapacity items before it
+     * is rehashed. If that is 0, nothing is allocated until the first add(). */
+    explicit FlatHashMap(size_t minimumCapacity = 0);
+    FlatHashMap(const FlatHashMap<TKey, TValue>& other);
+    ~FlatHashMap();
+
+    FlatHashMap<TKey, TValue>& operator=(const FlatHashMap<TKey, TValue>& other);
+
+    /* Returns the number of items in the map. */
+    inline size_t size() const { return mSize; }
+
+    /* Returns whether the map is empty. */
+    inline bool isEmpty() const { return mSize == 0; }
+
+    /* Returns the number of items the map can hold without being rehashed,
+     * if none are removed. */
+    inline size_t capacity() const { return mCapacity; }
+
+    /* Determines whether there is room to add another item without
+     * rehashing. When this returns true, a subsequent add() is guaranteed
+     * not to move any item.
+     *
+     * The slots of removed items cannot always be emptied, and lookups must
+     * skip over them, so the map also runs out of room once there are a
+     * few of those. */
+    inline bool hasMoreRoom() const {
+        return mFilled < mCapacity && mFilled - mSize <= mBucketCount / 16;
+    }
+
+    /* Returns the index of the item with the specified key, or
+     * NAME_NOT_FOUND. */
+    ssize_t indexOfKey(const TKey& key) const;
+
+    /* Return the key or value of the item at the specified index, which
+     * must refer to an item. */
+    inline const TKey& keyAt(size_t index) const { return mSlots[index].key; }
+    inline const TValue& valueAt(size_t index) const { return mSlots[index].value; }
+    inline TValue& editValueAt(size_t index) { return mSlots[index].value; }
+
+    /* Returns the index of the first item after the specified index, or -1
+     * if there is none. Pass -1 to find the first item. Items are returned
+     * in no particular order. */
+    ssize_t next(ssize_t index) const;
+
+    /* Adds an item, or replaces the value of the item with the same key.
+     * Returns the index of the item. If the map has no more room, it is
+     * rehashed first. */
+    ssize_t add(const TKey& key, const TValue& value);
+
+    /* Removes the item with the specified key. Returns the index it had,
+     * or NAME_NOT_FOUND. */
+    ssize_t removeItem(const TKey& key);
+
+    /* Removes the item at the specified index, which must refer to an item.
+     * It is legal to continue iterating with next() afterwards. */
+    void removeAt(size_t index);
+
+    /* Removes all items. The storage is kept. */
+    void clear();
+
+    /* Rehashes the map so that at least minimumCapacity items, and at least
+     * the items it holds, fit without rehashing again. Indices change. */
+    void rehash(size_t minimumCapacity);
+
+private:
+    typedef key_value_pair_t<TKey, TValue> Slot;
+
+    enum {
+        GROUP_SIZE = 8,
+        CTRL_EMPTY = 0x80,
+        CTRL_DELETED = 0xfe,
+        // Items have a control byte below 0x80.
+        CTRL_HASH_MASK = 0x7f,
+    };
+
+    static const uint64_t kLsbs = 0x0101010101010101ULL;
+    static const uint64_t kMsbs = 0x8080808080808080ULL;
+
+    // hash_type() of an integer is the integer itself, so scramble its
+    // bits before using some of them for the position and others for the
+    // control byte.
+    static inline hash_t mixHash(hash_t hash) {
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    // Loads the control bytes of the group starting at index, so that the
+    // byte of slot index + i is byte i of the result counting from the
+    // least significant one.
+    inline uint64_t loadGroup(size_t index) const {
+        uint64_t group;
+        memcpy(&group, mControl + index, sizeof(group));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        group = __builtin_bswap64(group);
+#endif
+        return group;
+    }
+
+    // Each of these returns a mask with the high bit set in the bytes that
+    // match. matchByte() may also match a byte above a real match, so the
+    // control byte must be checked again.
+    static inline uint64_t matchByte(uint64_t group, uint8_t value) {
+        uint64_t x = group ^ (kLsbs * value);
+        return (x - kLsbs) & ~x & kMsbs;
+    }
+
+    static inline uint64_t matchEmpty(uint64_t group) {
+        return group & (~group << 6) & kMsbs;
+    }
+
+    static inline uint64_t matchEmptyOrDeleted(uint64_t group) {
+        return group & kMsbs;
+    }
+
+    static inline size_t firstMatch(uint64_t match) {
+        return __builtin_ctzll(match) / 8;
+    }
+
+    // Returns the index of the first group to probe for the hash code.
+    inline size_t probeStart(hash_t hash) const {
+        return (hash >> 7) & (mBucketCount - 1) & ~size_t(GROUP_SIZE - 1);
+    }
+
+    ssize_t find(const TKey& key, hash_t hash) const;
+    size_t findInsertionIndex(hash_t hash) const;
+    void allocate(size_t bucketCount);
+    void destroyItems();
+
+    uint8_t* mControl;    // one control byte per bucket
+    Slot* mSlots;         // uninitialized unless the control byte is an item
+    size_t mBucketCount;  // a power of 2 and a multiple of GROUP_SIZE, or 0
+    size_t mCapacity;     // number of buckets that may be filled
+    size_t mFilled;       // number of buckets that are not empty
+    size_t mSize;         // number of items
+};
+
+template <typename TKey, typename TValue>
+FlatHashMap<TKey, TValue>::FlatHashMap(size_t minimumCapacity)
+    : mControl(NULL), mSlots(NULL), mBucketCount(0), mCapacity(0), mFilled(0), mSize(0) {
+    if (minimumCapacity) {
+        rehash(minimumCapacity);
+    }
+}
+
+template <typename TKey, typename TValue>
+FlatHashMap<TKey, TValue>::FlatHashMap(const FlatHashMap<TKey, TValue>& other)
+    : mControl(NULL), mSlots(NULL), mBucketCount(0), mCapacity(0), mFilled(0), mSize(0) {
+    *this = other;
+}
+
+template <typename TKey, typename TValue>
+FlatHashMap<TKey, TValue>::~FlatHashMap() {
+    destroyItems();
+    free(mControl);
+    free(mSlots);
+}
+
+template <typename TKey, typename TValue>
+FlatHashMap<TKey, TValue>& FlatHashMap<TKey, TValue>::operator=(
+        const FlatHashMap<TKey, TValue>& other) {
+    if (this != &other) {
+        clear();
+        if (other.mSize > mCapacity) {
+            rehash(other.mSize);
+        }
+        for (ssize_t i = other.next(-1); i >= 0; i = other.next(i)) {
+            add(other.keyAt(i), other.valueAt(i));
+        }
+    }
+    return *this;
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashMap<TKey, TValue>::indexOfKey(const TKey& key) const {
+    if (!mSize) {
+        return NAME_NOT_FOUND;
+    }
+    return find(key, mixHash(hash_type(key)));
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashMap<TKey, TValue>::find(const TKey& key, hash_t hash) const {
+    uint8_t h2 = hash & CTRL_HASH_MASK;
+    size_t index = probeStart(hash);
+    for (size_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+        uint64_t group = loadGroup(index);
+        for (uint64_t match = matchByte(group, h2); match; match &= match - 1) {
+            size_t i = index + firstMatch(match);
+            if (mControl[i] == h2 && mSlots[i].key == key) {
+                return i;
+            }
+        }
+        if (matchEmpty(group)) {
+            return NAME_NOT_FOUND;
+        }
+        // Triangular steps visit every group when there are 2^n of them.
+        index = (index + step) & (mBucketCount - 1);
+    }
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashMap<TKey, TValue>::next(ssize_t index) const {
+    for (size_t i = index + 1; i < mBucketCount; i++) {
+        if (mControl[i] < CTRL_EMPTY) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+template <typename TKey, typename TValue>
+size_t FlatHashMap<TKey, TValue>::findInsertionIndex(hash_t hash) const {
+    size_t index = probeStart(hash);
+    for (size_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+        uint64_t match = matchEmptyOrDeleted(loadGroup(index));
+        if (match) {
+            return index + firstMatch(match);
+        }
+        index = (index + step) & (mBucketCount - 1);
+    }
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashMap<TKey, TValue>::add(const TKey& key, const TValue& value) {
+    hash_t hash = mixHash(hash_type(key));
+    ssize_t index = mSize ? find(key, hash) : NAME_NOT_FOUND;
+    if (index >= 0) {
+        mSlots[index].value = value;
+        return index;
+    }
+    if (!hasMoreRoom()) {
+        // If the map is not that full, just reclaim the slots of removed
+        // items.
+        rehash(mSize * 2 < mCapacity ? mCapacity : mCapacity * 2);
+    }
+    index = findInsertionIndex(hash);
+    if (mControl[index] == CTRL_EMPTY) {
+        mFilled++;
+    }
+    mControl[index] = hash & CTRL_HASH_MASK;
+    new (&mSlots[index]) Slot(key, value);
+    mSize++;
+    return index;
+}
+
+template <typename TKey, typename TValue>
+ssize_t FlatHashMap<TKey, TValue>::removeItem(const TKey& key) {
+    ssize_t index = indexOfKey(key);
+    if (index >= 0) {
+        removeAt(index);
+    }
+    return index;
+}
+
+template <typename TKey, typename TValue>
+void FlatHashMap<TKey, TValue>::removeAt(size_t index) {
+    if (!traits<Slot>::has_trivial_dtor) {
+        mSlots[index].~Slot();
+    }
+    // A lookup stops at the first group with an empty slot, so none can
+    // have gone past this group if it still has one, and the slot can be
+    // emptied rather than marked as deleted.
+    if (matchEmpty(loadGroup(index & ~size_t(GROUP_SIZE - 1)))) {
+        mControl[index] = CTRL_EMPTY;
+        mFilled--;
+    } else {
+        mControl[index] = CTRL_DELETED;
+    }
+    mSize--;
+}
+
+template <typename TKey, typename TValue>
+void FlatHashMap<TKey, TValue>::clear() {
+    destroyItems();
+    if (mBucketCount) {
+        memset(mControl, CTRL_EMPTY, mBucketCount);
+    }
+    mFilled = 0;
+    mSize = 0;
+}
+
+template <typename TKey, typename TValue>
+void FlatHashMap<TKey, TValue>::rehash(size_t minimumCapacity) {
+    if (minimumCapacity < mSize) {
+        minimumCapacity = mSize;
+    }
+    // Fill at most 3/4 of the buckets, so that lookups stay short and
+    // always find an empty slot.
+    size_t bucketCount = GROUP_SIZE;
+    while (bucketCount - bucketCount / 4 < minimumCapacity) {
+        LOG_ALWAYS_FATAL_IF(bucketCount > size_t(-1) / 2 / sizeof(Slot),
+                "FlatHashMap capacity overflow");
+        bucketCount *= 2;
+    }
+
+    uint8_t* oldControl = mControl;
+    Slot* oldSlots = mSlots;
+    size_t oldBucketCount = mBucketCount;
+    allocate(bucketCount);
+    for (size_t i = 0; i < oldBucketCount; i++) {
+        if (oldControl[i] < CTRL_EMPTY) {
+            hash_t hash = mixHash(hash_type(oldSlots[i].key));
+            size_t index = findInsertionIndex(hash);
+            mControl[index] = hash & CTRL_HASH_MASK;
+            move_backward_type(&mSlots[index], &oldSlots[i]);
+        }
+    }
+    mFilled = mSize;
+    free(oldControl);
+    free(oldSlots);
+}
+
+template <typename TKey, typename TValue>
+void FlatHashMap<TKey, TValue>::allocate(size_t bucketCount) {
+    mControl = static_cast<uint8_t*>(malloc(bucketCount));
+    mSlots = static_cast<Slot*>(malloc(bucketCount * sizeof(Slot)));
+    LOG_ALWAYS_FATAL_IF(!mControl || !mSlots, "FlatHashMap out of memory");
+    memset(mControl, CTRL_EMPTY, bucketCount);
+    mBucketCount = bucketCount;
+    mCapacity = bucketCount - bucketCount / 4;
+}
+
+template <typename TKey, typename TValue>
+void FlatHashMap<TKey, TValue>::destroyItems() {
+    if (!traits<Slot>::has_trivial_dtor) {
+        for (ssize_t i = next(-1); i >= 0; i = next(i)) {
+            mSlots[i].~Slot();
+        }
+    }
+}
+
+}; // namespace android
+
+#endif // ANDROID_FLAT_HASH_MAP_H
@@ -216,7 +216,15 @@ public:
          * or Looper_pollAll() MUST check the return from these functions to
          * discover when data is available on such fds and process it.
          */
-        PREPARE_ALLOW_NON_CALLBACKS = 1<<0
+        PREPARE_ALLOW_NON_CALLBACKS = 1<<0,
+
+        /**
+         * Option for Looper_prepare: this looper will send delayed messages at
+         * their uptime to the nanosecond, using a timerfd in its epoll set,
+         * rather than waiting for them with a poll timeout rounded up to the
+         * millisecond.  This costs a file descriptor per looper.
+         */
+        PREPARE_PRECISE_TIMERS = 1<<1
     };
 
     /**
@@ -225,8 +233,11 @@ public:
      * If allowNonCallbaks is true, the looper will allow file descriptors to be
      * registered without associated callbacks.  This assumes that the caller of
      * pollOnce() is prepared to handle callback-less events itself.
+     *
+     * If preciseTimers is true, delayed messages are sent at their uptime as
+     * with PREPARE_PRECISE_TIMERS.
      */
-    Looper(bool allowNonCallbacks);
+    Looper(bool allowNonCallbacks, bool preciseTimers = false);
 
     /**
      * Returns whether this looper instance allows the registration of file descriptors
@@ -398,7 +409,8 @@ public:
      * If the thread already has a looper, it is returned.  Otherwise, a new
      * one is created, associated with the thread, and returned.
      *
-     * The opts may be PREPARE_ALLOW_NON_CALLBACKS or 0.
+     * The opts may be PREPARE_ALLOW_NON_CALLBACKS, PREPARE_PRECISE_TIMERS, both or 0.
+     * PREPARE_PRECISE_TIMERS only applies if the looper is created.
      */
     static sp<Looper> prepare(int opts);
 
@@ -434,13 +446,21 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
+
+        MessageEnvelope(nsecs_t uptime, uint64_t seq, const sp<MessageHandler> handler,
+                const Message& message) : uptime(uptime), seq(seq), handler(handler),
+                message(message) {
+        }
 
-        MessageEnvelope(nsecs_t uptime, const sp<MessageHandler> handler,
-                const Message& message) : uptime(uptime), handler(handler), message(message) {
+        // Orders the message heap so that the next message to send is on top. Messages
+        // for the same time are sent in the order they were sent in.
+        static bool sendsAfter(const MessageEnvelope& a, const MessageEnvelope& b) {
+            return a.uptime != b.uptime ? a.uptime > b.uptime : a.seq > b.seq;
         }
 
         nsecs_t uptime;
+        uint64_t seq;
         sp<MessageHandler> handler;
         Message message;
     };
@@ -448,9 +468,12 @@ private:
     const bool mAllowNonCallbacks; // immutable
 
     int mWakeEventFd;  // immutable
+    int mTimerFd;  // immutable, -1 without precise timers
     Mutex mLock;
 
+    // A binary heap ordered by MessageEnvelope::sendsAfter, the next message is at index 0.
     Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
+    uint64_t mNextMessageSeq; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
     // Whether we are currently waiting for work.  Not protected by a lock,
@@ -469,13 +492,16 @@ private:
     Vector<Response> mResponses;
     size_t mResponseIndex;
     nsecs_t mNextMessageUptime; // set to LLONG_MAX when none
+    nsecs_t mTimerUptime; // what mTimerFd is set to, LLONG_MAX when disarmed
 
     int pollInner(int timeoutMillis);
     int removeFd(int fd, int seq);
     void awoken();
+    void setTimer(nsecs_t uptime);
     void pushResponse(int events, const Request& request);
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
+    void removeMessagesLocked(const sp<MessageHandler>& handler, const int* what);
 
     static void initTLSKey();
     static void threadDestructor(void *st);
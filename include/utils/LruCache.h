@@ -18,7 +18,7 @@
 #define ANDROID_UTILS_LRU_CACHE_H
 
 #include <UniquePtr.h>
-#include <utils/BasicHashtable.h>
+#include <utils/FlatHashMap.h>
 
 namespace android {
 
@@ -65,11 +65,11 @@ public:
         }
 
         const TValue& value() const {
-            return mCache.mTable->entryAt(mIndex).value;
+            return mCache.mTable->valueAt(mIndex).value;
         }
 
         const TKey& key() const {
-            return mCache.mTable->entryAt(mIndex).key;
+            return mCache.mTable->keyAt(mIndex);
         }
     private:
         const LruCache<TKey, TValue>& mCache;
@@ -79,25 +79,26 @@ public:
 private:
     LruCache(const LruCache& that);  // disallow copy constructor
 
+    // The entries are linked from the oldest to the youngest by their
+    // indices in mTable, which only change when the table is rehashed.
     struct Entry {
-        TKey key;
         TValue value;
-        Entry* parent;
-        Entry* child;
+        ssize_t parent;
+        ssize_t child;
 
-        Entry(TKey key_, TValue value_) : key(key_), value(value_), parent(NULL), child(NULL) {
+        Entry(const TValue& value_) : value(value_), parent(-1), child(-1) {
         }
-        const TKey& getKey() const { return key; }
     };
 
-    void attachToCache(Entry& entry);
-    void detachFromCache(Entry& entry);
+    void attachToCache(ssize_t index);
+    void detachFromCache(ssize_t index);
+    void notifyRemoved(ssize_t index);
     void rehash(size_t newCapacity);
 
-    UniquePtr<BasicHashtable<TKey, Entry> > mTable;
+    UniquePtr<FlatHashMap<TKey, Entry> > mTable;
     OnEntryRemoved<TKey, TValue>* mListener;
-    Entry* mOldest;
-    Entry* mYoungest;
+    ssize_t mOldest;
+    ssize_t mYoungest;
     uint32_t mMaxCapacity;
     TValue mNullValue;
 };
@@ -105,10 +106,10 @@ private:
 // Implementation is here, because it's fully templated
 template <typename TKey, typename TValue>
 LruCache<TKey, TValue>::LruCache(uint32_t maxCapacity)
-    : mTable(new BasicHashtable<TKey, Entry>)
+    : mTable(new FlatHashMap<TKey, Entry>)
     , mListener(NULL)
-    , mOldest(NULL)
-    , mYoungest(NULL)
+    , mOldest(-1)
+    , mYoungest(-1)
     , mMaxCapacity(maxCapacity)
     , mNullValue(NULL) {
 };
@@ -125,15 +126,15 @@ size_t LruCache<TKey, TValue>::size() const {
 
 template <typename TKey, typename TValue>
 const TValue& LruCache<TKey, TValue>::get(const TKey& key) {
-    hash_t hash = hash_type(key);
-    ssize_t index = mTable->find(-1, hash, key);
-    if (index == -1) {
+    ssize_t index = mTable->indexOfKey(key);
+    if (index < 0) {
         return mNullValue;
     }
-    Entry& entry = mTable->editEntryAt(index);
-    detachFromCache(entry);
-    attachToCache(entry);
-    return entry.value;
+    if (index != mYoungest) {
+        detachFromCache(index);
+        attachToCache(index);
+    }
+    return mTable->valueAt(index).value;
 }
 
 template <typename TKey, typename TValue>
@@ -142,52 +143,49 @@ bool LruCache<TKey, TValue>::put(const TKey& key, const TValue& value) {
         removeOldest();
     }
 
-    hash_t hash = hash_type(key);
-    ssize_t index = mTable->find(-1, hash, key);
+    ssize_t index = mTable->indexOfKey(key);
     if (index >= 0) {
         return false;
     }
     if (!mTable->hasMoreRoom()) {
-        rehash(mTable->capacity() * 2);
+        // The slots of removed entries are only reclaimed by rehashing, so
+        // the table only has to grow when it is mostly full of entries.
+        rehash(mTable->size() * 2);
     }
 
-    // Would it be better to initialize a blank entry and assign key, value?
-    Entry initEntry(key, value);
-    index = mTable->add(hash, initEntry);
-    Entry& entry = mTable->editEntryAt(index);
-    attachToCache(entry);
+    index = mTable->add(key, Entry(value));
+    attachToCache(index);
     return true;
 }
 
 template <typename TKey, typename TValue>
 bool LruCache<TKey, TValue>::remove(const TKey& key) {
-    hash_t hash = hash_type(key);
-    ssize_t index = mTable->find(-1, hash, key);
+    ssize_t index = mTable->indexOfKey(key);
     if (index < 0) {
         return false;
     }
-    Entry& entry = mTable->editEntryAt(index);
-    if (mListener) {
-        (*mListener)(entry.key, entry.value);
-    }
-    detachFromCache(entry);
+    notifyRemoved(index);
+    detachFromCache(index);
     mTable->removeAt(index);
     return true;
 }
 
 template <typename TKey, typename TValue>
 bool LruCache<TKey, TValue>::removeOldest() {
-    if (mOldest != NULL) {
-        return remove(mOldest->key);
-        // TODO: should probably abort if false
+    if (mOldest >= 0) {
+        notifyRemoved(mOldest);
+        size_t index = mOldest;
+        detachFromCache(index);
+        mTable->removeAt(index);
+        return true;
     }
     return false;
 }
 
 template <typename TKey, typename TValue>
 const TValue& LruCache<TKey, TValue>::peekOldestValue() {
-    if (mOldest) {
-        return mOldest->value;
+    if (mOldest >= 0) {
+        return mTable->valueAt(mOldest).value;
     }
     return mNullValue;
 }
@@ -195,53 +193,64 @@ const TValue& LruCache<TKey, TValue>::peekOldestValue() {
 template <typename TKey, typename TValue>
 void LruCache<TKey, TValue>::clear() {
     if (mListener) {
-        for (Entry* p = mOldest; p != NULL; p = p->child) {
-            (*mListener)(p->key, p->value);
+        for (ssize_t i = mOldest; i >= 0; i = mTable->valueAt(i).child) {
+            notifyRemoved(i);
         }
     }
-    mYoungest = NULL;
-    mOldest = NULL;
+    mYoungest = -1;
+    mOldest = -1;
     mTable->clear();
 }
 
 template <typename TKey, typename TValue>
-void LruCache<TKey, TValue>::attachToCache(Entry& entry) {
-    if (mYoungest == NULL) {
-        mYoungest = mOldest = &entry;
+void LruCache<TKey, TValue>::attachToCache(ssize_t index) {
+    Entry& entry = mTable->editValueAt(index);
+    if (mYoungest < 0) {
+        mYoungest = mOldest = index;
     } else {
         entry.parent = mYoungest;
-        mYoungest->child = &entry;
-        mYoungest = &entry;
+        mTable->editValueAt(mYoungest).child = index;
+        mYoungest = index;
     }
 }
 
 template <typename TKey, typename TValue>
-void LruCache<TKey, TValue>::detachFromCache(Entry& entry) {
-    if (entry.parent != NULL) {
-        entry.parent->child = entry.child;
+void LruCache<TKey, TValue>::detachFromCache(ssize_t index) {
+    Entry& entry = mTable->editValueAt(index);
+    if (entry.parent >= 0) {
+        mTable->editValueAt(entry.parent).child = entry.child;
     } else {
         mOldest = entry.child;
     }
-    if (entry.child != NULL) {
-        entry.child->parent = entry.parent;
+    if (entry.child >= 0) {
+        mTable->editValueAt(entry.child).parent = entry.parent;
     } else {
         mYoungest = entry.parent;
     }
 
-    entry.parent = NULL;
-    entry.child = NULL;
+    entry.parent = -1;
+    entry.child = -1;
+}
+
+template <typename TKey, typename TValue>
+void LruCache<TKey, TValue>::notifyRemoved(ssize_t index) {
+    if (mListener) {
+        // The entry is removed right after, so the listener may have it.
+        (*mListener)(const_cast<TKey&>(mTable->keyAt(index)),
+                mTable->editValueAt(index).value);
+    }
 }
 
 template <typename TKey, typename TValue>
 void LruCache<TKey, TValue>::rehash(size_t newCapacity) {
-    UniquePtr<BasicHashtable<TKey, Entry> > oldTable(mTable.release());
-    Entry* oldest = mOldest;
-
-    mOldest = NULL;
-    mYoungest = NULL;
-    mTable.reset(new BasicHashtable<TKey, Entry>(newCapacity));
-    for (Entry* p = oldest; p != NULL; p = p->child) {
-        put(p->key, p->value);
+    UniquePtr<FlatHashMap<TKey, Entry> > oldTable(mTable.release());
+    ssize_t oldest = mOldest;
+
+    mOldest = -1;
+    mYoungest = -1;
+    mTable.reset(new FlatHashMap<TKey, Entry>(newCapacity));
+    for (ssize_t i = oldest; i >= 0; i = oldTable->valueAt(i).child) {
+        attachToCache(mTable->add(oldTable->keyAt(i), Entry(oldTable->valueAt(i).value)));
     }
 }
 
@@ -122,6 +122,12 @@ public:
         getWeakRefs()->trackMe(enable, retain); 
     }
 
+            //! DEBUGGING ONLY: Write the reference events traced on every
+            // thread, one line each, followed by the process memory map so
+            // that the caller pcs can be symbolized offline. Writes nothing
+            // unless libutils was built with DEBUG_REFS_TRACE.
+    static  void            dumpRefTrace(int fd);
+
     typedef RefBase basetype;
 
 protected:
@@ -24,6 +24,8 @@
 
 namespace android {
 
+class SharedBufferArena;
+
 class SharedBuffer
 {
 public:
@@ -89,17 +91,66 @@ public:
     
 
 private:
+        friend class SharedBufferArena;
+
         inline SharedBuffer() { }
         inline ~SharedBuffer() { }
         SharedBuffer(const SharedBuffer&);
         SharedBuffer& operator = (const SharedBuffer&);
+
+        void freeStorage() const;
  
         // 16 bytes. must be sized to preserve correct alignment.
         mutable int32_t        mRefs;
                 size_t         mSize;
+                // mReserved[0] tells buffers carved from a SharedBufferArena
+                // block apart, mReserved[1] is then their offset in it.
                 uint32_t       mReserved[2];
 };
 
+/*
+ * While a SharedBufferArena is in scope, SharedBuffer::alloc() on its thread
+ * carves small buffers out of large blocks instead of calling malloc() for
+ * each one, and editResize() grows the most recent of them in place.  This
+ * makes bulk builds of Vectors and String8s, such as parsing a file, cheap.
+ *
+ * Buffers behave as usual and may outlive the arena, or be released on other
+ * threads.  A block is freed once the arena has moved past it and every buffer
+ * carved from it has been released, so a long-lived buffer keeps its whole
+ * block alive: use arenas for short-lived data.  Arenas nest, the innermost
+ * one is used.
+ */
+class SharedBufferArena
+{
+public:
+    enum {
+        DEFAULT_BLOCK_SIZE = 64 * 1024
+    };
+
+    explicit SharedBufferArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    ~SharedBufferArena();
+
+private:
+    friend class SharedBuffer;
+
+    struct Block;
+
+    SharedBufferArena(const SharedBufferArena&);
+    SharedBufferArena& operator = (const SharedBufferArena&);
+
+    // the arena in scope on this thread, if any
+    static SharedBufferArena* current();
+
+    SharedBuffer* alloc(size_t size);
+    static bool resizeInPlace(SharedBuffer* buf, size_t newSize);
+    static void releaseBuffer(const SharedBuffer* buf);
+    static void releaseBlock(Block* block);
+
+    SharedBufferArena* mPrevious;
+    Block* mBlock;
+    size_t mBlockSize;
+};
+
 // ---------------------------------------------------------------------------
 
 const void* SharedBuffer::data() const {
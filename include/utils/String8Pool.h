@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_STRING8_POOL_H
+#define ANDROID_STRING8_POOL_H
+
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/*
+ * A set of strings that are handed out as copies, so that a string that
+ * recurs, such as a key read from many files, is allocated once and
+ * shared by all its copies. The copies are ordinary String8s: they share
+ * the pooled buffer until written to and stay valid after the pool is
+ * gone. Strings stay in the pool until it is destroyed.
+ *
+ * Only strings of up to MAX_LENGTH bytes are pooled, longer ones are
+ * unlikely to recur and are returned as new strings.
+ *
+ * This class is thread-safe.
+ */
+class String8Pool {
+public:
+    enum { MAX_LENGTH = 64 };
+
+    String8Pool();
+    ~String8Pool();
+
+    /* Returns the pooled string equal to the len bytes at str, adding it
+     * to the pool if needed. */
+    String8 get(const char* str, size_t len);
+
+    /* Returns the pooled string equal to str, adding str itself to the
+     * pool if needed. */
+    String8 get(const String8& str);
+
+    /* Returns the number of strings in the pool. */
+    size_t size() const;
+
+private:
+    String8Pool(const String8Pool&);
+    String8Pool& operator=(const String8Pool&);
+
+    ssize_t find(const char* str, size_t len, size_t* outInsertionIndex) const;
+
+    mutable Mutex mLock;
+    Vector<String8> mStrings; // sorted, guarded by mLock
+};
+
+} // namespace android
+
+#endif // ANDROID_STRING8_POOL_H
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UTILS_THREAD_POOL_H
+#define ANDROID_UTILS_THREAD_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/Condition.h>
+#include <utils/Errors.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+#include <utils/ThreadDefs.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+class ThreadPool;
+
+/**
+ * A unit of work that can be submitted to a ThreadPool.
+ *
+ * The work item is also its own future: the submitter keeps a reference to it
+ * and calls wait() to block until it has run, then reads whatever results the
+ * subclass stored in run().  A work item can be submitted only once.
+ */
+class WorkItem : public virtual RefBase {
+public:
+    WorkItem();
+
+    /**
+     * Waits until the work item has run or has been cancelled.
+     * Returns true if it ran.
+     *
+     * Do not call this from a worker of the pool the item was submitted to;
+     * use ThreadPool::waitFor() instead, which runs other work while waiting.
+     */
+    bool wait() const;
+
+    /**
+     * Returns true if the work item has run or has been cancelled.
+     */
+    bool isDone() const;
+
+    /**
+     * Cancels the work item if it has not started running yet.
+     * Returns true if it will not run.
+     */
+    bool cancel();
+
+protected:
+    virtual ~WorkItem();
+
+    /**
+     * Does the work.  Called once on a worker thread.
+     */
+    virtual void run() = 0;
+
+private:
+    friend class ThreadPool;
+
+    enum {
+        STATE_NEW,
+        STATE_QUEUED,
+        STATE_RUNNING,
+        STATE_DONE,
+        STATE_CANCELLED,
+    };
+
+    // Runs the item unless it was cancelled in the meantime.
+    void execute();
+    void finish(int32_t state);
+
+    volatile int32_t mState;
+    mutable Mutex mLock;
+    mutable Condition mCondition;
+};
+
+/**
+ * A fixed set of worker threads that run WorkItems.
+ *
+ * Each worker has its own deque.  Work submitted from a worker goes onto that
+ * worker's deque, and a worker runs the newest item of its deque first, so
+ * that work spawned by a work item runs while its data is still in cache.
+ * Work submitted from other threads is spread round-robin over the workers.
+ * A worker that runs out of work steals the oldest item of another worker.
+ *
+ * The workers run at the priority given to the constructor, which also puts
+ * them in the matching scheduling group (see androidSetThreadPriority), so a
+ * background pool does not compete with the foreground work of its process.
+ */
+class ThreadPool {
+public:
+    /**
+     * Starts the workers.  A thread count of zero means one per online CPU.
+     */
+    ThreadPool(const char* name, size_t threadCount = 0,
+            int32_t priority = PRIORITY_DEFAULT);
+
+    /**
+     * Runs the work that is still queued, then stops the workers.
+     * Must not be called from a worker.
+     */
+    ~ThreadPool();
+
+    /**
+     * Queues a work item.
+     * Returns INVALID_OPERATION if the item was already submitted.
+     */
+    status_t submit(const sp<WorkItem>& item);
+
+    /**
+     * Waits until the work item has run or has been cancelled, like
+     * WorkItem::wait().  When called from a worker of this pool, runs other
+     * queued work while waiting instead of blocking the worker.
+     */
+    bool waitFor(const sp<WorkItem>& item);
+
+    /**
+     * Calls body(chunkBegin, chunkEnd) for consecutive chunks of at most
+     * grain indices covering [begin, end), on the workers and on the calling
+     * thread, and returns once all chunks are done.  The chunks may run in
+     * any order and concurrently.
+     *
+     * May be called from a worker of this pool.
+     */
+    template<typename F>
+    void parallelFor(size_t begin, size_t end, size_t grain, const F& body) {
+        FunctorRangeBody<F> rangeBody(body);
+        parallelForImpl(begin, end, grain, &rangeBody);
+    }
+
+    inline size_t getThreadCount() const { return mWorkers.size(); }
+
+    /**
+     * Returns the pool whose worker is the calling thread, or NULL.
+     */
+    static ThreadPool* getForThread();
+
+private:
+    class Worker;
+    class RangeItem;
+
+    class RangeBody {
+    public:
+        virtual ~RangeBody() { }
+        virtual void run(size_t begin, size_t end) = 0;
+    };
+
+    template<typename F>
+    class FunctorRangeBody : public RangeBody {
+    public:
+        explicit FunctorRangeBody(const F& body) : mBody(body) { }
+        virtual void run(size_t begin, size_t end) { mBody(begin, end); }
+    private:
+        const F& mBody;
+    };
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void parallelForImpl(size_t begin, size_t end, size_t grain, RangeBody* body);
+
+    // Runs one queued work item, preferring the given worker's own deque.
+    // Returns false if there was none.
+    bool runOne(Worker* self);
+    sp<WorkItem> steal(Worker* self);
+    bool hasQueuedWork() const;
+    void threadLoop(Worker* self);
+
+    static Worker* getWorkerForThread();
+
+    const String8 mName;
+    Vector<sp<Worker> > mWorkers;
+    volatile int32_t mNextWorker;
+
+    // Idle workers sleep on mCondition.  Submitters only take mLock when one
+    // might be sleeping.
+    Mutex mLock;
+    Condition mCondition;
+    volatile int32_t mIdleCount;
+    bool mExiting;
+};
+
+} // namespace android
+
+#endif // ANDROID_UTILS_THREAD_POOL_H
@@ -81,7 +81,12 @@ enum {
     SYSTEM_TIME_MONOTONIC = 1, // monotonic time since unspecified starting point
     SYSTEM_TIME_PROCESS = 2,   // high-resolution per-process clock
     SYSTEM_TIME_THREAD = 3,    // high-resolution per-thread clock
-    SYSTEM_TIME_BOOTTIME = 4   // same as SYSTEM_TIME_MONOTONIC, but including CPU suspend time
+    SYSTEM_TIME_BOOTTIME = 4,  // same as SYSTEM_TIME_MONOTONIC, but including CPU suspend time
+    // Same as SYSTEM_TIME_MONOTONIC and SYSTEM_TIME_REALTIME, but only as fine
+    // as the last scheduler tick (a few milliseconds). Much cheaper to read, for
+    // hot paths that only need coarse timestamps.
+    SYSTEM_TIME_MONOTONIC_COARSE = 5,
+    SYSTEM_TIME_REALTIME_COARSE = 6
 };
 
 // return the system-time according to the specified clock
@@ -18,12 +18,41 @@
 #define _UTILS_TOKENIZER_H
 
 #include <assert.h>
+#include <string.h>
 #include <utils/Errors.h>
 #include <utils/FileMap.h>
 #include <utils/String8.h>
+#include <utils/String8Pool.h>
 
 namespace android {
 
+/**
+ * A token as a pointer into the tokenizer's buffer rather than a copy of it,
+ * so it is only valid while the tokenizer is and is not null-terminated.
+ */
+struct TokenView {
+    const char* data;
+    size_t length;
+
+    inline TokenView() : data(NULL), length(0) { }
+    inline TokenView(const char* data, size_t length) : data(data), length(length) { }
+
+    inline bool isEmpty() const { return length == 0; }
+
+    /**
+     * Returns true if the token is the null-terminated string str.
+     */
+    inline bool operator==(const char* str) const {
+        return strncmp(data ? data : "", str, length) == 0 && str[length] == '\0';
+    }
+    inline bool operator!=(const char* str) const { return !(*this == str); }
+
+    /**
+     * Copies the token, for keeping it beyond the tokenizer.
+     */
+    inline String8 toString8() const { return String8(data, length); }
+};
+
 /**
  * A simple tokenizer for loading and parsing ASCII text files line by line.
  */
@@ -51,6 +80,25 @@ public:
     static status_t fromContents(const String8& filename,
             const char* contents, Tokenizer** outTokenizer);
 
+    /**
+     * Called by parseFiles() with a tokenizer at the start of each file.
+     * Returns NO_ERROR, or an error that parseFiles() passes on.
+     */
+    typedef status_t (*ParseFunc)(Tokenizer* tokenizer, void* cookie);
+
+    /**
+     * Tokenizes each of the files in turn with one tokenizer, which reads
+     * every file into the same buffer rather than opening and mapping each
+     * one, so that a batch of small files costs a single allocation.
+     * The tokenizer and the tokens it returns are only valid during the call
+     * for their file.
+     *
+     * Every file is parsed even if some fail. Returns NO_ERROR if all were
+     * opened and parsed successfully, otherwise the first error.
+     */
+    static status_t parseFiles(const String8* filenames, size_t count,
+            ParseFunc parse, void* cookie);
+
     /**
      * Returns true if at the end of the file.
      */
@@ -88,6 +136,11 @@ public:
      */
     String8 peekRemainderOfLine() const;
 
+    /**
+     * Like peekRemainderOfLine() but returns a view of the buffer rather than a copy.
+     */
+    TokenView peekRemainderOfLineView() const;
+
     /**
      * Gets the character at the current position and advances past it.
      * Returns null at end of file.
@@ -103,6 +156,17 @@ public:
      */
     String8 nextToken(const char* delimiters);
 
+    /**
+     * Like nextToken() but returns the token from the pool, so that tokens that
+     * recur are not allocated again.
+     */
+    String8 nextToken(const char* delimiters, String8Pool* pool);
+
+    /**
+     * Like nextToken() but returns a view of the buffer rather than a copy.
+     */
+    TokenView nextTokenView(const char* delimiters);
+
     /**
      * Advances to the next line.
      * Does nothing if already at the end of the file.
@@ -129,6 +193,10 @@ private:
 
     inline const char* getEnd() const { return mBuffer + mLength; }
 
+    const char* scanToken(const char* delimiters);
+    const char* scanLine() const;
+    void reset(const String8& filename, char* buffer, size_t length);
+
 };
 
 } // namespace android
@@ -18,6 +18,7 @@
 #define ANDROID_TYPE_HELPERS_H
 
 #include <new>
+#include <utility>
 #include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
@@ -173,6 +174,17 @@ void splat_type(TYPE* where, const TYPE* what, size_t n) {
     }
 }
 
+// Constructs *d from *s, which is about to be destroyed, so that types
+// with a move constructor can steal its contents instead of copying them.
+template<typename TYPE> inline
+void move_construct_type(TYPE* d, const TYPE* s) {
+#if __cplusplus >= 201103L
+    new(d) TYPE(std::move(*const_cast<TYPE*>(s)));
+#else
+    new(d) TYPE(*s);
+#endif
+}
+
 template<typename TYPE> inline
 void move_forward_type(TYPE* d, const TYPE* s, size_t n = 1) {
     if ((traits<TYPE>::has_trivial_dtor && traits<TYPE>::has_trivial_copy) 
@@ -185,7 +197,7 @@ void move_forward_type(TYPE* d, const TYPE* s, size_t n = 1) {
         while (n--) {
             --d, --s;
             if (!traits<TYPE>::has_trivial_copy) {
-                new(d) TYPE(*s);
+                move_construct_type(d, s);
             } else {
                 *d = *s;   
             }
@@ -205,7 +217,7 @@ void move_backward_type(TYPE* d, const TYPE* s, size_t n = 1) {
     } else {
         while (n--) {
             if (!traits<TYPE>::has_trivial_copy) {
-                new(d) TYPE(*s);
+                move_construct_type(d, s);
             } else {
                 *d = *s;   
             }
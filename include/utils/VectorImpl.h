@@ -44,6 +44,7 @@ public:
         HAS_TRIVIAL_CTOR    = 0x00000001,
         HAS_TRIVIAL_DTOR    = 0x00000002,
         HAS_TRIVIAL_COPY    = 0x00000004,
+        HAS_TRIVIAL_MOVE    = 0x00000008,
     };
 
                             VectorImpl(size_t itemSize, uint32_t flags);
@@ -109,6 +110,8 @@ protected:
 private:
         void* _grow(size_t where, size_t amount);
         void  _shrink(size_t where, size_t amount);
+        bool  owns_storage() const;
+        bool  can_resize_storage() const;
 
         inline void _do_construct(void* storage, size_t num) const;
         inline void _do_destroy(void* storage, size_t num) const;
@@ -114,6 +114,22 @@ int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle);
 int32_t OpenArchiveFd(const int fd, const char* debugFileName,
                       ZipArchiveHandle *handle, bool assume_ownership = true);
 
+/*
+ * Like OpenArchive, but keeps the table of entries that opening builds in
+ * an index at |index_path|, for later opens of the same archive to map
+ * instead of parsing the central directory again. The index may be shared
+ * by any number of processes. It is tied to the archive's device, inode,
+ * size and modification time, and rebuilt and replaced when it does not
+ * match. Failing to write it is not an error.
+ *
+ * The caller picks where indexes live and must not put them where others
+ * can write: an index is checked for consistency, not authenticity.
+ *
+ * Returns 0 on success, and negative values on failure.
+ */
+int32_t OpenArchiveWithIndex(const char* fileName, const char* index_path,
+                             ZipArchiveHandle* handle);
+
 /*
  * Close archive, releasing resources associated with it. This will
  * unmap the central directory of the zipfile and free all internal
@@ -148,7 +164,9 @@ int32_t FindEntry(const ZipArchiveHandle handle, const ZipEntryName& entryName,
  * EndIteration to free any allocated memory.
  *
  * This method also accepts an optional prefix to restrict iteration to
- * entry names that start with |optional_prefix|.
+ * entry names that start with |optional_prefix|. Those entries come in the
+ * order of their names, and only they are looked at; the first such
+ * iteration sorts the names of the archive.
  *
  * Returns 0 on success and negative values on failure.
  */
@@ -181,6 +199,29 @@ void EndIteration(void* cookie);
  */
 int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd);
 
+/*
+ * An entry for ExtractEntriesToFiles to extract to |fd|, as
+ * ExtractEntryToFile would, and what came of it in |result|.
+ */
+struct ZipEntryExtraction {
+  ZipEntry* entry;
+  int fd;
+  int32_t result;
+};
+
+/*
+ * Extracts |count| entries to their files at once, on up to |max_threads|
+ * threads including the calling one, or one per CPU if it is 0. Each
+ * extraction must have a file of its own. The archive is only read at
+ * offsets, so this does not disturb, nor is disturbed by, the offset of
+ * its file descriptor.
+ *
+ * Returns 0 if every entry was extracted, and otherwise the first failure
+ * in |extractions|, each of which has its own |result|.
+ */
+int32_t ExtractEntriesToFiles(ZipArchiveHandle handle, ZipEntryExtraction* extractions,
+                              size_t count, unsigned max_threads);
+
 /**
  * Uncompress a given zip entry to the memory region at |begin| and of
  * size |size|. This size is expected to be the same as the *declared*
@@ -192,6 +233,52 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd);
 int32_t ExtractToMemory(ZipArchiveHandle handle, ZipEntry* entry,
                         uint8_t* begin, uint32_t size);
 
+/*
+ * Gives the data of a stored (uncompressed) entry in place, in a read-only
+ * mapping of the archive, rather than copying it out. The mapping is made
+ * on the first call and shared by all entries; |*data| stays valid until
+ * CloseArchive. If |alignment| is not 0 the data must start at a multiple
+ * of it in the archive, 4 for resources or the page size for native
+ * libraries that are to be mapped from it.
+ *
+ * Returns 0 on success and negative values on failure, which include
+ * compressed and misaligned entries.
+ */
+int32_t MapStoredEntry(ZipArchiveHandle handle, const ZipEntry* entry,
+                       uint32_t alignment, const uint8_t** data, uint32_t* size);
+
+/*
+ * Start reading |entry| a piece at a time, uncompressed, with ReadEntry
+ * and SkipEntry, rather than extracting it whole. |reader| will contain
+ * an opaque cookie for those, which must be freed with CloseEntryReader.
+ * Memory use depends on the inflate window, not the size of the entry.
+ * Readers read at offsets, so several may be used on an archive at once.
+ *
+ * Returns 0 on success and negative values on failure.
+ */
+int32_t OpenEntryReader(ZipArchiveHandle handle, const ZipEntry* entry, void** reader);
+
+/*
+ * Reads up to |len| more uncompressed bytes of the entry into |buf|.
+ *
+ * Returns the number of bytes read, |len| unless the entry ends first,
+ * 0 at its end and negative values on failure.
+ */
+int32_t ReadEntry(void* reader, uint8_t* buf, uint32_t len);
+
+/*
+ * Skips up to |len| uncompressed bytes of the entry. A stored entry is
+ * skipped without reading it; a deflated one has to be inflated.
+ *
+ * Returns the number of bytes skipped, and negative values on failure.
+ */
+int32_t SkipEntry(void* reader, uint32_t len);
+
+/*
+ * Frees the reader from OpenEntryReader.
+ */
+void CloseEntryReader(void* reader);
+
 int GetFileDescriptor(const ZipArchiveHandle handle);
 
 const char* ErrorCodeString(int32_t error_code);
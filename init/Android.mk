@@ -28,6 +28,7 @@ LOCAL_SRC_FILES:= \
     init_parser.cpp \
     log.cpp \
     parser.cpp \
+    rc_cache.cpp \
     util.cpp \
 
 LOCAL_STATIC_LIBRARIES := libbase
@@ -49,6 +50,7 @@ LOCAL_SRC_FILES:= \
     ueventd.cpp \
     ueventd_parser.cpp \
     ueventd_odroid.cpp \
+    ueventd_stats.cpp \
     watchdogd.cpp \
 
 LOCAL_MODULE:= init
@@ -105,6 +107,7 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := init_tests
 LOCAL_SRC_FILES := \
     init_parser_test.cpp \
+    rc_cache_test.cpp \
     util_test.cpp \
 
 LOCAL_SHARED_LIBRARIES += \
@@ -114,3 +117,17 @@ LOCAL_SHARED_LIBRARIES += \
 LOCAL_STATIC_LIBRARIES := libinit
 LOCAL_CLANG := $(init_clang)
 include $(BUILD_NATIVE_TEST)
+
+# Compiles .rc files at build time; see rc_cache.h.
+include $(CLEAR_VARS)
+LOCAL_MODULE := init_rc_compile
+LOCAL_CPPFLAGS := $(init_cflags)
+LOCAL_SRC_FILES := \
+    parser.cpp \
+    rc_cache.cpp \
+    rc_compile.cpp \
+
+LOCAL_STATIC_LIBRARIES := libbase liblog
+LOCAL_CXX_STL := libc++_static
+LOCAL_CLANG := $(init_clang)
+include $(BUILD_HOST_EXECUTABLE)
@@ -22,14 +22,20 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <map>
 #include <memory>
 #include <string>
 
@@ -39,8 +45,10 @@
 #define LOG_STAT        LOG_ROOT"/proc_stat.log"
 #define LOG_PROCS       LOG_ROOT"/proc_ps.log"
 #define LOG_DISK        LOG_ROOT"/proc_diskstats.log"
+#define LOG_EVENTS      LOG_ROOT"/init_events.log"
 #define LOG_HEADER      LOG_ROOT"/header"
 #define LOG_ACCT        LOG_ROOT"/kernel_pacct"
+#define LOG_SAMPLES     LOG_ROOT"/samples"
 
 #define LOG_STARTFILE   LOG_ROOT"/start"
 #define LOG_STOPFILE    LOG_ROOT"/stop"
@@ -51,19 +59,42 @@ static const int BOOTCHART_POLLING_MS = 200;
 // Max polling time in seconds.
 static const int BOOTCHART_MAX_TIME_SEC = 10*60;
 
-static long long g_last_bootchart_time;
-static int g_remaining_samples;
-
-static FILE* log_stat;
-static FILE* log_procs;
-static FILE* log_disks;
-
-static long long get_uptime_jiffies() {
-    std::string uptime;
-    if (!android::base::ReadFileToString("/proc/uptime", &uptime)) {
-        return 0;
-    }
-    return 100LL * strtod(uptime.c_str(), NULL);
+/*
+ * Sampling runs in a separate, low priority process, the collector, so that
+ * it does not hold up init.  While the boot is being charted the collector
+ * appends raw records to LOG_SAMPLES, with no parsing and no stdio; once it
+ * is done it turns them into the text logs that the bootchart tools read.
+ * init sends it the start of each action and service as events.
+ */
+enum {
+    RECORD_SAMPLE,      // Starts a sample; the records up to the next one belong to it.
+    RECORD_STAT,        // /proc/stat.
+    RECORD_DISKSTATS,   // /proc/diskstats.
+    RECORD_PROC_STAT,   // /proc/<pid>/stat.
+    RECORD_PROC_CMDLINE,// /proc/<pid>/cmdline, when it has changed.
+    RECORD_ACTION,      // An action started; the payload is its triggers.
+    RECORD_SERVICE,     // A service started; the payload is its name.
+};
+
+struct record_header {
+    uint16_t type;
+    uint16_t length;
+    int32_t pid;
+    uint32_t time;      // In jiffies for samples, in ms for events.
+};
+
+struct event {
+    record_header header;
+    char name[128 - sizeof(record_header)];
+};
+
+// init's end of the socket to the collector.
+static int g_event_fd = -1;
+
+static uint32_t get_uptime_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
 static void log_header() {
@@ -99,56 +130,283 @@ static void log_header() {
     fclose(out);
 }
 
-static void do_log_uptime(FILE* log) {
-    fprintf(log, "%lld\n", get_uptime_jiffies());
+static void append_record(std::string* out, int type, int pid, uint32_t time,
+                          const char* data, size_t length) {
+    if (length > UINT16_MAX) {
+        length = UINT16_MAX;
+    }
+    record_header header;
+    header.type = type;
+    header.length = length;
+    header.pid = pid;
+    header.time = time;
+    out->append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out->append(data, length);
 }
 
-static void do_log_file(FILE* log, const char* procfile) {
-    do_log_uptime(log);
-
-    std::string content;
-    if (android::base::ReadFileToString(procfile, &content)) {
-        fprintf(log, "%s\n", content.c_str());
+// Reads a whole proc file through an fd that stays open between samples.
+static bool pread_file(int fd, std::string* content) {
+    char buf[4096];
+    content->clear();
+    for (;;) {
+        ssize_t n = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), content->size()));
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        content->append(buf, n);
     }
 }
 
-static void do_log_procs(FILE* log) {
-    do_log_uptime(log);
-
-    std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir("/proc"), closedir);
-    struct dirent* entry;
-    while ((entry = readdir(dir.get())) != NULL) {
-        // Only match numeric values.
-        char* end;
-        int pid = strtol(entry->d_name, &end, 10);
-        if (end != NULL && end > entry->d_name && *end == 0) {
-            char filename[32];
-
-            // /proc/<pid>/stat only has truncated task names, so get the full
-            // name from /proc/<pid>/cmdline.
-            snprintf(filename, sizeof(filename), "/proc/%d/cmdline", pid);
+struct proc_files {
+    int stat_fd;
+    int cmdline_fd;
+    std::string cmdline;
+    bool seen;
+};
+
+class collector {
+public:
+    collector() : stat_fd_(-1), disks_fd_(-1), samples_fd_(-1), proc_dir_(NULL) {
+    }
+
+    bool open_files() {
+        stat_fd_ = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+        disks_fd_ = open("/proc/diskstats", O_RDONLY | O_CLOEXEC);
+        samples_fd_ = open(LOG_SAMPLES, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        proc_dir_ = opendir("/proc");
+        return stat_fd_ != -1 && disks_fd_ != -1 && samples_fd_ != -1 && proc_dir_ != NULL;
+    }
+
+    void sample() {
+        std::string records;
+        std::string content;
+        uint32_t time = get_uptime_ms() / 10;
+
+        append_record(&records, RECORD_SAMPLE, 0, time, NULL, 0);
+        if (pread_file(stat_fd_, &content)) {
+            append_record(&records, RECORD_STAT, 0, time, content.data(), content.size());
+        }
+        if (pread_file(disks_fd_, &content)) {
+            append_record(&records, RECORD_DISKSTATS, 0, time, content.data(), content.size());
+        }
+
+        for (auto& it : procs_) {
+            it.second.seen = false;
+        }
+        rewinddir(proc_dir_);
+        struct dirent* entry;
+        while ((entry = readdir(proc_dir_)) != NULL) {
+            // Only match numeric values.
+            char* end;
+            int pid = strtol(entry->d_name, &end, 10);
+            if (end == NULL || end == entry->d_name || *end != 0) {
+                continue;
+            }
+            auto it = procs_.find(pid);
+            if (it == procs_.end()) {
+                it = open_proc(pid);
+                if (it == procs_.end()) {
+                    continue;
+                }
+            }
+            proc_files& files = it->second;
+            if (!pread_file(files.stat_fd, &content)) {
+                // The process is gone; a new one with its pid is opened afresh.
+                close_proc(it);
+                continue;
+            }
+            files.seen = true;
+            append_record(&records, RECORD_PROC_STAT, pid, time, content.data(), content.size());
+
+            // /proc/<pid>/stat only has truncated task names, so keep track
+            // of the full name from /proc/<pid>/cmdline.
             std::string cmdline;
-            android::base::ReadFileToString(filename, &cmdline);
-            const char* full_name = cmdline.c_str(); // So we stop at the first NUL.
-
-            // Read process stat line.
-            snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
-            std::string stat;
-            if (android::base::ReadFileToString(filename, &stat)) {
-                if (!cmdline.empty()) {
+            if (pread_file(files.cmdline_fd, &cmdline) && cmdline != files.cmdline) {
+                files.cmdline = cmdline;
+                append_record(&records, RECORD_PROC_CMDLINE, pid, time,
+                              cmdline.data(), cmdline.size());
+            }
+        }
+        for (auto it = procs_.begin(); it != procs_.end();) {
+            auto next = it;
+            ++next;
+            if (!it->second.seen) {
+                close_proc(it);
+            }
+            it = next;
+        }
+
+        android::base::WriteFully(samples_fd_, records.data(), records.size());
+    }
+
+    void log_event(const event& ev, size_t size) {
+        android::base::WriteFully(samples_fd_, &ev, size);
+    }
+
+    // Turns the records into the text logs.
+    void finish() {
+        std::string records;
+        if (lseek(samples_fd_, 0, SEEK_SET) == 0) {
+            android::base::ReadFdToString(samples_fd_, &records);
+        }
+
+        FILE* log_stat = fopen(LOG_STAT, "we");
+        FILE* log_procs = fopen(LOG_PROCS, "we");
+        FILE* log_disks = fopen(LOG_DISK, "we");
+        FILE* log_events = fopen(LOG_EVENTS, "we");
+        if (log_stat && log_procs && log_disks && log_events) {
+            write_logs(records, log_stat, log_procs, log_disks, log_events);
+        }
+        if (log_stat) fclose(log_stat);
+        if (log_procs) fclose(log_procs);
+        if (log_disks) fclose(log_disks);
+        if (log_events) fclose(log_events);
+        unlink(LOG_SAMPLES);
+    }
+
+private:
+    std::map<int, proc_files>::iterator open_proc(int pid) {
+        char filename[32];
+        snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
+        int stat_fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if (stat_fd == -1) {
+            return procs_.end();
+        }
+        snprintf(filename, sizeof(filename), "/proc/%d/cmdline", pid);
+        proc_files files;
+        files.stat_fd = stat_fd;
+        files.cmdline_fd = open(filename, O_RDONLY | O_CLOEXEC);
+        files.seen = false;
+        return procs_.insert(std::make_pair(pid, files)).first;
+    }
+
+    void close_proc(std::map<int, proc_files>::iterator it) {
+        close(it->second.stat_fd);
+        if (it->second.cmdline_fd != -1) {
+            close(it->second.cmdline_fd);
+        }
+        procs_.erase(it);
+    }
+
+    static void write_logs(const std::string& records, FILE* log_stat, FILE* log_procs,
+                           FILE* log_disks, FILE* log_events) {
+        std::map<int, std::string> cmdlines;
+        bool in_sample = false;
+        size_t offset = 0;
+        while (records.size() - offset >= sizeof(record_header)) {
+            record_header header;
+            memcpy(&header, records.data() + offset, sizeof(header));
+            offset += sizeof(header);
+            if (records.size() - offset < header.length) {
+                break;
+            }
+            std::string data(records, offset, header.length);
+            offset += header.length;
+
+            switch (header.type) {
+            case RECORD_SAMPLE:
+                if (in_sample) {
+                    fputc('\n', log_procs);
+                }
+                fprintf(log_procs, "%u\n", header.time);
+                in_sample = true;
+                break;
+            case RECORD_STAT:
+                fprintf(log_stat, "%u\n%s\n", header.time, data.c_str());
+                break;
+            case RECORD_DISKSTATS:
+                fprintf(log_disks, "%u\n%s\n", header.time, data.c_str());
+                break;
+            case RECORD_PROC_CMDLINE:
+                cmdlines[header.pid] = data.c_str(); // So we stop at the first NUL.
+                break;
+            case RECORD_PROC_STAT: {
+                auto it = cmdlines.find(header.pid);
+                if (it != cmdlines.end() && !it->second.empty()) {
                     // Substitute the process name with its real name.
-                    size_t open = stat.find('(');
-                    size_t close = stat.find_last_of(')');
+                    size_t open = data.find('(');
+                    size_t close = data.find_last_of(')');
                     if (open != std::string::npos && close != std::string::npos) {
-                        stat.replace(open + 1, close - open - 1, full_name);
+                        data.replace(open + 1, close - open - 1, it->second);
                     }
                 }
-                fputs(stat.c_str(), log);
+                fputs(data.c_str(), log_procs);
+                break;
+            }
+            case RECORD_ACTION:
+                fprintf(log_events, "%u action %s\n", header.time, data.c_str());
+                break;
+            case RECORD_SERVICE:
+                fprintf(log_events, "%u service %s %d\n", header.time, data.c_str(), header.pid);
+                break;
+            }
+        }
+        if (in_sample) {
+            fputc('\n', log_procs);
+        }
+    }
+
+    int stat_fd_;
+    int disks_fd_;
+    int samples_fd_;
+    DIR* proc_dir_;
+    std::map<int, proc_files> procs_;
+};
+
+static void run_collector(int event_fd, int timeout) {
+    setpriority(PRIO_PROCESS, 0, 19);
+    signal(SIGCHLD, SIG_DFL);
+
+    collector c;
+    if (!c.open_files()) {
+        ERROR("Bootcharting init failure: %s\n", strerror(errno));
+        return;
+    }
+
+    // Create kernel process accounting file.
+    close(open(LOG_ACCT, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    acct(LOG_ACCT);
+
+    log_header();
+
+    uint32_t end_time = get_uptime_ms() + timeout * 1000;
+    uint32_t next_sample = get_uptime_ms();
+    for (;;) {
+        uint32_t now = get_uptime_ms();
+        if (int32_t(now - next_sample) >= 0) {
+            c.sample();
+            // Skip the samples that were missed.
+            while (int32_t(now - next_sample) >= 0) {
+                next_sample += BOOTCHART_POLLING_MS;
+            }
+
+            // Stop if /data/bootchart/stop contains 1.
+            std::string stop;
+            if (int32_t(now - end_time) >= 0 ||
+                    (access(LOG_STOPFILE, F_OK) == 0 &&
+                     android::base::ReadFileToString(LOG_STOPFILE, &stop) && stop == "1")) {
+                break;
+            }
+            continue;
+        }
+
+        pollfd pfd = { event_fd, POLLIN, 0 };
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, next_sample - now)) == 1) {
+            event ev;
+            ssize_t n = TEMP_FAILURE_RETRY(recv(event_fd, &ev, sizeof(ev), 0));
+            if (n >= ssize_t(sizeof(record_header))) {
+                c.log_event(ev, n);
             }
         }
     }
 
-    fputc('\n', log);
+    unlink(LOG_STOPFILE);
+    acct(NULL);
+    close(event_fd);
+    c.finish();
 }
 
 static int bootchart_init() {
@@ -176,98 +434,69 @@ static int bootchart_init() {
     if (timeout > BOOTCHART_MAX_TIME_SEC)
         timeout = BOOTCHART_MAX_TIME_SEC;
 
-    int count = (timeout*1000 + BOOTCHART_POLLING_MS-1)/BOOTCHART_POLLING_MS;
-
-    log_stat = fopen(LOG_STAT, "we");
-    if (log_stat == NULL) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sockets) == -1) {
         return -1;
     }
-    log_procs = fopen(LOG_PROCS, "we");
-    if (log_procs == NULL) {
-        fclose(log_stat);
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(sockets[0]);
+        close(sockets[1]);
         return -1;
     }
-    log_disks = fopen(LOG_DISK, "we");
-    if (log_disks == NULL) {
-        fclose(log_stat);
-        fclose(log_procs);
-        return -1;
+    if (pid == 0) {
+        close(sockets[0]);
+        run_collector(sockets[1], timeout);
+        _exit(0);
     }
-
-    // Create kernel process accounting file.
-    close(open(LOG_ACCT, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
-    acct(LOG_ACCT);
-
-    log_header();
-    return count;
+    close(sockets[1]);
+    g_event_fd = sockets[0];
+    fcntl(g_event_fd, F_SETFL, O_NONBLOCK);
+    return timeout;
 }
 
 int do_bootchart_init(int nargs, char** args) {
-    g_remaining_samples = bootchart_init();
-    if (g_remaining_samples < 0) {
+    int timeout = bootchart_init();
+    if (timeout < 0) {
         ERROR("Bootcharting init failure: %s\n", strerror(errno));
-    } else if (g_remaining_samples > 0) {
-        NOTICE("Bootcharting started (will run for %d s).\n",
-               (g_remaining_samples * BOOTCHART_POLLING_MS) / 1000);
+    } else if (timeout > 0) {
+        NOTICE("Bootcharting started (will run for %d s).\n", timeout);
     } else {
         NOTICE("Not bootcharting.\n");
     }
     return 0;
 }
 
-static int bootchart_step() {
-    do_log_file(log_stat,   "/proc/stat");
-    do_log_file(log_disks,  "/proc/diskstats");
-    do_log_procs(log_procs);
-
-    // Stop if /data/bootchart/stop contains 1.
-    std::string stop;
-    if (android::base::ReadFileToString(LOG_STOPFILE, &stop) && stop == "1") {
-        return -1;
+static void bootchart_event(int type, const char* name, pid_t pid) {
+    if (g_event_fd == -1) {
+        return;
     }
 
-    return 0;
-}
-
-/* called to get time (in ms) used by bootchart */
-static long long bootchart_gettime() {
-    return 10LL*get_uptime_jiffies();
+    event ev;
+    size_t length = strlen(name);
+    if (length > sizeof(ev.name)) {
+        length = sizeof(ev.name);
+    }
+    ev.header.type = type;
+    ev.header.length = length;
+    ev.header.pid = pid;
+    ev.header.time = get_uptime_ms();
+    memcpy(ev.name, name, length);
+
+    // Never block init; events are dropped if the collector falls behind,
+    // and the socket is closed once the collector has exited.
+    size_t size = sizeof(ev.header) + length;
+    if (send(g_event_fd, &ev, size, MSG_DONTWAIT | MSG_NOSIGNAL) == -1 &&
+            errno != EAGAIN && errno != EWOULDBLOCK) {
+        close(g_event_fd);
+        g_event_fd = -1;
+    }
 }
 
-static void bootchart_finish() {
-    unlink(LOG_STOPFILE);
-    fclose(log_stat);
-    fclose(log_disks);
-    fclose(log_procs);
-    acct(NULL);
+void bootchart_log_action(const char* triggers) {
+    bootchart_event(RECORD_ACTION, triggers, 0);
 }
 
-void bootchart_sample(int* timeout) {
-    // Do we have any more bootcharting to do?
-    if (g_remaining_samples <= 0) {
-        return;
-    }
-
-    long long current_time = bootchart_gettime();
-    int elapsed_time = current_time - g_last_bootchart_time;
-
-    if (elapsed_time >= BOOTCHART_POLLING_MS) {
-        /* count missed samples */
-        while (elapsed_time >= BOOTCHART_POLLING_MS) {
-            elapsed_time -= BOOTCHART_POLLING_MS;
-            g_remaining_samples--;
-        }
-        /* count may be negative, take a sample anyway */
-        g_last_bootchart_time = current_time;
-        if (bootchart_step() < 0 || g_remaining_samples <= 0) {
-            bootchart_finish();
-            g_remaining_samples = 0;
-        }
-    }
-    if (g_remaining_samples > 0) {
-        int remaining_time = BOOTCHART_POLLING_MS - elapsed_time;
-        if (*timeout < 0 || *timeout > remaining_time) {
-            *timeout = remaining_time;
-        }
-    }
+void bootchart_log_service(const char* name, pid_t pid) {
+    bootchart_event(RECORD_SERVICE, name, pid);
 }
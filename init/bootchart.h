@@ -17,6 +17,11 @@
 #ifndef _BOOTCHART_H
 #define _BOOTCHART_H
 
-void bootchart_sample(int* timeout);
+#include <sys/types.h>
+
+// Record the start of an action or a service in the bootchart, if one is
+// being collected.
+void bootchart_log_action(const char* triggers);
+void bootchart_log_service(const char* name, pid_t pid);
 
 #endif /* _BOOTCHART_H */
@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <fnmatch.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,6 +29,8 @@
 #include <unistd.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <linux/netlink.h>
@@ -44,8 +47,13 @@
 #include <cutils/list.h>
 #include <cutils/uevent.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "devices.h"
 #include "ueventd_parser.h"
+#include "ueventd_stats.h"
 #include "util.h"
 #include "log.h"
 
@@ -80,9 +88,27 @@ struct perms_ {
     unsigned short wildcard;
 };
 
-struct perm_node {
-    struct perms_ dp;
-    struct listnode plist;
+/* A character trie over the literal part of the permission rules' names:
+ * the whole name of exact and prefix rules, and the part before the first
+ * pattern character of wildcard rules.  Walking a path down the trie visits
+ * every rule that can match it, so only the wildcard rules on the way need
+ * fnmatch().
+ */
+struct perm_trie_node {
+    char c;
+    struct perm_trie_node *child;
+    struct perm_trie_node *sibling;
+    std::vector<size_t> exact;
+    std::vector<size_t> prefix;
+    std::vector<size_t> wildcard;
+};
+
+struct perm_trie {
+    /* Rules in the order they were added. */
+    std::vector<struct perms_> rules;
+    /* Length of the part of the names that paths omit. */
+    size_t skip;
+    struct perm_trie_node root;
 };
 
 struct platform_node {
@@ -92,38 +118,95 @@ struct platform_node {
     struct listnode list;
 };
 
-static list_declare(sys_perms);
-static list_declare(dev_perms);
+/* sys rules are matched against uevent paths, which omit the "/sys". */
+static struct perm_trie sys_perms = { std::vector<struct perms_>(), 4, perm_trie_node() };
+static struct perm_trie dev_perms = { std::vector<struct perms_>(), 0, perm_trie_node() };
 static list_declare(platform_names);
 
+static void perm_trie_add(struct perm_trie *trie, const struct perms_& dp)
+{
+    size_t index = trie->rules.size();
+    const char *name = dp.name + trie->skip;
+    size_t literal = dp.wildcard ? strcspn(name, "*?[\\") : strlen(name);
+    struct perm_trie_node *node = &trie->root;
+
+    trie->rules.push_back(dp);
+    for (size_t i = 0; i < literal; i++) {
+        struct perm_trie_node *child = node->child;
+        while (child && child->c != name[i])
+            child = child->sibling;
+        if (!child) {
+            child = new perm_trie_node();
+            child->c = name[i];
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+
+    if (dp.prefix)
+        node->prefix.push_back(index);
+    else if (dp.wildcard)
+        node->wildcard.push_back(index);
+    else
+        node->exact.push_back(index);
+}
+
+/* Appends the indices of the rules that match path to matches, unordered. */
+static void perm_trie_match(const struct perm_trie *trie, const char *path,
+                            std::vector<size_t> *matches)
+{
+    const struct perm_trie_node *node = &trie->root;
+    const char *p = path;
+
+    for (;;) {
+        matches->insert(matches->end(), node->prefix.begin(), node->prefix.end());
+        for (size_t i = 0; i < node->wildcard.size(); i++) {
+            const struct perms_& dp = trie->rules[node->wildcard[i]];
+            if (fnmatch(dp.name + trie->skip, path, FNM_PATHNAME) == 0)
+                matches->push_back(node->wildcard[i]);
+        }
+        if (!*p) {
+            matches->insert(matches->end(), node->exact.begin(), node->exact.end());
+            return;
+        }
+
+        node = node->child;
+        while (node && node->c != *p)
+            node = node->sibling;
+        if (!node)
+            return;
+        p++;
+    }
+}
+
 int add_dev_perms(const char *name, const char *attr,
                   mode_t perm, unsigned int uid, unsigned int gid,
                   unsigned short prefix,
                   unsigned short wildcard) {
-    struct perm_node *node = (perm_node*) calloc(1, sizeof(*node));
-    if (!node)
-        return -ENOMEM;
+    struct perms_ dp;
 
-    node->dp.name = strdup(name);
-    if (!node->dp.name)
+    dp.name = strdup(name);
+    if (!dp.name)
         return -ENOMEM;
 
+    dp.attr = NULL;
     if (attr) {
-        node->dp.attr = strdup(attr);
-        if (!node->dp.attr)
+        dp.attr = strdup(attr);
+        if (!dp.attr)
             return -ENOMEM;
     }
 
-    node->dp.perm = perm;
-    node->dp.uid = uid;
-    node->dp.gid = gid;
-    node->dp.prefix = prefix;
-    node->dp.wildcard = wildcard;
+    dp.perm = perm;
+    dp.uid = uid;
+    dp.gid = gid;
+    dp.prefix = prefix;
+    dp.wildcard = wildcard;
 
     if (attr)
-        list_add_tail(&sys_perms, &node->plist);
+        perm_trie_add(&sys_perms, dp);
     else
-        list_add_tail(&dev_perms, &node->plist);
+        perm_trie_add(&dev_perms, dp);
 
     return 0;
 }
@@ -131,24 +214,14 @@ int add_dev_perms(const char *name, const char *attr,
 void fixup_sys_perms(const char *upath)
 {
     char buf[512];
-    struct listnode *node;
-    struct perms_ *dp;
+    std::vector<size_t> matches;
+    uint64_t start = gettime_ns();
 
-    /* upaths omit the "/sys" that paths in this list
-     * contain, so we add 4 when comparing...
-     */
-    list_for_each(node, &sys_perms) {
-        dp = &(node_to_item(node, struct perm_node, plist))->dp;
-        if (dp->prefix) {
-            if (strncmp(upath, dp->name + 4, strlen(dp->name + 4)))
-                continue;
-        } else if (dp->wildcard) {
-            if (fnmatch(dp->name + 4, upath, FNM_PATHNAME) != 0)
-                continue;
-        } else {
-            if (strcmp(upath, dp->name + 4))
-                continue;
-        }
+    /* Apply all matching rules, in the order they were added. */
+    perm_trie_match(&sys_perms, upath, &matches);
+    std::sort(matches.begin(), matches.end());
+    for (size_t i = 0; i < matches.size(); i++) {
+        const struct perms_ *dp = &sys_perms.rules[matches[i]];
 
         if ((strlen(upath) + strlen(dp->attr) + 6) > sizeof(buf))
             break;
@@ -158,6 +231,7 @@ void fixup_sys_perms(const char *upath)
         chown(buf, dp->uid, dp->gid);
         chmod(buf, dp->perm);
     }
+    uevent_stats_record(UEVENT_PHASE_SYS_PERMS, start, upath);
 
     // Now fixup SELinux file labels
     int len = snprintf(buf, sizeof(buf), "/sys%s", upath);
@@ -167,61 +241,32 @@ void fixup_sys_perms(const char *upath)
     }
     if (access(buf, F_OK) == 0) {
         INFO("restorecon_recursive: %s\n", buf);
+        start = gettime_ns();
         restorecon_recursive(buf);
+        uevent_stats_record(UEVENT_PHASE_RESTORECON, start, buf);
     }
 }
 
-static bool perm_path_matches(const char *path, struct perms_ *dp)
-{
-    if (dp->prefix) {
-        if (strncmp(path, dp->name, strlen(dp->name)) == 0)
-            return true;
-    } else if (dp->wildcard) {
-        if (fnmatch(dp->name, path, FNM_PATHNAME) == 0)
-            return true;
-    } else {
-        if (strcmp(path, dp->name) == 0)
-            return true;
-    }
-
-    return false;
-}
-
 static mode_t get_device_perm(const char *path, const char **links,
                 unsigned *uid, unsigned *gid)
 {
-    struct listnode *node;
-    struct perm_node *perm_node;
-    struct perms_ *dp;
+    std::vector<size_t> matches;
 
-    /* search the perms list in reverse so that ueventd.$hardware can
-     * override ueventd.rc
-     */
-    list_for_each_reverse(node, &dev_perms) {
-        bool match = false;
-
-        perm_node = node_to_item(node, struct perm_node, plist);
-        dp = &perm_node->dp;
-
-        if (perm_path_matches(path, dp)) {
-            match = true;
-        } else {
-            if (links) {
-                int i;
-                for (i = 0; links[i]; i++) {
-                    if (perm_path_matches(links[i], dp)) {
-                        match = true;
-                        break;
-                    }
-                }
-            }
-        }
+    perm_trie_match(&dev_perms, path, &matches);
+    if (links) {
+        for (int i = 0; links[i]; i++)
+            perm_trie_match(&dev_perms, links[i], &matches);
+    }
 
-        if (match) {
-            *uid = dp->uid;
-            *gid = dp->gid;
-            return dp->perm;
-        }
+    /* The last rule added wins, so that ueventd.$hardware can override
+     * ueventd.rc
+     */
+    if (!matches.empty()) {
+        const struct perms_ *dp =
+                &dev_perms.rules[*std::max_element(matches.begin(), matches.end())];
+        *uid = dp->uid;
+        *gid = dp->gid;
+        return dp->perm;
     }
     /* Default if nothing found. */
     *uid = 0;
@@ -240,13 +285,18 @@ static void make_device(const char *path,
     dev_t dev;
     char *secontext = NULL;
 
+    uint64_t start = gettime_ns();
     mode = get_device_perm(path, links, &uid, &gid) | (block ? S_IFBLK : S_IFCHR);
+    uevent_stats_record(UEVENT_PHASE_PERMS_MATCH, start, path);
 
     if (sehandle) {
+        start = gettime_ns();
         selabel_lookup_best_match(sehandle, &secontext, path, links, mode);
+        uevent_stats_record(UEVENT_PHASE_SELABEL, start, path);
         setfscreatecon(secontext);
     }
 
+    start = gettime_ns();
     dev = makedev(major, minor);
     /* Temporarily change egid to avoid race condition setting the gid of the
      * device node. Unforunately changing the euid would prevent creation of
@@ -257,6 +307,7 @@ static void make_device(const char *path,
     mknod(path, mode, dev);
     chown(path, uid, -1);
     setegid(AID_ROOT);
+    uevent_stats_record(UEVENT_PHASE_MAKE_DEVICE, start, path);
 
     if (secontext) {
         freecon(secontext);
@@ -530,8 +581,10 @@ static void handle_device(const char *action, const char *devpath,
     if(!strcmp(action, "add")) {
         make_device(devpath, path, block, major, minor, (const char **)links);
         if (links) {
+            uint64_t start = gettime_ns();
             for (i = 0; links[i]; i++)
                 make_link_init(devpath, links[i]);
+            uevent_stats_record(UEVENT_PHASE_SYMLINKS, start, devpath);
         }
     }
 
@@ -815,44 +868,59 @@ static void handle_device_event(struct uevent *uevent)
     }
 }
 
+/*
+ * Copies the firmware into the data file without going through a buffer:
+ * with sendfile where the kernel can splice into sysfs, from a mapping of
+ * the firmware otherwise.  sysfs takes at most a page per write either way.
+ */
+static int copy_firmware(int fw_fd, int data_fd, off_t size)
+{
+    off_t offset = 0;
+    while (offset < size) {
+        ssize_t nw = sendfile(data_fd, fw_fd, &offset, size - offset);
+        if (nw <= 0) {
+            if (nw < 0 && offset == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                break;
+            }
+            return -1;
+        }
+    }
+    if (offset == size) {
+        return 0;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fw_fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    int ret = 0;
+    const char* p = static_cast<const char*>(map);
+    while (offset < size) {
+        ssize_t nw = TEMP_FAILURE_RETRY(write(data_fd, p + offset, size - offset));
+        if (nw <= 0) {
+            ret = -1;
+            break;
+        }
+        offset += nw;
+    }
+    munmap(map, size);
+    return ret;
+}
+
 static int load_firmware(int fw_fd, int loading_fd, int data_fd)
 {
     struct stat st;
-    long len_to_copy;
     int ret = 0;
 
     if(fstat(fw_fd, &st) < 0)
         return -1;
-    len_to_copy = st.st_size;
 
     write(loading_fd, "1", 1);  /* start transfer */
 
-    while (len_to_copy > 0) {
-        char buf[PAGE_SIZE];
-        ssize_t nr;
-
-        nr = read(fw_fd, buf, sizeof(buf));
-        if(!nr)
-            break;
-        if(nr < 0) {
-            ret = -1;
-            break;
-        }
-
-        len_to_copy -= nr;
-        while (nr > 0) {
-            ssize_t nw = 0;
-
-            nw = write(data_fd, buf + nw, nr);
-            if(nw <= 0) {
-                ret = -1;
-                goto out;
-            }
-            nr -= nw;
-        }
+    if (st.st_size > 0) {
+        ret = copy_firmware(fw_fd, data_fd, st.st_size);
     }
 
-out:
     if(!ret)
         write(loading_fd, "0", 1);  /* successful end of transfer */
     else
@@ -952,39 +1020,66 @@ static void handle_firmware_event(struct uevent *uevent)
     /* we fork, to avoid making large memory allocations in init proper */
     pid = fork();
     if (!pid) {
+        uint64_t start = gettime_ns();
         process_firmware_event(uevent);
+        uevent_stats_record(UEVENT_PHASE_FIRMWARE, start, uevent->firmware);
         _exit(EXIT_SUCCESS);
     } else if (pid < 0) {
         ERROR("could not fork to process firmware event: %s\n", strerror(errno));
     }
 }
 
+static void handle_uevent_msg(const char *msg)
+{
+    uint64_t start = gettime_ns();
+    struct uevent uevent;
+    parse_event(msg, &uevent);
+    uevent_stats_record(UEVENT_PHASE_PARSE, start, uevent.path);
+
+    if (sehandle && selinux_status_updated() > 0) {
+        struct selabel_handle *sehandle2;
+        sehandle2 = selinux_android_file_context_handle();
+        if (sehandle2) {
+            selabel_close(sehandle);
+            sehandle = sehandle2;
+        }
+    }
+
+    handle_device_event(&uevent);
+    handle_firmware_event(&uevent);
+    uevent_stats_record(UEVENT_PHASE_TOTAL, start, uevent.path);
+}
+
+/* While coldboot runs, received messages are queued here instead of being
+ * handled right away. */
+static std::vector<std::string>* coldboot_queue;
+
 #define UEVENT_MSG_LEN  2048
+#define UEVENT_BATCH    16
 void handle_device_fd()
 {
-    char msg[UEVENT_MSG_LEN+2];
-    int n;
-    while ((n = uevent_kernel_multicast_recv(device_fd, msg, UEVENT_MSG_LEN)) > 0) {
-        if(n >= UEVENT_MSG_LEN)   /* overflow -- discard */
-            continue;
+    /* Two bytes of slack per message for the terminating NULs. */
+    static char msgs[UEVENT_BATCH][UEVENT_MSG_LEN+2];
+    ssize_t lengths[UEVENT_BATCH];
+    ssize_t count;
+    while ((count = uevent_kernel_recv_batch(device_fd, msgs, sizeof(msgs[0]), UEVENT_BATCH,
+                                             lengths, true, NULL)) > 0) {
+        for (ssize_t i = 0; i < count; i++) {
+            ssize_t n = lengths[i];
+            if (n <= 0 || n >= UEVENT_MSG_LEN)   /* rejected or overflow -- discard */
+                continue;
 
-        msg[n] = '\0';
-        msg[n+1] = '\0';
+            char* msg = msgs[i];
+            msg[n] = '\0';
+            msg[n+1] = '\0';
 
-        struct uevent uevent;
-        parse_event(msg, &uevent);
-
-        if (sehandle && selinux_status_updated() > 0) {
-            struct selabel_handle *sehandle2;
-            sehandle2 = selinux_android_file_context_handle();
-            if (sehandle2) {
-                selabel_close(sehandle);
-                sehandle = sehandle2;
+            if (coldboot_queue) {
+                /* c_str() adds the second NUL. */
+                coldboot_queue->push_back(std::string(msg, n + 1));
+            } else {
+                handle_uevent_msg(msg);
             }
         }
-
-        handle_device_event(&uevent);
-        handle_firmware_event(&uevent);
     }
 }
 
@@ -1040,15 +1135,79 @@ static void coldboot(const char *path)
     }
 }
 
-void device_init() {
+#define COLDBOOT_MAX_WORKERS 8
+
+static uint32_t hash_devpath(const char *path)
+{
+    uint32_t hash = 5381;
+    while (*path) {
+        hash = hash * 33 + *path++;
+    }
+    return hash;
+}
+
+/* Handles the events regenerated by coldboot in forked workers.
+ *
+ * Platform devices are handled first, here: the names of other devices'
+ * nodes are derived from the list of them, and the workers only get a copy.
+ * The rest is partitioned by DEVPATH, so that all events of a device go to
+ * the same worker, in order.  Devices do not share nodes, and the
+ * directories and links they share are created idempotently.
+ */
+static void handle_coldboot_events(const std::vector<std::string>& events)
+{
+    for (size_t i = 0; i < events.size(); i++) {
+        struct uevent uevent;
+        parse_event(events[i].c_str(), &uevent);
+        if (!strncmp(uevent.subsystem, "platform", 8)) {
+            handle_uevent_msg(events[i].c_str());
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t workers = cpus > COLDBOOT_MAX_WORKERS ? COLDBOOT_MAX_WORKERS : (cpus > 1 ? cpus : 1);
+
+    /* ueventd ignores SIGCHLD, which would make waitpid() wait for every child. */
+    sighandler_t old_sigchld = signal(SIGCHLD, SIG_DFL);
+    std::vector<pid_t> pids;
+    for (uint32_t worker = 0; worker < workers; worker++) {
+        pid_t pid = workers > 1 ? fork() : -1;
+        if (pid > 0) {
+            pids.push_back(pid);
+            continue;
+        }
+        if (pid < 0 && workers > 1) {
+            ERROR("could not fork coldboot worker: %s\n", strerror(errno));
+        }
+
+        /* In the child, or in the parent if there is no child. */
+        for (size_t i = 0; i < events.size(); i++) {
+            struct uevent uevent;
+            parse_event(events[i].c_str(), &uevent);
+            if (strncmp(uevent.subsystem, "platform", 8) &&
+                    hash_devpath(uevent.path) % workers == worker) {
+                handle_uevent_msg(events[i].c_str());
+            }
+        }
+        if (pid == 0) {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    for (size_t i = 0; i < pids.size(); i++) {
+        TEMP_FAILURE_RETRY(waitpid(pids[i], NULL, 0));
+    }
+    signal(SIGCHLD, old_sigchld);
+    NOTICE("Coldboot handled %zu events with %u workers.\n", events.size(), workers);
+}
+
+void device_init(int rcvbuf_size) {
     sehandle = NULL;
     if (is_selinux_enabled() > 0) {
         sehandle = selinux_android_file_context_handle();
         selinux_status_open(true);
     }
 
-    /* is 256K enough? udev uses 16MB! */
-    device_fd = uevent_open_socket(256*1024, true);
+    device_fd = uevent_open_socket(rcvbuf_size, true);
     if (device_fd == -1) {
         return;
     }
@@ -1060,11 +1219,16 @@ void device_init() {
     }
 
     Timer t;
+    std::vector<std::string> events;
+    coldboot_queue = &events;
     coldboot("/sys/class");
     coldboot("/sys/block");
     coldboot("/sys/devices");
+    coldboot_queue = NULL;
+    handle_coldboot_events(events);
     close(open(COLDBOOT_DONE, O_WRONLY|O_CREAT|O_CLOEXEC, 0000));
     NOTICE("Coldboot took %.2fs.\n", t.duration());
+    uevent_stats_write();
 }
 
 int get_device_fd()
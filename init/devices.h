@@ -20,7 +20,10 @@
 #include <sys/stat.h>
 
 extern void handle_device_fd();
-extern void device_init(void);
+/* Default receive buffer size of the uevent socket. Is 256K enough? udev uses 16MB! */
+#define UEVENT_RCVBUF_SIZE (256*1024)
+
+extern void device_init(int rcvbuf_size);
 extern int add_dev_perms(const char *name, const char *attr,
                          mode_t perm, unsigned int uid,
                          unsigned int gid, unsigned short prefix,
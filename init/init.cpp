@@ -50,7 +50,11 @@
 #include <cutils/sockets.h>
 #include <private/android_filesystem_config.h>
 
+#include <functional>
 #include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
 
 #include "devices.h"
 #include "init.h"
@@ -184,11 +188,59 @@ static void publish_socket(const char *name, int fd)
     fcntl(fd, F_SETFD, 0);
 }
 
+// Returns true if svc lists dep among the services it comes after or
+// requires, directly or through other services.
+static bool service_depends_on(struct service *svc, struct service *dep, int depth)
+{
+    std::vector<std::string>* lists[] = { svc->after_, svc->requires_ };
+    if (depth > 16) {
+        return false;
+    }
+    for (auto names : lists) {
+        if (!names) {
+            continue;
+        }
+        for (auto& name : *names) {
+            struct service *other = service_find_by_name(name.c_str());
+            if (other == dep || (other && service_depends_on(other, dep, depth + 1))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// A service waits for the services it comes after that are themselves
+// waiting to start, and for the oneshot ones among them that are running.
+// Services that nobody started, or that are part of a dependency cycle,
+// do not hold it back.
+static bool service_is_blocked(struct service *svc)
+{
+    std::vector<std::string>* lists[] = { svc->after_, svc->requires_ };
+    for (auto names : lists) {
+        if (!names) {
+            continue;
+        }
+        for (auto& name : *names) {
+            struct service *dep = service_find_by_name(name.c_str());
+            if (!dep || dep == svc) {
+                continue;
+            }
+            bool pending = (dep->flags & SVC_WAITING) ||
+                    (dep->flags & (SVC_ONESHOT|SVC_RUNNING)) == (SVC_ONESHOT|SVC_RUNNING);
+            if (pending && !service_depends_on(dep, svc, 0)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 void service_start(struct service *svc, const char *dynamic_args)
 {
     // Starting a service removes it from the disabled or reset state and
     // immediately takes it out of the restarting state if it was in there.
-    svc->flags &= (~(SVC_DISABLED|SVC_RESTARTING|SVC_RESET|SVC_RESTART|SVC_DISABLED_START));
+    svc->flags &= (~(SVC_DISABLED|SVC_RESTARTING|SVC_RESET|SVC_RESTART|SVC_DISABLED_START|SVC_WAITING));
     svc->time_started = 0;
 
     // Running processes require no additional work --- if they're in the
@@ -198,6 +250,29 @@ void service_start(struct service *svc, const char *dynamic_args)
         return;
     }
 
+    // Start the services this one requires, then wait for those it comes
+    // after.  Everything else keeps starting in the meantime; waiting
+    // services are started from the main loop once they are unblocked.
+    // Dynamic arguments are not kept, so such starts do not wait.
+    if (!dynamic_args) {
+        svc->flags |= SVC_WAITING;
+        if (svc->requires_) {
+            for (auto& name : *svc->requires_) {
+                struct service *dep = service_find_by_name(name.c_str());
+                if (!dep) {
+                    ERROR("service '%s' requires unknown service '%s'\n", svc->name, name.c_str());
+                } else if (!(dep->flags & (SVC_RUNNING|SVC_WAITING))) {
+                    service_start(dep, NULL);
+                }
+            }
+        }
+        if (service_is_blocked(svc)) {
+            INFO("service '%s' waiting for the services it comes after\n", svc->name);
+            return;
+        }
+        svc->flags &= ~SVC_WAITING;
+    }
+
     bool needs_console = (svc->flags & SVC_CONSOLE);
     if (needs_console && !have_console) {
         ERROR("service '%s' requires console\n", svc->name);
@@ -380,13 +455,26 @@ void service_start(struct service *svc, const char *dynamic_args)
 
     if (pid < 0) {
         ERROR("failed to start '%s'\n", svc->name);
-        svc->pid = 0;
+        service_set_pid(svc, 0);
         return;
     }
 
     svc->time_started = gettime();
-    svc->pid = pid;
+    service_set_pid(svc, pid);
     svc->flags |= SVC_RUNNING;
+    bootchart_log_service(svc->name, pid);
+
+    uint64_t fork_ns = gettime_ns();
+    boot_timing_record("service %.3f %s %d\n", boot_timing_ms(fork_ns), svc->name, pid);
+    if ((svc->flags & SVC_EXEC) == 0 && properties_initialized()) {
+        // Only the first start is recorded, since the property is read-only.
+        std::string boottime_property = android::base::StringPrintf("ro.boottime.%s", svc->name);
+        char value[PROP_VALUE_MAX];
+        if (boottime_property.size() < PROP_NAME_MAX &&
+                init_property_get(boottime_property.c_str(), value) == 0) {
+            init_property_set(boottime_property.c_str(), std::to_string(fork_ns).c_str());
+        }
+    }
 
     if ((svc->flags & SVC_EXEC) != 0) {
         INFO("SVC_EXEC pid %d (uid %d gid %d+%zu context %s) started; waiting...\n",
@@ -403,7 +491,7 @@ static void service_stop_or_reset(struct service *svc, int how)
 {
     /* The service is still SVC_RUNNING until its process exits, but if it has
      * already exited it shoudn't attempt a restart yet. */
-    svc->flags &= ~(SVC_RESTARTING | SVC_DISABLED_START);
+    svc->flags &= ~(SVC_RESTARTING | SVC_DISABLED_START | SVC_WAITING);
 
     if ((how != SVC_DISABLED) && (how != SVC_RESET) && (how != SVC_RESTART)) {
         /* Hrm, an illegal flag.  Default to SVC_DISABLED */
@@ -448,33 +536,93 @@ void service_restart(struct service *svc)
     } /* else: Service is restarting anyways. */
 }
 
+/*
+ * When each action was queued and started, how long each command took, and
+ * when each service was started and exited, as text lines.  Written to
+ * BOOT_TIMING_FILE once the boot has completed; see "Boot timing" in
+ * readme.txt.
+ */
+#define BOOT_TIMING_FILE "/dev/init_boot_timing"
+
+static std::string boot_timing;
+static const size_t BOOT_TIMING_MAX = 1024 * 1024;
+
+double boot_timing_ms(uint64_t ns) {
+    return ns / 1000000.0;
+}
+
+void boot_timing_record(const char* fmt, ...) {
+    if (boot_timing.size() >= BOOT_TIMING_MAX) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    android::base::StringAppendV(&boot_timing, fmt, ap);
+    va_end(ap);
+}
+
 void property_changed(const char *name, const char *value)
 {
     if (property_triggers_enabled)
         queue_property_triggers(name, value);
+
+    if (!strcmp(name, "sys.boot_completed") && !strcmp(value, "1")) {
+        unlink(BOOT_TIMING_FILE);
+        write_file(BOOT_TIMING_FILE, boot_timing.c_str());
+    }
+}
+
+/*
+ * Services waiting to be restarted, soonest first.  Entries are left behind
+ * when a service is started or stopped in the meantime, and are skipped when
+ * they come up.
+ */
+typedef std::pair<time_t, struct service*> restart_entry;
+static std::priority_queue<restart_entry, std::vector<restart_entry>,
+                           std::greater<restart_entry>> restart_queue;
+
+static time_t restart_time(struct service *svc)
+{
+    return svc->time_started + 5;
 }
 
-static void restart_service_if_needed(struct service *svc)
+void service_schedule_restart(struct service *svc)
 {
-    time_t next_start_time = svc->time_started + 5;
+    svc->flags |= SVC_RESTARTING;
+    restart_queue.push(restart_entry(restart_time(svc), svc));
+}
 
-    if (next_start_time <= gettime()) {
-        svc->flags &= (~SVC_RESTARTING);
+static bool started_waiting_service;
+
+static void start_if_unblocked(struct service *svc)
+{
+    if (!service_is_blocked(svc)) {
         service_start(svc, NULL);
-        return;
+        started_waiting_service = true;
     }
+}
 
-    if ((next_start_time < process_needs_restart) ||
-        (process_needs_restart == 0)) {
-        process_needs_restart = next_start_time;
-    }
+// Starts the waiting services that are no longer blocked.
+// Returns true if it started any.
+bool service_start_waiting()
+{
+    started_waiting_service = false;
+    service_for_each_flags(SVC_WAITING, start_if_unblocked);
+    return started_waiting_service;
 }
 
 static void restart_processes()
 {
-    process_needs_restart = 0;
-    service_for_each_flags(SVC_RESTARTING,
-                           restart_service_if_needed);
+    time_t now = gettime();
+    while (!restart_queue.empty() && restart_queue.top().first <= now) {
+        struct service *svc = restart_queue.top().second;
+        restart_queue.pop();
+        if ((svc->flags & SVC_RESTARTING) && restart_time(svc) <= now) {
+            svc->flags &= (~SVC_RESTARTING);
+            service_start(svc, NULL);
+        }
+    }
+    process_needs_restart = restart_queue.empty() ? 0 : restart_queue.top().first;
 }
 
 static void msg_start(const char *name)
@@ -597,6 +745,9 @@ void execute_one_command() {
         build_triggers_string(name_str, sizeof(name_str), cur_action);
 
         INFO("processing action %p (%s)\n", cur_action, name_str);
+        bootchart_log_action(name_str);
+        boot_timing_record("action %.3f %.3f %s\n", boot_timing_ms(cur_action->queued_ns),
+                           boot_timing_ms(gettime_ns()), name_str);
         cur_command = get_first_command(cur_action);
     } else {
         cur_command = get_next_command(cur_action, cur_command);
@@ -606,7 +757,13 @@ void execute_one_command() {
         return;
     }
 
+    uint64_t start_ns = gettime_ns();
     int result = cur_command->func(cur_command->nargs, cur_command->args);
+    uint64_t end_ns = gettime_ns();
+    boot_timing_record("command %.3f %.3f %s %s:%d\n", boot_timing_ms(start_ns),
+                       boot_timing_ms(end_ns - start_ns), cur_command->args[0],
+                       cur_command->filename ? cur_command->filename : "builtin",
+                       cur_command->line);
     if (klog_get_level() >= KLOG_INFO_LEVEL) {
         for (int i = 0; i < cur_command->nargs; i++) {
             strlcat(cmd_str, cur_command->args[i], sizeof(cmd_str));
@@ -1127,6 +1284,11 @@ int main(int argc, char** argv) {
             restart_processes();
         }
 
+        // Services waiting for others start as soon as those have started or,
+        // for oneshot services, exited; they are not held up by exec.
+        while (service_start_waiting()) {
+        }
+
         int timeout = -1;
         if (process_needs_restart) {
             timeout = (process_needs_restart - gettime()) * 1000;
@@ -1138,8 +1300,6 @@ int main(int argc, char** argv) {
             timeout = 0;
         }
 
-        bootchart_sample(&timeout);
-
         epoll_event ev;
         int nr = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd, &ev, 1, timeout));
         if (nr == -1) {
@@ -17,6 +17,7 @@
 #ifndef _INIT_INIT_H
 #define _INIT_INIT_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <string>
@@ -54,6 +55,9 @@ struct action {
 
     unsigned hash;
 
+        /* when the action was last queued, for the boot timing */
+    uint64_t queued_ns;
+
         /* list of actions which triggers the commands*/
     struct listnode triggers;
     struct listnode commands;
@@ -87,6 +91,7 @@ struct svcenvinfo {
 #define SVC_RESTART        0x100  // Use to safely restart (stop, wait, start) a service.
 #define SVC_DISABLED_START 0x200  // A start was requested but it was disabled at the time.
 #define SVC_EXEC           0x400  // This synthetic service corresponds to an 'exec'.
+#define SVC_WAITING        0x800  // A start was requested but waits for the services it comes after.
 
 #define NR_SVC_SUPP_GIDS 12    /* twelve supplementary groups */
 
@@ -121,6 +126,10 @@ struct service {
 
     std::vector<std::string>* writepid_files_;
 
+    /* Services this one is started after, and services it starts first. */
+    std::vector<std::string>* after_;
+    std::vector<std::string>* requires_;
+
     /* keycodes for triggering this service via /dev/keychord */
     int *keycodes;
     int nkeycodes;
@@ -144,6 +153,7 @@ void handle_control_message(const char *msg, const char *arg);
 
 struct service *service_find_by_name(const char *name);
 struct service *service_find_by_pid(pid_t pid);
+void service_set_pid(struct service *svc, pid_t pid);
 struct service *service_find_by_keychord(int keychord_id);
 void service_for_each(void (*func)(struct service *svc));
 void service_for_each_class(const char *classname,
@@ -154,6 +164,8 @@ void service_stop(struct service *svc);
 void service_reset(struct service *svc);
 void service_restart(struct service *svc);
 void service_start(struct service *svc, const char *dynamic_args);
+void service_schedule_restart(struct service *svc);
+bool service_start_waiting();
 void property_changed(const char *name, const char *value);
 
 int selinux_reload_policy(void);
@@ -162,4 +174,7 @@ void zap_stdio(void);
 
 void register_epoll_handler(int fd, void (*fn)());
 
+void boot_timing_record(const char* fmt, ...) __printflike(1, 2);
+double boot_timing_ms(uint64_t ns);
+
 #endif	/* _INIT_INIT_H */
@@ -25,11 +25,16 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "init.h"
 #include "parser.h"
 #include "init_parser.h"
 #include "log.h"
 #include "property_service.h"
+#include "rc_cache.h"
 #include "util.h"
 
 #include <cutils/iosched_policy.h>
@@ -39,6 +44,10 @@ static list_declare(service_list);
 static list_declare(action_list);
 static list_declare(action_queue);
 
+// The actions with a trigger on each property, in action_list order, so that
+// setting a property only looks at the actions that depend on it.
+static std::unordered_map<std::string, std::vector<struct action*>> property_actions;
+
 struct import {
     struct listnode list;
     const char *filename;
@@ -117,6 +126,9 @@ void dump_parser_state() {
 static int lookup_keyword(const char *s)
 {
     switch (*s++) {
+    case 'a':
+        if (!strcmp(s, "fter")) return K_after;
+        break;
     case 'b':
         if (!strcmp(s, "ootchart_init")) return K_bootchart_init;
         break;
@@ -176,6 +188,7 @@ static int lookup_keyword(const char *s)
         if (!strcmp(s, "owerctl")) return K_powerctl;
         break;
     case 'r':
+        if (!strcmp(s, "equires")) return K_requires;
         if (!strcmp(s, "estart")) return K_restart;
         if (!strcmp(s, "estorecon")) return K_restorecon;
         if (!strcmp(s, "estorecon_recursive")) return K_restorecon_recursive;
@@ -383,6 +396,24 @@ static void parse_new_section(struct parse_state *state, int kw,
     state->parse_line = parse_line_no_op;
 }
 
+static void parse_config_line(struct parse_state *state, int nargs, char **args)
+{
+    int kw = lookup_keyword(args[0]);
+    if (kw_is(kw, SECTION)) {
+        state->parse_line(state, 0, 0);
+        parse_new_section(state, kw, nargs, args);
+    } else {
+        state->parse_line(state, nargs, args);
+    }
+}
+
+static void parse_cached_line(int line, int nargs, char **args, void *cookie)
+{
+    struct parse_state *state = (struct parse_state*) cookie;
+    state->line = line;
+    parse_config_line(state, nargs, args);
+}
+
 static void parse_config(const char *fn, const std::string& data)
 {
     struct listnode import_list;
@@ -394,13 +425,21 @@ static void parse_config(const char *fn, const std::string& data)
     parse_state state;
     state.filename = fn;
     state.line = 0;
-    state.ptr = strdup(data.c_str());  // TODO: fix this code!
     state.nexttoken = 0;
     state.parse_line = parse_line_no_op;
 
     list_init(&import_list);
     state.priv = &import_list;
 
+    // Use the compiled form of the file if it is up to date.
+    std::string cache_path = std::string(fn) + RC_CACHE_SUFFIX;
+    if (rc_cache_load(cache_path.c_str(), data, parse_cached_line, &state)) {
+        INFO("Using %s\n", cache_path.c_str());
+        state.parse_line(&state, 0, 0);
+        goto parser_done;
+    }
+
+    state.ptr = strdup(data.c_str());  // TODO: fix this code!
     for (;;) {
         switch (next_token(&state)) {
         case T_EOF:
@@ -409,13 +448,7 @@ static void parse_config(const char *fn, const std::string& data)
         case T_NEWLINE:
             state.line++;
             if (nargs) {
-                int kw = lookup_keyword(args[0]);
-                if (kw_is(kw, SECTION)) {
-                    state.parse_line(&state, 0, 0);
-                    parse_new_section(&state, kw, nargs, args);
-                } else {
-                    state.parse_line(&state, nargs, args);
-                }
+                parse_config_line(&state, nargs, args);
                 nargs = 0;
             }
             break;
@@ -482,17 +515,24 @@ struct service *service_find_by_name(const char *name)
     return 0;
 }
 
-struct service *service_find_by_pid(pid_t pid)
+// The services that are running, by pid.
+static std::unordered_map<pid_t, struct service*> service_pids;
+
+void service_set_pid(struct service *svc, pid_t pid)
 {
-    struct listnode *node;
-    struct service *svc;
-    list_for_each(node, &service_list) {
-        svc = node_to_item(node, struct service, slist);
-        if (svc->pid == pid) {
-            return svc;
-        }
+    if (svc->pid) {
+        service_pids.erase(svc->pid);
     }
-    return 0;
+    svc->pid = pid;
+    if (pid) {
+        service_pids[pid] = svc;
+    }
+}
+
+struct service *service_find_by_pid(pid_t pid)
+{
+    auto it = service_pids.find(pid);
+    return it != service_pids.end() ? it->second : 0;
 }
 
 struct service *service_find_by_keychord(int keychord_id)
@@ -563,54 +603,74 @@ void action_for_each_trigger(const char *trigger,
 }
 
 
-void queue_property_triggers(const char *name, const char *value)
+// Returns true if all of the triggers of act are property triggers that hold,
+// given that the property name (if not NULL) has just been set to value.
+static bool action_property_triggers_match(struct action *act, const char *name,
+                                           const char *value)
 {
-    struct listnode *node, *node2;
-    struct action *act;
+    struct listnode *node;
     struct trigger *cur_trigger;
-    bool match;
+    bool match = !name;
     int name_length;
 
-    list_for_each(node, &action_list) {
-        act = node_to_item(node, struct action, alist);
-        match = !name;
-        list_for_each(node2, &act->triggers) {
-            cur_trigger = node_to_item(node2, struct trigger, nlist);
-            if (!strncmp(cur_trigger->name, "property:", strlen("property:"))) {
-                const char *test = cur_trigger->name + strlen("property:");
-                if (!match) {
-                    name_length = strlen(name);
-                    if (!strncmp(name, test, name_length) &&
-                        test[name_length] == '=' &&
-                        (!strcmp(test + name_length + 1, value) ||
-                        !strcmp(test + name_length + 1, "*"))) {
-                        match = true;
+    list_for_each(node, &act->triggers) {
+        cur_trigger = node_to_item(node, struct trigger, nlist);
+        if (!strncmp(cur_trigger->name, "property:", strlen("property:"))) {
+            const char *test = cur_trigger->name + strlen("property:");
+            if (!match) {
+                name_length = strlen(name);
+                if (!strncmp(name, test, name_length) &&
+                    test[name_length] == '=' &&
+                    (!strcmp(test + name_length + 1, value) ||
+                    !strcmp(test + name_length + 1, "*"))) {
+                    match = true;
+                    continue;
+                }
+            }
+            const char* equals = strchr(test, '=');
+            if (equals) {
+                char prop_name[PROP_NAME_MAX + 1];
+                char value[PROP_VALUE_MAX];
+                int length = equals - test;
+                if (length <= PROP_NAME_MAX) {
+                    int ret;
+                    memcpy(prop_name, test, length);
+                    prop_name[length] = 0;
+
+                    /* does the property exist, and match the trigger value? */
+                    ret = __property_get(prop_name, value);
+                    if (ret > 0 && (!strcmp(equals + 1, value) ||
+                                    !strcmp(equals + 1, "*"))) {
                         continue;
                     }
                 }
-                const char* equals = strchr(test, '=');
-                if (equals) {
-                    char prop_name[PROP_NAME_MAX + 1];
-                    char value[PROP_VALUE_MAX];
-                    int length = equals - test;
-                    if (length <= PROP_NAME_MAX) {
-                        int ret;
-                        memcpy(prop_name, test, length);
-                        prop_name[length] = 0;
-
-                        /* does the property exist, and match the trigger value? */
-                        ret = __property_get(prop_name, value);
-                        if (ret > 0 && (!strcmp(equals + 1, value) ||
-                                        !strcmp(equals + 1, "*"))) {
-                            continue;
-                        }
-                    }
+            }
+        }
+        return false;
+    }
+    return match;
+}
+
+void queue_property_triggers(const char *name, const char *value)
+{
+    struct listnode *node;
+    struct action *act;
+
+    if (name) {
+        auto it = property_actions.find(name);
+        if (it != property_actions.end()) {
+            for (auto act : it->second) {
+                if (action_property_triggers_match(act, name, value)) {
+                    action_add_queue_tail(act);
                 }
             }
-            match = false;
-            break;
         }
-        if (match) {
+        return;
+    }
+
+    list_for_each(node, &action_list) {
+        act = node_to_item(node, struct action, alist);
+        if (action_property_triggers_match(act, name, value)) {
             action_add_queue_tail(act);
         }
     }
@@ -644,6 +704,7 @@ void queue_builtin_action(int (*func)(int nargs, char **args), const char *name)
 void action_add_queue_tail(struct action *act)
 {
     if (list_empty(&act->qlist)) {
+        act->queued_ns = gettime_ns();
         list_add_tail(&action_queue, &act->qlist);
     }
 }
@@ -928,6 +989,21 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
             svc->seclabel = args[1];
         }
         break;
+    case K_after:
+    case K_requires: {
+        if (nargs < 2) {
+            parse_error(state, "%s option requires at least one service name\n", args[0]);
+            break;
+        }
+        std::vector<std::string>*& names = (kw == K_after) ? svc->after_ : svc->requires_;
+        if (!names) {
+            names = new std::vector<std::string>;
+        }
+        for (int i = 1; i < nargs; ++i) {
+            names->push_back(args[i]);
+        }
+        break;
+    }
     case K_writepid:
         if (nargs < 2) {
             parse_error(state, "writepid option requires at least one filename\n");
@@ -946,6 +1022,7 @@ static void parse_line_service(struct parse_state *state, int nargs, char **args
 
 static void *parse_action(struct parse_state *state, int nargs, char **args)
 {
+    struct listnode *node;
     struct trigger *cur_trigger;
     int i;
     if (nargs < 2) {
@@ -979,7 +1056,21 @@ static void *parse_action(struct parse_state *state, int nargs, char **args)
     list_init(&act->commands);
     list_init(&act->qlist);
     list_add_tail(&action_list, &act->alist);
-        /* XXX add to hash */
+
+    list_for_each(node, &act->triggers) {
+        cur_trigger = node_to_item(node, struct trigger, nlist);
+        if (strncmp(cur_trigger->name, "property:", strlen("property:"))) {
+            continue;
+        }
+        const char* test = cur_trigger->name + strlen("property:");
+        const char* equals = strchr(test, '=');
+        if (equals) {
+            auto& actions = property_actions[std::string(test, equals - test)];
+            if (actions.empty() || actions.back() != act) {
+                actions.push_back(act);
+            }
+        }
+    }
     return act;
 }
 
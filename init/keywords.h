@@ -45,6 +45,7 @@ int do_confirm_formated(int nargs, char **args);
 enum {
     K_UNKNOWN,
 #endif
+    KEYWORD(after,       OPTION,  0, 0)
     KEYWORD(bootchart_init,        COMMAND, 0, do_bootchart_init)
     KEYWORD(chmod,       COMMAND, 2, do_chmod)
     KEYWORD(chown,       COMMAND, 2, do_chown)
@@ -78,6 +79,7 @@ enum {
     KEYWORD(onrestart,   OPTION,  0, 0)
     KEYWORD(on,          SECTION, 0, 0)
     KEYWORD(powerctl,    COMMAND, 1, do_powerctl)
+    KEYWORD(requires,    OPTION,  0, 0)
     KEYWORD(restart,     COMMAND, 1, do_restart)
     KEYWORD(restorecon,  COMMAND, 1, do_restorecon)
     KEYWORD(restorecon_recursive,  COMMAND, 1, do_restorecon_recursive)
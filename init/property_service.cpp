@@ -24,9 +24,14 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
+#include <map>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <cutils/misc.h>
 #include <cutils/sockets.h>
@@ -56,6 +61,8 @@
 #include "log.h"
 
 #define PERSISTENT_PROPERTY_DIR  "/data/property"
+#define PERSISTENT_PROPERTY_FILE PERSISTENT_PROPERTY_DIR "/persistent_properties"
+#define PERSISTENT_FLUSH_DELAY_MS 500
 #define FSTAB_PREFIX "/fstab."
 #define RECOVERY_MOUNT_POINT "/recovery"
 
@@ -63,6 +70,7 @@ static int persistent_properties_loaded = 0;
 static bool property_area_initialized = false;
 
 static int property_set_fd = -1;
+static int property_conn_epoll_fd = -1;
 
 struct workspace {
     size_t size;
@@ -90,6 +98,35 @@ void property_init() {
     }
 }
 
+/*
+ * The contexts of the properties looked up so far.  property_contexts only
+ * changes when the policy is reloaded, which clears the cache.  The cache is
+ * bounded because ctl.* names come from the clients.
+ */
+static std::unordered_map<std::string, std::string> property_contexts;
+
+/*
+ * Returns the context of the given property, or NULL.  The result is valid
+ * until the next lookup.
+ */
+static char* lookup_property_context(const char *name)
+{
+    auto it = property_contexts.find(name);
+    if (it != property_contexts.end()) {
+        return const_cast<char*>(it->second.c_str());
+    }
+
+    char* tctx = NULL;
+    if (selabel_lookup(sehandle_prop, &tctx, name, 1) != 0)
+        return NULL;
+    if (property_contexts.size() >= 4096) {
+        property_contexts.clear();
+    }
+    char* result = const_cast<char*>(property_contexts.emplace(name, tctx).first->second.c_str());
+    freecon(tctx);
+    return result;
+}
+
 static int check_mac_perms(const char *name, char *sctx)
 {
     if (is_selinux_enabled() <= 0)
@@ -104,13 +141,13 @@ static int check_mac_perms(const char *name, char *sctx)
     if (!sehandle_prop)
         goto err;
 
-    if (selabel_lookup(sehandle_prop, &tctx, name, 1) != 0)
+    tctx = lookup_property_context(name);
+    if (!tctx)
         goto err;
 
     if (selinux_check_access(sctx, tctx, "property_service", "set", (void*) name) == 0)
         result = 1;
 
-    freecon(tctx);
  err:
     return result;
 }
@@ -149,26 +186,67 @@ int __property_get(const char *name, char *value)
     return __system_property_get(name, value);
 }
 
-static void write_persistent_property(const char *name, const char *value)
+/*
+ * The persistent properties, in memory.  Changes are written behind, so that
+ * a burst of changes costs one write and one fsync: the first change arms
+ * persistent_flush_fd, and when it fires the whole set is written to a single
+ * file as name\0value\0 records, which replaces the old file atomically.
+ */
+static std::map<std::string, std::string> persistent_properties;
+static bool persistent_properties_dirty = false;
+static int persistent_flush_fd = -1;
+
+static bool flush_persistent_properties()
 {
-    char tempPath[PATH_MAX];
-    char path[PATH_MAX];
-    int fd;
+    if (!persistent_properties_dirty) {
+        return true;
+    }
+    persistent_properties_dirty = false;
+
+    std::string content;
+    for (auto& it : persistent_properties) {
+        content.append(it.first.c_str(), it.first.size() + 1);
+        content.append(it.second.c_str(), it.second.size() + 1);
+    }
 
+    char tempPath[PATH_MAX];
     snprintf(tempPath, sizeof(tempPath), "%s/.temp.XXXXXX", PERSISTENT_PROPERTY_DIR);
-    fd = mkstemp(tempPath);
+    int fd = mkstemp(tempPath);
     if (fd < 0) {
         ERROR("Unable to write persistent property to temp file %s: %s\n", tempPath, strerror(errno));
-        return;
+        return false;
     }
-    write(fd, value, strlen(value));
-    fsync(fd);
+    bool ok = android::base::WriteStringToFd(content, fd) && fsync(fd) == 0;
     close(fd);
 
-    snprintf(path, sizeof(path), "%s/%s", PERSISTENT_PROPERTY_DIR, name);
-    if (rename(tempPath, path)) {
+    if (!ok || rename(tempPath, PERSISTENT_PROPERTY_FILE)) {
         unlink(tempPath);
-        ERROR("Unable to rename persistent property file %s to %s\n", tempPath, path);
+        ERROR("Unable to write persistent property file %s\n", PERSISTENT_PROPERTY_FILE);
+        return false;
+    }
+    return true;
+}
+
+static void handle_persistent_flush_fd()
+{
+    uint64_t expirations;
+    TEMP_FAILURE_RETRY(read(persistent_flush_fd, &expirations, sizeof(expirations)));
+    flush_persistent_properties();
+}
+
+static void write_persistent_property(const char *name, const char *value)
+{
+    persistent_properties[name] = value;
+    if (persistent_properties_dirty) {
+        return;
+    }
+    persistent_properties_dirty = true;
+
+    itimerspec delay = {};
+    delay.it_value.tv_sec = PERSISTENT_FLUSH_DELAY_MS / 1000;
+    delay.it_value.tv_nsec = (PERSISTENT_FLUSH_DELAY_MS % 1000) * 1000000L;
+    if (persistent_flush_fd == -1 || timerfd_settime(persistent_flush_fd, 0, &delay, NULL) == -1) {
+        flush_persistent_properties();
     }
 }
 
@@ -209,6 +287,7 @@ static int property_set_impl(const char* name, const char* value) {
         if (selinux_reload_policy() != 0) {
             ERROR("Failed to reload policy\n");
         }
+        property_contexts.clear();
     } else if (strcmp("selinux.restorecon_recursive", name) == 0 && valuelen > 0) {
         if (restorecon_recursive(value) != 0) {
             ERROR("Failed to restorecon_recursive %s\n", value);
@@ -252,6 +331,10 @@ static int property_set_impl(const char* name, const char* value) {
          */
         write_persistent_property(name, value);
     }
+    if (strcmp("sys.powerctl", name) == 0) {
+        // Don't lose the changes that are still waiting to be written.
+        flush_persistent_properties();
+    }
     property_changed(name, value);
     return 0;
 }
@@ -264,96 +347,201 @@ int init_property_set(const char *name, const char *value) {
     return rc;
 }
 
-static void handle_property_set_fd()
-{
-    prop_msg msg;
-    int s;
-    int r;
+// A client connection whose messages have not all arrived yet.
+struct property_conn {
+    int fd;
     struct ucred cr;
-    struct sockaddr_un addr;
-    socklen_t addr_size = sizeof(addr);
-    socklen_t cr_size = sizeof(cr);
-    char * source_ctx = NULL;
-    struct pollfd ufds[1];
-    const int timeout_ms = 2 * 1000;  /* Default 2 sec timeout for caller to send property. */
-    int nr;
+    char* source_ctx;
+    uint64_t deadline_ns;
+    size_t received;
+    prop_msg msg;
+};
 
-    if ((s = accept(property_set_fd, (struct sockaddr *) &addr, &addr_size)) < 0) {
-        return;
-    }
+/* Default 2 sec timeout for caller to send property. */
+static const uint64_t PROPERTY_CONN_TIMEOUT_NS = 2000000000ULL;
+static const size_t PROPERTY_CONN_MAX = 64;
 
-    /* Check socket options here */
-    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
-        close(s);
-        ERROR("Unable to receive socket options\n");
-        return;
-    }
+static std::map<int, property_conn*> property_conns;
 
-    ufds[0].fd = s;
-    ufds[0].events = POLLIN;
-    ufds[0].revents = 0;
-    nr = TEMP_FAILURE_RETRY(poll(ufds, 1, timeout_ms));
-    if (nr == 0) {
-        ERROR("sys_prop: timeout waiting for uid=%d to send property message.\n", cr.uid);
-        close(s);
-        return;
-    } else if (nr < 0) {
-        ERROR("sys_prop: error waiting for uid=%d to send property message: %s\n", cr.uid, strerror(errno));
-        close(s);
-        return;
-    }
+static void close_property_conn(property_conn* conn)
+{
+    epoll_ctl(property_conn_epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    freecon(conn->source_ctx);
+    property_conns.erase(conn->fd);
+    delete conn;
+}
 
-    r = TEMP_FAILURE_RETRY(recv(s, &msg, sizeof(msg), MSG_DONTWAIT));
-    if(r != sizeof(prop_msg)) {
-        ERROR("sys_prop: mis-match msg size received: %d expected: %zu: %s\n",
-              r, sizeof(prop_msg), strerror(errno));
-        close(s);
-        return;
+/*
+ * Drops the connections whose client has not sent its messages in time, and
+ * the oldest ones if there are too many, so that no client can tie up init.
+ */
+static void expire_property_conns(size_t max_count)
+{
+    uint64_t now = gettime_ns();
+    while (!property_conns.empty()) {
+        property_conn* oldest = NULL;
+        for (auto& it : property_conns) {
+            if (!oldest || it.second->deadline_ns < oldest->deadline_ns) {
+                oldest = it.second;
+            }
+        }
+        if (oldest->deadline_ns > now && property_conns.size() <= max_count) {
+            break;
+        }
+        ERROR("sys_prop: timeout waiting for uid=%d to send property message.\n",
+              oldest->cr.uid);
+        close_property_conn(oldest);
     }
+}
+
+/*
+ * Handles one message.  Returns true if the client expects more messages on
+ * the connection, and false if the connection has been closed.
+ */
+static bool handle_property_msg(property_conn* conn)
+{
+    prop_msg& msg = conn->msg;
+    bool batch = msg.cmd == PROP_MSG_SETPROPS;
 
     switch(msg.cmd) {
     case PROP_MSG_SETPROP:
+    case PROP_MSG_SETPROPS:
         msg.name[PROP_NAME_MAX-1] = 0;
         msg.value[PROP_VALUE_MAX-1] = 0;
 
         if (!is_legal_property_name(msg.name, strlen(msg.name))) {
             ERROR("sys_prop: illegal property name. Got: \"%s\"\n", msg.name);
-            close(s);
-            return;
+            close_property_conn(conn);
+            return false;
         }
 
-        getpeercon(s, &source_ctx);
-
         if(memcmp(msg.name,"ctl.",4) == 0) {
             // Keep the old close-socket-early behavior when handling
             // ctl.* properties.
-            close(s);
+            struct ucred cr = conn->cr;
+            char* source_ctx = conn->source_ctx;
+            if (!batch) {
+                conn->source_ctx = NULL;
+                close_property_conn(conn);
+            }
             if (check_control_mac_perms(msg.value, source_ctx)) {
                 handle_control_message((char*) msg.name + 4, (char*) msg.value);
             } else {
                 ERROR("sys_prop: Unable to %s service ctl [%s] uid:%d gid:%d pid:%d\n",
                         msg.name + 4, msg.value, cr.uid, cr.gid, cr.pid);
             }
+            if (!batch) {
+                freecon(source_ctx);
+                return false;
+            }
         } else {
-            if (check_perms(msg.name, source_ctx)) {
+            if (check_perms(msg.name, conn->source_ctx)) {
                 init_property_set((char*) msg.name, (char*) msg.value);
             } else {
                 ERROR("sys_prop: permission denied uid:%d  name:%s\n",
-                      cr.uid, msg.name);
+                      conn->cr.uid, msg.name);
             }
 
             // Note: bionic's property client code assumes that the
             // property server will not close the socket until *AFTER*
             // the property is written to memory.
-            close(s);
+            if (!batch) {
+                close_property_conn(conn);
+                return false;
+            }
         }
-        freecon(source_ctx);
-        break;
+        return true;
 
     default:
+        close_property_conn(conn);
+        return false;
+    }
+}
+
+// Reads whatever the client has sent so far, without blocking.
+static void read_property_conn(property_conn* conn)
+{
+    for (;;) {
+        char* buf = reinterpret_cast<char*>(&conn->msg);
+        int r = TEMP_FAILURE_RETRY(recv(conn->fd, buf + conn->received,
+                                        sizeof(prop_msg) - conn->received, MSG_DONTWAIT));
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (r <= 0) {
+            if (r < 0 || conn->received) {
+                ERROR("sys_prop: mis-match msg size received: %zu expected: %zu: %s\n",
+                      conn->received, sizeof(prop_msg), strerror(errno));
+            }
+            close_property_conn(conn);
+            return;
+        }
+        conn->received += r;
+        if (conn->received < sizeof(prop_msg)) {
+            continue;
+        }
+        conn->received = 0;
+        if (!handle_property_msg(conn)) {
+            return;
+        }
+        conn->deadline_ns = gettime_ns() + PROPERTY_CONN_TIMEOUT_NS;
+    }
+}
+
+static void handle_property_conn_fds()
+{
+    epoll_event events[16];
+    int nr = TEMP_FAILURE_RETRY(epoll_wait(property_conn_epoll_fd, events, 16, 0));
+    for (int i = 0; i < nr; i++) {
+        auto it = property_conns.find(events[i].data.fd);
+        if (it != property_conns.end()) {
+            read_property_conn(it->second);
+        }
+    }
+    expire_property_conns(PROPERTY_CONN_MAX);
+}
+
+static void handle_property_set_fd()
+{
+    int s;
+    struct ucred cr;
+    struct sockaddr_un addr;
+    socklen_t addr_size = sizeof(addr);
+    socklen_t cr_size = sizeof(cr);
+
+    if ((s = accept4(property_set_fd, (struct sockaddr *) &addr, &addr_size,
+                     SOCK_CLOEXEC | SOCK_NONBLOCK)) < 0) {
+        return;
+    }
+
+    /* Check socket options here */
+    if (getsockopt(s, SOL_SOCKET, SO_PEERCRED, &cr, &cr_size) < 0) {
         close(s);
-        break;
+        ERROR("Unable to receive socket options\n");
+        return;
     }
+
+    property_conn* conn = new property_conn();
+    conn->fd = s;
+    conn->cr = cr;
+    conn->deadline_ns = gettime_ns() + PROPERTY_CONN_TIMEOUT_NS;
+    // The peer's context is looked up once and used for all its messages.
+    getpeercon(s, &conn->source_ctx);
+    property_conns[s] = conn;
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = s;
+    if (epoll_ctl(property_conn_epoll_fd, EPOLL_CTL_ADD, s, &ev) == -1) {
+        ERROR("epoll_ctl failed: %s\n", strerror(errno));
+        close_property_conn(conn);
+        return;
+    }
+
+    // The message has usually arrived already.
+    read_property_conn(conn);
+    expire_property_conns(PROPERTY_CONN_MAX);
 }
 
 void get_property_workspace(int *fd, int *sz)
@@ -438,9 +626,32 @@ static void load_properties_from_file(const char* filename, const char* filter)
     NOTICE("(Loading properties from %s took %.2fs.)\n", filename, t.duration());
 }
 
-static void load_persistent_properties() {
-    persistent_properties_loaded = 1;
+// Returns true if the persistent property file at fd may be trusted.
+static bool is_secure_persistent_file(int fd, const char* name)
+{
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        ERROR("fstat on property file \"%s\" failed: %s\n", name, strerror(errno));
+        return false;
+    }
 
+    // File must not be accessible to others, be owned by root/root, and
+    // not be a hard link to any other file.
+    if (((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0) || (sb.st_uid != 0) || (sb.st_gid != 0) ||
+            (sb.st_nlink != 1)) {
+        ERROR("skipping insecure property file %s (uid=%u gid=%u nlink=%u mode=%o)\n",
+              name, (unsigned int)sb.st_uid, (unsigned int)sb.st_gid,
+              (unsigned int)sb.st_nlink, sb.st_mode);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Reads the one-file-per-property layout that was used before
+ * PERSISTENT_PROPERTY_FILE, and removes the files once they are read.
+ */
+static void load_legacy_persistent_properties(std::map<std::string, std::string>* properties) {
     std::unique_ptr<DIR, int(*)(DIR*)> dir(opendir(PERSISTENT_PROPERTY_DIR), closedir);
     if (!dir) {
         ERROR("Unable to open persistent property directory \"%s\": %s\n",
@@ -448,6 +659,7 @@ static void load_persistent_properties() {
         return;
     }
 
+    std::vector<std::string> names;
     struct dirent* entry;
     while ((entry = readdir(dir.get())) != NULL) {
         if (strncmp("persist.", entry->d_name, strlen("persist."))) {
@@ -458,27 +670,13 @@ static void load_persistent_properties() {
         }
 
         // Open the file and read the property value.
-        int fd = openat(dirfd(dir.get()), entry->d_name, O_RDONLY | O_NOFOLLOW);
+        int fd = openat(dirfd(dir.get()), entry->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
         if (fd == -1) {
             ERROR("Unable to open persistent property file \"%s\": %s\n",
                   entry->d_name, strerror(errno));
             continue;
         }
-
-        struct stat sb;
-        if (fstat(fd, &sb) == -1) {
-            ERROR("fstat on property file \"%s\" failed: %s\n", entry->d_name, strerror(errno));
-            close(fd);
-            continue;
-        }
-
-        // File must not be accessible to others, be owned by root/root, and
-        // not be a hard link to any other file.
-        if (((sb.st_mode & (S_IRWXG | S_IRWXO)) != 0) || (sb.st_uid != 0) || (sb.st_gid != 0) ||
-                (sb.st_nlink != 1)) {
-            ERROR("skipping insecure property file %s (uid=%u gid=%u nlink=%u mode=%o)\n",
-                  entry->d_name, (unsigned int)sb.st_uid, (unsigned int)sb.st_gid,
-                  (unsigned int)sb.st_nlink, sb.st_mode);
+        if (!is_secure_persistent_file(fd, entry->d_name)) {
             close(fd);
             continue;
         }
@@ -487,13 +685,78 @@ static void load_persistent_properties() {
         int length = read(fd, value, sizeof(value) - 1);
         if (length >= 0) {
             value[length] = 0;
-            init_property_set(entry->d_name, value);
+            (*properties)[entry->d_name] = value;
+            names.push_back(entry->d_name);
         } else {
             ERROR("Unable to read persistent property file %s: %s\n",
                   entry->d_name, strerror(errno));
         }
         close(fd);
     }
+
+    if (names.empty()) {
+        return;
+    }
+    persistent_properties = *properties;
+    persistent_properties_dirty = true;
+    if (flush_persistent_properties()) {
+        for (auto& name : names) {
+            unlinkat(dirfd(dir.get()), name.c_str(), 0);
+        }
+    }
+}
+
+static void load_persistent_properties() {
+    std::map<std::string, std::string> properties;
+
+    int fd = open(PERSISTENT_PROPERTY_FILE, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT) {
+        load_legacy_persistent_properties(&properties);
+    } else if (fd == -1) {
+        ERROR("Unable to open persistent property file \"%s\": %s\n",
+              PERSISTENT_PROPERTY_FILE, strerror(errno));
+    } else {
+        std::string content;
+        if (!is_secure_persistent_file(fd, PERSISTENT_PROPERTY_FILE)) {
+            // Ignore it.
+        } else if (!android::base::ReadFdToString(fd, &content)) {
+            ERROR("Unable to read persistent property file %s: %s\n",
+                  PERSISTENT_PROPERTY_FILE, strerror(errno));
+        } else {
+            // A record cut short by a crash ends the file.
+            const char* p = content.c_str();
+            const char* end = p + content.size();
+            for (;;) {
+                const char* name_end = static_cast<const char*>(memchr(p, 0, end - p));
+                if (!name_end) break;
+                const char* value = name_end + 1;
+                const char* value_end = static_cast<const char*>(memchr(value, 0, end - value));
+                if (!value_end) break;
+                if (!strncmp("persist.", p, strlen("persist."))) {
+                    properties[p] = value;
+                }
+                p = value_end + 1;
+            }
+        }
+        close(fd);
+    }
+
+    // Setting the loaded properties must not write them back.
+    persistent_properties_loaded = 0;
+    for (auto& it : properties) {
+        init_property_set(it.first.c_str(), it.second.c_str());
+    }
+    persistent_properties = properties;
+    persistent_properties_loaded = 1;
+
+    if (persistent_flush_fd == -1) {
+        persistent_flush_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (persistent_flush_fd == -1) {
+            ERROR("timerfd_create failed: %s\n", strerror(errno));
+        } else {
+            register_epoll_handler(persistent_flush_fd, handle_persistent_flush_fd);
+        }
+    }
 }
 
 void property_load_boot_defaults() {
@@ -582,5 +845,14 @@ void start_property_service() {
 
     listen(property_set_fd, 8);
 
+    // Connections wait in their own epoll set for the client's messages, so
+    // that a slow client does not hold up the rest of init.
+    property_conn_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (property_conn_epoll_fd == -1) {
+        ERROR("start_property_service epoll_create1 failed: %s\n", strerror(errno));
+        exit(1);
+    }
+
     register_epoll_handler(property_set_fd, handle_property_set_fd);
+    register_epoll_handler(property_conn_epoll_fd, handle_property_conn_fds);
 }
@@ -20,6 +20,14 @@
 #include <stddef.h>
 #include <sys/system_properties.h>
 
+/*
+ * Like PROP_MSG_SETPROP, but the client sends further messages on the same
+ * connection; the last message of a batch is a PROP_MSG_SETPROP, after which
+ * init closes the connection as usual.  Lets a client set many properties
+ * with one connection and one SELinux context lookup.
+ */
+#define PROP_MSG_SETPROPS 0x00010001
+
 extern void property_init(void);
 extern void property_load_boot_defaults(void);
 extern void load_persist_props(void);
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rc_cache.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "init_parser.h"
+#include "parser.h"
+
+#define RC_CACHE_MAGIC 0x43524e49 /* "INRC" */
+#define RC_CACHE_VERSION 1
+
+/*
+ * The header is followed by word_count 32-bit words holding, for each line,
+ * its line number, its number of arguments and the offset of each argument
+ * in the string table, then by string_size bytes of NUL-terminated strings.
+ * Everything is in the byte order of the device, which is little endian for
+ * all the devices init is built for.
+ */
+struct rc_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t source_size;
+    uint32_t source_hash;
+    uint32_t line_count;
+    uint32_t word_count;
+    uint32_t string_size;
+};
+
+// FNV-1a.
+static uint32_t hash_source(const std::string& data) {
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < data.size(); i++) {
+        hash = (hash ^ (uint8_t) data[i]) * 16777619U;
+    }
+    return hash;
+}
+
+void rc_cache_compile(const std::string& data, std::string* out) {
+    std::vector<uint32_t> words;
+    std::string strings;
+    uint32_t line_count = 0;
+    char *args[INIT_PARSER_MAXARGS];
+    int nargs = 0;
+
+    // The same loop as parse_config, so that the lines come out the same.
+    std::vector<char> text(data.begin(), data.end());
+    text.push_back(0);
+    parse_state state;
+    state.filename = "";
+    state.line = 0;
+    state.ptr = &text[0];
+    state.nexttoken = 0;
+
+    for (;;) {
+        switch (next_token(&state)) {
+        case T_EOF:
+            goto done;
+        case T_NEWLINE:
+            state.line++;
+            if (nargs) {
+                words.push_back(state.line);
+                words.push_back(nargs);
+                for (int i = 0; i < nargs; i++) {
+                    words.push_back(strings.size());
+                    strings.append(args[i], strlen(args[i]) + 1);
+                }
+                line_count++;
+                nargs = 0;
+            }
+            break;
+        case T_TEXT:
+            if (nargs < INIT_PARSER_MAXARGS) {
+                args[nargs++] = state.text;
+            }
+            break;
+        }
+    }
+
+done:
+    rc_cache_header header;
+    header.magic = RC_CACHE_MAGIC;
+    header.version = RC_CACHE_VERSION;
+    header.source_size = data.size();
+    header.source_hash = hash_source(data);
+    header.line_count = line_count;
+    header.word_count = words.size();
+    header.string_size = strings.size();
+
+    out->assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    out->append(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint32_t));
+    out->append(strings);
+}
+
+// Checks that the records stay within the file and the strings within the
+// string table, so that the lines can be handed out without further checks.
+static bool rc_cache_is_valid(const rc_cache_header* header, const uint32_t* words,
+                              const char* strings) {
+    if (header->string_size && strings[header->string_size - 1] != 0) {
+        return false;
+    }
+    uint32_t w = 0;
+    for (uint32_t i = 0; i < header->line_count; i++) {
+        if (header->word_count - w < 2) {
+            return false;
+        }
+        uint32_t nargs = words[w + 1];
+        w += 2;
+        if (nargs < 1 || nargs > INIT_PARSER_MAXARGS || header->word_count - w < nargs) {
+            return false;
+        }
+        for (uint32_t j = 0; j < nargs; j++) {
+            if (words[w + j] >= header->string_size) {
+                return false;
+            }
+        }
+        w += nargs;
+    }
+    return w == header->word_count;
+}
+
+bool rc_cache_load(const char* path, const std::string& data, rc_cache_line_fn fn, void* cookie) {
+    int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC));
+    if (fd == -1) {
+        return false;
+    }
+
+    // Like read_file, disallow world-writable or group-writable files.
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || (sb.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+            (size_t) sb.st_size < sizeof(rc_cache_header)) {
+        close(fd);
+        return false;
+    }
+
+    // Private and writable, because the parser may write to its arguments.
+    size_t size = sb.st_size;
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const rc_cache_header* header = static_cast<const rc_cache_header*>(map);
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(header + 1);
+    char* strings = reinterpret_cast<char*>(const_cast<uint32_t*>(words) + header->word_count);
+    if (header->magic != RC_CACHE_MAGIC || header->version != RC_CACHE_VERSION ||
+            header->source_size != data.size() || header->source_hash != hash_source(data) ||
+            header->word_count > (size - sizeof(*header)) / sizeof(uint32_t) ||
+            header->string_size != size - sizeof(*header) - header->word_count * sizeof(uint32_t) ||
+            !rc_cache_is_valid(header, words, strings)) {
+        munmap(map, size);
+        return false;
+    }
+
+    char* args[INIT_PARSER_MAXARGS];
+    uint32_t w = 0;
+    for (uint32_t i = 0; i < header->line_count; i++) {
+        int line = words[w];
+        int nargs = words[w + 1];
+        w += 2;
+        for (int j = 0; j < nargs; j++) {
+            args[j] = strings + words[w + j];
+        }
+        w += nargs;
+        fn(line, nargs, args, cookie);
+    }
+    return true;
+}
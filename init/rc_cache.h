@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_RC_CACHE_H_
+#define _INIT_RC_CACHE_H_
+
+#include <string>
+
+/*
+ * A compiled .rc file holds the lines of the file already split into their
+ * arguments, with the size and hash of the text it was compiled from.  It is
+ * built with init_rc_compile and installed next to the .rc file with a
+ * RC_CACHE_SUFFIX suffix; init uses it in place of tokenizing the text when
+ * it still matches.
+ */
+#define RC_CACHE_SUFFIX ".bin"
+
+typedef void (*rc_cache_line_fn)(int line, int nargs, char** args, void* cookie);
+
+/*
+ * Compiles the text of a .rc file, which must end with a newline.
+ */
+void rc_cache_compile(const std::string& data, std::string* out);
+
+/*
+ * Maps the compiled file at path and calls fn for each line, in order, if it
+ * was compiled from data.  The arguments point into the mapping, which is
+ * never unmapped, so they may be kept.  Returns false without calling fn if
+ * the file is missing, insecure, corrupt or stale.
+ */
+bool rc_cache_load(const char* path, const std::string& data, rc_cache_line_fn fn, void* cookie);
+
+#endif
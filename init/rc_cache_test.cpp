@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "rc_cache.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <base/file.h>
+#include <gtest/gtest.h>
+
+static const char kRc[] =
+    "# comment\n"
+    "on boot\n"
+    "    write /proc/sys/kernel/x \"a b\"\n"
+    "\n"
+    "service foo /system/bin/foo \\\n"
+    "        --flag\n"
+    "    class main\n";
+
+static void collect(int line, int nargs, char** args, void* cookie) {
+  std::vector<std::string>* lines = static_cast<std::vector<std::string>*>(cookie);
+  std::string s = std::to_string(line) + ":";
+  for (int i = 0; i < nargs; ++i) {
+    s += " ";
+    s += args[i];
+  }
+  lines->push_back(s);
+}
+
+static std::string write_cache(const std::string& data) {
+  char path[] = "/data/local/tmp/rc_cache_test.XXXXXX";
+  int fd = mkstemp(path);
+  std::string out;
+  rc_cache_compile(data, &out);
+  EXPECT_TRUE(android::base::WriteStringToFd(out, fd));
+  close(fd);
+  return path;
+}
+
+TEST(rc_cache, round_trip) {
+  std::string data(kRc);
+  std::string path = write_cache(data);
+
+  std::vector<std::string> lines;
+  ASSERT_TRUE(rc_cache_load(path.c_str(), data, collect, &lines));
+  ASSERT_EQ(4U, lines.size());
+  EXPECT_EQ("2: on boot", lines[0]);
+  EXPECT_EQ("3: write /proc/sys/kernel/x a b", lines[1]);
+  EXPECT_EQ("6: service foo /system/bin/foo --flag", lines[2]);
+  EXPECT_EQ("7: class main", lines[3]);
+  unlink(path.c_str());
+}
+
+TEST(rc_cache, stale_or_corrupt) {
+  std::string data(kRc);
+  std::string path = write_cache(data);
+  std::vector<std::string> lines;
+
+  std::string changed(data);
+  changed[changed.size() - 2] = 'x';
+  EXPECT_FALSE(rc_cache_load(path.c_str(), changed, collect, &lines));
+
+  std::string out;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &out));
+  ASSERT_TRUE(android::base::WriteStringToFile(out.substr(0, out.size() - 1), path));
+  EXPECT_FALSE(rc_cache_load(path.c_str(), data, collect, &lines));
+
+  EXPECT_FALSE(rc_cache_load("/data/local/tmp/does-not-exist", data, collect, &lines));
+  EXPECT_TRUE(lines.empty());
+  unlink(path.c_str());
+}
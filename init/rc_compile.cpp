@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compiles an init .rc file at build time, so that init does not have to
+// tokenize it at boot:
+//
+//   init_rc_compile init.rc init.rc.bin
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <base/file.h>
+
+#include "log.h"
+#include "rc_cache.h"
+
+void init_klog_write(int level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <file.rc> <file.rc%s>\n", argv[0], RC_CACHE_SUFFIX);
+        return 1;
+    }
+
+    std::string data;
+    if (!android::base::ReadFileToString(argv[1], &data)) {
+        perror(argv[1]);
+        return 1;
+    }
+    data.push_back('\n'); // Like init_parse_config_file.
+
+    std::string out;
+    rc_cache_compile(data, &out);
+    if (!android::base::WriteStringToFile(out, argv[2])) {
+        perror(argv[2]);
+        return 1;
+    }
+    return 0;
+}
@@ -75,6 +75,9 @@ static bool wait_for_one_process() {
         return true;
     }
 
+    boot_timing_record("exit %.3f %s %d %s\n", boot_timing_ms(gettime_ns()), svc->name, pid,
+                       DescribeStatus(status).c_str());
+
     // TODO: all the code from here down should be a member function on service.
 
     if (!(svc->flags & SVC_ONESHOT) || (svc->flags & SVC_RESTART)) {
@@ -92,13 +95,14 @@ static bool wait_for_one_process() {
     if (svc->flags & SVC_EXEC) {
         INFO("SVC_EXEC pid %d finished...\n", svc->pid);
         waiting_for_exec = false;
+        service_set_pid(svc, 0);
         list_remove(&svc->slist);
         free(svc->name);
         free(svc);
         return true;
     }
 
-    svc->pid = 0;
+    service_set_pid(svc, 0);
     svc->flags &= (~SVC_RUNNING);
 
     // Oneshot processes go into the disabled state on exit,
@@ -130,7 +134,7 @@ static bool wait_for_one_process() {
     }
 
     svc->flags &= (~SVC_RESTART);
-    svc->flags |= SVC_RESTARTING;
+    service_schedule_restart(svc);
 
     // Execute all onrestart commands for this service.
     struct listnode* node;
@@ -31,8 +31,20 @@
 #include "util.h"
 #include "devices.h"
 #include "ueventd_parser.h"
+#include "ueventd_stats.h"
 #include "property_service.h"
 
+/* Steps of handling a uevent slower than this are logged, unless
+ * ro.ueventd.slow_ms says otherwise. */
+#define UEVENTD_SLOW_MS 50
+
+static volatile sig_atomic_t dump_stats;
+
+static void sigusr1_handler(int)
+{
+    dump_stats = 1;
+}
+
 int ueventd_main(int argc, char **argv)
 {
     /*
@@ -65,7 +77,28 @@ int ueventd_main(int argc, char **argv)
     ueventd_parse_config_file("/ueventd.rc");
     ueventd_parse_config_file(android::base::StringPrintf("/ueventd.%s.rc", hardware).c_str());
 
-    device_init();
+    /* Boards with many devices can grow the uevent socket's receive buffer,
+     * so that coldboot and hub reconnects do not overflow it. */
+    char rcvbuf_size[PROP_VALUE_MAX];
+    int size = 0;
+    if (init_property_get("ro.ueventd.rcvbuf_size", rcvbuf_size) > 0) {
+        size = atoi(rcvbuf_size);
+    }
+
+    char slow_ms[PROP_VALUE_MAX];
+    int slow = UEVENTD_SLOW_MS;
+    if (init_property_get("ro.ueventd.slow_ms", slow_ms) > 0) {
+        slow = atoi(slow_ms);
+    }
+    uevent_stats_init(slow > 0 ? slow : 0);
+
+    device_init(size > 0 ? size : UEVENT_RCVBUF_SIZE);
+
+    /* kill -USR1 rewrites UEVENTD_STATS_FILE with the stats so far. */
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sigusr1_handler;
+    sigaction(SIGUSR1, &act, NULL);
 
     pollfd ufd;
     ufd.events = POLLIN;
@@ -74,6 +107,11 @@ int ueventd_main(int argc, char **argv)
     while (true) {
         ufd.revents = 0;
         int nr = poll(&ufd, 1, -1);
+        if (dump_stats) {
+            dump_stats = 0;
+            uevent_stats_write();
+            NOTICE("ueventd: wrote %s\n", UEVENTD_STATS_FILE);
+        }
         if (nr <= 0) {
             continue;
         }
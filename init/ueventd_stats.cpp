@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ueventd_stats.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <base/stringprintf.h>
+
+#include "log.h"
+#include "util.h"
+
+/*
+ * Bucket 0 counts steps that took less than 1us, bucket b < UEVENT_BUCKETS - 1
+ * those that took [2^(b-1), 2^b) us, and the last one the rest (about 1s and
+ * up).
+ */
+#define UEVENT_BUCKETS 22
+
+struct uevent_histogram {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[UEVENT_BUCKETS];
+};
+
+static const char* const phase_names[UEVENT_PHASE_COUNT] = {
+    "parse",
+    "sys_perms",
+    "restorecon",
+    "perms_match",
+    "selabel",
+    "make_device",
+    "symlinks",
+    "firmware",
+    "total",
+};
+
+/* Used if the shared mapping cannot be made: only ueventd itself counts. */
+static uevent_histogram private_stats[UEVENT_PHASE_COUNT];
+static uevent_histogram* stats = private_stats;
+static uint64_t slow_ns;
+
+void uevent_stats_init(unsigned slow_ms) {
+    void* shared = mmap(NULL, sizeof(private_stats), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        ERROR("could not map uevent stats: %s\n", strerror(errno));
+    } else {
+        stats = static_cast<uevent_histogram*>(shared);
+    }
+    slow_ns = slow_ms * UINT64_C(1000000);
+}
+
+static unsigned bucket_of(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    if (us == 0) {
+        return 0;
+    }
+    unsigned b = 64 - __builtin_clzll(us);
+    return b < UEVENT_BUCKETS ? b : UEVENT_BUCKETS - 1;
+}
+
+void uevent_stats_record(uevent_phase phase, uint64_t start_ns, const char* what) {
+    uint64_t ns = gettime_ns() - start_ns;
+    uevent_histogram* h = &stats[phase];
+
+    /* Coldboot workers update the same counters. */
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    if (slow_ns && ns >= slow_ns) {
+        NOTICE("ueventd: slow %s took %.1fms: %s\n", phase_names[phase], ns / 1000000.0,
+               what ? what : "");
+    }
+}
+
+/* The upper bound of the bucket holding the p-th percentile. */
+static std::string percentile(const uevent_histogram& h, unsigned p) {
+    uint64_t wanted = (h.count * p + 99) / 100;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < UEVENT_BUCKETS - 1; b++) {
+        seen += h.buckets[b];
+        if (seen >= wanted) {
+            return android::base::StringPrintf("<%lluus", 1ULL << b);
+        }
+    }
+    return android::base::StringPrintf(">=%lluus", 1ULL << (UEVENT_BUCKETS - 2));
+}
+
+std::string uevent_stats_dump() {
+    std::string out = android::base::StringPrintf("%-12s %8s %12s %10s %10s %10s %10s\n",
+            "phase", "count", "total_ms", "max_ms", "p50", "p90", "p99");
+    uevent_histogram snapshot[UEVENT_PHASE_COUNT];
+    for (int i = 0; i < UEVENT_PHASE_COUNT; i++) {
+        const uevent_histogram& h = stats[i];
+        snapshot[i].count = __atomic_load_n(&h.count, __ATOMIC_RELAXED);
+        snapshot[i].total_ns = __atomic_load_n(&h.total_ns, __ATOMIC_RELAXED);
+        snapshot[i].max_ns = __atomic_load_n(&h.max_ns, __ATOMIC_RELAXED);
+        for (int b = 0; b < UEVENT_BUCKETS; b++) {
+            snapshot[i].buckets[b] = __atomic_load_n(&h.buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+
+    for (int i = 0; i < UEVENT_PHASE_COUNT; i++) {
+        const uevent_histogram& h = snapshot[i];
+        if (h.count == 0) {
+            continue;
+        }
+        android::base::StringAppendF(&out, "%-12s %8llu %12.3f %10.3f %10s %10s %10s\n",
+                phase_names[i], (unsigned long long) h.count, h.total_ns / 1000000.0,
+                h.max_ns / 1000000.0, percentile(h, 50).c_str(), percentile(h, 90).c_str(),
+                percentile(h, 99).c_str());
+    }
+
+    out += "\n";
+    for (int i = 0; i < UEVENT_PHASE_COUNT; i++) {
+        const uevent_histogram& h = snapshot[i];
+        if (h.count == 0) {
+            continue;
+        }
+        android::base::StringAppendF(&out, "%s:", phase_names[i]);
+        for (int b = 0; b < UEVENT_BUCKETS; b++) {
+            if (h.buckets[b] == 0) {
+                continue;
+            }
+            if (b < UEVENT_BUCKETS - 1) {
+                android::base::StringAppendF(&out, " <%lluus:%llu", 1ULL << b,
+                                             (unsigned long long) h.buckets[b]);
+            } else {
+                android::base::StringAppendF(&out, " >=%lluus:%llu", 1ULL << (b - 1),
+                                             (unsigned long long) h.buckets[b]);
+            }
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+void uevent_stats_write() {
+    unlink(UEVENTD_STATS_FILE);
+    write_file(UEVENTD_STATS_FILE, uevent_stats_dump().c_str());
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _INIT_UEVENTD_STATS_H_
+#define _INIT_UEVENTD_STATS_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#define UEVENTD_STATS_FILE "/dev/ueventd_stats"
+
+/* The steps of handling a uevent that are timed on their own. */
+enum uevent_phase {
+    UEVENT_PHASE_PARSE,
+    UEVENT_PHASE_SYS_PERMS,
+    UEVENT_PHASE_RESTORECON,
+    UEVENT_PHASE_PERMS_MATCH,
+    UEVENT_PHASE_SELABEL,
+    UEVENT_PHASE_MAKE_DEVICE,
+    UEVENT_PHASE_SYMLINKS,
+    UEVENT_PHASE_FIRMWARE,
+    UEVENT_PHASE_TOTAL,
+    UEVENT_PHASE_COUNT,
+};
+
+/*
+ * Sets up the histograms, in memory shared with the processes ueventd forks
+ * later on (coldboot workers, firmware loaders), so that their events are
+ * counted too.  Steps slower than slow_ms are logged as they happen; 0 turns
+ * that off.
+ */
+void uevent_stats_init(unsigned slow_ms);
+
+/*
+ * Records that 'phase' ran from start_ns (a gettime_ns() time) until now.
+ * 'what' names the path it worked on, for the slow step log.
+ */
+void uevent_stats_record(uevent_phase phase, uint64_t start_ns, const char* what);
+
+/* The histograms as text, one block per phase. */
+std::string uevent_stats_dump();
+
+/* Writes uevent_stats_dump() to UEVENTD_STATS_FILE. */
+void uevent_stats_write();
+
+#endif
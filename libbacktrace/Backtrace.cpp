@@ -15,12 +15,18 @@
  */
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <ucontext.h>
 
+#include <list>
+#include <map>
 #include <string>
+#include <tuple>
+#include <utility>
 
 #include <base/stringprintf.h>
 
@@ -36,6 +42,52 @@
 
 using android::base::StringPrintf;
 
+//-------------------------------------------------------------------------
+// Function name cache.
+//-------------------------------------------------------------------------
+// A file is identified by its device, inode, size and modification time,
+// and a pc in it by its offset in the file, which does not depend on where
+// the file is mapped.
+struct FunctionNameKey {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  uintptr_t file_pc;
+
+  bool operator<(const FunctionNameKey& other) const {
+    return std::tie(dev, ino, size, mtime, file_pc) <
+        std::tie(other.dev, other.ino, other.size, other.mtime, other.file_pc);
+  }
+};
+
+struct FunctionName {
+  std::string name;
+  uintptr_t offset;
+};
+
+// Most recently used first.
+typedef std::list<std::pair<FunctionNameKey, FunctionName>> FunctionNameList;
+
+static pthread_mutex_t g_function_name_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t g_function_name_cache_size = 0;
+static FunctionNameList g_function_names;
+static std::map<FunctionNameKey, FunctionNameList::iterator> g_function_name_index;
+
+static void TrimFunctionNameCacheLocked() {
+  while (g_function_names.size() > g_function_name_cache_size) {
+    g_function_name_index.erase(g_function_names.back().first);
+    g_function_names.pop_back();
+  }
+}
+
+void Backtrace::SetFunctionNameCacheSize(size_t entries) {
+  pthread_mutex_lock(&g_function_name_mutex);
+  g_function_name_cache_size = entries;
+  TrimFunctionNameCacheLocked();
+  pthread_mutex_unlock(&g_function_name_mutex);
+}
+
 //-------------------------------------------------------------------------
 // Backtrace functions.
 //-------------------------------------------------------------------------
@@ -55,10 +107,61 @@ Backtrace::~Backtrace() {
 }
 
 std::string Backtrace::GetFunctionName(uintptr_t pc, uintptr_t* offset) {
+  pthread_mutex_lock(&g_function_name_mutex);
+  bool use_cache = g_function_name_cache_size > 0;
+  pthread_mutex_unlock(&g_function_name_mutex);
+
+  FunctionNameKey key;
+  if (use_cache) {
+    backtrace_map_t map;
+    FillInMap(pc, &map);
+    struct stat st;
+    use_cache = BacktraceMap::IsValid(map) && !map.name.empty() && map.name[0] == '/' &&
+        stat(map.name.c_str(), &st) == 0;
+    if (use_cache) {
+      key.dev = st.st_dev;
+      key.ino = st.st_ino;
+      key.size = st.st_size;
+      key.mtime = st.st_mtime;
+      key.file_pc = pc - map.start + map.offset;
+    }
+  }
+
+  if (use_cache) {
+    pthread_mutex_lock(&g_function_name_mutex);
+    auto it = g_function_name_index.find(key);
+    if (it != g_function_name_index.end()) {
+      g_function_names.splice(g_function_names.begin(), g_function_names, it->second);
+      *offset = it->second->second.offset;
+      std::string func_name = it->second->second.name;
+      pthread_mutex_unlock(&g_function_name_mutex);
+      return func_name;
+    }
+    pthread_mutex_unlock(&g_function_name_mutex);
+  }
+
   std::string func_name = GetFunctionNameRaw(pc, offset);
+
+  if (use_cache) {
+    pthread_mutex_lock(&g_function_name_mutex);
+    if (g_function_name_cache_size > 0 &&
+        g_function_name_index.find(key) == g_function_name_index.end()) {
+      FunctionName entry;
+      entry.name = func_name;
+      entry.offset = *offset;
+      g_function_names.push_front(std::make_pair(key, entry));
+      g_function_name_index[key] = g_function_names.begin();
+      TrimFunctionNameCacheLocked();
+    }
+    pthread_mutex_unlock(&g_function_name_mutex);
+  }
   return func_name;
 }
 
+bool Backtrace::UnwindFramePointers(size_t) {
+  return false;
+}
+
 bool Backtrace::VerifyReadWordArgs(uintptr_t ptr, word_t* out_value) {
   if (ptr & (sizeof(word_t)-1)) {
     BACK_LOGW("invalid pointer %p", reinterpret_cast<void*>(ptr));
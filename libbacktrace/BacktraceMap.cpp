@@ -19,13 +19,15 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <backtrace/backtrace_constants.h>
 #include <backtrace/BacktraceMap.h>
 #include <log/log.h>
 
 #include "thread_utils.h"
 
-BacktraceMap::BacktraceMap(pid_t pid) : pid_(pid) {
+BacktraceMap::BacktraceMap(pid_t pid) : pid_(pid), last_index_(0) {
   if (pid_ < 0) {
     pid_ = getpid();
   }
@@ -35,9 +37,20 @@ BacktraceMap::~BacktraceMap() {
 }
 
 void BacktraceMap::FillIn(uintptr_t addr, backtrace_map_t* map) {
-  for (BacktraceMap::const_iterator it = begin();
-       it != end(); ++it) {
-    if (addr >= it->start && addr < it->end) {
+  // Consecutive lookups, such as the frames of one unwind, mostly land in
+  // the same map.
+  size_t last = last_index_.load(std::memory_order_relaxed);
+  if (last < maps_.size() && addr >= maps_[last].start && addr < maps_[last].end) {
+    *map = maps_[last];
+    return;
+  }
+
+  const_iterator it = std::upper_bound(begin(), end(), addr,
+      [](uintptr_t pc, const backtrace_map_t& entry) { return pc < entry.start; });
+  if (it != begin()) {
+    --it;
+    if (addr < it->end) {
+      last_index_.store(it - begin(), std::memory_order_relaxed);
       *map = *it;
       return;
     }
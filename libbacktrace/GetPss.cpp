@@ -14,15 +14,62 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 
-// This is an extremely simplified version of libpagemap.
+// Sums the "Pss:" lines of an smaps style file, in kB. The file is read in
+// large blocks and scanned in place, since smaps has a dozen lines for each
+// map and a process can have thousands of maps.
+static bool SumPssKb(const char* path, uint64_t* total_kb) {
+  int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    return false;
+  }
+
+  char buf[16384];
+  size_t used = 0;
+  bool skipping = false;  // In a line longer than buf, which is not a Pss line.
+  bool found = false;
+  *total_kb = 0;
+  for (;;) {
+    ssize_t bytes = TEMP_FAILURE_RETRY(read(fd, buf + used, sizeof(buf) - used - 1));
+    if (bytes <= 0) {
+      break;
+    }
+    used += bytes;
+    buf[used] = '\0';
+
+    char* line = buf;
+    char* newline;
+    while ((newline = reinterpret_cast<char*>(memchr(line, '\n', buf + used - line))) != nullptr) {
+      if (!skipping && strncmp(line, "Pss:", 4) == 0) {
+        *total_kb += strtoull(line + 4, nullptr, 10);
+        found = true;
+      }
+      skipping = false;
+      line = newline + 1;
+    }
+    used -= line - buf;
+    if (used == sizeof(buf) - 1) {
+      skipping = true;
+      used = 0;
+    } else {
+      memmove(buf, line, used);
+    }
+  }
+  close(fd);
+  return found;
+}
+
+// This is an extremely simplified version of libpagemap, for kernels
+// without smaps.
 
 #define _BITS(x, offset, bits) (((x) >> offset) & ((1LL << (bits)) - 1))
 
@@ -33,17 +80,9 @@
 #define PAGEMAP_SWAP_OFFSET(x) (_BITS(x, 5, 50))
 #define PAGEMAP_SWAP_TYPE(x)   (_BITS(x, 0,  5))
 
-static bool ReadData(int fd, unsigned long place, uint64_t *data) {
-  if (lseek(fd, place * sizeof(uint64_t), SEEK_SET) < 0) {
-    return false;
-  }
-  if (read(fd, (void*)data, sizeof(uint64_t)) != (ssize_t)sizeof(uint64_t)) {
-    return false;
-  }
-  return true;
-}
+#define PAGEMAP_BATCH 512
 
-size_t GetPssBytes() {
+static size_t GetPagemapPssBytes() {
   FILE* maps = fopen("/proc/self/maps", "r");
   if (maps == nullptr) {
     return 0;
@@ -65,19 +104,31 @@ size_t GetPssBytes() {
   char line[4096];
   size_t total_pss = 0;
   int pagesize = getpagesize();
+  uint64_t entries[PAGEMAP_BATCH];
   while (fgets(line, sizeof(line), maps)) {
     uintptr_t start, end;
     if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) != 2) {
       total_pss = 0;
       break;
     }
-    for (size_t page = start/pagesize; page < end/pagesize; page++) {
-      uint64_t data;
-      if (ReadData(pagemap_fd, page, &data)) {
+    // The pagemap entries of a map are read together rather than one by one.
+    for (size_t page = start/pagesize; page < end/pagesize; page += PAGEMAP_BATCH) {
+      size_t count = end/pagesize - page;
+      if (count > PAGEMAP_BATCH) {
+        count = PAGEMAP_BATCH;
+      }
+      ssize_t bytes = pread(pagemap_fd, entries, count * sizeof(uint64_t),
+                            page * sizeof(uint64_t));
+      if (bytes <= 0) {
+        continue;
+      }
+      for (size_t i = 0; i < bytes / sizeof(uint64_t); i++) {
+        uint64_t data = entries[i];
         if (PAGEMAP_PRESENT(data) && !PAGEMAP_SWAPPED(data)) {
-          uint64_t count;
-          if (ReadData(pagecount_fd, PAGEMAP_PFN(data), &count)) {
-            total_pss += (count >= 1) ? pagesize / count : 0;
+          uint64_t mapcount;
+          if (pread(pagecount_fd, &mapcount, sizeof(mapcount),
+                    PAGEMAP_PFN(data) * sizeof(uint64_t)) == sizeof(mapcount)) {
+            total_pss += (mapcount >= 1) ? pagesize / mapcount : 0;
           }
         }
       }
@@ -91,3 +142,13 @@ size_t GetPssBytes() {
 
   return total_pss;
 }
+
+size_t GetPssBytes() {
+  // smaps_rollup has the totals precomputed by the kernel; smaps has them
+  // per map. Both are much cheaper than walking pagemap.
+  uint64_t pss_kb;
+  if (SumPssKb("/proc/self/smaps_rollup", &pss_kb) || SumPssKb("/proc/self/smaps", &pss_kb)) {
+    return pss_kb * 1024;
+  }
+  return GetPagemapPssBytes();
+}
@@ -14,8 +14,10 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
 #include <stdint.h>
 #include <ucontext.h>
+#include <unistd.h>
 
 #include <memory>
 #include <string>
@@ -25,9 +27,19 @@
 
 #include <backtrace/Backtrace.h>
 
+#include <cutils/threads.h>
+
 #include "BacktraceLog.h"
 #include "UnwindCurrent.h"
 
+static pthread_once_t g_caching_once = PTHREAD_ONCE_INIT;
+
+// Keep what libunwind parses from the unwind tables of each map, for all the
+// unwinds of this process, rather than only for the current one.
+static void InitCaching() {
+  unw_set_caching_policy(unw_local_addr_space, UNW_CACHE_GLOBAL);
+}
+
 std::string UnwindCurrent::GetFunctionNameRaw(uintptr_t pc, uintptr_t* offset) {
   *offset = 0;
   char buf[512];
@@ -76,24 +88,31 @@ bool UnwindCurrent::UnwindFromContext(size_t num_ignore_frames, ucontext_t* ucon
     GetUnwContextFromUcontext(ucontext);
   }
 
-  // The cursor structure is pretty large, do not put it on the stack.
-  std::unique_ptr<unw_cursor_t> cursor(new unw_cursor_t);
-  int ret = unw_init_local(cursor.get(), &context_);
+  pthread_once(&g_caching_once, InitCaching);
+
+  // The cursor structure is pretty large, do not put it on the stack. It is
+  // kept for the next unwind of this object.
+  if (!cursor_) {
+    cursor_.reset(new unw_cursor_t);
+  }
+  unw_cursor_t* cursor = cursor_.get();
+  int ret = unw_init_local(cursor, &context_);
   if (ret < 0) {
     BACK_LOGW("unw_init_local failed %d", ret);
     return false;
   }
 
+  frames_.clear();
   size_t num_frames = 0;
   do {
     unw_word_t pc;
-    ret = unw_get_reg(cursor.get(), UNW_REG_IP, &pc);
+    ret = unw_get_reg(cursor, UNW_REG_IP, &pc);
     if (ret < 0) {
       BACK_LOGW("Failed to read IP %d", ret);
       break;
     }
     unw_word_t sp;
-    ret = unw_get_reg(cursor.get(), UNW_REG_SP, &sp);
+    ret = unw_get_reg(cursor, UNW_REG_SP, &sp);
     if (ret < 0) {
       BACK_LOGW("Failed to read SP %d", ret);
       break;
@@ -124,8 +143,73 @@ bool UnwindCurrent::UnwindFromContext(size_t num_ignore_frames, ucontext_t* ucon
         num_ignore_frames--;
       }
     }
-    ret = unw_step (cursor.get());
+    ret = unw_step (cursor);
   } while (ret > 0 && num_frames < MAX_BACKTRACE_FRAMES);
+  // Drop a trailing frame that was discarded or ignored.
+  frames_.resize(num_frames);
 
   return true;
 }
+
+bool UnwindCurrent::UnwindFramePointers(size_t num_ignore_frames) {
+#if defined(__aarch64__) || defined(__i386__) || defined(__x86_64__)
+  if (Tid() != gettid() || GetMap() == nullptr) {
+    return false;
+  }
+
+  // Each frame record is the caller's frame pointer followed by the return
+  // address. Records only move up the stack, and the walk never leaves the
+  // stack map, so a function built without a frame pointer ends the trace
+  // instead of sending it into unmapped memory. (32-bit arm has no single
+  // frame record layout, so it always uses the unwind tables.)
+  uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  backtrace_map_t stack_map;
+  FillInMap(fp, &stack_map);
+  if (!BacktraceMap::IsValid(stack_map) || !(stack_map.flags & PROT_READ)) {
+    return false;
+  }
+
+  frames_.clear();
+  size_t num_frames = 0;
+  while (num_frames < MAX_BACKTRACE_FRAMES) {
+    if ((fp & (sizeof(uintptr_t) - 1)) != 0 || fp < stack_map.start ||
+        stack_map.end - fp < 2 * sizeof(uintptr_t)) {
+      break;
+    }
+    const uintptr_t* record = reinterpret_cast<const uintptr_t*>(fp);
+    uintptr_t next_fp = record[0];
+    uintptr_t pc = record[1];
+    if (pc == 0) {
+      break;
+    }
+
+    if (num_ignore_frames == 0) {
+      frames_.resize(num_frames+1);
+      backtrace_frame_data_t* frame = &frames_.at(num_frames);
+      frame->num = num_frames;
+      frame->pc = pc;
+      // The caller's sp once this frame returns.
+      frame->sp = fp + 2 * sizeof(uintptr_t);
+      frame->stack_size = 0;
+      frame->func_offset = 0;
+      FillInMap(frame->pc, &frame->map);
+      if (num_frames > 0) {
+        backtrace_frame_data_t* prev = &frames_.at(num_frames-1);
+        prev->stack_size = frame->sp - prev->sp;
+      }
+      num_frames++;
+    } else {
+      num_ignore_frames--;
+    }
+
+    if (next_fp <= fp) {
+      break;
+    }
+    fp = next_fp;
+  }
+  return num_frames > 0;
+#else
+  (void) num_ignore_frames;
+  return false;
+#endif
+}
@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <ucontext.h>
 
+#include <memory>
 #include <string>
 
 #include <backtrace/Backtrace.h>
@@ -38,12 +39,15 @@ public:
 
   std::string GetFunctionNameRaw(uintptr_t pc, uintptr_t* offset) override;
 
+  bool UnwindFramePointers(size_t num_ignore_frames) override;
+
 private:
   void GetUnwContextFromUcontext(const ucontext_t* ucontext);
 
   bool UnwindFromContext(size_t num_ignore_frames, ucontext_t* ucontext) override;
 
   unw_context_t context_;
+  std::unique_ptr<unw_cursor_t> cursor_;
 };
 
 #endif // _LIBBACKTRACE_UNWIND_CURRENT_H
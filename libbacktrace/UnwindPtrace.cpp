@@ -14,8 +14,12 @@
  * limitations under the License.
  */
 
+#include <elf.h>
 #include <stdint.h>
+#include <sys/ptrace.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/user.h>
 #include <ucontext.h>
 
 #include <libunwind.h>
@@ -58,19 +62,26 @@ bool UnwindPtrace::Unwind(size_t num_ignore_frames, ucontext_t* ucontext) {
     return false;
   }
 
-  addr_space_ = unw_create_addr_space(&_UPT_accessors, 0);
+  // The address space and the upt info are kept for the next unwind of this
+  // object, and with them what libunwind parsed from the unwind tables.
   if (!addr_space_) {
-    BACK_LOGW("unw_create_addr_space failed.");
-    return false;
-  }
+    addr_space_ = unw_create_addr_space(&_UPT_accessors, 0);
+    if (!addr_space_) {
+      BACK_LOGW("unw_create_addr_space failed.");
+      return false;
+    }
+    unw_set_caching_policy(addr_space_, UNW_CACHE_GLOBAL);
 
-  UnwindMap* map = static_cast<UnwindMap*>(GetMap());
-  unw_map_set(addr_space_, map->GetMapCursor());
+    UnwindMap* map = static_cast<UnwindMap*>(GetMap());
+    unw_map_set(addr_space_, map->GetMapCursor());
+  }
 
-  upt_info_ = reinterpret_cast<struct UPT_info*>(_UPT_create(Tid()));
   if (!upt_info_) {
-    BACK_LOGW("Failed to create upt info.");
-    return false;
+    upt_info_ = reinterpret_cast<struct UPT_info*>(_UPT_create(Tid()));
+    if (!upt_info_) {
+      BACK_LOGW("Failed to create upt info.");
+      return false;
+    }
   }
 
   unw_cursor_t cursor;
@@ -80,6 +91,7 @@ bool UnwindPtrace::Unwind(size_t num_ignore_frames, ucontext_t* ucontext) {
     return false;
   }
 
+  frames_.clear();
   size_t num_frames = 0;
   do {
     unw_word_t pc;
@@ -122,6 +134,96 @@ bool UnwindPtrace::Unwind(size_t num_ignore_frames, ucontext_t* ucontext) {
   return true;
 }
 
+// Gets the pc, sp and frame pointer of the stopped thread.
+static bool GetFrameRegisters(pid_t tid, uintptr_t* pc, uintptr_t* sp, uintptr_t* fp) {
+#if defined(__aarch64__)
+  user_pt_regs regs;
+  struct iovec io;
+  io.iov_base = &regs;
+  io.iov_len = sizeof(regs);
+  if (ptrace(PTRACE_GETREGSET, tid, reinterpret_cast<void*>(NT_PRSTATUS), &io) == -1) {
+    return false;
+  }
+  *pc = regs.pc;
+  *sp = regs.sp;
+  *fp = regs.regs[29];
+  return true;
+#elif defined(__i386__) || defined(__x86_64__)
+  user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, tid, nullptr, &regs) == -1) {
+    return false;
+  }
+#if defined(__x86_64__)
+  *pc = regs.rip;
+  *sp = regs.rsp;
+  *fp = regs.rbp;
+#else
+  *pc = regs.eip;
+  *sp = regs.esp;
+  *fp = regs.ebp;
+#endif
+  return true;
+#else
+  (void) tid; (void) pc; (void) sp; (void) fp;
+  return false;
+#endif
+}
+
+bool UnwindPtrace::UnwindFramePointers(size_t num_ignore_frames) {
+  uintptr_t pc, sp, fp;
+  if (GetMap() == nullptr || !GetFrameRegisters(Tid(), &pc, &sp, &fp)) {
+    return false;
+  }
+
+  // The same walk as UnwindCurrent::UnwindFramePointers, reading the frame
+  // records with ptrace, starting from the pc the thread stopped at.
+  backtrace_map_t stack_map;
+  FillInMap(fp, &stack_map);
+  if (!BacktraceMap::IsValid(stack_map) || !(stack_map.flags & PROT_READ)) {
+    return false;
+  }
+
+  frames_.clear();
+  size_t num_frames = 0;
+  while (num_frames < MAX_BACKTRACE_FRAMES && pc != 0) {
+    if (num_ignore_frames == 0) {
+      frames_.resize(num_frames+1);
+      backtrace_frame_data_t* frame = &frames_.at(num_frames);
+      frame->num = num_frames;
+      frame->pc = pc;
+      frame->sp = sp;
+      frame->stack_size = 0;
+      frame->func_offset = 0;
+      FillInMap(frame->pc, &frame->map);
+      if (num_frames > 0) {
+        backtrace_frame_data_t* prev = &frames_.at(num_frames-1);
+        prev->stack_size = frame->sp - prev->sp;
+      }
+      num_frames++;
+    } else {
+      num_ignore_frames--;
+    }
+
+    word_t next_fp;
+    word_t next_pc;
+    if ((fp & (sizeof(uintptr_t) - 1)) != 0 || fp < stack_map.start ||
+        stack_map.end - fp < 2 * sizeof(uintptr_t) ||
+        !ReadWord(fp, &next_fp) || !ReadWord(fp + sizeof(uintptr_t), &next_pc)) {
+      break;
+    }
+    pc = next_pc;
+    // The caller's sp once this frame returns.
+    sp = fp + 2 * sizeof(uintptr_t);
+    if (next_fp <= fp) {
+      // The record of the outermost frame; still report its return address.
+      fp = 0;
+    } else {
+      fp = next_fp;
+    }
+  }
+  return num_frames > 0;
+}
+
 std::string UnwindPtrace::GetFunctionNameRaw(uintptr_t pc, uintptr_t* offset) {
   *offset = 0;
   char buf[512];
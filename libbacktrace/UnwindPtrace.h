@@ -36,6 +36,8 @@ public:
 
   bool Unwind(size_t num_ignore_frames, ucontext_t* ucontext) override;
 
+  bool UnwindFramePointers(size_t num_ignore_frames) override;
+
   std::string GetFunctionNameRaw(uintptr_t pc, uintptr_t* offset) override;
 
 private:
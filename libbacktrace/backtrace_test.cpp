@@ -754,6 +754,52 @@ TEST(libbacktrace, fillin_erases) {
   ASSERT_EQ("", map.name);
 }
 
+TEST(libbacktrace, fillin_finds_every_map) {
+  std::unique_ptr<BacktraceMap> back_map(BacktraceMap::Create(getpid(), true));
+  ASSERT_TRUE(back_map.get() != nullptr);
+
+  backtrace_map_t map;
+  for (BacktraceMap::const_iterator it = back_map->begin(); it != back_map->end(); ++it) {
+    back_map->FillIn(it->start, &map);
+    ASSERT_EQ(it->start, map.start);
+    ASSERT_EQ(it->name, map.name);
+    // Twice, the second time from the last-hit cache.
+    back_map->FillIn(it->end - 1, &map);
+    ASSERT_EQ(it->start, map.start);
+    back_map->FillIn(it->end - 1, &map);
+    ASSERT_EQ(it->start, map.start);
+
+    BacktraceMap::const_iterator next = it + 1;
+    if (next == back_map->end() || next->start != it->end) {
+      back_map->FillIn(it->end, &map);
+      ASSERT_FALSE(BacktraceMap::IsValid(map));
+    }
+  }
+}
+
+TEST(libbacktrace, function_name_cache) {
+  std::unique_ptr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS,
+                                                         BACKTRACE_CURRENT_THREAD));
+  ASSERT_TRUE(backtrace.get() != nullptr);
+
+  // Needed before GetFunctionName will work.
+  backtrace->Unwind(0);
+
+  uintptr_t pc = reinterpret_cast<uintptr_t>(&test_level_one) + 4;
+  uintptr_t offset;
+  std::string uncached_name = backtrace->GetFunctionName(pc, &offset);
+  ASSERT_EQ("test_level_one", uncached_name);
+  uintptr_t uncached_offset = offset;
+
+  Backtrace::SetFunctionNameCacheSize(16);
+  for (size_t i = 0; i < 2; i++) {
+    offset = 0;
+    ASSERT_EQ(uncached_name, backtrace->GetFunctionName(pc, &offset));
+    ASSERT_EQ(uncached_offset, offset);
+  }
+  Backtrace::SetFunctionNameCacheSize(0);
+}
+
 TEST(libbacktrace, format_test) {
   std::unique_ptr<Backtrace> backtrace(Backtrace::Create(getpid(), BACKTRACE_CURRENT_THREAD));
   ASSERT_TRUE(backtrace.get() != nullptr);
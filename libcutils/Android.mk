@@ -62,6 +62,7 @@ ifneq ($(WINDOWS_HOST_ONLY),1)
 
     commonHostSources += \
         ashmem-host.c \
+        ashmem-pool.c \
         trace-host.c
 
 endif
@@ -98,9 +99,11 @@ LOCAL_MODULE := libcutils
 LOCAL_SRC_FILES := $(commonSources) \
         android_reboot.c \
         ashmem-dev.c \
+        ashmem-pool.c \
         debugger.c \
         klog.c \
         partition_utils.c \
+        procfs.c \
         properties.c \
         qtaguid.c \
         trace-dev.c \
@@ -46,7 +46,7 @@ void android_memset16(uint16_t* dst, uint16_t value, size_t size)
    }
    /* dst is now 32-bit-aligned */
    /* fill body with 32-bit pairs */
-   uint32_t value32 = (value << 16) | value;
+   uint32_t value32 = ((uint32_t)value << 16) | value;
    android_memset32((uint32_t*) dst, value32, size<<1);
    if (size & 1) {
       dst[size-1] = value;  /* fill unpaired last elem */
@@ -54,6 +54,9 @@ void android_memset16(uint16_t* dst, uint16_t value, size_t size)
 }
 
 
+/* fills of at least this many bytes prefetch for streaming stores */
+#define STREAMING_THRESHOLD (256 * 1024)
+
 void android_memset32(uint32_t* dst, uint32_t value, size_t size)
 {
    /* optimized version of
@@ -63,7 +66,14 @@ void android_memset32(uint32_t* dst, uint32_t value, size_t size)
    */
 
    size >>= 2;
-   if (((uintptr_t)dst & 4) && size) {
+   if (size < 8) {
+      /* small fills are not worth aligning */
+      while (size--) {
+         *dst++ = value;
+      }
+      return;
+   }
+   if ((uintptr_t)dst & 4) {
       /* fill unpaired first 32-bit elem separately */
       *dst++ = value;
       size--;
@@ -73,21 +83,46 @@ void android_memset32(uint32_t* dst, uint32_t value, size_t size)
    uint64_t value64 = (((uint64_t)value)<<32) | value;
    uint64_t* dst64 = (uint64_t*)dst;
 
-   while (size >= 12) {
+   if (size >= STREAMING_THRESHOLD / 4) {
+      /* large fills: prepare the lines ahead for stores that will not be
+         read again soon, so they are neither fetched nor kept around */
+      while (size >= 16) {
+         __builtin_prefetch(dst64 + 32, 1, 0);
+         dst64[0] = value64;
+         dst64[1] = value64;
+         dst64[2] = value64;
+         dst64[3] = value64;
+         dst64[4] = value64;
+         dst64[5] = value64;
+         dst64[6] = value64;
+         dst64[7] = value64;
+         size  -= 16;
+         dst64 += 8;
+      }
+   }
+
+   /* 64 bytes per iteration */
+   while (size >= 16) {
       dst64[0] = value64;
       dst64[1] = value64;
       dst64[2] = value64;
       dst64[3] = value64;
       dst64[4] = value64;
       dst64[5] = value64;
-      size  -= 12;
-      dst64 += 6;
+      dst64[6] = value64;
+      dst64[7] = value64;
+      size  -= 16;
+      dst64 += 8;
    }
 
-   /* fill remainder with original 32-bit single-elem loop */
-   dst = (uint32_t*) dst64;
-   while (size--) {
-      *dst++ = value;
+   /* at most seven pairs left */
+   while (size >= 2) {
+      *dst64++ = value64;
+      size -= 2;
    }
 
+   /* fill unpaired last elem */
+   if (size) {
+      *(uint32_t*)dst64 = value;
+   }
 }
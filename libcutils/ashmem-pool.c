@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * A per-process pool of ashmem regions, built on the ashmem API of either
+ * ashmem-dev.c or ashmem-host.c.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+
+/* regions of 1, 2, 4, ... 256 pages are pooled */
+#define POOL_BUCKETS		9
+#define POOL_REGIONS_PER_BUCKET	4
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pool[POOL_BUCKETS][POOL_REGIONS_PER_BUCKET];
+static int pool_count[POOL_BUCKETS];
+
+/*
+ * Returns the bucket for regions of the given size, and sets *bucket_size to
+ * the size of the regions in it, or returns -1 if the size is too large.
+ */
+static int bucket_for_size(size_t size, size_t *bucket_size)
+{
+	size_t region_size = getpagesize();
+	int bucket = 0;
+
+	while (region_size < size) {
+		region_size <<= 1;
+		if (++bucket == POOL_BUCKETS)
+			return -1;
+	}
+	*bucket_size = region_size;
+	return bucket;
+}
+
+int ashmem_pool_create_region(const char *name, size_t size)
+{
+	size_t bucket_size;
+	int bucket = bucket_for_size(size, &bucket_size);
+	int fd = -1;
+
+	if (bucket < 0)
+		return ashmem_create_region(name, size);
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_count[bucket])
+		fd = pool[bucket][--pool_count[bucket]];
+	pthread_mutex_unlock(&pool_lock);
+
+	if (fd < 0)
+		return ashmem_create_region(name, bucket_size);
+
+	/* A region that was never mapped has nothing to pin. */
+	if (ashmem_pin_region(fd, 0, 0) < 0 && errno != EINVAL) {
+		close(fd);
+		return ashmem_create_region(name, bucket_size);
+	}
+	return fd;
+}
+
+void ashmem_pool_release_region(int fd)
+{
+	int size = ashmem_get_size_region(fd);
+	size_t bucket_size;
+	int bucket;
+
+	/*
+	 * Only regions of a bucket's size can be reused, since the size of a
+	 * region cannot change once it has been mapped, and neither can a
+	 * protection mask that was narrowed be widened again.
+	 */
+	if (size <= 0)
+		goto close_region;
+	bucket = bucket_for_size(size, &bucket_size);
+	if (bucket < 0 || bucket_size != (size_t) size)
+		goto close_region;
+	if (ashmem_set_prot_region(fd, PROT_READ | PROT_WRITE | PROT_EXEC) < 0)
+		goto close_region;
+
+	/* Let the kernel reclaim the pages while the region is in the pool. */
+	ashmem_unpin_region(fd, 0, 0);
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_count[bucket] < POOL_REGIONS_PER_BUCKET) {
+		pool[bucket][pool_count[bucket]++] = fd;
+		fd = -1;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+close_region:
+	if (fd >= 0)
+		close(fd);
+}
+
+void ashmem_pool_trim(void)
+{
+	int bucket;
+
+	pthread_mutex_lock(&pool_lock);
+	for (bucket = 0; bucket < POOL_BUCKETS; bucket++) {
+		while (pool_count[bucket])
+			close(pool[bucket][--pool_count[bucket]]);
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
@@ -260,6 +260,282 @@ void fs_config(const char *path, int dir, const char *target_out_path,
     *capabilities = pc->capabilities;
 }
 
+/* The compiled index.
+**
+** The rules of one kind (files or directories) are numbered in the order
+** fs_config() tries them: the records of the override file, then the
+** built-in table.  Every prefix is entered in a trie, and each trie node
+** keeps the lowest numbered rule whose prefix ends there, so "first match"
+** becomes the lowest rule met while walking the path down the trie.
+*/
+
+#define NO_RULE UINT32_MAX
+
+struct fs_config_node {
+    uint32_t child;      /* first child, 0 if none (the root is no child) */
+    uint32_t sibling;    /* next child of the same parent, 0 if none */
+    uint32_t rule;       /* a directory prefix, or an exact file name, ends here */
+    uint32_t wildcard;   /* files only: a prefix ending in '*' ends here */
+    char c;
+};
+
+struct fs_config_trie {
+    struct fs_path_config *rules; /* the last one holds the defaults */
+    uint32_t rule_count;
+    struct fs_config_node *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+    char *file;                   /* the override file, rules point into it */
+};
+
+struct fs_config_index {
+    struct fs_config_trie dirs;
+    struct fs_config_trie files;
+};
+
+static uint32_t fs_config_node_add(struct fs_config_trie *trie, char c)
+{
+    if (trie->node_count == trie->node_capacity) {
+        uint32_t capacity = trie->node_capacity ? trie->node_capacity * 2 : 256;
+        struct fs_config_node *nodes = realloc(trie->nodes, capacity * sizeof(*nodes));
+        if (!nodes) {
+            return 0;
+        }
+        trie->nodes = nodes;
+        trie->node_capacity = capacity;
+    }
+    struct fs_config_node *node = &trie->nodes[trie->node_count];
+    node->child = 0;
+    node->sibling = 0;
+    node->rule = NO_RULE;
+    node->wildcard = NO_RULE;
+    node->c = c;
+    return trie->node_count++;
+}
+
+static uint32_t fs_config_node_find(const struct fs_config_trie *trie, uint32_t parent, char c)
+{
+    uint32_t index;
+    for (index = trie->nodes[parent].child; index; index = trie->nodes[index].sibling) {
+        if (trie->nodes[index].c == c) {
+            break;
+        }
+    }
+    return index;
+}
+
+static bool fs_config_trie_insert(struct fs_config_trie *trie, bool dir, uint32_t rule)
+{
+    const char *prefix = trie->rules[rule].prefix;
+    size_t len = strlen(prefix);
+    bool wildcard = !dir && len > 0 && prefix[len - 1] == '*';
+    uint32_t index = 0;
+    size_t i;
+
+    if (wildcard) {
+        len--;
+    }
+    for (i = 0; i < len; i++) {
+        uint32_t child = fs_config_node_find(trie, index, prefix[i]);
+        if (!child) {
+            child = fs_config_node_add(trie, prefix[i]);
+            if (!child) {
+                return false;
+            }
+            trie->nodes[child].sibling = trie->nodes[index].child;
+            trie->nodes[index].child = child;
+        }
+        index = child;
+    }
+
+    /* Rules are inserted in order, so the first one to get here stays. */
+    uint32_t *slot = wildcard ? &trie->nodes[index].wildcard : &trie->nodes[index].rule;
+    if (*slot == NO_RULE) {
+        *slot = rule;
+    }
+    return true;
+}
+
+/* Reads the whole override file; returns the number of bytes read. */
+static size_t fs_config_read_file(int dir, const char *target_out_path, char **out)
+{
+    struct stat st;
+    size_t size = 0;
+    int fd;
+
+    *out = NULL;
+    fd = fs_config_open(dir, target_out_path);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        *out = malloc(st.st_size);
+        if (*out) {
+            while (size < (size_t) st.st_size) {
+                ssize_t n = TEMP_FAILURE_RETRY(read(fd, *out + size, st.st_size - size));
+                if (n <= 0) {
+                    break;
+                }
+                size += n;
+            }
+        }
+    }
+    close(fd);
+    return size;
+}
+
+/* Counts the well-formed records at the start of the override file, the
+** same ones fs_config() would try. */
+static uint32_t fs_config_count_records(bool dir, const char *file, size_t size)
+{
+    const struct fs_path_config_from_file *header;
+    uint32_t count = 0;
+    size_t offset = 0;
+
+    while (size - offset >= sizeof(*header)) {
+        header = (const struct fs_path_config_from_file *) (file + offset);
+        uint16_t host_len = get2LE((const uint8_t *) &header->len);
+        if (host_len <= sizeof(*header)) {
+            ALOGE("%s len is corrupted", dir ? conf_dir : conf_file);
+            break;
+        }
+        size_t remainder = host_len - sizeof(*header);
+        if (size - offset - sizeof(*header) < remainder) {
+            ALOGE("%s prefix is truncated", dir ? conf_dir : conf_file);
+            break;
+        }
+        if (strnlen(header->prefix, remainder) >= remainder) {
+            ALOGE("%s is corrupted", dir ? conf_dir : conf_file);
+            break;
+        }
+        count++;
+        offset += host_len;
+    }
+    return count;
+}
+
+static bool fs_config_trie_build(struct fs_config_trie *trie, bool dir,
+                                 const char *target_out_path)
+{
+    const struct fs_path_config *builtin = dir ? android_dirs : android_files;
+    const struct fs_path_config *pc;
+    uint32_t builtin_count = 0, records, rule;
+    size_t size, offset = 0;
+
+    size = fs_config_read_file(dir, target_out_path, &trie->file);
+    records = fs_config_count_records(dir, trie->file, size);
+    for (pc = builtin; pc->prefix; pc++) {
+        builtin_count++;
+    }
+
+    trie->rule_count = records + builtin_count;
+    trie->rules = malloc((trie->rule_count + 1) * sizeof(*trie->rules));
+    if (!trie->rules) {
+        return false;
+    }
+    /* The root, for the empty prefix. */
+    fs_config_node_add(trie, '\0');
+    if (trie->node_count != 1) {
+        return false;
+    }
+
+    for (rule = 0; rule < records; rule++) {
+        const struct fs_path_config_from_file *header =
+                (const struct fs_path_config_from_file *) (trie->file + offset);
+        struct fs_path_config *r = &trie->rules[rule];
+        r->mode = get2LE((const uint8_t *) &header->mode);
+        r->uid = get2LE((const uint8_t *) &header->uid);
+        r->gid = get2LE((const uint8_t *) &header->gid);
+        r->capabilities = get8LE((const uint8_t *) &header->capabilities);
+        r->prefix = header->prefix;
+        offset += get2LE((const uint8_t *) &header->len);
+    }
+    /* The built-in table, including its terminating defaults. */
+    memcpy(&trie->rules[records], builtin, (builtin_count + 1) * sizeof(*builtin));
+
+    for (rule = 0; rule < trie->rule_count; rule++) {
+        if (!fs_config_trie_insert(trie, dir, rule)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void fs_config_trie_free(struct fs_config_trie *trie)
+{
+    free(trie->rules);
+    free(trie->nodes);
+    free(trie->file);
+}
+
+struct fs_config_index *fs_config_index_create(const char *target_out_path)
+{
+    struct fs_config_index *index = calloc(1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+    if (!fs_config_trie_build(&index->dirs, true, target_out_path)
+            || !fs_config_trie_build(&index->files, false, target_out_path)) {
+        ALOGE("fs_config index out of memory");
+        fs_config_index_destroy(index);
+        return NULL;
+    }
+    return index;
+}
+
+void fs_config_index_destroy(struct fs_config_index *index)
+{
+    if (index) {
+        fs_config_trie_free(&index->dirs);
+        fs_config_trie_free(&index->files);
+        free(index);
+    }
+}
+
+void fs_config_index_lookup(const struct fs_config_index *index, const char *path, int dir,
+                            unsigned *uid, unsigned *gid, unsigned *mode,
+                            uint64_t *capabilities)
+{
+    const struct fs_config_trie *trie = dir ? &index->dirs : &index->files;
+    const struct fs_path_config *pc;
+    uint32_t best = NO_RULE;
+    uint32_t node = 0;
+
+    if (path[0] == '/') {
+        path++;
+    }
+
+    for (;;) {
+        const struct fs_config_node *n = &trie->nodes[node];
+        if (dir) {
+            /* Directory rules match any path they are a prefix of. */
+            if (n->rule < best) {
+                best = n->rule;
+            }
+        } else {
+            if (n->wildcard < best) {
+                best = n->wildcard;
+            }
+            if (*path == '\0' && n->rule < best) {
+                best = n->rule;
+            }
+        }
+        if (*path == '\0') {
+            break;
+        }
+        node = fs_config_node_find(trie, node, *path++);
+        if (!node) {
+            break;
+        }
+    }
+
+    pc = &trie->rules[best == NO_RULE ? trie->rule_count : best];
+    *uid = pc->uid;
+    *gid = pc->gid;
+    *mode = (*mode & (~07777)) | pc->mode;
+    *capabilities = pc->capabilities;
+}
+
 ssize_t fs_config_generate(char *buffer, size_t length, const struct fs_path_config *pc)
 {
     struct fs_path_config_from_file *p = (struct fs_path_config_from_file *)buffer;
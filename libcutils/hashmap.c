@@ -17,67 +17,167 @@
 #include <cutils/hashmap.h>
 #include <assert.h>
 #include <errno.h>
+#include <cutils/atomic.h>
 #include <cutils/threads.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/types.h>
 
-typedef struct Entry Entry;
-struct Entry {
+/*
+ * Entries live directly in an array of slots and collisions are resolved by
+ * linear probing, so a put allocates nothing unless the table grows.  Each
+ * slot keeps the full hash of its key, which is compared before calling
+ * equals() and lets the table be rehashed without calling hash() again.
+ *
+ * Removed entries leave a tombstone, so removing (even from inside
+ * hashmapForEach()) never moves other entries.  Tombstones are dropped when
+ * the table is rebuilt.
+ *
+ * A table is rebuilt incrementally: the new table takes all inserts while
+ * each put also moves a few slots of the old one over, so no single put pays
+ * for rehashing the whole map.  Until the old table is empty, lookups check
+ * both.
+ *
+ * A concurrent map is split into segments by the top bits of the hash, each
+ * with its own table and lock.
+ */
+
+enum {
+    SLOT_EMPTY = 0,
+    SLOT_FULL,
+    SLOT_DELETED,
+};
+
+typedef struct Slot Slot;
+struct Slot {
     void* key;
-    int hash;
     void* value;
-    Entry* next;
+    unsigned int hash;
+    unsigned int state;
+};
+
+typedef struct Table Table;
+struct Table {
+    Slot* slots;
+    // Power of 2, or 0 when there is no table.
+    size_t capacity;
+};
+
+typedef struct Segment Segment;
+struct Segment {
+    // New entries always go into table.
+    Table table;
+    // Full and deleted slots in table.  Probing relies on some slots being
+    // empty, so this is kept below 3/4 of the capacity.
+    size_t used;
+
+    // While the segment is being rebuilt, the oldSize entries that have not
+    // been moved over yet.  Slots before 'moved' are all deleted.
+    Table old;
+    size_t oldSize;
+    size_t moved;
+
+    size_t size;
+
+    mutex_t lock;
+    // A segment of a concurrent map can be locked again by the thread that
+    // holds it, as callbacks of hashmapForEach() may use the map.
+    volatile int32_t owner;
+    int depth;
 };
 
 struct Hashmap {
-    Entry** buckets;
-    size_t bucketCount;
+    Segment* segments;
+    // Power of 2.  A map that is not concurrent has a single segment.
+    size_t segmentCount;
+    int segmentShift;
+    bool concurrent;
     int (*hash)(void* key);
     bool (*equals)(void* keyA, void* keyB);
-    mutex_t lock; 
-    size_t size;
 };
 
-Hashmap* hashmapCreate(size_t initialCapacity,
+// Slots of the old table moved by each put while a segment is rebuilt.
+#define MOVES_PER_PUT 16
+
+// Segments of a concurrent map.
+#define CONCURRENT_SEGMENT_COUNT 16
+
+static inline size_t maxUsed(size_t capacity) {
+    // 0.75 load factor, counting tombstones.
+    return capacity * 3 / 4;
+}
+
+static size_t capacityFor(size_t entries) {
+    size_t minimumCapacity = entries * 4 / 3;
+    size_t capacity = 4;
+    while (capacity <= minimumCapacity) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+static bool initTable(Table* table, size_t capacity) {
+    table->slots = calloc(capacity, sizeof(Slot));
+    if (table->slots == NULL) {
+        return false;
+    }
+    table->capacity = capacity;
+    return true;
+}
+
+static Hashmap* createMap(size_t initialCapacity, size_t segmentCount, int segmentShift,
         int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
     assert(hash != NULL);
     assert(equals != NULL);
-    
+
     Hashmap* map = malloc(sizeof(Hashmap));
     if (map == NULL) {
         return NULL;
     }
-    
-    // 0.75 load factor.
-    size_t minimumBucketCount = initialCapacity * 4 / 3;
-    map->bucketCount = 1;
-    while (map->bucketCount <= minimumBucketCount) {
-        // Bucket count must be power of 2.
-        map->bucketCount <<= 1; 
-    }
-
-    map->buckets = calloc(map->bucketCount, sizeof(Entry*));
-    if (map->buckets == NULL) {
+    map->segments = calloc(segmentCount, sizeof(Segment));
+    if (map->segments == NULL) {
         free(map);
         return NULL;
     }
-    
-    map->size = 0;
-
+    map->segmentCount = segmentCount;
+    map->segmentShift = segmentShift;
+    map->concurrent = segmentCount > 1;
     map->hash = hash;
     map->equals = equals;
-    
-    mutex_init(&map->lock);
-    
+
+    size_t capacity = capacityFor((initialCapacity + segmentCount - 1) / segmentCount);
+    size_t i;
+    for (i = 0; i < segmentCount; i++) {
+        Segment* segment = &map->segments[i];
+        if (!initTable(&segment->table, capacity)) {
+            while (i-- > 0) {
+                free(map->segments[i].table.slots);
+                mutex_destroy(&map->segments[i].lock);
+            }
+            free(map->segments);
+            free(map);
+            return NULL;
+        }
+        mutex_init(&segment->lock);
+    }
     return map;
 }
 
+Hashmap* hashmapCreate(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    return createMap(initialCapacity, 1, 0, hash, equals);
+}
+
+Hashmap* hashmapCreateConcurrent(size_t initialCapacity,
+        int (*hash)(void* key), bool (*equals)(void* keyA, void* keyB)) {
+    return createMap(initialCapacity, CONCURRENT_SEGMENT_COUNT, 28, hash, equals);
+}
+
 /**
  * Hashes the given key.
  */
-static inline int hashKey(Hashmap* map, void* key) {
+static inline unsigned int hashKey(Hashmap* map, void* key) {
     int h = map->hash(key);
 
     // We apply this secondary hashing discovered by Doug Lea to defend
@@ -86,69 +186,205 @@ static inline int hashKey(Hashmap* map, void* key) {
     h ^= (((unsigned int) h) >> 14);
     h += (h << 4);
     h ^= (((unsigned int) h) >> 10);
-       
-    return h;
+
+    return (unsigned int) h;
 }
 
-size_t hashmapSize(Hashmap* map) {
-    return map->size;
+static inline Segment* segmentFor(Hashmap* map, unsigned int hash) {
+    if (map->segmentCount == 1) {
+        return map->segments;
+    }
+    return &map->segments[hash >> map->segmentShift];
 }
 
-static inline size_t calculateIndex(size_t bucketCount, int hash) {
-    return ((size_t) hash) & (bucketCount - 1);
+static void lockSegment(Hashmap* map, Segment* segment) {
+    if (!map->concurrent) {
+        return;
+    }
+    // Only this thread can have stored its own id.
+    int32_t tid = gettid();
+    if (android_atomic_acquire_load(&segment->owner) == tid) {
+        segment->depth++;
+        return;
+    }
+    mutex_lock(&segment->lock);
+    android_atomic_release_store(tid, &segment->owner);
+    segment->depth = 1;
 }
 
-static void expandIfNecessary(Hashmap* map) {
-    // If the load factor exceeds 0.75...
-    if (map->size > (map->bucketCount * 3 / 4)) {
-        // Start off with a 0.33 load factor.
-        size_t newBucketCount = map->bucketCount << 1;
-        Entry** newBuckets = calloc(newBucketCount, sizeof(Entry*));
-        if (newBuckets == NULL) {
-            // Abort expansion.
-            return;
+static void unlockSegment(Hashmap* map, Segment* segment) {
+    if (!map->concurrent) {
+        return;
+    }
+    if (--segment->depth == 0) {
+        android_atomic_release_store(0, &segment->owner);
+        mutex_unlock(&segment->lock);
+    }
+}
+
+static inline bool equalKeys(void* keyA, unsigned int hashA, void* keyB, unsigned int hashB,
+        bool (*equals)(void*, void*)) {
+    if (keyA == keyB) {
+        return true;
+    }
+    if (hashA != hashB) {
+        return false;
+    }
+    return equals(keyA, keyB);
+}
+
+/**
+ * Returns the full slot holding the given key, or NULL.
+ */
+static Slot* findSlot(Hashmap* map, Table* table, void* key, unsigned int hash) {
+    if (table->capacity == 0) {
+        return NULL;
+    }
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    while (true) {
+        Slot* slot = &table->slots[index];
+        if (slot->state == SLOT_EMPTY) {
+            return NULL;
         }
-        
-        // Move over existing entries.
-        size_t i;
-        for (i = 0; i < map->bucketCount; i++) {
-            Entry* entry = map->buckets[i];
-            while (entry != NULL) {
-                Entry* next = entry->next;
-                size_t index = calculateIndex(newBucketCount, entry->hash);
-                entry->next = newBuckets[index];
-                newBuckets[index] = entry;
-                entry = next;
-            }
+        if (slot->state == SLOT_FULL
+                && equalKeys(slot->key, slot->hash, key, hash, map->equals)) {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+/**
+ * Finds the entry for the given key in either table of the segment.
+ */
+static Slot* findEntry(Hashmap* map, Segment* segment, void* key, unsigned int hash) {
+    Slot* slot = findSlot(map, &segment->table, key, hash);
+    if (slot == NULL) {
+        slot = findSlot(map, &segment->old, key, hash);
+    }
+    return slot;
+}
+
+/**
+ * Fills the first free slot for a key that is known not to be in the table.
+ */
+static Slot* addSlot(Segment* segment, void* key, unsigned int hash, void* value) {
+    Table* table = &segment->table;
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+    while (table->slots[index].state == SLOT_FULL) {
+        index = (index + 1) & mask;
+    }
+    Slot* slot = &table->slots[index];
+    if (slot->state == SLOT_EMPTY) {
+        segment->used++;
+    }
+    slot->key = key;
+    slot->value = value;
+    slot->hash = hash;
+    slot->state = SLOT_FULL;
+    return slot;
+}
+
+/**
+ * Moves up to count slots of the old table into the new one.
+ */
+static void moveSlots(Segment* segment, size_t count) {
+    Table* old = &segment->old;
+    size_t end = old->capacity - segment->moved > count ? segment->moved + count : old->capacity;
+    size_t i;
+    for (i = segment->moved; i < end; i++) {
+        Slot* slot = &old->slots[i];
+        if (slot->state == SLOT_FULL) {
+            addSlot(segment, slot->key, slot->hash, slot->value);
+            // Later entries of the same probe sequence must still be found.
+            slot->state = SLOT_DELETED;
+            segment->oldSize--;
+        }
+    }
+    segment->moved = end;
+    if (end == old->capacity) {
+        free(old->slots);
+        old->slots = NULL;
+        old->capacity = 0;
+    }
+}
+
+/**
+ * Makes room for one more entry.  Returns false if memory allocation fails.
+ */
+static bool reserveSlot(Segment* segment) {
+    // The entries still in the old table will need room too.
+    if (segment->used + segment->oldSize < maxUsed(segment->table.capacity)) {
+        return true;
+    }
+    if (segment->old.capacity != 0) {
+        moveSlots(segment, segment->old.capacity);
+        if (segment->used < maxUsed(segment->table.capacity)) {
+            return true;
         }
+    }
 
-        // Copy over internals.
-        free(map->buckets);
-        map->buckets = newBuckets;
-        map->bucketCount = newBucketCount;
+    // Start off with a load factor of at most 0.375, which also drops the
+    // tombstones.
+    Table table;
+    if (!initTable(&table, capacityFor(segment->size * 2))) {
+        // Carry on above the load factor as long as an empty slot remains
+        // for probing to end.
+        return segment->used + 1 < segment->table.capacity;
     }
+    segment->old = segment->table;
+    segment->oldSize = segment->size;
+    segment->moved = 0;
+    segment->table = table;
+    segment->used = 0;
+    return true;
+}
+
+size_t hashmapSize(Hashmap* map) {
+    size_t size = 0;
+    size_t i;
+    for (i = 0; i < map->segmentCount; i++) {
+        Segment* segment = &map->segments[i];
+        lockSegment(map, segment);
+        size += segment->size;
+        unlockSegment(map, segment);
+    }
+    return size;
 }
 
 void hashmapLock(Hashmap* map) {
-    mutex_lock(&map->lock);
+    if (!map->concurrent) {
+        mutex_lock(&map->segments[0].lock);
+        return;
+    }
+    size_t i;
+    for (i = 0; i < map->segmentCount; i++) {
+        lockSegment(map, &map->segments[i]);
+    }
 }
 
 void hashmapUnlock(Hashmap* map) {
-    mutex_unlock(&map->lock);
+    if (!map->concurrent) {
+        mutex_unlock(&map->segments[0].lock);
+        return;
+    }
+    size_t i = map->segmentCount;
+    while (i-- > 0) {
+        unlockSegment(map, &map->segments[i]);
+    }
 }
 
 void hashmapFree(Hashmap* map) {
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry* next = entry->next;
-            free(entry);
-            entry = next;
-        }
+    for (i = 0; i < map->segmentCount; i++) {
+        Segment* segment = &map->segments[i];
+        free(segment->table.slots);
+        free(segment->old.slots);
+        mutex_destroy(&segment->lock);
     }
-    free(map->buckets);
-    mutex_destroy(&map->lock);
+    free(map->segments);
     free(map);
 }
 
@@ -163,182 +399,178 @@ int hashmapHash(void* key, size_t keySize) {
     return h;
 }
 
-static Entry* createEntry(void* key, int hash, void* value) {
-    Entry* entry = malloc(sizeof(Entry));
-    if (entry == NULL) {
-        return NULL;
-    }
-    entry->key = key;
-    entry->hash = hash;
-    entry->value = value;
-    entry->next = NULL;
-    return entry;
-}
-
-static inline bool equalKeys(void* keyA, int hashA, void* keyB, int hashB,
-        bool (*equals)(void*, void*)) {
-    if (keyA == keyB) {
-        return true;
-    }
-    if (hashA != hashB) {
-        return false;
-    }
-    return equals(keyA, keyB);
-}
-
 void* hashmapPut(Hashmap* map, void* key, void* value) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
+    unsigned int hash = hashKey(map, key);
+    Segment* segment = segmentFor(map, hash);
+    lockSegment(map, segment);
 
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, value);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            map->size++;
-            expandIfNecessary(map);
-            return NULL;
-        }
+    if (segment->old.capacity != 0) {
+        moveSlots(segment, MOVES_PER_PUT);
+    }
 
-        // Replace existing entry.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* oldValue = current->value;
-            current->value = value;
-            return oldValue;
-        }
+    // Replace existing entry.
+    Slot* slot = findEntry(map, segment, key, hash);
+    if (slot != NULL) {
+        void* oldValue = slot->value;
+        slot->value = value;
+        unlockSegment(map, segment);
+        return oldValue;
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!reserveSlot(segment)) {
+        unlockSegment(map, segment);
+        errno = ENOMEM;
+        return NULL;
     }
+    addSlot(segment, key, hash, value);
+    segment->size++;
+    unlockSegment(map, segment);
+    return NULL;
 }
 
 void* hashmapGet(Hashmap* map, void* key) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return entry->value;
-        }
-        entry = entry->next;
-    }
-
-    return NULL;
+    unsigned int hash = hashKey(map, key);
+    Segment* segment = segmentFor(map, hash);
+    lockSegment(map, segment);
+    Slot* slot = findEntry(map, segment, key, hash);
+    void* value = slot != NULL ? slot->value : NULL;
+    unlockSegment(map, segment);
+    return value;
 }
 
 bool hashmapContainsKey(Hashmap* map, void* key) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    Entry* entry = map->buckets[index];
-    while (entry != NULL) {
-        if (equalKeys(entry->key, entry->hash, key, hash, map->equals)) {
-            return true;
-        }
-        entry = entry->next;
-    }
-
-    return false;
+    unsigned int hash = hashKey(map, key);
+    Segment* segment = segmentFor(map, hash);
+    lockSegment(map, segment);
+    bool found = findEntry(map, segment, key, hash) != NULL;
+    unlockSegment(map, segment);
+    return found;
 }
 
-void* hashmapMemoize(Hashmap* map, void* key, 
+void* hashmapMemoize(Hashmap* map, void* key,
         void* (*initialValue)(void* key, void* context), void* context) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
+    unsigned int hash = hashKey(map, key);
+    Segment* segment = segmentFor(map, hash);
+    lockSegment(map, segment);
 
-    Entry** p = &(map->buckets[index]);
-    while (true) {
-        Entry* current = *p;
-
-        // Add a new entry.
-        if (current == NULL) {
-            *p = createEntry(key, hash, NULL);
-            if (*p == NULL) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            void* value = initialValue(key, context);
-            (*p)->value = value;
-            map->size++;
-            expandIfNecessary(map);
-            return value;
-        }
+    if (segment->old.capacity != 0) {
+        moveSlots(segment, MOVES_PER_PUT);
+    }
 
-        // Return existing value.
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            return current->value;
-        }
+    // Return existing value.
+    Slot* slot = findEntry(map, segment, key, hash);
+    if (slot != NULL) {
+        void* value = slot->value;
+        unlockSegment(map, segment);
+        return value;
+    }
 
-        // Move to next entry.
-        p = &current->next;
+    // Add a new entry.
+    if (!reserveSlot(segment)) {
+        unlockSegment(map, segment);
+        errno = ENOMEM;
+        return NULL;
     }
+    void* value = initialValue(key, context);
+    addSlot(segment, key, hash, value);
+    segment->size++;
+    unlockSegment(map, segment);
+    return value;
 }
 
 void* hashmapRemove(Hashmap* map, void* key) {
-    int hash = hashKey(map, key);
-    size_t index = calculateIndex(map->bucketCount, hash);
-
-    // Pointer to the current entry.
-    Entry** p = &(map->buckets[index]);
-    Entry* current;
-    while ((current = *p) != NULL) {
-        if (equalKeys(current->key, current->hash, key, hash, map->equals)) {
-            void* value = current->value;
-            *p = current->next;
-            free(current);
-            map->size--;
-            return value;
+    unsigned int hash = hashKey(map, key);
+    Segment* segment = segmentFor(map, hash);
+    lockSegment(map, segment);
+
+    void* value = NULL;
+    Slot* slot = findEntry(map, segment, key, hash);
+    if (slot != NULL) {
+        value = slot->value;
+        slot->key = NULL;
+        slot->value = NULL;
+        slot->state = SLOT_DELETED;
+        segment->size--;
+        if (slot >= segment->old.slots && slot < segment->old.slots + segment->old.capacity) {
+            segment->oldSize--;
         }
-
-        p = &current->next;
     }
 
-    return NULL;
+    unlockSegment(map, segment);
+    return value;
 }
 
-void hashmapForEach(Hashmap* map, 
+/**
+ * Calls the callback for each full slot of the table.  Returns false if the
+ * callback asked to stop.
+ */
+static bool forEachSlot(Table* table,
+        bool (*callback)(void* key, void* value, void* context), void* context) {
+    size_t i;
+    for (i = 0; i < table->capacity; i++) {
+        Slot* slot = &table->slots[i];
+        if (slot->state == SLOT_FULL && !callback(slot->key, slot->value, context)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void hashmapForEach(Hashmap* map,
         bool (*callback)(void* key, void* value, void* context),
         void* context) {
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            Entry *next = entry->next;
-            if (!callback(entry->key, entry->value, context)) {
-                return;
-            }
-            entry = next;
+    for (i = 0; i < map->segmentCount; i++) {
+        Segment* segment = &map->segments[i];
+        lockSegment(map, segment);
+        // Removing entries from the callback only leaves tombstones, and
+        // only puts move entries between the tables.
+        bool more = forEachSlot(&segment->table, callback, context)
+                && forEachSlot(&segment->old, callback, context);
+        unlockSegment(map, segment);
+        if (!more) {
+            return;
         }
     }
 }
 
 size_t hashmapCurrentCapacity(Hashmap* map) {
-    size_t bucketCount = map->bucketCount;
-    return bucketCount * 3 / 4;
+    size_t capacity = 0;
+    size_t i;
+    for (i = 0; i < map->segmentCount; i++) {
+        Segment* segment = &map->segments[i];
+        lockSegment(map, segment);
+        capacity += maxUsed(segment->table.capacity);
+        unlockSegment(map, segment);
+    }
+    return capacity;
 }
 
-size_t hashmapCountCollisions(Hashmap* map) {
+static size_t countDisplaced(Table* table) {
     size_t collisions = 0;
     size_t i;
-    for (i = 0; i < map->bucketCount; i++) {
-        Entry* entry = map->buckets[i];
-        while (entry != NULL) {
-            if (entry->next != NULL) {
-                collisions++;
-            }
-            entry = entry->next;
+    for (i = 0; i < table->capacity; i++) {
+        Slot* slot = &table->slots[i];
+        if (slot->state == SLOT_FULL && (slot->hash & (table->capacity - 1)) != i) {
+            collisions++;
         }
     }
     return collisions;
 }
 
+size_t hashmapCountCollisions(Hashmap* map) {
+    size_t collisions = 0;
+    size_t i;
+    for (i = 0; i < map->segmentCount; i++) {
+        Segment* segment = &map->segments[i];
+        lockSegment(map, segment);
+        collisions += countDisplaced(&segment->table) + countDisplaced(&segment->old);
+        unlockSegment(map, segment);
+    }
+    return collisions;
+}
+
 int hashmapIntHash(void* key) {
     // Return the key value itself.
     return *((int*) key);
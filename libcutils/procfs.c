@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/procfs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int procfs_open(pid_t pid, pid_t tid)
+{
+    char path[64];
+
+    if (tid)
+        snprintf(path, sizeof(path), "/proc/%d/task/%d", pid, tid);
+    else
+        snprintf(path, sizeof(path), "/proc/%d", pid);
+    return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static ssize_t read_from(int fd, char *buf, size_t size, int positional)
+{
+    size_t len = 0;
+
+    if (size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* /proc files can come in more than one read. */
+    while (len < size - 1) {
+        ssize_t ret = positional ? pread(fd, buf + len, size - 1 - len, len)
+                                 : read(fd, buf + len, size - 1 - len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        len += ret;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+ssize_t procfs_read_at(int dirfd, const char *name, char *buf, size_t size)
+{
+    ssize_t ret;
+    int saved_errno;
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return -1;
+    ret = read_from(fd, buf, size, 0);
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return ret;
+}
+
+ssize_t procfs_read(pid_t pid, pid_t tid, const char *name, char *buf, size_t size)
+{
+    char path[96];
+
+    if (tid)
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/%s", pid, tid, name);
+    else
+        snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    return procfs_read_at(AT_FDCWD, path, buf, size);
+}
+
+ssize_t procfs_pread(int fd, char *buf, size_t size)
+{
+    return read_from(fd, buf, size, 1);
+}
+
+char *procfs_next_field(char **cursor)
+{
+    char *p = *cursor;
+    char *field;
+
+    while (*p == ' ' || *p == '\n')
+        p++;
+    field = p;
+    while (*p != '\0' && *p != ' ' && *p != '\n')
+        p++;
+    if (*p != '\0')
+        *p++ = '\0';
+    *cursor = p;
+    return field;
+}
+
+int procfs_parse_stat(char *buf, struct procfs_stat *stat)
+{
+    char *open_paren = strchr(buf, '(');
+    /* comm may contain ") ", so the last one ends it. */
+    char *close_paren = strrchr(buf, ')');
+    char *cursor;
+    int field;
+
+    memset(stat, 0, sizeof(*stat));
+    if (!open_paren || !close_paren || close_paren < open_paren)
+        return -1;
+    *close_paren = '\0';
+    stat->comm = open_paren + 1;
+
+    /* Fields are numbered as in proc(5); comm is 2. */
+    cursor = close_paren + 1;
+    for (field = 3; ; field++) {
+        char *value = procfs_next_field(&cursor);
+        if (*value == '\0')
+            break;
+        switch (field) {
+        case 3: stat->state = value[0]; break;
+        case 4: stat->ppid = atoi(value); break;
+        case 14: stat->utime = strtoull(value, NULL, 10); break;
+        case 15: stat->stime = strtoull(value, NULL, 10); break;
+        case 18: stat->priority = atoi(value); break;
+        case 19: stat->nice = atoi(value); break;
+        case 20: stat->num_threads = atoi(value); break;
+        case 22: stat->starttime = strtoull(value, NULL, 10); break;
+        case 23: stat->vsize = strtoull(value, NULL, 10); break;
+        case 24: stat->rss = strtoull(value, NULL, 10); break;
+        case 30: stat->kstkeip = strtoull(value, NULL, 10); break;
+        case 39: stat->processor = atoi(value); break;
+        case 40: stat->rt_priority = strtoul(value, NULL, 10); break;
+        case 41: stat->policy = strtoul(value, NULL, 10); return 0;
+        }
+    }
+    return field > 3 ? 0 : -1;
+}
+
+int procfs_parse_statm(const char *buf, uint64_t *size, uint64_t *resident)
+{
+    char *end;
+
+    *size = strtoull(buf, &end, 10);
+    if (end == buf)
+        return -1;
+    buf = end;
+    *resident = strtoull(buf, &end, 10);
+    return end == buf ? -1 : 0;
+}
+
+const char *procfs_status_value(const char *buf, const char *key)
+{
+    size_t key_len = strlen(key);
+    const char *line = buf;
+
+    while (line) {
+        if (!strncmp(line, key, key_len) && line[key_len] == ':') {
+            line += key_len + 1;
+            while (*line == ' ' || *line == '\t')
+                line++;
+            return line;
+        }
+        line = strchr(line, '\n');
+        if (line)
+            line++;
+    }
+    return NULL;
+}
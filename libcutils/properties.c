@@ -30,15 +30,11 @@
 #include <inttypes.h>
 #include <log/log.h>
 
-int8_t property_get_bool(const char *key, int8_t default_value) {
-    if (!key) {
-        return default_value;
-    }
-
+// Convert a property value to a boolean (default if it is not one)
+static int8_t parse_bool(const char *buf, int8_t default_value) {
     int8_t result = default_value;
-    char buf[PROPERTY_VALUE_MAX] = {'\0',};
+    size_t len = strlen(buf);
 
-    int len = property_get(key, buf, "");
     if (len == 1) {
         char ch = buf[0];
         if (ch == '0' || ch == 'n') {
@@ -57,19 +53,24 @@ int8_t property_get_bool(const char *key, int8_t default_value) {
     return result;
 }
 
-// Convert string property to int (default if fails); return default value if out of bounds
-static intmax_t property_get_imax(const char *key, intmax_t lower_bound, intmax_t upper_bound,
-        intmax_t default_value) {
+int8_t property_get_bool(const char *key, int8_t default_value) {
     if (!key) {
         return default_value;
     }
 
-    intmax_t result = default_value;
     char buf[PROPERTY_VALUE_MAX] = {'\0',};
+
+    property_get(key, buf, "");
+    return parse_bool(buf, default_value);
+}
+
+// Convert a property value to int (default if fails); return default value if out of bounds
+static intmax_t parse_imax(const char *key, const char *buf, intmax_t lower_bound,
+        intmax_t upper_bound, intmax_t default_value) {
+    intmax_t result = default_value;
     char *end = NULL;
 
-    int len = property_get(key, buf, "");
-    if (len > 0) {
+    if (buf[0] != '\0') {
         int tmp = errno;
         errno = 0;
 
@@ -96,6 +97,19 @@ static intmax_t property_get_imax(const char *key, intmax_t lower_bound, intmax_
     return result;
 }
 
+// Convert string property to int (default if fails); return default value if out of bounds
+static intmax_t property_get_imax(const char *key, intmax_t lower_bound, intmax_t upper_bound,
+        intmax_t default_value) {
+    if (!key) {
+        return default_value;
+    }
+
+    char buf[PROPERTY_VALUE_MAX] = {'\0',};
+
+    property_get(key, buf, "");
+    return parse_imax(key, buf, lower_bound, upper_bound, default_value);
+}
+
 int64_t property_get_int64(const char *key, int64_t default_value) {
     return (int64_t)property_get_imax(key, INT64_MIN, INT64_MAX, default_value);
 }
@@ -131,6 +145,62 @@ int property_get(const char *key, char *value, const char *default_value)
     return len;
 }
 
+void cached_property_init(struct cached_property *prop, const char *key)
+{
+    prop->key = key;
+    prop->pi = NULL;
+    prop->area_serial = -1;
+    prop->serial = -1;
+    prop->value[0] = '\0';
+}
+
+static const char *cached_property_refresh(struct cached_property *prop)
+{
+    // Any property being added or changed bumps the area serial, so while it
+    // stays the same the cached value is current.
+    uint32_t area_serial = __system_property_area_serial();
+    if (area_serial == prop->area_serial) {
+        return prop->value;
+    }
+    prop->area_serial = area_serial;
+
+    if (!prop->pi) {
+        prop->pi = __system_property_find(prop->key);
+        if (!prop->pi) {
+            return prop->value;
+        }
+    }
+    uint32_t serial = __system_property_serial(prop->pi);
+    if (serial != prop->serial) {
+        prop->serial = serial;
+        __system_property_read(prop->pi, NULL, prop->value);
+    }
+    return prop->value;
+}
+
+const char *cached_property_get(struct cached_property *prop, const char *default_value)
+{
+    const char *value = cached_property_refresh(prop);
+    return value[0] != '\0' ? value : default_value;
+}
+
+int8_t cached_property_get_bool(struct cached_property *prop, int8_t default_value)
+{
+    return parse_bool(cached_property_refresh(prop), default_value);
+}
+
+int64_t cached_property_get_int64(struct cached_property *prop, int64_t default_value)
+{
+    return (int64_t)parse_imax(prop->key, cached_property_refresh(prop),
+            INT64_MIN, INT64_MAX, default_value);
+}
+
+int32_t cached_property_get_int32(struct cached_property *prop, int32_t default_value)
+{
+    return (int32_t)parse_imax(prop->key, cached_property_refresh(prop),
+            INT32_MIN, INT32_MAX, default_value);
+}
+
 struct property_list_callback_data
 {
     void (*propfn)(const char *key, const char *value, void *cookie);
@@ -65,15 +65,9 @@ static int system_bg_cpuset_fd = -1;
 static int bg_cpuset_fd = -1;
 static int fg_cpuset_fd = -1;
 
-/* Add tid to the scheduling group defined by the policy */
-static int add_tid_to_cgroup(int tid, int fd)
+/* Write tid in decimal, as the cgroup files expect */
+static int write_tid(int fd, int tid)
 {
-    if (fd < 0) {
-        SLOGE("add_tid_to_cgroup failed; fd=%d\n", fd);
-        errno = EINVAL;
-        return -1;
-    }
-
     // specialized itoa -- works for tid > 0
     char text[22];
     char *end = text + sizeof(text) - 1;
@@ -84,15 +78,27 @@ static int add_tid_to_cgroup(int tid, int fd)
         tid = tid / 10;
     }
 
-    if (write(fd, ptr, end - ptr) < 0) {
+    return write(fd, ptr, end - ptr) < 0 ? -1 : 0;
+}
+
+/* Add tid to the scheduling group defined by the policy */
+static int add_tid_to_cgroup(int tid, int fd)
+{
+    if (fd < 0) {
+        SLOGE("add_tid_to_cgroup failed; fd=%d\n", fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (write_tid(fd, tid) < 0) {
         /*
          * If the thread is in the process of exiting,
          * don't flag an error
          */
         if (errno == ESRCH)
                 return 0;
-        SLOGW("add_tid_to_cgroup failed to write '%s' (%s); fd=%d\n",
-              ptr, strerror(errno), fd);
+        SLOGW("add_tid_to_cgroup failed to write '%d' (%s); fd=%d\n",
+              tid, strerror(errno), fd);
         errno = EINVAL;
         return -1;
     }
@@ -100,6 +106,27 @@ static int add_tid_to_cgroup(int tid, int fd)
     return 0;
 }
 
+/* Move all threads of process tgid into the cgroup directory dir at once.
+ * Returns -1 without logging if that is not possible.
+ */
+static int add_tgid_to_cgroup(int tgid, const char *dir)
+{
+    char filename[64];
+    int fd, rc;
+
+    if (!dir) {
+        return -1;
+    }
+    snprintf(filename, sizeof(filename), "%s/cgroup.procs", dir);
+    fd = open(filename, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    rc = write_tid(fd, tgid);
+    close(fd);
+    return rc;
+}
+
 static void __initialize(void) {
     char* filename;
     if (!access("/dev/cpuctl/tasks", F_OK)) {
@@ -241,6 +268,76 @@ int get_sched_policy(int tid, SchedPolicy *policy)
     return 0;
 }
 
+/* The cpuset for policy: its tasks fd, or -1, and its directory, or NULL */
+static int cpuset_for_policy(SchedPolicy policy, const char **dir)
+{
+    switch (policy) {
+    case SP_BACKGROUND:
+        *dir = "/dev/cpuset/background";
+        return bg_cpuset_fd;
+    case SP_FOREGROUND:
+    case SP_AUDIO_APP:
+    case SP_AUDIO_SYS:
+        *dir = "/dev/cpuset/foreground";
+        return fg_cpuset_fd;
+    case SP_SYSTEM:
+        *dir = "/dev/cpuset/system-background";
+        return system_bg_cpuset_fd;
+    default:
+        *dir = NULL;
+        return -1;
+    }
+}
+
+/* The cpu cgroup for policy: its tasks fd, or -1, and its directory, or NULL */
+static int cgroup_for_policy(SchedPolicy policy, const char **dir)
+{
+    switch (policy) {
+    case SP_BACKGROUND:
+        *dir = "/dev/cpuctl/bg_non_interactive";
+        return bg_cgroup_fd;
+    case SP_FOREGROUND:
+    case SP_AUDIO_APP:
+    case SP_AUDIO_SYS:
+        *dir = "/dev/cpuctl";
+        return fg_cgroup_fd;
+    default:
+        *dir = NULL;
+        return -1;
+    }
+}
+
+/* Add each of tids to the cgroup, or all of process tgid at once */
+static int add_tids_to_cgroup(int tgid, const int *tids, size_t count,
+                              int fd, const char *dir, int *errors)
+{
+    int first_error = 0;
+    size_t i;
+
+    if (tgid > 0 && add_tgid_to_cgroup(tgid, dir) == 0) {
+        if (errors) {
+            memset(errors, 0, count * sizeof(*errors));
+        }
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        int rc = 0;
+        int tid = tids[i] == 0 ? gettid() : tids[i];
+        if (add_tid_to_cgroup(tid, fd) != 0) {
+            if (errno != ESRCH && errno != ENOENT)
+                rc = -errno;
+        }
+        if (errors) {
+            errors[i] = rc;
+        }
+        if (rc && !first_error) {
+            first_error = rc;
+        }
+    }
+    return first_error;
+}
+
 int set_cpuset_policy(int tid, SchedPolicy policy)
 {
     // in the absence of cpusets, use the old sched policy
@@ -253,23 +350,8 @@ int set_cpuset_policy(int tid, SchedPolicy policy)
     policy = _policy(policy);
     pthread_once(&the_once, __initialize);
 
-    int fd;
-    switch (policy) {
-    case SP_BACKGROUND:
-        fd = bg_cpuset_fd;
-        break;
-    case SP_FOREGROUND:
-    case SP_AUDIO_APP:
-    case SP_AUDIO_SYS:
-        fd = fg_cpuset_fd;
-        break;
-    case SP_SYSTEM:
-        fd = system_bg_cpuset_fd;
-        break;
-    default:
-        fd = -1;
-        break;
-    }
+    const char *dir;
+    int fd = cpuset_for_policy(policy, &dir);
 
     if (add_tid_to_cgroup(tid, fd) != 0) {
         if (errno != ESRCH && errno != ENOENT)
@@ -280,6 +362,22 @@ int set_cpuset_policy(int tid, SchedPolicy policy)
 #endif
 }
 
+int set_cpuset_policy_batch(int tgid, const int *tids, size_t count,
+                            SchedPolicy policy, int *errors)
+{
+    // in the absence of cpusets, use the old sched policy
+#ifndef USE_CPUSETS
+    return set_sched_policy_batch(tgid, tids, count, policy, errors);
+#else
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
+
+    const char *dir;
+    int fd = cpuset_for_policy(policy, &dir);
+    return add_tids_to_cgroup(tgid, tids, count, fd, dir, errors);
+#endif
+}
+
 int set_sched_policy(int tid, SchedPolicy policy)
 {
     if (tid == 0) {
@@ -330,21 +428,8 @@ int set_sched_policy(int tid, SchedPolicy policy)
 #endif
 
     if (__sys_supports_schedgroups) {
-        int fd;
-        switch (policy) {
-        case SP_BACKGROUND:
-            fd = bg_cgroup_fd;
-            break;
-        case SP_FOREGROUND:
-        case SP_AUDIO_APP:
-        case SP_AUDIO_SYS:
-            fd = fg_cgroup_fd;
-            break;
-        default:
-            fd = -1;
-            break;
-        }
-
+        const char *dir;
+        int fd = cgroup_for_policy(policy, &dir);
 
         if (add_tid_to_cgroup(tid, fd) != 0) {
             if (errno != ESRCH && errno != ENOENT)
@@ -366,6 +451,42 @@ int set_sched_policy(int tid, SchedPolicy policy)
     return 0;
 }
 
+int set_sched_policy_batch(int tgid, const int *tids, size_t count,
+                           SchedPolicy policy, int *errors)
+{
+    int rc = 0;
+    size_t i;
+
+    policy = _policy(policy);
+    pthread_once(&the_once, __initialize);
+
+    if (__sys_supports_schedgroups) {
+        const char *dir;
+        int fd = cgroup_for_policy(policy, &dir);
+        rc = add_tids_to_cgroup(tgid, tids, count, fd, dir, errors);
+    } else if (errors) {
+        memset(errors, 0, count * sizeof(*errors));
+    }
+
+    // Timer slack and the scheduler are per thread either way.
+    for (i = 0; i < count; i++) {
+        int tid = tids[i] == 0 ? gettid() : tids[i];
+        if (!__sys_supports_schedgroups) {
+            struct sched_param param;
+
+            param.sched_priority = 0;
+            sched_setscheduler(tid,
+                               (policy == SP_BACKGROUND) ?
+                               SCHED_BATCH : SCHED_NORMAL,
+                               &param);
+        }
+        prctl(PR_SET_TIMERSLACK_PID,
+              policy == SP_BACKGROUND ? TIMER_SLACK_BG : TIMER_SLACK_FG, tid);
+    }
+
+    return rc;
+}
+
 #else
 
 /* Stubs for non-Android targets. */
@@ -381,6 +502,21 @@ int get_sched_policy(int tid UNUSED, SchedPolicy *policy)
     return 0;
 }
 
+int set_sched_policy_batch(int tgid UNUSED, const int *tids UNUSED, size_t count,
+                           SchedPolicy policy UNUSED, int *errors)
+{
+    if (errors) {
+        memset(errors, 0, count * sizeof(*errors));
+    }
+    return 0;
+}
+
+int set_cpuset_policy_batch(int tgid, const int *tids, size_t count,
+                            SchedPolicy policy, int *errors)
+{
+    return set_sched_policy_batch(tgid, tids, count, policy, errors);
+}
+
 #endif
 
 const char *get_sched_policy_name(SchedPolicy policy)
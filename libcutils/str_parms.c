@@ -23,216 +23,276 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 
-#include <cutils/hashmap.h>
 #include <cutils/memory.h>
 #include <cutils/str_parms.h>
 #include <log/log.h>
 
-#define UNUSED __attribute__((unused))
+/* audio HAL parameter strings rarely carry more pairs than this */
+#define INLINE_ENTRIES 8
 
+struct str_parms_entry {
+    size_t key;             /* offset of the key in buf */
+    size_t value;           /* offset of the value in buf */
+    uint32_t hash;
+};
+
+/*
+ * Keys and values are NUL-terminated strings stored back to back in buf, and
+ * the entries, in the order their keys were first added, refer to them by
+ * offset.  str_parms_create_str() parses its string in place in inline_buf,
+ * so that parsing a typical parameter string costs a single allocation.
+ * Replaced and deleted strings stay in buf until it next has to grow.
+ */
 struct str_parms {
-    Hashmap *map;
+    struct str_parms_entry *entries;
+    size_t count;
+    size_t capacity;
+    char *buf;
+    size_t buf_used;
+    size_t buf_size;
+    struct str_parms_entry inline_entries[INLINE_ENTRIES];
+    char inline_buf[];
 };
 
+/* use djb hash unless we find it inadequate */
+static uint32_t str_hash(const char *str)
+{
+    uint32_t hash = 5381;
+    const char *p;
 
-static bool str_eq(void *key_a, void *key_b)
+    for (p = str; *p; p++)
+        hash = ((hash << 5) + hash) + *p;
+    return hash;
+}
+
+static ssize_t find_entry(struct str_parms *str_parms, const char *key,
+                          uint32_t hash)
 {
-    return !strcmp((const char *)key_a, (const char *)key_b);
+    size_t i;
+
+    for (i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        if (entry->hash == hash && !strcmp(str_parms->buf + entry->key, key))
+            return i;
+    }
+    return -1;
 }
 
-/* use djb hash unless we find it inadequate */
-static int str_hash_fn(void *str)
+/* makes room for one more entry */
+static int reserve_entry(struct str_parms *str_parms)
 {
-    uint32_t hash = 5381;
-    char *p;
+    struct str_parms_entry *entries;
+    size_t capacity;
 
-    for (p = str; p && *p; p++)
-        hash = ((hash << 5) + hash) + *p;
-    return (int)hash;
+    if (str_parms->count < str_parms->capacity)
+        return 0;
+
+    capacity = str_parms->capacity * 2;
+    if (str_parms->entries == str_parms->inline_entries) {
+        entries = malloc(capacity * sizeof(*entries));
+        if (entries)
+            memcpy(entries, str_parms->inline_entries,
+                   str_parms->count * sizeof(*entries));
+    } else {
+        entries = realloc(str_parms->entries, capacity * sizeof(*entries));
+    }
+    if (!entries)
+        return -ENOMEM;
+
+    str_parms->entries = entries;
+    str_parms->capacity = capacity;
+    return 0;
 }
 
-struct str_parms *str_parms_create(void)
+/* makes room for size more bytes of strings, dropping the unused ones */
+static int reserve_buf(struct str_parms *str_parms, size_t size)
 {
-    struct str_parms *str_parms;
+    char *buf;
+    size_t buf_size;
+    size_t used = 0;
+    size_t i;
 
-    str_parms = calloc(1, sizeof(struct str_parms));
-    if (!str_parms)
-        return NULL;
+    if (str_parms->buf_size - str_parms->buf_used >= size)
+        return 0;
 
-    str_parms->map = hashmapCreate(5, str_hash_fn, str_eq);
-    if (!str_parms->map)
-        goto err;
+    for (i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        used += strlen(str_parms->buf + entry->key) + 1;
+        used += strlen(str_parms->buf + entry->value) + 1;
+    }
+    buf_size = (used + size) * 2;
+    if (buf_size < 64)
+        buf_size = 64;
+    buf = malloc(buf_size);
+    if (!buf)
+        return -ENOMEM;
+
+    used = 0;
+    for (i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        size_t len;
+
+        len = strlen(str_parms->buf + entry->key) + 1;
+        memcpy(buf + used, str_parms->buf + entry->key, len);
+        entry->key = used;
+        used += len;
+
+        len = strlen(str_parms->buf + entry->value) + 1;
+        memcpy(buf + used, str_parms->buf + entry->value, len);
+        entry->value = used;
+        used += len;
+    }
 
-    return str_parms;
+    if (str_parms->buf != str_parms->inline_buf)
+        free(str_parms->buf);
+    str_parms->buf = buf;
+    str_parms->buf_used = used;
+    str_parms->buf_size = buf_size;
+    return 0;
+}
 
-err:
-    free(str_parms);
-    return NULL;
+/* copies a string to the end of buf, which must have room for it */
+static size_t append_str(struct str_parms *str_parms, const char *str,
+                         size_t len)
+{
+    size_t offset = str_parms->buf_used;
+
+    memcpy(str_parms->buf + offset, str, len + 1);
+    str_parms->buf_used += len + 1;
+    return offset;
 }
 
-struct remove_ctxt {
+static struct str_parms *str_parms_alloc(size_t inline_size)
+{
     struct str_parms *str_parms;
-    const char *key;
-};
 
-static bool remove_pair(void *key, void *value, void *context)
-{
-    struct remove_ctxt *ctxt = context;
-    bool should_continue;
-
-    /*
-     * - if key is not supplied, then we are removing all entries,
-     *   so remove key and continue (i.e. return true)
-     * - if key is supplied and matches, then remove it and don't
-     *   continue (return false). Otherwise, return true and keep searching
-     *   for key.
-     *
-     */
-    if (!ctxt->key) {
-        should_continue = true;
-        goto do_remove;
-    } else if (!strcmp(ctxt->key, key)) {
-        should_continue = false;
-        goto do_remove;
-    }
+    str_parms = calloc(1, sizeof(struct str_parms) + inline_size);
+    if (!str_parms)
+        return NULL;
 
-    return true;
+    str_parms->entries = str_parms->inline_entries;
+    str_parms->capacity = INLINE_ENTRIES;
+    str_parms->buf = str_parms->inline_buf;
+    str_parms->buf_size = inline_size;
+    return str_parms;
+}
 
-do_remove:
-    hashmapRemove(ctxt->str_parms->map, key);
-    free(key);
-    free(value);
-    return should_continue;
+struct str_parms *str_parms_create(void)
+{
+    return str_parms_alloc(0);
 }
 
 void str_parms_del(struct str_parms *str_parms, const char *key)
 {
-    struct remove_ctxt ctxt = {
-        .str_parms = str_parms,
-        .key = key,
-    };
-    hashmapForEach(str_parms->map, remove_pair, &ctxt);
+    ssize_t i = find_entry(str_parms, key, str_hash(key));
+
+    if (i < 0)
+        return;
+
+    str_parms->count--;
+    memmove(&str_parms->entries[i], &str_parms->entries[i + 1],
+            (str_parms->count - i) * sizeof(struct str_parms_entry));
 }
 
 void str_parms_destroy(struct str_parms *str_parms)
 {
-    struct remove_ctxt ctxt = {
-        .str_parms = str_parms,
-    };
-
-    hashmapForEach(str_parms->map, remove_pair, &ctxt);
-    hashmapFree(str_parms->map);
+    if (str_parms->entries != str_parms->inline_entries)
+        free(str_parms->entries);
+    if (str_parms->buf != str_parms->inline_buf)
+        free(str_parms->buf);
     free(str_parms);
 }
 
 struct str_parms *str_parms_create_str(const char *_string)
 {
     struct str_parms *str_parms;
-    char *str;
+    size_t len = strlen(_string);
     char *kvpair;
-    char *tmpstr;
     int items = 0;
 
-    str_parms = str_parms_create();
+    str_parms = str_parms_alloc(len + 1);
     if (!str_parms)
-        goto err_create_str_parms;
-
-    str = strdup(_string);
-    if (!str)
-        goto err_strdup;
+        return NULL;
 
     ALOGV("%s: source string == '%s'\n", __func__, _string);
 
-    kvpair = strtok_r(str, ";", &tmpstr);
-    while (kvpair && *kvpair) {
-        char *eq = strchr(kvpair, '='); /* would love strchrnul */
+    memcpy(str_parms->inline_buf, _string, len + 1);
+    str_parms->buf_used = len + 1;
+
+    kvpair = str_parms->inline_buf;
+    while (*kvpair) {
+        char *next = kvpair + strcspn(kvpair, ";");
         char *value;
-        char *key;
-        void *old_val;
+        uint32_t hash;
+        ssize_t i;
 
-        if (eq == kvpair)
-            goto next_pair;
+        if (*next)
+            *next++ = '\0';
 
-        if (eq) {
-            key = strndup(kvpair, eq - kvpair);
-            if (*(++eq))
-                value = strdup(eq);
-            else
-                value = strdup("");
-        } else {
-            key = strdup(kvpair);
-            value = strdup("");
-        }
+        if (*kvpair == '\0' || *kvpair == '=')
+            goto next_pair;
 
-        /* if we replaced a value, free it */
-        old_val = hashmapPut(str_parms->map, key, value);
-        if (old_val) {
-            free(old_val);
-            free(key);
+        value = strchr(kvpair, '=');
+        if (value)
+            *value++ = '\0';
+        else
+            value = kvpair + strlen(kvpair);
+
+        /* a later value for the same key replaces the earlier one */
+        hash = str_hash(kvpair);
+        i = find_entry(str_parms, kvpair, hash);
+        if (i < 0) {
+            if (reserve_entry(str_parms) < 0) {
+                str_parms_destroy(str_parms);
+                return NULL;
+            }
+            i = str_parms->count++;
+            str_parms->entries[i].key = kvpair - str_parms->buf;
+            str_parms->entries[i].hash = hash;
         }
+        str_parms->entries[i].value = value - str_parms->buf;
 
         items++;
 next_pair:
-        kvpair = strtok_r(NULL, ";", &tmpstr);
+        kvpair = next;
     }
 
     if (!items)
         ALOGV("%s: no items found in string\n", __func__);
 
-    free(str);
-
     return str_parms;
-
-err_strdup:
-    str_parms_destroy(str_parms);
-err_create_str_parms:
-    return NULL;
 }
 
 int str_parms_add_str(struct str_parms *str_parms, const char *key,
                       const char *value)
 {
-    void *tmp_key = NULL;
-    void *tmp_val = NULL;
-    void *old_val = NULL;
-
-    // strdup and hashmapPut both set errno on failure.
-    // Set errno to 0 so we can recognize whether anything went wrong.
-    int saved_errno = errno;
-    errno = 0;
-
-    tmp_key = strdup(key);
-    if (tmp_key == NULL) {
-        goto clean_up;
-    }
-
-    tmp_val = strdup(value);
-    if (tmp_val == NULL) {
-        goto clean_up;
-    }
-
-    old_val = hashmapPut(str_parms->map, tmp_key, tmp_val);
-    if (old_val == NULL) {
-        // Did hashmapPut fail?
-        if (errno == ENOMEM) {
-            goto clean_up;
+    size_t key_len = strlen(key);
+    size_t value_len = strlen(value);
+    uint32_t hash = str_hash(key);
+    ssize_t i;
+
+    i = find_entry(str_parms, key, hash);
+    if (i >= 0) {
+        /* overwrite the old value if the new one fits */
+        char *old_value = str_parms->buf + str_parms->entries[i].value;
+        if (strlen(old_value) >= value_len) {
+            memcpy(old_value, value, value_len + 1);
+            return 0;
         }
-        // For new keys, hashmap takes ownership of tmp_key and tmp_val.
-        tmp_key = tmp_val = NULL;
+        if (reserve_buf(str_parms, value_len + 1) < 0)
+            return -ENOMEM;
     } else {
-        // For existing keys, hashmap takes ownership of tmp_val.
-        // (It also gives up ownership of old_val.)
-        tmp_val = NULL;
+        if (reserve_entry(str_parms) < 0 ||
+                reserve_buf(str_parms, key_len + 1 + value_len + 1) < 0)
+            return -ENOMEM;
+        i = str_parms->count++;
+        str_parms->entries[i].key = append_str(str_parms, key, key_len);
+        str_parms->entries[i].hash = hash;
     }
-
-clean_up:
-    free(tmp_key);
-    free(tmp_val);
-    free(old_val);
-    int result = -errno;
-    errno = saved_errno;
-    return result;
+    str_parms->entries[i].value = append_str(str_parms, value, value_len);
+    return 0;
 }
 
 int str_parms_add_int(struct str_parms *str_parms, const char *key, int value)
@@ -262,16 +322,23 @@ int str_parms_add_float(struct str_parms *str_parms, const char *key,
     return ret;
 }
 
+static const char *get_value(struct str_parms *str_parms, const char *key)
+{
+    ssize_t i = find_entry(str_parms, key, str_hash(key));
+
+    return i >= 0 ? str_parms->buf + str_parms->entries[i].value : NULL;
+}
+
 int str_parms_has_key(struct str_parms *str_parms, const char *key) {
-    return hashmapGet(str_parms->map, (void *)key) != NULL;
+    return get_value(str_parms, key) != NULL;
 }
 
 int str_parms_get_str(struct str_parms *str_parms, const char *key, char *val,
                       int len)
 {
-    char *value;
+    const char *value;
 
-    value = hashmapGet(str_parms->map, (void *)key);
+    value = get_value(str_parms, key);
     if (value)
         return strlcpy(val, value, len);
 
@@ -280,10 +347,10 @@ int str_parms_get_str(struct str_parms *str_parms, const char *key, char *val,
 
 int str_parms_get_int(struct str_parms *str_parms, const char *key, int *val)
 {
-    char *value;
+    const char *value;
     char *end;
 
-    value = hashmapGet(str_parms->map, (void *)key);
+    value = get_value(str_parms, key);
     if (!value)
         return -ENOENT;
 
@@ -298,10 +365,10 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
                         float *val)
 {
     float out;
-    char *value;
+    const char *value;
     char *end;
 
-    value = hashmapGet(str_parms->map, (void *)key);
+    value = get_value(str_parms, key);
     if (!value)
         return -ENOENT;
 
@@ -313,47 +380,50 @@ int str_parms_get_float(struct str_parms *str_parms, const char *key,
     return 0;
 }
 
-static bool combine_strings(void *key, void *value, void *context)
+char *str_parms_to_str(struct str_parms *str_parms)
 {
-    char **old_str = context;
-    char *new_str;
-    int ret;
-
-    ret = asprintf(&new_str, "%s%s%s=%s",
-                   *old_str ? *old_str : "",
-                   *old_str ? ";" : "",
-                   (char *)key,
-                   (char *)value);
-    if (*old_str)
-        free(*old_str);
-
-    if (ret >= 0) {
-        *old_str = new_str;
-        return true;
-    }
+    char *str;
+    char *p;
+    size_t len = 0;
+    size_t i;
 
-    *old_str = NULL;
-    return false;
-}
+    if (!str_parms->count)
+        return strdup("");
 
-char *str_parms_to_str(struct str_parms *str_parms)
-{
-    char *str = NULL;
+    for (i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        len += strlen(str_parms->buf + entry->key) + 1 +
+               strlen(str_parms->buf + entry->value) + 1;
+    }
+    str = malloc(len);
+    if (!str)
+        return NULL;
 
-    if (hashmapSize(str_parms->map) > 0)
-        hashmapForEach(str_parms->map, combine_strings, &str);
-    else
-        str = strdup("");
+    p = str;
+    for (i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        size_t key_len = strlen(str_parms->buf + entry->key);
+        size_t value_len = strlen(str_parms->buf + entry->value);
+
+        if (i)
+            *p++ = ';';
+        memcpy(p, str_parms->buf + entry->key, key_len);
+        p += key_len;
+        *p++ = '=';
+        memcpy(p, str_parms->buf + entry->value, value_len);
+        p += value_len;
+    }
+    *p = '\0';
     return str;
 }
 
-static bool dump_entry(void *key, void *value, void *context UNUSED)
-{
-    ALOGI("key: '%s' value: '%s'\n", (char *)key, (char *)value);
-    return true;
-}
-
 void str_parms_dump(struct str_parms *str_parms)
 {
-    hashmapForEach(str_parms->map, dump_entry, str_parms);
+    size_t i;
+
+    for (i = 0; i < str_parms->count; i++) {
+        struct str_parms_entry *entry = &str_parms->entries[i];
+        ALOGI("key: '%s' value: '%s'\n", str_parms->buf + entry->key,
+              str_parms->buf + entry->value);
+    }
 }
@@ -15,10 +15,14 @@
 LOCAL_PATH := $(call my-dir)
 
 test_src_files := \
+    AshmemPoolTest.cpp \
+    FsConfigTest.cpp \
+    HashmapTest.cpp \
     test_str_parms.cpp \
 
 test_target_only_src_files := \
     MemsetTest.cpp \
+    ProcfsTest.cpp \
     PropertiesTest.cpp \
 
 test_libraries := libcutils liblog
@@ -71,3 +75,18 @@ LOCAL_MULTILIB := both
 LOCAL_MODULE_STEM_32 := $(LOCAL_MODULE)32
 LOCAL_MODULE_STEM_64 := $(LOCAL_MODULE)64
 include $(BUILD_HOST_NATIVE_TEST)
+
+
+#
+# Benchmark, run by hand.
+#
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libcutils_memset_benchmark
+LOCAL_SRC_FILES := MemsetBenchmark.cpp
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SHARED_LIBRARIES := libcutils
+LOCAL_MULTILIB := both
+LOCAL_MODULE_STEM_32 := $(LOCAL_MODULE)32
+LOCAL_MODULE_STEM_64 := $(LOCAL_MODULE)64
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cutils/ashmem.h>
+#include <gtest/gtest.h>
+
+TEST(AshmemPoolTest, RoundsSizesUpToBuckets) {
+    size_t page = getpagesize();
+    int fd = ashmem_pool_create_region("pool test", page + 1);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(int(2 * page), ashmem_get_size_region(fd));
+    ashmem_pool_release_region(fd);
+
+    // Too large to pool.
+    fd = ashmem_pool_create_region("pool test", 300 * page);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(int(300 * page), ashmem_get_size_region(fd));
+    ashmem_pool_release_region(fd);
+
+    ashmem_pool_trim();
+}
+
+TEST(AshmemPoolTest, ReusesReleasedRegions) {
+    size_t size = 4 * getpagesize();
+    int fd = ashmem_pool_create_region("pool test", size);
+    ASSERT_GE(fd, 0);
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ASSERT_NE(MAP_FAILED, data);
+    memset(data, 0x5a, size);
+    munmap(data, size);
+    ashmem_pool_release_region(fd);
+
+    int reused = ashmem_pool_create_region("pool test", size);
+    EXPECT_EQ(fd, reused);
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, reused, 0);
+    ASSERT_NE(MAP_FAILED, data);
+    munmap(data, size);
+
+    // A different bucket gets a new region.
+    int other = ashmem_pool_create_region("pool test", 2 * size);
+    EXPECT_NE(reused, other);
+    ashmem_pool_release_region(other);
+    ashmem_pool_release_region(reused);
+
+    ashmem_pool_trim();
+    EXPECT_EQ(-1, fcntl(reused, F_GETFD));
+    EXPECT_EQ(-1, fcntl(other, F_GETFD));
+}
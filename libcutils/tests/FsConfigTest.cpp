@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <private/android_filesystem_config.h>
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+static const char* paths[] = {
+    "", "/", "cache", "cache/x", "data", "/data", "data/app", "data/app/foo.apk",
+    "data/app-private", "data/app-private/foo.apk", "data/apps", "data/local",
+    "data/local/tmp", "data/local/tmp/x", "data/misc/dhcp", "data/misc/dhcpx",
+    "init", "init.rc", "initx", "fstab.hammerhead", "fstab", "sbin/fs_mgr",
+    "sbin/adbd", "system/bin/run-as", "system/bin/sh", "system/bin",
+    "system/etc/ppp", "system/etc/ppp/ip-up", "system/etc/rc.local",
+    "system/etc/fs_config_dirs", "system/etc/fs_config_files",
+    "system/xbin/su", "system/xbin/su2", "vendor/bin/x", "vendor/bin",
+    "override", "override/dir/file", "override/wild", "override/wildcard",
+    "system/bin/overridden", "nothing/at/all",
+};
+
+static void writeRules(const std::string& name, const struct fs_path_config* rules,
+        size_t count) {
+    char buffer[4096];
+    FILE* fp = fopen(name.c_str(), "w");
+    ASSERT_TRUE(fp != NULL);
+    for (size_t i = 0; i < count; i++) {
+        ssize_t len = fs_config_generate(buffer, sizeof(buffer), &rules[i]);
+        ASSERT_GT(len, 0);
+        ASSERT_EQ(1U, fwrite(buffer, len, 1, fp));
+    }
+    // A truncated record ends the rules, as far as both lookups are concerned.
+    ASSERT_EQ(1U, fwrite(buffer, 20, 1, fp));
+    fclose(fp);
+}
+
+static void expectSameAsFsConfig(const char* target_out_path) {
+    struct fs_config_index* index = fs_config_index_create(target_out_path);
+    ASSERT_TRUE(index != NULL);
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        for (int dir = 0; dir < 2; dir++) {
+            unsigned uid = -1, gid = -1, mode = 0170000;
+            uint64_t capabilities = -1;
+            fs_config(paths[i], dir, target_out_path, &uid, &gid, &mode, &capabilities);
+
+            unsigned indexUid = -1, indexGid = -1, indexMode = 0170000;
+            uint64_t indexCapabilities = -1;
+            fs_config_index_lookup(index, paths[i], dir, &indexUid, &indexGid, &indexMode,
+                    &indexCapabilities);
+
+            EXPECT_EQ(uid, indexUid) << paths[i] << " dir=" << dir;
+            EXPECT_EQ(gid, indexGid) << paths[i] << " dir=" << dir;
+            EXPECT_EQ(mode, indexMode) << paths[i] << " dir=" << dir;
+            EXPECT_EQ(capabilities, indexCapabilities) << paths[i] << " dir=" << dir;
+        }
+    }
+    fs_config_index_destroy(index);
+}
+
+TEST(fs_config, index_matches_builtin_rules) {
+    expectSameAsFsConfig(NULL);
+}
+
+TEST(fs_config, index_matches_override_files) {
+    char dir[] = "/tmp/fs_config_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    std::string etc = std::string(dir) + "/etc";
+    ASSERT_EQ(0, mkdir(etc.c_str(), 0700));
+
+    static const struct fs_path_config dirs[] = {
+        { 00700, 1, 2, 0, "override/dir" },
+        { 00750, 3, 4, 0, "override" },
+        { 00711, 5, 6, 0, "override" },
+    };
+    static const struct fs_path_config files[] = {
+        { 00600, 7, 8, 1, "override/wild*" },
+        { 00640, 9, 10, 2, "override/wildcard" },
+        { 04755, 11, 12, 4, "system/bin/overridden" },
+        { 00644, 13, 14, 8, "init" },
+    };
+    writeRules(etc + "/fs_config_dirs", dirs, sizeof(dirs) / sizeof(dirs[0]));
+    writeRules(etc + "/fs_config_files", files, sizeof(files) / sizeof(files[0]));
+
+    expectSameAsFsConfig(dir);
+
+    struct fs_config_index* index = fs_config_index_create(dir);
+    ASSERT_TRUE(index != NULL);
+    unsigned uid, gid, mode = 0;
+    uint64_t capabilities;
+    fs_config_index_lookup(index, "override/x", 1, &uid, &gid, &mode, &capabilities);
+    EXPECT_EQ(3U, uid);
+    EXPECT_EQ(00750U, mode);
+    fs_config_index_lookup(index, "override/wildcard", 0, &uid, &gid, &mode, &capabilities);
+    EXPECT_EQ(7U, uid);
+    EXPECT_EQ(1U, capabilities);
+    fs_config_index_destroy(index);
+
+    unlink((etc + "/fs_config_dirs").c_str());
+    unlink((etc + "/fs_config_files").c_str());
+    rmdir(etc.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/hashmap.h>
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <vector>
+
+static int badHash(void*) {
+    // Every key collides.
+    return 42;
+}
+
+static bool removeEven(void* key, void*, void* context) {
+    Hashmap* map = reinterpret_cast<Hashmap*>(context);
+    if (*reinterpret_cast<int*>(key) % 2 == 0) {
+        hashmapRemove(map, key);
+    }
+    return true;
+}
+
+static bool countEntries(void*, void*, void* context) {
+    (*reinterpret_cast<size_t*>(context))++;
+    return true;
+}
+
+static void* keyPlusOne(void* key, void*) {
+    return reinterpret_cast<void*>(static_cast<intptr_t>(*reinterpret_cast<int*>(key) + 1));
+}
+
+static void* valueOf(int i) {
+    return reinterpret_cast<void*>(static_cast<intptr_t>(i));
+}
+
+static void putGetRemove(Hashmap* map, size_t count) {
+    std::vector<int> keys(count);
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = i;
+        ASSERT_EQ(NULL, hashmapPut(map, &keys[i], valueOf(i)));
+    }
+    ASSERT_EQ(count, hashmapSize(map));
+
+    for (size_t i = 0; i < count; i++) {
+        int key = i;
+        ASSERT_EQ(valueOf(i), hashmapGet(map, &key)) << i;
+        ASSERT_EQ(valueOf(i), hashmapPut(map, &keys[i], valueOf(i * 2)));
+    }
+
+    hashmapForEach(map, removeEven, map);
+    ASSERT_EQ(count / 2, hashmapSize(map));
+    size_t visited = 0;
+    hashmapForEach(map, countEntries, &visited);
+    ASSERT_EQ(count / 2, visited);
+
+    for (size_t i = 0; i < count; i++) {
+        int key = i;
+        ASSERT_EQ(i % 2 == 1, hashmapContainsKey(map, &key)) << i;
+        ASSERT_EQ(i % 2 == 1 ? valueOf(i * 2) : NULL, hashmapGet(map, &key)) << i;
+    }
+
+    // Reinserting after removals reuses the tombstones.
+    for (size_t i = 0; i < count; i += 2) {
+        ASSERT_EQ(valueOf(i + 1), hashmapMemoize(map, &keys[i], keyPlusOne, NULL));
+        ASSERT_EQ(valueOf(i + 1), hashmapMemoize(map, &keys[i], keyPlusOne, NULL));
+    }
+    ASSERT_EQ(count, hashmapSize(map));
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_NE(static_cast<void*>(NULL), hashmapRemove(map, &keys[i])) << i;
+    }
+    ASSERT_EQ(0U, hashmapSize(map));
+}
+
+TEST(hashmap, put_get_remove) {
+    Hashmap* map = hashmapCreate(0, hashmapIntHash, hashmapIntEquals);
+    putGetRemove(map, 10000);
+    ASSERT_GE(hashmapCurrentCapacity(map), 10000U);
+    putGetRemove(map, 10000);
+    hashmapFree(map);
+}
+
+TEST(hashmap, colliding_hashes) {
+    Hashmap* map = hashmapCreate(0, badHash, hashmapIntEquals);
+    putGetRemove(map, 500);
+    hashmapFree(map);
+}
+
+TEST(hashmap, concurrent_put_get_remove) {
+    Hashmap* map = hashmapCreateConcurrent(16, hashmapIntHash, hashmapIntEquals);
+    putGetRemove(map, 10000);
+    hashmapLock(map);
+    putGetRemove(map, 100);
+    hashmapUnlock(map);
+    hashmapFree(map);
+}
+
+struct Writer {
+    Hashmap* map;
+    std::vector<int> keys;
+};
+
+static void* write(void* arg) {
+    Writer* writer = reinterpret_cast<Writer*>(arg);
+    for (size_t i = 0; i < writer->keys.size(); i++) {
+        hashmapPut(writer->map, &writer->keys[i], &writer->keys[i]);
+    }
+    for (size_t i = 0; i < writer->keys.size(); i += 2) {
+        hashmapRemove(writer->map, &writer->keys[i]);
+    }
+    return NULL;
+}
+
+TEST(hashmap, concurrent_writers) {
+    Hashmap* map = hashmapCreateConcurrent(0, hashmapIntHash, hashmapIntEquals);
+    const size_t threadCount = 4;
+    const size_t keysPerThread = 5000;
+    Writer writers[threadCount];
+    pthread_t threads[threadCount];
+    for (size_t t = 0; t < threadCount; t++) {
+        writers[t].map = map;
+        for (size_t i = 0; i < keysPerThread; i++) {
+            writers[t].keys.push_back(t * keysPerThread + i);
+        }
+        ASSERT_EQ(0, pthread_create(&threads[t], NULL, write, &writers[t]));
+    }
+    for (size_t t = 0; t < threadCount; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    ASSERT_EQ(threadCount * keysPerThread / 2, hashmapSize(map));
+    for (size_t t = 0; t < threadCount; t++) {
+        for (size_t i = 0; i < keysPerThread; i++) {
+            int key = t * keysPerThread + i;
+            ASSERT_EQ(i % 2 == 1, hashmapContainsKey(map, &key)) << key;
+        }
+    }
+    hashmapFree(map);
+}
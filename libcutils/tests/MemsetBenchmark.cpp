@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures android_memset16 and android_memset32 at the sizes pixelflinger
+// and the surface fill paths use: a few pixels, a scanline, and whole
+// buffers that are larger than the caches.
+//
+//   libcutils_memset_benchmark [iterations]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <cutils/memory.h>
+
+static int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static void measure(uint8_t* buf, size_t size, size_t offset, int iterations) {
+    uint8_t* dst = buf + offset;
+
+    int64_t start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        android_memset16(reinterpret_cast<uint16_t*>(dst), 0xb139, size);
+    }
+    int64_t memset16 = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        android_memset32(reinterpret_cast<uint32_t*>(dst), 0x48193a27, size);
+    }
+    int64_t memset32 = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        android_memset32(reinterpret_cast<uint32_t*>(dst), 0, size);
+    }
+    int64_t zero = now_ns() - start;
+
+    printf("%9zu bytes +%zu  memset16 %8.2f GB/s  memset32 %8.2f GB/s  zero %8.2f GB/s\n",
+            size, offset,
+            double(size) * iterations / memset16,
+            double(size) * iterations / memset32,
+            double(size) * iterations / zero);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    static const size_t sizes[] = {
+        8, 32, 60, 128, 480, 1440, 4096, 65536, 1 << 20, 8 << 20, 32 << 20,
+    };
+    const size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+
+    uint8_t* buf = static_cast<uint8_t*>(malloc(max_size + 64));
+    if (buf == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        // Keep the total amount of memory set roughly constant.
+        int n = iterations / int(1 + sizes[i] / 256);
+        if (n < 10) {
+            n = 10;
+        }
+        measure(buf, sizes[i], 0, n);
+        measure(buf, sizes[i], 4, n);
+    }
+    free(buf);
+    return 0;
+}
@@ -160,8 +160,8 @@ void RunMemsetTests(test_e test_type, uint32_t value, int align[][2], size_t num
       VerifyFencepost(&buf_align[len]);
     }
   }
-  delete expected_buf;
-  delete buf;
+  delete[] expected_buf;
+  delete[] buf;
 }
 
 TEST(libcutils, android_memset16_non_zero) {
@@ -179,3 +179,43 @@ TEST(libcutils, android_memset32_non_zero) {
 TEST(libcutils, android_memset32_zero) {
   RunMemsetTests(MEMSET32, 0, g_memset32_aligns, sizeof(g_memset32_aligns)/sizeof(int[2]));
 }
+
+// Large fills take the non-temporal path on some architectures.
+static void RunLargeMemsetTest(test_e test_type, uint32_t value) {
+  const size_t len = 2*1024*1024 + 60;
+  uint8_t *buf = new uint8_t[len + 128 + 2*FENCEPOST_LENGTH];
+  for (size_t offset = 0; offset < 16; offset += (test_type == MEMSET16) ? 2 : 4) {
+    uint8_t *buf_align = reinterpret_cast<uint8_t*>(GetAlignedPtr(
+        buf+FENCEPOST_LENGTH, 32, offset));
+
+    SetFencepost(&buf_align[-FENCEPOST_LENGTH]);
+    SetFencepost(&buf_align[len]);
+
+    memset(buf_align, 0xff, len);
+    if (test_type == MEMSET16) {
+      android_memset16(reinterpret_cast<uint16_t*>(buf_align), value, len);
+      for (size_t i = 0; i < len; i += 2) {
+        ASSERT_EQ(value, *reinterpret_cast<uint16_t*>(&buf_align[i])) << i;
+      }
+    } else {
+      android_memset32(reinterpret_cast<uint32_t*>(buf_align), value, len);
+      for (size_t i = 0; i < len; i += 4) {
+        ASSERT_EQ(value, *reinterpret_cast<uint32_t*>(&buf_align[i])) << i;
+      }
+    }
+
+    VerifyFencepost(&buf_align[-FENCEPOST_LENGTH]);
+    VerifyFencepost(&buf_align[len]);
+  }
+  delete[] buf;
+}
+
+TEST(libcutils, android_memset16_large) {
+  RunLargeMemsetTest(MEMSET16, MEMSET16_PATTERN);
+  RunLargeMemsetTest(MEMSET16, 0);
+}
+
+TEST(libcutils, android_memset32_large) {
+  RunLargeMemsetTest(MEMSET32, MEMSET32_PATTERN);
+  RunLargeMemsetTest(MEMSET32, 0);
+}
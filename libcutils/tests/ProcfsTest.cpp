@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cutils/procfs.h>
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+TEST(procfs, parse_stat) {
+    // A comm with spaces and parentheses, as prctl(PR_SET_NAME) allows.
+    char buf[] = "1234 (a) b (c) S 1 1234 1234 0 -1 4194560 10 0 0 0 "
+                 "7 3 0 0 20 0 5 0 987 8192000 250 18446744073709551615 "
+                 "1 1 0 0 4096 0 0 0 0 0 0 0 17 2 0 0 0 0 0\n";
+    struct procfs_stat st;
+    ASSERT_EQ(0, procfs_parse_stat(buf, &st));
+    EXPECT_STREQ("a) b (c", st.comm);
+    EXPECT_EQ('S', st.state);
+    EXPECT_EQ(1, st.ppid);
+    EXPECT_EQ(7U, st.utime);
+    EXPECT_EQ(3U, st.stime);
+    EXPECT_EQ(20, st.priority);
+    EXPECT_EQ(0, st.nice);
+    EXPECT_EQ(5, st.num_threads);
+    EXPECT_EQ(987U, st.starttime);
+    EXPECT_EQ(8192000U, st.vsize);
+    EXPECT_EQ(250U, st.rss);
+    EXPECT_EQ(4096U, st.kstkeip);
+    EXPECT_EQ(2, st.processor);
+    EXPECT_EQ(0U, st.rt_priority);
+    EXPECT_EQ(0U, st.policy);
+
+    char bad[] = "not a stat line";
+    EXPECT_EQ(-1, procfs_parse_stat(bad, &st));
+}
+
+TEST(procfs, next_field) {
+    char buf[] = "  one two\nthree ";
+    char* cursor = buf;
+    EXPECT_STREQ("one", procfs_next_field(&cursor));
+    EXPECT_STREQ("two", procfs_next_field(&cursor));
+    EXPECT_STREQ("three", procfs_next_field(&cursor));
+    EXPECT_STREQ("", procfs_next_field(&cursor));
+    EXPECT_STREQ("", procfs_next_field(&cursor));
+}
+
+TEST(procfs, status_value) {
+    const char buf[] = "Name:\tfoo\nUid:\t1000\t1000\t1000\t1000\nVmSwap:\t   12 kB\n";
+    EXPECT_EQ(1000, atoi(procfs_status_value(buf, "Uid")));
+    EXPECT_EQ(12, atoi(procfs_status_value(buf, "VmSwap")));
+    EXPECT_EQ(0, strncmp("foo\n", procfs_status_value(buf, "Name"), 4));
+    EXPECT_EQ(NULL, procfs_status_value(buf, "Gid"));
+    EXPECT_EQ(NULL, procfs_status_value(buf, "Vm"));
+}
+
+TEST(procfs, read_self) {
+    char buf[1024];
+    struct procfs_stat st;
+    int dirfd = procfs_open(getpid(), 0);
+    ASSERT_GE(dirfd, 0);
+    ASSERT_GT(procfs_read_at(dirfd, "stat", buf, sizeof(buf)), 0);
+    ASSERT_EQ(0, procfs_parse_stat(buf, &st));
+    EXPECT_EQ('R', st.state);
+    EXPECT_EQ(getppid(), st.ppid);
+    EXPECT_GE(st.num_threads, 1);
+    close(dirfd);
+
+    uint64_t size, resident;
+    ASSERT_GT(procfs_read(getpid(), 0, "statm", buf, sizeof(buf)), 0);
+    ASSERT_EQ(0, procfs_parse_statm(buf, &size, &resident));
+    EXPECT_GT(size, 0U);
+    EXPECT_GT(resident, 0U);
+
+    pid_t tid = syscall(__NR_gettid);
+    ASSERT_GT(procfs_read(getpid(), tid, "stat", buf, sizeof(buf)), 0);
+    ASSERT_EQ(0, procfs_parse_stat(buf, &st));
+    EXPECT_EQ('R', st.state);
+
+    EXPECT_EQ(-1, procfs_read(getpid(), 0, "no-such-file", buf, sizeof(buf)));
+}
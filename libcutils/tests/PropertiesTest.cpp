@@ -306,4 +306,34 @@ TEST_F(PropertiesTest, GetInt32) {
     }
 }
 
+TEST_F(PropertiesTest, CachedProperty) {
+    struct cached_property prop = CACHED_PROPERTY_INITIALIZER(PROPERTY_TEST_KEY);
+
+    // Not set yet.
+    EXPECT_STREQ(PROPERTY_TEST_VALUE_DEFAULT,
+            cached_property_get(&prop, PROPERTY_TEST_VALUE_DEFAULT));
+    EXPECT_EQ(NULL, cached_property_get(&prop, NULL));
+
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "1"));
+    EXPECT_STREQ("1", cached_property_get(&prop, PROPERTY_TEST_VALUE_DEFAULT));
+    EXPECT_TRUE(cached_property_get_bool(&prop, false));
+    EXPECT_EQ(1, cached_property_get_int32(&prop, 0));
+
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, "0x7fffffffff"));
+    EXPECT_STREQ("0x7fffffffff", cached_property_get(&prop, PROPERTY_TEST_VALUE_DEFAULT));
+    EXPECT_EQ(0x7fffffffffLL, cached_property_get_int64(&prop, 0));
+    EXPECT_EQ(-1, cached_property_get_int32(&prop, -1));
+    EXPECT_FALSE(cached_property_get_bool(&prop, false));
+
+    // A handle set up with cached_property_init() sees the same value.
+    struct cached_property other;
+    cached_property_init(&other, PROPERTY_TEST_KEY);
+    EXPECT_STREQ("0x7fffffffff", cached_property_get(&other, NULL));
+
+    ASSERT_OK(property_set(PROPERTY_TEST_KEY, ""));
+    EXPECT_STREQ(PROPERTY_TEST_VALUE_DEFAULT,
+            cached_property_get(&prop, PROPERTY_TEST_VALUE_DEFAULT));
+    EXPECT_TRUE(cached_property_get_bool(&prop, true));
+}
+
 } // namespace android
@@ -14,6 +14,10 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
 #include <cutils/str_parms.h>
 #include <gtest/gtest.h>
 
@@ -55,3 +59,55 @@ TEST(str_parms, put_ENOMEM) {
     ASSERT_EQ(ENOMEM, errno);
     test_str_parms_str("foo=bar;baz=", "foo=bar;baz=");
 }
+
+TEST(str_parms, get) {
+    str_parms* str_parms = str_parms_create_str("routing=2;volume=0.5;mode=x=y;flag");
+    char value[16];
+    int int_value = 0;
+    float float_value = 0;
+
+    ASSERT_EQ(1, str_parms_get_str(str_parms, "routing", value, sizeof(value)));
+    EXPECT_STREQ("2", value);
+    ASSERT_EQ(3, str_parms_get_str(str_parms, "mode", value, sizeof(value)));
+    EXPECT_STREQ("x=y", value);
+    EXPECT_TRUE(str_parms_has_key(str_parms, "flag"));
+    EXPECT_FALSE(str_parms_has_key(str_parms, "rout"));
+    EXPECT_EQ(-ENOENT, str_parms_get_str(str_parms, "missing", value, sizeof(value)));
+
+    EXPECT_EQ(0, str_parms_get_int(str_parms, "routing", &int_value));
+    EXPECT_EQ(2, int_value);
+    EXPECT_EQ(-EINVAL, str_parms_get_int(str_parms, "flag", &int_value));
+    EXPECT_EQ(0, str_parms_get_float(str_parms, "volume", &float_value));
+    EXPECT_FLOAT_EQ(0.5f, float_value);
+    str_parms_destroy(str_parms);
+}
+
+TEST(str_parms, many_keys_and_replaced_values) {
+    str_parms* str_parms = str_parms_create_str("a=1;b=2");
+    char key[8];
+    for (int i = 0; i < 40; i++) {
+        snprintf(key, sizeof(key), "k%d", i);
+        ASSERT_EQ(0, str_parms_add_int(str_parms, key, i));
+    }
+    for (int i = 0; i < 40; i += 2) {
+        snprintf(key, sizeof(key), "k%d", i);
+        str_parms_del(str_parms, key);
+    }
+    // Shorter values are written in place, longer ones are appended.
+    ASSERT_EQ(0, str_parms_add_str(str_parms, "a", ""));
+    ASSERT_EQ(0, str_parms_add_str(str_parms, "b", "a much longer value"));
+
+    for (int i = 0; i < 40; i++) {
+        int value = -1;
+        snprintf(key, sizeof(key), "k%d", i);
+        ASSERT_EQ(i % 2 ? 0 : -ENOENT, str_parms_get_int(str_parms, key, &value)) << key;
+        if (i % 2) {
+            EXPECT_EQ(i, value);
+        }
+    }
+
+    char* out_str = str_parms_to_str(str_parms);
+    ASSERT_EQ(0, strncmp("a=;b=a much longer value;k1=1;k3=3;", out_str, 35)) << out_str;
+    free(out_str);
+    str_parms_destroy(str_parms);
+}
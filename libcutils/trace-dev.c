@@ -22,7 +22,9 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <cutils/compiler.h>
 #include <cutils/properties.h>
 #include <cutils/trace.h>
@@ -37,6 +39,13 @@
  */
 #define ATRACE_MESSAGE_LENGTH 1024
 
+/**
+ * Size of the per-thread buffer events are recorded in when
+ * debug.atrace.buffer_dir is set.  Large enough for a few hundred events
+ * between writes; it is only allocated by threads that trace in that mode.
+ */
+#define ATRACE_BUFFER_SIZE (32 * 1024)
+
 atomic_bool             atrace_is_ready      = ATOMIC_VAR_INIT(false);
 int                     atrace_marker_fd     = -1;
 uint64_t                atrace_enabled_tags  = ATRACE_TAG_NOT_READY;
@@ -45,6 +54,19 @@ static atomic_bool      atrace_is_enabled    = ATOMIC_VAR_INIT(true);
 static pthread_once_t   atrace_once_control  = PTHREAD_ONCE_INIT;
 static pthread_mutex_t  atrace_tags_mutex    = PTHREAD_MUTEX_INITIALIZER;
 
+// Buffered mode.  The file is opened once, the first time the property is
+// set, and kept open so that threads can still flush what they recorded
+// after the property is cleared.
+static atomic_bool      atrace_is_buffering  = ATOMIC_VAR_INIT(false);
+static int              atrace_buffer_fd     = -1;
+static pthread_key_t    atrace_buffer_key;
+
+struct atrace_buffer {
+    pid_t tid;
+    size_t length;
+    char data[ATRACE_BUFFER_SIZE];
+};
+
 // Set whether this process is debuggable, which determines whether
 // application-level tracing is allowed when the ro.debuggable system property
 // is not set to '1'.
@@ -151,6 +173,33 @@ static uint64_t atrace_get_property()
     return (tags | ATRACE_TAG_ALWAYS) & ATRACE_TAG_VALID_MASK;
 }
 
+// Read the buffer directory property, and open the buffer file the first
+// time it is set.  Called with atrace_tags_mutex held, or before tracing is
+// ready.
+static void atrace_update_buffering()
+{
+    char dir[PROPERTY_VALUE_MAX];
+
+    property_get("debug.atrace.buffer_dir", dir, "");
+    if (dir[0] == '\0') {
+        atomic_store_explicit(&atrace_is_buffering, false, memory_order_release);
+        return;
+    }
+
+    if (atrace_buffer_fd == -1) {
+        char path[PROPERTY_VALUE_MAX + 32];
+        snprintf(path, sizeof(path), "%s/atrace-%d", dir, getpid());
+        atrace_buffer_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (atrace_buffer_fd == -1) {
+            ALOGE("Error opening trace buffer file %s: %s (%d)", path,
+                    strerror(errno), errno);
+        }
+    }
+    atomic_store_explicit(&atrace_is_buffering, atrace_buffer_fd != -1,
+            memory_order_release);
+}
+
 // Update tags if tracing is ready. Useful as a sysprop change callback.
 void atrace_update_tags()
 {
@@ -160,6 +209,7 @@ void atrace_update_tags()
             tags = atrace_get_property();
             pthread_mutex_lock(&atrace_tags_mutex);
             atrace_enabled_tags = tags;
+            atrace_update_buffering();
             pthread_mutex_unlock(&atrace_tags_mutex);
         } else {
             // Tracing is disabled for this process, so we simply don't
@@ -171,8 +221,27 @@ void atrace_update_tags()
     }
 }
 
+static void atrace_buffer_write(struct atrace_buffer* buffer)
+{
+    if (buffer->length > 0) {
+        if (write(atrace_buffer_fd, buffer->data, buffer->length) == -1) {
+            ALOGE("Error writing trace buffer: %s (%d)", strerror(errno), errno);
+        }
+        buffer->length = 0;
+    }
+}
+
+static void atrace_buffer_destroy(void* data)
+{
+    struct atrace_buffer* buffer = (struct atrace_buffer*) data;
+    atrace_buffer_write(buffer);
+    free(buffer);
+}
+
 static void atrace_init_once()
 {
+    pthread_key_create(&atrace_buffer_key, atrace_buffer_destroy);
+
     atrace_marker_fd = open("/sys/kernel/debug/tracing/trace_marker", O_WRONLY);
     if (atrace_marker_fd == -1) {
         ALOGE("Error opening trace file: %s (%d)", strerror(errno), errno);
@@ -181,6 +250,7 @@ static void atrace_init_once()
     }
 
     atrace_enabled_tags = atrace_get_property();
+    atrace_update_buffering();
 
 done:
     atomic_store_explicit(&atrace_is_ready, true, memory_order_release);
@@ -191,21 +261,128 @@ void atrace_setup()
     pthread_once(&atrace_once_control, atrace_init_once);
 }
 
+void atrace_flush()
+{
+    if (atomic_load_explicit(&atrace_is_ready, memory_order_acquire)) {
+        struct atrace_buffer* buffer = pthread_getspecific(atrace_buffer_key);
+        if (buffer != NULL) {
+            atrace_buffer_write(buffer);
+        }
+    }
+}
+
+static char* atrace_append_uint(char* p, uint64_t value)
+{
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static char* atrace_append_int(char* p, int64_t value)
+{
+    if (value < 0) {
+        *p++ = '-';
+        return atrace_append_uint(p, -(uint64_t) value);
+    }
+    return atrace_append_uint(p, value);
+}
+
+// Records "<timestamp> <tid> <type>[|<pid>|<name>[|<value>]]" in the calling
+// thread's buffer if buffering, without formatting through snprintf.
+// Returns false if the event is to be written to trace_marker instead.
+static bool atrace_buffer_event(char type, const char* name, bool has_value, int64_t value)
+{
+    struct atrace_buffer* buffer = pthread_getspecific(atrace_buffer_key);
+
+    if (!atomic_load_explicit(&atrace_is_buffering, memory_order_acquire)) {
+        // Don't hold back what was recorded before buffering was turned off.
+        if (CC_UNLIKELY(buffer != NULL && buffer->length > 0)) {
+            atrace_buffer_write(buffer);
+        }
+        return false;
+    }
+
+    if (CC_UNLIKELY(buffer == NULL)) {
+        buffer = malloc(sizeof(*buffer));
+        if (buffer == NULL) {
+            return false;
+        }
+        buffer->tid = gettid();
+        buffer->length = 0;
+        pthread_setspecific(atrace_buffer_key, buffer);
+    }
+
+    // The fixed part of a record takes fewer than 128 bytes.
+    size_t name_length = name != NULL ? strnlen(name, ATRACE_MESSAGE_LENGTH) : 0;
+    if (ATRACE_BUFFER_SIZE - buffer->length < name_length + 128) {
+        atrace_buffer_write(buffer);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    char* p = buffer->data + buffer->length;
+    p = atrace_append_uint(p, now.tv_sec * UINT64_C(1000000000) + now.tv_nsec);
+    *p++ = ' ';
+    p = atrace_append_uint(p, buffer->tid);
+    *p++ = ' ';
+    *p++ = type;
+    if (name != NULL) {
+        *p++ = '|';
+        p = atrace_append_uint(p, getpid());
+        *p++ = '|';
+        memcpy(p, name, name_length);
+        p += name_length;
+        if (has_value) {
+            *p++ = '|';
+            p = atrace_append_int(p, value);
+        }
+    }
+    *p++ = '\n';
+    buffer->length = p - buffer->data;
+    return true;
+}
+
 void atrace_begin_body(const char* name)
 {
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_buffer_event('B', name, false, 0)) {
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "B|%d|%s", getpid(), name);
     write(atrace_marker_fd, buf, len);
 }
 
+void atrace_end_body()
+{
+    char c = 'E';
+
+    if (atrace_buffer_event('E', NULL, false, 0)) {
+        return;
+    }
+
+    write(atrace_marker_fd, &c, 1);
+}
 
 void atrace_async_begin_body(const char* name, int32_t cookie)
 {
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_buffer_event('S', name, true, cookie)) {
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "S|%d|%s|%" PRId32,
             getpid(), name, cookie);
     write(atrace_marker_fd, buf, len);
@@ -216,6 +393,10 @@ void atrace_async_end_body(const char* name, int32_t cookie)
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_buffer_event('F', name, true, cookie)) {
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "F|%d|%s|%" PRId32,
             getpid(), name, cookie);
     write(atrace_marker_fd, buf, len);
@@ -226,6 +407,10 @@ void atrace_int_body(const char* name, int32_t value)
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_buffer_event('C', name, true, value)) {
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "C|%d|%s|%" PRId32,
             getpid(), name, value);
     write(atrace_marker_fd, buf, len);
@@ -236,6 +421,10 @@ void atrace_int64_body(const char* name, int64_t value)
     char buf[ATRACE_MESSAGE_LENGTH];
     size_t len;
 
+    if (atrace_buffer_event('C', name, true, value)) {
+        return;
+    }
+
     len = snprintf(buf, ATRACE_MESSAGE_LENGTH, "C|%d|%s|%" PRId64,
             getpid(), name, value);
     write(atrace_marker_fd, buf, len);
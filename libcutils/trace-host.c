@@ -28,7 +28,9 @@ void atrace_set_debuggable(bool debuggable __unused) { }
 void atrace_set_tracing_enabled(bool enabled __unused) { }
 void atrace_update_tags() { }
 void atrace_setup() { }
+void atrace_flush() { }
 void atrace_begin_body(const char* name __unused) { }
+void atrace_end_body() { }
 void atrace_async_begin_body(const char* name __unused, int32_t cookie __unused) { }
 void atrace_async_end_body(const char* name __unused, int32_t cookie __unused) { }
 void atrace_int_body(const char* name __unused, int32_t value __unused) { }
@@ -49,6 +49,40 @@ ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length
     return uevent_kernel_recv(socket, buffer, length, true, uid);
 }
 
+/*
+ * Returns true if a received message comes from the kernel, and if requested,
+ * was multicast.  Sets *uid to the sender's uid, or to -1 if unknown.
+ */
+static bool uevent_from_kernel(struct msghdr *hdr, bool require_group, uid_t *uid)
+{
+    struct sockaddr_nl *addr = hdr->msg_name;
+
+    *uid = -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        /* ignoring netlink message with no sender credentials */
+        return false;
+    }
+
+    struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
+    *uid = cred->uid;
+    if (cred->uid != 0) {
+        /* ignoring netlink message from non-root user */
+        return false;
+    }
+
+    if (addr->nl_pid != 0) {
+        /* ignore non-kernel */
+        return false;
+    }
+    if (require_group && addr->nl_groups == 0) {
+        /* ignore unicast messages when requested */
+        return false;
+    }
+
+    return true;
+}
+
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid)
 {
     struct iovec iov = { buffer, length };
@@ -70,35 +104,59 @@ ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require
         return n;
     }
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
-    if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
-        /* ignoring netlink message with no sender credentials */
-        goto out;
+    if (uevent_from_kernel(&hdr, require_group, uid)) {
+        return n;
     }
 
-    struct ucred *cred = (struct ucred *)CMSG_DATA(cmsg);
-    *uid = cred->uid;
-    if (cred->uid != 0) {
-        /* ignoring netlink message from non-root user */
-        goto out;
-    }
+    /* clear residual potentially malicious data */
+    bzero(buffer, length);
+    errno = EIO;
+    return -1;
+}
 
-    if (addr.nl_pid != 0) {
-        /* ignore non-kernel */
-        goto out;
+ssize_t uevent_kernel_recv_batch(int socket, void *buffer, size_t length, size_t count,
+                                 ssize_t *lengths, bool require_group, uid_t *uids)
+{
+    struct mmsghdr msgs[UEVENT_RECV_BATCH_MAX];
+    struct iovec iovs[UEVENT_RECV_BATCH_MAX];
+    struct sockaddr_nl addrs[UEVENT_RECV_BATCH_MAX];
+    char controls[UEVENT_RECV_BATCH_MAX][CMSG_SPACE(sizeof(struct ucred))];
+    size_t i;
+
+    if (count > UEVENT_RECV_BATCH_MAX) {
+        count = UEVENT_RECV_BATCH_MAX;
     }
-    if (require_group && addr.nl_groups == 0) {
-        /* ignore unicast messages when requested */
-        goto out;
+    for (i = 0; i < count; i++) {
+        iovs[i].iov_base = (char *)buffer + i * length;
+        iovs[i].iov_len = length;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
     }
 
-    return n;
+    int n = recvmmsg(socket, msgs, count, MSG_WAITFORONE, NULL);
+    if (n <= 0) {
+        return n;
+    }
 
-out:
-    /* clear residual potentially malicious data */
-    bzero(buffer, length);
-    errno = EIO;
-    return -1;
+    for (i = 0; i < (size_t)n; i++) {
+        uid_t uid;
+        if (uevent_from_kernel(&msgs[i].msg_hdr, require_group, &uid)) {
+            lengths[i] = msgs[i].msg_len;
+        } else {
+            /* clear residual potentially malicious data */
+            bzero(iovs[i].iov_base, length);
+            lengths[i] = -1;
+        }
+        if (uids != NULL) {
+            uids[i] = uid;
+        }
+    }
+    return n;
 }
 
 int uevent_open_socket(int buf_sz, bool passcred)
@@ -116,7 +174,10 @@ int uevent_open_socket(int buf_sz, bool passcred)
     if(s < 0)
         return -1;
 
-    setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &buf_sz, sizeof(buf_sz));
+    /* Without CAP_NET_ADMIN, settle for what net.core.rmem_max allows. */
+    if (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &buf_sz, sizeof(buf_sz)) < 0) {
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, &buf_sz, sizeof(buf_sz));
+    }
     setsockopt(s, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
 
     if(bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
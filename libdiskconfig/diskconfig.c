@@ -457,6 +457,34 @@ fail:
     return 1;
 }
 
+/* Same as apply_disk_config, but builds every run of adjacent sectors in
+ * memory and writes it with one call; see wlist_commit_regions. */
+int
+apply_disk_config_flags(struct disk_info *dinfo, int flags)
+{
+    int fd;
+    struct write_list *wr_lst = NULL;
+    int rv;
+
+    if (validate_and_config(dinfo, &fd, &wr_lst) != 0) {
+        ALOGE("Configuration is invalid.");
+        goto fail;
+    }
+
+    if ((rv = wlist_commit_regions(fd, wr_lst, dinfo->sect_size, flags)) >= 0)
+        rv = (flags & WLIST_COMMIT_TEST) ? 0 : sync_ptable(fd);
+
+    close(fd);
+    wlist_free(wr_lst);
+    return rv;
+
+fail:
+    close(fd);
+    if (wr_lst)
+        wlist_free(wr_lst);
+    return 1;
+}
+
 int
 dump_disk_config(struct disk_info *dinfo)
 {
@@ -17,9 +17,12 @@
 
 #define LOG_TAG "write_lst"
 #include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <cutils/log.h>
@@ -90,3 +93,243 @@ wlist_commit(int fd, struct write_list *lst, int test)
 fail:
     return -1;
 }
+
+/* A run of whole sectors covered by one or more write_list items. */
+struct wl_region {
+    loff_t offset;
+    uint32_t len;
+    uint8_t *data;      /* the new contents, sector aligned in memory */
+    uint8_t *orig;      /* what was on the disk before */
+};
+
+static int
+cmp_wl_offset(const void *a, const void *b)
+{
+    const struct write_list *wa = *(const struct write_list * const *)a;
+    const struct write_list *wb = *(const struct write_list * const *)b;
+
+    if (wa->offset != wb->offset)
+        return wa->offset < wb->offset ? -1 : 1;
+    return 0;
+}
+
+static void
+free_regions(struct wl_region *regions, int num_regions)
+{
+    int i;
+
+    for (i = 0; i < num_regions; ++i) {
+        free(regions[i].data);
+        free(regions[i].orig);
+    }
+    free(regions);
+}
+
+/* Sorts the items by offset and merges those whose sectors touch or overlap
+ * into regions. Returns the number of regions, or -1 on error. */
+static int
+build_regions(struct write_list *lst, uint32_t sect_size,
+              struct wl_region **pregions)
+{
+    struct write_list *item;
+    struct write_list **items = NULL;
+    struct wl_region *regions = NULL;
+    int num_items = 0;
+    int num_regions = 0;
+    int i;
+
+    for (item = lst; item; item = item->next)
+        ++num_items;
+
+    if (!num_items) {
+        *pregions = NULL;
+        return 0;
+    }
+
+    items = malloc(num_items * sizeof(*items));
+    regions = calloc(num_items, sizeof(*regions));
+    if (!items || !regions) {
+        ALOGE("Unable to allocate memory.");
+        goto fail;
+    }
+
+    for (i = 0, item = lst; item; item = item->next)
+        items[i++] = item;
+    qsort(items, num_items, sizeof(*items), cmp_wl_offset);
+
+    for (i = 0; i < num_items; ++i) {
+        loff_t start = items[i]->offset & ~((loff_t)sect_size - 1);
+        loff_t end = (items[i]->offset + items[i]->len + sect_size - 1) &
+                ~((loff_t)sect_size - 1);
+        struct wl_region *last = num_regions ? &regions[num_regions - 1] : NULL;
+
+        if (last && start <= last->offset + last->len) {
+            if (end > last->offset + last->len)
+                last->len = end - last->offset;
+        } else {
+            regions[num_regions].offset = start;
+            regions[num_regions].len = end - start;
+            ++num_regions;
+        }
+    }
+
+    free(items);
+    *pregions = regions;
+    return num_regions;
+
+fail:
+    free(items);
+    free(regions);
+    return -1;
+}
+
+static struct wl_region *
+find_region(struct wl_region *regions, int num_regions, loff_t offset)
+{
+    int lo = 0;
+    int hi = num_regions - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (offset < regions[mid].offset)
+            hi = mid - 1;
+        else if (offset >= regions[mid].offset + regions[mid].len)
+            lo = mid + 1;
+        else
+            return &regions[mid];
+    }
+    return NULL;
+}
+
+static int
+read_full(int fd, uint8_t *buf, uint32_t len, loff_t offset)
+{
+    uint32_t done = 0;
+
+    while (done < len) {
+        ssize_t rv = pread64(fd, buf + done, len - done, offset + done);
+        if (rv < 0 && errno == EINTR)
+            continue;
+        if (rv < 0) {
+            ALOGE("Failed reading %u bytes at position %lld (errno=%d).",
+                  len - done, (long long)(offset + done), errno);
+            return -1;
+        }
+        if (rv == 0) {
+            /* past the end of an image file: reads as zeroes */
+            memset(buf + done, 0, len - done);
+            break;
+        }
+        done += rv;
+    }
+    return 0;
+}
+
+static int
+verify_region(int fd, const struct wl_region *region, uint32_t sect_size,
+              uint8_t *scratch)
+{
+    uint32_t pos;
+
+    for (pos = 0; pos < region->len; pos += sect_size) {
+        if (!memcmp(region->data + pos, region->orig + pos, sect_size))
+            continue;
+        if (read_full(fd, scratch, sect_size, region->offset + pos))
+            return -1;
+        if (memcmp(scratch, region->data + pos, sect_size)) {
+            ALOGE("Verify failed for the sector at position %lld.",
+                  (long long)(region->offset + pos));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Like wlist_commit, but with one aligned write per run of adjacent sectors
+ * instead of one seek and write per item. Each run is read first and the
+ * items are laid over it in list order, so later items win where they
+ * overlap, exactly as with wlist_commit. Runs whose contents would not
+ * change are not written at all. With WLIST_COMMIT_VERIFY, the sectors that
+ * changed are read back from the device once everything has been written. */
+int
+wlist_commit_regions(int fd, struct write_list *lst, int sect_size, int flags)
+{
+    struct wl_region *regions = NULL;
+    struct write_list *item;
+    uint8_t *scratch = NULL;
+    int num_regions;
+    int i;
+
+    if (sect_size <= 0 || (sect_size & (sect_size - 1))) {
+        ALOGE("Invalid sector size %d.", sect_size);
+        return -1;
+    }
+
+    if ((num_regions = build_regions(lst, sect_size, &regions)) < 0)
+        return -1;
+
+    for (i = 0; i < num_regions; ++i) {
+        struct wl_region *region = &regions[i];
+        if (posix_memalign((void **)&region->data, sect_size, region->len) ||
+            !(region->orig = malloc(region->len))) {
+            ALOGE("Unable to allocate memory.");
+            goto fail;
+        }
+        if (read_full(fd, region->data, region->len, region->offset))
+            goto fail;
+        memcpy(region->orig, region->data, region->len);
+    }
+
+    /* The list holds the items in the order wlist_commit would write them. */
+    for (item = lst; item; item = item->next) {
+        struct wl_region *region = find_region(regions, num_regions, item->offset);
+        memcpy(region->data + (item->offset - region->offset), item->data, item->len);
+    }
+
+    for (i = 0; i < num_regions; ++i) {
+        struct wl_region *region = &regions[i];
+
+        if (!memcmp(region->data, region->orig, region->len))
+            continue;
+
+        if (flags & WLIST_COMMIT_TEST) {
+            ALOGI("Would write %u bytes @ offset %lld.", region->len,
+                  (long long)region->offset);
+            continue;
+        }
+
+        if (pwrite64(fd, region->data, region->len, region->offset) !=
+                (ssize_t)region->len) {
+            ALOGE("Failed writing %u bytes at position %lld.", region->len,
+                  (long long)region->offset);
+            goto fail;
+        }
+    }
+
+    if ((flags & WLIST_COMMIT_VERIFY) && !(flags & WLIST_COMMIT_TEST)) {
+        if (fsync(fd)) {
+            ALOGE("Cannot sync before verifying (errno=%d).", errno);
+            goto fail;
+        }
+        if (posix_memalign((void **)&scratch, sect_size, sect_size)) {
+            ALOGE("Unable to allocate memory.");
+            goto fail;
+        }
+        for (i = 0; i < num_regions; ++i) {
+            /* make the read back come from the device, not the page cache */
+            posix_fadvise64(fd, regions[i].offset, regions[i].len,
+                            POSIX_FADV_DONTNEED);
+            if (verify_region(fd, &regions[i], sect_size, scratch))
+                goto fail;
+        }
+    }
+
+    free(scratch);
+    free_regions(regions, num_regions);
+    return 0;
+
+fail:
+    free(scratch);
+    free_regions(regions, num_regions);
+    return -1;
+}
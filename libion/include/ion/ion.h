@@ -41,6 +41,35 @@ int ion_map(int fd, ion_user_handle_t handle, size_t length, int prot,
 int ion_share(int fd, ion_user_handle_t handle, int *share_fd);
 int ion_import(int fd, int share_fd, ion_user_handle_t *handle);
 
+/*
+ * A pool of mapped buffers for clients that keep allocating buffers of the
+ * same few sizes, such as camera and codec streams.  A freed buffer is kept,
+ * still mapped, and handed out again by the next ion_pool_alloc with the same
+ * len, heap_mask and flags, so its contents are whatever was left in it.  At
+ * most max_idle_bytes of buffers are kept idle; the least recently freed go
+ * first.  ion_pool_trim releases idle buffers down to target_bytes (0 for
+ * all) and returns how many bytes it released; call it when the process is
+ * told to trim its memory.  Only free a buffer once its fd is no longer in
+ * use anywhere else.  The pool does not own ion_fd.
+ */
+struct ion_pool;
+
+struct ion_pool_buffer {
+    int fd;                 /* dma-buf fd, owned by the pool */
+    unsigned char *ptr;     /* read/write shared mapping of len bytes */
+    size_t len;
+    unsigned int heap_mask;
+    unsigned int flags;
+    struct ion_pool_buffer *prev, *next;    /* private to the pool */
+};
+
+struct ion_pool *ion_pool_create(int ion_fd, size_t max_idle_bytes);
+void ion_pool_destroy(struct ion_pool *pool);
+int ion_pool_alloc(struct ion_pool *pool, size_t len, unsigned int heap_mask,
+                   unsigned int flags, struct ion_pool_buffer **buffer);
+void ion_pool_free(struct ion_pool *pool, struct ion_pool_buffer *buffer);
+size_t ion_pool_trim(struct ion_pool *pool, size_t target_bytes);
+
 __END_DECLS
 
 #endif /* __SYS_CORE_ION_H */
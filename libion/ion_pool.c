@@ -0,0 +1,175 @@
+/*
+ *  ion_pool.c
+ *
+ * Recycling of mapped ion buffers
+ *
+ *   Copyright 2015 Google, Inc
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#define LOG_TAG "ion"
+
+#include <cutils/log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ion/ion.h>
+
+/*
+ * Idle buffers sit on one list, most recently freed first.  ion_pool_alloc
+ * takes the most recent match, so the buffers that stay idle longest end up
+ * at the tail, which is where trimming starts.
+ */
+struct ion_pool {
+    pthread_mutex_t lock;
+    int ion_fd;
+    size_t max_idle_bytes;
+    size_t idle_bytes;
+    struct ion_pool_buffer *head;
+    struct ion_pool_buffer *tail;
+};
+
+static void unlink_buffer(struct ion_pool *pool, struct ion_pool_buffer *buffer)
+{
+    if (buffer->prev)
+        buffer->prev->next = buffer->next;
+    else
+        pool->head = buffer->next;
+    if (buffer->next)
+        buffer->next->prev = buffer->prev;
+    else
+        pool->tail = buffer->prev;
+    buffer->prev = buffer->next = NULL;
+    pool->idle_bytes -= buffer->len;
+}
+
+static void release_buffer(struct ion_pool_buffer *buffer)
+{
+    munmap(buffer->ptr, buffer->len);
+    close(buffer->fd);
+    free(buffer);
+}
+
+/* Called with the lock held; returns the number of bytes released. */
+static size_t trim_locked(struct ion_pool *pool, size_t target_bytes)
+{
+    size_t released = 0;
+
+    while (pool->idle_bytes > target_bytes) {
+        struct ion_pool_buffer *buffer = pool->tail;
+        unlink_buffer(pool, buffer);
+        released += buffer->len;
+        release_buffer(buffer);
+    }
+    return released;
+}
+
+struct ion_pool *ion_pool_create(int ion_fd, size_t max_idle_bytes)
+{
+    struct ion_pool *pool = calloc(1, sizeof(*pool));
+
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->ion_fd = ion_fd;
+    pool->max_idle_bytes = max_idle_bytes;
+    return pool;
+}
+
+void ion_pool_destroy(struct ion_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    trim_locked(pool, 0);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int ion_pool_alloc(struct ion_pool *pool, size_t len, unsigned int heap_mask,
+                   unsigned int flags, struct ion_pool_buffer **buffer)
+{
+    struct ion_pool_buffer *b;
+    int ret;
+
+    if (pool == NULL || buffer == NULL || len == 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&pool->lock);
+    for (b = pool->head; b != NULL; b = b->next) {
+        if (b->len == len && b->heap_mask == heap_mask && b->flags == flags) {
+            unlink_buffer(pool, b);
+            pthread_mutex_unlock(&pool->lock);
+            *buffer = b;
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+        return -ENOMEM;
+    ret = ion_alloc_fd(pool->ion_fd, len, 0, heap_mask, flags, &b->fd);
+    if (ret < 0) {
+        free(b);
+        return ret;
+    }
+    b->ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, b->fd, 0);
+    if (b->ptr == MAP_FAILED) {
+        ret = -errno;
+        ALOGE("mmap failed: %s\n", strerror(errno));
+        close(b->fd);
+        free(b);
+        return ret;
+    }
+    b->len = len;
+    b->heap_mask = heap_mask;
+    b->flags = flags;
+    *buffer = b;
+    return 0;
+}
+
+void ion_pool_free(struct ion_pool *pool, struct ion_pool_buffer *buffer)
+{
+    if (buffer == NULL)
+        return;
+    if (buffer->len > pool->max_idle_bytes) {
+        release_buffer(buffer);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    buffer->prev = NULL;
+    buffer->next = pool->head;
+    if (pool->head)
+        pool->head->prev = buffer;
+    else
+        pool->tail = buffer;
+    pool->head = buffer;
+    pool->idle_bytes += buffer->len;
+    trim_locked(pool, pool->max_idle_bytes);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+size_t ion_pool_trim(struct ion_pool *pool, size_t target_bytes)
+{
+    size_t released;
+
+    pthread_mutex_lock(&pool->lock);
+    released = trim_locked(pool, target_bytes);
+    pthread_mutex_unlock(&pool->lock);
+    return released;
+}
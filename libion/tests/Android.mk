@@ -27,6 +27,7 @@ LOCAL_SRC_FILES := \
 	formerly_valid_handle_test.cpp \
 	invalid_values_test.cpp \
 	map_test.cpp \
+	pool_test.cpp \
 	device_test.cpp \
 	exit_test.cpp
 include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/mman.h>
+
+#include <gtest/gtest.h>
+
+#include <ion/ion.h>
+
+#include "ion_test_fixture.h"
+
+class Pool : public IonAllHeapsTest {
+};
+
+TEST_F(Pool, Recycle)
+{
+    static const size_t allocationSizes[] = {4*1024, 64*1024, 1024*1024, 2*1024*1024};
+    for (unsigned int heapMask : m_allHeaps) {
+        for (size_t size : allocationSizes) {
+            SCOPED_TRACE(::testing::Message() << "heap " << heapMask);
+            SCOPED_TRACE(::testing::Message() << "size " << size);
+            struct ion_pool *pool = ion_pool_create(m_ionFd, 4 * size);
+            ASSERT_TRUE(pool != NULL);
+
+            struct ion_pool_buffer *buffer = NULL;
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, 0, &buffer));
+            ASSERT_TRUE(buffer != NULL);
+            ASSERT_GE(buffer->fd, 0);
+            ASSERT_EQ(size, buffer->len);
+            memset(buffer->ptr, 0xaa, size);
+            unsigned char *ptr = buffer->ptr;
+            ion_pool_free(pool, buffer);
+
+            // Same key: the idle buffer comes back, still mapped.
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, 0, &buffer));
+            ASSERT_EQ(ptr, buffer->ptr);
+            ASSERT_EQ(0xaa, buffer->ptr[size - 1]);
+
+            // Different flags: a new buffer.
+            struct ion_pool_buffer *cached = NULL;
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, ION_FLAG_CACHED, &cached));
+            ASSERT_NE(buffer, cached);
+
+            ion_pool_free(pool, buffer);
+            ion_pool_free(pool, cached);
+            ASSERT_EQ(2 * size, ion_pool_trim(pool, 0));
+            ASSERT_EQ(0U, ion_pool_trim(pool, 0));
+
+            ion_pool_destroy(pool);
+        }
+    }
+}
+
+TEST_F(Pool, TrimToLimit)
+{
+    static const size_t size = 64*1024;
+    for (unsigned int heapMask : m_allHeaps) {
+        SCOPED_TRACE(::testing::Message() << "heap " << heapMask);
+        struct ion_pool *pool = ion_pool_create(m_ionFd, 2 * size);
+        ASSERT_TRUE(pool != NULL);
+
+        struct ion_pool_buffer *buffers[3];
+        for (int i = 0; i < 3; i++) {
+            ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, 0, &buffers[i]));
+        }
+        for (int i = 0; i < 3; i++) {
+            ion_pool_free(pool, buffers[i]);
+        }
+
+        // Only the two most recently freed stay idle, newest first.
+        struct ion_pool_buffer *buffer = NULL;
+        ASSERT_EQ(0, ion_pool_alloc(pool, size, heapMask, 0, &buffer));
+        ASSERT_EQ(buffers[2], buffer);
+        ASSERT_EQ(size, ion_pool_trim(pool, 0));
+
+        ion_pool_free(pool, buffer);
+        ion_pool_destroy(pool);
+    }
+}
@@ -70,6 +70,17 @@ endif
 LOCAL_MULTILIB := both
 include $(BUILD_HOST_SHARED_LIBRARY)
 
+ifeq ($(strip $(USE_MINGW)),)
+# Build time generator of the event tag index
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags-index
+LOCAL_SRC_FILES := event_tag_index.c
+LOCAL_CFLAGS := -Werror
+LOCAL_STATIC_LIBRARIES := liblog
+include $(BUILD_HOST_EXECUTABLE)
+endif
+
 
 # Shared and static library for target
 # ========================================================
@@ -87,6 +98,24 @@ LOCAL_CFLAGS := -Werror $(liblog_cflags)
 # TODO: This is to work around b/19059885. Remove after root cause is fixed
 LOCAL_LDFLAGS_arm := -Wl,--hash-style=both
 
+LOCAL_REQUIRED_MODULES := event-log-tags.idx
+
 include $(BUILD_SHARED_LIBRARY)
 
+# Index of the event tags, mapped by android_openEventTagMap()
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags.idx
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_PATH := $(TARGET_OUT_ETC)
+include $(BUILD_SYSTEM)/base_rules.mk
+
+event_log_tags_index_tool := $(HOST_OUT_EXECUTABLES)/event-log-tags-index$(HOST_EXECUTABLE_SUFFIX)
+$(LOCAL_BUILT_MODULE): PRIVATE_TOOL := $(event_log_tags_index_tool)
+$(LOCAL_BUILT_MODULE): $(TARGET_OUT_ETC)/event-log-tags $(event_log_tags_index_tool)
+	@echo "Generate: $< -> $@"
+	@mkdir -p $(dir $@)
+	$(hide) $(PRIVATE_TOOL) $< $@
+event_log_tags_index_tool :=
+
 include $(call first-makefiles-under,$(LOCAL_PATH))
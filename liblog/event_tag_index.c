@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Build time generator of the binary index of event-log-tags.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <log/event_tag_map.h>
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <event-log-tags> <index>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (android_writeEventTagIndex(argv[1], argv[2]) != 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
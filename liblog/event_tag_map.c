@@ -17,9 +17,14 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <log/event_tag_map.h>
 #include <log/log.h>
@@ -34,20 +39,57 @@ typedef struct EventTag {
     const char*     tagStr;
 } EventTag;
 
+/*
+ * Binary index of a map file, "<fileName>.idx", generated at build time by
+ * event-log-tags-index. It is mapped read-only and shared, looking a tag up
+ * takes no parsing and no memory of our own.
+ *
+ * The tags are placed with a perfect hash: tag t belongs to bucket
+ * hashTag(t, 0) % numBuckets, and goes in slot hashTag(t, seeds[bucket]) %
+ * numSlots, the seeds having been picked so that no two tags share a slot.
+ * The header is followed by the seeds, the slots and then the strings,
+ * all in native byte order.
+ */
+#define EVENT_TAG_INDEX_MAGIC   0x58495445 /* "ETIX" */
+#define EVENT_TAG_INDEX_SUFFIX  ".idx"
+
+typedef struct EventTagIndexHeader {
+    uint32_t        magic;
+    uint32_t        numTags;
+    uint32_t        numBuckets;
+    uint32_t        numSlots;
+    uint32_t        stringsLen;
+    uint32_t        sourceLen;  /* size of the file indexed, for staleness */
+} EventTagIndexHeader;
+
+typedef struct EventTagSlot {
+    uint32_t        tagIndex;
+    uint32_t        tagStr;     /* offset into the strings, 0 if empty */
+} EventTagSlot;
+
 /*
  * Map.
  */
 struct EventTagMap {
-    /* memory-mapped source file; we get strings from here */
+    /* memory-mapped source file or index; we get strings from here */
     void*           mapAddr;
     size_t          mapLen;
 
     /* array of event tags, sorted numerically by tag index */
     EventTag*       tagArray;
     int             numTags;
+
+    /* or, the sections of the mapped index */
+    const EventTagIndexHeader* index;
+    const uint32_t* seeds;
+    const EventTagSlot* slots;
+    const char*     strings;
 };
 
 /* fwd */
+static EventTagMap* openIndex(const char* fileName);
+static EventTagMap* openSource(const char* fileName);
+static uint32_t hashTag(uint32_t tag, uint32_t seed);
 static int processFile(EventTagMap* map);
 static int countMapLines(const EventTagMap* map);
 static int parseMapLines(EventTagMap* map);
@@ -56,12 +98,107 @@ static int sortTags(EventTagMap* map);
 
 
 /*
- * Open the map file and allocate a structure to manage it.
+ * Open the map file and allocate a structure to manage it, by way of its
+ * binary index if there is a current one.
+ */
+EventTagMap* android_openEventTagMap(const char* fileName)
+{
+    EventTagMap* newTagMap = openIndex(fileName);
+
+    if (newTagMap != NULL)
+        return newTagMap;
+    return openSource(fileName);
+}
+
+/*
+ * Map the index of fileName, if there is one, and check that it is sound
+ * and was generated from fileName as it stands. NULL if not.
+ */
+static EventTagMap* openIndex(const char* fileName)
+{
+    char indexName[PATH_MAX];
+    struct stat st;
+    off_t sourceLen = -1;
+    const EventTagIndexHeader* hdr;
+    EventTagMap* newTagMap;
+    uint64_t expected;
+    void* addr;
+    int fd;
+
+    if ((size_t)snprintf(indexName, sizeof(indexName), "%s%s", fileName,
+                         EVENT_TAG_INDEX_SUFFIX) >= sizeof(indexName))
+        return NULL;
+
+    fd = open(indexName, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (stat(fileName, &st) == 0)
+        sourceLen = st.st_size;
+
+    if ((fstat(fd, &st) != 0)
+            || (st.st_size < (off_t)sizeof(EventTagIndexHeader))) {
+        close(fd);
+        return NULL;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    hdr = (const EventTagIndexHeader*) addr;
+    expected = sizeof(*hdr)
+            + (uint64_t) hdr->numBuckets * sizeof(uint32_t)
+            + (uint64_t) hdr->numSlots * sizeof(EventTagSlot)
+            + hdr->stringsLen;
+    if ((hdr->magic != EVENT_TAG_INDEX_MAGIC)
+            || !hdr->numBuckets || (hdr->numSlots < hdr->numTags)
+            || !hdr->numSlots || !hdr->stringsLen
+            || (expected != (uint64_t) st.st_size)) {
+        fprintf(stderr, "%s: ignoring corrupt index '%s'\n",
+            OUT_TAG, indexName);
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+    if ((sourceLen >= 0) && (sourceLen != (off_t) hdr->sourceLen)) {
+        fprintf(stderr, "%s: ignoring stale index '%s'\n", OUT_TAG, indexName);
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+
+    newTagMap = calloc(1, sizeof(EventTagMap));
+    if (newTagMap == NULL) {
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+    newTagMap->mapAddr = addr;
+    newTagMap->mapLen = st.st_size;
+    newTagMap->numTags = hdr->numTags;
+    newTagMap->index = hdr;
+    newTagMap->seeds = (const uint32_t*) (hdr + 1);
+    newTagMap->slots = (const EventTagSlot*)
+            (newTagMap->seeds + hdr->numBuckets);
+    newTagMap->strings = (const char*) (newTagMap->slots + hdr->numSlots);
+
+    /* any offset in range then yields a terminated string */
+    if (newTagMap->strings[0] || newTagMap->strings[hdr->stringsLen - 1]) {
+        fprintf(stderr, "%s: ignoring corrupt index '%s'\n",
+            OUT_TAG, indexName);
+        android_closeEventTagMap(newTagMap);
+        return NULL;
+    }
+
+    return newTagMap;
+}
+
+/*
+ * Map and parse the source file.
  *
  * We create a private mapping because we want to terminate the log tag
  * strings with '\0'.
  */
-EventTagMap* android_openEventTagMap(const char* fileName)
+static EventTagMap* openSource(const char* fileName)
 {
     EventTagMap* newTagMap;
     off_t end;
@@ -93,6 +230,8 @@ EventTagMap* android_openEventTagMap(const char* fileName)
         goto fail;
     }
     newTagMap->mapLen = end;
+    close(fd);
+    fd = -1;
 
     if (processFile(newTagMap) != 0)
         goto fail;
@@ -114,19 +253,34 @@ void android_closeEventTagMap(EventTagMap* map)
     if (map == NULL)
         return;
 
-    munmap(map->mapAddr, map->mapLen);
+    if (map->mapAddr != NULL && map->mapAddr != MAP_FAILED)
+        munmap(map->mapAddr, map->mapLen);
+    free(map->tagArray);
     free(map);
 }
 
 /*
  * Look up an entry in the map.
  *
- * The entries are sorted by tag number, so we can do a binary search.
+ * With an index it is a single probe. Otherwise the entries are sorted by
+ * tag number, so we can do a binary search.
  */
 const char* android_lookupEventTag(const EventTagMap* map, int tag)
 {
     int hi, lo, mid;
 
+    if (map->index != NULL) {
+        const EventTagIndexHeader* hdr = map->index;
+        uint32_t seed = map->seeds[hashTag(tag, 0) % hdr->numBuckets];
+        const EventTagSlot* slot =
+                &map->slots[hashTag(tag, seed) % hdr->numSlots];
+
+        if (slot->tagStr && (slot->tagIndex == (uint32_t) tag)
+                && (slot->tagStr < hdr->stringsLen))
+            return map->strings + slot->tagStr;
+        return NULL;
+    }
+
     lo = 0;
     hi = map->numTags-1;
 
@@ -420,3 +574,208 @@ static int sortTags(EventTagMap* map)
 
     return 0;
 }
+
+/*
+ * Mix the tag number with a seed, the finalizer of MurmurHash3.
+ */
+static uint32_t hashTag(uint32_t tag, uint32_t seed)
+{
+    uint32_t h = tag ^ (seed * 0x9e3779b9);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/* Seeds tried for a bucket before the table is made larger */
+#define MAX_SEED 0x10000
+
+typedef struct EventTagBucket {
+    uint32_t        bucket;
+    uint32_t        count;
+} EventTagBucket;
+
+/*
+ * Largest buckets first, they are the hardest to place.
+ */
+static int compareBuckets(const void* v1, const void* v2)
+{
+    const EventTagBucket* b1 = (const EventTagBucket*) v1;
+    const EventTagBucket* b2 = (const EventTagBucket*) v2;
+
+    if (b1->count != b2->count)
+        return (b1->count < b2->count) ? 1 : -1;
+    return (b1->bucket < b2->bucket) ? -1 : (b1->bucket > b2->bucket);
+}
+
+/*
+ * Pick a seed for every bucket such that the tags in "map" land in
+ * distinct slots. "seeds" has numBuckets entries, "slots" numSlots and is
+ * filled with the index of the tag in each slot plus one, or 0.
+ *
+ * Returns 0 on success, nonzero if some bucket could not be placed.
+ */
+static int placeTags(const EventTagMap* map, uint32_t numBuckets,
+    uint32_t numSlots, uint32_t* seeds, uint32_t* slots)
+{
+    EventTagBucket* buckets;
+    uint32_t* start;
+    uint32_t* members;
+    uint32_t* tried;
+    uint32_t i, j, b;
+    int ret = -1;
+
+    buckets = calloc(numBuckets, sizeof(*buckets));
+    start = calloc(numBuckets + 1, sizeof(*start));
+    members = calloc(map->numTags + 1, sizeof(*members));
+    tried = calloc(map->numTags + 1, sizeof(*tried));
+    if (!buckets || !start || !members || !tried)
+        goto done;
+
+    /* group the tags by bucket */
+    for (i = 0; i < (uint32_t) map->numTags; i++)
+        start[hashTag(map->tagArray[i].tagIndex, 0) % numBuckets + 1]++;
+    for (b = 0; b < numBuckets; b++) {
+        buckets[b].bucket = b;
+        buckets[b].count = start[b + 1];
+        start[b + 1] += start[b];
+    }
+    for (i = 0; i < (uint32_t) map->numTags; i++) {
+        b = hashTag(map->tagArray[i].tagIndex, 0) % numBuckets;
+        members[start[b] + tried[b]++] = i;
+    }
+    qsort(buckets, numBuckets, sizeof(*buckets), compareBuckets);
+
+    memset(slots, 0, numSlots * sizeof(*slots));
+    for (b = 0; b < numBuckets && buckets[b].count; b++) {
+        const uint32_t* first = &members[start[buckets[b].bucket]];
+        uint32_t count = buckets[b].count;
+        uint32_t seed;
+
+        for (seed = 1; seed < MAX_SEED; seed++) {
+            for (i = 0; i < count; i++) {
+                tried[i] = hashTag(map->tagArray[first[i]].tagIndex, seed)
+                        % numSlots;
+                if (slots[tried[i]])
+                    break;
+                for (j = 0; j < i && tried[j] != tried[i]; j++)
+                    ;
+                if (j < i)
+                    break;
+            }
+            if (i == count)
+                break;
+        }
+        if (seed == MAX_SEED)
+            goto done;
+
+        seeds[buckets[b].bucket] = seed;
+        for (i = 0; i < count; i++)
+            slots[tried[i]] = first[i] + 1;
+    }
+    ret = 0;
+
+done:
+    free(buckets);
+    free(start);
+    free(members);
+    free(tried);
+    return ret;
+}
+
+/*
+ * Generate the binary index of the map file "fileName" into "indexName".
+ */
+int android_writeEventTagIndex(const char* fileName, const char* indexName)
+{
+    EventTagIndexHeader hdr;
+    EventTagMap* map;
+    EventTagSlot* slots = NULL;
+    uint32_t* seeds = NULL;
+    uint32_t* placed = NULL;
+    uint32_t* offsets = NULL;
+    uint32_t i;
+    FILE* fp = NULL;
+    int ret = -1;
+
+    map = openSource(fileName);
+    if (map == NULL)
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = EVENT_TAG_INDEX_MAGIC;
+    hdr.numTags = map->numTags;
+    hdr.numBuckets = map->numTags / 4 + 1;
+    hdr.numSlots = map->numTags + map->numTags / 4 + 1;
+    hdr.sourceLen = map->mapLen;
+
+    /* the strings, after an empty one for the empty slots */
+    offsets = calloc(map->numTags + 1, sizeof(*offsets));
+    if (offsets == NULL)
+        goto done;
+    hdr.stringsLen = 1;
+    for (i = 0; i < hdr.numTags; i++) {
+        offsets[i] = hdr.stringsLen;
+        hdr.stringsLen += strlen(map->tagArray[i].tagStr) + 1;
+    }
+
+    for (;;) {
+        free(seeds);
+        free(placed);
+        seeds = calloc(hdr.numBuckets, sizeof(*seeds));
+        placed = calloc(hdr.numSlots, sizeof(*placed));
+        if (!seeds || !placed)
+            goto done;
+        if (placeTags(map, hdr.numBuckets, hdr.numSlots, seeds, placed) == 0)
+            break;
+        hdr.numSlots += hdr.numSlots / 8 + 1;
+    }
+
+    slots = calloc(hdr.numSlots, sizeof(*slots));
+    if (slots == NULL)
+        goto done;
+    for (i = 0; i < hdr.numSlots; i++) {
+        if (placed[i]) {
+            slots[i].tagIndex = map->tagArray[placed[i] - 1].tagIndex;
+            slots[i].tagStr = offsets[placed[i] - 1];
+        }
+    }
+
+    fp = fopen(indexName, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: unable to create index '%s': %s\n",
+            OUT_TAG, indexName, strerror(errno));
+        goto done;
+    }
+    if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+            || (fwrite(seeds, sizeof(*seeds), hdr.numBuckets, fp)
+                    != hdr.numBuckets)
+            || (fwrite(slots, sizeof(*slots), hdr.numSlots, fp)
+                    != hdr.numSlots)
+            || (fputc('\0', fp) == EOF))
+        goto done;
+    for (i = 0; i < hdr.numTags; i++) {
+        const char* str = map->tagArray[i].tagStr;
+        if (fwrite(str, strlen(str) + 1, 1, fp) != 1)
+            goto done;
+    }
+    ret = 0;
+
+done:
+    if (fp != NULL && fclose(fp) != 0)
+        ret = -1;
+    if (ret != 0) {
+        fprintf(stderr, "%s: failed to write index '%s'\n", OUT_TAG, indexName);
+        if (fp != NULL)
+            unlink(indexName);
+    }
+    free(slots);
+    free(seeds);
+    free(placed);
+    free(offsets);
+    android_closeEventTagMap(map);
+    return ret;
+}
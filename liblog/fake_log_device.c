@@ -93,24 +93,39 @@ typedef struct LogState {
  * Locking.  Since we're emulating a device, we need to be prepared
  * to have multiple callers at the same time.  This lock is used
  * to both protect the fd list and to prevent LogStates from being
- * freed out from under a user.
+ * freed out from under a user.  Writers only read the fd list and
+ * their LogState, so they share the lock and format and write their
+ * messages in parallel; only open and close take it exclusively.
  */
-static pthread_mutex_t fakeLogDeviceLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t fakeLogDeviceLock = PTHREAD_RWLOCK_INITIALIZER;
 
 static void lock()
 {
-    pthread_mutex_lock(&fakeLogDeviceLock);
+    pthread_rwlock_wrlock(&fakeLogDeviceLock);
+}
+
+static void lockShared()
+{
+    pthread_rwlock_rdlock(&fakeLogDeviceLock);
 }
 
 static void unlock()
 {
-    pthread_mutex_unlock(&fakeLogDeviceLock);
+    pthread_rwlock_unlock(&fakeLogDeviceLock);
 }
 #else   // !defined(_WIN32)
 #define lock() ((void)0)
+#define lockShared() ((void)0)
 #define unlock() ((void)0)
 #endif  // !defined(_WIN32)
 
+/*
+ * The lowest priority any text log would show, from ANDROID_LOG_TAGS, or
+ * ANDROID_LOG_UNKNOWN until a log has been opened.  Anything below it can
+ * be dropped before it is even formatted, see fakeLogMinPriority().
+ */
+static volatile int minLoggablePriority = ANDROID_LOG_UNKNOWN;
+
 
 /*
  * File descriptor management.
@@ -299,6 +314,18 @@ static void configureInitialState(const char* pathName, LogState* logState)
     }
 
     logState->outputFormat = format;
+
+    if (!logState->isBinary) {
+        int i;
+        int lowest = logState->globalMinPriority;
+        for (i = 0; i < kTagSetSize; i++) {
+            if (logState->tagSet[i].minPriority == ANDROID_LOG_UNKNOWN)
+                break;
+            if (logState->tagSet[i].minPriority < lowest)
+                lowest = logState->tagSet[i].minPriority;
+        }
+        minLoggablePriority = lowest;
+    }
 }
 
 /*
@@ -344,6 +371,35 @@ static ssize_t fake_writev(int fd, const struct iovec *iov, int iovcnt) {
 #endif
 
 
+/*
+ * Copy the lines of a message, each with the prefix and suffix, into buf.
+ * Returns the length, or 0 if it doesn't fit.
+ */
+static size_t formatLines(char* buf, size_t bufLen,
+        const char* prefix, size_t prefixLen,
+        const char* suffix, size_t suffixLen,
+        const char* msg, const char* end, size_t numLines)
+{
+    const char* p = msg;
+    size_t len = 0;
+
+    while (numLines > 0 && p < end) {
+        const char* start = p;
+        while (p < end && *p != '\n') p++;
+        if (len + prefixLen + (p-start) + suffixLen > bufLen)
+            return 0;
+        memcpy(buf + len, prefix, prefixLen);
+        len += prefixLen;
+        memcpy(buf + len, start, p-start);
+        len += p-start;
+        memcpy(buf + len, suffix, suffixLen);
+        len += suffixLen;
+        if (*p == '\n') p++;
+        numLines -= 1;
+    }
+    return len;
+}
+
 /*
  * Write a filtered log message to stderr.
  *
@@ -378,12 +434,23 @@ static void showLog(LogState *state,
      * brackets, asterisks, or other special chars here.
      */
 #if !defined(_WIN32)
-    ptm = localtime_r(&when, &tmBuf);
+    /* localtime_r takes a process-wide lock; once a second per thread is
+     * plenty. */
+    static __thread time_t cachedWhen = (time_t) -1;
+    static __thread char cachedTimeBuf[32];
+
+    if (when != cachedWhen) {
+        ptm = localtime_r(&when, &tmBuf);
+        //strftime(cachedTimeBuf, sizeof(cachedTimeBuf), "%Y-%m-%d %H:%M:%S", ptm);
+        strftime(cachedTimeBuf, sizeof(cachedTimeBuf), "%m-%d %H:%M:%S", ptm);
+        cachedWhen = when;
+    }
+    strcpy(timeBuf, cachedTimeBuf);
 #else
     ptm = localtime(&when);
-#endif
     //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
     strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
+#endif
 
     /*
      * Construct a buffer containing the log header and log message.
@@ -445,6 +512,36 @@ static void showLog(LogState *state,
     }
     if (p > msg && *(p-1) != '\n') numLines++;
 
+    /*
+     * Usually the whole message fits in a buffer on this thread's stack,
+     * and goes out with one write().  That keeps it in one piece among the
+     * messages of other threads without holding a lock around the write.
+     */
+    char lineBuf[8192];
+    size_t lineLen = formatLines(lineBuf, sizeof(lineBuf),
+            prefixBuf, prefixLen, suffixBuf, suffixLen, msg, end, numLines);
+    if (lineLen > 0) {
+        for (;;) {
+            ssize_t cc = write(fileno(stderr), lineBuf, lineLen);
+
+            if (cc == (ssize_t) lineLen) break;
+
+            if (cc < 0) {
+                if (errno == EINTR) continue;
+
+                    /* can't really log the failure; for now, throw out a stderr */
+                fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+                break;
+            } else {
+                    /* shouldn't happen when writing to file or tty */
+                fprintf(stderr, "+++ LOG: write partial (%d of %d)\n",
+                        (int) cc, (int) lineLen);
+                break;
+            }
+        }
+        return;
+    }
+
     /*
      * Create an array of iovecs large enough to write all of
      * the lines with a prefix and a suffix.
@@ -510,8 +607,7 @@ static void showLog(LogState *state,
      *
      * If the file descriptor is actually a network socket, the writev()
      * call may return with a partial write.  Putting the writev() call in
-     * a loop can result in interleaved data.  This can be alleviated
-     * somewhat by wrapping the writev call in the Mutex.
+     * a loop can result in interleaved data.
      */
 
     for(;;) {
@@ -549,11 +645,8 @@ static ssize_t logWritev(int fd, const struct iovec* vector, int count)
 {
     LogState* state;
 
-    /* Make sure that no-one frees the LogState while we're using it.
-     * Also guarantees that only one thread is in showLog() at a given
-     * time (if it matters).
-     */
-    lock();
+    /* Make sure that no-one frees the LogState while we're using it. */
+    lockShared();
 
     state = fdToLogState(fd);
     if (state == NULL) {
@@ -690,6 +783,11 @@ ssize_t fakeLogWritev(int fd, const struct iovec* vector, int count)
     return redirectWritev(fd, vector, count);
 }
 
+int fakeLogMinPriority()
+{
+    return minLoggablePriority;
+}
+
 int __android_log_is_loggable(int prio, const char *tag __unused, int def)
 {
     int logLevel = def;
@@ -25,4 +25,10 @@ int fakeLogOpen(const char *pathName, int flags);
 int fakeLogClose(int fd);
 ssize_t fakeLogWritev(int fd, const struct iovec* vector, int count);
 
+/*
+ * Messages below this priority would not be shown for any tag, and need
+ * not be formatted.  ANDROID_LOG_UNKNOWN (0) until the first log is opened.
+ */
+int fakeLogMinPriority(void);
+
 #endif // _LIBLOG_FAKE_LOG_DEVICE_H
@@ -49,8 +49,68 @@ static void refresh_cache(struct cache *cache, const char *key)
     cache->c = buf[0];
 }
 
+/*
+ * Per-tag cache, holding the level each tag last resolved to and the
+ * property area serial it was resolved at. Any property change bumps the
+ * area serial, so a lookup with the serial unchanged costs a hash probe.
+ * Bounded, tags beyond TAG_CACHE_MAX are looked up uncached.
+ */
+#define TAG_CACHE_BUCKETS 64 /* power of two */
+#define TAG_CACHE_MAX     256
+
+struct tag_cache {
+    struct tag_cache *next;
+    uint32_t serial;       /* area serial c was resolved at */
+    char c;                /* '\0' defers to the global default */
+    struct cache cache[2]; /* log.tag.<tag>, persist.log.tag.<tag> */
+    char tag[];
+};
+
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
+static struct tag_cache *tag_table[TAG_CACHE_BUCKETS];
+static size_t tag_count;
+
+/* lock assumed, returns NULL if the tag can not be cached */
+static struct tag_cache *find_tag_cache(const char *tag, size_t taglen)
+{
+    uint32_t hash = 2166136261U; /* FNV-1a */
+    struct tag_cache *entry;
+    size_t i;
+
+    for (i = 0; i < taglen; ++i) {
+        hash = (hash ^ (unsigned char)tag[i]) * 16777619U;
+    }
+    hash &= TAG_CACHE_BUCKETS - 1;
+
+    for (entry = tag_table[hash]; entry; entry = entry->next) {
+        if (!strcmp(entry->tag, tag)) {
+            return entry;
+        }
+    }
+
+    if (tag_count >= TAG_CACHE_MAX) {
+        return NULL;
+    }
+    entry = malloc(sizeof(*entry) + taglen + 1);
+    if (!entry) {
+        return NULL;
+    }
+    entry->serial = -1;
+    entry->c = '\0';
+    for (i = 0; i < (sizeof(entry->cache) / sizeof(entry->cache[0])); ++i) {
+        entry->cache[i].pinfo = NULL;
+        entry->cache[i].serial = -1;
+        entry->cache[i].c = '\0';
+    }
+    memcpy(entry->tag, tag, taglen + 1);
+    entry->next = tag_table[hash];
+    tag_table[hash] = entry;
+    ++tag_count;
+
+    return entry;
+}
+
 static int __android_log_level(const char *tag, int def)
 {
     /* sizeof() is used on this array below */
@@ -64,7 +124,7 @@ static int __android_log_level(const char *tag, int def)
     size_t i;
     char c = 0;
     /*
-     * Single layer cache of four properties. Priorities are:
+     * Cache of four properties per tag. Priorities are:
      *    log.tag.<tag>
      *    persist.log.tag.<tag>
      *    log.tag
@@ -72,13 +132,8 @@ static int __android_log_level(const char *tag, int def)
      * Where the missing tag matches all tags and becomes the
      * system global default. We do not support ro.log.tag* .
      */
-    static char *last_tag;
-    static uint32_t global_serial;
-    uint32_t current_global_serial;
-    static struct cache tag_cache[2] = {
-        { NULL, -1, 0 },
-        { NULL, -1, 0 }
-    };
+    static uint32_t global_serial = -1;
+    uint32_t current_serial;
     static struct cache global_cache[2] = {
         { NULL, -1, 0 },
         { NULL, -1, 0 }
@@ -88,39 +143,38 @@ static int __android_log_level(const char *tag, int def)
 
     pthread_mutex_lock(&lock);
 
-    current_global_serial = __system_property_area_serial();
+    current_serial = __system_property_area_serial();
 
     if (taglen) {
-        uint32_t current_local_serial = current_global_serial;
-
-        if (!last_tag || strcmp(last_tag, tag)) {
-            /* invalidate log.tag.<tag> cache */
-            for(i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-                tag_cache[i].pinfo = NULL;
-                tag_cache[i].serial = -1;
-                tag_cache[i].c = '\0';
-            }
-            free(last_tag);
-            last_tag = NULL;
-            current_global_serial = -1;
-        }
-        if (!last_tag) {
-            last_tag = strdup(tag);
-        }
-        strcpy(key + sizeof(log_namespace) - 1, tag);
+        struct tag_cache *entry = find_tag_cache(tag, taglen);
 
-        kp = key;
-        for(i = 0; i < (sizeof(tag_cache) / sizeof(tag_cache[0])); ++i) {
-            if (current_local_serial != global_serial) {
+        if (entry && (entry->serial == current_serial)) {
+            c = entry->c;
+        } else {
+            struct cache uncached[2] = {
+                { NULL, -1, 0 },
+                { NULL, -1, 0 }
+            };
+            struct cache *tag_cache = entry ? entry->cache : uncached;
+
+            strcpy(key + sizeof(log_namespace) - 1, tag);
+
+            kp = key;
+            for(i = 0; i < (sizeof(uncached) / sizeof(uncached[0])); ++i) {
                 refresh_cache(&tag_cache[i], kp);
-            }
 
-            if (tag_cache[i].c) {
-                c = tag_cache[i].c;
-                break;
+                if (tag_cache[i].c) {
+                    c = tag_cache[i].c;
+                    break;
+                }
+
+                kp = key + base_offset;
             }
 
-            kp = key + base_offset;
+            if (entry) {
+                entry->c = c;
+                entry->serial = current_serial;
+            }
         }
     }
 
@@ -140,7 +194,7 @@ static int __android_log_level(const char *tag, int def)
 
         kp = key;
         for(i = 0; i < (sizeof(global_cache) / sizeof(global_cache[0])); ++i) {
-            if (current_global_serial != global_serial) {
+            if (current_serial != global_serial) {
                 refresh_cache(&global_cache[i], kp);
             }
 
@@ -151,11 +205,10 @@ static int __android_log_level(const char *tag, int def)
 
             kp = key + base_offset;
         }
+        global_serial = current_serial;
         break;
     }
 
-    global_serial = current_global_serial;
-
     pthread_mutex_unlock(&lock);
 
     switch (toupper(c)) {
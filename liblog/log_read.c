@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/cdefs.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <cutils/list.h>
@@ -640,6 +641,10 @@ static int android_logger_list_read_pstore(struct logger_list *logger_list,
     if (logger_list->sock < 0) {
         int fd = open("/sys/fs/pstore/pmsg-ramoops-0", O_RDONLY);
 
+        if ((fd < 0) && (errno == ENOENT)) {
+            /* No pmsg pstore, try what logd persisted in the same format */
+            fd = open("/data/misc/logd_ring/ring.last", O_RDONLY);
+        }
         if (fd < 0) {
             return -errno;
         }
@@ -886,6 +891,92 @@ int android_logger_list_read(struct logger_list *logger_list,
     return ret;
 }
 
+/* Entries taken from the socket per recvmmsg(2) */
+#define LOG_READ_BATCH 16
+
+/*
+ * Read up to count entries from the selected logs. Waits for the first as
+ * android_logger_list_read() does, then takes whatever logd has queued on
+ * the socket already, a recvmmsg(2) per LOG_READ_BATCH entries, without
+ * blocking. Returns the number of entries read, or a negative errno if not
+ * even the first could be.
+ */
+int android_logger_list_read_batch(struct logger_list *logger_list,
+                                   struct log_msg *log_msgs,
+                                   size_t count)
+{
+    struct mmsghdr msgs[LOG_READ_BATCH];
+    struct iovec iov[LOG_READ_BATCH];
+    struct logger *logger;
+    size_t n, i, want, kept;
+    int ret;
+
+    if (!logger_list || !log_msgs || !count) {
+        return -EINVAL;
+    }
+
+    ret = android_logger_list_read(logger_list, &log_msgs[0]);
+    if (ret <= 0) {
+        return ret;
+    }
+    n = 1;
+
+    if (logger_list->mode & ANDROID_LOG_PSTORE) {
+        while ((n < count)
+                && (android_logger_list_read_pstore(logger_list,
+                                                    &log_msgs[n]) > 0)) {
+            ++n;
+        }
+        return n;
+    }
+
+    while ((n < count) && (logger_list->sock >= 0)) {
+        want = min(count - n, LOG_READ_BATCH);
+        memset(msgs, 0, sizeof(msgs[0]) * want);
+        for (i = 0; i < want; ++i) {
+            memset(&log_msgs[n + i], 0, sizeof(log_msgs[0]));
+            iov[i].iov_base = &log_msgs[n + i];
+            iov[i].iov_len = LOGGER_ENTRY_MAX_LEN;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        /* NOTE: SOCK_SEQPACKET guarantees each is exactly one full entry */
+        ret = recvmmsg(logger_list->sock, msgs, want, MSG_DONTWAIT, NULL);
+        if (ret <= 0) {
+            /* Nothing more queued, errors surface on the next call */
+            break;
+        }
+
+        /* Close up the entries for logs we did not ask for */
+        kept = 0;
+        for (i = 0; i < (size_t)ret; ++i) {
+            if (msgs[i].msg_len == 0) {
+                /* server had closed it, leave it for the next call to see */
+                break;
+            }
+            logger_for_each(logger, logger_list) {
+                if (log_msgs[n + i].entry.lid == logger->id) {
+                    if (kept != i) {
+                        memcpy(&log_msgs[n + kept], &log_msgs[n + i],
+                               msgs[i].msg_len);
+                        memset(log_msgs[n + kept].buf + msgs[i].msg_len, 0,
+                               sizeof(log_msgs[0]) - msgs[i].msg_len);
+                    }
+                    ++kept;
+                    break;
+                }
+            }
+        }
+        n += kept;
+
+        if ((i < (size_t)ret) || ((size_t)ret < want)) {
+            break;
+        }
+    }
+    return n;
+}
+
 /* Close all the logs */
 void android_logger_list_free(struct logger_list *logger_list)
 {
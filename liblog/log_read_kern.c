@@ -398,6 +398,29 @@ static bool low_queue(struct listnode *node)
 }
 
 /* Flush queues in sequential order, one at a time */
+/*
+ * Kernel logger channels are not necessarily in time order, so each entry is
+ * inserted into its queue by timestamp. Out of order entries are rare and
+ * never far from the end, so the walk back from the tail is short, and the
+ * oldest entry is always at the head for the merge in
+ * android_logger_list_flush().
+ */
+static void queue_entry(struct logger *logger, struct log_list *entry)
+{
+    struct listnode *node;
+
+    list_for_each_reverse(node, &logger->log_list) {
+        struct log_list *prev = node_to_item(node, struct log_list, node);
+        if ((prev->entry.entry.sec < entry->entry.entry.sec)
+                || ((prev->entry.entry.sec == entry->entry.entry.sec)
+                    && (prev->entry.entry.nsec <= entry->entry.entry.nsec))) {
+            break;
+        }
+    }
+    /* node is the newest entry not after this one, or the list head */
+    list_add_head(node, &entry->node);
+}
+
 static int android_logger_list_flush(struct logger_list *logger_list,
                                      struct log_msg *log_msg)
 {
@@ -415,19 +438,12 @@ static int android_logger_list_flush(struct logger_list *logger_list,
         firstentry = NULL;
 
         logger_for_each(logger, logger_list) {
-            struct listnode *node;
             struct log_list *oldest = NULL;
 
-            /* kernel logger channels not necessarily time-sort order */
-            list_for_each(node, &logger->log_list) {
-                struct log_list *entry = node_to_item(node,
-                                                      struct log_list, node);
-                if (!oldest
-                        || (entry->entry.entry.sec < oldest->entry.entry.sec)
-                        || ((entry->entry.entry.sec == oldest->entry.entry.sec)
-                            && (entry->entry.entry.nsec < oldest->entry.entry.nsec))) {
-                    oldest = entry;
-                }
+            /* each queue is kept in time order, see queue_entry() */
+            if (!list_empty(&logger->log_list)) {
+                oldest = node_to_item(list_head(&logger->log_list),
+                                      struct log_list, node);
             }
 
             if (!oldest) {
@@ -680,7 +696,7 @@ int android_logger_list_read(struct logger_list *logger_list,
 
             memcpy(entry->entry.buf, logger_list->entry.buf, result);
             entry->entry.buf[result] = '\0';
-            list_add_tail(&logger->log_list, &entry->node);
+            queue_entry(logger, entry);
         }
 
         if (ret <= 0) {
@@ -725,6 +741,20 @@ done:
     return ret;
 }
 
+/* The kernel logger has no way to take more than one at a time */
+int android_logger_list_read_batch(struct logger_list *logger_list,
+                                   struct log_msg *log_msgs,
+                                   size_t count)
+{
+    int ret;
+
+    if (!log_msgs || !count) {
+        return -EINVAL;
+    }
+    ret = android_logger_list_read(logger_list, log_msgs);
+    return (ret > 0) ? 1 : ret;
+}
+
 /* Close all the logs */
 void android_logger_list_free(struct logger_list *logger_list)
 {
@@ -23,12 +23,17 @@
 #endif
 #include <stdarg.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #if (FAKE_LOG_DEVICE == 0)
+#include <linux/ashmem.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #endif
@@ -50,6 +55,10 @@
 #if FAKE_LOG_DEVICE
 /* This will be defined when building for the host. */
 #include "fake_log_device.h"
+/* Below every level ANDROID_LOG_TAGS asks for: not worth formatting */
+#define fake_log_dropped(prio) ((prio) < fakeLogMinPriority())
+#else
+#define fake_log_dropped(prio) 0
 #endif
 
 static int __write_to_log_init(log_id_t, struct iovec *vec, size_t nr);
@@ -67,6 +76,7 @@ static int log_fds[(int)LOG_ID_MAX] = { -1, -1, -1, -1, -1 };
 #else
 static int logd_fd = -1;
 static int pstore_fd = -1;
+static atomic_int_fast32_t dropped;
 #endif
 
 /*
@@ -133,6 +143,428 @@ static int __write_to_log_initialize()
     return ret;
 }
 
+#if (FAKE_LOG_DEVICE == 0)
+/*
+ * Opt-in per-thread staging of the datagrams bound for logd, sent with
+ * a single sendmmsg(2). Each record remains a datagram of its own, so
+ * logd reads them just as it does individual writes.
+ */
+#define LOG_BATCH_MAX  16
+#define LOG_BATCH_SIZE (8 * 1024)
+
+struct log_batch {
+    struct timespec first; /* realtime of the oldest record staged */
+    size_t count;
+    size_t used;
+    struct iovec iov[LOG_BATCH_MAX];
+    char data[LOG_BATCH_SIZE];
+};
+
+static atomic_uint_fast32_t batch_msecs;
+static pthread_once_t batch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t batch_key;
+static atomic_bool batch_keyed;
+
+/* Sends and empties the stage, records logd refuses are counted dropped */
+static void __write_to_log_batch_flush(struct log_batch *batch)
+{
+    struct mmsghdr msgs[LOG_BATCH_MAX];
+    size_t i, sent;
+    int ret;
+
+    if (!batch->count) {
+        return;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < batch->count; ++i) {
+        msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sent = 0;
+    while ((sent < batch->count) && (logd_fd >= 0)) {
+        ret = TEMP_FAILURE_RETRY(sendmmsg(logd_fd, msgs + sent,
+                                          batch->count - sent, 0));
+        if (ret > 0) {
+            sent += ret;
+            continue;
+        }
+        if ((ret < 0) && (errno == ENOTCONN)) {
+            pthread_mutex_lock(&log_init_lock);
+            close(logd_fd);
+            logd_fd = -1;
+            ret = __write_to_log_initialize();
+            pthread_mutex_unlock(&log_init_lock);
+            if (ret >= 0) {
+                ret = TEMP_FAILURE_RETRY(sendmmsg(logd_fd, msgs + sent,
+                                                  batch->count - sent, 0));
+                if (ret > 0) {
+                    sent += ret;
+                    continue;
+                }
+            }
+        }
+        break;
+    }
+    if (sent < batch->count) {
+        atomic_fetch_add_explicit(&dropped, batch->count - sent,
+                                  memory_order_relaxed);
+    }
+
+    batch->count = 0;
+    batch->used = 0;
+}
+
+static void __write_to_log_batch_destroy(void *arg)
+{
+    struct log_batch *batch = arg;
+
+    __write_to_log_batch_flush(batch);
+    free(batch);
+}
+
+/* The parent sends what was staged before the fork, not the child */
+static void __write_to_log_batch_atfork_child()
+{
+    struct log_batch *batch = pthread_getspecific(batch_key);
+
+    if (batch) {
+        batch->count = 0;
+        batch->used = 0;
+    }
+}
+
+static void __write_to_log_batch_once()
+{
+    if (!pthread_key_create(&batch_key, __write_to_log_batch_destroy)) {
+        pthread_atfork(NULL, NULL, __write_to_log_batch_atfork_child);
+        atomic_store(&batch_keyed, true);
+    }
+}
+
+/*
+ * Stages the datagram in vec (android_log_header_t plus payload, len bytes
+ * all told). Returns 0 if batching is not in effect or the record does not
+ * fit, the caller then writes it out directly.
+ */
+static int __write_to_log_batch(log_id_t log_id, struct iovec *vec,
+                                size_t nr, size_t len,
+                                const struct timespec *ts)
+{
+    uint_fast32_t msecs;
+    struct log_batch *batch;
+    int64_t elapsed;
+    size_t i;
+    char *cp;
+
+    if (!atomic_load(&batch_keyed)) {
+        return 0;
+    }
+    msecs = atomic_load_explicit(&batch_msecs, memory_order_relaxed);
+    batch = pthread_getspecific(batch_key);
+    if (!msecs) {
+        if (batch) {
+            __write_to_log_batch_flush(batch);
+        }
+        return 0;
+    }
+    if (!batch) {
+        batch = malloc(sizeof(*batch));
+        if (!batch) {
+            return 0;
+        }
+        batch->count = 0;
+        batch->used = 0;
+        if (pthread_setspecific(batch_key, batch)) {
+            free(batch);
+            return 0;
+        }
+    }
+
+    if ((batch->count >= LOG_BATCH_MAX)
+            || ((batch->used + len) > sizeof(batch->data))) {
+        __write_to_log_batch_flush(batch);
+    }
+    if (len > sizeof(batch->data)) {
+        return 0;
+    }
+
+    if (!batch->count) {
+        batch->first = *ts;
+    }
+    cp = batch->data + batch->used;
+    batch->iov[batch->count].iov_base = cp;
+    batch->iov[batch->count].iov_len = len;
+    for (i = 0; i < nr; ++i) {
+        memcpy(cp, vec[i].iov_base, vec[i].iov_len);
+        cp += vec[i].iov_len;
+    }
+    batch->used += len;
+    ++batch->count;
+
+    elapsed = (ts->tv_sec - batch->first.tv_sec) * 1000LL
+            + (ts->tv_nsec - batch->first.tv_nsec) / 1000000LL;
+    if ((log_id == LOG_ID_CRASH) || (elapsed >= (int64_t)msecs)
+            || ((log_id != LOG_ID_EVENTS) && (nr > 1) && vec[1].iov_len
+                && (*(const char *)vec[1].iov_base >= ANDROID_LOG_FATAL))) {
+        __write_to_log_batch_flush(batch);
+    }
+
+    return len;
+}
+
+/*
+ * Shared memory ring to logd, see android_logger.h for the protocol.
+ * ring_lock serializes the writers of this process, ring_pid tells a
+ * forked child that the ring, and the credentials logd bound to it,
+ * belong to its parent.
+ */
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static android_log_ring_t *ring;
+static size_t ring_mapped;
+static int ring_doorbell = -1;
+static pid_t ring_pid;
+
+/* ring_lock assumed */
+static void __write_to_log_ring_close()
+{
+    if (ring) {
+        munmap(ring, ring_mapped);
+        ring = NULL;
+    }
+    if (ring_doorbell >= 0) {
+        close(ring_doorbell);
+        ring_doorbell = -1;
+    }
+}
+
+/* ring_lock assumed */
+static int __write_to_log_ring_open(size_t size)
+{
+    android_log_ring_register_t reg;
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    struct cmsghdr *cmsg;
+    struct pollfd pfd;
+    void *map;
+    int fd, sv[2], ret;
+    char c;
+
+    fd = TEMP_FAILURE_RETRY(open("/dev/ashmem", O_RDWR | O_CLOEXEC));
+    if (fd < 0) {
+        return -errno;
+    }
+    ring_mapped = sizeof(android_log_ring_t) + size;
+    if ((ioctl(fd, ASHMEM_SET_NAME, "logd ring") < 0)
+            || (ioctl(fd, ASHMEM_SET_SIZE, ring_mapped) < 0)) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+    map = mmap(NULL, ring_mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        ret = -errno;
+        munmap(map, ring_mapped);
+        close(fd);
+        return ret;
+    }
+    ring = map;
+    ring_doorbell = sv[0];
+    ring_pid = getpid();
+
+    ring->magic = LOGGER_RING_MAGIC;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->waiting = 0;
+
+    reg.magic = LOGGER_RING_MAGIC;
+    reg.size = size;
+    iov.iov_base = &reg;
+    iov.iov_len = sizeof(reg);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 2);
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    memcpy(CMSG_DATA(cmsg) + sizeof(int), &sv[1], sizeof(int));
+
+    ret = 0;
+    pthread_mutex_lock(&log_init_lock);
+    if (logd_fd < 0) {
+        ret = __write_to_log_initialize();
+    }
+    if ((ret >= 0) && (TEMP_FAILURE_RETRY(sendmsg(logd_fd, &msg, 0)) < 0)) {
+        ret = -errno;
+    }
+    pthread_mutex_unlock(&log_init_lock);
+    close(fd);
+    close(sv[1]);
+
+    /* logd acknowledges with a byte, or hangs up on us */
+    if (ret >= 0) {
+        pfd.fd = ring_doorbell;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, 1000));
+        if (ret <= 0) {
+            ret = ret ? -errno : -ETIMEDOUT;
+        } else if (TEMP_FAILURE_RETRY(recv(ring_doorbell, &c, 1,
+                                           MSG_DONTWAIT)) != 1) {
+            ret = -ECONNREFUSED;
+        } else {
+            ret = 0;
+        }
+    }
+    if (ret < 0) {
+        __write_to_log_ring_close();
+    }
+    return ret;
+}
+
+/*
+ * Copies the datagram in vec (android_log_header_t plus payload, len bytes
+ * all told) into the ring. Returns 0 if there is no ring or no room, the
+ * caller then sends it over the socket.
+ */
+static int __write_to_log_ring(struct iovec *vec, size_t nr, size_t len)
+{
+    uint32_t head, tail, size, off, skip, need;
+    uint16_t reclen;
+    char *data;
+    size_t i;
+
+    if (!__atomic_load_n(&ring, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    if (!ring || (ring_pid != getpid())) {
+        pthread_mutex_unlock(&ring_lock);
+        return 0;
+    }
+
+    size = ring_mapped - sizeof(android_log_ring_t);
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    need = sizeof(reclen) + len;
+    off = head & (size - 1);
+    skip = ((size - off) < need) ? (size - off) : 0;
+    if (((head - tail) + skip + need) > size) {
+        pthread_mutex_unlock(&ring_lock);
+        return 0;
+    }
+
+    data = (char *)(ring + 1);
+    if (skip >= sizeof(reclen)) {
+        reclen = LOGGER_RING_PAD;
+        memcpy(data + off, &reclen, sizeof(reclen));
+    }
+    off = (head + skip) & (size - 1);
+    reclen = len;
+    memcpy(data + off, &reclen, sizeof(reclen));
+    off += sizeof(reclen);
+    for (i = 0; i < nr; ++i) {
+        memcpy(data + off, vec[i].iov_base, vec[i].iov_len);
+        off += vec[i].iov_len;
+    }
+    __atomic_store_n(&ring->head, head + skip + need, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&ring->waiting, 0, __ATOMIC_SEQ_CST)) {
+        char c = 0;
+        if ((TEMP_FAILURE_RETRY(send(ring_doorbell, &c, 1,
+                                     MSG_DONTWAIT | MSG_NOSIGNAL)) < 0)
+                && (errno != EAGAIN)) {
+            /* logd is gone, and with it this record */
+            __write_to_log_ring_close();
+            pthread_mutex_unlock(&ring_lock);
+            return 0;
+        }
+    }
+
+    pthread_mutex_unlock(&ring_lock);
+    return len;
+}
+#endif
+
+int __android_log_open_ring(size_t size)
+{
+#if FAKE_LOG_DEVICE
+    (void)size;
+    return -ENOSYS;
+#else
+    size_t ring_size = LOGGER_RING_MIN;
+    int ret = 0;
+
+    if (size > LOGGER_RING_MAX) {
+        return -EINVAL;
+    }
+    while (ring_size < size) {
+        ring_size <<= 1;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    if (ring && (ring_pid != getpid())) {
+        /* inherited from our parent, the parent keeps it going */
+        munmap(ring, ring_mapped);
+        ring = NULL;
+        close(ring_doorbell);
+        ring_doorbell = -1;
+    }
+    if (!ring) {
+        ret = __write_to_log_ring_open(ring_size);
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return ret;
+#endif
+}
+
+int __android_log_set_batching(unsigned msecs)
+{
+#if FAKE_LOG_DEVICE
+    (void)msecs;
+    return -ENOSYS;
+#else
+    pthread_once(&batch_once, __write_to_log_batch_once);
+    if (!atomic_load(&batch_keyed)) {
+        return -ENOMEM;
+    }
+    atomic_store_explicit(&batch_msecs, msecs, memory_order_relaxed);
+    if (!msecs) {
+        return __android_log_flush();
+    }
+    return 0;
+#endif
+}
+
+int __android_log_flush(void)
+{
+#if (FAKE_LOG_DEVICE == 0)
+    struct log_batch *batch;
+
+    if (!atomic_load(&batch_keyed)) {
+        return 0;
+    }
+    batch = pthread_getspecific(batch_key);
+    if (batch) {
+        __write_to_log_batch_flush(batch);
+    }
+#endif
+    return 0;
+}
+
 static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
 {
     ssize_t ret;
@@ -159,7 +591,6 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
     size_t i, payload_size;
     static uid_t last_uid = AID_ROOT; /* logd *always* starts up as AID_ROOT */
     static pid_t last_pid = (pid_t) -1;
-    static atomic_int_fast32_t dropped;
 
     if (!nr) {
         return -EINVAL;
@@ -261,6 +692,12 @@ static int __write_to_log_daemon(log_id_t log_id, struct iovec *vec, size_t nr)
         return -EBADF;
     }
 
+    if (__write_to_log_ring(newVec + 1, i - 1, sizeof(header) + payload_size)
+            || __write_to_log_batch(log_id, newVec + 1, i - 1,
+                                    sizeof(header) + payload_size, &ts)) {
+        return payload_size;
+    }
+
     /*
      * The write below could be lost, but will never block.
      *
@@ -368,6 +805,9 @@ int __android_log_buf_write(int bufID, int prio, const char *tag, const char *ms
     if (!tag)
         tag = "";
 
+    if (fake_log_dropped(prio))
+        return 0;
+
     /* XXX: This needs to go! */
     if ((bufID != LOG_ID_RADIO) &&
          (!strcmp(tag, "HTC_RIL") ||
@@ -405,6 +845,9 @@ int __android_log_vprint(int prio, const char *tag, const char *fmt, va_list ap)
 {
     char buf[LOG_BUF_SIZE];
 
+    if (fake_log_dropped(prio))
+        return 0;
+
     vsnprintf(buf, LOG_BUF_SIZE, fmt, ap);
 
     return __android_log_write(prio, tag, buf);
@@ -415,6 +858,9 @@ int __android_log_print(int prio, const char *tag, const char *fmt, ...)
     va_list ap;
     char buf[LOG_BUF_SIZE];
 
+    if (fake_log_dropped(prio))
+        return 0;
+
     va_start(ap, fmt);
     vsnprintf(buf, LOG_BUF_SIZE, fmt, ap);
     va_end(ap);
@@ -427,6 +873,9 @@ int __android_log_buf_print(int bufID, int prio, const char *tag, const char *fm
     va_list ap;
     char buf[LOG_BUF_SIZE];
 
+    if (fake_log_dropped(prio))
+        return 0;
+
     va_start(ap, fmt);
     vsnprintf(buf, LOG_BUF_SIZE, fmt, ap);
     va_end(ap);
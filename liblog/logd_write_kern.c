@@ -137,6 +137,22 @@ static int __write_to_log_init(log_id_t log_id, struct iovec *vec, size_t nr)
     return write_to_log(log_id, vec, nr);
 }
 
+/* The kernel logger takes one message per write, nothing to batch */
+int __android_log_set_batching(unsigned msecs __unused)
+{
+    return -ENOSYS;
+}
+
+int __android_log_flush(void)
+{
+    return 0;
+}
+
+int __android_log_open_ring(size_t size __unused)
+{
+    return -ENOSYS;
+}
+
 int __android_log_write(int prio, const char *tag, const char *msg)
 {
     return __android_log_buf_write(LOG_ID_MAIN, prio, tag, msg);
@@ -37,6 +37,8 @@
 
 typedef struct FilterInfo_t {
     char *mTag;
+    size_t mLen;
+    uint32_t mHash;
     android_LogPriority mPri;
     struct FilterInfo_t *p_next;
 } FilterInfo;
@@ -44,10 +46,24 @@ typedef struct FilterInfo_t {
 struct AndroidLogFormat_t {
     android_LogPriority global_pri;
     FilterInfo *filters;
+    /*
+     * filters compiled for filterPriForTag(), latest rule per tag, rebuilt
+     * when a rule has been added since: an open addressed table of
+     * filter_mask + 1 slots, and a bitmap of the tag lengths it holds, bit
+     * 63 standing for 63 and up
+     */
+    FilterInfo **filter_table;
+    size_t filter_mask;
+    uint64_t filter_lengths;
+    bool filters_dirty;
     AndroidLogPrintFormat format;
     bool colored_output;
     bool usec_time_output;
     bool printable_output;
+    /* strftime() of time_sec, it changes once a second at most */
+    time_t time_sec;
+    size_t time_len;
+    char time_buf[24];
 };
 
 /*
@@ -64,12 +80,29 @@ struct AndroidLogFormat_t {
 #define ANDROID_COLOR_RED     196
 #define ANDROID_COLOR_YELLOW  226
 
+/* FNV-1a */
+static uint32_t filterHash(const char *tag, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    while (len--) {
+        hash = (hash ^ (unsigned char)*tag++) * 16777619U;
+    }
+    return hash;
+}
+
+static uint64_t filterLengthBit(size_t len)
+{
+    return 1ULL << (len < 63 ? len : 63);
+}
+
 static FilterInfo * filterinfo_new(const char * tag, android_LogPriority pri)
 {
     FilterInfo *p_ret;
 
     p_ret = (FilterInfo *)calloc(1, sizeof(FilterInfo));
     p_ret->mTag = strdup(tag);
+    p_ret->mLen = strlen(tag);
+    p_ret->mHash = filterHash(tag, p_ret->mLen);
     p_ret->mPri = pri;
 
     return p_ret;
@@ -150,25 +183,94 @@ static int colorFromPri (android_LogPriority pri)
     }
 }
 
+/*
+ * Builds filter_table from the filter list, which has the latest rule
+ * first, so only the first rule seen for a tag is kept.  On allocation
+ * failure filter_table is left NULL and the list is walked instead.
+ */
+static void filterCompile(AndroidLogFormat *p_format)
+{
+    FilterInfo *p_curFilter;
+    size_t count = 0;
+    size_t size = 16;
+
+    free(p_format->filter_table);
+    p_format->filter_table = NULL;
+    p_format->filter_mask = 0;
+    p_format->filter_lengths = 0;
+    p_format->filters_dirty = false;
+
+    for (p_curFilter = p_format->filters; p_curFilter; p_curFilter = p_curFilter->p_next) {
+        ++count;
+    }
+    /* at most half full */
+    while (size < (count * 2)) {
+        size *= 2;
+    }
+    p_format->filter_table = calloc(size, sizeof(FilterInfo *));
+    if (!p_format->filter_table) {
+        return;
+    }
+    p_format->filter_mask = size - 1;
+
+    for (p_curFilter = p_format->filters; p_curFilter; p_curFilter = p_curFilter->p_next) {
+        size_t i = p_curFilter->mHash & p_format->filter_mask;
+        FilterInfo *p_slot;
+        while ((p_slot = p_format->filter_table[i])) {
+            if ((p_slot->mHash == p_curFilter->mHash)
+                    && !strcmp(p_slot->mTag, p_curFilter->mTag)) {
+                break;
+            }
+            i = (i + 1) & p_format->filter_mask;
+        }
+        if (!p_slot) {
+            p_format->filter_table[i] = p_curFilter;
+            p_format->filter_lengths |= filterLengthBit(p_curFilter->mLen);
+        }
+    }
+}
+
 static android_LogPriority filterPriForTag(
         AndroidLogFormat *p_format, const char *tag)
 {
-    FilterInfo *p_curFilter;
+    FilterInfo *p_curFilter = NULL;
 
-    for (p_curFilter = p_format->filters
-            ; p_curFilter != NULL
-            ; p_curFilter = p_curFilter->p_next
-    ) {
-        if (0 == strcmp(tag, p_curFilter->mTag)) {
-            if (p_curFilter->mPri == ANDROID_LOG_DEFAULT) {
-                return p_format->global_pri;
-            } else {
-                return p_curFilter->mPri;
+    if (!p_format->filters) {
+        return p_format->global_pri;
+    }
+    if (p_format->filters_dirty) {
+        filterCompile(p_format);
+    }
+
+    if (p_format->filter_table) {
+        size_t len = strlen(tag);
+        if (!(p_format->filter_lengths & filterLengthBit(len))) {
+            return p_format->global_pri;
+        }
+        uint32_t hash = filterHash(tag, len);
+        size_t i = hash & p_format->filter_mask;
+        while ((p_curFilter = p_format->filter_table[i])) {
+            if ((p_curFilter->mHash == hash) && (p_curFilter->mLen == len)
+                    && !memcmp(tag, p_curFilter->mTag, len)) {
+                break;
+            }
+            i = (i + 1) & p_format->filter_mask;
+        }
+    } else {
+        for (p_curFilter = p_format->filters
+                ; p_curFilter != NULL
+                ; p_curFilter = p_curFilter->p_next
+        ) {
+            if (0 == strcmp(tag, p_curFilter->mTag)) {
+                break;
             }
         }
     }
 
-    return p_format->global_pri;
+    if (!p_curFilter || (p_curFilter->mPri == ANDROID_LOG_DEFAULT)) {
+        return p_format->global_pri;
+    }
+    return p_curFilter->mPri;
 }
 
 /**
@@ -206,9 +308,11 @@ void android_log_format_free(AndroidLogFormat *p_format)
         p_info_old = p_info;
         p_info = p_info->p_next;
 
+        free(p_info_old->mTag);
         free(p_info_old);
     }
 
+    free(p_format->filter_table);
     free(p_format);
 }
 
@@ -325,6 +429,7 @@ int android_log_addFilterRule(AndroidLogFormat *p_format,
 
         p_fi->p_next = p_format->filters;
         p_format->filters = p_fi;
+        p_format->filters_dirty = true;
     }
 
     return 0;
@@ -466,9 +571,38 @@ static inline uint64_t get8LE(const uint8_t* src)
 
 
 /*
- * Recursively convert binary log data to printable form.
+ * Format a signed 64-bit value in decimal, without the cost of snprintf.
+ * buf must hold at least 21 bytes; returns the length, no NUL is added.
+ */
+static size_t formatEventInteger(char* buf, int64_t val)
+{
+    char digits[20];
+    size_t len = 0, n = 0;
+    uint64_t mag = (val < 0) ? -(uint64_t) val : (uint64_t) val;
+
+    do {
+        digits[n++] = '0' + (mag % 10);
+        mag /= 10;
+    } while (mag);
+
+    if (val < 0)
+        buf[len++] = '-';
+    while (n)
+        buf[len++] = digits[--n];
+    return len;
+}
+
+/*
+ * Deepest nesting of lists we will follow.  The largest event payload could
+ * nest further, but nothing real comes close.
+ */
+#define MAX_EVENT_LIST_DEPTH 64
+
+/*
+ * Convert binary log data to printable form.
  *
- * This needs to be recursive because you can have lists of lists.
+ * Lists of lists are followed with an explicit stack of the items left at
+ * each level, rather than by recursion.
  *
  * If we run out of room, we stop processing immediately.  It's important
  * for us to check for space on every output element to avoid producing
@@ -483,156 +617,161 @@ static int android_log_printBinaryEvent(const unsigned char** pEventData,
     size_t eventDataLen = *pEventDataLen;
     char* outBuf = *pOutBuf;
     size_t outBufLen = *pOutBufLen;
+    unsigned char remaining[MAX_EVENT_LIST_DEPTH];
+    int depth = 0;
     unsigned char type;
+    char numBuf[32];
     size_t outCount;
     int result = 0;
 
-    if (eventDataLen < 1)
-        return -1;
-    type = *eventData++;
-    eventDataLen--;
-
-    switch (type) {
-    case EVENT_TYPE_INT:
-        /* 32-bit signed int */
-        {
-            int ival;
+    for (;;) {
+        if (eventDataLen < 1)
+            return -1;
+        type = *eventData++;
+        eventDataLen--;
 
+        switch (type) {
+        case EVENT_TYPE_INT:
+            /* 32-bit signed int */
             if (eventDataLen < 4)
                 return -1;
-            ival = get4LE(eventData);
+            outCount = formatEventInteger(numBuf, (int32_t) get4LE(eventData));
             eventData += 4;
             eventDataLen -= 4;
-
-            outCount = snprintf(outBuf, outBufLen, "%d", ival);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
-                /* halt output */
-                goto no_room;
-            }
-        }
-        break;
-    case EVENT_TYPE_LONG:
-        /* 64-bit signed long */
-        {
-            uint64_t lval;
-
+            goto copy_number;
+        case EVENT_TYPE_LONG:
+            /* 64-bit signed long */
             if (eventDataLen < 8)
                 return -1;
-            lval = get8LE(eventData);
+            outCount = formatEventInteger(numBuf, (int64_t) get8LE(eventData));
             eventData += 8;
             eventDataLen -= 8;
-
-            outCount = snprintf(outBuf, outBufLen, "%" PRId64, lval);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
-                /* halt output */
-                goto no_room;
+            goto copy_number;
+        case EVENT_TYPE_FLOAT:
+            /* float */
+            {
+                uint32_t ival;
+                float fval;
+
+                if (eventDataLen < 4)
+                    return -1;
+                ival = get4LE(eventData);
+                memcpy(&fval, &ival, sizeof(fval));
+                eventData += 4;
+                eventDataLen -= 4;
+
+                outCount = snprintf(numBuf, sizeof(numBuf), "%f", fval);
+                if (outCount >= sizeof(numBuf)) {
+                    /* huge values are rare enough to format in place */
+                    outCount = snprintf(outBuf, outBufLen, "%f", fval);
+                    if (outCount >= outBufLen)
+                        goto no_room;
+                    outBuf += outCount;
+                    outBufLen -= outCount;
+                    break;
+                }
             }
-        }
-        break;
-    case EVENT_TYPE_FLOAT:
-        /* float */
-        {
-            uint32_t ival;
-            float fval;
-
-            if (eventDataLen < 4)
-                return -1;
-            ival = get4LE(eventData);
-            fval = *(float*)&ival;
-            eventData += 4;
-            eventDataLen -= 4;
-
-            outCount = snprintf(outBuf, outBufLen, "%f", fval);
-            if (outCount < outBufLen) {
-                outBuf += outCount;
-                outBufLen -= outCount;
-            } else {
+        copy_number:
+            if (outCount >= outBufLen) {
                 /* halt output */
                 goto no_room;
             }
-        }
-        break;
-    case EVENT_TYPE_STRING:
-        /* UTF-8 chars, not NULL-terminated */
-        {
-            unsigned int strLen;
-
-            if (eventDataLen < 4)
-                return -1;
-            strLen = get4LE(eventData);
-            eventData += 4;
-            eventDataLen -= 4;
-
-            if (eventDataLen < strLen)
-                return -1;
-
-            if (strLen < outBufLen) {
-                memcpy(outBuf, eventData, strLen);
-                outBuf += strLen;
-                outBufLen -= strLen;
-            } else if (outBufLen > 0) {
-                /* copy what we can */
-                memcpy(outBuf, eventData, outBufLen);
-                outBuf += outBufLen;
-                outBufLen -= outBufLen;
-                goto no_room;
+            memcpy(outBuf, numBuf, outCount);
+            outBuf += outCount;
+            outBufLen -= outCount;
+            break;
+        case EVENT_TYPE_STRING:
+            /* UTF-8 chars, not NULL-terminated */
+            {
+                unsigned int strLen;
+
+                if (eventDataLen < 4)
+                    return -1;
+                strLen = get4LE(eventData);
+                eventData += 4;
+                eventDataLen -= 4;
+
+                if (eventDataLen < strLen)
+                    return -1;
+
+                if (strLen < outBufLen) {
+                    memcpy(outBuf, eventData, strLen);
+                    outBuf += strLen;
+                    outBufLen -= strLen;
+                } else if (outBufLen > 0) {
+                    /* copy what we can */
+                    memcpy(outBuf, eventData, outBufLen);
+                    outBuf += outBufLen;
+                    outBufLen -= outBufLen;
+                    goto no_room;
+                }
+                eventData += strLen;
+                eventDataLen -= strLen;
             }
-            eventData += strLen;
-            eventDataLen -= strLen;
             break;
-        }
-    case EVENT_TYPE_LIST:
-        /* N items, all different types */
-        {
-            unsigned char count;
-            int i;
-
-            if (eventDataLen < 1)
-                return -1;
+        case EVENT_TYPE_LIST:
+            /* N items, all different types */
+            {
+                unsigned char count;
+
+                if (eventDataLen < 1)
+                    return -1;
+
+                count = *eventData++;
+                eventDataLen--;
+
+                if (outBufLen > 0) {
+                    *outBuf++ = '[';
+                    outBufLen--;
+                } else {
+                    goto no_room;
+                }
 
-            count = *eventData++;
-            eventDataLen--;
+                if (count > 0) {
+                    if (depth == MAX_EVENT_LIST_DEPTH) {
+                        fprintf(stderr, "Binary event lists nested too deep\n");
+                        return -1;
+                    }
+                    /* the next value is the list's first item */
+                    remaining[depth++] = count;
+                    continue;
+                }
 
-            if (outBufLen > 0) {
-                *outBuf++ = '[';
-                outBufLen--;
-            } else {
-                goto no_room;
+                if (outBufLen > 0) {
+                    *outBuf++ = ']';
+                    outBufLen--;
+                } else {
+                    goto no_room;
+                }
             }
+            break;
+        default:
+            fprintf(stderr, "Unknown binary event type %d\n", type);
+            return -1;
+        }
 
-            for (i = 0; i < count; i++) {
-                result = android_log_printBinaryEvent(&eventData, &eventDataLen,
-                        &outBuf, &outBufLen);
-                if (result != 0)
-                    goto bail;
-
-                if (i < count-1) {
-                    if (outBufLen > 0) {
-                        *outBuf++ = ',';
-                        outBufLen--;
-                    } else {
-                        goto no_room;
-                    }
+        /* A value is done: separate it from the next item of its list, or
+         * close the lists it ends. */
+        while (depth > 0) {
+            if (--remaining[depth - 1] > 0) {
+                if (outBufLen > 0) {
+                    *outBuf++ = ',';
+                    outBufLen--;
+                } else {
+                    goto no_room;
                 }
+                break;
             }
-
             if (outBufLen > 0) {
                 *outBuf++ = ']';
                 outBufLen--;
             } else {
                 goto no_room;
             }
+            depth--;
         }
-        break;
-    default:
-        fprintf(stderr, "Unknown binary event type %d\n", type);
-        return -1;
+        if (depth == 0)
+            break;
     }
 
 bail:
@@ -808,6 +947,37 @@ WEAK ssize_t utf8_character_length(const char *src, size_t len)
     return num_to_read;
 }
 
+/*
+ * Length of the leading run of bytes convertPrintable() passes through as is,
+ * ' ' through DEL other than '\\'. Nearly all messages are plain ASCII, so
+ * check a word at a time for any byte that is not.
+ */
+static size_t plainLength(const char *message, size_t len)
+{
+    static const uint64_t ones = 0x0101010101010101ULL;
+    static const uint64_t highs = 0x8080808080808080ULL;
+    size_t i = 0;
+
+    while ((len - i) >= sizeof(uint64_t)) {
+        uint64_t v, b;
+        memcpy(&v, message + i, sizeof(v));
+        b = v ^ (ones * '\\');
+        /* high bit set, or less than ' ', or '\\' */
+        if ((v | ((v - ones * ' ') & ~v) | ((b - ones) & ~b)) & highs) {
+            break;
+        }
+        i += sizeof(v);
+    }
+    while (i < len) {
+        unsigned char c = message[i];
+        if ((c < ' ') || (c & 0x80) || (c == '\\')) {
+            break;
+        }
+        ++i;
+    }
+    return i;
+}
+
 /*
  * Convert to printable from message to p buffer, return string length. If p is
  * NULL, do not copy, but still return the expected string length.
@@ -818,6 +988,17 @@ static size_t convertPrintable(char *p, const char *message, size_t messageLen)
     bool print = p != NULL;
 
     while (messageLen) {
+        size_t plain = plainLength(message, messageLen);
+        if (plain) {
+            if (print) {
+                memcpy(p, message, plain);
+            }
+            p += plain;
+            message += plain;
+            messageLen -= plain;
+            continue;
+        }
+
         char buf[6];
         ssize_t len = sizeof(buf) - 1;
         if ((size_t)len > messageLen) {
@@ -865,9 +1046,114 @@ static size_t convertPrintable(char *p, const char *message, size_t messageLen)
         message += len;
         messageLen -= len;
     }
+    if (print) {
+        *p = '\0';
+    }
     return p - begin;
 }
 
+/*
+ * Formats value right justified in width columns, as "%*d" would.
+ */
+static char *formatDecimal(char *p, int value, size_t width)
+{
+    char digits[12];
+    char *d = digits + sizeof(digits);
+    unsigned int v = (value < 0) ? -(unsigned int)value : (unsigned int)value;
+    size_t len;
+
+    do {
+        *--d = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0) {
+        *--d = '-';
+    }
+    len = digits + sizeof(digits) - d;
+    for (; width > len; --width) {
+        *p++ = ' ';
+    }
+    memcpy(p, d, len);
+    return p + len;
+}
+
+/*
+ * Formats the len bytes of str left justified in width columns, as "%-*s"
+ * would.
+ */
+static char *formatString(char *p, const char *str, size_t len, size_t width)
+{
+    memcpy(p, str, len);
+    p += len;
+    for (; width > len; --width) {
+        *p++ = ' ';
+    }
+    return p;
+}
+
+/*
+ * Formats the time stamp of entry into timeBuf, returns its length. Lines
+ * arrive in bursts sharing the same second, so the localtime() and
+ * strftime() of the last second formatted are kept in p_format.
+ */
+static size_t formatTime(AndroidLogFormat *p_format,
+                         const AndroidLogEntry *entry, char *timeBuf,
+                         size_t timeBufSize)
+{
+    size_t len;
+    long frac, limit;
+    int digits;
+
+    if (!p_format->time_len || (p_format->time_sec != entry->tv_sec)) {
+#if !defined(_WIN32)
+        struct tm tmBuf;
+        struct tm* ptm = localtime_r(&(entry->tv_sec), &tmBuf);
+#else
+        struct tm* ptm = localtime(&(entry->tv_sec));
+#endif
+        /*
+         * It's often useful when examining a log with "less" to jump to
+         * a specific point in the file by searching for the date/time stamp.
+         * For this reason it's very annoying to have regexp meta characters
+         * in the time stamp.  Don't use forward slashes, parenthesis,
+         * brackets, asterisks, or other special chars here.
+         */
+        /* strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm); */
+        p_format->time_len = ptm ? strftime(p_format->time_buf,
+                                            sizeof(p_format->time_buf),
+                                            "%m-%d %H:%M:%S", ptm)
+                                 : 0;
+        p_format->time_sec = entry->tv_sec;
+    }
+    len = p_format->time_len;
+    memcpy(timeBuf, p_format->time_buf, len);
+
+    if (p_format->usec_time_output) {
+        frac = entry->tv_nsec / 1000;
+        limit = 1000000;
+        digits = 6;
+    } else {
+        frac = entry->tv_nsec / 1000000;
+        limit = 1000;
+        digits = 3;
+    }
+    if ((frac < 0) || (frac >= limit)) {
+        snprintf(timeBuf + len, timeBufSize - len, ".%0*ld", digits, frac);
+        return len + strlen(timeBuf + len);
+    }
+    timeBuf[len++] = '.';
+    for (int i = digits; i > 0; --i) {
+        timeBuf[len + i - 1] = '0' + (frac % 10);
+        frac /= 10;
+    }
+    len += digits;
+    timeBuf[len] = '\0';
+    return len;
+}
+
+/* Longest tag the hand formatted prefixes take, the rest go to snprintf() */
+#define FAST_TAG_MAX 48
+
 /**
  * Formats a log message into a buffer
  *
@@ -883,10 +1169,6 @@ char *android_log_formatLogLine (
     const AndroidLogEntry *entry,
     size_t *p_outLength)
 {
-#if !defined(_WIN32)
-    struct tm tmBuf;
-#endif
-    struct tm* ptm;
     char timeBuf[32]; /* good margin, 23+nul for msec, 26+nul for usec */
     char prefixBuf[128], suffixBuf[128];
     char priChar;
@@ -896,30 +1178,18 @@ char *android_log_formatLogLine (
     priChar = filterPriToChar(entry->priority);
     size_t prefixLen = 0, suffixLen = 0;
     size_t len;
+    size_t tagLen = strlen(entry->tag);
 
-    /*
-     * Get the current date/time in pretty form
-     *
-     * It's often useful when examining a log with "less" to jump to
-     * a specific point in the file by searching for the date/time stamp.
-     * For this reason it's very annoying to have regexp meta characters
-     * in the time stamp.  Don't use forward slashes, parenthesis,
-     * brackets, asterisks, or other special chars here.
-     */
-#if !defined(_WIN32)
-    ptm = localtime_r(&(entry->tv_sec), &tmBuf);
-#else
-    ptm = localtime(&(entry->tv_sec));
-#endif
-    /* strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm); */
-    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
-    len = strlen(timeBuf);
-    if (p_format->usec_time_output) {
-        snprintf(timeBuf + len, sizeof(timeBuf) - len,
-                 ".%06ld", entry->tv_nsec / 1000);
-    } else {
-        snprintf(timeBuf + len, sizeof(timeBuf) - len,
-                 ".%03ld", entry->tv_nsec / 1000000);
+    /* Get the current date/time in pretty form, for the formats with it */
+    switch (p_format->format) {
+        case FORMAT_TIME:
+        case FORMAT_THREADTIME:
+        case FORMAT_LONG:
+            formatTime(p_format, entry, timeBuf, sizeof(timeBuf));
+            break;
+        default:
+            timeBuf[0] = '\0';
+            break;
     }
 
     /*
@@ -933,6 +1203,57 @@ char *android_log_formatLogLine (
         suffixLen = MIN(suffixLen, sizeof(suffixBuf));
     }
 
+    /*
+     * The common formats are put together by hand rather than through
+     * snprintf() when the tag is short enough for the prefix to fit.
+     */
+    if (tagLen <= FAST_TAG_MAX) {
+        char *p = prefixBuf + prefixLen;
+
+        switch (p_format->format) {
+            case FORMAT_THREADTIME:
+                len = strlen(timeBuf);
+                memcpy(p, timeBuf, len);
+                p += len;
+                *p++ = ' ';
+                p = formatDecimal(p, entry->pid, 5);
+                *p++ = ' ';
+                p = formatDecimal(p, entry->tid, 5);
+                *p++ = ' ';
+                *p++ = priChar;
+                *p++ = ' ';
+                p = formatString(p, entry->tag, tagLen, 8);
+                *p++ = ':';
+                *p++ = ' ';
+                break;
+            case FORMAT_TIME:
+                len = strlen(timeBuf);
+                memcpy(p, timeBuf, len);
+                p += len;
+                *p++ = ' ';
+                /* FALLTHRU */
+            case FORMAT_BRIEF:
+                *p++ = priChar;
+                *p++ = '/';
+                p = formatString(p, entry->tag, tagLen, 8);
+                *p++ = '(';
+                p = formatDecimal(p, entry->pid, 5);
+                *p++ = ')';
+                *p++ = ':';
+                *p++ = ' ';
+                break;
+            default:
+                break;
+        }
+        if (p != (prefixBuf + prefixLen)) {
+            *p = '\0';
+            prefixLen = p - prefixBuf;
+            suffixBuf[suffixLen++] = '\n';
+            suffixBuf[suffixLen] = '\0';
+            goto formatted;
+        }
+    }
+
     switch (p_format->format) {
         case FORMAT_TAG:
             len = snprintf(prefixBuf + prefixLen, sizeof(prefixBuf) - prefixLen,
@@ -995,8 +1316,10 @@ char *android_log_formatLogLine (
      * possibly causing heap corruption.  To avoid this we double check and
      * set the length at the maximum (size minus null byte)
      */
-    prefixLen += MIN(len, sizeof(prefixBuf) - prefixLen);
-    suffixLen = MIN(suffixLen, sizeof(suffixBuf));
+    prefixLen += MIN(len, sizeof(prefixBuf) - prefixLen - 1);
+    suffixLen = MIN(suffixLen, sizeof(suffixBuf) - 1);
+
+formatted:
 
     /* the following code is tragically unreadable */
 
@@ -1016,9 +1339,13 @@ char *android_log_formatLogLine (
          * The line-end finding here must match the line-end finding
          * in for ( ... numLines...) loop below
          */
-        while (pm < (entry->message + entry->messageLen)) {
-            if (*pm++ == '\n') numLines++;
+        while ((pm < (entry->message + entry->messageLen))
+                && (pm = memchr(pm, '\n',
+                                entry->message + entry->messageLen - pm))) {
+            pm++;
+            numLines++;
         }
+        pm = entry->message + entry->messageLen;
         /* plus one line for anything not newline-terminated at the end */
         if (pm > entry->message && *(pm-1) != '\n') numLines++;
     }
@@ -1045,21 +1372,19 @@ char *android_log_formatLogLine (
         }
     }
 
-    ret[0] = '\0';       /* to start strcat off */
-
     p = ret;
     pm = entry->message;
 
     if (prefixSuffixIsHeaderFooter) {
-        strcat(p, prefixBuf);
+        memcpy(p, prefixBuf, prefixLen);
         p += prefixLen;
         if (p_format->printable_output) {
             p += convertPrintable(p, entry->message, entry->messageLen);
         } else {
-            strncat(p, entry->message, entry->messageLen);
+            memcpy(p, entry->message, entry->messageLen);
             p += entry->messageLen;
         }
-        strcat(p, suffixBuf);
+        memcpy(p, suffixBuf, suffixLen);
         p += suffixLen;
     } else {
         while(pm < (entry->message + entry->messageLen)) {
@@ -1068,24 +1393,28 @@ char *android_log_formatLogLine (
             lineStart = pm;
 
             /* Find the next end-of-line in message */
-            while (pm < (entry->message + entry->messageLen)
-                    && *pm != '\n') pm++;
+            pm = memchr(lineStart, '\n',
+                        entry->message + entry->messageLen - lineStart);
+            if (!pm) {
+                pm = entry->message + entry->messageLen;
+            }
             lineLen = pm - lineStart;
 
-            strcat(p, prefixBuf);
+            memcpy(p, prefixBuf, prefixLen);
             p += prefixLen;
             if (p_format->printable_output) {
                 p += convertPrintable(p, lineStart, lineLen);
             } else {
-                strncat(p, lineStart, lineLen);
+                memcpy(p, lineStart, lineLen);
                 p += lineLen;
             }
-            strcat(p, suffixBuf);
+            memcpy(p, suffixBuf, suffixLen);
             p += suffixLen;
 
-            if (*pm == '\n') pm++;
+            if (pm < (entry->message + entry->messageLen)) pm++;
         }
     }
+    *p = '\0';
 
     if (p_outLength != NULL) {
         *p_outLength = p - ret;
@@ -1106,7 +1435,7 @@ int android_log_printLogLine(
     const AndroidLogEntry *entry)
 {
     int ret;
-    char defaultBuffer[512];
+    char defaultBuffer[LOGGER_ENTRY_MAX_LEN + 256];
     char *outBuffer = NULL;
     size_t totalLen;
 
@@ -691,6 +691,43 @@ TEST(liblog, filterRule) {
     android_log_format_free(p_format);
 }
 
+TEST(liblog, filterRule_many) {
+    AndroidLogFormat *p_format = android_log_format_new();
+    char rule[96];
+
+    EXPECT_TRUE(android_log_addFilterString(p_format, "*:w") == 0);
+    for (int i = 0; i < 200; ++i) {
+        snprintf(rule, sizeof(rule), "tag%d:%c", i, (i & 1) ? 'v' : 'e');
+        EXPECT_TRUE(android_log_addFilterRule(p_format, rule) == 0);
+    }
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0", ANDROID_LOG_ERROR));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag199", ANDROID_LOG_VERBOSE));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag200", ANDROID_LOG_WARN));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag1x", ANDROID_LOG_WARN));
+    EXPECT_TRUE(checkPriForTag(p_format, "", ANDROID_LOG_WARN));
+
+    // the latest rule for a tag wins
+    EXPECT_TRUE(android_log_addFilterRule(p_format, "tag0:i") == 0);
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0", ANDROID_LOG_INFO));
+
+    // as does the latest global priority
+    EXPECT_TRUE(android_log_addFilterRule(p_format, "*:e") == 0);
+    EXPECT_TRUE(checkPriForTag(p_format, "tag200", ANDROID_LOG_ERROR));
+    EXPECT_TRUE(checkPriForTag(p_format, "tag0", ANDROID_LOG_INFO));
+
+    // long tags share a length bucket
+    static const char longTag[] =
+        "a_tag_that_is_longer_than_sixty_three_characters_to_share_a_bucket";
+    snprintf(rule, sizeof(rule), "%s:d", longTag);
+    EXPECT_TRUE(android_log_addFilterRule(p_format, rule) == 0);
+    EXPECT_TRUE(checkPriForTag(p_format, longTag, ANDROID_LOG_DEBUG));
+    EXPECT_TRUE(checkPriForTag(p_format,
+        "a_tag_that_is_longer_than_sixty_three_characters_to_share_a_bucket_too",
+        ANDROID_LOG_ERROR));
+
+    android_log_format_free(p_format);
+}
+
 TEST(liblog, is_loggable) {
     static const char tag[] = "is_loggable";
     static const char log_namespace[] = "persist.log.tag.";
@@ -30,6 +30,9 @@
 
 static const memtrack_module_t *module;
 
+/* Types the HAL answered -ENODEV for; it is not asked about them again. */
+static unsigned int unsupported_types;
+
 struct memtrack_proc {
     pid_t pid;
     struct memtrack_proc_type {
@@ -83,23 +86,40 @@ void memtrack_proc_destroy(struct memtrack_proc *p)
 static int memtrack_proc_get_type(struct memtrack_proc_type *t,
             pid_t pid, enum memtrack_type type)
 {
-    size_t num_records = t->num_records;
+    size_t num_records;
     int ret;
 
+    if (__atomic_load_n(&unsupported_types, __ATOMIC_RELAXED) & (1U << type)) {
+        t->num_records = 0;
+        return -ENODEV;
+    }
+
 retry:
+    /* offer all of the buffer, a handle is reused across processes */
+    num_records = t->allocated_records;
     ret = module->getMemory(module, pid, type, t->records, &num_records);
     if (ret) {
+        if (ret == -ENODEV) {
+            __atomic_fetch_or(&unsupported_types, 1U << type, __ATOMIC_RELAXED);
+        }
         t->num_records = 0;
         return ret;
     }
     if (num_records > t->allocated_records) {
-        /* Need more records than allocated */
+        /* Need more records than allocated; leave room to grow, so that
+         * the next process does not need a second call either */
+        size_t allocated = t->allocated_records * 2;
+        if (allocated < num_records) {
+            allocated = num_records;
+        }
         free(t->records);
-        t->records = calloc(sizeof(*t->records), num_records);
+        t->records = calloc(sizeof(*t->records), allocated);
         if (!t->records) {
+            t->allocated_records = 0;
+            t->num_records = 0;
             return -ENOMEM;
         }
-        t->allocated_records = num_records;
+        t->allocated_records = allocated;
         goto retry;
     }
     t->num_records = num_records;
@@ -140,6 +160,34 @@ int memtrack_proc_get(struct memtrack_proc *p, pid_t pid)
     return memtrack_proc_sanity_check(p);
 }
 
+int memtrack_proc_get_batch(struct memtrack_proc **procs, const pid_t *pids,
+            size_t count, int *results)
+{
+    size_t i;
+    int ret;
+    int ok = 0;
+
+    if (!module) {
+        return -EINVAL;
+    }
+
+    if (!procs || !pids) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < count; i++) {
+        ret = memtrack_proc_get(procs[i], pids[i]);
+        if (results) {
+            results[i] = ret;
+        }
+        if (!ret) {
+            ok++;
+        }
+    }
+
+    return ok;
+}
+
 static ssize_t memtrack_proc_sum(struct memtrack_proc *p,
             enum memtrack_type types[], size_t num_types,
             unsigned int flags)
@@ -76,7 +76,8 @@ int main(int argc, char *argv[])
     pm_kernel_t *ker;
     size_t num_procs;
     pid_t *pids;
-    struct memtrack_proc *p;
+    struct memtrack_proc **procs;
+    int *results;
     size_t i;
 
     (void)argc;
@@ -101,14 +102,29 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    p = memtrack_proc_new();
-    if (ret) {
-        fprintf(stderr, "failed to create memtrack process handle\n");
+    procs = calloc(num_procs, sizeof(*procs));
+    results = calloc(num_procs, sizeof(*results));
+    if (!procs || !results) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_procs; i++) {
+        procs[i] = memtrack_proc_new();
+        if (!procs[i]) {
+            fprintf(stderr, "failed to create memtrack process handle\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ret = memtrack_proc_get_batch(procs, pids, num_procs, results);
+    if (ret < 0) {
+        fprintf(stderr, "failed to get memory info: %s (%d)\n", strerror(-ret), ret);
         exit(EXIT_FAILURE);
     }
 
     for (i = 0; i < num_procs; i++) {
         pid_t pid = pids[i];
+        struct memtrack_proc *p = procs[i];
         char cmdline[256];
         size_t v1;
         size_t v2;
@@ -119,7 +135,7 @@ int main(int argc, char *argv[])
 
         getprocname(pid, cmdline, (int)sizeof(cmdline));
 
-        ret = memtrack_proc_get(p, pid);
+        ret = results[i];
         if (ret) {
             fprintf(stderr, "failed to get memory info for pid %d: %s (%d)\n",
                     pid, strerror(-ret), ret);
@@ -139,7 +155,11 @@ int main(int argc, char *argv[])
         }
     }
 
-    memtrack_proc_destroy(p);
+    for (i = 0; i < num_procs; i++) {
+        memtrack_proc_destroy(procs[i]);
+    }
+    free(procs);
+    free(results);
 
     return 0;
 }
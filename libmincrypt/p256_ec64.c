@@ -0,0 +1,500 @@
+/*
+ * Copyright 2015 The Android Open Source Project
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Google Inc. nor the names of its contributors may
+ *       be used to endorse or promote products derived from this software
+ *       without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A faster p256_points_mul_vartime() for 64-bit targets, used by
+// p256_ecdsa_verify().  The field elements are four 64-bit limbs in
+// Montgomery form with R = 2**256, multiplied with 128-bit products, instead
+// of the nine 28/29-bit limbs of p256_ec.c.  The scalar multiplication is a
+// variable-time interleaved wNAF over a precomputed table for the base point,
+// which is fine for the same reason as in p256_ec.c: signature verification
+// deals with no secrets.  The constant-time functions stay in p256_ec.c.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mincrypt/p256.h"
+
+#if defined(__LP64__) && defined(__SIZEOF_INT128__)
+
+typedef uint64_t u64;
+typedef unsigned __int128 u128;
+
+/* A field element, x[0] + x[1] * 2**64 + x[2] * 2**128 + x[3] * 2**192, fully
+ * reduced mod p and stored as (y * R) mod p for the value y. */
+typedef u64 fe[4];
+
+typedef struct {
+  fe x, y, z;  /* Jacobian; the point at infinity has z == 0. */
+} jacobian;
+
+typedef struct {
+  fe x, y;
+} affine;
+
+static const fe kZero = {0};
+static const fe kP = {
+    0xffffffffffffffff, 0x00000000ffffffff, 0, 0xffffffff00000001
+};
+/* R mod p, i.e. 1 in Montgomery form. */
+static const fe kOne = {
+    0x0000000000000001, 0xffffffff00000000, 0xffffffffffffffff, 0x00000000fffffffe
+};
+/* R**2 mod p, for converting into Montgomery form. */
+static const fe kRR = {
+    0x0000000000000003, 0xfffffffbffffffff, 0xfffffffffffffffe, 0x00000004fffffffd
+};
+
+/* Window widths of the wNAF digits of the two scalars. */
+#define BASE_WINDOW 7
+#define POINT_WINDOW 5
+
+/* kBaseTable[i] is (2i + 1)G, i.e. G, 3G, ... 63G, for the base point
+ * digits. */
+static const affine kBaseTable[1 << (BASE_WINDOW - 2)] = {
+    {{0x79e730d418a9143c, 0x75ba95fc5fedb601, 0x79fb732b77622510, 0x18905f76a53755c6},
+     {0xddf25357ce95560a, 0x8b4ab8e4ba19e45c, 0xd2e88688dd21f325, 0x8571ff1825885d85}},
+    {{0xffac3f904eebc127, 0xb027f84a087d81fb, 0x66ad77dd87cbbc98, 0x26936a3fb6ff747e},
+     {0xb04c5c1fc983a7eb, 0x583e47ad0861fe1a, 0x788208311a2ee98e, 0xd5f06a29e587cc07}},
+    {{0xbe1b8aaec45c61f5, 0x90ec649a94b9537d, 0x941cb5aad076c20c, 0xc9079605890523c8},
+     {0xeb309b4ae7ba4f10, 0x73c568efe5eb882b, 0x3540a9877e7a1f68, 0x73a076bb2dd1e916}},
+    {{0x0746354ea0173b4f, 0x2bd20213d23c00f7, 0xf43eaab50c23bb08, 0x13ba5119c3123e03},
+     {0x2847d0303f5b9d4d, 0x6742f2f25da67bdd, 0xef933bdc77c94195, 0xeaedd9156e240867}},
+    {{0x75c96e8f264e20e8, 0xabe6bfed59a7a841, 0x2cc09c0444c8eb00, 0xe05b3080f0c4e16b},
+     {0x1eb7777aa45f3314, 0x56af7bedce5d45e3, 0x2b6e019a88b12f1a, 0x086659cdfd835f9b}},
+    {{0xea7d260a6245e404, 0x9de407956e7fdfe0, 0x1ff3a4158dac1ab5, 0x3e7090f1649c9073},
+     {0x1a7685612b944e88, 0x250f939ee57f61c8, 0x0c0daa891ead643d, 0x68930023e125b88e}},
+    {{0xccc425634b2ed709, 0x0e356769856fd30d, 0xbcbcd43f559e9811, 0x738477ac5395b759},
+     {0x35752b90c00ee17f, 0x68748390742ed2e3, 0x7cd06422bd1f5bc1, 0xfbc08769c9e7b797}},
+    {{0x72bcd8b7bc60055b, 0x03cc23ee56e27e4b, 0xee337424e4819370, 0xe2aa0e430ad3da09},
+     {0x40b8524f6383c45d, 0xd766355442a41b25, 0x64efa6de778a4797, 0x2042170a7079adf4}},
+    {{0x97091dcbd53c5c9d, 0xf17624b6ac0a177b, 0xb0f139752cfe2dff, 0xc1a35c0a6c7a574e},
+     {0x227d314693e79987, 0x0575bf30e89cb80e, 0x2f4e247f0d1883bb, 0xebd512263274c3d0}},
+    {{0xfea912baa5659ae8, 0x68363aba25e1a16e, 0xb8842277752c41ac, 0xfe545c282897c3fc},
+     {0x2d36e9e7dc4c696b, 0x5806244afba977c5, 0x85665e9be39508c1, 0xf720ee256d12597b}},
+    {{0x562e4cecc135b208, 0x74e1b2654783f47d, 0x6d2a506c5a3f3b30, 0xecead9f4c16762fc},
+     {0xf29dd4b2e286e5b9, 0x1b0fadc083bb3c61, 0x7a75023e7fac29a4, 0xc086d5f1c9477fa3}},
+    {{0xf4f876532de45068, 0x37c7a7e89e2e1f6e, 0xd0825fa2a3584069, 0xaf2cea7c1727bf42},
+     {0x0360a4fb9e4785a9, 0xe5fda49c27299f4a, 0x48068e1371ac2f71, 0x83d0687b9077666f}},
+    {{0xa4a319acd837879f, 0x6fc1b49eed6b67b0, 0xe395993332f1f3af, 0x966742eb65432a2e},
+     {0x4b8dc9feb4966228, 0x96cc631243f43950, 0x12068859c9b731ee, 0x7b948dc356f79968}},
+    {{0x042c2af497e2feb4, 0xd36a42d7aebf7313, 0x49d2c9eb084ffdd7, 0x9f8aa54b2ef7c76a},
+     {0x9200b7ba09895e70, 0x3bd0c66fddb7fb58, 0x2d97d10878eb4cbb, 0x2d431068d84bde31}},
+    {{0x5e5db46acb66e132, 0xf1be963a0d925880, 0x944a70270317b9e2, 0xe266f95948603d48},
+     {0x98db66735c208899, 0x90472447a2fb18a3, 0x8a966939777c619f, 0x3798142a2a3be21b}},
+    {{0xe2f73c696755ff89, 0xdd3cf7e7473017e6, 0x8ef5689d3cf7600d, 0x948dc4f8b1fc87b4},
+     {0xd9e9fe814ea53299, 0x2d921ca298eb6028, 0xfaecedfd0c9803fc, 0xf38ae8914d7b4745}},
+    {{0x871514560f664534, 0x85ceae7c4b68f103, 0xac09c4ae65578ab9, 0x33ec6868f044b10c},
+     {0x6ac4832b3a8ec1f1, 0x5509d1285847d5ef, 0xf909604f763f1574, 0xb16c4303c32f63c4}},
+    {{0xfd16847fdec67ef5, 0x742ee464233e76b7, 0x0b8e4134efc2b4c8, 0xca640b8642a3e521},
+     {0x653a01908ceb6aa9, 0x313c300c547852d5, 0x24e4ab126b237af7, 0x2ba901628bb47af8}},
+    {{0x00467bc58cce08b5, 0xb636458c7f178d55, 0xc5748baea677d806, 0x2763a387dfa394eb},
+     {0xa12b448a7d3cebb6, 0xe7adda3e6f20d850, 0xf63ebce51558462c, 0x58b36143620088a8}},
+    {{0xa9d89488a059c142, 0x6f5ae714ff0b9346, 0x068f237d16fb3664, 0x5853e4c4363186ac},
+     {0xe2d87d2363c52f98, 0x2ec4a76681828876, 0x47b864fae14e7b1c, 0x0c0bc0e569192408}},
+    {{0x624d60492ed22e91, 0x6fdfe0b56f072822, 0xeeca111539ce2271, 0x98100a4fdb01614f},
+     {0xb6b0daa2a35c628f, 0xb6f94d2ec87e9a47, 0xc67732591d57d9ce, 0xf70bfeec03884a7b}},
+    {{0x4ff23ffd248a7d06, 0x80c5bfb4878873fa, 0xb7d9ad9005745981, 0x179c85db3db01994},
+     {0xba41b06261a6966c, 0x4d82d052eadce5a8, 0x9e91cd3ba5e6a318, 0x47795f4f95b2dda0}},
+    {{0x1ee426ccd5cd79bf, 0x0032940b946c6e18, 0x1b1e8ae057477f58, 0xe94f7d346d823278},
+     {0xc747cb96782ba21a, 0xc5254469f72b33a5, 0x772ef6dec7f80c81, 0xd73acbfe2cd9e6b5}},
+    {{0x283c7513caa76097, 0x0a624fa936c83906, 0x6b20afec715af2c7, 0x4b969974eba78bfd},
+     {0x220755ccd921d60e, 0x9b944e107baeca13, 0x04819d515ded93d4, 0x9bbff86e6dddfd27}},
+    {{0x21950b421ff6acd3, 0xffe7048453dc6909, 0xff4cd0b228766127, 0xabdbe6084fb7db2b},
+     {0x837c92285e1109e8, 0x26147d27f4645b5a, 0x4d78f592f7818ed8, 0xd394077ef247fa36}},
+    {{0x508cec1c3b3f64c9, 0xe20bc0ba1e5edf3f, 0xda1deb852f4318d4, 0xd20ebe0d5c3fa443},
+     {0x370b4ea773241ea3, 0x61f1511c5e1a5f65, 0x99a5e23d82681c62, 0xd731e383a2f54c2d}},
+    {{0x97359638546c4d8d, 0x5f9c3fc492f24679, 0x912e8beda8c8acd9, 0xec3a318d306634b0},
+     {0x80167f41c31cb264, 0x3db82f6f522113f2, 0xb155bcd2dcafe197, 0xfba1da5943465283}},
+    {{0x258bbbf9e7305683, 0x31eea5bf07ef5be6, 0x0deb0e4a46c814c1, 0x5cee8449a7b730dd},
+     {0xeab495c5a0182bde, 0xee759f879e27a6b4, 0xc2cf6a6880e518ca, 0x25e8013ff14cf3f4}},
+    {{0x3ec832e77acaca28, 0x1bfeea57c7385b29, 0x068212e3fd1eaf38, 0xc13298306acf8ccc},
+     {0xb909f2db2aac9e59, 0x5748060db661782a, 0xc5ab2632c79b7a01, 0xda44c6c600017626}},
+    {{0x69d44ed65c46aa8e, 0x2100d5d3a8d063d1, 0xcb9727eaa2d17c36, 0x4c2bab1b8add53b7},
+     {0xa084e90c15426704, 0x778afcd3a837ebea, 0x6651f7017ce477f8, 0xa062499846fb7a8b}},
+    {{0x3667eb1a7f4c04cc, 0x59556621a9404f84, 0x71cdf6537eceb50a, 0x994a44a69b8335fa},
+     {0xd7faf819dbeb9b69, 0x473c5680eed4350d, 0xb6658466da44bba2, 0x0d1bc780872bdbf3}},
+    {{0xb8d3d9319ff91fe5, 0x039c4800f0518eed, 0x95c376329182cb26, 0x0763a43482fc568d},
+     {0x707c04d5383e76ba, 0xac98b930824e8197, 0x92bf7c8f91230de0, 0x90876a0140959b70}},
+};
+
+/* Field element operations: */
+
+/* fe_reduce_once sets out = {hi,t} mod p, for {hi,t} < 2p. */
+static void fe_reduce_once(fe out, const u64 t[4], u64 hi) {
+  u64 s[4], borrow = 0, mask;
+  u128 d;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    d = (u128)t[i] - kP[i] - borrow;
+    s[i] = (u64)d;
+    borrow = (u64)(d >> 64) & 1;
+  }
+  /* Keep t if t - p went negative. */
+  mask = 0 - (borrow & ~hi & 1);
+  for (i = 0; i < 4; i++) {
+    out[i] = (t[i] & mask) | (s[i] & ~mask);
+  }
+}
+
+static void fe_add(fe out, const fe a, const fe b) {
+  u64 t[4];
+  u128 acc = 0;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    acc += (u128)a[i] + b[i];
+    t[i] = (u64)acc;
+    acc >>= 64;
+  }
+  fe_reduce_once(out, t, (u64)acc);
+}
+
+static void fe_sub(fe out, const fe a, const fe b) {
+  u64 t[4], borrow = 0, mask;
+  u128 acc;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    acc = (u128)a[i] - b[i] - borrow;
+    t[i] = (u64)acc;
+    borrow = (u64)(acc >> 64) & 1;
+  }
+  /* Add p back if it went negative. */
+  mask = 0 - borrow;
+  acc = 0;
+  for (i = 0; i < 4; i++) {
+    acc += (u128)t[i] + (kP[i] & mask);
+    out[i] = (u64)acc;
+    acc >>= 64;
+  }
+}
+
+/* fe_mul sets out = a * b / R mod p. Montgomery multiplication, interleaving
+ * the product and the reduction. -1/p mod 2**64 is 1, so the multiple of p to
+ * add at each step is just the bottom limb m, and the shape of p turns most of
+ * m * p into shifts: m * p[0] + m is m * 2**64 and p[2] is 0. */
+static void fe_mul(fe out, const fe a, const fe b) {
+  u64 t[6] = {0};
+  u64 m, carry;
+  u128 acc;
+  int i, j;
+
+  for (i = 0; i < 4; i++) {
+    carry = 0;
+    for (j = 0; j < 4; j++) {
+      acc = (u128)a[j] * b[i] + t[j] + carry;
+      t[j] = (u64)acc;
+      carry = (u64)(acc >> 64);
+    }
+    acc = (u128)t[4] + carry;
+    t[4] = (u64)acc;
+    t[5] = (u64)(acc >> 64);
+
+    m = t[0];
+    acc = (u128)m * kP[1] + t[1] + m;
+    t[0] = (u64)acc;
+    acc = (acc >> 64) + t[2];
+    t[1] = (u64)acc;
+    acc = (acc >> 64) + (u128)m * kP[3] + t[3];
+    t[2] = (u64)acc;
+    acc = (acc >> 64) + t[4];
+    t[3] = (u64)acc;
+    t[4] = t[5] + (u64)(acc >> 64);
+  }
+  fe_reduce_once(out, t, t[4]);
+}
+
+static void fe_sqr(fe out, const fe a) {
+  fe_mul(out, a, a);
+}
+
+static int fe_is_zero(const fe a) {
+  return (a[0] | a[1] | a[2] | a[3]) == 0;
+}
+
+/* fe_inv sets out = 1 / a, as a**(p-2). */
+static void fe_inv(fe out, const fe a) {
+  /* p - 2, most significant limb first. */
+  static const u64 kExponent[4] = {
+      0xffffffff00000001, 0, 0x00000000ffffffff, 0xfffffffffffffffd
+  };
+  fe r;
+  int i, j;
+
+  memcpy(r, kOne, sizeof(fe));
+  for (i = 0; i < 4; i++) {
+    for (j = 63; j >= 0; j--) {
+      fe_sqr(r, r);
+      if ((kExponent[i] >> j) & 1) {
+        fe_mul(r, r, a);
+      }
+    }
+  }
+  memcpy(out, r, sizeof(fe));
+}
+
+static void to_montgomery(fe out, const p256_int* in) {
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    out[i] = P256_DIGIT(in, 2 * i) | ((u64)P256_DIGIT(in, 2 * i + 1) << 32);
+  }
+  fe_mul(out, out, kRR);
+}
+
+static void from_montgomery(p256_int* out, const fe in) {
+  static const fe kPlainOne = {1, 0, 0, 0};
+  fe t;
+  int i;
+
+  fe_mul(t, in, kPlainOne);
+  for (i = 0; i < 4; i++) {
+    P256_DIGIT(out, 2 * i) = (p256_digit)t[i];
+    P256_DIGIT(out, 2 * i + 1) = (p256_digit)(t[i] >> 32);
+  }
+}
+
+/* Group operations: */
+
+/* point_double sets out = 2 * in. See
+ * http://hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-3.html#doubling-dbl-2001-b
+ * Doubling the point at infinity gives the point at infinity. */
+static void point_double(jacobian* out, const jacobian* in) {
+  fe delta, gamma, beta, alpha, t, u;
+
+  fe_sqr(delta, in->z);
+  fe_sqr(gamma, in->y);
+  fe_mul(beta, in->x, gamma);
+
+  /* alpha = 3 * (x - delta) * (x + delta) */
+  fe_sub(t, in->x, delta);
+  fe_add(u, in->x, delta);
+  fe_mul(alpha, t, u);
+  fe_add(t, alpha, alpha);
+  fe_add(alpha, t, alpha);
+
+  /* z3 = (y + z)**2 - gamma - delta */
+  fe_add(t, in->y, in->z);
+  fe_sqr(t, t);
+  fe_sub(t, t, gamma);
+  fe_sub(out->z, t, delta);
+
+  /* x3 = alpha**2 - 8 * beta */
+  fe_add(beta, beta, beta);
+  fe_add(beta, beta, beta);
+  fe_add(u, beta, beta);
+  fe_sqr(t, alpha);
+  fe_sub(out->x, t, u);
+
+  /* y3 = alpha * (4 * beta - x3) - 8 * gamma**2 */
+  fe_sub(t, beta, out->x);
+  fe_mul(t, alpha, t);
+  fe_sqr(gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_add(gamma, gamma, gamma);
+  fe_sub(out->y, t, gamma);
+}
+
+/* point_add_vartime sets out = a + {b_x,b_y,b_z}, where b_z may be NULL for an
+ * affine b. See
+ * http://hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-3.html#addition-add-2007-bl
+ * and #addition-madd-2007-bl. b must not be the point at infinity. */
+static void point_add_vartime(jacobian* out, const jacobian* a,
+                              const fe b_x, const fe b_y, const fe b_z) {
+  fe z1z1, z2z2, u1, u2, s1, s2, h, i, j, r, v, t;
+
+  if (fe_is_zero(a->z)) {
+    memcpy(out->x, b_x, sizeof(fe));
+    memcpy(out->y, b_y, sizeof(fe));
+    memcpy(out->z, b_z != NULL ? b_z : kOne, sizeof(fe));
+    return;
+  }
+
+  fe_sqr(z1z1, a->z);
+  fe_mul(u2, b_x, z1z1);
+  fe_mul(s2, b_y, a->z);
+  fe_mul(s2, s2, z1z1);
+  if (b_z != NULL) {
+    fe_sqr(z2z2, b_z);
+    fe_mul(u1, a->x, z2z2);
+    fe_mul(s1, a->y, b_z);
+    fe_mul(s1, s1, z2z2);
+  } else {
+    memcpy(u1, a->x, sizeof(fe));
+    memcpy(s1, a->y, sizeof(fe));
+  }
+
+  fe_sub(h, u2, u1);
+  fe_sub(r, s2, s1);
+  if (fe_is_zero(h)) {
+    if (fe_is_zero(r)) {
+      /* a == b */
+      point_double(out, a);
+    } else {
+      /* a == -b */
+      memset(out, 0, sizeof(*out));
+    }
+    return;
+  }
+  fe_add(r, r, r);
+
+  /* i = (2h)**2, j = h * i, v = u1 * i */
+  fe_add(i, h, h);
+  fe_sqr(i, i);
+  fe_mul(j, h, i);
+  fe_mul(v, u1, i);
+
+  /* z3 = ((z1 + z2)**2 - z1z1 - z2z2) * h, which is 2 * z1 * z2 * h. */
+  fe_mul(t, a->z, h);
+  if (b_z != NULL) {
+    fe_mul(t, t, b_z);
+  }
+  fe_add(out->z, t, t);
+
+  /* x3 = r**2 - j - 2v */
+  fe_sqr(t, r);
+  fe_sub(t, t, j);
+  fe_sub(t, t, v);
+  fe_sub(out->x, t, v);
+
+  /* y3 = r * (v - x3) - 2 * s1 * j */
+  fe_sub(t, v, out->x);
+  fe_mul(t, r, t);
+  fe_mul(s1, s1, j);
+  fe_add(s1, s1, s1);
+  fe_sub(out->y, t, s1);
+}
+
+/* wnaf sets naf[0..256] to the width-w non-adjacent form of n: digits that
+ * are zero or odd and less than 2**(w-1) in magnitude, with at least w - 1
+ * zeros after each non-zero one, and n = sum(naf[i] * 2**i). Returns the
+ * number of digits up to the most significant non-zero one. */
+static int wnaf(signed char naf[257], const p256_int* n, int w) {
+  u64 k[5];
+  int i, len = 0;
+
+  for (i = 0; i < 4; i++) {
+    k[i] = P256_DIGIT(n, 2 * i) | ((u64)P256_DIGIT(n, 2 * i + 1) << 32);
+  }
+  k[4] = 0;
+  memset(naf, 0, 257);
+
+  for (i = 0; (k[0] | k[1] | k[2] | k[3] | k[4]) != 0; i++) {
+    if (k[0] & 1) {
+      int d = (int)(k[0] & ((1 << w) - 1));
+      int j;
+
+      if (d >= 1 << (w - 1)) {
+        d -= 1 << w;
+      }
+      naf[i] = (signed char)d;
+      len = i + 1;
+      /* k -= d, which clears the bottom w bits. A positive d is just those
+       * bits, so only adding can carry. */
+      if (d > 0) {
+        k[0] -= (u64)d;
+      } else {
+        k[0] += (u64)-d;
+        if (k[0] < (u64)-d) {
+          for (j = 1; j < 5 && ++k[j] == 0; j++) {
+          }
+        }
+      }
+    }
+    k[0] = (k[0] >> 1) | (k[1] << 63);
+    k[1] = (k[1] >> 1) | (k[2] << 63);
+    k[2] = (k[2] >> 1) | (k[3] << 63);
+    k[3] = (k[3] >> 1) | (k[4] << 63);
+    k[4] >>= 1;
+  }
+  return len;
+}
+
+/* p256_points_mul_vartime64 is p256_points_mul_vartime() for 64-bit
+ * targets. */
+void p256_points_mul_vartime64(
+    const p256_int* n1, const p256_int* n2, const p256_int* in_x,
+    const p256_int* in_y, p256_int* out_x, p256_int* out_y) {
+  signed char naf1[257], naf2[257];
+  jacobian table[1 << (POINT_WINDOW - 2)];
+  jacobian r, twice;
+  fe neg_y, zinv, zinv2;
+  int i, len1, len2;
+
+  /* table[i] = (2i + 1) * in. */
+  to_montgomery(table[0].x, in_x);
+  to_montgomery(table[0].y, in_y);
+  memcpy(table[0].z, kOne, sizeof(fe));
+  point_double(&twice, &table[0]);
+  for (i = 1; i < (1 << (POINT_WINDOW - 2)); i++) {
+    point_add_vartime(&table[i], &twice, table[i - 1].x, table[i - 1].y,
+                      table[i - 1].z);
+  }
+
+  len1 = wnaf(naf1, n1, BASE_WINDOW);
+  len2 = wnaf(naf2, n2, POINT_WINDOW);
+
+  memset(&r, 0, sizeof(r));
+  for (i = (len1 > len2 ? len1 : len2) - 1; i >= 0; i--) {
+    if (!fe_is_zero(r.z)) {
+      point_double(&r, &r);
+    }
+    if (naf1[i] > 0) {
+      const affine* p = &kBaseTable[naf1[i] >> 1];
+      point_add_vartime(&r, &r, p->x, p->y, NULL);
+    } else if (naf1[i] < 0) {
+      const affine* p = &kBaseTable[-naf1[i] >> 1];
+      fe_sub(neg_y, kZero, p->y);
+      point_add_vartime(&r, &r, p->x, neg_y, NULL);
+    }
+    if (naf2[i] > 0) {
+      const jacobian* p = &table[naf2[i] >> 1];
+      point_add_vartime(&r, &r, p->x, p->y, p->z);
+    } else if (naf2[i] < 0) {
+      const jacobian* p = &table[-naf2[i] >> 1];
+      fe_sub(neg_y, kZero, p->y);
+      point_add_vartime(&r, &r, p->x, neg_y, p->z);
+    }
+  }
+
+  if (fe_is_zero(r.z)) {
+    p256_clear(out_x);
+    p256_clear(out_y);
+    return;
+  }
+
+  fe_inv(zinv, r.z);
+  fe_sqr(zinv2, zinv);
+  fe_mul(r.x, r.x, zinv2);
+  fe_mul(zinv2, zinv2, zinv);
+  fe_mul(r.y, r.y, zinv2);
+  from_montgomery(out_x, r.x);
+  from_montgomery(out_y, r.y);
+}
+
+#endif  // __LP64__ && __SIZEOF_INT128__
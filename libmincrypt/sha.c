@@ -33,12 +33,15 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "sha_hw.h"
+
+int mincrypt_sha_hw_enabled = 1;
+
 #define rol(bits, value) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-static void SHA1_Transform(SHA_CTX* ctx) {
+static void SHA1_Transform(uint32_t* state, const uint8_t* p) {
     uint32_t W[80];
     uint32_t A, B, C, D, E;
-    uint8_t* p = ctx->buf;
     int t;
 
     for(t = 0; t < 16; ++t) {
@@ -53,11 +56,11 @@ static void SHA1_Transform(SHA_CTX* ctx) {
         W[t] = rol(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
     }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
 
     for(t = 0; t < 80; t++) {
         uint32_t tmp = rol(5,A) + E + W[t];
@@ -78,11 +81,123 @@ static void SHA1_Transform(SHA_CTX* ctx) {
         A = tmp;
     }
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+}
+
+#if defined(MINCRYPT_SHA_NI)
+
+MINCRYPT_SHA_NI_TARGET
+static void SHA1_blocks_hw(uint32_t* state, const uint8_t* p, size_t count) {
+    const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i ABCD, E0, E1, MSG[4];
+    int t;
+
+    // A is in the top lane, and so is E.
+    ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1B);
+    E0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (count--) {
+        __m128i ABCD_SAVE = ABCD;
+        __m128i E0_SAVE = E0;
+
+        for (t = 0; t < 4; t++) {
+            MSG[t] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + 16 * t)), MASK);
+        }
+        p += 64;
+
+        // Four rounds at a time; MSG[t & 3] holds W[4t..4t+3].  E1 is the
+        // state before the last four rounds, from which sha1nexte derives E.
+        for (t = 0; t < 20; t++) {
+            __m128i WK = t == 0 ? _mm_add_epi32(E0, MSG[0]) : _mm_sha1nexte_epu32(E1, MSG[t & 3]);
+            E1 = ABCD;
+            switch (t / 5) {
+            case 0: ABCD = _mm_sha1rnds4_epu32(ABCD, WK, 0); break;
+            case 1: ABCD = _mm_sha1rnds4_epu32(ABCD, WK, 1); break;
+            case 2: ABCD = _mm_sha1rnds4_epu32(ABCD, WK, 2); break;
+            default: ABCD = _mm_sha1rnds4_epu32(ABCD, WK, 3); break;
+            }
+            if (t < 16) {
+                MSG[t & 3] = _mm_sha1msg2_epu32(
+                        _mm_xor_si128(_mm_sha1msg1_epu32(MSG[t & 3], MSG[(t + 1) & 3]),
+                                      MSG[(t + 2) & 3]),
+                        MSG[(t + 3) & 3]);
+            }
+        }
+
+        E0 = _mm_sha1nexte_epu32(E1, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    }
+
+    _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(ABCD, 0x1B));
+    state[4] = _mm_extract_epi32(E0, 3);
+}
+
+#elif defined(MINCRYPT_SHA_ARMV8)
+
+static void SHA1_blocks_hw(uint32_t* state, const uint8_t* p, size_t count) {
+    static const uint32_t K[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    uint32x4_t ABCD = vld1q_u32(state);
+    uint32_t E0 = state[4];
+    uint32x4_t WK, MSG[4];
+    int t;
+
+    while (count--) {
+        uint32x4_t ABCD_SAVE = ABCD;
+        uint32_t E0_SAVE = E0;
+
+        for (t = 0; t < 4; t++) {
+            MSG[t] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16 * t)));
+        }
+        p += 64;
+
+        // Four rounds at a time; MSG[t & 3] holds W[4t..4t+3].
+        for (t = 0; t < 20; t++) {
+            uint32_t E1 = vsha1h_u32(vgetq_lane_u32(ABCD, 0));
+            WK = vaddq_u32(MSG[t & 3], vdupq_n_u32(K[t / 5]));
+            if (t < 5) {
+                ABCD = vsha1cq_u32(ABCD, E0, WK);
+            } else if (t >= 10 && t < 15) {
+                ABCD = vsha1mq_u32(ABCD, E0, WK);
+            } else {
+                ABCD = vsha1pq_u32(ABCD, E0, WK);
+            }
+            E0 = E1;
+            if (t < 16) {
+                MSG[t & 3] = vsha1su1q_u32(
+                        vsha1su0q_u32(MSG[t & 3], MSG[(t + 1) & 3], MSG[(t + 2) & 3]),
+                        MSG[(t + 3) & 3]);
+            }
+        }
+
+        ABCD = vaddq_u32(ABCD, ABCD_SAVE);
+        E0 += E0_SAVE;
+    }
+
+    vst1q_u32(state, ABCD);
+    state[4] = E0;
+}
+
+#endif
+
+static void SHA1_blocks(uint32_t* state, const uint8_t* p, size_t count) {
+#if defined(MINCRYPT_SHA_HW)
+    static int hw = -1;
+    if (hw < 0) {
+        hw = mincrypt_cpu_has_sha(0);
+    }
+    if (hw && mincrypt_sha_hw_enabled) {
+        SHA1_blocks_hw(state, p, count);
+        return;
+    }
+#endif
+    while (count--) {
+        SHA1_Transform(state, p);
+        p += 64;
+    }
 }
 
 static const HASH_VTAB SHA_VTAB = {
@@ -110,13 +225,24 @@ void SHA_update(SHA_CTX* ctx, const void* data, int len) {
 
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA1_Transform(ctx);
-            i = 0;
+    // Completes a partial block, then hashes whole blocks straight from the
+    // data, and keeps what is left for later.
+    if (i) {
+        int n = len < 64 - i ? len : 64 - i;
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < 64) {
+            return;
         }
+        SHA1_blocks(ctx->state, ctx->buf, 1);
+    }
+    if (len >= 64) {
+        SHA1_blocks(ctx->state, p, len / 64);
+        p += len & ~63;
+        len &= 63;
     }
+    memcpy(ctx->buf, p, len);
 }
 
 
@@ -33,6 +33,8 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "sha_hw.h"
+
 #define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
 #define shr(value, bits) ((value) >> (bits))
 
@@ -54,10 +56,9 @@ static const uint32_t K[64] = {
     0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
 
-static void SHA256_Transform(SHA256_CTX* ctx) {
+static void SHA256_Transform(uint32_t* state, const uint8_t* p) {
     uint32_t W[64];
     uint32_t A, B, C, D, E, F, G, H;
-    uint8_t* p = ctx->buf;
     int t;
 
     for(t = 0; t < 16; ++t) {
@@ -74,14 +75,14 @@ static void SHA256_Transform(SHA256_CTX* ctx) {
         W[t] = W[t-16] + s0 + W[t-7] + s1;
     }
 
-    A = ctx->state[0];
-    B = ctx->state[1];
-    C = ctx->state[2];
-    D = ctx->state[3];
-    E = ctx->state[4];
-    F = ctx->state[5];
-    G = ctx->state[6];
-    H = ctx->state[7];
+    A = state[0];
+    B = state[1];
+    C = state[2];
+    D = state[3];
+    E = state[4];
+    F = state[5];
+    G = state[6];
+    H = state[7];
 
     for(t = 0; t < 64; t++) {
         uint32_t s0 = ror(A, 2) ^ ror(A, 13) ^ ror(A, 22);
@@ -101,14 +102,115 @@ static void SHA256_Transform(SHA256_CTX* ctx) {
         A = t1 + t2;
     }
 
-    ctx->state[0] += A;
-    ctx->state[1] += B;
-    ctx->state[2] += C;
-    ctx->state[3] += D;
-    ctx->state[4] += E;
-    ctx->state[5] += F;
-    ctx->state[6] += G;
-    ctx->state[7] += H;
+    state[0] += A;
+    state[1] += B;
+    state[2] += C;
+    state[3] += D;
+    state[4] += E;
+    state[5] += F;
+    state[6] += G;
+    state[7] += H;
+}
+
+#if defined(MINCRYPT_SHA_NI)
+
+MINCRYPT_SHA_NI_TARGET
+static void SHA256_blocks_hw(uint32_t* state, const uint8_t* p, size_t count) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, TMP, MSG[4];
+    int t;
+
+    // The instructions want the state as ABEF and CDGH.
+    TMP = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[0]), 0xB1);
+    STATE1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) &state[4]), 0x1B);
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+    while (count--) {
+        __m128i ABEF = STATE0;
+        __m128i CDGH = STATE1;
+
+        for (t = 0; t < 4; t++) {
+            MSG[t] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + 16 * t)), MASK);
+        }
+        p += 64;
+
+        // Four rounds at a time; MSG[t & 3] holds W[4t..4t+3].
+        for (t = 0; t < 16; t++) {
+            TMP = _mm_add_epi32(MSG[t & 3], _mm_loadu_si128((const __m128i*) &K[4 * t]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, TMP);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, _mm_shuffle_epi32(TMP, 0x0E));
+            if (t < 12) {
+                TMP = _mm_sha256msg1_epu32(MSG[t & 3], MSG[(t + 1) & 3]);
+                TMP = _mm_add_epi32(TMP, _mm_alignr_epi8(MSG[(t + 3) & 3], MSG[(t + 2) & 3], 4));
+                MSG[t & 3] = _mm_sha256msg2_epu32(TMP, MSG[(t + 3) & 3]);
+            }
+        }
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF);
+        STATE1 = _mm_add_epi32(STATE1, CDGH);
+    }
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+    _mm_storeu_si128((__m128i*) &state[0], _mm_blend_epi16(TMP, STATE1, 0xF0));
+    _mm_storeu_si128((__m128i*) &state[4], _mm_alignr_epi8(STATE1, TMP, 8));
+}
+
+#elif defined(MINCRYPT_SHA_ARMV8)
+
+static void SHA256_blocks_hw(uint32_t* state, const uint8_t* p, size_t count) {
+    uint32x4_t STATE0 = vld1q_u32(&state[0]);
+    uint32x4_t STATE1 = vld1q_u32(&state[4]);
+    uint32x4_t TMP, ABCD, MSG[4];
+    int t;
+
+    while (count--) {
+        uint32x4_t ABCD_SAVE = STATE0;
+        uint32x4_t EFGH_SAVE = STATE1;
+
+        for (t = 0; t < 4; t++) {
+            MSG[t] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p + 16 * t)));
+        }
+        p += 64;
+
+        // Four rounds at a time; MSG[t & 3] holds W[4t..4t+3].
+        for (t = 0; t < 16; t++) {
+            TMP = vaddq_u32(MSG[t & 3], vld1q_u32(&K[4 * t]));
+            ABCD = STATE0;
+            STATE0 = vsha256hq_u32(STATE0, STATE1, TMP);
+            STATE1 = vsha256h2q_u32(STATE1, ABCD, TMP);
+            if (t < 12) {
+                MSG[t & 3] = vsha256su1q_u32(vsha256su0q_u32(MSG[t & 3], MSG[(t + 1) & 3]),
+                                             MSG[(t + 2) & 3], MSG[(t + 3) & 3]);
+            }
+        }
+
+        STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+        STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+    }
+
+    vst1q_u32(&state[0], STATE0);
+    vst1q_u32(&state[4], STATE1);
+}
+
+#endif
+
+static void SHA256_blocks(uint32_t* state, const uint8_t* p, size_t count) {
+#if defined(MINCRYPT_SHA_HW)
+    static int hw = -1;
+    if (hw < 0) {
+        hw = mincrypt_cpu_has_sha(1);
+    }
+    if (hw && mincrypt_sha_hw_enabled) {
+        SHA256_blocks_hw(state, p, count);
+        return;
+    }
+#endif
+    while (count--) {
+        SHA256_Transform(state, p);
+        p += 64;
+    }
 }
 
 static const HASH_VTAB SHA256_VTAB = {
@@ -139,13 +241,24 @@ void SHA256_update(SHA256_CTX* ctx, const void* data, int len) {
 
     ctx->count += len;
 
-    while (len--) {
-        ctx->buf[i++] = *p++;
-        if (i == 64) {
-            SHA256_Transform(ctx);
-            i = 0;
+    // Completes a partial block, then hashes whole blocks straight from the
+    // data, and keeps what is left for later.
+    if (i) {
+        int n = len < 64 - i ? len : 64 - i;
+        memcpy(ctx->buf + i, p, n);
+        p += n;
+        len -= n;
+        if (i + n < 64) {
+            return;
         }
+        SHA256_blocks(ctx->state, ctx->buf, 1);
+    }
+    if (len >= 64) {
+        SHA256_blocks(ctx->state, p, len / 64);
+        p += len & ~63;
+        len &= 63;
     }
+    memcpy(ctx->buf, p, len);
 }
 
 
@@ -0,0 +1,96 @@
+/*
+** Copyright 2015, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Private to libmincrypt and its tests: which SHA instructions sha.c and
+// sha256.c can use, and whether the CPU we run on has them.
+//
+// x86 and x86_64 use the SHA extensions (SHA-NI), compiled in with a target
+// attribute so that the rest of the library still runs on any CPU.  arm64
+// uses the ARMv8 Crypto Extensions when the compiler targets them, which
+// Android.mk asks for.
+
+#ifndef SYSTEM_CORE_LIBMINCRYPT_SHA_HW_H_
+#define SYSTEM_CORE_LIBMINCRYPT_SHA_HW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__)
+#define MINCRYPT_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#define MINCRYPT_SHA_NI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO) && defined(__linux__)
+#define MINCRYPT_SHA_ARMV8 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+
+#if defined(MINCRYPT_SHA_NI) || defined(MINCRYPT_SHA_ARMV8)
+#define MINCRYPT_SHA_HW 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Set to 0 to make SHA_update and SHA256_update use the portable C code
+// even where the CPU has SHA instructions; for tests and benchmarks.
+extern int mincrypt_sha_hw_enabled;
+
+// Whether the CPU has instructions for SHA-1 (sha256 == 0) or SHA-256.
+static inline int mincrypt_cpu_has_sha(int sha256) {
+#if defined(MINCRYPT_SHA_NI)
+    unsigned int eax, ebx, ecx, edx;
+    (void) sha256;
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
+    }
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return 0;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1 << 29)) != 0;
+#elif defined(MINCRYPT_SHA_ARMV8)
+    return (getauxval(AT_HWCAP) & (sha256 ? HWCAP_SHA2 : HWCAP_SHA1)) != 0;
+#else
+    (void) sha256;
+    return 0;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // SYSTEM_CORE_LIBMINCRYPT_SHA_HW_H_
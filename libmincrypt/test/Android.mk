@@ -13,3 +13,23 @@ LOCAL_MODULE := ecdsa_test
 LOCAL_SRC_FILES := ecdsa_test.c
 LOCAL_STATIC_LIBRARIES := libmincrypt
 include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := sha_test
+LOCAL_SRC_FILES := sha_test.c
+LOCAL_STATIC_LIBRARIES := libmincrypt
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := sha_benchmark
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := sha_benchmark.c
+LOCAL_STATIC_LIBRARIES := libmincrypt
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := sha_benchmark
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := sha_benchmark.c
+LOCAL_STATIC_LIBRARIES := libmincrypt
+include $(BUILD_EXECUTABLE)
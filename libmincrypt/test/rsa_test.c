@@ -798,6 +798,11 @@ unsigned char* parsehex(char* str, int* len) {
 int main(int arg __unused, char** argv __unused) {
 
     unsigned char hash[SHA_DIGEST_SIZE];
+    unsigned char hashes[21][SHA_DIGEST_SIZE];
+    const uint8_t* batch_signatures[21];
+    const uint8_t* batch_hashes[21];
+    int batch_results[21];
+    int i;
 
     unsigned char* message;
     int mlen;
@@ -811,6 +816,9 @@ int main(int arg __unused, char** argv __unused) {
     int result = RSA_verify(&key_15, signature, slen, hash, sizeof(hash)); \
     printf("message %d: %s\n", n, result ? "verified" : "not verified"); \
     success = success && result; \
+    memcpy(hashes[n - 1], hash, sizeof(hash)); \
+    batch_signatures[n - 1] = signature; \
+    batch_hashes[n - 1] = hashes[n - 1]; \
     } while(0)
 
     int success = 1;
@@ -836,6 +844,19 @@ int main(int arg __unused, char** argv __unused) {
     TEST_MESSAGE(19);
     TEST_MESSAGE(20);
 
+    // All of the above again in one batch, plus signature 1 against the
+    // hash of message 2, which must not verify.
+    batch_signatures[20] = batch_signatures[0];
+    batch_hashes[20] = batch_hashes[1];
+    int verified = RSA_verify_batch(&key_15, batch_signatures, slen,
+                                    batch_hashes, SHA_DIGEST_SIZE, 21,
+                                    batch_results);
+    printf("batch: %d of 21 verified\n", verified);
+    success = success && verified == 20;
+    for (i = 0; i < 21; i++) {
+        success = success && batch_results[i] == (i < 20);
+    }
+
     printf("\n%s\n\n", success ? "PASS" : "FAIL");
 
     return !success;
@@ -0,0 +1,98 @@
+/*
+** Copyright 2015, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Measures SHA-1 and SHA-256 throughput in MB/s for a range of update sizes,
+// with the portable C code and, where the CPU has them, the SHA instructions.
+//
+//   sha_benchmark [milliseconds per measurement]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
+#include "../sha_hw.h"
+
+static const size_t kSizes[] = { 64, 1024, 16384, 1024 * 1024 };
+static const size_t kMaxSize = 1024 * 1024;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double measure(int sha256, const uint8_t* data, size_t size, int64_t budget) {
+    HASH_CTX ctx;
+    int64_t bytes = 0;
+    int64_t elapsed;
+    const int64_t start = now_ns();
+    if (sha256) {
+        SHA256_init(&ctx);
+    } else {
+        SHA_init(&ctx);
+    }
+    do {
+        HASH_update(&ctx, data, size);
+        bytes += size;
+        elapsed = now_ns() - start;
+    } while (elapsed < budget);
+    HASH_final(&ctx);
+    return bytes * 1000.0 / elapsed;
+}
+
+int main(int argc, char** argv) {
+    const int64_t budget = (argc > 1 ? atoi(argv[1]) : 200) * 1000000LL;
+    uint8_t* data = malloc(kMaxSize);
+    size_t i, s;
+    int sha256;
+
+    for (i = 0; i < kMaxSize; i++) {
+        data[i] = (uint8_t) (i * 7 + (i >> 8));
+    }
+
+    printf("%-8s %8s %10s %10s   (MB/s)\n", "hash", "size", "C", "hw");
+    for (sha256 = 0; sha256 < 2; sha256++) {
+        const int has_hw = mincrypt_cpu_has_sha(sha256);
+        for (s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); s++) {
+            printf("%-8s %8zu", sha256 ? "SHA-256" : "SHA-1", kSizes[s]);
+            mincrypt_sha_hw_enabled = 0;
+            printf(" %10.1f", measure(sha256, data, kSizes[s], budget));
+            fflush(stdout);
+            mincrypt_sha_hw_enabled = 1;
+            if (has_hw) {
+                printf(" %10.1f\n", measure(sha256, data, kSizes[s], budget));
+            } else {
+                printf(" %10s\n", "-");
+            }
+        }
+    }
+
+    free(data);
+    return 0;
+}
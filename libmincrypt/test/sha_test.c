@@ -0,0 +1,162 @@
+/*
+** Copyright 2015, The Android Open Source Project
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are met:
+**     * Redistributions of source code must retain the above copyright
+**       notice, this list of conditions and the following disclaimer.
+**     * Redistributions in binary form must reproduce the above copyright
+**       notice, this list of conditions and the following disclaimer in the
+**       documentation and/or other materials provided with the distribution.
+**     * Neither the name of Google Inc. nor the names of its contributors may
+**       be used to endorse or promote products derived from this software
+**       without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY Google Inc. ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+** MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+** EVENT SHALL Google Inc. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+** PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+** OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+** WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+** OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+** ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
+#include "../sha_hw.h"
+
+// FIPS 180-2 test vectors.
+static const struct {
+    const char* message;
+    int repeat;
+    const char* sha1;
+    const char* sha256;
+} vectors[] = {
+    { "abc", 1,
+      "a9993e364706816aba3e25717850c26c9cd0d89d",
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "a", 1000000,
+      "34aa973cd4c4daa4f61eeb2bdbad27316534016f",
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+static void tohex(const uint8_t* digest, int size, char* hex) {
+    int i;
+    for (i = 0; i < size; i++) {
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+}
+
+// Hashes the vector in uneven pieces, so that partial blocks get buffered.
+static void hash_vector(HASH_CTX* ctx, int i, char* hex) {
+    int len = strlen(vectors[i].message);
+    int r;
+    for (r = 0; r < vectors[i].repeat; r++) {
+        int half = (r * 7) % (len + 1);
+        HASH_update(ctx, vectors[i].message, half);
+        HASH_update(ctx, vectors[i].message + half, len - half);
+    }
+    tohex(HASH_final(ctx), HASH_size(ctx), hex);
+}
+
+static int test_vectors(void) {
+    int success = 1;
+    size_t i;
+    for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        char hex[2 * SHA256_DIGEST_SIZE + 1];
+        SHA_CTX sha;
+        SHA256_CTX sha256;
+
+        SHA_init(&sha);
+        hash_vector(&sha, i, hex);
+        if (strcmp(hex, vectors[i].sha1)) {
+            printf("vector %zu: SHA-1 %s, expected %s\n", i, hex, vectors[i].sha1);
+            success = 0;
+        }
+        SHA256_init(&sha256);
+        hash_vector(&sha256, i, hex);
+        if (strcmp(hex, vectors[i].sha256)) {
+            printf("vector %zu: SHA-256 %s, expected %s\n", i, hex, vectors[i].sha256);
+            success = 0;
+        }
+    }
+    return success;
+}
+
+// Compares the SHA instructions, if the CPU has them, with the C code, for
+// every length up to a few blocks and every split of the data in two.
+static int test_hw(void) {
+    uint8_t data[300];
+    uint8_t expected[SHA256_DIGEST_SIZE];
+    uint8_t actual[SHA256_DIGEST_SIZE];
+    int success = 1;
+    int len, split;
+
+    for (len = 0; len < (int) sizeof(data); len++) {
+        data[len] = (uint8_t) (len * 167 + 13);
+    }
+
+    for (len = 0; len <= (int) sizeof(data); len++) {
+        for (split = 0; split <= len; split += (len < 70 ? 1 : 13)) {
+            SHA_CTX sha;
+            SHA256_CTX sha256;
+
+            mincrypt_sha_hw_enabled = 0;
+            SHA_hash(data, len, expected);
+            mincrypt_sha_hw_enabled = 1;
+            SHA_init(&sha);
+            SHA_update(&sha, data, split);
+            SHA_update(&sha, data + split, len - split);
+            memcpy(actual, SHA_final(&sha), SHA_DIGEST_SIZE);
+            if (memcmp(expected, actual, SHA_DIGEST_SIZE)) {
+                printf("SHA-1 of %d bytes split at %d differs\n", len, split);
+                success = 0;
+            }
+
+            mincrypt_sha_hw_enabled = 0;
+            SHA256_hash(data, len, expected);
+            mincrypt_sha_hw_enabled = 1;
+            SHA256_init(&sha256);
+            SHA256_update(&sha256, data, split);
+            SHA256_update(&sha256, data + split, len - split);
+            memcpy(actual, SHA256_final(&sha256), SHA256_DIGEST_SIZE);
+            if (memcmp(expected, actual, SHA256_DIGEST_SIZE)) {
+                printf("SHA-256 of %d bytes split at %d differs\n", len, split);
+                success = 0;
+            }
+        }
+    }
+    return success;
+}
+
+int main(void) {
+    int success = 1;
+
+    printf("SHA-1 instructions: %s\n", mincrypt_cpu_has_sha(0) ? "yes" : "no");
+    printf("SHA-256 instructions: %s\n", mincrypt_cpu_has_sha(1) ? "yes" : "no");
+
+    mincrypt_sha_hw_enabled = 0;
+    printf("test vectors, C: ");
+    success = test_vectors() && success;
+    printf("done\n");
+    mincrypt_sha_hw_enabled = 1;
+    printf("test vectors, default: ");
+    success = test_vectors() && success;
+    printf("done\n");
+    success = test_hw() && success;
+
+    printf("\n%s\n\n", success ? "PASS" : "FAIL");
+
+    return !success;
+}
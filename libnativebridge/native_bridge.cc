@@ -25,6 +25,10 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace android {
 
@@ -98,6 +102,29 @@ static constexpr const char* kCodeCacheDir = "code_cache";
 
 static constexpr uint32_t kLibNativeBridgeVersion = 2;
 
+// Trampolines already looked up, per library handle, keyed by name and shorty. A library loaded
+// through the bridge is never unloaded while the bridge is up, so its answers, including nullptr
+// (the runtime tries both the short and the long JNI name), stay valid until UnloadNativeBridge.
+typedef std::unordered_map<std::string, void*> TrampolineMap;
+static std::unordered_map<void*, TrampolineMap> trampoline_cache;
+static NativeBridgeTrampolineCacheStats trampoline_cache_stats;
+static std::mutex trampoline_cache_lock;
+
+static std::string TrampolineKey(const char* name, const char* shorty, uint32_t len) {
+  std::string key(name);
+  key.push_back('\0');
+  if (shorty != nullptr) {
+    key.append(shorty, len);
+  }
+  return key;
+}
+
+static void ClearTrampolineCache() {
+  std::lock_guard<std::mutex> guard(trampoline_cache_lock);
+  trampoline_cache.clear();
+  trampoline_cache_stats = NativeBridgeTrampolineCacheStats();
+}
+
 // Characters allowed in a native bridge filename. The first character must
 // be in [a-zA-Z] (expected 'l' for "libx"). The rest must be in [a-zA-Z0-9._-].
 static bool CharacterAllowed(char c, bool first) {
@@ -450,6 +477,7 @@ void UnloadNativeBridge() {
       // Unload.
       dlclose(native_bridge_handle);
       CloseNativeBridge(false);
+      ClearTrampolineCache();
       break;
 
     case NativeBridgeState::kNotSetup:
@@ -488,10 +516,86 @@ void* NativeBridgeLoadLibrary(const char* libpath, int flag) {
 
 void* NativeBridgeGetTrampoline(void* handle, const char* name, const char* shorty,
                                 uint32_t len) {
-  if (NativeBridgeInitialized()) {
-    return callbacks->getTrampoline(handle, name, shorty, len);
+  NativeBridgeTrampolineRequest request = { name, shorty, len };
+  void* trampoline = nullptr;
+  NativeBridgeGetTrampolines(handle, &request, 1, &trampoline);
+  return trampoline;
+}
+
+size_t NativeBridgeGetTrampolines(void* handle, const NativeBridgeTrampolineRequest* requests,
+                                  size_t count, void** trampolines) {
+  if (!NativeBridgeInitialized()) {
+    for (size_t i = 0; i < count; ++i) {
+      trampolines[i] = nullptr;
+    }
+    return 0;
   }
-  return nullptr;
+
+  // Answer what we can from the cache with a single lock, and note what is left to the bridge.
+  std::vector<std::string> keys(count);
+  std::vector<bool> missed(count, false);
+  size_t misses = 0;
+  {
+    std::lock_guard<std::mutex> guard(trampoline_cache_lock);
+    TrampolineMap& map = trampoline_cache[handle];
+    for (size_t i = 0; i < count; ++i) {
+      const NativeBridgeTrampolineRequest& r = requests[i];
+      trampolines[i] = nullptr;
+      ++trampoline_cache_stats.lookups;
+      if (r.name == nullptr) {
+        // Not something we can key on, always ask the bridge.
+        missed[i] = true;
+        ++misses;
+        continue;
+      }
+      keys[i] = TrampolineKey(r.name, r.shorty, r.len);
+      auto it = map.find(keys[i]);
+      if (it != map.end()) {
+        ++trampoline_cache_stats.hits;
+        trampolines[i] = it->second;
+      } else {
+        missed[i] = true;
+        ++misses;
+      }
+    }
+    trampoline_cache_stats.misses += misses;
+  }
+
+  if (misses != 0) {
+    // The bridge may take a while, so it is called without the lock. Two threads racing on the
+    // same method both ask it, and get the same answer.
+    for (size_t i = 0; i < count; ++i) {
+      if (missed[i]) {
+        const NativeBridgeTrampolineRequest& r = requests[i];
+        trampolines[i] = callbacks->getTrampoline(handle, r.name, r.shorty, r.len);
+      }
+    }
+
+    std::lock_guard<std::mutex> guard(trampoline_cache_lock);
+    TrampolineMap& map = trampoline_cache[handle];
+    for (size_t i = 0; i < count; ++i) {
+      if (missed[i] && requests[i].name != nullptr) {
+        map.emplace(std::move(keys[i]), trampolines[i]);
+      }
+    }
+    trampoline_cache_stats.entries = 0;
+    for (const auto& entry : trampoline_cache) {
+      trampoline_cache_stats.entries += entry.second.size();
+    }
+  }
+
+  size_t resolved = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (trampolines[i] != nullptr) {
+      ++resolved;
+    }
+  }
+  return resolved;
+}
+
+void NativeBridgeGetTrampolineCacheStats(NativeBridgeTrampolineCacheStats* stats) {
+  std::lock_guard<std::mutex> guard(trampoline_cache_lock);
+  *stats = trampoline_cache_stats;
 }
 
 bool NativeBridgeIsSupported(const char* libpath) {
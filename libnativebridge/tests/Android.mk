@@ -18,6 +18,7 @@ test_src_files := \
     PreInitializeNativeBridgeFail1_test.cpp \
     PreInitializeNativeBridgeFail2_test.cpp \
     ReSetupNativeBridge_test.cpp \
+    TrampolineCache_test.cpp \
     UnavailableNativeBridge_test.cpp \
     ValidNameNativeBridge_test.cpp
 
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NativeBridgeTest.h"
+
+#include <unistd.h>
+
+namespace android {
+
+TEST_F(NativeBridgeTest, TrampolineCache) {
+    ASSERT_TRUE(LoadNativeBridge(kNativeBridgeLibrary, nullptr));
+    ASSERT_TRUE(PreInitializeNativeBridge(".", "isa"));
+    ASSERT_TRUE(InitializeNativeBridge(nullptr, nullptr));
+
+    // The dummy bridge resolves nothing, and misses are cached too
+    void* handle = reinterpret_cast<void*>(0x1000);
+    ASSERT_EQ(nullptr, NativeBridgeGetTrampoline(handle, "Java_Foo_bar", "VI", 2));
+    ASSERT_EQ(nullptr, NativeBridgeGetTrampoline(handle, "Java_Foo_bar", "VI", 2));
+    ASSERT_EQ(nullptr, NativeBridgeGetTrampoline(handle, "Java_Foo_bar", "VJ", 2));
+
+    NativeBridgeTrampolineCacheStats stats;
+    NativeBridgeGetTrampolineCacheStats(&stats);
+    EXPECT_EQ(3U, stats.lookups);
+    EXPECT_EQ(1U, stats.hits);
+    EXPECT_EQ(2U, stats.misses);
+    EXPECT_EQ(2U, stats.entries);
+
+    // Only the shorty length counts, and a nameless request is never cached
+    NativeBridgeTrampolineRequest requests[] = {
+        { "Java_Foo_bar", "VIZ", 2 },
+        { "Java_Foo_baz", "V", 1 },
+        { nullptr, nullptr, 0 },
+    };
+    void* trampolines[3] = { handle, handle, handle };
+    EXPECT_EQ(0U, NativeBridgeGetTrampolines(handle, requests, 3, trampolines));
+    EXPECT_EQ(nullptr, trampolines[0]);
+    EXPECT_EQ(nullptr, trampolines[1]);
+    EXPECT_EQ(nullptr, trampolines[2]);
+
+    NativeBridgeGetTrampolineCacheStats(&stats);
+    EXPECT_EQ(6U, stats.lookups);
+    EXPECT_EQ(2U, stats.hits);
+    EXPECT_EQ(4U, stats.misses);
+    EXPECT_EQ(3U, stats.entries);
+
+    // Each handle has its own entries
+    ASSERT_EQ(nullptr, NativeBridgeGetTrampoline(nullptr, "Java_Foo_bar", "VI", 2));
+    NativeBridgeGetTrampolineCacheStats(&stats);
+    EXPECT_EQ(2U, stats.hits);
+    EXPECT_EQ(4U, stats.entries);
+
+    UnloadNativeBridge();
+
+    NativeBridgeGetTrampolineCacheStats(&stats);
+    EXPECT_EQ(0U, stats.lookups);
+    EXPECT_EQ(0U, stats.entries);
+
+    // Clean-up code_cache
+    ASSERT_EQ(0, rmdir(kCodeCache));
+}
+
+}  // namespace android
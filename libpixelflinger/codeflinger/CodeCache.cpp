@@ -151,9 +151,12 @@ ssize_t Assembly::resize(size_t newSize)
 // ----------------------------------------------------------------------------
 
 CodeCache::CodeCache(size_t size)
-    : mCacheSize(size), mCacheInUse(0)
+    : mCacheSize(size), mCacheInUse(0), mEvictor(this),
+      mCacheData(LruCache<AssemblyKeyRef, sp<Assembly> >::kUnlimitedCapacity),
+      mHits(0), mMisses(0), mEvictions(0)
 {
     pthread_mutex_init(&mLock, 0);
+    mCacheData.setOnEntryRemovedListener(&mEvictor);
 }
 
 CodeCache::~CodeCache()
@@ -161,15 +164,20 @@ CodeCache::~CodeCache()
     pthread_mutex_destroy(&mLock);
 }
 
+void CodeCache::evictor_t::operator()(AssemblyKeyRef&, sp<Assembly>& assembly)
+{
+    mCache->mCacheInUse -= assembly->size();
+    mCache->mEvictions++;
+}
+
 sp<Assembly> CodeCache::lookup(const AssemblyKeyBase& keyBase) const
 {
     pthread_mutex_lock(&mLock);
-    sp<Assembly> r;
-    ssize_t index = mCacheData.indexOfKey(key_t(keyBase));
-    if (index >= 0) {
-        const cache_entry_t& e = mCacheData.valueAt(index);
-        e.when = mWhen++;
-        r = e.entry;
+    sp<Assembly> r = mCacheData.get(AssemblyKeyRef(keyBase));
+    if (r != 0) {
+        mHits++;
+    } else {
+        mMisses++;
     }
     pthread_mutex_unlock(&mLock);
     return r;
@@ -180,34 +188,38 @@ int CodeCache::cache(  const AssemblyKeyBase& keyBase,
 {
     pthread_mutex_lock(&mLock);
 
-    const ssize_t assemblySize = assembly->size();
-    while (mCacheInUse + assemblySize > mCacheSize) {
-        // evict the LRU
-        size_t lru = 0;
-        size_t count = mCacheData.size();
-        for (size_t i=0 ; i<count ; i++) {
-            const cache_entry_t& e = mCacheData.valueAt(i);
-            if (e.when < mCacheData.valueAt(lru).when) {
-                lru = i;
-            }
-        }
-        const cache_entry_t& e = mCacheData.valueAt(lru);
-        mCacheInUse -= e.entry->size();
-        mCacheData.removeItemsAt(lru);
+    // another thread may have generated the same code in the meantime
+    if (mCacheData.get(AssemblyKeyRef(keyBase)) != 0) {
+        pthread_mutex_unlock(&mLock);
+        return 0;
     }
 
-    ssize_t err = mCacheData.add(key_t(keyBase), cache_entry_t(assembly, mWhen));
-    if (err >= 0) {
-        mCacheInUse += assemblySize;
-        mWhen++;
-        // synchronize caches...
-        char* base = reinterpret_cast<char*>(assembly->base());
-        char* curr = reinterpret_cast<char*>(base + assembly->size());
-        __builtin___clear_cache(base, curr);
+    const ssize_t assemblySize = assembly->size();
+    while (mCacheInUse + assemblySize > mCacheSize && mCacheData.removeOldest()) {
+        // the evictor accounts for the LRU
     }
 
+    mCacheData.put(AssemblyKeyRef(keyBase), assembly);
+    mCacheInUse += assemblySize;
+    // synchronize caches...
+    char* base = reinterpret_cast<char*>(assembly->base());
+    char* curr = reinterpret_cast<char*>(base + assembly->size());
+    __builtin___clear_cache(base, curr);
+
+    pthread_mutex_unlock(&mLock);
+    return 0;
+}
+
+void CodeCache::getStats(stats_t* stats) const
+{
+    pthread_mutex_lock(&mLock);
+    stats->hits = mHits;
+    stats->misses = mMisses;
+    stats->evictions = mEvictions;
+    stats->count = mCacheData.size();
+    stats->inUse = mCacheInUse;
+    stats->size = mCacheSize;
     pthread_mutex_unlock(&mLock);
-    return err;
 }
 
 // ----------------------------------------------------------------------------
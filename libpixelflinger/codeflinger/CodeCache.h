@@ -23,7 +23,7 @@
 #include <pthread.h>
 #include <sys/types.h>
 
-#include "utils/KeyedVector.h"
+#include "utils/LruCache.h"
 #include "tinyutils/smartpointer.h"
 
 namespace android {
@@ -36,6 +36,7 @@ class AssemblyKeyBase {
 public:
     virtual ~AssemblyKeyBase() { }
     virtual int compare_type(const AssemblyKeyBase& key) const = 0;
+    virtual hash_t hash() const = 0;
 };
 
 template  <typename T>
@@ -47,10 +48,30 @@ public:
         const T& rhs = static_cast<const AssemblyKey&>(key).mKey;
         return android::compare_type(mKey, rhs);
     }
+    virtual hash_t hash() const {
+        return android::hash_type(mKey);
+    }
 private:
     T mKey;
 };
 
+// Refers to the key of a cached assembly, which the assembly itself holds.
+class AssemblyKeyRef {
+public:
+    AssemblyKeyRef() : mKey(0) { }
+    AssemblyKeyRef(const AssemblyKeyBase& k) : mKey(&k) { }
+    inline bool operator == (const AssemblyKeyRef& rhs) const {
+        return mKey->compare_type(*rhs.mKey) == 0;
+    }
+    inline hash_t hash() const { return mKey->hash(); }
+private:
+    const AssemblyKeyBase* mKey;
+};
+
+template<> inline hash_t hash_type(const AssemblyKeyRef& key) {
+    return key.hash();
+}
+
 // ----------------------------------------------------------------------------
 
 class Assembly
@@ -79,6 +100,15 @@ private:
 class CodeCache
 {
 public:
+    struct stats_t {
+        uint32_t    hits;
+        uint32_t    misses;
+        uint32_t    evictions;
+        size_t      count;
+        size_t      inUse;
+        size_t      size;
+    };
+
 // pretty simple cache API...
                 CodeCache(size_t size);
                 ~CodeCache();
@@ -88,46 +118,29 @@ public:
             int                 cache(  const AssemblyKeyBase& key,
                                         const sp<Assembly>& assembly);
 
+            void                getStats(stats_t* stats) const;
+
 private:
     // nothing to see here...
-    struct cache_entry_t {
-        inline cache_entry_t() { }
-        inline cache_entry_t(const sp<Assembly>& a, int64_t w)
-                : entry(a), when(w) { }
-        sp<Assembly>            entry;
-        mutable int64_t         when;
-    };
-
-    class key_t {
-        friend int compare_type(
-            const key_value_pair_t<key_t, cache_entry_t>&,
-            const key_value_pair_t<key_t, cache_entry_t>&);
-        const AssemblyKeyBase* mKey;
+    class evictor_t : public OnEntryRemoved<AssemblyKeyRef, sp<Assembly> > {
     public:
-        key_t() { };
-        key_t(const AssemblyKeyBase& k) : mKey(&k)  { }
+        evictor_t(CodeCache* cache) : mCache(cache) { }
+        virtual void operator()(AssemblyKeyRef& key, sp<Assembly>& assembly);
+    private:
+        CodeCache* mCache;
     };
 
     mutable pthread_mutex_t             mLock;
-    mutable int64_t                     mWhen;
     size_t                              mCacheSize;
     size_t                              mCacheInUse;
-    KeyedVector<key_t, cache_entry_t>   mCacheData;
-
-    friend int compare_type(
-        const key_value_pair_t<key_t, cache_entry_t>&,
-        const key_value_pair_t<key_t, cache_entry_t>&);
+    evictor_t                           mEvictor;
+    // lookup() moves the entry it finds to the young end
+    mutable LruCache<AssemblyKeyRef, sp<Assembly> > mCacheData;
+    mutable uint32_t                    mHits;
+    mutable uint32_t                    mMisses;
+    uint32_t                            mEvictions;
 };
 
-// KeyedVector uses compare_type(), which is more efficient, than
-// just using operator < ()
-inline int compare_type(
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& lhs,
-    const key_value_pair_t<CodeCache::key_t, CodeCache::cache_entry_t>& rhs)
-{
-    return lhs.key.mKey->compare_type(*(rhs.key.mKey));
-}
-
 // ----------------------------------------------------------------------------
 
 }; // namespace android
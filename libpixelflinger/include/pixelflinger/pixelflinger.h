@@ -73,6 +73,7 @@ enum GGLNames {
     GGL_AA                          = 0x80000001,
     GGL_W_LERP                      = 0x80000004,
     GGL_POINT_SMOOTH_NICE           = 0x80000005,
+    GGL_TILED                       = 0x80000006,
 
     // buffers, pixel drawing/reading
     GGL_COLOR                       = 0x1800,
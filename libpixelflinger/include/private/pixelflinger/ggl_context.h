@@ -26,6 +26,9 @@
 #include <pixelflinger/pixelflinger.h>
 #include <private/pixelflinger/ggl_fixed.h>
 
+#include <utils/JenkinsHash.h>
+#include <utils/TypeHelpers.h>
+
 namespace android {
 
 // ----------------------------------------------------------------------------
@@ -229,7 +232,8 @@ enum {
     GGL_ENABLE_W            = 0x00000200,
     GGL_ENABLE_DITHER       = 0x00000400,
     GGL_ENABLE_FOG          = 0x00000800,
-    GGL_ENABLE_POINT_AA_NICE= 0x00001000
+    GGL_ENABLE_POINT_AA_NICE= 0x00001000,
+    GGL_ENABLE_TILED        = 0x00002000
 };
 
 // ----------------------------------------------------------------------------
@@ -255,6 +259,15 @@ inline int compare_type(const needs_t& lhs, const needs_t& rhs) {
     return memcmp(&lhs, &rhs, sizeof(needs_t));
 }
 
+template<> inline hash_t hash_type(const needs_t& needs) {
+    uint32_t hash = JenkinsHashMix(0, needs.n);
+    hash = JenkinsHashMix(hash, needs.p);
+    for (int i = 0; i < GGL_TEXTURE_UNIT_COUNT; i++) {
+        hash = JenkinsHashMix(hash, needs.t[i]);
+    }
+    return JenkinsHashWhiten(hash);
+}
+
 struct needs_filter_t {
     needs_t     value;
     needs_t     mask;
@@ -547,6 +560,7 @@ struct context_t {
     
     void*               base;
     Assembly*           scanline_as;
+    uint32_t            scanline_paths;
     GGLenum             error;
 };
 
@@ -69,6 +69,7 @@ static void ggl_enable_point_aa_nice(context_t* c, int enable);
 static void ggl_enable_texture2d(context_t* c, int enable);
 static void ggl_enable_w_lerp(context_t* c, int enable);
 static void ggl_enable_fog(context_t* c, int enable);
+static void ggl_enable_tiled(context_t* c, int enable);
 
 static inline int min(int a, int b) CONST;
 static inline int min(int a, int b) {
@@ -171,6 +172,7 @@ static void enable_disable(context_t* c, GGLenum name, int en)
     case GGL_W_LERP:            ggl_enable_w_lerp(c, en);        break;
     case GGL_FOG:               ggl_enable_fog(c, en);           break;
     case GGL_POINT_SMOOTH_NICE: ggl_enable_point_aa_nice(c, en); break;
+    case GGL_TILED:             ggl_enable_tiled(c, en);         break;
     }
 }
 
@@ -722,7 +724,14 @@ void ggl_enable_texture2d(context_t* c, int enable)
     }
 }
 
-        
+void ggl_enable_tiled(context_t* c, int enable)
+{
+    // only changes how primitives are cut up, not the pixel pipeline
+    if (enable) c->state.enables |= GGL_ENABLE_TILED;
+    else        c->state.enables &= ~GGL_ENABLE_TILED;
+}
+
+
 // ----------------------------------------------------------------------------
 
 int64_t ggl_system_time()
@@ -796,6 +805,7 @@ void ggl_init_context(context_t* c)
     c->state.depth_test.clearValue = FIXED_ONE;
     c->shade.w0 = FIXED_ONE;
     memcpy(c->ditherMatrix, gDitherMatrix, sizeof(gDitherMatrix));
+    ggl_prewarm_scanline(c);
 }
 
 void ggl_uninit_context(context_t* c)
@@ -19,6 +19,7 @@
 #define LOG_TAG "pixelflinger"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -65,6 +66,26 @@
 #   define ANDROID_ARM_CODEGEN  0
 #endif
 
+/* NEON or SSE2 versions of the most common shortcuts, tried before the
+ * others. */
+#if (ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && \
+        (defined(__aarch64__) || (defined(__arm__) && defined(__ARM_HAVE_NEON)))
+#   define ANDROID_NEON_SCANLINES   1
+#   include <arm_neon.h>
+#else
+#   define ANDROID_NEON_SCANLINES   0
+#endif
+
+#if (ANDROID_CODEGEN >= ANDROID_CODEGEN_ASM) && \
+        (defined(__i386__) || defined(__x86_64__)) && defined(__SSE2__)
+#   define ANDROID_SSE2_SCANLINES   1
+#   include <emmintrin.h>
+#else
+#   define ANDROID_SSE2_SCANLINES   0
+#endif
+
+#define ANDROID_SIMD_SCANLINES  (ANDROID_NEON_SCANLINES || ANDROID_SSE2_SCANLINES)
+
 #define DEBUG__CODEGEN_ONLY     0
 
 /* Set to 1 to dump to the log the states that need a new
@@ -121,6 +142,14 @@ static void scanline_memset16(context_t* c);
 static void scanline_memset32(context_t* c);
 static void scanline_noop(context_t* c);
 static void scanline_set(context_t* c);
+#if ANDROID_SIMD_SCANLINES
+static void scanline_t32cb16_simd(context_t* c);
+static void scanline_t32cb16blend_simd(context_t* c);
+static void scanline_t32cb16blend_dither_simd(context_t* c);
+static void scanline_t32cb16blend_clamp_mod_simd(context_t* c);
+static void scanline_t32cb16blend_clamp_linear_simd(context_t* c);
+static void scanline_t32cb32blend_simd(context_t* c);
+#endif
 static void scanline_clear(context_t* c);
 
 static void rect_generic(context_t* c, size_t yc);
@@ -272,6 +301,35 @@ static shortcut_t shortcuts[] = {
         { 0x0000003F, 0x00000000, { 0x00000000, 0x00000000 } } },
         "(error) invalid color-buffer format", scanline_noop, init_y_error },
 };
+
+#if ANDROID_SIMD_SCANLINES
+/* These are looked at before the entries above; the [dither] variants
+ * check GGL_NEED_MASK(P_DITHER) themselves. */
+static shortcut_t simd_shortcuts[] = {
+#if ANDROID_SSE2_SCANLINES
+    /* the ARM builds have assembly for this one */
+    { { { 0x03515104, 0x00000077, { 0x00000A01, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "565 fb, 8888 tx, blend SRC_OVER (simd)", scanline_t32cb16blend_simd, init_y_noop },
+#endif
+    { { { 0x03515104, 0x00000177, { 0x00000A01, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFFFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "565 fb, 8888 tx, blend SRC_OVER dither (simd)", scanline_t32cb16blend_dither_simd, init_y_noop },
+    { { { 0x03010104, 0x00000077, { 0x00000A01, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFEFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "565 fb, 8888 tx, SRC [dither] (simd)", scanline_t32cb16_simd, init_y_noop },
+    { { { 0x03515104, 0x00000077, { 0x00001001, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFEFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "565 fb, 8888 tx, SRC_OVER clamp modulate [dither] (simd)", scanline_t32cb16blend_clamp_mod_simd, init_y },
+    { { { 0x03515104, 0x00000077, { 0x00008001, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFEFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "565 fb, 8888 tx, SRC_OVER clamp linear [dither] (simd)", scanline_t32cb16blend_clamp_linear_simd, init_y },
+    { { { 0x03515101, 0x00000077, { 0x00000A01, 0x00000000 } },
+        { 0xFFFFFFFF, 0xFFFFFEFF, { 0xFFFFFFFF, 0x0000003F } } },
+        "8888 fb, 8888 tx, blend SRC_OVER (simd)", scanline_t32cb32blend_simd, init_y_noop },
+};
+#endif
+
 static const needs_filter_t noblend1to1 = {
         // (disregard dithering, see below)
         { 0x03010100, 0x00000077, { 0x00000A00, 0x00000000 } },
@@ -301,6 +359,82 @@ public:
         : Assembly(size), mKey(needs) { }
     const AssemblyKey<needs_t>& key() const { return mKey; }
 };
+
+// Returns the scanline code for the given needs, from the cache or freshly
+// generated, or 0 if it could not be generated.
+static sp<Assembly> generate_scanline(context_t* c, const needs_t& needs)
+{
+    const AssemblyKey<needs_t> key(needs);
+    sp<Assembly> assembly = gCodeCache.lookup(key);
+    if (assembly == 0) {
+        // create a new assembly region
+        sp<ScanlineAssembly> a = new ScanlineAssembly(needs,
+                ASSEMBLY_SCRATCH_SIZE);
+        // initialize our assembler
+#if defined(__arm__)
+        GGLAssembler assembler( new ARMAssembler(a) );
+        //GGLAssembler assembler(
+        //        new ARMAssemblerOptimizer(new ARMAssembler(a)) );
+#endif
+#if defined(__mips__)
+        GGLAssembler assembler( new ArmToMipsAssembler(a) );
+#elif defined(__aarch64__)
+        GGLAssembler assembler( new ArmToArm64Assembler(a) );
+#endif
+        // generate the scanline code for the given needs
+        bool err = assembler.scanline(needs, c) != 0;
+        if (ggl_likely(!err)) {
+            // finally, cache this assembly
+            err = gCodeCache.cache(a->key(), a) < 0;
+        }
+        if (ggl_unlikely(err)) {
+            return 0;
+        }
+        assembly = a;
+    }
+    return assembly;
+}
+
+/*
+ * A device may list the needs of its most used pixel pipelines in this
+ * file, one "p:n_t0_t1" per line as printed by DEBUG_NEEDS and taken by
+ * test-opengl-codegen, so that their code is generated along with the
+ * first context instead of while drawing the first frame.
+ */
+#define PREWARM_NEEDS_PATH  "/system/etc/pixelflinger_needs.txt"
+
+static pthread_mutex_t gPrewarmLock = PTHREAD_MUTEX_INITIALIZER;
+static bool gPrewarmed = false;
+
+static void prewarm_scanlines(context_t* c)
+{
+    pthread_mutex_lock(&gPrewarmLock);
+    if (gPrewarmed) {
+        pthread_mutex_unlock(&gPrewarmLock);
+        return;
+    }
+    gPrewarmed = true;
+    FILE* f = fopen(PREWARM_NEEDS_PATH, "re");
+    if (f) {
+        char line[128];
+        while (fgets(line, sizeof(line), f)) {
+            needs_t needs;
+            if (sscanf(line, "%08x:%08x_%08x_%08x",
+                    &needs.p, &needs.n, &needs.t[0], &needs.t[1]) != 4) {
+                continue;
+            }
+            if (generate_scanline(c, needs) == 0) {
+                ALOGW("could not generate scanline for %s", line);
+            }
+        }
+        fclose(f);
+        CodeCache::stats_t stats;
+        gCodeCache.getStats(&stats);
+        ALOGD("prewarmed %zu scanlines, %zu of %zu bytes",
+                stats.count, stats.inUse, stats.size);
+    }
+    pthread_mutex_unlock(&gPrewarmLock);
+}
 #endif
 
 // ----------------------------------------------------------------------------
@@ -310,6 +444,22 @@ void ggl_init_scanline(context_t* c)
     c->init_y = init_y;
     c->step_y = step_y__generic;
     c->scanline = scanline;
+    c->scanline_paths = GGL_SCANLINE_ALL;
+}
+
+void ggl_set_scanline_paths(context_t* c, uint32_t paths)
+{
+    c->scanline_paths = paths;
+    ggl_pick_scanline(c);
+}
+
+void ggl_prewarm_scanline(context_t* c)
+{
+#if ANDROID_ARM_CODEGEN
+    prewarm_scanlines(c);
+#else
+    (void)c;
+#endif
 }
 
 void ggl_uninit_scanline(context_t* c)
@@ -339,9 +489,12 @@ static void pick_scanline(context_t* c)
     //    c->state.needs.n, c->state.needs.p,
     //    c->state.needs.t[0], c->state.needs.t[1]);
 
+    const uint32_t paths = c->scanline_paths;
+
     // first handle the special case that we cannot test with a filter
     const uint32_t cb_format = GGL_READ_NEEDS(CB_FORMAT, c->state.needs.n);
-    if (GGL_READ_NEEDS(T_FORMAT, c->state.needs.t[0]) == cb_format) {
+    if ((paths & GGL_SCANLINE_SHORTCUTS) &&
+            GGL_READ_NEEDS(T_FORMAT, c->state.needs.t[0]) == cb_format) {
         if (c->state.needs.match(noblend1to1)) {
             // this will match regardless of dithering state, since both
             // src and dest have the same format anyway, there is no dithering
@@ -362,7 +515,7 @@ static void pick_scanline(context_t* c)
         }
     }
 
-    if (c->state.needs.match(fill16noblend)) {
+    if ((paths & GGL_SCANLINE_SHORTCUTS) && c->state.needs.match(fill16noblend)) {
         c->init_y = init_y_packed;
         switch (c->formats[cb_format].size) {
         case 1: c->scanline = scanline_memset8;  return;
@@ -371,7 +524,20 @@ static void pick_scanline(context_t* c)
         }
     }
 
-    const int numFilters = sizeof(shortcuts)/sizeof(shortcut_t);
+#if ANDROID_SIMD_SCANLINES
+    const int numSimdFilters = (paths & GGL_SCANLINE_SIMD) ?
+            sizeof(simd_shortcuts)/sizeof(shortcut_t) : 0;
+    for (int i=0 ; i<numSimdFilters ; i++) {
+        if (c->state.needs.match(simd_shortcuts[i].filter)) {
+            c->scanline = simd_shortcuts[i].scanline;
+            c->init_y = simd_shortcuts[i].init_y;
+            return;
+        }
+    }
+#endif
+
+    const int numFilters = (paths & GGL_SCANLINE_SHORTCUTS) ?
+            sizeof(shortcuts)/sizeof(shortcut_t) : 0;
     for (int i=0 ; i<numFilters ; i++) {
         if (c->state.needs.match(shortcuts[i].filter)) {
             c->scanline = shortcuts[i].scanline;
@@ -381,8 +547,8 @@ static void pick_scanline(context_t* c)
     }
 
 #if DEBUG_NEEDS
-    ALOGI("Needs: n=0x%08x p=0x%08x t0=0x%08x t1=0x%08x",
-         c->state.needs.n, c->state.needs.p,
+    ALOGI("Needs: %08x:%08x_%08x_%08x",
+         c->state.needs.p, c->state.needs.n,
          c->state.needs.t[0], c->state.needs.t[1]);
 #endif
 
@@ -392,39 +558,19 @@ static void pick_scanline(context_t* c)
     c->step_y = step_y__generic;
 
 #if ANDROID_ARM_CODEGEN
+    if (!(c->scanline_paths & GGL_SCANLINE_CODEGEN)) {
+        c->scanline = scanline;
+        return;
+    }
+
     // we're going to have to generate some code...
-    // here, generate code for our pixel pipeline
-    const AssemblyKey<needs_t> key(c->state.needs);
-    sp<Assembly> assembly = gCodeCache.lookup(key);
-    if (assembly == 0) {
-        // create a new assembly region
-        sp<ScanlineAssembly> a = new ScanlineAssembly(c->state.needs, 
-                ASSEMBLY_SCRATCH_SIZE);
-        // initialize our assembler
-#if defined(__arm__)
-        GGLAssembler assembler( new ARMAssembler(a) );
-        //GGLAssembler assembler(
-        //        new ARMAssemblerOptimizer(new ARMAssembler(a)) );
-#endif
-#if defined(__mips__)
-        GGLAssembler assembler( new ArmToMipsAssembler(a) );
-#elif defined(__aarch64__)
-        GGLAssembler assembler( new ArmToArm64Assembler(a) );
-#endif
-        // generate the scanline code for the given needs
-        bool err = assembler.scanline(c->state.needs, c) != 0;
-        if (ggl_likely(!err)) {
-            // finally, cache this assembly
-            err = gCodeCache.cache(a->key(), a) < 0;
-        }
-        if (ggl_unlikely(err)) {
-            ALOGE("error generating or caching assembly. Reverting to NOP.");
-            c->scanline = scanline_noop;
-            c->init_y = init_y_noop;
-            c->step_y = step_y__nop;
-            return;
-        }
-        assembly = a;
+    sp<Assembly> assembly = generate_scanline(c, c->state.needs);
+    if (ggl_unlikely(assembly == 0)) {
+        ALOGE("error generating or caching assembly. Reverting to NOP.");
+        c->scanline = scanline_noop;
+        c->init_y = init_y_noop;
+        c->step_y = step_y__nop;
+        return;
     }
 
     // release the previous assembly
@@ -464,15 +610,6 @@ static void blend_factor(context_t* c, pixel_t* r, uint32_t factor,
         const pixel_t* src, const pixel_t* dst);
 static void rescale(uint32_t& u, uint8_t& su, uint32_t& v, uint8_t& sv);
 
-#if ANDROID_ARM_CODEGEN && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED)
-
-// no need to compile the generic-pipeline, it can't be reached
-void scanline(context_t*)
-{
-}
-
-#else
-
 void rescale(uint32_t& u, uint8_t& su, uint32_t& v, uint8_t& sv)
 {
     if (su && sv) {
@@ -939,7 +1076,6 @@ discard:
 	}
 }
 
-#endif // ANDROID_ARM_CODEGEN && (ANDROID_CODEGEN == ANDROID_CODEGEN_GENERATED)
 
 // ----------------------------------------------------------------------------
 #if 0
@@ -1128,6 +1264,9 @@ struct ditherer {
     void step(void) {
         m_index++;
     }
+    void skip(int count) {
+        m_index += count;
+    }
     int  get_value(void) {
         int ret = m_line[m_index & GGL_DITHER_MASK];
         m_index++;
@@ -1599,6 +1738,729 @@ void scanline_x32cb16blend_clamp_mod_dither(context_t* c)
     }
 }
 
+// ----------------------------------------------------------------------------
+#if 0
+#pragma mark -
+#pragma mark SIMD scanlines
+#endif
+
+#if ANDROID_SIMD_SCANLINES
+
+/* The kernels below work on several pixels at a time and compute exactly
+ * what the blenders above compute for each pixel.  Each returns how many
+ * pixels it did, a multiple of 8 or less, and the scanlines hand the rest
+ * to the blenders.  Textures fetched with clamping are gathered into a
+ * small buffer first, since only the blending vectorizes.
+ */
+#define SIMD_CHUNK  64
+
+/* The dither thresholds of the 8 pixels starting at xl.  Each chunk is a
+ * multiple of 8 pixels, so they serve the whole scanline. */
+static inline void simd_dither_row(const context_t* c, uint8_t* th)
+{
+    const uint8_t* line = &c->ditherMatrix[
+            (c->iterators.y & GGL_DITHER_MASK) << GGL_DITHER_ORDER_SHIFT];
+    const int x = c->iterators.xl;
+    for (int i=0 ; i<8 ; i++) {
+        th[i] = line[(x + i) & GGL_DITHER_MASK];
+    }
+}
+
+/* The modulation factors of blender_modulate, in a, r, g, b order. */
+static inline void simd_modulate_factors(const context_t* c, uint16_t* m)
+{
+    const GGLcolor colors[4] = { c->iterators.ydady, c->iterators.ydrdy,
+                                 c->iterators.ydgdy, c->iterators.ydbdy };
+    for (int i=0 ; i<4 ; i++) {
+        const int v = colors[i] >> (GGL_COLOR_BITS-8);
+        m[i] = v + (v >> 7);
+    }
+}
+
+#if ANDROID_NEON_SCANLINES
+
+/* A 0x0000 or 0xFFFF lane for each 0x00 or 0xFF byte of a mask. */
+static inline uint16x8_t neon_widen_mask(uint8x8_t m)
+{
+    return vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(m)));
+}
+
+static inline uint8x8_t neon_is_zero(const uint8x8x4_t& s)
+{
+    const uint8x8_t any = vorr_u8(vorr_u8(s.val[0], s.val[1]),
+                                  vorr_u8(s.val[2], s.val[3]));
+    return vceq_u8(any, vdup_n_u8(0));
+}
+
+static inline uint16x8_t neon_pack565(uint16x8_t r, uint16x8_t g, uint16x8_t b)
+{
+    return vorrq_u16(vorrq_u16(vshlq_n_u16(r, 11), vshlq_n_u16(g, 5)), b);
+}
+
+/* 0x100 - (a + (a>>7)), the destination factor of SRC_OVER. */
+static inline uint16x8_t neon_one_minus(uint16x8_t a)
+{
+    return vsubq_u16(vdupq_n_u16(0x100), vaddq_u16(a, vshrq_n_u16(a, 7)));
+}
+
+/* convertAbgr8888ToRgb565(s) */
+static size_t convert32to16_simd(uint16_t* dst, const uint32_t* src, size_t ct)
+{
+    const size_t n = ct & ~size_t(7);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        vst1q_u16(dst + i, neon_pack565(
+                vmovl_u8(vshr_n_u8(s.val[0], 3)),
+                vmovl_u8(vshr_n_u8(s.val[1], 2)),
+                vmovl_u8(vshr_n_u8(s.val[2], 3))));
+    }
+    return n;
+}
+
+/* ditherer::abgr8888ToRgb565(s) */
+static size_t convert32to16_dither_simd(uint16_t* dst, const uint32_t* src, size_t ct,
+        const uint8_t* thresholds)
+{
+    const size_t n = ct & ~size_t(7);
+    const uint8x8_t th = vld1_u8(thresholds);
+    const uint8x8_t th_rb = vshr_n_u8(th, GGL_DITHER_BITS-8 +5);
+    const uint8x8_t th_g = vshr_n_u8(th, GGL_DITHER_BITS-8 +6);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        vst1q_u16(dst + i, neon_pack565(
+                vmovl_u8(vshr_n_u8(vqadd_u8(s.val[0], th_rb), 3)),
+                vmovl_u8(vshr_n_u8(vqadd_u8(s.val[1], th_g), 2)),
+                vmovl_u8(vshr_n_u8(vqadd_u8(s.val[2], th_rb), 3))));
+    }
+    return n;
+}
+
+/* blender_32to16::write(s, dst) */
+static size_t blend32to16_simd(uint16_t* dst, const uint32_t* src, size_t ct)
+{
+    const size_t n = ct & ~size_t(7);
+    const uint16x8_t m5 = vdupq_n_u16(0x1f);
+    const uint16x8_t m6 = vdupq_n_u16(0x3f);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        const uint16x8_t d = vld1q_u16(dst + i);
+        const uint16x8_t f = neon_one_minus(vmovl_u8(s.val[3]));
+
+        const uint16x8_t sR = vmovl_u8(vshr_n_u8(s.val[0], 3));
+        const uint16x8_t sG = vmovl_u8(vshr_n_u8(s.val[1], 2));
+        const uint16x8_t sB = vmovl_u8(vshr_n_u8(s.val[2], 3));
+        const uint16x8_t opaque = neon_pack565(sR, sG, sB);
+
+        const uint16x8_t dR = vshrq_n_u16(d, 11);
+        const uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), m6);
+        const uint16x8_t dB = vandq_u16(d, m5);
+        const uint16x8_t blended = neon_pack565(
+                vaddq_u16(sR, vshrq_n_u16(vmulq_u16(f, dR), 8)),
+                vaddq_u16(sG, vshrq_n_u16(vmulq_u16(f, dG), 8)),
+                vaddq_u16(sB, vshrq_n_u16(vmulq_u16(f, dB), 8)));
+
+        uint16x8_t r = vbslq_u16(neon_widen_mask(vceq_u8(s.val[3], vdup_n_u8(0xff))),
+                opaque, blended);
+        r = vbslq_u16(neon_widen_mask(neon_is_zero(s)), d, r);
+        vst1q_u16(dst + i, r);
+    }
+    return n;
+}
+
+/* blender_32to16::write(s, dst, ditherer) */
+static size_t blend32to16_dither_simd(uint16_t* dst, const uint32_t* src, size_t ct,
+        const uint8_t* thresholds)
+{
+    const size_t n = ct & ~size_t(7);
+    const uint16x8_t m5 = vdupq_n_u16(0x1f);
+    const uint16x8_t m6 = vdupq_n_u16(0x3f);
+    const uint8x8_t th = vld1_u8(thresholds);
+    // opaque pixels add the threshold to the 8-bit components...
+    const uint8x8_t th_rb = vshr_n_u8(th, GGL_DITHER_BITS-8 +5);
+    const uint8x8_t th_g = vshr_n_u8(th, GGL_DITHER_BITS-8 +6);
+    // ...the others to the 8.8 blended ones
+    const uint16x8_t th16 = vshll_n_u8(th, 8 - GGL_DITHER_BITS);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        const uint16x8_t d = vld1q_u16(dst + i);
+        const uint16x8_t f = neon_one_minus(vmovl_u8(s.val[3]));
+
+        const uint16x8_t opaque = neon_pack565(
+                vmovl_u8(vshr_n_u8(vqadd_u8(s.val[0], th_rb), 3)),
+                vmovl_u8(vshr_n_u8(vqadd_u8(s.val[1], th_g), 2)),
+                vmovl_u8(vshr_n_u8(vqadd_u8(s.val[2], th_rb), 3)));
+
+        const uint16x8_t dR = vshrq_n_u16(d, 11);
+        const uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), m6);
+        const uint16x8_t dB = vandq_u16(d, m5);
+        uint16x8_t bR = vaddq_u16(vshll_n_u8(vshr_n_u8(s.val[0], 3), 8), th16);
+        uint16x8_t bG = vaddq_u16(vshll_n_u8(vshr_n_u8(s.val[1], 2), 8), th16);
+        uint16x8_t bB = vaddq_u16(vshll_n_u8(vshr_n_u8(s.val[2], 3), 8), th16);
+        bR = vminq_u16(vshrq_n_u16(vmlaq_u16(bR, f, dR), 8), m5);
+        bG = vminq_u16(vshrq_n_u16(vmlaq_u16(bG, f, dG), 8), m6);
+        bB = vminq_u16(vshrq_n_u16(vmlaq_u16(bB, f, dB), 8), m5);
+        const uint16x8_t blended = neon_pack565(bR, bG, bB);
+
+        uint16x8_t r = vbslq_u16(neon_widen_mask(vceq_u8(s.val[3], vdup_n_u8(0xff))),
+                opaque, blended);
+        r = vbslq_u16(neon_widen_mask(neon_is_zero(s)), d, r);
+        vst1q_u16(dst + i, r);
+    }
+    return n;
+}
+
+/* blender_32to16_modulate::write(s, dst[, ditherer]) */
+static size_t blend32to16_modulate_simd(uint16_t* dst, const uint32_t* src, size_t ct,
+        const context_t* c, bool dither, const uint8_t* thresholds)
+{
+    const size_t n = ct & ~size_t(7);
+    uint16_t m[4];
+    simd_modulate_factors(c, m);
+    const uint16x8_t mA = vdupq_n_u16(m[0]);
+    const uint16x8_t mR = vdupq_n_u16(m[1]);
+    const uint16x8_t mG = vdupq_n_u16(m[2]);
+    const uint16x8_t mB = vdupq_n_u16(m[3]);
+    const uint16x8_t m5 = vdupq_n_u16(0x1f);
+    const uint16x8_t m6 = vdupq_n_u16(0x3f);
+    const uint16x8_t th16 = dither ?
+            vshll_n_u8(vld1_u8(thresholds), 8 - GGL_DITHER_BITS) : vdupq_n_u16(0);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        const uint16x8_t d = vld1q_u16(dst + i);
+
+        // modulate, keeping R/G/B in 5.8 or 6.8 fixed point
+        const uint16x8_t sA = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[3]), mA), 8);
+        uint16x8_t sR = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[0]), mR), 8 - 5);
+        uint16x8_t sG = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[1]), mG), 8 - 6);
+        uint16x8_t sB = vshrq_n_u16(vmulq_u16(vmovl_u8(s.val[2]), mB), 8 - 5);
+        const uint16x8_t f = neon_one_minus(sA);
+
+        const uint16x8_t dR = vshrq_n_u16(d, 11);
+        const uint16x8_t dG = vandq_u16(vshrq_n_u16(d, 5), m6);
+        const uint16x8_t dB = vandq_u16(d, m5);
+        sR = vshrq_n_u16(vmlaq_u16(vaddq_u16(sR, th16), f, dR), 8);
+        sG = vshrq_n_u16(vmlaq_u16(vaddq_u16(sG, th16), f, dG), 8);
+        sB = vshrq_n_u16(vmlaq_u16(vaddq_u16(sB, th16), f, dB), 8);
+        if (dither) {
+            sR = vminq_u16(sR, m5);
+            sG = vminq_u16(sG, m6);
+            sB = vminq_u16(sB, m5);
+        }
+
+        const uint16x8_t r = vbslq_u16(neon_widen_mask(neon_is_zero(s)), d,
+                neon_pack565(sR, sG, sB));
+        vst1q_u16(dst + i, r);
+    }
+    return n;
+}
+
+/* blender_32to32::write(s, dst) */
+static size_t blend32to32_simd(uint32_t* dst, const uint32_t* src, size_t ct)
+{
+    const size_t n = ct & ~size_t(7);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        const uint8x8x4_t d = vld4_u8(reinterpret_cast<const uint8_t*>(dst + i));
+        const uint16x8_t f = neon_one_minus(vmovl_u8(s.val[3]));
+        const uint8x8_t keep = neon_is_zero(s);
+        const uint8x8_t opaque = vceq_u8(s.val[3], vdup_n_u8(0xff));
+        uint8x8x4_t r;
+        for (int j=0 ; j<4 ; j++) {
+            const uint8x8_t blended = vqadd_u8(s.val[j],
+                    vshrn_n_u16(vmulq_u16(vmovl_u8(d.val[j]), f), 8));
+            r.val[j] = vbsl_u8(keep, d.val[j], vbsl_u8(opaque, s.val[j], blended));
+        }
+        vst4_u8(reinterpret_cast<uint8_t*>(dst + i), r);
+    }
+    return n;
+}
+
+/* The bilinear filtering of linear_clamp_iterator; w[] are the weights of
+ * t00, t01, t10 and t11 and add up to 0x100. */
+static inline uint32_t bilerp_simd(uint32_t t00, uint32_t t01, uint32_t t10, uint32_t t11,
+        const uint16_t* w)
+{
+    // texels (u,v) (u1,v) in one vector, (u,v1) (u1,v1) in the other
+    const uint16x8_t t0 = vmovl_u8(vreinterpret_u8_u32(
+            vset_lane_u32(t10, vdup_n_u32(t00), 1)));
+    const uint16x8_t t1 = vmovl_u8(vreinterpret_u8_u32(
+            vset_lane_u32(t11, vdup_n_u32(t01), 1)));
+    const uint16x8_t w0 = vcombine_u16(vdup_n_u16(w[0]), vdup_n_u16(w[2]));
+    const uint16x8_t w1 = vcombine_u16(vdup_n_u16(w[1]), vdup_n_u16(w[3]));
+    const uint16x8_t sum = vmlaq_u16(vmulq_u16(t0, w0), t1, w1);
+    const uint16x4_t texel = vadd_u16(vget_low_u16(sum), vget_high_u16(sum));
+    const uint8x8_t bytes = vshrn_n_u16(vcombine_u16(texel, texel), 8);
+    return vget_lane_u32(vreinterpret_u32_u8(bytes), 0);
+}
+
+#else // ANDROID_SSE2_SCANLINES
+
+/* 8 pixels, one component per 16-bit lane; zero is all ones where the
+ * whole pixel is 0. */
+struct sse2_pixels {
+    sse2_pixels(const uint32_t* p) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 4));
+        const __m128i m8 = _mm_set1_epi32(0xff);
+        r = _mm_packs_epi32(_mm_and_si128(lo, m8), _mm_and_si128(hi, m8));
+        g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), m8),
+                            _mm_and_si128(_mm_srli_epi32(hi, 8), m8));
+        b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), m8),
+                            _mm_and_si128(_mm_srli_epi32(hi, 16), m8));
+        a = _mm_packs_epi32(_mm_srli_epi32(lo, 24), _mm_srli_epi32(hi, 24));
+        const __m128i zero = _mm_setzero_si128();
+        this->zero = _mm_packs_epi32(_mm_cmpeq_epi32(lo, zero), _mm_cmpeq_epi32(hi, zero));
+    }
+    __m128i r, g, b, a;
+    __m128i zero;
+};
+
+static inline __m128i sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i sse2_pack565(__m128i r, __m128i g, __m128i b)
+{
+    return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(r, 11), _mm_slli_epi16(g, 5)), b);
+}
+
+/* 0x100 - (a + (a>>7)), the destination factor of SRC_OVER. */
+static inline __m128i sse2_one_minus(__m128i a)
+{
+    return _mm_sub_epi16(_mm_set1_epi16(0x100), _mm_add_epi16(a, _mm_srli_epi16(a, 7)));
+}
+
+static inline __m128i sse2_thresholds(const uint8_t* thresholds)
+{
+    return _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(thresholds)),
+            _mm_setzero_si128());
+}
+
+/* ditherer::rgb888ToRgb565(), th_rb and th_g already shifted */
+static inline __m128i sse2_dither565(const sse2_pixels& s, __m128i th_rb, __m128i th_g)
+{
+    const __m128i m8 = _mm_set1_epi16(0xff);
+    return sse2_pack565(
+            _mm_srli_epi16(_mm_min_epi16(_mm_add_epi16(s.r, th_rb), m8), 3),
+            _mm_srli_epi16(_mm_min_epi16(_mm_add_epi16(s.g, th_g), m8), 2),
+            _mm_srli_epi16(_mm_min_epi16(_mm_add_epi16(s.b, th_rb), m8), 3));
+}
+
+/* convertAbgr8888ToRgb565(s) */
+static size_t convert32to16_simd(uint16_t* dst, const uint32_t* src, size_t ct)
+{
+    const size_t n = ct & ~size_t(7);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const sse2_pixels s(src + i);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), sse2_pack565(
+                _mm_srli_epi16(s.r, 3), _mm_srli_epi16(s.g, 2), _mm_srli_epi16(s.b, 3)));
+    }
+    return n;
+}
+
+/* ditherer::abgr8888ToRgb565(s) */
+static size_t convert32to16_dither_simd(uint16_t* dst, const uint32_t* src, size_t ct,
+        const uint8_t* thresholds)
+{
+    const size_t n = ct & ~size_t(7);
+    const __m128i th = sse2_thresholds(thresholds);
+    const __m128i th_rb = _mm_srli_epi16(th, GGL_DITHER_BITS-8 +5);
+    const __m128i th_g = _mm_srli_epi16(th, GGL_DITHER_BITS-8 +6);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const sse2_pixels s(src + i);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), sse2_dither565(s, th_rb, th_g));
+    }
+    return n;
+}
+
+/* blender_32to16::write(s, dst) */
+static size_t blend32to16_simd(uint16_t* dst, const uint32_t* src, size_t ct)
+{
+    const size_t n = ct & ~size_t(7);
+    const __m128i m5 = _mm_set1_epi16(0x1f);
+    const __m128i m6 = _mm_set1_epi16(0x3f);
+    const __m128i m8 = _mm_set1_epi16(0xff);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const sse2_pixels s(src + i);
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i d = _mm_loadu_si128(p);
+        const __m128i f = sse2_one_minus(s.a);
+
+        const __m128i sR = _mm_srli_epi16(s.r, 3);
+        const __m128i sG = _mm_srli_epi16(s.g, 2);
+        const __m128i sB = _mm_srli_epi16(s.b, 3);
+        const __m128i opaque = sse2_pack565(sR, sG, sB);
+
+        const __m128i dR = _mm_srli_epi16(d, 11);
+        const __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), m6);
+        const __m128i dB = _mm_and_si128(d, m5);
+        const __m128i blended = sse2_pack565(
+                _mm_add_epi16(sR, _mm_srli_epi16(_mm_mullo_epi16(f, dR), 8)),
+                _mm_add_epi16(sG, _mm_srli_epi16(_mm_mullo_epi16(f, dG), 8)),
+                _mm_add_epi16(sB, _mm_srli_epi16(_mm_mullo_epi16(f, dB), 8)));
+
+        const __m128i r = sse2_select(_mm_cmpeq_epi16(s.a, m8), opaque, blended);
+        _mm_storeu_si128(p, sse2_select(s.zero, d, r));
+    }
+    return n;
+}
+
+/* blender_32to16::write(s, dst, ditherer) */
+static size_t blend32to16_dither_simd(uint16_t* dst, const uint32_t* src, size_t ct,
+        const uint8_t* thresholds)
+{
+    const size_t n = ct & ~size_t(7);
+    const __m128i m5 = _mm_set1_epi16(0x1f);
+    const __m128i m6 = _mm_set1_epi16(0x3f);
+    const __m128i m8 = _mm_set1_epi16(0xff);
+    const __m128i th = sse2_thresholds(thresholds);
+    // opaque pixels add the threshold to the 8-bit components...
+    const __m128i th_rb = _mm_srli_epi16(th, GGL_DITHER_BITS-8 +5);
+    const __m128i th_g = _mm_srli_epi16(th, GGL_DITHER_BITS-8 +6);
+    // ...the others to the 8.8 blended ones
+    const __m128i th16 = _mm_slli_epi16(th, 8 - GGL_DITHER_BITS);
+    for (size_t i=0 ; i<n ; i+=8) {
+        const sse2_pixels s(src + i);
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i d = _mm_loadu_si128(p);
+        const __m128i f = sse2_one_minus(s.a);
+
+        const __m128i opaque = sse2_dither565(s, th_rb, th_g);
+
+        const __m128i dR = _mm_srli_epi16(d, 11);
+        const __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), m6);
+        const __m128i dB = _mm_and_si128(d, m5);
+        __m128i bR = _mm_add_epi16(_mm_slli_epi16(_mm_srli_epi16(s.r, 3), 8), th16);
+        __m128i bG = _mm_add_epi16(_mm_slli_epi16(_mm_srli_epi16(s.g, 2), 8), th16);
+        __m128i bB = _mm_add_epi16(_mm_slli_epi16(_mm_srli_epi16(s.b, 3), 8), th16);
+        bR = _mm_min_epi16(_mm_srli_epi16(_mm_add_epi16(bR, _mm_mullo_epi16(f, dR)), 8), m5);
+        bG = _mm_min_epi16(_mm_srli_epi16(_mm_add_epi16(bG, _mm_mullo_epi16(f, dG)), 8), m6);
+        bB = _mm_min_epi16(_mm_srli_epi16(_mm_add_epi16(bB, _mm_mullo_epi16(f, dB)), 8), m5);
+        const __m128i blended = sse2_pack565(bR, bG, bB);
+
+        const __m128i r = sse2_select(_mm_cmpeq_epi16(s.a, m8), opaque, blended);
+        _mm_storeu_si128(p, sse2_select(s.zero, d, r));
+    }
+    return n;
+}
+
+/* blender_32to16_modulate::write(s, dst[, ditherer]) */
+static size_t blend32to16_modulate_simd(uint16_t* dst, const uint32_t* src, size_t ct,
+        const context_t* c, bool dither, const uint8_t* thresholds)
+{
+    const size_t n = ct & ~size_t(7);
+    uint16_t m[4];
+    simd_modulate_factors(c, m);
+    const __m128i mA = _mm_set1_epi16(m[0]);
+    const __m128i mR = _mm_set1_epi16(m[1]);
+    const __m128i mG = _mm_set1_epi16(m[2]);
+    const __m128i mB = _mm_set1_epi16(m[3]);
+    const __m128i m5 = _mm_set1_epi16(0x1f);
+    const __m128i m6 = _mm_set1_epi16(0x3f);
+    const __m128i th16 = dither ?
+            _mm_slli_epi16(sse2_thresholds(thresholds), 8 - GGL_DITHER_BITS) :
+            _mm_setzero_si128();
+    for (size_t i=0 ; i<n ; i+=8) {
+        const sse2_pixels s(src + i);
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i d = _mm_loadu_si128(p);
+
+        // modulate, keeping R/G/B in 5.8 or 6.8 fixed point
+        const __m128i sA = _mm_srli_epi16(_mm_mullo_epi16(s.a, mA), 8);
+        __m128i sR = _mm_srli_epi16(_mm_mullo_epi16(s.r, mR), 8 - 5);
+        __m128i sG = _mm_srli_epi16(_mm_mullo_epi16(s.g, mG), 8 - 6);
+        __m128i sB = _mm_srli_epi16(_mm_mullo_epi16(s.b, mB), 8 - 5);
+        const __m128i f = sse2_one_minus(sA);
+
+        const __m128i dR = _mm_srli_epi16(d, 11);
+        const __m128i dG = _mm_and_si128(_mm_srli_epi16(d, 5), m6);
+        const __m128i dB = _mm_and_si128(d, m5);
+        sR = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sR, th16), _mm_mullo_epi16(f, dR)), 8);
+        sG = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sG, th16), _mm_mullo_epi16(f, dG)), 8);
+        sB = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sB, th16), _mm_mullo_epi16(f, dB)), 8);
+        if (dither) {
+            sR = _mm_min_epi16(sR, m5);
+            sG = _mm_min_epi16(sG, m6);
+            sB = _mm_min_epi16(sB, m5);
+        }
+
+        _mm_storeu_si128(p, sse2_select(s.zero, d, sse2_pack565(sR, sG, sB)));
+    }
+    return n;
+}
+
+/* blender_32to32::write(s, dst), 4 pixels at a time */
+static size_t blend32to32_simd(uint32_t* dst, const uint32_t* src, size_t ct)
+{
+    const size_t n = ct & ~size_t(3);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i m8 = _mm_set1_epi32(0xff);
+    for (size_t i=0 ; i<n ; i+=4) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i* p = reinterpret_cast<__m128i*>(dst + i);
+        const __m128i d = _mm_loadu_si128(p);
+        __m128i half[2];
+        for (int j=0 ; j<2 ; j++) {
+            // two pixels, with their alpha copied to all four lanes
+            const __m128i sc = j ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero);
+            const __m128i dc = j ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+            const __m128i sA = _mm_shufflehi_epi16(
+                    _mm_shufflelo_epi16(sc, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+            const __m128i f = sse2_one_minus(sA);
+            half[j] = _mm_add_epi16(sc, _mm_srli_epi16(_mm_mullo_epi16(dc, f), 8));
+        }
+        const __m128i blended = _mm_packus_epi16(half[0], half[1]);
+        const __m128i opaque = _mm_cmpeq_epi32(_mm_srli_epi32(s, 24), m8);
+        const __m128i r = sse2_select(opaque, s, blended);
+        _mm_storeu_si128(p, sse2_select(_mm_cmpeq_epi32(s, zero), d, r));
+    }
+    return n;
+}
+
+/* The bilinear filtering of linear_clamp_iterator; w[] are the weights of
+ * t00, t01, t10 and t11 and add up to 0x100. */
+static inline uint32_t bilerp_simd(uint32_t t00, uint32_t t01, uint32_t t10, uint32_t t11,
+        const uint16_t* w)
+{
+    // texels (u,v) (u1,v) in one vector, (u,v1) (u1,v1) in the other
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i t0 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, t10, t00), zero);
+    const __m128i t1 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, t11, t01), zero);
+    const __m128i w0 = _mm_set_epi16(w[2], w[2], w[2], w[2], w[0], w[0], w[0], w[0]);
+    const __m128i w1 = _mm_set_epi16(w[3], w[3], w[3], w[3], w[1], w[1], w[1], w[1]);
+    const __m128i sum = _mm_add_epi16(_mm_mullo_epi16(t0, w0), _mm_mullo_epi16(t1, w1));
+    const __m128i texel = _mm_srli_epi16(_mm_add_epi16(sum, _mm_srli_si128(sum, 8)), 8);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(texel, texel));
+}
+
+#endif
+
+/* Blends 32-bit source pixels SRC_OVER onto 32-bit destination ones. */
+struct blender_32to32 {
+    void write(uint32_t s, uint32_t* dst) {
+        if (s == 0)
+            return;
+        s = GGL_RGBA_TO_HOST(s);
+        const int sA = (s>>24);
+        if (sA == 0xff) {
+            *dst = GGL_HOST_TO_RGBA(s);
+            return;
+        }
+        const uint32_t f = 0x100 - (sA + (sA>>7));
+        const uint32_t d = GGL_RGBA_TO_HOST(*dst);
+        uint32_t r = 0;
+        for (int shift=0 ; shift<32 ; shift+=8) {
+            uint32_t v = ((s >> shift) & 0xff) + ((((d >> shift) & 0xff) * f) >> 8);
+            if (v > 0xff)
+                v = 0xff;
+            r |= v << shift;
+        }
+        *dst = GGL_HOST_TO_RGBA(r);
+    }
+};
+
+/* The first source pixel of a one-to-one mapped scanline. */
+static inline const uint32_t* simd_horz_src32(const context_t* c)
+{
+    const texture_t& tx = c->state.texture[0];
+    const int32_t u = (tx.shade.is0>>16) + c->iterators.xl;
+    const int32_t v = (tx.shade.it0>>16) + c->iterators.y;
+    return reinterpret_cast<const uint32_t*>(tx.surface.data)+(u+(tx.surface.stride*v));
+}
+
+/* Fills buf with the next ct texels of a clamped texture iterator. */
+template <typename T>
+static inline void simd_gather(T& it, uint32_t* buf, size_t ct)
+{
+    for (size_t i=0 ; i<ct ; i++) {
+        buf[i] = it.get_pixel32();
+    }
+}
+
+/* Bilinear fetch from a texture with GGL_CLAMP_TO_EDGE on both axes, the
+ * same way as the generic scanline() does it, but truncating the filtered
+ * components to 8 bits so that they go through blender_32to16 like any
+ * other texel. */
+struct linear_clamp_iterator {
+    linear_clamp_iterator(context_t* c) {
+        const int xs = c->iterators.xl;
+        texture_t& tx = c->state.texture[0];
+        texture_iterators_t& ti = tx.iterators;
+        m_s = (xs * ti.dsdx) + ti.ydsdy;
+        m_t = (xs * ti.dtdx) + ti.ydtdy;
+        m_ds = ti.dsdx;
+        m_dt = ti.dtdx;
+        m_width = tx.surface.width;
+        m_height = tx.surface.height;
+        m_data = reinterpret_cast<const uint32_t*>(tx.surface.data);
+        m_stride = tx.surface.stride;
+    }
+    uint32_t get_pixel32() {
+        int u, v, u1, v1, fu, fv;
+        coord(m_s, m_width, u, u1, fu);
+        coord(m_t, m_height, v, v1, fv);
+        m_s += m_ds;
+        m_t += m_dt;
+        const uint32_t* row0 = m_data + m_stride*v;
+        const uint32_t* row1 = m_data + m_stride*v1;
+        uint16_t w[4];
+        w[0] = (0x10 - fu) * (0x10 - fv);
+        w[1] = (0x10 - fu) * fv;
+        w[2] = fu * (0x10 - fv);
+        w[3] = 0x100 - (w[0] + w[1] + w[2]);
+        return bilerp_simd(row0[u], row1[u], row0[u1], row1[u1], w);
+    }
+private:
+    static void coord(GGLfixed s, int size, int& i0, int& i1, int& frac) {
+        const GGLfixed clamp_max = (size << 16) - FIXED_HALF;
+        if (s < FIXED_HALF) s = FIXED_HALF;
+        if (s > clamp_max)  s = clamp_max;
+        s -= FIXED_HALF;
+        i0 = s >> 16;
+        i1 = i0 + 1 < size ? i0 + 1 : size - 1;
+        frac = (s >> 12) & 0xF;
+        frac += frac >> 3;
+    }
+
+    GGLfixed        m_s, m_t;
+    GGLfixed        m_ds, m_dt;
+    int             m_width, m_height;
+    const uint32_t* m_data;
+    int             m_stride;
+};
+
+void scanline_t32cb16_simd(context_t* c)
+{
+    const bool dither = c->state.needs.p & GGL_NEED_MASK(P_DITHER);
+    dst_iterator16 di(c);
+    ditherer dither_tail(c);
+    uint8_t th[8];
+    simd_dither_row(c, th);
+    const uint32_t* src = simd_horz_src32(c);
+    const size_t n = dither ?
+            convert32to16_dither_simd(di.dst, src, di.count, th) :
+            convert32to16_simd(di.dst, src, di.count);
+    dither_tail.skip(n);
+    for (size_t i=n ; i<size_t(di.count) ; i++) {
+        if (dither) {
+            di.dst[i] = dither_tail.abgr8888ToRgb565(src[i]);
+        } else {
+            di.dst[i] = convertAbgr8888ToRgb565(GGL_RGBA_TO_HOST(src[i]));
+        }
+    }
+}
+
+void scanline_t32cb16blend_simd(context_t* c)
+{
+    dst_iterator16 di(c);
+    blender_32to16 bl(c);
+    const uint32_t* src = simd_horz_src32(c);
+    const size_t n = blend32to16_simd(di.dst, src, di.count);
+    for (size_t i=n ; i<size_t(di.count) ; i++) {
+        bl.write(src[i], di.dst + i);
+    }
+}
+
+void scanline_t32cb16blend_dither_simd(context_t* c)
+{
+    dst_iterator16 di(c);
+    ditherer       dither(c);
+    blender_32to16 bl(c);
+    uint8_t th[8];
+    simd_dither_row(c, th);
+    const uint32_t* src = simd_horz_src32(c);
+    const size_t n = blend32to16_dither_simd(di.dst, src, di.count, th);
+    dither.skip(n);
+    for (size_t i=n ; i<size_t(di.count) ; i++) {
+        bl.write(src[i], di.dst + i, dither);
+    }
+}
+
+void scanline_t32cb16blend_clamp_mod_simd(context_t* c)
+{
+    const bool dither = c->state.needs.p & GGL_NEED_MASK(P_DITHER);
+    dst_iterator16 di(c);
+    blender_32to16_modulate bl(c);
+    ditherer dither_tail(c);
+    uint8_t th[8];
+    simd_dither_row(c, th);
+    const bool horizontal = is_context_horizontal(c);
+    horz_clamp_iterator32 hci(c);
+    clamp_iterator ci(c);
+
+    uint32_t buf[SIMD_CHUNK];
+    while (di.count > 0) {
+        const size_t ct = di.count < SIMD_CHUNK ? di.count : SIMD_CHUNK;
+        if (horizontal) {
+            simd_gather(hci, buf, ct);
+        } else {
+            simd_gather(ci, buf, ct);
+        }
+        const size_t n = blend32to16_modulate_simd(di.dst, buf, ct, c, dither, th);
+        dither_tail.skip(n);
+        for (size_t i=n ; i<ct ; i++) {
+            if (dither) {
+                bl.write(buf[i], di.dst + i, dither_tail);
+            } else {
+                bl.write(buf[i], di.dst + i);
+            }
+        }
+        di.dst += ct;
+        di.count -= ct;
+    }
+}
+
+void scanline_t32cb16blend_clamp_linear_simd(context_t* c)
+{
+    const bool dither = c->state.needs.p & GGL_NEED_MASK(P_DITHER);
+    dst_iterator16 di(c);
+    blender_32to16 bl(c);
+    ditherer dither_tail(c);
+    uint8_t th[8];
+    simd_dither_row(c, th);
+    linear_clamp_iterator li(c);
+
+    uint32_t buf[SIMD_CHUNK];
+    while (di.count > 0) {
+        const size_t ct = di.count < SIMD_CHUNK ? di.count : SIMD_CHUNK;
+        simd_gather(li, buf, ct);
+        const size_t n = dither ?
+                blend32to16_dither_simd(di.dst, buf, ct, th) :
+                blend32to16_simd(di.dst, buf, ct);
+        dither_tail.skip(n);
+        for (size_t i=n ; i<ct ; i++) {
+            if (dither) {
+                bl.write(buf[i], di.dst + i, dither_tail);
+            } else {
+                bl.write(buf[i], di.dst + i);
+            }
+        }
+        di.dst += ct;
+        di.count -= ct;
+    }
+}
+
+void scanline_t32cb32blend_simd(context_t* c)
+{
+    const int32_t x = c->iterators.xl;
+    size_t ct = c->iterators.xr - x;
+    const int32_t y = c->iterators.y;
+    surface_t* cb = &(c->state.buffers.color);
+    uint32_t* dst = reinterpret_cast<uint32_t*>(cb->data) + (x+(cb->stride*y));
+    const uint32_t* src = simd_horz_src32(c);
+
+    const size_t n = blend32to32_simd(dst, src, ct);
+    blender_32to32 bl;
+    for (size_t i=n ; i<ct ; i++) {
+        bl.write(src[i], dst + i);
+    }
+}
+
+#endif // ANDROID_SIMD_SCANLINES
+
+
 void scanline_t16cb16_clamp(context_t* c)
 {
     dst_iterator16  di(c);
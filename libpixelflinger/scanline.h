@@ -23,9 +23,22 @@
 
 namespace android {
 
+// The kinds of pixel pipeline ggl_pick_scanline() chooses from, in order;
+// what none of the enabled ones covers goes to the generic C pipeline.
+enum {
+    GGL_SCANLINE_SIMD       = 0x01, // NEON or SSE2 shortcuts
+    GGL_SCANLINE_SHORTCUTS  = 0x02, // the other hand-written C and assembly
+    GGL_SCANLINE_CODEGEN    = 0x04, // generated code
+    GGL_SCANLINE_ALL        = 0x07
+};
+
 void ggl_init_scanline(context_t* c);
 void ggl_uninit_scanline(context_t* c);
 void ggl_pick_scanline(context_t* c);
+// Restricts c to some kinds of pipeline, to measure them against each other.
+void ggl_set_scanline_paths(context_t* c, uint32_t paths);
+// Generates the code of the pipelines listed by the device, once per process.
+void ggl_prewarm_scanline(context_t* c);
 
 }; // namespace android
 
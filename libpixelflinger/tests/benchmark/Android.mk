@@ -0,0 +1,21 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+# Benchmark, run by hand.
+LOCAL_SRC_FILES:= \
+	benchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libpixelflinger
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../..
+
+LOCAL_CFLAGS := -Werror -Wall
+
+LOCAL_MODULE:= test-pixelflinger-benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the pixel pipelines over a matrix of color buffer formats,
+// texturing, blending, dithering and primitive sizes.  Each case is drawn
+// with the generic C pipeline, the code generator, the hand-written
+// shortcuts and the SIMD shortcuts in turn, and the rate is printed in
+// millions of pixels per second; "-" means that there is nothing of that
+// kind for the case, so it would use the generic pipeline.
+//
+//   test-pixelflinger-benchmark [milliseconds per measurement] [case filter]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pixelflinger/pixelflinger.h>
+#include "private/pixelflinger/ggl_context.h"
+
+#include "scanline.h"
+
+using namespace android;
+
+static const int kSize = 1024;
+
+enum Texturing {
+    NO_TEXTURE,
+    ONE_TO_ONE,
+    SCALED,
+    SCALED_LINEAR,
+};
+
+static const char* const kTexturing[] = { "color", "1:1", "scaled", "linear" };
+
+struct Case {
+    int format;
+    Texturing texturing;
+    bool modulate;
+    bool blend;
+    bool dither;
+};
+
+static const struct {
+    const char* name;
+    uint32_t paths;
+} kPaths[] = {
+    { "generic",    0 },
+    { "jit",        GGL_SCANLINE_CODEGEN },
+    { "shortcuts",  GGL_SCANLINE_SHORTCUTS },
+    { "simd",       GGL_SCANLINE_SIMD },
+};
+static const size_t kPathCount = sizeof(kPaths) / sizeof(kPaths[0]);
+
+static int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static void describe(const Case& t, char* buf, size_t size) {
+    snprintf(buf, size, "%s fb, %s%s%s%s",
+            t.format == GGL_PIXEL_FORMAT_RGB_565 ? "565" : "8888",
+            kTexturing[t.texturing],
+            t.texturing != NO_TEXTURE ? (t.modulate ? " modulate" : " replace") : "",
+            t.blend ? ", SRC_OVER" : "",
+            t.dither ? ", dither" : "");
+}
+
+static void setup(GGLContext* c, const Case& t, GGLSurface* cb, GGLSurface* tex) {
+    cb->format = t.format;
+    c->colorBuffer(c, cb);
+    c->scissor(c, 0, 0, kSize, kSize);
+    c->shadeModel(c, GGL_FLAT);
+    const GGLclampx color[4] = { 0xC000, 0x8000, 0xE000, 0x10000 };
+    c->color4xv(c, color);
+    c->enableDisable(c, GGL_DITHER, t.dither);
+    c->enableDisable(c, GGL_BLEND, t.blend);
+    c->blendFunc(c, GGL_ONE, GGL_ONE_MINUS_SRC_ALPHA);
+
+    c->activeTexture(c, 0);
+    c->enableDisable(c, GGL_TEXTURE_2D, t.texturing != NO_TEXTURE);
+    if (t.texturing == NO_TEXTURE) {
+        return;
+    }
+    c->bindTexture(c, tex);
+    const GGLint filter = t.texturing == SCALED_LINEAR ? GGL_LINEAR : GGL_NEAREST;
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_MIN_FILTER, filter);
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_MAG_FILTER, filter);
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_S, GGL_CLAMP);
+    c->texParameteri(c, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_T, GGL_CLAMP);
+    c->texEnvi(c, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, t.modulate ? GGL_MODULATE : GGL_REPLACE);
+    if (t.texturing == ONE_TO_ONE) {
+        c->texGeni(c, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+        c->texGeni(c, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+        c->texCoord2i(c, 0, 0);
+    } else {
+        // Shrinks the whole texture by 3/4 in both directions.
+        c->texGeni(c, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+        c->texGeni(c, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+        const int32_t grad[8] = { 0, 0x15555, 0, 0, 0, 0x15555, 0, 0 };
+        c->texCoordGradScale8xv(c, 0, grad);
+    }
+}
+
+// Draws size x size pixels, as a rectangle or as two triangles.
+static void draw(GGLContext* c, int size, bool triangles, int i) {
+    // Moves around a little, so that not every scanline starts aligned.
+    const int x = (i * 7) % (kSize - size + 1);
+    const int y = (i * 3) % (kSize - size + 1);
+    if (!triangles) {
+        c->recti(c, x, y, x + size, y + size);
+        return;
+    }
+    const GGLcoord v0[2] = { x << 4, y << 4 };
+    const GGLcoord v1[2] = { (x + size) << 4, y << 4 };
+    const GGLcoord v2[2] = { x << 4, (y + size) << 4 };
+    const GGLcoord v3[2] = { (x + size) << 4, (y + size) << 4 };
+    c->trianglex(c, v0, v1, v2);
+    c->trianglex(c, v1, v3, v2);
+}
+
+// Returns millions of pixels per second.
+static double measure(GGLContext* c, int size, bool triangles, int64_t budget) {
+    draw(c, size, triangles, 0);
+    int count = 0;
+    const int64_t start = now_ns();
+    int64_t elapsed;
+    do {
+        for (int i = 0; i < 16; i++) {
+            draw(c, size, triangles, ++count);
+        }
+        elapsed = now_ns() - start;
+    } while (elapsed < budget);
+    return double(size) * size * count * 1000.0 / elapsed;
+}
+
+int main(int argc, char** argv) {
+    const int64_t budget = (argc > 1 ? atoi(argv[1]) : 50) * 1000000LL;
+    const char* filter = argc > 2 ? argv[2] : NULL;
+
+    uint32_t* pixels = new uint32_t[kSize * kSize];
+    uint32_t* texels = new uint32_t[kSize * kSize];
+    for (int y = 0; y < kSize; y++) {
+        for (int x = 0; x < kSize; x++) {
+            // Premultiplied, with a bit of every alpha value.
+            const uint32_t a = (x + y) & 0xff;
+            const uint32_t r = (x * a) >> 10;
+            const uint32_t g = (y * a) >> 10;
+            const uint32_t b = ((x ^ y) & 0xff) * a / 255;
+            texels[y * kSize + x] = (a << 24) | (b << 16) | (g << 8) | r;
+        }
+    }
+    memset(pixels, 0x5a, kSize * kSize * sizeof(uint32_t));
+
+    GGLSurface cb;
+    memset(&cb, 0, sizeof(cb));
+    cb.version = sizeof(cb);
+    cb.width = kSize;
+    cb.height = kSize;
+    cb.stride = kSize;
+    cb.data = reinterpret_cast<GGLubyte*>(pixels);
+    GGLSurface tex = cb;
+    tex.data = reinterpret_cast<GGLubyte*>(texels);
+    tex.format = GGL_PIXEL_FORMAT_RGBA_8888;
+
+    GGLContext* c;
+    gglInit(&c);
+    context_t* ctx = reinterpret_cast<context_t*>(c);
+
+    static const int kFormats[] = { GGL_PIXEL_FORMAT_RGB_565, GGL_PIXEL_FORMAT_RGBA_8888 };
+    static const int kSizes[] = { 8, 64, 512 };
+
+    printf("%-46s %4s %4s", "case", "size", "prim");
+    for (size_t p = 0; p < kPathCount; p++) {
+        printf(" %10s", kPaths[p].name);
+    }
+    printf("   (Mpixels/s)\n");
+
+    for (size_t f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); f++)
+    for (int texturing = NO_TEXTURE; texturing <= SCALED_LINEAR; texturing++)
+    for (int modulate = 0; modulate < (texturing == NO_TEXTURE ? 1 : 2); modulate++)
+    for (int blend = 0; blend < 2; blend++)
+    for (int dither = 0; dither < (kFormats[f] == GGL_PIXEL_FORMAT_RGB_565 ? 2 : 1); dither++) {
+        const Case t = { kFormats[f], Texturing(texturing), modulate != 0, blend != 0,
+                         dither != 0 };
+        char name[64];
+        describe(t, name, sizeof(name));
+        if (filter != NULL && strstr(name, filter) == NULL) {
+            continue;
+        }
+        setup(c, t, &cb, &tex);
+
+        for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); s++)
+        for (int triangles = 0; triangles < 2; triangles++) {
+            printf("%-46s %4d %4s", name, kSizes[s], triangles ? "tri" : "rect");
+            void (*generic)(context_t*) = NULL;
+            for (size_t p = 0; p < kPathCount; p++) {
+                // Draws once to validate the state before picking.
+                ggl_set_scanline_paths(ctx, GGL_SCANLINE_ALL);
+                draw(c, kSizes[s], triangles, 0);
+                ggl_set_scanline_paths(ctx, kPaths[p].paths);
+                if (p == 0) {
+                    generic = ctx->scanline;
+                } else if (ctx->scanline == generic) {
+                    printf(" %10s", "-");
+                    continue;
+                }
+                printf(" %10.1f", measure(c, kSizes[s], triangles, budget));
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+    }
+
+    ggl_set_scanline_paths(ctx, GGL_SCANLINE_ALL);
+    gglUninit(c);
+    delete[] pixels;
+    delete[] texels;
+    return 0;
+}
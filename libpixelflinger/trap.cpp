@@ -16,14 +16,17 @@
 */
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "trap.h"
 #include "picker.h"
 
 #include <cutils/log.h>
 #include <cutils/memory.h>
+#include <utils/ThreadPool.h>
 
 namespace android {
 
@@ -32,6 +35,11 @@ namespace android {
 // enable to see triangles edges
 #define DEBUG_TRANGLES  0
 
+// with GGL_TILED, primitives are cut into bands of this many scanlines...
+#define TILE_ROWS       32
+// ...if they have at least two bands and cover at least this many pixels
+#define TILE_MIN_PIXELS (128*128)
+
 // ----------------------------------------------------------------------------
 
 static void pointx_validate(void *con, const GGLcoord* c, GGLcoord r);
@@ -402,6 +410,56 @@ static void aa_linex(void *con, const GGLcoord* v0, const GGLcoord* v1, GGLcoord
 }
 
 
+// ----------------------------------------------------------------------------
+#if 0
+#pragma mark -
+#pragma mark Tiles
+#endif
+
+/*
+ * With GGL_TILED enabled, the scanlines of large rectangles and triangles
+ * are split in bands of TILE_ROWS rows, which the workers of a process-wide
+ * pool and the calling thread rasterize concurrently.  Each band works on
+ * its own copy of the context, initialized for its first row with init_y(),
+ * so the iterators and the generated scanline's variables are never shared;
+ * the bands write disjoint rows of the buffers.
+ */
+
+static pthread_once_t gTilePoolOnce = PTHREAD_ONCE_INIT;
+static ThreadPool* gTilePool;
+
+static void tile_pool_init()
+{
+    gTilePool = new ThreadPool("pixelflinger");
+}
+
+static ThreadPool* tile_pool(context_t* c, int rows, int columns)
+{
+    if (ggl_likely(!(c->state.enables & GGL_ENABLE_TILED)))
+        return 0;
+    if (rows < 2*TILE_ROWS || rows*columns < TILE_MIN_PIXELS)
+        return 0;
+    pthread_once(&gTilePoolOnce, tile_pool_init);
+    return gTilePool->getThreadCount() > 1 ? gTilePool : 0;
+}
+
+static void tile_init(context_t* band, const context_t* c, int32_t y)
+{
+    memcpy(band, c, sizeof(context_t));
+    band->activeTMU = &band->state.texture[c->activeTMUIndex];
+    band->init_y(band, y);
+}
+
+struct rect_tiles {
+    context_t*  c;
+    int32_t     top;
+    void operator()(size_t begin, size_t end) const {
+        context_t band;
+        tile_init(&band, c, top + int32_t(begin));
+        band.rect(&band, end - begin);
+    }
+};
+
 // ----------------------------------------------------------------------------
 #if 0
 #pragma mark -
@@ -436,7 +494,13 @@ void recti(void* con, GGLint l, GGLint t, GGLint r, GGLint b)
         c->iterators.xl = l;
         c->iterators.xr = r;
         c->init_y(c, t);
-        c->rect(c, yc);
+        ThreadPool* pool = tile_pool(c, yc, xc);
+        if (ggl_unlikely(pool)) {
+            rect_tiles tiles = { c, t };
+            pool->parallelFor(0, yc, TILE_ROWS, tiles);
+        } else {
+            c->rect(c, yc);
+        }
     }
 }
 
@@ -715,6 +779,48 @@ void edge_setup(
 }
 
 
+static void
+sweep_spans( context_t*  c,
+             int         left_x,
+             int         left_xi,
+             int         right_x,
+             int         right_xi,
+             int         count )
+{
+	const int xmin = c->state.scissor.left;
+	const int xmax = c->state.scissor.right;
+    do {
+        // horizontal scissoring
+        const int32_t xl = max(left_x  >> TRI_ITERATORS_BITS, xmin);
+        const int32_t xr = min(right_x >> TRI_ITERATORS_BITS, xmax);
+        left_x  += left_xi;
+        right_x += right_xi;
+        // invoke the scanline rasterizer
+        if (ggl_likely(xl < xr)) {
+            c->iterators.xl = xl;
+            c->iterators.xr = xr;
+            c->scanline(c);
+        }
+		c->step_y(c);
+	} while (--count);
+}
+
+struct span_tiles {
+    context_t*  c;
+    int32_t     top;
+    int         left_x;
+    int         left_xi;
+    int         right_x;
+    int         right_xi;
+    void operator()(size_t begin, size_t end) const {
+        context_t band;
+        const int rows = int(begin);
+        tile_init(&band, c, top + rows);
+        sweep_spans(&band, left_x + left_xi * rows, left_xi,
+                right_x + right_xi * rows, right_xi, int(end - begin));
+    }
+};
+
 static void
 triangle_sweep_edges( Edge*  left,
                       Edge*  right,
@@ -738,22 +844,19 @@ triangle_sweep_edges( Edge*  left,
     left->x  += left_xi * count;
     right->x += right_xi * count;
 
-	const int xmin = c->state.scissor.left;
-	const int xmax = c->state.scissor.right;
-    do {
-        // horizontal scissoring
-        const int32_t xl = max(left_x  >> TRI_ITERATORS_BITS, xmin);
-        const int32_t xr = min(right_x >> TRI_ITERATORS_BITS, xmax);
-        left_x  += left_xi;
-        right_x += right_xi;
-        // invoke the scanline rasterizer
-        if (ggl_likely(xl < xr)) {
-            c->iterators.xl = xl;
-            c->iterators.xr = xr;
-            c->scanline(c);
-        }
-		c->step_y(c);
-	} while (--count);
+    // estimate the area from the width half way down
+    const int width = ((right_x + right->x) - (left_x + left->x)) >> (TRI_ITERATORS_BITS + 1);
+    ThreadPool* pool = tile_pool(c, count, width);
+    if (ggl_unlikely(pool)) {
+        const int32_t top = c->iterators.y;
+        span_tiles tiles = { c, top, left_x, left_xi, right_x, right_xi };
+        pool->parallelFor(0, count, TILE_ROWS, tiles);
+        // leave c where the sweep would have, for the next one
+        c->init_y(c, top + count);
+        return;
+    }
+
+    sweep_spans(c, left_x, left_xi, right_x, right_xi, count);
 }
 
 
@@ -17,7 +17,6 @@
 //#define LOG_NDEBUG 0
 #define LOG_TAG "libprocessgroup"
 
-#include <assert.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -26,7 +25,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 
 #include <log/log.h>
@@ -37,13 +39,20 @@
 #include <processgroup/processgroup.h>
 #include "processgroup_priv.h"
 
-struct ctx {
-    bool initialized;
-    int fd;
-    char buf[128];
-    char *buf_ptr;
-    size_t buf_len;
-};
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+#ifndef __NR_pidfd_send_signal
+#define __NR_pidfd_send_signal 424
+#endif
+
+// How long killProcessGroup waits for the group to empty before giving up.
+#define KILL_TIMEOUT_MS 200
+// How many processes of a group we hold a pidfd for while waiting.
+#define MAX_WAIT_PIDFDS 64
+
+// How many threads removeAllProcessGroups uses to remove stale groups.
+#define REMOVE_THREADS 4
 
 static int convertUidToPath(char *path, size_t size, uid_t uid)
 {
@@ -63,87 +72,81 @@ static int convertUidPidToPath(char *path, size_t size, uid_t uid, int pid)
             pid);
 }
 
-static int initCtx(uid_t uid, int pid, struct ctx *ctx)
+// Reads the whole cgroup.procs of a process group and returns the number of
+// pids in it, or -errno.  On success *pids points to an array that the caller
+// frees.  Parsing stops at the first malformed line.
+static int getProcessGroupPids(uid_t uid, int initialPid, pid_t **pids)
 {
     int ret;
     char path[PROCESSGROUP_MAX_PATH_LEN] = {0};
-    convertUidPidToPath(path, sizeof(path), uid, pid);
+    convertUidPidToPath(path, sizeof(path), uid, initialPid);
     strlcat(path, PROCESSGROUP_CGROUP_PROCS_FILE, sizeof(path));
 
-    int fd = open(path, O_RDONLY);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         ret = -errno;
         SLOGW("failed to open %s: %s", path, strerror(errno));
         return ret;
     }
 
-    ctx->fd = fd;
-    ctx->buf_ptr = ctx->buf;
-    ctx->buf_len = 0;
-    ctx->initialized = true;
-
-    SLOGV("Initialized context for %s", path);
-
-    return 0;
-}
-
-static int refillBuffer(struct ctx *ctx)
-{
-    memmove(ctx->buf, ctx->buf_ptr, ctx->buf_len);
-    ctx->buf_ptr = ctx->buf;
-
-    ssize_t ret = read(ctx->fd, ctx->buf_ptr + ctx->buf_len,
-                sizeof(ctx->buf) - ctx->buf_len - 1);
-    if (ret < 0) {
-        return -errno;
-    } else if (ret == 0) {
-        return 0;
-    }
-
-    ctx->buf_len += ret;
-    ctx->buf[ctx->buf_len] = 0;
-    SLOGV("Read %zd to buffer: %s", ret, ctx->buf);
-
-    assert(ctx->buf_len <= sizeof(ctx->buf));
-
-    return ret;
-}
-
-static pid_t getOneAppProcess(uid_t uid, int appProcessPid, struct ctx *ctx)
-{
-    if (!ctx->initialized) {
-        int ret = initCtx(uid, appProcessPid, ctx);
-        if (ret < 0) {
+    size_t size = 4096;
+    size_t len = 0;
+    char *buf = (char *)malloc(size);
+    for (;;) {
+        if (buf == NULL) {
+            close(fd);
+            return -ENOMEM;
+        }
+        ssize_t n = TEMP_FAILURE_RETRY(read(fd, buf + len, size - len - 1));
+        if (n < 0) {
+            ret = -errno;
+            free(buf);
+            close(fd);
             return ret;
         }
-    }
-
-    char *eptr;
-    while ((eptr = (char *)memchr(ctx->buf_ptr, '\n', ctx->buf_len)) == NULL) {
-        int ret = refillBuffer(ctx);
-        if (ret == 0) {
-            return -ERANGE;
+        if (n == 0) {
+            break;
         }
-        if (ret < 0) {
-            return ret;
+        len += n;
+        if (size - len - 1 == 0) {
+            size *= 2;
+            char *bigger = (char *)realloc(buf, size);
+            if (bigger == NULL) {
+                free(buf);
+            }
+            buf = bigger;
         }
     }
+    close(fd);
+    buf[len] = '\0';
 
-    *eptr = '\0';
-    char *pid_eptr = NULL;
-    errno = 0;
-    long pid = strtol(ctx->buf_ptr, &pid_eptr, 10);
-    if (errno != 0) {
-        return -errno;
+    // Every pid takes at least two bytes.
+    *pids = (pid_t *)malloc((len / 2 + 1) * sizeof(pid_t));
+    if (*pids == NULL) {
+        free(buf);
+        return -ENOMEM;
     }
-    if (pid_eptr != eptr) {
-        return -EINVAL;
+
+    int count = 0;
+    char *ptr = buf;
+    char *eptr;
+    while ((eptr = strchr(ptr, '\n')) != NULL) {
+        *eptr = '\0';
+        char *pid_eptr = NULL;
+        errno = 0;
+        long pid = strtol(ptr, &pid_eptr, 10);
+        if (errno != 0 || pid_eptr != eptr) {
+            SLOGW("malformed line in %s: '%s'", path, ptr);
+            break;
+        }
+        (*pids)[count++] = (pid_t)pid;
+        ptr = eptr + 1;
     }
+    free(buf);
 
-    ctx->buf_len -= (eptr - ctx->buf_ptr) + 1;
-    ctx->buf_ptr = eptr + 1;
+    SLOGV("Read %d pids from %s", count, path);
 
-    return (pid_t)pid;
+    return count;
 }
 
 static int removeProcessGroup(uid_t uid, int pid)
@@ -185,43 +188,115 @@ static void removeUidProcessGroups(const char *uid_path)
     }
 }
 
+// The uid directories of /acct, shared by the removeAllProcessGroups threads.
+struct removeCtx {
+    pthread_mutex_t lock;
+    DIR *root;
+};
+
+static void *removeProcessGroupsThread(void *arg)
+{
+    struct removeCtx *ctx = (struct removeCtx *)arg;
+    for (;;) {
+        struct dirent cur;
+        struct dirent *dir;
+        char path[PROCESSGROUP_MAX_PATH_LEN];
+
+        pthread_mutex_lock(&ctx->lock);
+        if (readdir_r(ctx->root, &cur, &dir) != 0) {
+            dir = NULL;
+        }
+        pthread_mutex_unlock(&ctx->lock);
+        if (dir == NULL) {
+            break;
+        }
+
+        if (dir->d_type != DT_DIR) {
+            continue;
+        }
+        if (strncmp(dir->d_name, PROCESSGROUP_UID_PREFIX, strlen(PROCESSGROUP_UID_PREFIX))) {
+            continue;
+        }
+
+        // Each rmdir of a cgroup waits for the kernel to tear it down, so
+        // the uid directories are removed by several threads at once.
+        snprintf(path, sizeof(path), "%s/%s", PROCESSGROUP_CGROUP_PATH, dir->d_name);
+        removeUidProcessGroups(path);
+        SLOGV("removing %s\n", path);
+        rmdir(path);
+    }
+    return NULL;
+}
+
 void removeAllProcessGroups()
 {
     SLOGV("removeAllProcessGroups()");
-    DIR *root = opendir(PROCESSGROUP_CGROUP_PATH);
-    if (root == NULL) {
+    struct removeCtx ctx;
+    ctx.root = opendir(PROCESSGROUP_CGROUP_PATH);
+    if (ctx.root == NULL) {
         SLOGE("failed to open %s: %s", PROCESSGROUP_CGROUP_PATH, strerror(errno));
     } else {
-        struct dirent cur;
-        struct dirent *dir;
-        while ((readdir_r(root, &cur, &dir) == 0) && dir) {
-            char path[PROCESSGROUP_MAX_PATH_LEN];
-
-            if (dir->d_type != DT_DIR) {
-                continue;
-            }
-            if (strncmp(dir->d_name, PROCESSGROUP_UID_PREFIX, strlen(PROCESSGROUP_UID_PREFIX))) {
-                continue;
+        pthread_mutex_init(&ctx.lock, NULL);
+        pthread_t threads[REMOVE_THREADS - 1];
+        int started = 0;
+        for (int i = 0; i < REMOVE_THREADS - 1; i++) {
+            if (pthread_create(&threads[started], NULL, removeProcessGroupsThread, &ctx) == 0) {
+                started++;
             }
-
-            snprintf(path, sizeof(path), "%s/%s", PROCESSGROUP_CGROUP_PATH, dir->d_name);
-            removeUidProcessGroups(path);
-            SLOGV("removing %s\n", path);
-            rmdir(path);
         }
-        closedir(root);
+        removeProcessGroupsThread(&ctx);
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&ctx.lock);
+        closedir(ctx.root);
     }
 }
 
-static int killProcessGroupOnce(uid_t uid, int initialPid, int signal)
+// The pidfds of the processes signalled by the last killProcessGroupOnce.
+struct waiter {
+    struct pollfd fds[MAX_WAIT_PIDFDS];
+    int count;
+    bool overflowed;
+};
+
+static bool pidfdSupported = true;
+
+// Returns a pidfd for pid, or -1 if the kernel has none or pid is gone.
+static int openPidfd(pid_t pid)
 {
-    int processes = 0;
-    struct ctx ctx;
-    pid_t pid;
+    if (!pidfdSupported) {
+        return -1;
+    }
+    int fd = syscall(__NR_pidfd_open, pid, 0);
+    if (fd < 0 && (errno == ENOSYS || errno == EPERM)) {
+        // Older kernel, or a seccomp policy that does not know the call.
+        pidfdSupported = false;
+    }
+    return fd;
+}
 
-    ctx.initialized = false;
+static void closeWaiter(struct waiter *waiter)
+{
+    for (int i = 0; i < waiter->count; i++) {
+        int fd = waiter->fds[i].fd;
+        close(fd < 0 ? ~fd : fd);
+    }
+    waiter->count = 0;
+    waiter->overflowed = false;
+}
+
+static int killProcessGroupOnce(uid_t uid, int initialPid, int signal, struct waiter *waiter)
+{
+    pid_t *pids;
+    int count = getProcessGroupPids(uid, initialPid, &pids);
+    if (count < 0) {
+        return 0;
+    }
 
-    while ((pid = getOneAppProcess(uid, initialPid, &ctx)) >= 0) {
+    int processes = 0;
+    for (int i = 0; i < count; i++) {
+        pid_t pid = pids[i];
         processes++;
         if (pid == 0) {
             // Should never happen...  but if it does, trying to kill this
@@ -236,37 +311,98 @@ static int killProcessGroupOnce(uid_t uid, int initialPid, int signal)
             // logged elsewhere about killing it.
             SLOGI("Killing pid %d in uid %d as part of process group %d", pid, uid, initialPid);
         }
-        int ret = kill(pid, signal);
+
+        // Signalling through a pidfd cannot hit a recycled pid, and the same
+        // fd then tells us when the process is gone.
+        int ret;
+        int pidfd = openPidfd(pid);
+        if (pidfd >= 0) {
+            ret = syscall(__NR_pidfd_send_signal, pidfd, signal, NULL, 0);
+            if (waiter->count < MAX_WAIT_PIDFDS) {
+                waiter->fds[waiter->count].fd = pidfd;
+                waiter->fds[waiter->count].events = POLLIN;
+                waiter->count++;
+            } else {
+                close(pidfd);
+                waiter->overflowed = true;
+            }
+        } else if (pidfdSupported && errno == ESRCH) {
+            // Already reaped since we read cgroup.procs.
+            processes--;
+            continue;
+        } else {
+            ret = kill(pid, signal);
+            waiter->overflowed = true;
+        }
         if (ret == -1) {
             SLOGW("failed to kill pid %d: %s", pid, strerror(errno));
         }
     }
 
-    if (ctx.initialized) {
-        close(ctx.fd);
+    free(pids);
+    return processes;
+}
+
+// Waits at most timeoutMs for the processes signalled by the last
+// killProcessGroupOnce to exit.  Without a pidfd for each of them, or if
+// none of them is still running, it just sleeps a little before the
+// caller reads cgroup.procs again.
+static void waitForProcesses(struct waiter *waiter, int64_t timeoutMs)
+{
+    const int64_t sleep_us = 1000;  // 1ms
+    bool waited = false;
+
+    if (!waiter->overflowed && waiter->count > 0 &&
+            poll(waiter->fds, waiter->count, 0) < waiter->count) {
+        int64_t deadline = android::uptimeMillis() + timeoutMs;
+        int running = waiter->count;
+        while (running > 0) {
+            int64_t left = deadline - android::uptimeMillis();
+            if (left <= 0) {
+                break;
+            }
+            int ret = poll(waiter->fds, waiter->count, (int)left);
+            if (ret < 0 && errno != EINTR) {
+                break;
+            }
+            for (int i = 0; ret > 0 && i < waiter->count; i++) {
+                if (waiter->fds[i].revents) {
+                    // poll skips negative fds; closeWaiter undoes this.
+                    waiter->fds[i].fd = ~waiter->fds[i].fd;
+                    running--;
+                }
+            }
+        }
+        waited = true;
     }
 
-    return processes;
+    closeWaiter(waiter);
+    if (!waited) {
+        usleep(sleep_us < timeoutMs * 1000 ? sleep_us : timeoutMs * 1000);
+    }
 }
 
 int killProcessGroup(uid_t uid, int initialPid, int signal)
 {
     int processes;
-    const int sleep_us = 5 * 1000;  // 5ms
+    struct waiter waiter;
     int64_t startTime = android::uptimeMillis();
-    int retry = 40;
 
-    while ((processes = killProcessGroupOnce(uid, initialPid, signal)) > 0) {
+    waiter.count = 0;
+    waiter.overflowed = false;
+
+    while ((processes = killProcessGroupOnce(uid, initialPid, signal, &waiter)) > 0) {
         SLOGV("killed %d processes for processgroup %d\n", processes, initialPid);
-        if (retry > 0) {
-            usleep(sleep_us);
-            --retry;
+        int64_t left = startTime + KILL_TIMEOUT_MS - android::uptimeMillis();
+        if (left > 0) {
+            waitForProcesses(&waiter, left);
         } else {
             SLOGE("failed to kill %d processes for processgroup %d\n",
                     processes, initialPid);
             break;
         }
     }
+    closeWaiter(&waiter);
 
     SLOGV("Killed process group uid %d pid %d in %" PRId64 "ms, %d procs remain", uid, initialPid,
             android::uptimeMillis()-startTime, processes);
@@ -10,6 +10,12 @@ libsparse_src_files := \
         sparse_err.c \
         sparse_read.c
 
+# Raw images are read on several threads.
+libsparse_host_ldlibs :=
+ifneq ($(HOST_OS),windows)
+libsparse_host_ldlibs := -lpthread
+endif
+
 
 include $(CLEAR_VARS)
 LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)/include
@@ -51,6 +57,7 @@ LOCAL_MODULE_STEM := simg2img
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS := $(libsparse_host_ldlibs)
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
 
@@ -74,6 +81,7 @@ LOCAL_MODULE_STEM := img2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS := $(libsparse_host_ldlibs)
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
 
@@ -96,11 +104,24 @@ LOCAL_MODULE := append2simg
 LOCAL_STATIC_LIBRARIES := \
     libsparse_host \
     libz
+LOCAL_LDLIBS := $(libsparse_host_ldlibs)
 LOCAL_CFLAGS := -Werror
 include $(BUILD_HOST_EXECUTABLE)
 
 endif
 
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := sparse_crc32_benchmark.c
+LOCAL_MODULE := sparse_crc32_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_STATIC_LIBRARIES := libsparse_host
+LOCAL_CFLAGS := -Werror
+LOCAL_LDLIBS := $(libsparse_host_ldlibs)
+ifneq ($(HOST_OS),darwin)
+LOCAL_LDLIBS += -lrt
+endif
+include $(BUILD_HOST_EXECUTABLE)
+
 include $(CLEAR_VARS)
 LOCAL_MODULE := simg_dump.py
 LOCAL_SRC_FILES := simg_dump.py
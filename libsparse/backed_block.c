@@ -16,6 +16,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +24,13 @@
 #include "backed_block.h"
 #include "sparse_defs.h"
 
+/* The list is also a skip list, so that blocks added out of order, as
+ * make_ext4fs does, are found in O(log n) rather than by walking it. next
+ * is the bottom level, which is all the iterators and most of the code
+ * here see. A block is on each level above with a chance of one in four.
+ */
+#define SKIP_LEVELS 12
+
 struct backed_block {
 	unsigned int block;
 	unsigned int len;
@@ -44,14 +52,116 @@ struct backed_block {
 		} fill;
 	};
 	struct backed_block *next;
+	struct backed_block *skip[SKIP_LEVELS - 1];	/* levels above next */
+	int height;
 };
 
 struct backed_block_list {
 	struct backed_block *data_blocks;
-	struct backed_block *last_used;
+	struct backed_block *skip[SKIP_LEVELS - 1];
+	int levels;
+	uint32_t random;
 	unsigned int block_size;
 };
 
+/* The link from bb on a level, or from the head of the list for NULL */
+static struct backed_block **skip_link(struct backed_block_list *bbl,
+		struct backed_block *bb, int level)
+{
+	if (bb == NULL) {
+		return level ? &bbl->skip[level - 1] : &bbl->data_blocks;
+	}
+	return level ? &bb->skip[level - 1] : &bb->next;
+}
+
+static int skip_height(struct backed_block_list *bbl)
+{
+	int height = 1;
+
+	/* xorshift32, which need not be good, only cheap and deterministic */
+	bbl->random ^= bbl->random << 13;
+	bbl->random ^= bbl->random >> 17;
+	bbl->random ^= bbl->random << 5;
+	while (height < SKIP_LEVELS && (bbl->random >> (2 * height)) % 4 == 0) {
+		height++;
+	}
+	return height;
+}
+
+/* Finds on each level the last block before block, NULL for the head */
+static void skip_find(struct backed_block_list *bbl, unsigned int block,
+		struct backed_block **preds)
+{
+	struct backed_block *pred = NULL;
+	struct backed_block *next;
+	int level;
+
+	for (level = bbl->levels - 1; level >= 0; level--) {
+		while ((next = *skip_link(bbl, pred, level)) && next->block < block) {
+			pred = next;
+		}
+		preds[level] = pred;
+	}
+}
+
+/* Links bb in after preds, as found for its block by skip_find() */
+static void skip_insert(struct backed_block_list *bbl, struct backed_block *bb,
+		struct backed_block **preds)
+{
+	int level;
+
+	bb->height = skip_height(bbl);
+	for (; bbl->levels < bb->height; bbl->levels++) {
+		preds[bbl->levels] = NULL;
+	}
+	for (level = 0; level < bb->height; level++) {
+		*skip_link(bbl, bb, level) = *skip_link(bbl, preds[level], level);
+		*skip_link(bbl, preds[level], level) = bb;
+	}
+}
+
+static void skip_remove(struct backed_block_list *bbl, struct backed_block *bb)
+{
+	struct backed_block *preds[SKIP_LEVELS];
+	struct backed_block *pred;
+	int level;
+
+	skip_find(bbl, bb->block, preds);
+	for (level = 0; level < bb->height; level++) {
+		/* Past any others starting at the same block */
+		for (pred = preds[level]; *skip_link(bbl, pred, level) != bb;
+				pred = *skip_link(bbl, pred, level))
+			;
+		*skip_link(bbl, pred, level) = *skip_link(bbl, bb, level);
+	}
+}
+
+/* Relinks the levels above next, after blocks were moved on that level */
+static void skip_rebuild(struct backed_block_list *bbl)
+{
+	struct backed_block *last[SKIP_LEVELS];
+	struct backed_block *bb;
+	int level;
+
+	for (level = 1; level < SKIP_LEVELS; level++) {
+		last[level] = NULL;
+		*skip_link(bbl, NULL, level) = NULL;
+	}
+	bbl->levels = 1;
+
+	for (bb = bbl->data_blocks; bb; bb = bb->next) {
+		bb->height = skip_height(bbl);
+		if (bb->height > bbl->levels) {
+			bbl->levels = bb->height;
+		}
+		for (level = 1; level < bb->height; level++) {
+			*skip_link(bbl, bb, level) = NULL;
+			*skip_link(bbl, last[level], level) = bb;
+			last[level] = bb;
+		}
+	}
+}
+
 struct backed_block *backed_block_iter_new(struct backed_block_list *bbl)
 {
 	return bbl->data_blocks;
@@ -123,7 +233,12 @@ void backed_block_destroy(struct backed_block *bb)
 struct backed_block_list *backed_block_list_new(unsigned int block_size)
 {
 	struct backed_block_list *b = calloc(sizeof(struct backed_block_list), 1);
+	if (b == NULL) {
+		return NULL;
+	}
 	b->block_size = block_size;
+	b->levels = 1;
+	b->random = 2463534242U;
 	return b;
 }
 
@@ -160,8 +275,6 @@ void backed_block_list_move(struct backed_block_list *from,
 		return;
 	}
 
-	from->last_used = NULL;
-	to->last_used = NULL;
 	if (from->data_blocks == start) {
 		from->data_blocks = end->next;
 	} else {
@@ -185,6 +298,9 @@ void backed_block_list_move(struct backed_block_list *from,
 			}
 		}
 	}
+
+	skip_rebuild(from);
+	skip_rebuild(to);
 }
 
 /* may free b */
@@ -211,6 +327,11 @@ static int merge_bb(struct backed_block_list *bbl,
 		return -EINVAL;
 	}
 
+	/* The merged length would not fit, as with images of 4GB or more */
+	if (a->len > UINT_MAX - b->len) {
+		return -EINVAL;
+	}
+
 	switch (a->type) {
 	case BACKED_BLOCK_DATA:
 		/* Don't support merging data for now */
@@ -237,7 +358,7 @@ static int merge_bb(struct backed_block_list *bbl,
 	/* Blocks are compatible and adjacent, with a before b.  Merge b into a,
 	 * and free b */
 	a->len += b->len;
-	a->next = b->next;
+	skip_remove(bbl, b);
 
 	backed_block_destroy(b);
 
@@ -246,40 +367,13 @@ static int merge_bb(struct backed_block_list *bbl,
 
 static int queue_bb(struct backed_block_list *bbl, struct backed_block *new_bb)
 {
-	struct backed_block *bb;
+	struct backed_block *preds[SKIP_LEVELS];
 
-	if (bbl->data_blocks == NULL) {
-		bbl->data_blocks = new_bb;
-		return 0;
-	}
-
-	if (bbl->data_blocks->block > new_bb->block) {
-		new_bb->next = bbl->data_blocks;
-		bbl->data_blocks = new_bb;
-		return 0;
-	}
-
-	/* Optimization: blocks are mostly queued in sequence, so save the
-	   pointer to the last bb that was added, and start searching from
-	   there if the next block number is higher */
-	if (bbl->last_used && new_bb->block > bbl->last_used->block)
-		bb = bbl->last_used;
-	else
-		bb = bbl->data_blocks;
-	bbl->last_used = new_bb;
-
-	for (; bb->next && bb->next->block < new_bb->block; bb = bb->next)
-		;
-
-	if (bb->next == NULL) {
-		bb->next = new_bb;
-	} else {
-		new_bb->next = bb->next;
-		bb->next = new_bb;
-	}
+	skip_find(bbl, new_bb->block, preds);
+	skip_insert(bbl, new_bb, preds);
 
 	merge_bb(bbl, new_bb, new_bb->next);
-	merge_bb(bbl, bb, new_bb);
+	merge_bb(bbl, preds[0], new_bb);
 
 	return 0;
 }
@@ -362,6 +456,7 @@ int backed_block_split(struct backed_block_list *bbl, struct backed_block *bb,
 		unsigned int max_len)
 {
 	struct backed_block *new_bb;
+	struct backed_block *preds[SKIP_LEVELS];
 
 	max_len = ALIGN_DOWN(max_len, bbl->block_size);
 
@@ -378,8 +473,8 @@ int backed_block_split(struct backed_block_list *bbl, struct backed_block *bb,
 
 	new_bb->len = bb->len - max_len;
 	new_bb->block = bb->block + max_len / bbl->block_size;
-	new_bb->next = bb->next;
-	bb->next = new_bb;
+	skip_find(bbl, new_bb->block, preds);
+	skip_insert(bbl, new_bb, preds);
 	bb->len = max_len;
 
 	switch (bb->type) {
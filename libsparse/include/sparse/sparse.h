@@ -246,6 +246,27 @@ struct sparse_file *sparse_file_import(int fd, bool verbose, bool crc);
  */
 struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose);
 
+/**
+ * sparse_file_stream - expand a sparse file as it is read
+ *
+ * @fd - file descriptor to read from, which need not be seekable
+ * @verbose - print verbose errors while reading the sparse file
+ * @crc - verify the crc of the sparse file
+ * @write - function to call for each part of the expanded file
+ * @priv - value that will be passed as the first argument to write
+ *
+ * Reads a file in the Android sparse file format from a pipe or socket as
+ * well as a file, and calls write with each part of the expanded file in
+ * order as soon as it is read, with data==NULL to skip over a region that
+ * the sparse file does not care about.  Nothing is kept in memory but the
+ * part being passed on, and the crc, if any, is only checked at the end.
+ * The callback should return negative on error, 0 on success.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_stream(int fd, bool verbose, bool crc,
+		int (*write)(void *priv, const void *data, int len), void *priv);
+
 /** sparse_file_resparse - rechunk an existing sparse file into smaller files
  *
  * @in_s - sparse file cookie of the existing sparse file
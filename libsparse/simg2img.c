@@ -14,8 +14,12 @@
  * limitations under the License.
  */
 
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE 1
+
 #include <sparse/sparse.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -30,9 +34,41 @@
 #define O_BINARY 0
 #endif
 
+#if defined(__APPLE__) && defined(__MACH__)
+#define lseek64 lseek
+#define ftruncate64 ftruncate
+#define off64_t off_t
+#endif
+
 void usage()
 {
   fprintf(stderr, "Usage: simg2img <sparse_image_files> <raw_image_file>\n");
+  fprintf(stderr, "       a sparse image file of - is read from stdin\n");
+}
+
+/* The sparse images are expanded as they are read, so that they can come
+ * from a pipe, and written out over each other.
+ */
+static int write_out(void *priv, const void *data, int len)
+{
+	int out = *(int *)priv;
+	const char *ptr = data;
+
+	if (!data) {
+		return lseek64(out, len, SEEK_CUR) < 0 ? -errno : 0;
+	}
+	while (len > 0) {
+		ssize_t ret = write(out, ptr, len);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -errno;
+		}
+		ptr += ret;
+		len -= ret;
+	}
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -41,7 +77,7 @@ int main(int argc, char *argv[])
 	int out;
 	int i;
 	int ret;
-	struct sparse_file *s;
+	off64_t len;
 
 	if (argc < 3) {
 		usage();
@@ -65,20 +101,20 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		s = sparse_file_import(in, true, false);
-		if (!s) {
-			fprintf(stderr, "Failed to read sparse file\n");
+		lseek64(out, 0, SEEK_SET);
+
+		ret = sparse_file_stream(in, true, false, write_out, &out);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to expand sparse file %s\n", argv[i]);
 			exit(-1);
 		}
 
-		lseek(out, SEEK_SET, 0);
-
-		ret = sparse_file_write(s, out, false, false, false);
-		if (ret < 0) {
+		/* A don't care region at the end still counts in the length. */
+		len = lseek64(out, 0, SEEK_CUR);
+		if (len < 0 || ftruncate64(out, len) < 0) {
 			fprintf(stderr, "Cannot write output file\n");
 			exit(-1);
 		}
-		sparse_file_destroy(s);
 		close(in);
 	}
 
@@ -86,4 +122,3 @@ int main(int argc, char *argv[])
 
 	exit(0);
 }
-
@@ -43,9 +43,29 @@
  */
 
 /* Code taken from FreeBSD 8 */
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
-static uint32_t crc32_tab[] = {
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#define CRC32_PCLMUL 1
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#define CRC32_ARM64 1
+#endif
+
+#include "sparse_crc32.h"
+
+static const uint32_t crc32_tab[] = {
         0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
         0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
         0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
@@ -92,20 +112,274 @@ static uint32_t crc32_tab[] = {
 };
 
 /*
- * A function that calculates the CRC-32 based on the table above is
- * given below for documentation purposes. An equivalent implementation
- * of this function that's actually used in the kernel can be found
- * in sys/libkern.h, where it can be inlined.
+ * The implementations below all work on the CRC as the table loop keeps
+ * it, inverted, and must give the same results as crc32_bytes(). Which
+ * one sparse_crc32() uses is picked once, when the library is loaded.
  */
 
-uint32_t sparse_crc32(uint32_t crc_in, const void *buf, int size)
+static uint32_t crc32_bytes(uint32_t crc, const uint8_t *p, size_t size)
 {
-        const uint8_t *p = buf;
-        uint32_t crc;
-
-        crc = crc_in ^ ~0U;
         while (size--)
                 crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-        return crc ^ ~0U;
+        return crc;
 }
 
+/*
+ * Slicing-by-8: crc32_tab8[k][n] is the CRC of byte n followed by k zero
+ * bytes, so that eight bytes are folded in with eight lookups.
+ */
+static uint32_t crc32_tab8[8][256];
+
+static void crc32_tab8_init(void)
+{
+        int n, k;
+
+        for (n = 0; n < 256; n++) {
+                uint32_t crc = crc32_tab[n];
+                crc32_tab8[0][n] = crc;
+                for (k = 1; k < 8; k++) {
+                        crc = crc32_tab[crc & 0xFF] ^ (crc >> 8);
+                        crc32_tab8[k][n] = crc;
+                }
+        }
+}
+
+static inline uint32_t load32le(const uint8_t *p)
+{
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+        while (size >= 8) {
+                uint32_t lo = load32le(p) ^ crc;
+                uint32_t hi = load32le(p + 4);
+                crc = crc32_tab8[7][lo & 0xFF] ^
+                      crc32_tab8[6][(lo >> 8) & 0xFF] ^
+                      crc32_tab8[5][(lo >> 16) & 0xFF] ^
+                      crc32_tab8[4][lo >> 24] ^
+                      crc32_tab8[3][hi & 0xFF] ^
+                      crc32_tab8[2][(hi >> 8) & 0xFF] ^
+                      crc32_tab8[1][(hi >> 16) & 0xFF] ^
+                      crc32_tab8[0][hi >> 24];
+                p += 8;
+                size -= 8;
+        }
+        return crc32_bytes(crc, p, size);
+}
+
+#ifdef CRC32_PCLMUL
+/*
+ * Folding with carry-less multiplies, from "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009): four
+ * 128 bit lanes are folded 64 bytes at a time, then into one, which is
+ * Barrett reduced to the CRC. The constants are those of the paper for
+ * the bit reflected CRC-32.
+ */
+#define PCLMUL_MIN 64
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+        static const uint64_t k1k2[2] __attribute__((aligned(16))) =
+                { 0x0154442bd4, 0x01c6e41596 };
+        static const uint64_t k3k4[2] __attribute__((aligned(16))) =
+                { 0x01751997d0, 0x00ccaa009e };
+        static const uint64_t k5k0[2] __attribute__((aligned(16))) =
+                { 0x0163cd6124, 0x0000000000 };
+        static const uint64_t poly[2] __attribute__((aligned(16))) =
+                { 0x01db710641, 0x01f7011641 };
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+        size_t tail;
+
+        if (size < PCLMUL_MIN)
+                return crc32_slice8(crc, p, size);
+        tail = size & 15;
+        size -= tail;
+
+        x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+        x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+        x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+        x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+        x0 = _mm_load_si128((const __m128i *)k1k2);
+        p += 64;
+        size -= 64;
+
+        while (size >= 64) {
+                x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+                x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+                x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+                x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+                x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+                x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+                x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+                x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+                y5 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+                y6 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+                y7 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+                y8 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+                x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+                x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+                x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+                p += 64;
+                size -= 64;
+        }
+
+        /* Fold the four lanes into one. */
+        x0 = _mm_load_si128((const __m128i *)k3k4);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        while (size >= 16) {
+                x2 = _mm_loadu_si128((const __m128i *)p);
+
+                x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+                x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+                p += 16;
+                size -= 16;
+        }
+
+        /* Fold 128 bits to 64. */
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_srli_si128(x1, 8);
+        x1 = _mm_xor_si128(x1, x2);
+
+        x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        /* Barrett reduce to 32 bits. */
+        x0 = _mm_load_si128((const __m128i *)poly);
+
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        crc = _mm_extract_epi32(x1, 1);
+        return crc32_slice8(crc, p, tail);
+}
+
+static int crc32_pclmul_supported(void)
+{
+        unsigned int eax, ebx, ecx, edx;
+
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                return 0;
+        return (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+}
+#endif
+
+#ifdef CRC32_ARM64
+/*
+ * The ARMv8 CRC32 instructions are for this polynomial (CRC32C ones are
+ * for another), eight bytes at a time.
+ */
+static inline uint32_t crc32_arm64_byte(uint32_t crc, uint8_t v)
+{
+        __asm__(".arch armv8-a+crc\n\tcrc32b %w0, %w0, %w1" : "+r"(crc) : "r"(v));
+        return crc;
+}
+
+static uint32_t crc32_arm64(uint32_t crc, const uint8_t *p, size_t size)
+{
+        while (size && ((uintptr_t)p & 7)) {
+                crc = crc32_arm64_byte(crc, *p++);
+                size--;
+        }
+        while (size >= 8) {
+                uint64_t v;
+                memcpy(&v, p, sizeof(v));
+                __asm__(".arch armv8-a+crc\n\tcrc32x %w0, %w0, %x1" : "+r"(crc) : "r"(v));
+                p += 8;
+                size -= 8;
+        }
+        while (size--)
+                crc = crc32_arm64_byte(crc, *p++);
+        return crc;
+}
+
+static int crc32_arm64_supported(void)
+{
+        return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif
+
+static uint32_t (*crc32_update)(uint32_t crc, const uint8_t *p, size_t size) = crc32_bytes;
+
+static const struct sparse_crc32_impl crc32_impls[] = {
+        { "bytes", crc32_bytes },
+        { "slice8", crc32_slice8 },
+#ifdef CRC32_PCLMUL
+        { "pclmul", crc32_pclmul },
+#endif
+#ifdef CRC32_ARM64
+        { "arm64", crc32_arm64 },
+#endif
+};
+
+static int crc32_impl_supported(const struct sparse_crc32_impl *impl)
+{
+#ifdef CRC32_PCLMUL
+        if (impl->update == crc32_pclmul)
+                return crc32_pclmul_supported();
+#endif
+#ifdef CRC32_ARM64
+        if (impl->update == crc32_arm64)
+                return crc32_arm64_supported();
+#endif
+        (void)impl;
+        return 1;
+}
+
+/* Picks the last, and fastest, implementation the CPU has. */
+__attribute__((constructor))
+static void crc32_init(void)
+{
+        size_t n;
+
+        crc32_tab8_init();
+        for (n = 0; n < sizeof(crc32_impls) / sizeof(crc32_impls[0]); n++) {
+                if (crc32_impl_supported(&crc32_impls[n]))
+                        crc32_update = crc32_impls[n].update;
+        }
+}
+
+const struct sparse_crc32_impl *sparse_crc32_impl(int n)
+{
+        int i;
+
+        for (i = 0; i < (int)(sizeof(crc32_impls) / sizeof(crc32_impls[0])); i++) {
+                if (crc32_impl_supported(&crc32_impls[i]) && n-- == 0)
+                        return &crc32_impls[i];
+        }
+        return NULL;
+}
+
+uint32_t sparse_crc32(uint32_t crc_in, const void *buf, size_t size)
+{
+        return crc32_update(crc_in ^ ~0U, buf, size) ^ ~0U;
+}
@@ -14,7 +14,21 @@
  * limitations under the License.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 uint32_t sparse_crc32(uint32_t crc, const void *buf, size_t size);
 
+/* An implementation sparse_crc32() may use, updating the CRC as it is
+ * kept between its first and last inversion.
+ */
+struct sparse_crc32_impl {
+        const char *name;
+        uint32_t (*update)(uint32_t crc, const uint8_t *p, size_t size);
+};
+
+/* The nth of the implementations this CPU supports, or NULL past the last,
+ * for tests and benchmarks. The first is the byte at a time table loop.
+ */
+const struct sparse_crc32_impl *sparse_crc32_impl(int n);
+
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that each CRC-32 implementation this CPU supports gives the same
+ * results as the table loop, over all lengths and alignments up to a few
+ * hundred bytes, then measures their throughput.
+ *
+ *   sparse_crc32_benchmark [MiB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sparse_crc32.h"
+
+#define CHECK_MAX 512
+#define ALIGN_MAX 16
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check(const struct sparse_crc32_impl *impl,
+		const struct sparse_crc32_impl *ref, const uint8_t *buf)
+{
+	size_t len;
+	int align;
+
+	for (align = 0; align < ALIGN_MAX; align++) {
+		for (len = 0; len <= CHECK_MAX; len++) {
+			uint32_t crc = len * 0x9e3779b9;
+			if (impl->update(crc, buf + align, len) != ref->update(crc, buf + align, len)) {
+				fprintf(stderr, "%s: wrong CRC of %zu bytes at offset %d\n",
+						impl->name, len, align);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct sparse_crc32_impl *ref = sparse_crc32_impl(0);
+	const struct sparse_crc32_impl *impl;
+	size_t size = 64;
+	uint8_t *buf;
+	size_t i;
+	int n;
+	int failed = 0;
+
+	if (argc > 2 || (argc == 2 && (size = strtoul(argv[1], NULL, 0)) == 0)) {
+		fprintf(stderr, "Usage: sparse_crc32_benchmark [MiB]\n");
+		return 1;
+	}
+	size *= 1024 * 1024;
+
+	buf = malloc(size + ALIGN_MAX);
+	if (!buf) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	srand(1);
+	for (i = 0; i < size + ALIGN_MAX; i++) {
+		buf[i] = rand();
+	}
+
+	for (n = 0; (impl = sparse_crc32_impl(n)) != NULL; n++) {
+		if (check(impl, ref, buf)) {
+			failed = 1;
+			continue;
+		}
+
+		double start = now();
+		uint32_t crc = impl->update(~0U, buf, size);
+		double secs = now() - start;
+		printf("%-8s %08x %8.1f MiB/s\n", impl->name, crc ^ ~0U,
+				size / (1024.0 * 1024.0) / secs);
+	}
+
+	free(buf);
+	return failed;
+}
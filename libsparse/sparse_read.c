@@ -18,7 +18,9 @@
 #define _FILE_OFFSET_BITS 64
 #define _LARGEFILE64_SOURCE 1
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -27,6 +29,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifndef USE_MINGW
+#include <pthread.h>
+#endif
+
 #include <sparse/sparse.h>
 
 #include "defs.h"
@@ -38,6 +44,7 @@
 #if defined(__APPLE__) && defined(__MACH__)
 #define lseek64 lseek
 #define off64_t off_t
+#define pread64 pread
 #endif
 
 #define SPARSE_HEADER_MAJOR_VER 1
@@ -47,8 +54,19 @@
 #define COPY_BUF_SIZE (1024U*1024U)
 static char *copybuf;
 
+/* Raw images are classified into fill and data blocks a batch at a time,
+ * each batch split between threads that read and check their share, then
+ * added in order as runs of blocks.
+ */
+#define CLASSIFY_BATCH_SIZE (256U*1024U*1024U)
+#define CLASSIFY_READ_SIZE (1024U*1024U)
+#define CLASSIFY_THREAD_MIN_SIZE (4U*1024U*1024U)
+#define CLASSIFY_THREADS_MAX 16
+
 #define min(a, b) \
 	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a < _b) ? _a : _b; })
+#define max(a, b) \
+	({ typeof(a) _a = (a); typeof(b) _b = (b); (_a > _b) ? _a : _b; })
 
 static void verbose_error(bool verbose, int err, const char *fmt, ...)
 {
@@ -72,7 +90,7 @@ static void verbose_error(bool verbose, int err, const char *fmt, ...)
 		}
 
 		va_start(argp, fmt);
-		vsnprintf(at, size, fmt, argp);
+		vsnprintf(at, size + 1, fmt, argp);
 		va_end(argp);
 		at[size] = 0;
 		s = " at ";
@@ -353,56 +371,220 @@ static int sparse_file_read_sparse(struct sparse_file *s, int fd, bool crc)
 	return 0;
 }
 
-static int sparse_file_read_normal(struct sparse_file *s, int fd)
+static int pread_all(int fd, void *buf, size_t len, int64_t offset)
 {
+#ifdef USE_MINGW
+	if (lseek64(fd, offset, SEEK_SET) < 0)
+		return -errno;
+	return read_all(fd, buf, len);
+#else
+	size_t total = 0;
 	int ret;
-	uint32_t *buf = malloc(s->block_size);
-	unsigned int block = 0;
-	int64_t remain = s->len;
-	int64_t offset = 0;
-	unsigned int to_read;
-	unsigned int i;
-	bool sparse_block;
+	char *ptr = buf;
+
+	while (total < len) {
+		ret = pread64(fd, ptr, len - total, offset + total);
+
+		if (ret < 0)
+			return -errno;
+
+		if (ret == 0)
+			return -EINVAL;
+
+		ptr += ret;
+		total += ret;
+	}
+
+	return 0;
+#endif
+}
+
+/* A block is a fill block when all its words are the same, which is when
+ * it matches itself a word further on; memcmp() does that a vector at a
+ * time.
+ */
+static bool block_is_fill(const uint8_t *block, unsigned int block_size,
+		uint32_t *fill_val)
+{
+	memcpy(fill_val, block, sizeof(*fill_val));
+	return memcmp(block, block + sizeof(uint32_t),
+			block_size - sizeof(uint32_t)) == 0;
+}
+
+struct classify_job {
+	int fd;
+	unsigned int block_size;
+	unsigned int first;		/* block */
+	unsigned int count;
+	uint32_t *fill_val;		/* per block, of this job's share */
+	uint8_t *fill;			/* per block, of this job's share */
+	int ret;
+};
+
+static void *classify_blocks(void *arg)
+{
+	struct classify_job *job = arg;
+	unsigned int per_read = max(CLASSIFY_READ_SIZE / job->block_size, 1U);
+	uint8_t *buf = malloc(per_read * job->block_size);
+	unsigned int done, n, i;
 
 	if (!buf) {
-		return -ENOMEM;
+		job->ret = -ENOMEM;
+		return NULL;
 	}
 
-	while (remain > 0) {
-		to_read = min(remain, s->block_size);
-		ret = read_all(fd, buf, to_read);
-		if (ret < 0) {
-			error("failed to read sparse file");
-			return ret;
+	job->ret = 0;
+	for (done = 0; done < job->count; done += n) {
+		n = min(per_read, job->count - done);
+		job->ret = pread_all(job->fd, buf, (size_t)n * job->block_size,
+				(int64_t)(job->first + done) * job->block_size);
+		if (job->ret < 0)
+			break;
+		for (i = 0; i < n; i++) {
+			job->fill[done + i] = block_is_fill(buf + (size_t)i * job->block_size,
+					job->block_size, &job->fill_val[done + i]);
 		}
+	}
 
-		if (to_read == s->block_size) {
-			sparse_block = true;
-			for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-				if (buf[0] != buf[i]) {
-					sparse_block = false;
-					break;
-				}
-			}
+	free(buf);
+	return NULL;
+}
+
+static int classify_threads(void)
+{
+#if defined(USE_MINGW) || !defined(_SC_NPROCESSORS_ONLN)
+	return 1;
+#else
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		return 1;
+	return min(cpus, (long)CLASSIFY_THREADS_MAX);
+#endif
+}
+
+/* Classifies count blocks from first, into fill_val and fill. */
+static int classify_batch(int fd, unsigned int block_size, unsigned int first,
+		unsigned int count, uint32_t *fill_val, uint8_t *fill)
+{
+	struct classify_job jobs[CLASSIFY_THREADS_MAX];
+	unsigned int min_share = max(CLASSIFY_THREAD_MIN_SIZE / block_size, 1U);
+	int threads = classify_threads();
+	unsigned int share;
+	int ret = 0;
+	int i;
+
+	threads = min(threads, (int)DIV_ROUND_UP(count, min_share));
+	share = DIV_ROUND_UP(count, threads);
+	for (i = 0; i < threads; i++) {
+		unsigned int start = i * share;
+		jobs[i].fd = fd;
+		jobs[i].block_size = block_size;
+		jobs[i].first = first + start;
+		jobs[i].count = min(share, count - start);
+		jobs[i].fill_val = fill_val + start;
+		jobs[i].fill = fill + start;
+	}
+
+#ifndef USE_MINGW
+	pthread_t thread[CLASSIFY_THREADS_MAX];
+	bool started[CLASSIFY_THREADS_MAX];
+
+	for (i = 1; i < threads; i++) {
+		started[i] = pthread_create(&thread[i], NULL, classify_blocks, &jobs[i]) == 0;
+	}
+	classify_blocks(&jobs[0]);
+	for (i = 1; i < threads; i++) {
+		if (started[i]) {
+			pthread_join(thread[i], NULL);
 		} else {
-			sparse_block = false;
+			classify_blocks(&jobs[i]);
 		}
+	}
+#else
+	for (i = 0; i < threads; i++) {
+		classify_blocks(&jobs[i]);
+	}
+#endif
 
-		if (sparse_block) {
-			/* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-			sparse_file_add_fill(s, buf[0], to_read, block);
-		} else {
-			sparse_file_add_fd(s, fd, offset, to_read, block);
+	for (i = 0; i < threads; i++) {
+		if (jobs[i].ret < 0 && ret == 0) {
+			ret = jobs[i].ret;
 		}
+	}
+	return ret;
+}
+
+/* Adds count classified blocks from first, a run of like blocks at a time. */
+static int add_block_runs(struct sparse_file *s, int fd, unsigned int first,
+		unsigned int count, const uint32_t *fill_val, const uint8_t *fill)
+{
+	unsigned int i, run;
+	int ret;
 
-		remain -= to_read;
-		offset += to_read;
-		block++;
+	for (i = 0; i < count; i += run) {
+		for (run = 1; i + run < count && fill[i + run] == fill[i]; run++) {
+			if (fill[i] && fill_val[i + run] != fill_val[i])
+				break;
+		}
+
+		/* TODO: add flag to use skip instead of fill for fill_val == 0 */
+		if (fill[i]) {
+			ret = sparse_file_add_fill(s, fill_val[i], run * s->block_size,
+					first + i);
+		} else {
+			ret = sparse_file_add_fd(s, fd, (int64_t)(first + i) * s->block_size,
+					run * s->block_size, first + i);
+		}
+		if (ret < 0)
+			return ret;
 	}
 
 	return 0;
 }
 
+static int sparse_file_read_normal(struct sparse_file *s, int fd)
+{
+	int ret = 0;
+	unsigned int blocks = s->len / s->block_size;
+	unsigned int tail = s->len % s->block_size;
+	unsigned int batch = max(CLASSIFY_BATCH_SIZE / s->block_size, 1U);
+	uint32_t *fill_val;
+	uint8_t *fill;
+	unsigned int block;
+	unsigned int count;
+
+	batch = min(batch, max(blocks, 1U));
+	fill_val = malloc(batch * sizeof(*fill_val));
+	fill = malloc(batch);
+	if (!fill_val || !fill) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (block = 0; block < blocks; block += count) {
+		count = min(batch, blocks - block);
+		ret = classify_batch(fd, s->block_size, block, count, fill_val, fill);
+		if (ret < 0) {
+			error("failed to read sparse file");
+			goto out;
+		}
+		ret = add_block_runs(s, fd, block, count, fill_val, fill);
+		if (ret < 0)
+			goto out;
+	}
+
+	/* A partial last block is always data. */
+	if (tail) {
+		ret = sparse_file_add_fd(s, fd, (int64_t)blocks * s->block_size, tail,
+				blocks);
+	}
+
+out:
+	free(fill_val);
+	free(fill);
+	return ret;
+}
+
 int sparse_file_read(struct sparse_file *s, int fd, bool sparse, bool crc)
 {
 	if (crc && !sparse) {
@@ -503,3 +685,261 @@ struct sparse_file *sparse_file_import_auto(int fd, bool crc, bool verbose)
 
 	return s;
 }
+
+struct sparse_stream {
+	int fd;
+	uint32_t *crc32;
+	int (*write)(void *priv, const void *data, int len);
+	void *priv;
+	char *buf;		/* COPY_BUF_SIZE */
+};
+
+/* Reads and drops len bytes, where a file would be seeked over. */
+static int stream_discard(struct sparse_stream *st, unsigned int len)
+{
+	int ret;
+
+	while (len) {
+		unsigned int chunk = min(len, COPY_BUF_SIZE);
+		ret = read_all(st->fd, st->buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		len -= chunk;
+	}
+	return 0;
+}
+
+/* Passes on len bytes of buf, repeated, as the fill of a chunk. */
+static int stream_repeat(struct sparse_stream *st, int64_t len)
+{
+	int ret;
+
+	while (len) {
+		int chunk = min(len, (int64_t)COPY_BUF_SIZE);
+		if (st->crc32) {
+			*st->crc32 = sparse_crc32(*st->crc32, st->buf, chunk);
+		}
+		ret = st->write(st->priv, st->buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		len -= chunk;
+	}
+	return 0;
+}
+
+static int stream_raw_chunk(struct sparse_stream *st, unsigned int block_size,
+		unsigned int chunk_size, unsigned int blocks)
+{
+	int ret;
+
+	if (chunk_size % block_size != 0 || chunk_size / block_size != blocks) {
+		return -EINVAL;
+	}
+
+	while (chunk_size) {
+		unsigned int chunk = min(chunk_size, COPY_BUF_SIZE);
+		ret = read_all(st->fd, st->buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		if (st->crc32) {
+			*st->crc32 = sparse_crc32(*st->crc32, st->buf, chunk);
+		}
+		ret = st->write(st->priv, st->buf, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		chunk_size -= chunk;
+	}
+	return 0;
+}
+
+static int stream_fill_chunk(struct sparse_stream *st, unsigned int chunk_size,
+		int64_t len)
+{
+	uint32_t fill_val;
+	uint32_t *fillbuf = (uint32_t *)st->buf;
+	unsigned int i;
+	int ret;
+
+	if (chunk_size != sizeof(fill_val)) {
+		return -EINVAL;
+	}
+
+	ret = read_all(st->fd, &fill_val, sizeof(fill_val));
+	if (ret < 0) {
+		return ret;
+	}
+
+	for (i = 0; i < COPY_BUF_SIZE / sizeof(fill_val); i++) {
+		fillbuf[i] = fill_val;
+	}
+	return stream_repeat(st, len);
+}
+
+static int stream_skip_chunk(struct sparse_stream *st, unsigned int chunk_size,
+		int64_t len)
+{
+	int ret;
+
+	if (chunk_size != 0) {
+		return -EINVAL;
+	}
+
+	if (st->crc32) {
+		memset(st->buf, 0, COPY_BUF_SIZE);
+	}
+	while (len) {
+		int chunk = min(len, (int64_t)INT_MAX);
+		if (st->crc32) {
+			int64_t crc_len = chunk;
+			while (crc_len) {
+				int n = min(crc_len, (int64_t)COPY_BUF_SIZE);
+				*st->crc32 = sparse_crc32(*st->crc32, st->buf, n);
+				crc_len -= n;
+			}
+		}
+		ret = st->write(st->priv, NULL, chunk);
+		if (ret < 0) {
+			return ret;
+		}
+		len -= chunk;
+	}
+	return 0;
+}
+
+static int stream_crc32_chunk(struct sparse_stream *st, unsigned int chunk_size)
+{
+	uint32_t file_crc32;
+	int ret;
+
+	if (chunk_size != sizeof(file_crc32)) {
+		return -EINVAL;
+	}
+
+	ret = read_all(st->fd, &file_crc32, sizeof(file_crc32));
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (st->crc32 && file_crc32 != *st->crc32) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* Like sparse_file_read_sparse(), but passes each chunk on as it is read
+ * rather than adding it to a sparse file, and reads over what it would
+ * have seeked over.
+ */
+int sparse_file_stream(int fd, bool verbose, bool crc,
+		int (*write)(void *priv, const void *data, int len), void *priv)
+{
+	struct sparse_stream st;
+	sparse_header_t sparse_header;
+	chunk_header_t chunk_header;
+	uint32_t crc32 = 0;
+	unsigned int cur_block = 0;
+	unsigned int chunk_data_size;
+	int64_t len;
+	unsigned int i;
+	int ret;
+
+	st.fd = fd;
+	st.crc32 = crc ? &crc32 : NULL;
+	st.write = write;
+	st.priv = priv;
+	st.buf = malloc(COPY_BUF_SIZE);
+	if (!st.buf) {
+		verbose_error(verbose, -ENOMEM, NULL);
+		return -ENOMEM;
+	}
+
+	ret = read_all(fd, &sparse_header, sizeof(sparse_header));
+	if (ret < 0) {
+		verbose_error(verbose, ret, "header");
+		goto out;
+	}
+
+	ret = -EINVAL;
+	if (sparse_header.magic != SPARSE_HEADER_MAGIC) {
+		verbose_error(verbose, ret, "header magic");
+		goto out;
+	}
+
+	if (sparse_header.major_version != SPARSE_HEADER_MAJOR_VER) {
+		verbose_error(verbose, ret, "header major version");
+		goto out;
+	}
+
+	if (sparse_header.file_hdr_sz < SPARSE_HEADER_LEN ||
+			sparse_header.chunk_hdr_sz < CHUNK_HEADER_LEN ||
+			sparse_header.blk_sz == 0 || sparse_header.blk_sz % 4 != 0) {
+		verbose_error(verbose, ret, "header");
+		goto out;
+	}
+
+	ret = stream_discard(&st, sparse_header.file_hdr_sz - SPARSE_HEADER_LEN);
+	if (ret < 0) {
+		verbose_error(verbose, ret, "header");
+		goto out;
+	}
+
+	for (i = 0; i < sparse_header.total_chunks; i++) {
+		ret = read_all(fd, &chunk_header, sizeof(chunk_header));
+		if (ret == 0) {
+			ret = stream_discard(&st, sparse_header.chunk_hdr_sz - CHUNK_HEADER_LEN);
+		}
+		if (ret < 0) {
+			verbose_error(verbose, ret, "chunk header %u", i);
+			goto out;
+		}
+
+		if (chunk_header.total_sz < sparse_header.chunk_hdr_sz) {
+			ret = -EINVAL;
+			verbose_error(verbose, ret, "chunk %u", i);
+			goto out;
+		}
+		chunk_data_size = chunk_header.total_sz - sparse_header.chunk_hdr_sz;
+		len = (int64_t)chunk_header.chunk_sz * sparse_header.blk_sz;
+
+		switch (chunk_header.chunk_type) {
+		case CHUNK_TYPE_RAW:
+			ret = stream_raw_chunk(&st, sparse_header.blk_sz, chunk_data_size,
+					chunk_header.chunk_sz);
+			break;
+		case CHUNK_TYPE_FILL:
+			ret = stream_fill_chunk(&st, chunk_data_size, len);
+			break;
+		case CHUNK_TYPE_DONT_CARE:
+			ret = stream_skip_chunk(&st, chunk_data_size, len);
+			break;
+		case CHUNK_TYPE_CRC32:
+			ret = stream_crc32_chunk(&st, chunk_data_size);
+			len = 0;
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+		}
+		if (ret < 0) {
+			verbose_error(verbose, ret, "chunk %u, type %04X, at block %u", i,
+					chunk_header.chunk_type, cur_block);
+			goto out;
+		}
+
+		cur_block += len / sparse_header.blk_sz;
+	}
+
+	ret = 0;
+	if (sparse_header.total_blks != cur_block) {
+		ret = -EINVAL;
+		verbose_error(verbose, ret, "block count");
+	}
+
+out:
+	free(st.buf);
+	return ret;
+}
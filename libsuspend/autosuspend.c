@@ -110,3 +110,19 @@ int autosuspend_disable(void)
     autosuspend_enabled = false;
     return 0;
 }
+
+int autosuspend_get_stats(struct autosuspend_stats *stats)
+{
+    int ret;
+
+    ret = autosuspend_init();
+    if (ret) {
+        return ret;
+    }
+
+    if (!autosuspend_ops->get_stats) {
+        return -1;
+    }
+
+    return autosuspend_ops->get_stats(stats);
+}
@@ -23,17 +23,29 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define LOG_TAG "libsuspend"
 //#define LOG_NDEBUG 0
 #include <cutils/log.h>
 
+#include <suspend/autosuspend.h>
+
 #include "autosuspend_ops.h"
 
 #define SYS_POWER_STATE "/sys/power/state"
 #define SYS_POWER_WAKEUP_COUNT "/sys/power/wakeup_count"
 
+/*
+ * Reading wakeup_count blocks until no wakeup events are in progress, so the
+ * thread only needs to hold off after a suspend attempt fails without one,
+ * a driver refusing to suspend for example.  It then waits BACKOFF_MIN_MS,
+ * doubling each time up to BACKOFF_MAX_MS, until a suspend succeeds.
+ */
+#define BACKOFF_MIN_MS 10
+#define BACKOFF_MAX_MS 1000
+
 static int state_fd;
 static int wakeup_count_fd;
 static pthread_t suspend_thread;
@@ -41,6 +53,36 @@ static sem_t suspend_lockout;
 static const char *sleep_state = "mem";
 static void (*wakeup_func)(bool success) = NULL;
 
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct autosuspend_stats stats;
+/* when autosuspend was enabled or the system last resumed; 0 if neither */
+static uint64_t awake_since_ms;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void back_off(bool aborted)
+{
+    pthread_mutex_lock(&stats_lock);
+    if (aborted) {
+        stats.aborts++;
+    }
+    if (stats.backoff_ms == 0) {
+        stats.backoff_ms = BACKOFF_MIN_MS;
+    } else if (stats.backoff_ms < BACKOFF_MAX_MS) {
+        stats.backoff_ms *= 2;
+        if (stats.backoff_ms > BACKOFF_MAX_MS) {
+            stats.backoff_ms = BACKOFF_MAX_MS;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
 static void *suspend_thread_func(void *arg __attribute__((unused)))
 {
     char buf[80];
@@ -48,9 +90,18 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
     int wakeup_count_len;
     int ret;
     bool success;
+    uint32_t backoff_ms;
+    uint64_t start_ms;
 
     while (1) {
-        usleep(100000);
+        pthread_mutex_lock(&stats_lock);
+        backoff_ms = stats.backoff_ms;
+        pthread_mutex_unlock(&stats_lock);
+        if (backoff_ms) {
+            ALOGV("%s: back off for %ums\n", __func__, backoff_ms);
+            usleep(backoff_ms * 1000);
+        }
+
         ALOGV("%s: read wakeup_count\n", __func__);
         lseek(wakeup_count_fd, 0, SEEK_SET);
         wakeup_count_len = TEMP_FAILURE_RETRY(read(wakeup_count_fd, wakeup_count,
@@ -59,10 +110,12 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
             strerror_r(errno, buf, sizeof(buf));
             ALOGE("Error reading from %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
             wakeup_count_len = 0;
+            back_off(false);
             continue;
         }
         if (!wakeup_count_len) {
             ALOGE("Empty wakeup count\n");
+            back_off(false);
             continue;
         }
 
@@ -71,6 +124,7 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
         if (ret < 0) {
             strerror_r(errno, buf, sizeof(buf));
             ALOGE("Error waiting on semaphore: %s\n", buf);
+            back_off(false);
             continue;
         }
 
@@ -78,14 +132,39 @@ static void *suspend_thread_func(void *arg __attribute__((unused)))
         ALOGV("%s: write %*s to wakeup_count\n", __func__, wakeup_count_len, wakeup_count);
         ret = TEMP_FAILURE_RETRY(write(wakeup_count_fd, wakeup_count, wakeup_count_len));
         if (ret < 0) {
-            strerror_r(errno, buf, sizeof(buf));
-            ALOGE("Error writing to %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
+            if (errno == EINVAL) {
+                /* A wakeup event came in since the count was read; the next
+                 * read waits for it to be handled, so try again straight
+                 * away. */
+                ALOGV("%s: wakeup_count changed\n", __func__);
+                pthread_mutex_lock(&stats_lock);
+                stats.aborts++;
+                pthread_mutex_unlock(&stats_lock);
+            } else {
+                strerror_r(errno, buf, sizeof(buf));
+                ALOGE("Error writing to %s: %s\n", SYS_POWER_WAKEUP_COUNT, buf);
+                back_off(true);
+            }
         } else {
             ALOGV("%s: write %s to %s\n", __func__, sleep_state, SYS_POWER_STATE);
+            start_ms = now_ms();
             ret = TEMP_FAILURE_RETRY(write(state_fd, sleep_state, strlen(sleep_state)));
             if (ret < 0) {
                 success = false;
+                back_off(true);
             }
+            pthread_mutex_lock(&stats_lock);
+            stats.attempts++;
+            if (success) {
+                stats.suspends++;
+                stats.backoff_ms = 0;
+                if (awake_since_ms) {
+                    stats.last_time_to_suspend_ms = start_ms - awake_since_ms;
+                    stats.total_time_to_suspend_ms += stats.last_time_to_suspend_ms;
+                }
+                awake_since_ms = now_ms();
+            }
+            pthread_mutex_unlock(&stats_lock);
             void (*func)(bool success) = wakeup_func;
             if (func != NULL) {
                 (*func)(success);
@@ -109,6 +188,10 @@ static int autosuspend_wakeup_count_enable(void)
 
     ALOGV("autosuspend_wakeup_count_enable\n");
 
+    pthread_mutex_lock(&stats_lock);
+    awake_since_ms = now_ms();
+    pthread_mutex_unlock(&stats_lock);
+
     ret = sem_post(&suspend_lockout);
 
     if (ret < 0) {
@@ -149,9 +232,19 @@ void set_wakeup_callback(void (*func)(bool success))
     wakeup_func = func;
 }
 
+static int autosuspend_wakeup_count_get_stats(struct autosuspend_stats *out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    return 0;
+}
+
 struct autosuspend_ops autosuspend_wakeup_count_ops = {
         .enable = autosuspend_wakeup_count_enable,
         .disable = autosuspend_wakeup_count_disable,
+        .get_stats = autosuspend_wakeup_count_get_stats,
 };
 
 struct autosuspend_ops *autosuspend_wakeup_count_init(void)
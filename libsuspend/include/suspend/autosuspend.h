@@ -19,6 +19,7 @@
 
 #include <sys/cdefs.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 __BEGIN_DECLS
 
@@ -53,6 +54,32 @@ int autosuspend_disable(void);
  */
 void set_wakeup_callback(void (*func)(bool success));
 
+struct autosuspend_stats {
+    /* writes to /sys/power/state */
+    uint64_t attempts;
+    /* attempts after which the system had suspended */
+    uint64_t suspends;
+    /* attempts that failed, plus wakeup counts that went stale before
+     * suspend could be attempted */
+    uint64_t aborts;
+    /* how long the next attempt will be held off after an abort */
+    uint32_t backoff_ms;
+    /* from enabling autosuspend or the last resume to the last suspend */
+    uint32_t last_time_to_suspend_ms;
+    uint64_t total_time_to_suspend_ms;
+};
+
+/*
+ * autosuspend_get_stats
+ *
+ * Fill in stats with what the wakeup_count backend has counted since it was
+ * initialized.
+ *
+ * Returns 0 on success, -1 if autosuspend could not be initialized or the
+ * backend in use does not keep statistics.
+ */
+int autosuspend_get_stats(struct autosuspend_stats *stats);
+
 __END_DECLS
 
 #endif
@@ -44,6 +44,22 @@ struct sync_pt_info {
 /* timeout in msecs */
 int sync_wait(int fd, int timeout);
 int sync_merge(const char *name, int fd1, int fd2);
+
+/*
+ * Waits in a single poll for all (wait_all != 0) or any of count fences.
+ * Returns 0 once all have signaled, or the index of a signaled fence when
+ * waiting for any.  On timeout returns -1 with errno set to ETIME, and if a
+ * fence has an error, -1 with the errno sync_wait would give for it.
+ */
+int sync_wait_many(const int *fds, int count, int timeout, int wait_all);
+
+/*
+ * Merges count fences into a new one through a balanced tree of sync_merge
+ * calls, so each point is copied log2(count) times rather than up to count
+ * times.  The intermediate fences are closed and fds are left open.
+ */
+int sync_merge_many(const char *name, const int *fds, int count);
+
 struct sync_fence_info_data *sync_fence_info(int fd);
 struct sync_pt_info *sync_pt_info(struct sync_fence_info_data *info,
                                   struct sync_pt_info *itr);
@@ -16,10 +16,14 @@
  *  limitations under the License.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <poll.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <linux/sync.h>
 #include <linux/sw_sync.h>
@@ -50,6 +54,116 @@ int sync_merge(const char *name, int fd1, int fd2)
     return data.fence;
 }
 
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int sync_wait_many(const int *fds, int count, int timeout, int wait_all)
+{
+    struct pollfd stack_pfds[16];
+    struct pollfd *pfds = stack_pfds;
+    int64_t deadline = timeout < 0 ? -1 : now_ms() + timeout;
+    int pending = count;
+    int ret = -1;
+    int i;
+
+    if (count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (count > (int)(sizeof(stack_pfds) / sizeof(stack_pfds[0]))) {
+        pfds = malloc(count * sizeof(*pfds));
+        if (pfds == NULL)
+            return -1;
+    }
+    for (i = 0; i < count; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+
+    while (pending > 0) {
+        int left = -1;
+        int n;
+
+        if (deadline >= 0) {
+            int64_t ms = deadline - now_ms();
+            left = ms > 0 ? (int)ms : 0;
+        }
+        n = poll(pfds, count, left);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0) {
+            errno = ETIME;
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            if (pfds[i].fd < 0 || pfds[i].revents == 0)
+                continue;
+            if (!(pfds[i].revents & POLLIN)) {
+                /* Let the ioctl report the fence's error. */
+                if (sync_wait(fds[i], 0) == 0)
+                    errno = EINVAL;
+                pending = -1;
+                break;
+            }
+            if (!wait_all) {
+                ret = i;
+                pending = -1;
+                break;
+            }
+            /* Signaled for good; poll skips negative fds. */
+            pfds[i].fd = -1;
+            pending--;
+        }
+        if (pending == 0)
+            ret = 0;
+    }
+
+    if (pfds != stack_pfds)
+        free(pfds);
+    return ret;
+}
+
+static int merge_range(const char *name, const int *fds, int count)
+{
+    int half = count / 2;
+    int a, b, fence, saved_errno;
+
+    if (count <= 2)
+        return sync_merge(name, fds[0], fds[count - 1]);
+
+    a = merge_range(name, fds, half);
+    if (a < 0)
+        return a;
+    b = merge_range(name, fds + half, count - half);
+    if (b < 0) {
+        close(a);
+        return b;
+    }
+    fence = sync_merge(name, a, b);
+    saved_errno = errno;
+    close(a);
+    close(b);
+    errno = saved_errno;
+    return fence;
+}
+
+int sync_merge_many(const char *name, const int *fds, int count)
+{
+    if (count <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return merge_range(name, fds, count);
+}
+
 struct sync_fence_info_data *sync_fence_info(int fd)
 {
     struct sync_fence_info_data *info;
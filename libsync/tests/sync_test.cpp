@@ -438,6 +438,65 @@ TEST(FenceTest, MultiTimelineWait) {
     ASSERT_EQ(mergedFence.wait(100), 0);
 }
 
+TEST(FenceTest, MultiTimelineWaitMany) {
+    SyncTimeline timelineA, timelineB, timelineC;
+
+    SyncFence fenceA(timelineA, 5);
+    SyncFence fenceB(timelineB, 5);
+    SyncFence fenceC(timelineC, 5);
+    const int fds[] = { fenceA.getFd(), fenceB.getFd(), fenceC.getFd() };
+
+    // Nothing signaled yet.
+    ASSERT_EQ(sync_wait_many(fds, 3, 0, 0), -1);
+    ASSERT_EQ(errno, ETIME);
+    ASSERT_EQ(sync_wait_many(fds, 3, 0, 1), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    // Any returns the one that signaled, all still times out.
+    timelineB.inc(5);
+    ASSERT_EQ(sync_wait_many(fds, 3, 100, 0), 1);
+    ASSERT_EQ(sync_wait_many(fds, 3, 0, 1), -1);
+    ASSERT_EQ(errno, ETIME);
+
+    timelineA.inc(5);
+    timelineC.inc(5);
+    ASSERT_EQ(sync_wait_many(fds, 3, 100, 1), 0);
+}
+
+TEST(FenceTest, MergeMany) {
+    const int count = 7;
+    SyncTimeline timelines[count];
+    vector<SyncFence> fences;
+    vector<int> fds;
+    for (int i = 0; i < count; i++) {
+        fences.push_back(SyncFence(timelines[i], 1));
+        ASSERT_TRUE(fences.back().isValid());
+        fds.push_back(fences.back().getFd());
+    }
+
+    int fd = sync_merge_many("mergeMany", fds.data(), count);
+    ASSERT_GE(fd, 0);
+
+    // The merged fence holds one point per timeline.
+    sync_fence_info_data *info = sync_fence_info(fd);
+    ASSERT_TRUE(info != nullptr);
+    int points = 0;
+    for (struct sync_pt_info *pt = nullptr; (pt = sync_pt_info(info, pt)); )
+        points++;
+    sync_fence_info_free(info);
+    ASSERT_EQ(points, count);
+
+    // The sources stay open and the merged fence waits for all of them.
+    for (int i = 0; i < count; i++) {
+        ASSERT_TRUE(fences[i].isValid());
+        ASSERT_EQ(sync_wait(fd, 0), -1);
+        ASSERT_EQ(errno, ETIME);
+        timelines[i].inc(1);
+    }
+    ASSERT_EQ(sync_wait(fd, 0), 0);
+    close(fd);
+}
+
 TEST(StressTest, TwoThreadsSharedTimeline) {
     const int iterations = 1 << 16;
     int counter = 0;
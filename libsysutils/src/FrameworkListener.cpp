@@ -19,6 +19,7 @@
 
 #define LOG_TAG "FrameworkListener"
 
+#include <cutils/hashmap.h>
 #include <cutils/log.h>
 
 #include <sysutils/FrameworkListener.h>
@@ -29,6 +30,14 @@ static const int CMD_BUF_SIZE = 1024;
 
 #define UNUSED __attribute__((unused))
 
+static int str_hash(void *key) {
+    return hashmapHash(key, strlen((const char *) key));
+}
+
+static bool str_equals(void *keyA, void *keyB) {
+    return strcmp((const char *) keyA, (const char *) keyB) == 0;
+}
+
 FrameworkListener::FrameworkListener(const char *socketName, bool withSeq) :
                             SocketListener(socketName, true, withSeq) {
     init(socketName, withSeq);
@@ -46,6 +55,7 @@ FrameworkListener::FrameworkListener(int sock) :
 
 void FrameworkListener::init(const char *socketName UNUSED, bool withSeq) {
     mCommands = new FrameworkCommandCollection();
+    mCommandMap = hashmapCreate(16, str_hash, str_equals);
     errorRate = 0;
     mCommandCount = 0;
     mWithSeq = withSeq;
@@ -80,22 +90,29 @@ bool FrameworkListener::onDataAvailable(SocketClient *c) {
 
 void FrameworkListener::registerCmd(FrameworkCommand *cmd) {
     mCommands->push_back(cmd);
+    // As with the list, the first command registered under a name wins.
+    void *name = const_cast<char *>(cmd->getCommand());
+    if (!hashmapContainsKey(mCommandMap, name)) {
+        hashmapPut(mCommandMap, name, cmd);
+    }
 }
 
 void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
-    FrameworkCommandCollection::iterator i;
+    FrameworkCommand *c;
     int argc = 0;
     char *argv[FrameworkListener::CMD_ARGS_MAX];
+    // The arguments are unescaped one after the other into tmp, each
+    // terminated in place, and argv points into it.
     char tmp[CMD_BUF_SIZE];
     char *p = data;
     char *q = tmp;
+    char *arg = tmp;
     char *qlimit = tmp + sizeof(tmp) - 1;
     bool esc = false;
     bool quote = false;
     bool haveCmdNum = !mWithSeq;
 
     memset(argv, 0, sizeof(argv));
-    memset(tmp, 0, sizeof(tmp));
     while(*p) {
         if (*p == '\\') {
             if (esc) {
@@ -141,20 +158,20 @@ void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
             *q = '\0';
             if (!haveCmdNum) {
                 char *endptr;
-                int cmdNum = (int)strtol(tmp, &endptr, 0);
+                int cmdNum = (int)strtol(arg, &endptr, 0);
                 if (endptr == NULL || *endptr != '\0') {
                     cli->sendMsg(500, "Invalid sequence number", false);
                     goto out;
                 }
                 cli->setCmdNum(cmdNum);
                 haveCmdNum = true;
+                q = arg;
             } else {
                 if (argc >= CMD_ARGS_MAX)
                     goto overflow;
-                argv[argc++] = strdup(tmp);
+                argv[argc++] = arg;
+                arg = ++q;
             }
-            memset(tmp, 0, sizeof(tmp));
-            q = tmp;
             continue;
         }
         q++;
@@ -163,7 +180,7 @@ void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
     *q = '\0';
     if (argc >= CMD_ARGS_MAX)
         goto overflow;
-    argv[argc++] = strdup(tmp);
+    argv[argc++] = arg;
 #if 0
     for (int k = 0; k < argc; k++) {
         SLOGD("arg[%d] = '%s'", k, argv[k]);
@@ -181,21 +198,15 @@ void FrameworkListener::dispatchCommand(SocketClient *cli, char *data) {
         goto out;
     }
 
-    for (i = mCommands->begin(); i != mCommands->end(); ++i) {
-        FrameworkCommand *c = *i;
-
-        if (!strcmp(argv[0], c->getCommand())) {
-            if (c->runCommand(cli, argc, argv)) {
-                SLOGW("Handler '%s' error (%s)", c->getCommand(), strerror(errno));
-            }
-            goto out;
+    c = (FrameworkCommand *) hashmapGet(mCommandMap, argv[0]);
+    if (c != NULL) {
+        if (c->runCommand(cli, argc, argv)) {
+            SLOGW("Handler '%s' error (%s)", c->getCommand(), strerror(errno));
         }
+        goto out;
     }
     cli->sendMsg(500, "Command not recognized", false);
 out:
-    int j;
-    for (j = 0; j < argc; j++)
-        free(argv[j]);
     return;
 
 overflow:
@@ -52,14 +52,13 @@ NetlinkEvent::NetlinkEvent() {
     memset(mParams, 0, sizeof(mParams));
     mPath = NULL;
     mSubsystem = NULL;
+    mParamsOwned = false;
 }
 
 NetlinkEvent::~NetlinkEvent() {
     int i;
-    if (mPath)
-        free(mPath);
-    if (mSubsystem)
-        free(mSubsystem);
+    if (!mParamsOwned)
+        return;
     for (i = 0; i < NL_PARAMS_MAX; i++) {
         if (!mParams[i])
             break;
@@ -144,7 +143,7 @@ bool NetlinkEvent::parseIfInfoMessage(const struct nlmsghdr *nh) {
                 asprintf(&mParams[0], "INTERFACE=%s", (char *) RTA_DATA(rta));
                 mAction = (ifi->ifi_flags & IFF_LOWER_UP) ? Action::kLinkUp :
                                                             Action::kLinkDown;
-                mSubsystem = strdup("net");
+                mSubsystem = "net";
                 return true;
         }
     }
@@ -234,7 +233,7 @@ bool NetlinkEvent::parseIfAddrMessage(const struct nlmsghdr *nh) {
     // Fill in netlink event information.
     mAction = (type == RTM_NEWADDR) ? Action::kAddressUpdated :
                                       Action::kAddressRemoved;
-    mSubsystem = strdup("net");
+    mSubsystem = "net";
     asprintf(&mParams[0], "ADDRESS=%s/%d", addrstr,
              ifaddr->ifa_prefixlen);
     asprintf(&mParams[1], "INTERFACE=%s", ifname);
@@ -263,7 +262,7 @@ bool NetlinkEvent::parseUlogPacketMessage(const struct nlmsghdr *nh) {
     devname = pm->indev_name[0] ? pm->indev_name : pm->outdev_name;
     asprintf(&mParams[0], "ALERT_NAME=%s", pm->prefix);
     asprintf(&mParams[1], "INTERFACE=%s", devname);
-    mSubsystem = strdup("qlog");
+    mSubsystem = "qlog";
     mAction = Action::kChange;
     return true;
 }
@@ -298,7 +297,7 @@ bool NetlinkEvent::parseNfPacketMessage(struct nlmsghdr *nh) {
 
     asprintf(&mParams[0], "UID=%d", uid);
     mParams[1] = hex;
-    mSubsystem = strdup("strict");
+    mSubsystem = "strict";
     mAction = Action::kChange;
     return true;
 }
@@ -387,7 +386,7 @@ bool NetlinkEvent::parseRtMessage(const struct nlmsghdr *nh) {
     // Fill in netlink event information.
     mAction = (type == RTM_NEWROUTE) ? Action::kRouteUpdated :
                                        Action::kRouteRemoved;
-    mSubsystem = strdup("net");
+    mSubsystem = "net";
     asprintf(&mParams[0], "ROUTE=%s/%d", dst, prefixLength);
     asprintf(&mParams[1], "GATEWAY=%s", (*gw) ? gw : "");
     asprintf(&mParams[2], "INTERFACE=%s", (*dev) ? dev : "");
@@ -492,7 +491,7 @@ bool NetlinkEvent::parseNdUserOptMessage(const struct nlmsghdr *nh) {
         buf[pos] = '\0';
 
         mAction = Action::kRdnss;
-        mSubsystem = strdup("net");
+        mSubsystem = "net";
         asprintf(&mParams[0], "INTERFACE=%s", ifname);
         asprintf(&mParams[1], "LIFETIME=%u", lifetime);
         mParams[2] = buf;
@@ -605,7 +604,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = p+1;
             first = 0;
         } else {
             const char* a;
@@ -619,9 +618,9 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
             } else if ((a = HAS_CONST_PREFIX(s, end, "SEQNUM=")) != NULL) {
                 mSeq = atoi(a);
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != NULL) {
-                mSubsystem = strdup(a);
+                mSubsystem = a;
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                mParams[param_idx++] = (char *) s;
             }
         }
         s += strlen(s) + 1;
@@ -632,6 +631,8 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
 bool NetlinkEvent::decode(char *buffer, int size, int format) {
     if (format == NetlinkListener::NETLINK_FORMAT_BINARY
             || format == NetlinkListener::NETLINK_FORMAT_BINARY_UNICAST) {
+        // The parameters of binary messages are formatted, so they are ours.
+        mParamsOwned = true;
         return parseBinaryNetlinkMessage(buffer, size);
     } else {
         return parseAsciiNetlinkMessage(buffer, size);
@@ -44,32 +44,40 @@ NetlinkListener::NetlinkListener(int socket, int format) :
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
 {
     int socket = cli->getSocket();
+    ssize_t lengths[kRecvBatch];
+    uid_t uids[kRecvBatch];
     ssize_t count;
-    uid_t uid = -1;
 
     bool require_group = true;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
     }
 
-    count = TEMP_FAILURE_RETRY(uevent_kernel_recv(socket,
-            mBuffer, sizeof(mBuffer), require_group, &uid));
+    // Takes whatever has queued up since the last wakeup, up to
+    // kRecvBatch messages, each into its own slot of mBuffer.
+    count = TEMP_FAILURE_RETRY(uevent_kernel_recv_batch(socket,
+            mBuffer, kRecvSlotSize, kRecvBatch, lengths, require_group, uids));
     if (count < 0) {
-        if (uid > 0)
-            LOG_EVENT_INT(65537, uid);
-        SLOGE("recvmsg failed (%s)", strerror(errno));
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
         return false;
     }
 
-    NetlinkEvent *evt = new NetlinkEvent();
-    if (evt->decode(mBuffer, count, mFormat)) {
-        onEvent(evt);
-    } else if (mFormat != NETLINK_FORMAT_BINARY) {
-        // Don't complain if parseBinaryNetlinkMessage returns false. That can
-        // just mean that the buffer contained no messages we're interested in.
-        SLOGE("Error decoding NetlinkEvent");
-    }
+    for (ssize_t i = 0; i < count; i++) {
+        if (lengths[i] < 0) {
+            if (uids[i] > 0)
+                LOG_EVENT_INT(65537, uids[i]);
+            SLOGE("Ignoring netlink message that is not from the kernel");
+            continue;
+        }
 
-    delete evt;
+        NetlinkEvent evt;
+        if (evt.decode(mBuffer + i * kRecvSlotSize, lengths[i], mFormat)) {
+            onEvent(&evt);
+        } else if (mFormat != NETLINK_FORMAT_BINARY) {
+            // Don't complain if parseBinaryNetlinkMessage returns false. That can
+            // just mean that the buffer contained no messages we're interested in.
+            SLOGE("Error decoding NetlinkEvent");
+        }
+    }
     return true;
 }
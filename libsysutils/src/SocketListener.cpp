@@ -16,8 +16,8 @@
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -32,6 +32,8 @@
 #define CtrlPipe_Shutdown 0
 #define CtrlPipe_Wakeup   1
 
+static const int kMaxEvents = 16;
+
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
 }
@@ -51,6 +53,15 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mUseCmdNum = useCmdNum;
     pthread_mutex_init(&mClientsLock, NULL);
     mClients = new SocketClientCollection();
+    mCtrlPipe[0] = -1;
+    mCtrlPipe[1] = -1;
+    mEpollFd = -1;
+    mWorkerCount = 0;
+    mWorkers = NULL;
+    mWorkQueue = new SocketClientCollection();
+    pthread_mutex_init(&mWorkLock, NULL);
+    pthread_cond_init(&mWorkCond, NULL);
+    mWorkersExit = false;
 }
 
 SocketListener::~SocketListener() {
@@ -61,12 +72,21 @@ SocketListener::~SocketListener() {
         close(mCtrlPipe[0]);
         close(mCtrlPipe[1]);
     }
+    if (mEpollFd != -1) {
+        close(mEpollFd);
+    }
     SocketClientCollection::iterator it;
     for (it = mClients->begin(); it != mClients->end();) {
         (*it)->decRef();
         it = mClients->erase(it);
     }
     delete mClients;
+    delete mWorkQueue;
+    delete[] mWorkers;
+}
+
+void SocketListener::setWorkerThreads(int count) {
+    mWorkerCount = count;
 }
 
 int SocketListener::startListener() {
@@ -92,14 +112,41 @@ int SocketListener::startListener(int backlog) {
     if (mListen && listen(mSock, backlog) < 0) {
         SLOGE("Unable to listen on socket (%s)", strerror(errno));
         return -1;
-    } else if (!mListen)
-        mClients->push_back(new SocketClient(mSock, false, mUseCmdNum));
+    }
 
     if (pipe(mCtrlPipe)) {
         SLOGE("pipe failed (%s)", strerror(errno));
         return -1;
     }
 
+    // The clients stay registered until release(), rather than being
+    // collected again on every pass of the listener thread.
+    if ((mEpollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return -1;
+    }
+    if (watch(mCtrlPipe[0], false) || (mListen && watch(mSock, false))) {
+        return -1;
+    }
+    if (!mListen) {
+        mClients->push_back(new SocketClient(mSock, false, mUseCmdNum));
+        if (watch(mSock, mWorkerCount > 0)) {
+            return -1;
+        }
+    }
+
+    if (mWorkerCount > 0) {
+        mWorkersExit = false;
+        mWorkers = new pthread_t[mWorkerCount];
+        for (int i = 0; i < mWorkerCount; i++) {
+            if (pthread_create(&mWorkers[i], NULL, SocketListener::workerStart, this)) {
+                SLOGE("pthread_create (%s)", strerror(errno));
+                mWorkerCount = i;
+                return -1;
+            }
+        }
+    }
+
     if (pthread_create(&mThread, NULL, SocketListener::threadStart, this)) {
         SLOGE("pthread_create (%s)", strerror(errno));
         return -1;
@@ -108,6 +155,29 @@ int SocketListener::startListener(int backlog) {
     return 0;
 }
 
+int SocketListener::watch(int fd, bool oneShot) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    if (oneShot) {
+        ev.events |= EPOLLONESHOT;
+    }
+    ev.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev)) {
+        SLOGE("epoll_ctl(ADD, %d) failed (%s)", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Re-enables the one-shot registration of a client that a worker is done
+// with.  Fails harmlessly if the client has been released meanwhile.
+void SocketListener::rearm(SocketClient *c) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = c->getSocket();
+    epoll_ctl(mEpollFd, EPOLL_CTL_MOD, c->getSocket(), &ev);
+}
+
 int SocketListener::stopListener() {
     char c = CtrlPipe_Shutdown;
     int  rc;
@@ -123,6 +193,26 @@ int SocketListener::stopListener() {
         SLOGE("Error joining to listener thread (%s)", strerror(errno));
         return -1;
     }
+
+    if (mWorkerCount > 0) {
+        pthread_mutex_lock(&mWorkLock);
+        mWorkersExit = true;
+        pthread_cond_broadcast(&mWorkCond);
+        pthread_mutex_unlock(&mWorkLock);
+        for (int i = 0; i < mWorkerCount; i++) {
+            pthread_join(mWorkers[i], NULL);
+        }
+        delete[] mWorkers;
+        mWorkers = NULL;
+        SocketClientCollection::iterator it;
+        for (it = mWorkQueue->begin(); it != mWorkQueue->end();) {
+            (*it)->decRef();
+            it = mWorkQueue->erase(it);
+        }
+    }
+
+    close(mEpollFd);
+    mEpollFd = -1;
     close(mCtrlPipe[0]);
     close(mCtrlPipe[1]);
     mCtrlPipe[0] = -1;
@@ -152,45 +242,32 @@ void *SocketListener::threadStart(void *obj) {
 void SocketListener::runListener() {
 
     SocketClientCollection pendingList;
+    struct epoll_event events[kMaxEvents];
 
     while(1) {
         SocketClientCollection::iterator it;
-        fd_set read_fds;
-        int rc = 0;
-        int max = -1;
-
-        FD_ZERO(&read_fds);
+        bool ctrl = false;
+        bool accepting = false;
+        int rc, i;
 
-        if (mListen) {
-            max = mSock;
-            FD_SET(mSock, &read_fds);
-        }
-
-        FD_SET(mCtrlPipe[0], &read_fds);
-        if (mCtrlPipe[0] > max)
-            max = mCtrlPipe[0];
-
-        pthread_mutex_lock(&mClientsLock);
-        for (it = mClients->begin(); it != mClients->end(); ++it) {
-            // NB: calling out to an other object with mClientsLock held (safe)
-            int fd = (*it)->getSocket();
-            FD_SET(fd, &read_fds);
-            if (fd > max) {
-                max = fd;
-            }
-        }
-        pthread_mutex_unlock(&mClientsLock);
-        SLOGV("mListen=%d, max=%d, mSocketName=%s", mListen, max, mSocketName);
-        if ((rc = select(max + 1, &read_fds, NULL, NULL, NULL)) < 0) {
+        SLOGV("mListen=%d, mSocketName=%s", mListen, mSocketName);
+        if ((rc = epoll_wait(mEpollFd, events, kMaxEvents, -1)) < 0) {
             if (errno == EINTR)
                 continue;
-            SLOGE("select failed (%s) mListen=%d, max=%d", strerror(errno), mListen, max);
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
             sleep(1);
             continue;
-        } else if (!rc)
-            continue;
+        }
 
-        if (FD_ISSET(mCtrlPipe[0], &read_fds)) {
+        for (i = 0; i < rc; i++) {
+            if (events[i].data.fd == mCtrlPipe[0]) {
+                ctrl = true;
+            } else if (mListen && events[i].data.fd == mSock) {
+                accepting = true;
+            }
+        }
+
+        if (ctrl) {
             char c = CtrlPipe_Shutdown;
             TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
             if (c == CtrlPipe_Shutdown) {
@@ -198,7 +275,7 @@ void SocketListener::runListener() {
             }
             continue;
         }
-        if (mListen && FD_ISSET(mSock, &read_fds)) {
+        if (accepting) {
             struct sockaddr addr;
             socklen_t alen;
             int c;
@@ -214,21 +291,31 @@ void SocketListener::runListener() {
                 continue;
             }
             fcntl(c, F_SETFD, FD_CLOEXEC);
-            pthread_mutex_lock(&mClientsLock);
-            mClients->push_back(new SocketClient(c, true, mUseCmdNum));
-            pthread_mutex_unlock(&mClientsLock);
+            if (watch(c, mWorkerCount > 0)) {
+                close(c);
+            } else {
+                pthread_mutex_lock(&mClientsLock);
+                mClients->push_back(new SocketClient(c, true, mUseCmdNum));
+                pthread_mutex_unlock(&mClientsLock);
+            }
         }
 
         /* Add all active clients to the pending list first */
         pendingList.clear();
         pthread_mutex_lock(&mClientsLock);
-        for (it = mClients->begin(); it != mClients->end(); ++it) {
-            SocketClient* c = *it;
-            // NB: calling out to an other object with mClientsLock held (safe)
-            int fd = c->getSocket();
-            if (FD_ISSET(fd, &read_fds)) {
-                pendingList.push_back(c);
-                c->incRef();
+        for (i = 0; i < rc; i++) {
+            int fd = events[i].data.fd;
+            if (fd == mCtrlPipe[0] || (mListen && fd == mSock)) {
+                continue;
+            }
+            for (it = mClients->begin(); it != mClients->end(); ++it) {
+                SocketClient* c = *it;
+                // NB: calling out to an other object with mClientsLock held (safe)
+                if (c->getSocket() == fd) {
+                    pendingList.push_back(c);
+                    c->incRef();
+                    break;
+                }
             }
         }
         pthread_mutex_unlock(&mClientsLock);
@@ -240,15 +327,55 @@ void SocketListener::runListener() {
             it = pendingList.begin();
             SocketClient* c = *it;
             pendingList.erase(it);
-            /* Process it, if false is returned, remove from list */
-            if (!onDataAvailable(c)) {
-                release(c, false);
+            if (mWorkerCount > 0) {
+                /* The worker drops the reference */
+                pthread_mutex_lock(&mWorkLock);
+                mWorkQueue->push_back(c);
+                pthread_cond_signal(&mWorkCond);
+                pthread_mutex_unlock(&mWorkLock);
+                continue;
             }
+            dispatch(c);
             c->decRef();
         }
     }
 }
 
+void SocketListener::dispatch(SocketClient *c) {
+    /* Process it, if false is returned, remove from list */
+    if (!onDataAvailable(c)) {
+        release(c, false);
+    }
+}
+
+void *SocketListener::workerStart(void *obj) {
+    SocketListener *me = reinterpret_cast<SocketListener *>(obj);
+
+    me->runWorker();
+    return NULL;
+}
+
+void SocketListener::runWorker() {
+    pthread_mutex_lock(&mWorkLock);
+    while (!mWorkersExit) {
+        if (mWorkQueue->empty()) {
+            pthread_cond_wait(&mWorkCond, &mWorkLock);
+            continue;
+        }
+        SocketClientCollection::iterator it = mWorkQueue->begin();
+        SocketClient* c = *it;
+        mWorkQueue->erase(it);
+        pthread_mutex_unlock(&mWorkLock);
+
+        dispatch(c);
+        rearm(c);
+        c->decRef();
+
+        pthread_mutex_lock(&mWorkLock);
+    }
+    pthread_mutex_unlock(&mWorkLock);
+}
+
 bool SocketListener::release(SocketClient* c, bool wakeup) {
     bool ret = false;
     /* if our sockets are connection-based, remove and destroy it */
@@ -266,6 +393,7 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
         }
         pthread_mutex_unlock(&mClientsLock);
         if (ret) {
+            epoll_ctl(mEpollFd, EPOLL_CTL_DEL, c->getSocket(), NULL);
             ret = c->decRef();
             if (wakeup) {
                 char b = CtrlPipe_Wakeup;
@@ -39,6 +39,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/inotify.h>
+#include <sys/uio.h>
 #include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -64,6 +65,29 @@
 #define MAX_USBFS_BUFFER_SIZE   16384
 
 #define MAX_USBFS_WD_COUNT      10
+// Device numbers on a bus are USB addresses, 1 to 127
+#define MAX_USBFS_DEVICES       128
+
+// Room for a burst of events, such as a hub coming up with its devices
+#define INOTIFY_BUF_SIZE        4096
+
+// What usb_request.private_data points to. The URB comes first, so that
+// private_data can still be used as the struct usbdevfs_urb* it always was.
+struct usb_request_private {
+    struct usbdevfs_urb         urb;
+    int                         queued;
+    // usb_request_queue_sg() segments, one URB each
+    struct usbdevfs_urb         *sg_urbs;
+    int                         sg_capacity;
+    int                         sg_count;
+    int                         sg_pending;
+};
+
+struct usb_request_ring {
+    struct usb_request          **requests;
+    int                         count;
+    void                        *buffers;
+};
 
 struct usb_host_context {
     int                         fd;
@@ -73,6 +97,9 @@ struct usb_host_context {
     int                         wds[MAX_USBFS_WD_COUNT];
     int                         wdd;
     int                         wddbus;
+    // devices reported as added and not yet removed, a bit per device
+    // number for each watched bus
+    uint32_t                    devices[MAX_USBFS_WD_COUNT][MAX_USBFS_DEVICES / 32];
 };
 
 struct usb_device {
@@ -91,9 +118,27 @@ static inline int badname(const char *name)
     return 0;
 }
 
-static int find_existing_devices_bus(char *busname,
-                                     usb_device_added_cb added_cb,
-                                     void *client_data)
+/* Records whether the device is present, returning false if it already
+ * was known to be. Buses and devices out of the table's range are never
+ * known, so their events always go through.
+ */
+static int update_device_table(struct usb_host_context *context,
+                               int bus, int dev, int present)
+{
+    uint32_t *word, bit;
+
+    if (bus <= 0 || bus >= MAX_USBFS_WD_COUNT || dev <= 0 || dev >= MAX_USBFS_DEVICES)
+        return 1;
+    word = &context->devices[bus][dev / 32];
+    bit = 1u << (dev % 32);
+    if (!(*word & bit) == !present)
+        return 0;
+    *word ^= bit;
+    return 1;
+}
+
+static int find_existing_devices_bus(struct usb_host_context *context, int bus,
+                                     char *busname)
 {
     char devname[32];
     DIR *devdir;
@@ -105,9 +150,10 @@ static int find_existing_devices_bus(char *busname,
 
     while ((de = readdir(devdir)) && !done) {
         if(badname(de->d_name)) continue;
+        if (!update_device_table(context, bus, atoi(de->d_name), 1)) continue;
 
         snprintf(devname, sizeof(devname), "%s/%s", busname, de->d_name);
-        done = added_cb(devname, client_data);
+        done = context->cb_added(devname, context->data);
     } // end of devdir while
     closedir(devdir);
 
@@ -115,8 +161,7 @@ static int find_existing_devices_bus(char *busname,
 }
 
 /* returns true if one of the callbacks indicates we are done */
-static int find_existing_devices(usb_device_added_cb added_cb,
-                                  void *client_data)
+static int find_existing_devices(struct usb_host_context *context)
 {
     char busname[32];
     DIR *busdir;
@@ -130,8 +175,7 @@ static int find_existing_devices(usb_device_added_cb added_cb,
         if(badname(de->d_name)) continue;
 
         snprintf(busname, sizeof(busname), USB_FS_DIR "/%s", de->d_name);
-        done = find_existing_devices_bus(busname, added_cb,
-                                         client_data);
+        done = find_existing_devices_bus(context, atoi(de->d_name), busname);
     } //end of busdir while
     closedir(busdir);
 
@@ -150,6 +194,8 @@ static void watch_existing_subdirs(struct usb_host_context *context,
 
     /* watch existing subdirectories of USB_FS_DIR */
     for (i = 1; i < wd_count; i++) {
+        if (wds[i] >= 0)
+            continue;
         snprintf(path, sizeof(path), USB_FS_DIR "/%03d", i);
         ret = inotify_add_watch(context->fd, path, IN_CREATE | IN_DELETE);
         if (ret >= 0)
@@ -216,88 +262,112 @@ int usb_host_load(struct usb_host_context *context,
     watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
 
     /* check for existing devices first, after we have inotify set up */
-    done = find_existing_devices(added_cb, client_data);
+    done = find_existing_devices(context);
     if (discovery_done_cb)
         done |= discovery_done_cb(client_data);
 
     return done;
 } /* usb_host_load() */
 
-int usb_host_read_event(struct usb_host_context *context)
+static void forget_bus(struct usb_host_context *context, int bus)
 {
-    struct inotify_event* event;
-    char event_buf[512];
-    char path[100];
-    int i, ret, done = 0;
-    int offset = 0;
-    int wd;
+    if (context->wds[bus] >= 0) {
+        inotify_rm_watch(context->fd, context->wds[bus]);
+        context->wds[bus] = -1;
+    }
+    memset(context->devices[bus], 0, sizeof(context->devices[bus]));
+}
 
-    ret = read(context->fd, event_buf, sizeof(event_buf));
-    if (ret >= (int)sizeof(struct inotify_event)) {
-        while (offset < ret && !done) {
-            event = (struct inotify_event*)&event_buf[offset];
-            done = 0;
-            wd = event->wd;
-            if (wd == context->wdd) {
-                if ((event->mask & IN_CREATE) && !strcmp(event->name, "bus")) {
-                    context->wddbus = inotify_add_watch(context->fd, DEV_BUS_DIR, IN_CREATE | IN_DELETE);
-                    if (context->wddbus < 0) {
-                        done = 1;
-                    } else {
-                        watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
-                        done = find_existing_devices(context->cb_added, context->data);
-                    }
-                }
-            } else if (wd == context->wddbus) {
-                if ((event->mask & IN_CREATE) && !strcmp(event->name, "usb")) {
-                    watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
-                    done = find_existing_devices(context->cb_added, context->data);
-                } else if ((event->mask & IN_DELETE) && !strcmp(event->name, "usb")) {
-                    for (i = 0; i < MAX_USBFS_WD_COUNT; i++) {
-                        if (context->wds[i] >= 0) {
-                            inotify_rm_watch(context->fd, context->wds[i]);
-                            context->wds[i] = -1;
-                        }
-                    }
+/* returns true if one of the callbacks indicates we are done */
+static int usb_host_handle_event(struct usb_host_context *context,
+                                 struct inotify_event *event)
+{
+    char path[100];
+    int i, done = 0;
+    int wd = event->wd;
+
+    if (wd == context->wdd) {
+        if ((event->mask & IN_CREATE) && !strcmp(event->name, "bus")) {
+            context->wddbus = inotify_add_watch(context->fd, DEV_BUS_DIR, IN_CREATE | IN_DELETE);
+            if (context->wddbus < 0) {
+                done = 1;
+            } else {
+                watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
+                done = find_existing_devices(context);
+            }
+        }
+    } else if (wd == context->wddbus) {
+        if ((event->mask & IN_CREATE) && !strcmp(event->name, "usb")) {
+            watch_existing_subdirs(context, context->wds, MAX_USBFS_WD_COUNT);
+            done = find_existing_devices(context);
+        } else if ((event->mask & IN_DELETE) && !strcmp(event->name, "usb")) {
+            for (i = 0; i < MAX_USBFS_WD_COUNT; i++)
+                forget_bus(context, i);
+        }
+    } else if (wd == context->wds[0]) {
+        i = atoi(event->name);
+        snprintf(path, sizeof(path), USB_FS_DIR "/%s", event->name);
+        D("%s subdirectory %s: index: %d\n", (event->mask & IN_CREATE) ?
+                "new" : "gone", path, i);
+        if (i > 0 && i < MAX_USBFS_WD_COUNT) {
+            int local_ret = 0;
+            if (event->mask & IN_CREATE) {
+                // only a bus not seen before needs scanning
+                if (context->wds[i] < 0) {
+                    local_ret = inotify_add_watch(context->fd, path,
+                            IN_CREATE | IN_DELETE);
+                    if (local_ret >= 0)
+                        context->wds[i] = local_ret;
+                    done = find_existing_devices_bus(context, i, path);
                 }
-            } else if (wd == context->wds[0]) {
-                i = atoi(event->name);
-                snprintf(path, sizeof(path), USB_FS_DIR "/%s", event->name);
-                D("%s subdirectory %s: index: %d\n", (event->mask & IN_CREATE) ?
-                        "new" : "gone", path, i);
-                if (i > 0 && i < MAX_USBFS_WD_COUNT) {
-                    int local_ret = 0;
-                    if (event->mask & IN_CREATE) {
-                        local_ret = inotify_add_watch(context->fd, path,
-                                IN_CREATE | IN_DELETE);
-                        if (local_ret >= 0)
-                            context->wds[i] = local_ret;
-                        done = find_existing_devices_bus(path, context->cb_added,
-                                context->data);
-                    } else if (event->mask & IN_DELETE) {
-                        inotify_rm_watch(context->fd, context->wds[i]);
-                        context->wds[i] = -1;
+            } else if (event->mask & IN_DELETE) {
+                forget_bus(context, i);
+            }
+        }
+    } else {
+        for (i = 1; (i < MAX_USBFS_WD_COUNT) && !done; i++) {
+            if (wd == context->wds[i]) {
+                int dev = atoi(event->name);
+                snprintf(path, sizeof(path), USB_FS_DIR "/%03d/%s", i, event->name);
+                if (event->mask == IN_CREATE) {
+                    if (update_device_table(context, i, dev, 1)) {
+                        D("new device %s\n", path);
+                        done = context->cb_added(path, context->data);
                     }
-                }
-            } else {
-                for (i = 1; (i < MAX_USBFS_WD_COUNT) && !done; i++) {
-                    if (wd == context->wds[i]) {
-                        snprintf(path, sizeof(path), USB_FS_DIR "/%03d/%s", i, event->name);
-                        if (event->mask == IN_CREATE) {
-                            D("new device %s\n", path);
-                            done = context->cb_added(path, context->data);
-                        } else if (event->mask == IN_DELETE) {
-                            D("gone device %s\n", path);
-                            done = context->cb_removed(path, context->data);
-                        }
+                } else if (event->mask == IN_DELETE) {
+                    if (update_device_table(context, i, dev, 0)) {
+                        D("gone device %s\n", path);
+                        done = context->cb_removed(path, context->data);
                     }
                 }
+                break;
             }
-
-            offset += sizeof(struct inotify_event) + event->len;
         }
     }
 
+    return done;
+}
+
+int usb_host_read_event(struct usb_host_context *context)
+{
+    struct inotify_event* event;
+    char event_buf[INOTIFY_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int ret, done = 0;
+    int offset;
+    int pending;
+
+    /* take everything that has queued up, a hub brings a burst of events */
+    do {
+        ret = read(context->fd, event_buf, sizeof(event_buf));
+        if (ret < (int)sizeof(struct inotify_event))
+            break;
+        for (offset = 0; offset < ret && !done;
+                offset += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event*)&event_buf[offset];
+            done = usb_host_handle_event(context, event);
+        }
+    } while (!done && ioctl(context->fd, FIONREAD, &pending) == 0 && pending > 0);
+
     return done;
 } /* usb_host_read_event() */
 
@@ -620,9 +690,10 @@ int usb_device_bulk_transfer(struct usb_device *device,
 struct usb_request *usb_request_new(struct usb_device *dev,
         const struct usb_endpoint_descriptor *ep_desc)
 {
-    struct usbdevfs_urb *urb = calloc(1, sizeof(struct usbdevfs_urb));
-    if (!urb)
+    struct usb_request_private *priv = calloc(1, sizeof(struct usb_request_private));
+    if (!priv)
         return NULL;
+    struct usbdevfs_urb *urb = &priv->urb;
 
     if ((ep_desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK) == USB_ENDPOINT_XFER_BULK)
         urb->type = USBDEVFS_URB_TYPE_BULK;
@@ -630,20 +701,20 @@ struct usb_request *usb_request_new(struct usb_device *dev,
         urb->type = USBDEVFS_URB_TYPE_INTERRUPT;
     else {
         D("Unsupported endpoint type %d", ep_desc->bmAttributes & USB_ENDPOINT_XFERTYPE_MASK);
-        free(urb);
+        free(priv);
         return NULL;
     }
     urb->endpoint = ep_desc->bEndpointAddress;
 
     struct usb_request *req = calloc(1, sizeof(struct usb_request));
     if (!req) {
-        free(urb);
+        free(priv);
         return NULL;
     }
 
     req->dev = dev;
     req->max_packet_size = __le16_to_cpu(ep_desc->wMaxPacketSize);
-    req->private_data = urb;
+    req->private_data = priv;
     req->endpoint = urb->endpoint;
     urb->usercontext = req;
 
@@ -652,13 +723,27 @@ struct usb_request *usb_request_new(struct usb_device *dev,
 
 void usb_request_free(struct usb_request *req)
 {
-    free(req->private_data);
+    struct usb_request_private *priv = req->private_data;
+    free(priv->sg_urbs);
+    free(priv);
     free(req);
 }
 
+static int usb_submit_urb(struct usb_device *dev, struct usbdevfs_urb *urb)
+{
+    int res;
+
+    do {
+        res = ioctl(dev->fd, USBDEVFS_SUBMITURB, urb);
+    } while((res < 0) && (errno == EINTR));
+
+    return res;
+}
+
 int usb_request_queue(struct usb_request *req)
 {
-    struct usbdevfs_urb *urb = (struct usbdevfs_urb*)req->private_data;
+    struct usb_request_private *priv = req->private_data;
+    struct usbdevfs_urb *urb = &priv->urb;
     int res;
 
     urb->status = -1;
@@ -669,13 +754,106 @@ int usb_request_queue(struct usb_request *req)
     else
         urb->buffer_length = req->buffer_length;
 
-    do {
-        res = ioctl(req->dev->fd, USBDEVFS_SUBMITURB, urb);
-    } while((res < 0) && (errno == EINTR));
-
+    res = usb_submit_urb(req->dev, urb);
+    if (res >= 0)
+        priv->queued = 1;
     return res;
 }
 
+int usb_request_queue_sg(struct usb_request *req, const struct iovec *iov, int iovcnt)
+{
+    struct usb_request_private *priv = req->private_data;
+    int count = 0;
+    int i;
+
+    if (priv->urb.type != USBDEVFS_URB_TYPE_BULK || priv->queued) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < iovcnt; i++)
+        count += (iov[i].iov_len + MAX_USBFS_BUFFER_SIZE - 1) / MAX_USBFS_BUFFER_SIZE;
+    if (count == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // no URB is in flight, so they may move
+    if (count > priv->sg_capacity) {
+        struct usbdevfs_urb *urbs = realloc(priv->sg_urbs, count * sizeof(*urbs));
+        if (!urbs)
+            return -1;
+        priv->sg_urbs = urbs;
+        priv->sg_capacity = count;
+    }
+    memset(priv->sg_urbs, 0, count * sizeof(*priv->sg_urbs));
+
+    int in = (req->endpoint & USB_ENDPOINT_DIR_MASK) == USB_DIR_IN;
+    struct usbdevfs_urb *urb = priv->sg_urbs;
+    for (i = 0; i < iovcnt; i++) {
+        char *base = iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+        while (left) {
+            size_t length = left > MAX_USBFS_BUFFER_SIZE ? MAX_USBFS_BUFFER_SIZE : left;
+            urb->type = USBDEVFS_URB_TYPE_BULK;
+            urb->endpoint = req->endpoint;
+            urb->status = -1;
+            urb->buffer = base;
+            urb->buffer_length = length;
+            urb->usercontext = req;
+            // a short read ends the transfer, the kernel then cancels
+            // the URBs that continue it
+            if (urb != priv->sg_urbs)
+                urb->flags |= USBDEVFS_URB_BULK_CONTINUATION;
+            if (in && urb != priv->sg_urbs + count - 1)
+                urb->flags |= USBDEVFS_URB_SHORT_NOT_OK;
+            base += length;
+            left -= length;
+            urb++;
+        }
+    }
+
+    req->actual_length = 0;
+    priv->sg_count = count;
+    priv->sg_pending = 0;
+    for (i = 0; i < count; i++) {
+        if (usb_submit_urb(req->dev, &priv->sg_urbs[i]) < 0) {
+            int saved_errno = errno;
+            D("usb_request_queue_sg segment %d failed errno %d\n", i, errno);
+            if (!priv->sg_pending)
+                return -1;
+            // what is already in flight still completes the request
+            priv->queued = 1;
+            usb_request_cancel(req);
+            errno = saved_errno;
+            return -1;
+        }
+        priv->sg_pending++;
+    }
+    priv->queued = 1;
+    return 0;
+}
+
+// Accounts for a reaped URB. Returns its request if that is now complete,
+// or NULL if other segments of it are still to come.
+static struct usb_request *usb_request_reaped(struct usbdevfs_urb *urb)
+{
+    struct usb_request *req = (struct usb_request*)urb->usercontext;
+    struct usb_request_private *priv = req->private_data;
+
+    D("[ urb @%p status = %d, actual = %d ]\n",
+        urb, urb->status, urb->actual_length);
+    if (urb == &priv->urb) {
+        req->actual_length = urb->actual_length;
+    } else {
+        req->actual_length += urb->actual_length;
+        if (--priv->sg_pending > 0)
+            return NULL;
+    }
+    priv->queued = 0;
+    return req;
+}
+
 struct usb_request *usb_request_wait(struct usb_device *dev)
 {
     struct usbdevfs_urb *urb = NULL;
@@ -691,19 +869,155 @@ struct usb_request *usb_request_wait(struct usb_device *dev)
             D("[ reap urb - error ]\n");
             return NULL;
         } else {
-            D("[ urb @%p status = %d, actual = %d ]\n",
-                urb, urb->status, urb->actual_length);
-            req = (struct usb_request*)urb->usercontext;
-            req->actual_length = urb->actual_length;
+            req = usb_request_reaped(urb);
+            if (!req)
+                continue;
         }
         break;
     }
     return req;
 }
 
+struct usb_request *usb_request_reap(struct usb_device *dev)
+{
+    struct usbdevfs_urb *urb = NULL;
+    struct usb_request *req = NULL;
+
+    while (!req) {
+        int res = ioctl(dev->fd, USBDEVFS_REAPURBNDELAY, &urb);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            // EAGAIN when nothing has completed
+            return NULL;
+        }
+        req = usb_request_reaped(urb);
+    }
+    return req;
+}
+
 int usb_request_cancel(struct usb_request *req)
 {
-    struct usbdevfs_urb *urb = ((struct usbdevfs_urb*)req->private_data);
-    return ioctl(req->dev->fd, USBDEVFS_DISCARDURB, urb);
+    struct usb_request_private *priv = req->private_data;
+    int i, res;
+
+    if (!priv->sg_pending)
+        return ioctl(req->dev->fd, USBDEVFS_DISCARDURB, &priv->urb);
+
+    // segments that already completed fail with EINVAL, which is fine
+    res = -1;
+    for (i = 0; i < priv->sg_count; i++) {
+        if (ioctl(req->dev->fd, USBDEVFS_DISCARDURB, &priv->sg_urbs[i]) == 0)
+            res = 0;
+    }
+    return res;
+}
+
+struct usb_request_ring *usb_request_ring_new(struct usb_device *dev,
+        const struct usb_endpoint_descriptor *ep_desc, int count, int buffer_length)
+{
+    struct usb_request_ring *ring;
+    int i;
+
+    if (count <= 0 || buffer_length <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ring = calloc(1, sizeof(struct usb_request_ring));
+    if (!ring)
+        return NULL;
+    ring->requests = calloc(count, sizeof(struct usb_request *));
+    ring->buffers = malloc((size_t)count * buffer_length);
+    if (!ring->requests || !ring->buffers)
+        goto failed;
+
+    for (i = 0; i < count; i++) {
+        struct usb_request *req = usb_request_new(dev, ep_desc);
+        if (!req)
+            goto failed;
+        req->buffer = (char *)ring->buffers + (size_t)i * buffer_length;
+        req->buffer_length = buffer_length;
+        ring->requests[ring->count++] = req;
+    }
+    return ring;
+
+failed:
+    usb_request_ring_free(ring);
+    return NULL;
+}
+
+void usb_request_ring_free(struct usb_request_ring *ring)
+{
+    int i;
+
+    for (i = 0; i < ring->count; i++) {
+        if (usb_request_is_queued(ring->requests[i]))
+            D("usb_request_ring_free: request %d still queued\n", i);
+        usb_request_free(ring->requests[i]);
+    }
+    free(ring->requests);
+    free(ring->buffers);
+    free(ring);
+}
+
+int usb_request_ring_get_count(struct usb_request_ring *ring)
+{
+    return ring->count;
+}
+
+struct usb_request *usb_request_ring_get_request(struct usb_request_ring *ring, int index)
+{
+    if (index < 0 || index >= ring->count)
+        return NULL;
+    return ring->requests[index];
+}
+
+int usb_request_is_queued(struct usb_request *req)
+{
+    return ((struct usb_request_private *)req->private_data)->queued;
 }
 
+int usb_request_ring_queue(struct usb_request_ring *ring)
+{
+    int i, queued = 0;
+
+    for (i = 0; i < ring->count; i++) {
+        struct usb_request *req = ring->requests[i];
+        int res;
+
+        if (usb_request_is_queued(req))
+            continue;
+        if (req->buffer_length > MAX_USBFS_BUFFER_SIZE) {
+            struct iovec iov = { req->buffer, req->buffer_length };
+            res = usb_request_queue_sg(req, &iov, 1);
+        } else {
+            res = usb_request_queue(req);
+        }
+        if (res < 0)
+            return queued ? queued : -1;
+        queued++;
+    }
+    return queued;
+}
+
+int usb_request_ring_get_pending(struct usb_request_ring *ring)
+{
+    int i, pending = 0;
+
+    for (i = 0; i < ring->count; i++) {
+        if (usb_request_is_queued(ring->requests[i]))
+            pending++;
+    }
+    return pending;
+}
+
+void usb_request_ring_cancel(struct usb_request_ring *ring)
+{
+    int i;
+
+    for (i = 0; i < ring->count; i++) {
+        if (usb_request_is_queued(ring->requests[i]))
+            usb_request_cancel(ring->requests[i]);
+    }
+}
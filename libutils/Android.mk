@@ -30,6 +30,7 @@ commonSources:= \
 	Static.cpp \
 	StopWatch.cpp \
 	String8.cpp \
+	String8Pool.cpp \
 	String16.cpp \
 	SystemClock.cpp \
 	Threads.cpp \
@@ -53,7 +54,7 @@ endif
 include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= $(commonSources)
 ifeq ($(HOST_OS), linux)
-LOCAL_SRC_FILES += Looper.cpp
+LOCAL_SRC_FILES += Looper.cpp ThreadPool.cpp
 endif
 ifeq ($(HOST_OS),darwin)
 LOCAL_CFLAGS += -Wno-unused-parameter
@@ -76,6 +77,7 @@ LOCAL_SRC_FILES:= \
 	$(commonSources) \
 	BlobCache.cpp \
 	Looper.cpp \
+	ThreadPool.cpp \
 	Trace.cpp
 
 ifeq ($(TARGET_ARCH),mips)
@@ -23,6 +23,7 @@
 
 #include <utils/BlobCache.h>
 #include <utils/Errors.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 
 #include <cutils/properties.h>
@@ -33,7 +34,7 @@ namespace android {
 static const uint32_t blobCacheMagic = ('_' << 24) + ('B' << 16) + ('b' << 8) + '$';
 
 // BlobCache::Header::mBlobCacheVersion value
-static const uint32_t blobCacheVersion = 3;
+static const uint32_t blobCacheVersion = 4;
 
 // BlobCache::Header::mDeviceVersion value
 static const uint32_t blobCacheDeviceVersion = 1;
@@ -56,39 +57,48 @@ BlobCache::BlobCache(size_t maxKeySize, size_t maxValueSize, size_t maxTotalSize
 
 void BlobCache::set(const void* key, size_t keySize, const void* value,
         size_t valueSize) {
+    if (isCacheable(keySize, valueSize)) {
+        setEntry(key, keySize, hashKey(key, keySize), value, valueSize, true);
+    }
+}
+
+bool BlobCache::isCacheable(size_t keySize, size_t valueSize) const {
     if (mMaxKeySize < keySize) {
         ALOGV("set: not caching because the key is too large: %zu (limit: %zu)",
                 keySize, mMaxKeySize);
-        return;
+        return false;
     }
     if (mMaxValueSize < valueSize) {
         ALOGV("set: not caching because the value is too large: %zu (limit: %zu)",
                 valueSize, mMaxValueSize);
-        return;
+        return false;
     }
     if (mMaxTotalSize < keySize + valueSize) {
         ALOGV("set: not caching because the combined key/value size is too "
                 "large: %zu (limit: %zu)", keySize + valueSize, mMaxTotalSize);
-        return;
+        return false;
     }
     if (keySize == 0) {
         ALOGW("set: not caching because keySize is 0");
-        return;
+        return false;
     }
     if (valueSize <= 0) {
         ALOGW("set: not caching because valueSize is 0");
-        return;
+        return false;
     }
+    return true;
+}
 
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
+void BlobCache::setEntry(const void* key, size_t keySize, uint32_t keyHash,
+        const void* value, size_t valueSize, bool copyData) {
+    CacheKey cacheKey(key, keySize, keyHash);
 
     while (true) {
-        ssize_t index = mCacheEntries.indexOf(dummyEntry);
+        ssize_t index = mIndex.indexOfKey(cacheKey);
         if (index < 0) {
             // Create a new cache entry.
-            sp<Blob> keyBlob(new Blob(key, keySize, true));
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
+            sp<Blob> keyBlob(new Blob(key, keySize, copyData));
+            sp<Blob> valueBlob(new Blob(value, valueSize, copyData));
             size_t newTotalSize = mTotalSize + keySize + valueSize;
             if (mMaxTotalSize < newTotalSize) {
                 if (isCleanable()) {
@@ -103,13 +113,15 @@ void BlobCache::set(const void* key, size_t keySize, const void* value,
                     break;
                 }
             }
-            mCacheEntries.add(CacheEntry(keyBlob, valueBlob));
+            mIndex.add(CacheKey(keyBlob->getData(), keySize, keyHash),
+                    mCacheEntries.add(CacheEntry(keyBlob, keyHash, valueBlob)));
             mTotalSize = newTotalSize;
             ALOGV("set: created new cache entry with %zu byte key and %zu byte value",
                     keySize, valueSize);
         } else {
             // Update the existing cache entry.
-            sp<Blob> valueBlob(new Blob(value, valueSize, true));
+            index = mIndex.valueAt(index);
+            sp<Blob> valueBlob(new Blob(value, valueSize, copyData));
             sp<Blob> oldValueBlob(mCacheEntries[index].getValue());
             size_t newTotalSize = mTotalSize + valueSize - oldValueBlob->getSize();
             if (mMaxTotalSize < newTotalSize) {
@@ -140,9 +152,7 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
                 keySize, mMaxKeySize);
         return 0;
     }
-    sp<Blob> dummyKey(new Blob(key, keySize, false));
-    CacheEntry dummyEntry(dummyKey, NULL);
-    ssize_t index = mCacheEntries.indexOf(dummyEntry);
+    ssize_t index = mIndex.indexOfKey(CacheKey(key, keySize, hashKey(key, keySize)));
     if (index < 0) {
         ALOGV("get: no cache entry found for key of size %zu", keySize);
         return 0;
@@ -150,7 +160,7 @@ size_t BlobCache::get(const void* key, size_t keySize, void* value,
 
     // The key was found. Return the value if the caller's buffer is large
     // enough.
-    sp<Blob> valueBlob(mCacheEntries[index].getValue());
+    const Blob* valueBlob = mCacheEntries[mIndex.valueAt(index)].getValue().get();
     size_t valueBlobSize = valueBlob->getSize();
     if (valueBlobSize <= valueSize) {
         ALOGV("get: copying %zu bytes to caller's buffer", valueBlobSize);
@@ -214,6 +224,7 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
             &byteBuffer[byteOffset]);
         eheader->mKeySize = keySize;
         eheader->mValueSize = valueSize;
+        eheader->mKeyHash = e.getKeyHash();
 
         memcpy(eheader->mData, keyBlob->getData(), keySize);
         memcpy(eheader->mData + keySize, valueBlob->getData(), valueSize);
@@ -231,8 +242,18 @@ status_t BlobCache::flatten(void* buffer, size_t size) const {
 }
 
 status_t BlobCache::unflatten(void const* buffer, size_t size) {
+    return unflattenEntries(buffer, size, true);
+}
+
+status_t BlobCache::unflattenInPlace(void const* buffer, size_t size) {
+    return unflattenEntries(buffer, size, false);
+}
+
+status_t BlobCache::unflattenEntries(void const* buffer, size_t size, bool copyData) {
     // All errors should result in the BlobCache being in an empty state.
     mCacheEntries.clear();
+    mIndex.clear();
+    mTotalSize = 0;
 
     // Read the cache header
     if (size < sizeof(Header)) {
@@ -258,9 +279,15 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
     const uint8_t* byteBuffer = reinterpret_cast<const uint8_t*>(buffer);
     off_t byteOffset = align4(sizeof(Header) + header->mBuildIdLength);
     size_t numEntries = header->mNumEntries;
+    size_t maxEntries = size > size_t(byteOffset) ?
+            (size - byteOffset) / align4(sizeof(EntryHeader)) : 0;
+    mCacheEntries.setCapacity(numEntries < maxEntries ? numEntries : maxEntries);
+    mIndex.rehash(numEntries < maxEntries ? numEntries : maxEntries);
     for (size_t i = 0; i < numEntries; i++) {
         if (byteOffset + sizeof(EntryHeader) > size) {
             mCacheEntries.clear();
+            mIndex.clear();
+            mTotalSize = 0;
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
@@ -274,12 +301,16 @@ status_t BlobCache::unflatten(void const* buffer, size_t size) {
         size_t totalSize = align4(entrySize);
         if (byteOffset + totalSize > size) {
             mCacheEntries.clear();
+            mIndex.clear();
+            mTotalSize = 0;
             ALOGE("unflatten: not enough room for cache entry headers");
             return BAD_VALUE;
         }
 
         const uint8_t* data = eheader->mData;
-        set(data, keySize, data + keySize, valueSize);
+        if (isCacheable(keySize, valueSize)) {
+            setEntry(data, keySize, eheader->mKeyHash, data + keySize, valueSize, copyData);
+        }
 
         byteOffset += totalSize;
     }
@@ -302,8 +333,30 @@ void BlobCache::clean() {
         size_t i = size_t(blob_random() % (mCacheEntries.size()));
         const CacheEntry& entry(mCacheEntries[i]);
         mTotalSize -= entry.getKey()->getSize() + entry.getValue()->getSize();
-        mCacheEntries.removeAt(i);
+        removeEntryAt(i);
+    }
+}
+
+void BlobCache::removeEntryAt(size_t index) {
+    const CacheEntry& entry(mCacheEntries[index]);
+    sp<Blob> key(entry.getKey());
+    mIndex.removeItem(CacheKey(key->getData(), key->getSize(), entry.getKeyHash()));
+
+    size_t last = mCacheEntries.size() - 1;
+    if (index != last) {
+        CacheEntry lastEntry(mCacheEntries[last]);
+        sp<Blob> lastKey(lastEntry.getKey());
+        ssize_t lastIndex = mIndex.indexOfKey(
+                CacheKey(lastKey->getData(), lastKey->getSize(), lastEntry.getKeyHash()));
+        mIndex.editValueAt(lastIndex) = index;
+        mCacheEntries.editItemAt(index) = lastEntry;
     }
+    mCacheEntries.removeAt(last);
+}
+
+uint32_t BlobCache::hashKey(const void* key, size_t keySize) {
+    return JenkinsHashWhiten(JenkinsHashMixBytes(0,
+            static_cast<const uint8_t*>(key), keySize));
 }
 
 bool BlobCache::isCleanable() const {
@@ -325,14 +378,6 @@ BlobCache::Blob::~Blob() {
     }
 }
 
-bool BlobCache::Blob::operator<(const Blob& rhs) const {
-    if (mSize == rhs.mSize) {
-        return memcmp(mData, rhs.mData, mSize) < 0;
-    } else {
-        return mSize < rhs.mSize;
-    }
-}
-
 const void* BlobCache::Blob::getData() const {
     return mData;
 }
@@ -341,25 +386,26 @@ size_t BlobCache::Blob::getSize() const {
     return mSize;
 }
 
-BlobCache::CacheEntry::CacheEntry() {
+BlobCache::CacheEntry::CacheEntry():
+        mKeyHash(0) {
 }
 
-BlobCache::CacheEntry::CacheEntry(const sp<Blob>& key, const sp<Blob>& value):
+BlobCache::CacheEntry::CacheEntry(const sp<Blob>& key, uint32_t keyHash,
+        const sp<Blob>& value):
         mKey(key),
+        mKeyHash(keyHash),
         mValue(value) {
 }
 
 BlobCache::CacheEntry::CacheEntry(const CacheEntry& ce):
         mKey(ce.mKey),
+        mKeyHash(ce.mKeyHash),
         mValue(ce.mValue) {
 }
 
-bool BlobCache::CacheEntry::operator<(const CacheEntry& rhs) const {
-    return *mKey < *rhs.mKey;
-}
-
 const BlobCache::CacheEntry& BlobCache::CacheEntry::operator=(const CacheEntry& rhs) {
     mKey = rhs.mKey;
+    mKeyHash = rhs.mKeyHash;
     mValue = rhs.mValue;
     return *this;
 }
@@ -368,6 +414,10 @@ sp<BlobCache::Blob> BlobCache::CacheEntry::getKey() const {
     return mKey;
 }
 
+uint32_t BlobCache::CacheEntry::getKeyHash() const {
+    return mKeyHash;
+}
+
 sp<BlobCache::Blob> BlobCache::CacheEntry::getValue() const {
     return mValue;
 }
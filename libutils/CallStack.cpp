@@ -23,9 +23,26 @@
 #include <UniquePtr.h>
 
 #include <backtrace/Backtrace.h>
+#include <backtrace/BacktraceMap.h>
+
+#include <pthread.h>
 
 namespace android {
 
+// One map of the process is shared by all call stacks, so that capturing a
+// stack does not read and parse /proc/self/maps every time.  The map is not
+// thread-safe (it regenerates itself when it misses an address), so the lock
+// is held for the whole capture.
+static pthread_mutex_t gMapLock = PTHREAD_MUTEX_INITIALIZER;
+static BacktraceMap* gMap = NULL;
+
+static BacktraceMap* getMapLocked() {
+    if (gMap == NULL) {
+        gMap = BacktraceMap::Create(getpid());
+    }
+    return gMap;
+}
+
 CallStack::CallStack() {
 }
 
@@ -40,13 +57,38 @@ CallStack::~CallStack() {
 void CallStack::update(int32_t ignoreDepth, pid_t tid) {
     mFrameLines.clear();
 
-    UniquePtr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS, tid));
+    pthread_mutex_lock(&gMapLock);
+    UniquePtr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS, tid,
+            getMapLocked()));
     if (!backtrace->Unwind(ignoreDepth)) {
         ALOGW("%s: Failed to unwind callstack.", __FUNCTION__);
     }
     for (size_t i = 0; i < backtrace->NumFrames(); i++) {
       mFrameLines.push_back(String8(backtrace->FormatFrameData(i).c_str()));
     }
+    pthread_mutex_unlock(&gMapLock);
+}
+
+void CallStack::updateFast(int32_t ignoreDepth) {
+    mFrameLines.clear();
+
+    pthread_mutex_lock(&gMapLock);
+    UniquePtr<Backtrace> backtrace(Backtrace::Create(BACKTRACE_CURRENT_PROCESS,
+            BACKTRACE_CURRENT_THREAD, getMapLocked()));
+    if (!backtrace->UnwindFramePointers(ignoreDepth) && !backtrace->Unwind(ignoreDepth)) {
+        ALOGW("%s: Failed to unwind callstack.", __FUNCTION__);
+    }
+    for (size_t i = 0; i < backtrace->NumFrames(); i++) {
+      mFrameLines.push_back(String8(backtrace->FormatFrameData(i).c_str()));
+    }
+    pthread_mutex_unlock(&gMapLock);
+}
+
+void CallStack::invalidateMapCache() {
+    pthread_mutex_lock(&gMapLock);
+    delete gMap;
+    gMap = NULL;
+    pthread_mutex_unlock(&gMapLock);
 }
 
 void CallStack::log(const char* logtag, android_LogPriority priority, const char* prefix) const {
@@ -83,6 +83,12 @@ FileMap::~FileMap(void)
 // Returns "false" on failure.
 bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
         bool readOnly)
+{
+    return create(origFileName, fd, offset, length, readOnly, 0);
+}
+
+bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t length,
+        bool readOnly, uint32_t createFlags)
 {
 #if defined(__MINGW32__)
     int     adjust;
@@ -147,6 +153,10 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
     adjLength = length + adjust;
 
     flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+    if (createFlags & POPULATE)
+        flags |= MAP_POPULATE;
+#endif
     prot = PROT_READ;
     if (!readOnly)
         prot |= PROT_WRITE;
@@ -158,6 +168,11 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
         return false;
     }
     mBasePtr = ptr;
+#if !defined(MAP_POPULATE)
+    // At least start reading it in.
+    if (createFlags & POPULATE)
+        madvise(mBasePtr, adjLength, MADV_WILLNEED);
+#endif
 #endif // !defined(__MINGW32__)
 
     mFileName = origFileName != NULL ? strdup(origFileName) : NULL;
@@ -174,22 +189,48 @@ bool FileMap::create(const char* origFileName, int fd, off64_t offset, size_t le
     return true;
 }
 
+// Find the pages of the map that hold a range of the data.
+bool FileMap::getPageRange(size_t offset, size_t length,
+        void** outStart, size_t* outLength) const
+{
+    if (mBasePtr == NULL || offset >= mDataLength || length == 0)
+        return false;
+    if (length > mDataLength - offset)
+        length = mDataLength - offset;
+
+    // mBasePtr is page aligned, and so are offsets from it rounded down.
+    size_t start = (char*) mDataPtr - (char*) mBasePtr + offset;
+    size_t alignedStart = start - start % mPageSize;
+    *outStart = (char*) mBasePtr + alignedStart;
+    *outLength = start + length - alignedStart;
+    return true;
+}
+
 // Provide guidance to the system.
 #if !defined(_WIN32)
+static int toSysAdvice(FileMap::MapAdvice advice)
+{
+    switch (advice) {
+        case FileMap::NORMAL:       return MADV_NORMAL;
+        case FileMap::RANDOM:       return MADV_RANDOM;
+        case FileMap::SEQUENTIAL:   return MADV_SEQUENTIAL;
+        case FileMap::WILLNEED:     return MADV_WILLNEED;
+        case FileMap::DONTNEED:     return MADV_DONTNEED;
+#if defined(MADV_HUGEPAGE)
+        case FileMap::HUGEPAGE:     return MADV_HUGEPAGE;
+        case FileMap::NOHUGEPAGE:   return MADV_NOHUGEPAGE;
+#endif
+        default:                    return -1;
+    }
+}
+
 int FileMap::advise(MapAdvice advice)
 {
     int cc, sysAdvice;
 
-    switch (advice) {
-        case NORMAL:        sysAdvice = MADV_NORMAL;        break;
-        case RANDOM:        sysAdvice = MADV_RANDOM;        break;
-        case SEQUENTIAL:    sysAdvice = MADV_SEQUENTIAL;    break;
-        case WILLNEED:      sysAdvice = MADV_WILLNEED;      break;
-        case DONTNEED:      sysAdvice = MADV_DONTNEED;      break;
-        default:
-                            assert(false);
-                            return -1;
-    }
+    sysAdvice = toSysAdvice(advice);
+    if (sysAdvice < 0)
+        return -1;
 
     cc = madvise(mBasePtr, mBaseLength, sysAdvice);
     if (cc != 0)
@@ -197,9 +238,75 @@ int FileMap::advise(MapAdvice advice)
     return cc;
 }
 
+int FileMap::advise(MapAdvice advice, size_t offset, size_t length)
+{
+    int cc, sysAdvice;
+    void* start;
+    size_t len;
+
+    sysAdvice = toSysAdvice(advice);
+    if (sysAdvice < 0)
+        return -1;
+    if (!getPageRange(offset, length, &start, &len))
+        return 0;
+
+    cc = madvise(start, len, sysAdvice);
+    if (cc != 0)
+        ALOGW("madvise(%d) failed: %s\n", sysAdvice, strerror(errno));
+    return cc;
+}
+
+ssize_t FileMap::getResidentPageCount(size_t offset, size_t length,
+        size_t* outPageCount) const
+{
+#if defined(__APPLE__)
+    char vec[256];
+#else
+    unsigned char vec[256];
+#endif
+    void* start;
+    size_t len;
+
+    if (!getPageRange(offset, length, &start, &len)) {
+        if (outPageCount != NULL)
+            *outPageCount = 0;
+        return 0;
+    }
+
+    size_t pageCount = (len + mPageSize - 1) / mPageSize;
+    size_t resident = 0;
+    // A bounded vector at a time, so that large maps need no allocation.
+    for (size_t page = 0; page < pageCount; page += sizeof(vec)) {
+        size_t count = pageCount - page;
+        if (count > sizeof(vec))
+            count = sizeof(vec);
+        if (mincore((char*) start + page * mPageSize, count * mPageSize, vec) != 0) {
+            ALOGW("mincore failed: %s\n", strerror(errno));
+            return -1;
+        }
+        for (size_t i = 0; i < count; i++)
+            resident += vec[i] & 1;
+    }
+
+    if (outPageCount != NULL)
+        *outPageCount = pageCount;
+    return resident;
+}
+
 #else
 int FileMap::advise(MapAdvice /* advice */)
 {
     return -1;
 }
+
+int FileMap::advise(MapAdvice /* advice */, size_t /* offset */, size_t /* length */)
+{
+    return -1;
+}
+
+ssize_t FileMap::getResidentPageCount(size_t /* offset */, size_t /* length */,
+        size_t* /* outPageCount */) const
+{
+    return -1;
+}
 #endif
@@ -22,6 +22,9 @@
 #include <limits.h>
 #include <inttypes.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include <algorithm>
 
 
 namespace android {
@@ -63,24 +66,42 @@ int SimpleLooperCallback::handleEvent(int fd, int events, void* data) {
 static const int EPOLL_SIZE_HINT = 8;
 
 // Maximum number of file descriptors for which to retrieve poll events each iteration.
-static const int EPOLL_MAX_EVENTS = 16;
+// Loopers watching many busy fds would otherwise go around the loop, and take the lock,
+// once per handful of events.
+static const int EPOLL_MAX_EVENTS = 64;
+
+// The clock systemTime(SYSTEM_TIME_MONOTONIC) reads, and so message uptimes are on.
+#if defined(HAVE_ANDROID_OS)
+static const clockid_t TIMER_CLOCK = CLOCK_MONOTONIC;
+#else
+static const clockid_t TIMER_CLOCK = CLOCK_REALTIME;
+#endif
 
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
-Looper::Looper(bool allowNonCallbacks) :
-        mAllowNonCallbacks(allowNonCallbacks), mSendingMessage(false),
-        mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
-        mNextRequestSeq(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX) {
+Looper::Looper(bool allowNonCallbacks, bool preciseTimers) :
+        mAllowNonCallbacks(allowNonCallbacks), mTimerFd(-1), mNextMessageSeq(0),
+        mSendingMessage(false), mPolling(false), mEpollFd(-1), mEpollRebuildRequired(false),
+        mNextRequestSeq(0), mResponseIndex(0), mNextMessageUptime(LLONG_MAX),
+        mTimerUptime(LLONG_MAX) {
     mWakeEventFd = eventfd(0, EFD_NONBLOCK);
     LOG_ALWAYS_FATAL_IF(mWakeEventFd < 0, "Could not make wake event fd.  errno=%d", errno);
 
+    if (preciseTimers) {
+        mTimerFd = timerfd_create(TIMER_CLOCK, TFD_NONBLOCK);
+        LOG_ALWAYS_FATAL_IF(mTimerFd < 0, "Could not make timer fd.  errno=%d", errno);
+    }
+
     AutoMutex _l(mLock);
     rebuildEpollLocked();
 }
 
 Looper::~Looper() {
     close(mWakeEventFd);
+    if (mTimerFd >= 0) {
+        close(mTimerFd);
+    }
     if (mEpollFd >= 0) {
         close(mEpollFd);
     }
@@ -123,7 +144,7 @@ sp<Looper> Looper::prepare(int opts) {
     bool allowNonCallbacks = opts & PREPARE_ALLOW_NON_CALLBACKS;
     sp<Looper> looper = Looper::getForThread();
     if (looper == NULL) {
-        looper = new Looper(allowNonCallbacks);
+        looper = new Looper(allowNonCallbacks, opts & PREPARE_PRECISE_TIMERS);
         Looper::setForThread(looper);
     }
     if (looper->getAllowNonCallbacks() != allowNonCallbacks) {
@@ -158,6 +179,13 @@ void Looper::rebuildEpollLocked() {
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake event fd to epoll instance.  errno=%d",
             errno);
 
+    if (mTimerFd >= 0) {
+        eventItem.data.fd = mTimerFd;
+        result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, & eventItem);
+        LOG_ALWAYS_FATAL_IF(result != 0, "Could not add timer fd to epoll instance.  errno=%d",
+                errno);
+    }
+
     for (size_t i = 0; i < mRequests.size(); i++) {
         const Request& request = mRequests.valueAt(i);
         struct epoll_event eventItem;
@@ -222,8 +250,11 @@ int Looper::pollInner(int timeoutMillis) {
     ALOGD("%p ~ pollOnce - waiting: timeoutMillis=%d", this, timeoutMillis);
 #endif
 
-    // Adjust the timeout based on when the next message is due.
-    if (timeoutMillis != 0 && mNextMessageUptime != LLONG_MAX) {
+    // Adjust the timeout based on when the next message is due, or have the timer
+    // wake us up then.
+    if (mTimerFd >= 0) {
+        setTimer(mNextMessageUptime);
+    } else if (timeoutMillis != 0 && mNextMessageUptime != LLONG_MAX) {
         nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
         int messageTimeoutMillis = toMillisecondTimeoutDelay(now, mNextMessageUptime);
         if (messageTimeoutMillis >= 0
@@ -293,6 +324,11 @@ int Looper::pollInner(int timeoutMillis) {
             } else {
                 ALOGW("Ignoring unexpected epoll events 0x%x on wake event fd.", epollEvents);
             }
+        } else if (fd == mTimerFd) {
+            // The messages that are due are sent below.
+            uint64_t expirations;
+            TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(uint64_t)));
+            mTimerUptime = LLONG_MAX;
         } else {
             ssize_t requestIndex = mRequests.indexOfKey(fd);
             if (requestIndex >= 0) {
@@ -323,7 +359,9 @@ Done: ;
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                        MessageEnvelope::sendsAfter);
+                mMessageEnvelopes.removeAt(mMessageEnvelopes.size() - 1);
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -424,6 +462,27 @@ void Looper::awoken() {
     TEMP_FAILURE_RETRY(read(mWakeEventFd, &counter, sizeof(uint64_t)));
 }
 
+void Looper::setTimer(nsecs_t uptime) {
+    if (uptime == mTimerUptime) {
+        return;
+    }
+
+    // A zero time disarms the timer, messages due at or before it are set for
+    // the first nanosecond instead.
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (uptime != LLONG_MAX) {
+        nsecs_t time = uptime > 0 ? uptime : 1;
+        spec.it_value.tv_sec = time / 1000000000LL;
+        spec.it_value.tv_nsec = time % 1000000000LL;
+    }
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+        ALOGW("Could not set timer fd, errno=%d", errno);
+        return;
+    }
+    mTimerUptime = uptime;
+}
+
 void Looper::pushResponse(int events, const Request& request) {
     Response response;
     response.events = events;
@@ -598,17 +657,16 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool atHead;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
+        // Messages for the same time go after those already queued.
+        atHead = mMessageEnvelopes.isEmpty() || uptime < mMessageEnvelopes.itemAt(0).uptime;
 
-        MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        mMessageEnvelopes.push_back(MessageEnvelope(uptime, mNextMessageSeq++, handler, message));
+        std::push_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                MessageEnvelope::sendsAfter);
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -620,7 +678,7 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (atHead) {
         wake();
     }
 }
@@ -632,13 +690,7 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
 
     { // acquire lock
         AutoMutex _l(mLock);
-
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler) {
-                mMessageEnvelopes.removeAt(i);
-            }
-        }
+        removeMessagesLocked(handler, NULL);
     } // release lock
 }
 
@@ -649,15 +701,34 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
 
     { // acquire lock
         AutoMutex _l(mLock);
+        removeMessagesLocked(handler, &what);
+    } // release lock
+}
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
-            const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
-            if (messageEnvelope.handler == handler
-                    && messageEnvelope.message.what == what) {
-                mMessageEnvelopes.removeAt(i);
-            }
+void Looper::removeMessagesLocked(const sp<MessageHandler>& handler, const int* what) {
+    // Keep the other messages in a single pass and reorder them into a heap
+    // afterwards, rather than shifting the queue down for every message removed.
+    size_t count = mMessageEnvelopes.size();
+    if (count == 0) {
+        return;
+    }
+    MessageEnvelope* envelopes = mMessageEnvelopes.editArray();
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (envelopes[i].handler == handler
+                && (what == NULL || envelopes[i].message.what == *what)) {
+            continue;
         }
-    } // release lock
+        if (kept != i) {
+            envelopes[kept] = envelopes[i];
+        }
+        kept += 1;
+    }
+    if (kept != count) {
+        mMessageEnvelopes.removeItemsAt(kept, count - kept);
+        std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                MessageEnvelope::sendsAfter);
+    }
 }
 
 bool Looper::isPolling() const {
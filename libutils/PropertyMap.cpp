@@ -21,6 +21,7 @@
 
 #include <utils/PropertyMap.h>
 #include <utils/Log.h>
+#include <utils/String8Pool.h>
 
 // Enables debug output for the parser.
 #define DEBUG_PARSER 0
@@ -34,6 +35,10 @@ namespace android {
 static const char* WHITESPACE = " \t\r";
 static const char* WHITESPACE_OR_PROPERTY_DELIMITER = " \t\r=";
 
+// Keys recur across the many property files a process may load, such as the
+// configurations of its input devices, so their strings are shared.
+static String8Pool gPropertyKeys;
+
 
 // --- PropertyMap ---
 
@@ -170,7 +175,8 @@ status_t PropertyMap::Parser::parse() {
         mTokenizer->skipDelimiters(WHITESPACE);
 
         if (!mTokenizer->isEol() && mTokenizer->peekChar() != '#') {
-            String8 keyToken = mTokenizer->nextToken(WHITESPACE_OR_PROPERTY_DELIMITER);
+            String8 keyToken = mTokenizer->nextToken(WHITESPACE_OR_PROPERTY_DELIMITER,
+                    &gPropertyKeys);
             if (keyToken.isEmpty()) {
                 ALOGE("%s: Expected non-empty property key.", mTokenizer->getLocation().string());
                 return BAD_VALUE;
@@ -18,6 +18,7 @@
 // #define LOG_NDEBUG 0
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -27,6 +28,7 @@
 
 #include <utils/RefBase.h>
 
+#include <cutils/threads.h>
 #include <utils/Atomic.h>
 #include <utils/CallStack.h>
 #include <utils/Log.h>
@@ -53,6 +55,14 @@
 // log all reference counting operations
 #define PRINT_REFS                      0
 
+// record every reference counting operation, with the object, the count
+// before it and the caller's pc, in a ring per thread written without
+// locks; see RefBase::dumpRefTrace(). Cheap enough to leave on under load.
+#define DEBUG_REFS_TRACE                0
+
+// records kept per thread, a power of 2
+#define DEBUG_REFS_TRACE_RING_SIZE      4096
+
 // ---------------------------------------------------------------------------
 
 namespace android {
@@ -61,6 +71,126 @@ namespace android {
 
 // ---------------------------------------------------------------------------
 
+#if DEBUG_REFS_TRACE
+
+enum {
+    REF_TRACE_INC_STRONG,
+    REF_TRACE_DEC_STRONG,
+    REF_TRACE_FORCE_INC_STRONG,
+    REF_TRACE_INC_WEAK,
+    REF_TRACE_DEC_WEAK,
+    REF_TRACE_ATTEMPT_INC_STRONG,
+};
+
+static const char* const gRefTraceOps[] = {
+    "incStrong", "decStrong", "forceIncStrong", "incWeak", "decWeak",
+    "attemptIncStrong",
+};
+
+struct ref_trace_record {
+    const void*         object;
+    const void*         id;
+    const void*         pc;
+    int32_t             op;
+    int32_t             count;
+};
+
+// Only the owning thread writes a ring. Rings are never freed, so that the
+// events of threads that have exited can still be dumped.
+struct ref_trace_ring {
+    ref_trace_ring*     next;
+    pid_t               tid;
+    volatile int32_t    head;   // records written so far
+    ref_trace_record    records[DEBUG_REFS_TRACE_RING_SIZE];
+};
+
+static ref_trace_ring* volatile gRefTraceRings = NULL;
+static pthread_key_t gRefTraceKey;
+static pthread_once_t gRefTraceOnce = PTHREAD_ONCE_INIT;
+
+static void refTraceInit()
+{
+    pthread_key_create(&gRefTraceKey, NULL);
+}
+
+static ref_trace_ring* refTraceRing()
+{
+    pthread_once(&gRefTraceOnce, refTraceInit);
+    ref_trace_ring* ring = static_cast<ref_trace_ring*>(pthread_getspecific(gRefTraceKey));
+    if (ring == NULL) {
+        ring = static_cast<ref_trace_ring*>(calloc(1, sizeof(ref_trace_ring)));
+        if (ring == NULL) {
+            return NULL;
+        }
+        ring->tid = gettid();
+        do {
+            ring->next = gRefTraceRings;
+        } while (!__sync_bool_compare_and_swap(&gRefTraceRings, ring->next, ring));
+        pthread_setspecific(gRefTraceKey, ring);
+    }
+    return ring;
+}
+
+static void refTrace(int32_t op, const void* object, const void* id,
+        int32_t count, const void* pc)
+{
+    ref_trace_ring* ring = refTraceRing();
+    if (ring == NULL) {
+        return;
+    }
+    int32_t head = ring->head;
+    ref_trace_record& r = ring->records[head & (DEBUG_REFS_TRACE_RING_SIZE - 1)];
+    r.object = object;
+    r.id = id;
+    r.pc = pc;
+    r.op = op;
+    r.count = count;
+    android_atomic_release_store(head + 1, &ring->head);
+}
+
+#define REF_TRACE(op, object, id, count) \
+    refTrace(op, object, id, count, __builtin_return_address(0))
+
+void RefBase::dumpRefTrace(int fd)
+{
+    // The rings keep being written while we read them, so the oldest
+    // records of a busy thread may be overwritten as they are printed.
+    dprintf(fd, "tid object id op count pc\n");
+    for (ref_trace_ring* ring = gRefTraceRings; ring != NULL; ring = ring->next) {
+        int32_t head = android_atomic_acquire_load(&ring->head);
+        int32_t start = head > DEBUG_REFS_TRACE_RING_SIZE ?
+                head - DEBUG_REFS_TRACE_RING_SIZE : 0;
+        for (int32_t i = start; i < head; i++) {
+            const ref_trace_record& r = ring->records[i & (DEBUG_REFS_TRACE_RING_SIZE - 1)];
+            dprintf(fd, "%d %p %p %s %d %p\n", ring->tid, r.object, r.id,
+                    gRefTraceOps[r.op], r.count, r.pc);
+        }
+    }
+
+    dprintf(fd, "maps\n");
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps >= 0) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(maps, buf, sizeof(buf))) > 0) {
+            write(fd, buf, n);
+        }
+        close(maps);
+    }
+}
+
+#else
+
+#define REF_TRACE(op, object, id, count) do { } while (0)
+
+void RefBase::dumpRefTrace(int /*fd*/)
+{
+}
+
+#endif
+
+// ---------------------------------------------------------------------------
+
 class RefBase::weakref_impl : public RefBase::weakref_type
 {
 public:
@@ -235,7 +365,7 @@ private:
             ref->ref = mRef;
             ref->id = id;
 #if DEBUG_REFS_CALLSTACK_ENABLED
-            ref->stack.update(2);
+            ref->stack.updateFast(2);
 #endif
             ref->next = *refs;
             *refs = ref;
@@ -326,6 +456,7 @@ void RefBase::incStrong(const void* id) const
     
     refs->addStrongRef(id);
     const int32_t c = android_atomic_inc(&refs->mStrong);
+    REF_TRACE(REF_TRACE_INC_STRONG, this, id, c);
     ALOG_ASSERT(c > 0, "incStrong() called on %p after last strong ref", refs);
 #if PRINT_REFS
     ALOGD("incStrong of %p from %p: cnt=%d\n", this, id, c);
@@ -343,6 +474,7 @@ void RefBase::decStrong(const void* id) const
     weakref_impl* const refs = mRefs;
     refs->removeStrongRef(id);
     const int32_t c = android_atomic_dec(&refs->mStrong);
+    REF_TRACE(REF_TRACE_DEC_STRONG, this, id, c);
 #if PRINT_REFS
     ALOGD("decStrong of %p from %p: cnt=%d\n", this, id, c);
 #endif
@@ -363,6 +495,7 @@ void RefBase::forceIncStrong(const void* id) const
     
     refs->addStrongRef(id);
     const int32_t c = android_atomic_inc(&refs->mStrong);
+    REF_TRACE(REF_TRACE_FORCE_INC_STRONG, this, id, c);
     ALOG_ASSERT(c >= 0, "forceIncStrong called on %p after ref count underflow",
                refs);
 #if PRINT_REFS
@@ -393,6 +526,7 @@ void RefBase::weakref_type::incWeak(const void* id)
     weakref_impl* const impl = static_cast<weakref_impl*>(this);
     impl->addWeakRef(id);
     const int32_t c __unused = android_atomic_inc(&impl->mWeak);
+    REF_TRACE(REF_TRACE_INC_WEAK, impl->mBase, id, c);
     ALOG_ASSERT(c >= 0, "incWeak called on %p after last weak ref", this);
 }
 
@@ -402,6 +536,7 @@ void RefBase::weakref_type::decWeak(const void* id)
     weakref_impl* const impl = static_cast<weakref_impl*>(this);
     impl->removeWeakRef(id);
     const int32_t c = android_atomic_dec(&impl->mWeak);
+    REF_TRACE(REF_TRACE_DEC_WEAK, impl->mBase, id, c);
     ALOG_ASSERT(c >= 1, "decWeak called on %p too many times", this);
     if (c != 1) return;
 
@@ -508,6 +643,7 @@ bool RefBase::weakref_type::attemptIncStrong(const void* id)
     }
     
     impl->addStrongRef(id);
+    REF_TRACE(REF_TRACE_ATTEMPT_INC_STRONG, impl->mBase, id, curCount);
 
 #if PRINT_REFS
     ALOGD("attemptIncStrong of %p from %p: cnt=%d\n", this, id, curCount);
@@ -19,6 +19,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 #include <log/log.h>
 #include <utils/SharedBuffer.h>
 #include <utils/Atomic.h>
@@ -27,6 +31,146 @@
 
 namespace android {
 
+// mReserved[0] of buffers carved from an arena block
+static const uint32_t kArenaBuffer = 0x41524e41; // 'ARNA'
+
+// Arena carvings and block headers are kept to this alignment, which is
+// what malloc() gives the buffers that don't come from an arena.
+static const size_t kArenaAlign = 16;
+
+static inline size_t arenaRound(size_t size) {
+    return (size + kArenaAlign - 1) & ~(kArenaAlign - 1);
+}
+
+struct SharedBufferArena::Block {
+    // buffers carved from the block and not yet released, plus one for as
+    // long as it is the arena's current block
+    volatile int32_t live;
+    size_t used;
+    size_t size;
+};
+
+#if !defined(_WIN32)
+static pthread_key_t gArenaKey;
+static pthread_once_t gArenaKeyOnce = PTHREAD_ONCE_INIT;
+// arenas alive in the process; until there is one, alloc() skips the lookup
+static volatile int32_t gArenaCount = 0;
+
+static void createArenaKey() {
+    pthread_key_create(&gArenaKey, NULL);
+}
+#endif
+
+SharedBufferArena::SharedBufferArena(size_t blockSize)
+    : mPrevious(NULL), mBlock(NULL), mBlockSize(blockSize)
+{
+#if !defined(_WIN32)
+    pthread_once(&gArenaKeyOnce, createArenaKey);
+    android_atomic_inc(&gArenaCount);
+    mPrevious = static_cast<SharedBufferArena*>(pthread_getspecific(gArenaKey));
+    pthread_setspecific(gArenaKey, this);
+#endif
+}
+
+SharedBufferArena::~SharedBufferArena()
+{
+#if !defined(_WIN32)
+    pthread_setspecific(gArenaKey, mPrevious);
+    android_atomic_dec(&gArenaCount);
+#endif
+    if (mBlock) {
+        releaseBlock(mBlock);
+    }
+}
+
+SharedBufferArena* SharedBufferArena::current()
+{
+#if !defined(_WIN32)
+    if (gArenaCount == 0) {
+        return NULL;
+    }
+    return static_cast<SharedBufferArena*>(pthread_getspecific(gArenaKey));
+#else
+    return NULL;
+#endif
+}
+
+SharedBuffer* SharedBufferArena::alloc(size_t size)
+{
+    // big buffers would waste most of a block, let malloc() have them
+    if (size > mBlockSize / 4) {
+        return NULL;
+    }
+
+    const size_t header = arenaRound(sizeof(Block));
+    const size_t needed = arenaRound(sizeof(SharedBuffer) + size);
+    if (mBlock == NULL || mBlock->size - mBlock->used < needed) {
+        Block* block = static_cast<Block*>(malloc(header + mBlockSize));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->live = 1;
+        block->used = header;
+        block->size = header + mBlockSize;
+        if (mBlock) {
+            releaseBlock(mBlock);
+        }
+        mBlock = block;
+    }
+
+    SharedBuffer* sb = reinterpret_cast<SharedBuffer*>(
+            reinterpret_cast<char*>(mBlock) + mBlock->used);
+    sb->mRefs = 1;
+    sb->mSize = size;
+    sb->mReserved[0] = kArenaBuffer;
+    sb->mReserved[1] = mBlock->used;
+    mBlock->used += needed;
+    android_atomic_inc(&mBlock->live);
+    return sb;
+}
+
+bool SharedBufferArena::resizeInPlace(SharedBuffer* buf, size_t newSize)
+{
+    const size_t start = buf->mReserved[1];
+    const size_t carved = arenaRound(sizeof(SharedBuffer) + buf->mSize);
+
+    // still fits in what it was carved with
+    if (newSize <= carved - sizeof(SharedBuffer)) {
+        buf->mSize = newSize;
+        return true;
+    }
+
+    // otherwise only the last buffer carved from the current block of this
+    // thread's arena can move its end
+    SharedBufferArena* arena = current();
+    Block* block = arena ? arena->mBlock : NULL;
+    if (block == NULL || newSize > arena->mBlockSize / 4
+            || reinterpret_cast<char*>(buf) - start != reinterpret_cast<char*>(block)
+            || start + carved != block->used) {
+        return false;
+    }
+    const size_t needed = arenaRound(sizeof(SharedBuffer) + newSize);
+    if (block->size - start < needed) {
+        return false;
+    }
+    block->used = start + needed;
+    buf->mSize = newSize;
+    return true;
+}
+
+void SharedBufferArena::releaseBuffer(const SharedBuffer* buf)
+{
+    releaseBlock(reinterpret_cast<Block*>(const_cast<char*>(
+            reinterpret_cast<const char*>(buf) - buf->mReserved[1])));
+}
+
+void SharedBufferArena::releaseBlock(Block* block)
+{
+    if (android_atomic_dec(&block->live) == 1) {
+        free(block);
+    }
+}
+
 SharedBuffer* SharedBuffer::alloc(size_t size)
 {
     // Don't overflow if the combined size of the buffer / header is larger than
@@ -34,19 +178,36 @@ SharedBuffer* SharedBuffer::alloc(size_t size)
     LOG_ALWAYS_FATAL_IF((size >= (SIZE_MAX - sizeof(SharedBuffer))),
                         "Invalid buffer size %zu", size);
 
+    SharedBufferArena* arena = SharedBufferArena::current();
+    if (arena) {
+        SharedBuffer* sb = arena->alloc(size);
+        if (sb) {
+            return sb;
+        }
+    }
+
     SharedBuffer* sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
     if (sb) {
         sb->mRefs = 1;
         sb->mSize = size;
+        sb->mReserved[0] = 0;
     }
     return sb;
 }
 
+void SharedBuffer::freeStorage() const
+{
+    if (mReserved[0] == kArenaBuffer) {
+        SharedBufferArena::releaseBuffer(this);
+    } else {
+        free(const_cast<SharedBuffer*>(this));
+    }
+}
 
 ssize_t SharedBuffer::dealloc(const SharedBuffer* released)
 {
     if (released->mRefs != 0) return -1; // XXX: invalid operation
-    free(const_cast<SharedBuffer*>(released));
+    released->freeStorage();
     return 0;
 }
 
@@ -73,10 +234,16 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
         LOG_ALWAYS_FATAL_IF((newSize >= (SIZE_MAX - sizeof(SharedBuffer))),
                             "Invalid buffer size %zu", newSize);
 
-        buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
-        if (buf != NULL) {
-            buf->mSize = newSize;
-            return buf;
+        if (buf->mReserved[0] == kArenaBuffer) {
+            if (SharedBufferArena::resizeInPlace(buf, newSize)) {
+                return buf;
+            }
+        } else {
+            buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
+            if (buf != NULL) {
+                buf->mSize = newSize;
+                return buf;
+            }
         }
     }
     SharedBuffer* sb = alloc(newSize);
@@ -116,7 +283,7 @@ int32_t SharedBuffer::release(uint32_t flags) const
     if (onlyOwner() || ((prev = android_atomic_dec(&mRefs)) == 1)) {
         mRefs = 0;
         if ((flags & eKeepStorage) == 0) {
-            free(const_cast<SharedBuffer*>(this));
+            freeStorage();
         }
     }
     return prev;
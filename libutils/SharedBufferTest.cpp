@@ -56,3 +56,72 @@ TEST(SharedBufferTest, TestEditResize) {
   ASSERT_EQ(0U, buf->size());
   buf->release();
 }
+
+TEST(SharedBufferTest, TestArenaAlloc) {
+  android::SharedBufferArena arena;
+  android::SharedBuffer* a = android::SharedBuffer::alloc(10);
+  android::SharedBuffer* b = android::SharedBuffer::alloc(10);
+  ASSERT_FALSE(NULL == a);
+  ASSERT_FALSE(NULL == b);
+  // carved one after the other from the same block
+  ASSERT_LT(reinterpret_cast<char*>(a), reinterpret_cast<char*>(b));
+  ASSERT_GT(reinterpret_cast<char*>(a) + 64, reinterpret_cast<char*>(b));
+  memset(a->data(), 'a', 10);
+  memset(b->data(), 'b', 10);
+  ASSERT_EQ('a', static_cast<char*>(a->data())[9]);
+  a->release();
+  b->release();
+}
+
+TEST(SharedBufferTest, TestArenaEditResize) {
+  android::SharedBufferArena arena;
+  android::SharedBuffer* buf = android::SharedBuffer::alloc(10);
+  memset(buf->data(), 'x', 10);
+
+  // the last buffer carved grows in place
+  android::SharedBuffer* grown = buf->editResize(1000);
+  ASSERT_EQ(buf, grown);
+  ASSERT_EQ(1000U, grown->size());
+  ASSERT_EQ('x', static_cast<char*>(grown->data())[9]);
+
+  // one that isn't moves, keeping its contents
+  android::SharedBuffer* other = android::SharedBuffer::alloc(10);
+  android::SharedBuffer* moved = grown->editResize(2000);
+  ASSERT_NE(grown, moved);
+  ASSERT_EQ('x', static_cast<char*>(moved->data())[9]);
+
+  // and so does one too big for the arena
+  moved = moved->editResize(android::SharedBufferArena::DEFAULT_BLOCK_SIZE);
+  ASSERT_EQ('x', static_cast<char*>(moved->data())[9]);
+
+  moved->release();
+  other->release();
+}
+
+TEST(SharedBufferTest, TestArenaOutlived) {
+  android::SharedBuffer* buf;
+  {
+    android::SharedBufferArena arena;
+    buf = android::SharedBuffer::alloc(10);
+    memset(buf->data(), 'y', 10);
+  }
+  // the block stays until its last buffer goes
+  ASSERT_EQ('y', static_cast<char*>(buf->data())[9]);
+  buf->acquire();
+  ASSERT_EQ(2, buf->release());
+  ASSERT_EQ(1, buf->release());
+}
+
+TEST(SharedBufferTest, TestArenaKeepStorage) {
+  android::SharedBufferArena arena(256);
+  android::SharedBuffer* buf = android::SharedBuffer::alloc(10);
+  ASSERT_EQ(1, buf->release(android::SharedBuffer::eKeepStorage));
+  ASSERT_EQ(0, android::SharedBuffer::dealloc(buf));
+
+  // blocks are replaced as they fill up
+  for (int i = 0; i < 100; i++) {
+    buf = android::SharedBuffer::alloc(48);
+    ASSERT_FALSE(NULL == buf);
+    buf->release();
+  }
+}
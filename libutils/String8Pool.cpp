@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8Pool.h>
+
+#include <string.h>
+
+namespace android {
+
+String8Pool::String8Pool() {
+}
+
+String8Pool::~String8Pool() {
+}
+
+// Orders the pool by the bytes of its strings, then by their lengths.
+static int compareBytes(const char* a, size_t aLen, const String8& b) {
+    size_t bLen = b.length();
+    int result = memcmp(a, b.string(), aLen < bLen ? aLen : bLen);
+    if (result != 0) {
+        return result;
+    }
+    return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
+ssize_t String8Pool::find(const char* str, size_t len, size_t* outInsertionIndex) const {
+    size_t l = 0;
+    size_t h = mStrings.size();
+    while (l < h) {
+        size_t mid = l + (h - l) / 2;
+        int c = compareBytes(str, len, mStrings.itemAt(mid));
+        if (c == 0) {
+            return mid;
+        }
+        if (c < 0) {
+            h = mid;
+        } else {
+            l = mid + 1;
+        }
+    }
+    *outInsertionIndex = l;
+    return NAME_NOT_FOUND;
+}
+
+String8 String8Pool::get(const char* str, size_t len) {
+    if (len > MAX_LENGTH) {
+        return String8(str, len);
+    }
+
+    AutoMutex _l(mLock);
+    size_t insertionIndex;
+    ssize_t index = find(str, len, &insertionIndex);
+    if (index >= 0) {
+        return mStrings.itemAt(index);
+    }
+    String8 result(str, len);
+    mStrings.insertAt(result, insertionIndex);
+    return result;
+}
+
+String8 String8Pool::get(const String8& str) {
+    size_t len = str.length();
+    if (len > MAX_LENGTH) {
+        return str;
+    }
+
+    AutoMutex _l(mLock);
+    size_t insertionIndex;
+    ssize_t index = find(str.string(), len, &insertionIndex);
+    if (index >= 0) {
+        return mStrings.itemAt(index);
+    }
+    mStrings.insertAt(str, insertionIndex);
+    return str;
+}
+
+size_t String8Pool::size() const {
+    AutoMutex _l(mLock);
+    return mStrings.size();
+}
+
+} // namespace android
@@ -103,6 +103,45 @@ static inline void checkTimeStamps(int64_t timestamp,
 #define checkTimeStamps(timestamp, prevTimestampPtr, prevMethodPtr, curMethod)
 #endif
 
+#ifdef HAVE_ANDROID_OS
+/*
+ * How elapsedRealtimeNano() reads the clock, decided on the first call.
+ * CLOCK_BOOTTIME is read through the vDSO without entering the kernel;
+ * /dev/alarm only serves kernels too old to have it.
+ */
+static volatile int32_t s_method = -1;
+static int s_alarm_fd = -1;
+
+static int elapsedRealtimeMethod()
+{
+    int32_t method = s_method;
+    if (method >= 0) {
+        return method;
+    }
+
+    struct timespec ts;
+    if (clock_gettime(CLOCK_BOOTTIME, &ts) == 0) {
+        method = METHOD_CLOCK_GETTIME;
+    } else {
+        int fd = open("/dev/alarm", O_RDONLY);
+        if (fd >= 0 && ioctl(fd,
+                ANDROID_ALARM_GET_TIME(ANDROID_ALARM_ELAPSED_REALTIME), &ts) == 0) {
+            if (android_atomic_cmpxchg(-1, fd, &s_alarm_fd)) {
+                close(fd);
+            }
+            method = METHOD_IOCTL;
+        } else {
+            if (fd >= 0) {
+                close(fd);
+            }
+            method = METHOD_SYSTEMTIME;
+        }
+    }
+    android_atomic_release_store(method, &s_method);
+    return method;
+}
+#endif
+
 /*
  * native public static long elapsedRealtimeNano();
  */
@@ -110,38 +149,29 @@ int64_t elapsedRealtimeNano()
 {
 #ifdef HAVE_ANDROID_OS
     struct timespec ts;
-    int result;
     int64_t timestamp;
 #if DEBUG_TIMESTAMP
     static volatile int64_t prevTimestamp;
     static volatile int prevMethod;
 #endif
 
-    static int s_fd = -1;
-
-    if (s_fd == -1) {
-        int fd = open("/dev/alarm", O_RDONLY);
-        if (android_atomic_cmpxchg(-1, fd, &s_fd)) {
-            close(fd);
+    switch (elapsedRealtimeMethod()) {
+    case METHOD_CLOCK_GETTIME:
+        if (clock_gettime(CLOCK_BOOTTIME, &ts) == 0) {
+            timestamp = seconds_to_nanoseconds(ts.tv_sec) + ts.tv_nsec;
+            checkTimeStamps(timestamp, &prevTimestamp, &prevMethod,
+                            METHOD_CLOCK_GETTIME);
+            return timestamp;
         }
-    }
-
-    result = ioctl(s_fd,
-            ANDROID_ALARM_GET_TIME(ANDROID_ALARM_ELAPSED_REALTIME), &ts);
-
-    if (result == 0) {
-        timestamp = seconds_to_nanoseconds(ts.tv_sec) + ts.tv_nsec;
-        checkTimeStamps(timestamp, &prevTimestamp, &prevMethod, METHOD_IOCTL);
-        return timestamp;
-    }
-
-    // /dev/alarm doesn't exist, fallback to CLOCK_BOOTTIME
-    result = clock_gettime(CLOCK_BOOTTIME, &ts);
-    if (result == 0) {
-        timestamp = seconds_to_nanoseconds(ts.tv_sec) + ts.tv_nsec;
-        checkTimeStamps(timestamp, &prevTimestamp, &prevMethod,
-                        METHOD_CLOCK_GETTIME);
-        return timestamp;
+        break;
+    case METHOD_IOCTL:
+        if (ioctl(s_alarm_fd,
+                ANDROID_ALARM_GET_TIME(ANDROID_ALARM_ELAPSED_REALTIME), &ts) == 0) {
+            timestamp = seconds_to_nanoseconds(ts.tv_sec) + ts.tv_nsec;
+            checkTimeStamps(timestamp, &prevTimestamp, &prevMethod, METHOD_IOCTL);
+            return timestamp;
+        }
+        break;
     }
 
     // XXX: there was an error, probably because the driver didn't
@@ -0,0 +1,390 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ThreadPool"
+
+#include <utils/ThreadPool.h>
+
+#include <cutils/atomic.h>
+#include <utils/Log.h>
+#include <utils/Thread.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+namespace android {
+
+static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gTLSKey = 0;
+
+static void initTLSKey() {
+    int result = pthread_key_create(&gTLSKey, NULL);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not allocate TLS key.");
+}
+
+// --- WorkItem ---
+
+WorkItem::WorkItem() : mState(STATE_NEW) {
+}
+
+WorkItem::~WorkItem() {
+}
+
+bool WorkItem::isDone() const {
+    int32_t state = android_atomic_acquire_load(&mState);
+    return state == STATE_DONE || state == STATE_CANCELLED;
+}
+
+bool WorkItem::wait() const {
+    if (!isDone()) {
+        AutoMutex _l(mLock);
+        while (!isDone()) {
+            mCondition.wait(mLock);
+        }
+    }
+    return android_atomic_acquire_load(&mState) == STATE_DONE;
+}
+
+bool WorkItem::cancel() {
+    for (;;) {
+        int32_t state = android_atomic_acquire_load(&mState);
+        if (state != STATE_NEW && state != STATE_QUEUED) {
+            return state == STATE_CANCELLED;
+        }
+        if (android_atomic_cmpxchg(state, STATE_CANCELLED, &mState) == 0) {
+            finish(STATE_CANCELLED);
+            return true;
+        }
+    }
+}
+
+void WorkItem::execute() {
+    if (android_atomic_cmpxchg(STATE_QUEUED, STATE_RUNNING, &mState) == 0) {
+        run();
+        finish(STATE_DONE);
+    }
+}
+
+void WorkItem::finish(int32_t state) {
+    // Waiters check the state with mLock held, so taking it here means none of
+    // them can miss the broadcast.
+    AutoMutex _l(mLock);
+    android_atomic_release_store(state, &mState);
+    mCondition.broadcast();
+}
+
+// --- ThreadPool::Worker ---
+
+class ThreadPool::Worker : public Thread {
+public:
+    Worker(ThreadPool* pool, size_t index) :
+            Thread(false), mPool(pool), mIndex(index), mHead(0), mCount(0) {
+    }
+
+    ThreadPool* const mPool;
+    const size_t mIndex;
+
+    void push(const sp<WorkItem>& item) {
+        AutoMutex _l(mLock);
+        size_t capacity = mItems.size();
+        if (mCount == capacity) {
+            Vector<sp<WorkItem> > items;
+            size_t newCapacity = capacity ? capacity * 2 : 16;
+            items.setCapacity(newCapacity);
+            for (size_t i = 0; i < mCount; i++) {
+                items.add(mItems[(mHead + i) % capacity]);
+            }
+            items.insertAt(sp<WorkItem>(), mCount, newCapacity - mCount);
+            mItems = items;
+            mHead = 0;
+            capacity = newCapacity;
+        }
+        mItems.editItemAt((mHead + mCount) % capacity) = item;
+        mCount += 1;
+    }
+
+    // The worker itself takes the newest item...
+    sp<WorkItem> popNewest() {
+        AutoMutex _l(mLock);
+        if (!mCount) {
+            return NULL;
+        }
+        mCount -= 1;
+        return take((mHead + mCount) % mItems.size());
+    }
+
+    // ...and other workers steal the oldest.
+    sp<WorkItem> popOldest() {
+        AutoMutex _l(mLock);
+        if (!mCount) {
+            return NULL;
+        }
+        size_t index = mHead;
+        mHead = (mHead + 1) % mItems.size();
+        mCount -= 1;
+        return take(index);
+    }
+
+    bool isEmpty() const {
+        AutoMutex _l(mLock);
+        return !mCount;
+    }
+
+private:
+    virtual bool threadLoop() {
+        pthread_setspecific(gTLSKey, this);
+        mPool->threadLoop(this);
+        pthread_setspecific(gTLSKey, NULL);
+        return false;
+    }
+
+    sp<WorkItem> take(size_t index) {
+        sp<WorkItem>& slot = mItems.editItemAt(index);
+        sp<WorkItem> item = slot;
+        slot.clear();
+        return item;
+    }
+
+    // A ring of mCount items starting at mHead.
+    mutable Mutex mLock;
+    Vector<sp<WorkItem> > mItems;
+    size_t mHead;
+    size_t mCount;
+};
+
+// --- ThreadPool::RangeItem ---
+
+class ThreadPool::RangeItem : public WorkItem {
+public:
+    struct Range {
+        size_t begin;
+        size_t end;
+        size_t grain;
+        int32_t chunkCount;
+        volatile int32_t nextChunk;
+        RangeBody* body;
+    };
+
+    explicit RangeItem(Range* range) : mRange(range) {
+    }
+
+    // Runs chunks until there are none left.
+    static void runChunks(Range* range) {
+        for (;;) {
+            int32_t chunk = android_atomic_inc(&range->nextChunk);
+            if (chunk >= range->chunkCount) {
+                break;
+            }
+            size_t begin = range->begin + size_t(chunk) * range->grain;
+            size_t end = range->end - begin > range->grain ? begin + range->grain : range->end;
+            range->body->run(begin, end);
+        }
+    }
+
+protected:
+    virtual void run() {
+        runChunks(mRange);
+    }
+
+private:
+    Range* mRange;
+};
+
+// --- ThreadPool ---
+
+ThreadPool::ThreadPool(const char* name, size_t threadCount, int32_t priority) :
+        mName(name), mNextWorker(0), mIdleCount(0), mExiting(false) {
+    int result = pthread_once(&gTLSOnce, initTLSKey);
+    LOG_ALWAYS_FATAL_IF(result != 0, "pthread_once failed");
+
+    if (!threadCount) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cpus > 0 ? cpus : 1;
+    }
+
+    // Workers steal from each other as soon as they start, so they must all
+    // be in mWorkers before any of them runs.
+    mWorkers.setCapacity(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        mWorkers.add(new Worker(this, i));
+    }
+    for (size_t i = 0; i < threadCount; i++) {
+        String8 threadName = String8::format("%s:%zu", mName.string(), i);
+        status_t status = mWorkers[i]->run(threadName.string(), priority);
+        LOG_ALWAYS_FATAL_IF(status != NO_ERROR, "Could not start %s: %d",
+                threadName.string(), status);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    LOG_ALWAYS_FATAL_IF(getForThread() == this, "ThreadPool destroyed by its own worker");
+
+    { // acquire lock
+        AutoMutex _l(mLock);
+        mExiting = true;
+        mCondition.broadcast();
+    } // release lock
+
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        mWorkers[i]->join();
+    }
+}
+
+ThreadPool::Worker* ThreadPool::getWorkerForThread() {
+    return static_cast<Worker*>(pthread_getspecific(gTLSKey));
+}
+
+ThreadPool* ThreadPool::getForThread() {
+    int result = pthread_once(&gTLSOnce, initTLSKey);
+    LOG_ALWAYS_FATAL_IF(result != 0, "pthread_once failed");
+
+    Worker* worker = getWorkerForThread();
+    return worker ? worker->mPool : NULL;
+}
+
+status_t ThreadPool::submit(const sp<WorkItem>& item) {
+    if (android_atomic_cmpxchg(WorkItem::STATE_NEW, WorkItem::STATE_QUEUED, &item->mState)) {
+        return INVALID_OPERATION;
+    }
+
+    Worker* worker = getWorkerForThread();
+    if (!worker || worker->mPool != this) {
+        uint32_t next = uint32_t(android_atomic_inc(&mNextWorker));
+        worker = mWorkers[next % mWorkers.size()].get();
+    }
+    worker->push(item);
+
+    // An idle worker increments mIdleCount before it looks at the deques one
+    // last time, so either it sees this item or we see it idle.
+    if (android_atomic_acquire_load(&mIdleCount) > 0) {
+        AutoMutex _l(mLock);
+        mCondition.signal();
+    }
+    return NO_ERROR;
+}
+
+bool ThreadPool::waitFor(const sp<WorkItem>& item) {
+    Worker* worker = getWorkerForThread();
+    if (worker && worker->mPool == this) {
+        // Once no work is queued anywhere, the item is running on another
+        // worker (or done), and blocking cannot deadlock.
+        while (!item->isDone() && runOne(worker)) {
+        }
+    }
+    return item->wait();
+}
+
+sp<WorkItem> ThreadPool::steal(Worker* self) {
+    size_t count = mWorkers.size();
+    size_t start = self ? self->mIndex + 1 : 0;
+    for (size_t i = 0; i < count; i++) {
+        Worker* victim = mWorkers[(start + i) % count].get();
+        if (victim != self) {
+            sp<WorkItem> item = victim->popOldest();
+            if (item != NULL) {
+                return item;
+            }
+        }
+    }
+    return NULL;
+}
+
+bool ThreadPool::runOne(Worker* self) {
+    sp<WorkItem> item = self->popNewest();
+    if (item == NULL) {
+        item = steal(self);
+        if (item == NULL) {
+            return false;
+        }
+    }
+    item->execute();
+    return true;
+}
+
+bool ThreadPool::hasQueuedWork() const {
+    for (size_t i = 0; i < mWorkers.size(); i++) {
+        if (!mWorkers[i]->isEmpty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::threadLoop(Worker* self) {
+    for (;;) {
+        if (runOne(self)) {
+            continue;
+        }
+
+        AutoMutex _l(mLock);
+        android_atomic_inc(&mIdleCount);
+        while (!hasQueuedWork()) {
+            if (mExiting) {
+                android_atomic_dec(&mIdleCount);
+                return;
+            }
+            mCondition.wait(mLock);
+        }
+        android_atomic_dec(&mIdleCount);
+    }
+}
+
+void ThreadPool::parallelForImpl(size_t begin, size_t end, size_t grain, RangeBody* body) {
+    if (begin >= end) {
+        return;
+    }
+    size_t length = end - begin;
+    if (grain < 1) {
+        grain = 1;
+    }
+    if ((length - 1) / grain >= size_t(INT32_MAX)) {
+        grain = (length - 1) / (INT32_MAX - 1) + 1;
+    }
+
+    RangeItem::Range range;
+    range.begin = begin;
+    range.end = end;
+    range.grain = grain;
+    range.chunkCount = int32_t((length - 1) / grain + 1);
+    range.nextChunk = 0;
+    range.body = body;
+
+    // The calling thread takes chunks too, so one helper fewer than there
+    // are chunks is enough.
+    size_t helperCount = mWorkers.size();
+    if (helperCount > size_t(range.chunkCount - 1)) {
+        helperCount = range.chunkCount - 1;
+    }
+    Vector<sp<RangeItem> > helpers;
+    helpers.setCapacity(helperCount);
+    for (size_t i = 0; i < helperCount; i++) {
+        sp<RangeItem> helper = new RangeItem(&range);
+        helpers.add(helper);
+        submit(helper);
+    }
+
+    RangeItem::runChunks(&range);
+
+    // All chunks have been taken.  Helpers that have not started would find
+    // nothing to do; the others are finishing their last chunk.
+    for (size_t i = 0; i < helperCount; i++) {
+        if (!helpers[i]->cancel()) {
+            waitFor(helpers[i]);
+        }
+    }
+}
+
+} // namespace android
@@ -31,7 +31,9 @@ nsecs_t systemTime(int clock)
             CLOCK_MONOTONIC,
             CLOCK_PROCESS_CPUTIME_ID,
             CLOCK_THREAD_CPUTIME_ID,
-            CLOCK_BOOTTIME
+            CLOCK_BOOTTIME,
+            CLOCK_MONOTONIC_COARSE,
+            CLOCK_REALTIME_COARSE
     };
     struct timespec t;
     t.tv_sec = t.tv_nsec = 0;
@@ -107,13 +107,89 @@ status_t Tokenizer::fromContents(const String8& filename,
     return OK;
 }
 
+void Tokenizer::reset(const String8& filename, char* buffer, size_t length) {
+    mFilename = filename;
+    mBuffer = buffer;
+    mLength = length;
+    mCurrent = buffer;
+    mLineNumber = 1;
+}
+
+// Reads the whole file into *buffer, growing it as needed. The size from
+// stat is only a hint, sysfs files always claim to be 4096 bytes long.
+static status_t readFile(const String8& filename, char** buffer,
+        size_t* capacity, size_t* outLength) {
+    int fd = ::open(filename.string(), O_RDONLY);
+    if (fd < 0) {
+        status_t result = -errno;
+        ALOGE("Error opening file '%s', %s.", filename.string(), strerror(errno));
+        return result;
+    }
+
+    struct stat stat;
+    size_t hint = fstat(fd, &stat) ? 0 : size_t(stat.st_size);
+    size_t length = 0;
+    for (;;) {
+        if (length == *capacity || hint > *capacity) {
+            size_t newCapacity = *capacity ? *capacity * 2 : 4096;
+            while (newCapacity < hint) {
+                newCapacity *= 2;
+            }
+            char* newBuffer = new char[newCapacity];
+            memcpy(newBuffer, *buffer, length);
+            delete[] *buffer;
+            *buffer = newBuffer;
+            *capacity = newCapacity;
+        }
+        ssize_t nrd = TEMP_FAILURE_RETRY(read(fd, *buffer + length, *capacity - length));
+        if (nrd < 0) {
+            status_t result = -errno;
+            ALOGE("Error reading file '%s', %s.", filename.string(), strerror(errno));
+            close(fd);
+            return result;
+        }
+        if (nrd == 0) {
+            break;
+        }
+        length += size_t(nrd);
+    }
+    close(fd);
+
+    *outLength = length;
+    return NO_ERROR;
+}
+
+status_t Tokenizer::parseFiles(const String8* filenames, size_t count,
+        ParseFunc parse, void* cookie) {
+    status_t firstError = NO_ERROR;
+    char* buffer = NULL;
+    size_t capacity = 0;
+    Tokenizer tokenizer(String8(), NULL, NULL, false, 0);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t length;
+        status_t result = readFile(filenames[i], &buffer, &capacity, &length);
+        if (!result) {
+            tokenizer.reset(filenames[i], buffer, length);
+            result = parse(&tokenizer, cookie);
+        }
+        if (result && !firstError) {
+            firstError = result;
+        }
+    }
+
+    delete[] buffer;
+    return firstError;
+}
+
 String8 Tokenizer::getLocation() const {
     String8 result;
     result.appendFormat("%s:%d", mFilename.string(), mLineNumber);
     return result;
 }
 
-String8 Tokenizer::peekRemainderOfLine() const {
+// Returns the end of the current line, excluding the newline character.
+const char* Tokenizer::scanLine() const {
     const char* end = getEnd();
     const char* eol = mCurrent;
     while (eol != end) {
@@ -123,13 +199,43 @@ String8 Tokenizer::peekRemainderOfLine() const {
         }
         eol += 1;
     }
-    return String8(mCurrent, eol - mCurrent);
+    return eol;
+}
+
+String8 Tokenizer::peekRemainderOfLine() const {
+    return String8(mCurrent, scanLine() - mCurrent);
+}
+
+TokenView Tokenizer::peekRemainderOfLineView() const {
+    return TokenView(mCurrent, scanLine() - mCurrent);
 }
 
 String8 Tokenizer::nextToken(const char* delimiters) {
 #if DEBUG_TOKENIZER
     ALOGD("nextToken");
 #endif
+    const char* tokenStart = scanToken(delimiters);
+    return String8(tokenStart, mCurrent - tokenStart);
+}
+
+String8 Tokenizer::nextToken(const char* delimiters, String8Pool* pool) {
+#if DEBUG_TOKENIZER
+    ALOGD("nextToken");
+#endif
+    const char* tokenStart = scanToken(delimiters);
+    return pool->get(tokenStart, mCurrent - tokenStart);
+}
+
+TokenView Tokenizer::nextTokenView(const char* delimiters) {
+#if DEBUG_TOKENIZER
+    ALOGD("nextToken");
+#endif
+    const char* tokenStart = scanToken(delimiters);
+    return TokenView(tokenStart, mCurrent - tokenStart);
+}
+
+// Advances past the next token and returns where it starts.
+const char* Tokenizer::scanToken(const char* delimiters) {
     const char* end = getEnd();
     const char* tokenStart = mCurrent;
     while (mCurrent != end) {
@@ -139,7 +245,7 @@ String8 Tokenizer::nextToken(const char* delimiters) {
         }
         mCurrent += 1;
     }
-    return String8(tokenStart, mCurrent - tokenStart);
+    return tokenStart;
 }
 
 void Tokenizer::nextLine() {
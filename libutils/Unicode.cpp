@@ -18,6 +18,13 @@
 #include <utils/Unicode.h>
 
 #include <stddef.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+# include <arm_neon.h>
+#endif
 
 #ifdef HAVE_WINSOCK
 # undef  nhtol
@@ -203,6 +210,162 @@ void utf32_to_utf8(const char32_t* src, size_t src_len, char* dst, size_t dst_le
     *cur = '\0';
 }
 
+// --------------------------------------------------------------------------
+// ASCII runs
+// --------------------------------------------------------------------------
+
+// Most strings converted between String8 and String16 are plain ASCII, and
+// ASCII maps to a single unit in both encodings.  The conversions below
+// hand runs of ASCII to these helpers, which check and copy a vector (or a
+// word) at a time, and deal with everything else one code point at a time
+// as before, so malformed input gives the same results as it always did.
+
+/**
+ * Returns the number of leading ASCII bytes in src.
+ */
+static size_t utf8_ascii_run(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v)) {
+            break;
+        }
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x8_t folded = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & 0x8080808080808080ULL) {
+            break;
+        }
+    }
+    while (i < len && src[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Returns the number of leading ASCII code units in src.
+ */
+static size_t utf16_ascii_run(const char16_t* src, size_t len)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i nonAscii = _mm_set1_epi16(0xff80);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= len; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(v, nonAscii), zero);
+        if (_mm_movemask_epi8(ascii) != 0xffff) {
+            break;
+        }
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; i + 8 <= len; i += 8) {
+        uint16x8_t v = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+        uint16x4_t folded = vorr_u16(vget_low_u16(v), vget_high_u16(v));
+        if (vget_lane_u64(vreinterpret_u64_u16(folded), 0) & 0xff80ff80ff80ff80ULL) {
+            break;
+        }
+    }
+#endif
+    for (; i + 4 <= len; i += 4) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word & 0xff80ff80ff80ff80ULL) {
+            break;
+        }
+    }
+    while (i < len && src[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Converts the leading ASCII bytes of src, up to len of them, to UTF-16.
+ * Returns the number converted.
+ */
+static size_t utf8_ascii_to_utf16(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        if (_mm_movemask_epi8(v)) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x8_t folded = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) & 0x8080808080808080ULL) {
+            break;
+        }
+        vst1q_u16(reinterpret_cast<uint16_t*>(dst + i), vmovl_u8(vget_low_u8(v)));
+        vst1q_u16(reinterpret_cast<uint16_t*>(dst + i + 8), vmovl_u8(vget_high_u8(v)));
+    }
+#endif
+    while (i < len && src[i] < 0x80) {
+        dst[i] = src[i];
+        i++;
+    }
+    return i;
+}
+
+/**
+ * Converts the leading ASCII code units of src, up to len of them, to UTF-8.
+ * Returns the number converted.
+ */
+static size_t utf16_ascii_to_utf8(const char16_t* src, size_t len, char* dst)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i nonAscii = _mm_set1_epi16(0xff80);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+        __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(lo, hi), nonAscii), zero);
+        if (_mm_movemask_epi8(ascii) != 0xffff) {
+            break;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; i + 16 <= len; i += 16) {
+        uint16x8_t lo = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i));
+        uint16x8_t hi = vld1q_u16(reinterpret_cast<const uint16_t*>(src + i + 8));
+        uint16x8_t both = vorrq_u16(lo, hi);
+        uint16x4_t folded = vorr_u16(vget_low_u16(both), vget_high_u16(both));
+        if (vget_lane_u64(vreinterpret_u64_u16(folded), 0) & 0xff80ff80ff80ff80ULL) {
+            break;
+        }
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst + i), vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+#endif
+    while (i < len && src[i] < 0x80) {
+        dst[i] = (char) src[i];
+        i++;
+    }
+    return i;
+}
+
 // --------------------------------------------------------------------------
 // UTF-16
 // --------------------------------------------------------------------------
@@ -338,6 +501,21 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst, size_t dst_le
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        if (*cur_utf16 < 0x80 && dst_len > 1) {
+            // Leave room for the terminator; running out of space is
+            // caught below, one code point at a time.
+            size_t run_len = end_utf16 - cur_utf16;
+            if (run_len > dst_len - 1) {
+                run_len = dst_len - 1;
+            }
+            size_t n = utf16_ascii_to_utf8(cur_utf16, run_len, cur);
+            cur_utf16 += n;
+            cur += n;
+            dst_len -= n;
+            if (cur_utf16 == end_utf16) {
+                break;
+            }
+        }
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -414,6 +592,14 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        if (*src < 0x80) {
+            size_t n = utf16_ascii_run(src, end - src);
+            ret += n;
+            src += n;
+            if (src == end) {
+                break;
+            }
+        }
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*(src + 1) & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
@@ -526,6 +712,14 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            size_t n = utf8_ascii_run(u8cur, u8end - u8cur);
+            u16measuredLen += n;
+            u8cur += n;
+            if (u8cur == u8end) {
+                break;
+            }
+        }
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
@@ -551,6 +745,14 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     char16_t* u16cur = u16str;
 
     while (u8cur < u8end) {
+        if (*u8cur < 0x80) {
+            size_t n = utf8_ascii_to_utf16(u8cur, u8end - u8cur, u16cur);
+            u8cur += n;
+            u16cur += n;
+            if (u8cur == u8end) {
+                break;
+            }
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -582,6 +784,18 @@ char16_t* utf8_to_utf16_n(const uint8_t* src, size_t srcLen, char16_t* dst, size
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        if (*u8cur < 0x80) {
+            size_t run_len = u8end - u8cur;
+            if (run_len > size_t(u16end - u16cur)) {
+                run_len = u16end - u16cur;
+            }
+            size_t n = utf8_ascii_to_utf16(u8cur, run_len, u16cur);
+            u8cur += n;
+            u16cur += n;
+            if (u8cur == u8end || u16cur == u16end) {
+                break;
+            }
+        }
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
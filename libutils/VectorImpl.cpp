@@ -372,6 +372,22 @@ void VectorImpl::release_storage()
     }
 }
 
+bool VectorImpl::owns_storage() const
+{
+    return mStorage && SharedBuffer::bufferFromData(mStorage)->onlyOwner();
+}
+
+bool VectorImpl::can_resize_storage() const
+{
+    // Items that can be copied with memcpy survive editResize() even when
+    // it has to copy a shared buffer; items that can merely be moved with
+    // memmove only survive a realloc() of a buffer nobody else holds.
+    if ((mFlags & HAS_TRIVIAL_COPY) && (mFlags & HAS_TRIVIAL_DTOR)) {
+        return true;
+    }
+    return (mFlags & HAS_TRIVIAL_MOVE) && owns_storage();
+}
+
 void* VectorImpl::_grow(size_t where, size_t amount)
 {
 //    ALOGV("_grow(this=%p, where=%d, amount=%d) count=%d, capacity=%d",
@@ -404,11 +420,7 @@ void* VectorImpl::_grow(size_t where, size_t amount)
                             "new_alloc_size overflow");
 
 //        ALOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((mStorage) &&
-            (mCount==where) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
-        {
+        if ((mStorage) && can_resize_storage()) {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_alloc_size);
             if (sb) {
@@ -416,19 +428,36 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             } else {
                 return NULL;
             }
+            if (where != mCount) {
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* to = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                _do_move_forward(to, from, mCount - where);
+            }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_alloc_size);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != mCount) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
-                    _do_copy(dest, from, mCount-where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
+                if (owns_storage()) {
+                    // nobody else can see the items, so move them to the
+                    // new storage rather than copying and destroying them.
+                    if (where != 0) {
+                        _do_move_backward(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_move_backward(dest, from, mCount-where);
+                    }
+                    SharedBuffer::bufferFromData(mStorage)->release();
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_copy(dest, from, mCount-where);
+                    }
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else {
                 return NULL;
@@ -472,10 +501,17 @@ void VectorImpl::_shrink(size_t where, size_t amount)
         // we are always reducing the capacity of the underlying SharedBuffer.
         // In other words, (old_capacity * mItemSize) did not overflow, and
         // where < (where + amount) < new_capacity < old_capacity.
-        if ((where == new_size) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
+        if (((where == new_size) &&
+             (mFlags & HAS_TRIVIAL_COPY) &&
+             (mFlags & HAS_TRIVIAL_DTOR)) ||
+            ((mFlags & HAS_TRIVIAL_MOVE) && owns_storage()))
         {
+            void* to = reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize;
+            _do_destroy(to, amount);
+            if (where != new_size) {
+                const void* from = reinterpret_cast<uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                _do_move_backward(to, from, new_size - where);
+            }
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
             if (sb) {
@@ -487,15 +523,29 @@ void VectorImpl::_shrink(size_t where, size_t amount)
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != new_size) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
-                    _do_copy(dest, from, new_size - where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + (where+amount)*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + where*mItemSize;
+                if (owns_storage()) {
+                    // as in _grow(), move the surviving items instead of
+                    // copying them, and destroy only the removed ones.
+                    void* removed = reinterpret_cast<uint8_t *>(mStorage) + where*mItemSize;
+                    _do_destroy(removed, amount);
+                    if (where != 0) {
+                        _do_move_backward(array, mStorage, where);
+                    }
+                    if (where != new_size) {
+                        _do_move_backward(dest, from, new_size - where);
+                    }
+                    SharedBuffer::bufferFromData(mStorage)->release();
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != new_size) {
+                        _do_copy(dest, from, new_size - where);
+                    }
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else{
                 return;
@@ -25,9 +25,14 @@ LOCAL_SRC_FILES := \
     BasicHashtable_test.cpp \
     BlobCache_test.cpp \
     BitSet_test.cpp \
+    FileMap_test.cpp \
+    FlatHashMap_test.cpp \
     Looper_test.cpp \
     LruCache_test.cpp \
     String8_test.cpp \
+    String8Pool_test.cpp \
+    ThreadPool_test.cpp \
+    Tokenizer_test.cpp \
     Unicode_test.cpp \
     Vector_test.cpp \
 
@@ -46,3 +51,25 @@ LOCAL_SRC_FILES := Vector_test.cpp
 LOCAL_STATIC_LIBRARIES := libutils liblog
 
 include $(BUILD_HOST_NATIVE_TEST)
+
+# Benchmark, run by hand.
+include $(CLEAR_VARS)
+LOCAL_MODULE := libutils_unicode_benchmark
+LOCAL_SRC_FILES := Unicode_benchmark.cpp
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SHARED_LIBRARIES := liblog libutils
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libutils_unicode_benchmark_host
+LOCAL_SRC_FILES := Unicode_benchmark.cpp
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_STATIC_LIBRARIES := libutils liblog
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libutils_systemclock_benchmark
+LOCAL_SRC_FILES := SystemClock_benchmark.cpp
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SHARED_LIBRARIES := liblog libutils
+include $(BUILD_EXECUTABLE)
@@ -258,6 +258,24 @@ TEST_F(BlobCacheTest, ExceedingTotalLimitHalvesCacheSize) {
     ASSERT_EQ(maxEntries/2 + 1, numCached);
 }
 
+TEST_F(BlobCacheTest, EvictionKeepsRemainingEntriesReachable) {
+    sp<BlobCache> bc(new BlobCache(4, 4, 1000));
+    for (uint32_t i = 0; i < 1000; i++) {
+        bc->set(&i, sizeof(i), &i, sizeof(i));
+    }
+    // Every entry still in the cache must map to its own value.
+    int numCached = 0;
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint32_t v = 0xeeeeeeee;
+        if (bc->get(&i, sizeof(i), &v, sizeof(v)) == sizeof(v)) {
+            ASSERT_EQ(i, v);
+            numCached++;
+        }
+    }
+    ASSERT_LT(0, numCached);
+    ASSERT_GE(1000 / 8, numCached);
+}
+
 class BlobCacheFlattenTest : public BlobCacheTest {
 protected:
     virtual void SetUp() {
@@ -311,6 +329,35 @@ TEST_F(BlobCacheFlattenTest, FlattenFullCache) {
     }
 }
 
+TEST_F(BlobCacheFlattenTest, UnflattenInPlaceUsesBuffer) {
+    unsigned char buf[2] = { 0xee, 0xee };
+    mBC->set("ab", 2, "cd", 2);
+    mBC->set("ef", 2, "gh", 2);
+
+    size_t size = mBC->getFlattenedSize();
+    uint8_t* flat = new uint8_t[size];
+    ASSERT_EQ(OK, mBC->flatten(flat, size));
+    ASSERT_EQ(OK, mBC2->unflattenInPlace(flat, size));
+
+    ASSERT_EQ(size_t(2), mBC2->get("ab", 2, buf, 2));
+    ASSERT_EQ(0, memcmp(buf, "cd", 2));
+
+    // The cache refers to the buffer rather than a copy of it.
+    uint8_t* value = static_cast<uint8_t*>(memmem(flat, size, "efgh", 4)) + 2;
+    value[0] = 'G';
+    ASSERT_EQ(size_t(2), mBC2->get("ef", 2, buf, 2));
+    ASSERT_EQ(0, memcmp(buf, "Gh", 2));
+
+    // New values are copied.
+    mBC2->set("ef", 2, "ij", 2);
+    value[0] = 'g';
+    ASSERT_EQ(size_t(2), mBC2->get("ef", 2, buf, 2));
+    ASSERT_EQ(0, memcmp(buf, "ij", 2));
+
+    mBC2.clear();
+    delete[] flat;
+}
+
 TEST_F(BlobCacheFlattenTest, FlattenDoesntChangeCache) {
     // Fill up the entire cache with 1 char key/value pairs.
     const int maxEntries = MAX_TOTAL_SIZE / 2;
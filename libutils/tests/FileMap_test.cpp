@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FileMap_test"
+
+#include <utils/FileMap.h>
+#include <utils/Log.h>
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace android {
+
+class FileMapTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        mPageSize = sysconf(_SC_PAGESIZE);
+        mFile = tmpfile();
+        ASSERT_TRUE(mFile != NULL);
+        mFd = fileno(mFile);
+
+        // Eight pages, each filled with its number.
+        char* page = new char[mPageSize];
+        for (int i = 0; i < 8; i++) {
+            memset(page, '0' + i, mPageSize);
+            ASSERT_EQ(mPageSize, write(mFd, page, mPageSize));
+        }
+        delete[] page;
+    }
+
+    virtual void TearDown() {
+        if (mFile != NULL) {
+            fclose(mFile);
+        }
+    }
+
+    long mPageSize;
+    FILE* mFile;
+    int mFd;
+};
+
+TEST_F(FileMapTest, PopulatedMapIsResident) {
+    FileMap map;
+    // Starts half way into page 1 and ends half way into page 6.
+    ASSERT_TRUE(map.create(NULL, mFd, mPageSize * 3 / 2, mPageSize * 5, true,
+            FileMap::POPULATE));
+    const char* data = static_cast<const char*>(map.getDataPtr());
+    EXPECT_EQ('1', data[0]);
+    EXPECT_EQ('6', data[mPageSize * 5 - 1]);
+
+    size_t pageCount;
+    EXPECT_EQ(6, map.getResidentPageCount(0, map.getDataLength(), &pageCount));
+    EXPECT_EQ(6U, pageCount);
+}
+
+TEST_F(FileMapTest, RangesAreClippedToTheData) {
+    FileMap map;
+    ASSERT_TRUE(map.create(NULL, mFd, mPageSize / 2, mPageSize * 2, true));
+
+    size_t pageCount;
+    map.getResidentPageCount(mPageSize, mPageSize * 10, &pageCount);
+    EXPECT_EQ(2U, pageCount);
+    map.getResidentPageCount(mPageSize / 4, 1, &pageCount);
+    EXPECT_EQ(1U, pageCount);
+    EXPECT_EQ(0, map.getResidentPageCount(mPageSize * 2, 1, &pageCount));
+    EXPECT_EQ(0U, pageCount);
+
+    EXPECT_EQ(0, map.prefetch(0, mPageSize * 10));
+    EXPECT_EQ(0, map.prefetch(mPageSize * 10, 1));
+    EXPECT_EQ(0, map.advise(FileMap::RANDOM, mPageSize, mPageSize));
+    EXPECT_EQ('0', static_cast<const char*>(map.getDataPtr())[0]);
+}
+
+} // namespace android
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FlatHashMap_test"
+
+#include <utils/FlatHashMap.h>
+#include <utils/String8.h>
+#include <cutils/log.h>
+#include <gtest/gtest.h>
+
+namespace {
+
+struct ComplexKey {
+    int k;
+
+    explicit ComplexKey(int k) : k(k) {
+        instanceCount += 1;
+    }
+
+    ComplexKey(const ComplexKey& other) : k(other.k) {
+        instanceCount += 1;
+    }
+
+    ~ComplexKey() {
+        instanceCount -= 1;
+    }
+
+    bool operator ==(const ComplexKey& other) const {
+        return k == other.k;
+    }
+
+    static ssize_t instanceCount;
+};
+
+ssize_t ComplexKey::instanceCount = 0;
+
+} // namespace
+
+namespace android {
+
+// All keys collide, so every lookup has to probe.
+template<> inline hash_t hash_type(const ComplexKey&) {
+    return 0;
+}
+
+typedef FlatHashMap<int, int> IntMap;
+
+TEST(FlatHashMapTest, Empty) {
+    IntMap map;
+    EXPECT_EQ(0U, map.size());
+    EXPECT_TRUE(map.isEmpty());
+    EXPECT_EQ(0U, map.capacity());
+    EXPECT_FALSE(map.hasMoreRoom());
+    EXPECT_EQ(NAME_NOT_FOUND, map.indexOfKey(1));
+    EXPECT_EQ(-1, map.next(-1));
+}
+
+TEST(FlatHashMapTest, AddFindRemove) {
+    IntMap map;
+    for (int i = 0; i < 1000; i++) {
+        ssize_t index = map.add(i, i * 10);
+        ASSERT_GE(index, 0);
+        EXPECT_EQ(i, map.keyAt(index));
+    }
+    EXPECT_EQ(1000U, map.size());
+    for (int i = 0; i < 1000; i++) {
+        ssize_t index = map.indexOfKey(i);
+        ASSERT_GE(index, 0);
+        EXPECT_EQ(i * 10, map.valueAt(index));
+    }
+    EXPECT_EQ(NAME_NOT_FOUND, map.indexOfKey(1000));
+
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_GE(map.removeItem(i), 0);
+    }
+    EXPECT_EQ(NAME_NOT_FOUND, map.removeItem(0));
+    EXPECT_EQ(500U, map.size());
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(i % 2 != 0, map.indexOfKey(i) >= 0) << i;
+    }
+}
+
+TEST(FlatHashMapTest, AddReplacesValue) {
+    IntMap map;
+    ssize_t index = map.add(7, 1);
+    EXPECT_EQ(index, map.add(7, 2));
+    EXPECT_EQ(1U, map.size());
+    EXPECT_EQ(2, map.valueAt(index));
+
+    map.editValueAt(index) = 3;
+    EXPECT_EQ(3, map.valueAt(map.indexOfKey(7)));
+}
+
+TEST(FlatHashMapTest, IndicesAreStableUntilRehash) {
+    IntMap map(100);
+    size_t capacity = map.capacity();
+    EXPECT_LE(100U, capacity);
+
+    ssize_t index = map.add(42, 0);
+    for (int i = 0; map.hasMoreRoom(); i++) {
+        map.add(i + 1000, i);
+        if (i % 3 == 0) {
+            map.removeItem(i + 1000);
+        }
+    }
+    EXPECT_EQ(capacity, map.capacity());
+    EXPECT_EQ(index, map.indexOfKey(42));
+
+    for (ssize_t i = map.next(-1); i >= 0; i = map.next(i)) {
+        if (map.keyAt(i) != 42) {
+            map.removeAt(i);
+        }
+    }
+    map.rehash(0);
+    EXPECT_EQ(6U, map.capacity());
+    EXPECT_EQ(1U, map.size());
+    EXPECT_GE(map.indexOfKey(42), 0);
+}
+
+TEST(FlatHashMapTest, Iterate) {
+    IntMap map;
+    for (int i = 0; i < 100; i++) {
+        map.add(i, i);
+    }
+    map.removeItem(50);
+
+    int sum = 0;
+    size_t count = 0;
+    for (ssize_t i = map.next(-1); i >= 0; i = map.next(i)) {
+        EXPECT_EQ(map.keyAt(i), map.valueAt(i));
+        sum += map.valueAt(i);
+        count++;
+    }
+    EXPECT_EQ(99U, count);
+    EXPECT_EQ(4950 - 50, sum);
+}
+
+TEST(FlatHashMapTest, CollidingKeys) {
+    ComplexKey::instanceCount = 0;
+    {
+        FlatHashMap<ComplexKey, String8> map;
+        for (int i = 0; i < 100; i++) {
+            map.add(ComplexKey(i), String8::format("%d", i));
+        }
+        EXPECT_EQ(100, ComplexKey::instanceCount);
+        for (int i = 0; i < 100; i += 3) {
+            map.removeItem(ComplexKey(i));
+        }
+        EXPECT_EQ(66, ComplexKey::instanceCount);
+        for (int i = 0; i < 100; i++) {
+            ssize_t index = map.indexOfKey(ComplexKey(i));
+            if (i % 3 == 0) {
+                EXPECT_EQ(NAME_NOT_FOUND, index);
+            } else {
+                ASSERT_GE(index, 0);
+                EXPECT_EQ(String8::format("%d", i), map.valueAt(index));
+            }
+        }
+
+        FlatHashMap<ComplexKey, String8> copy(map);
+        EXPECT_EQ(66U, copy.size());
+        EXPECT_EQ(132, ComplexKey::instanceCount);
+        map.clear();
+        EXPECT_EQ(66, ComplexKey::instanceCount);
+        EXPECT_GE(copy.indexOfKey(ComplexKey(1)), 0);
+    }
+    EXPECT_EQ(0, ComplexKey::instanceCount);
+}
+
+} // namespace android
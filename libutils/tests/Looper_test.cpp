@@ -632,6 +632,87 @@ TEST_F(LooperTest, SendMessageAtTime_WhenSentToThePresent_ShouldInvokeHandlerDur
             << "handled message";
 }
 
+TEST_F(LooperTest, SendMessageAtTime_WithPreciseTimers_WhenSentToTheFuture_ShouldInvokeHandlerAtUptime) {
+    sp<Looper> looper = new Looper(true, true);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    nsecs_t uptime = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(100) + 500000;
+    looper->sendMessageAtTime(uptime, handler, Message(MSG_TEST1));
+
+    int result = looper->pollOnce(1000);
+
+    EXPECT_EQ(Looper::POLL_WAKE, result)
+            << "pollOnce result should be Looper::POLL_WAKE due to wakeup";
+    EXPECT_EQ(size_t(0), handler->messages.size())
+            << "no message handled yet";
+
+    result = looper->pollOnce(1000);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because message was sent";
+    EXPECT_LE(uptime, now)
+            << "message should not be handled before its uptime";
+    EXPECT_NEAR(0, ns2ms(now - uptime), TIMING_TOLERANCE_MS)
+            << "message should be handled at its uptime";
+    EXPECT_EQ(size_t(1), handler->messages.size())
+            << "handled message";
+
+    result = looper->pollOnce(100);
+
+    EXPECT_EQ(Looper::POLL_TIMEOUT, result)
+            << "pollOnce result should be Looper::POLL_TIMEOUT because there was nothing to do";
+}
+
+TEST_F(LooperTest, SendMessageAtTime_WithPreciseTimers_WhenSentToThePast_ShouldInvokeHandlerDuringNextPoll) {
+    sp<Looper> looper = new Looper(true, true);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    looper->sendMessageAtTime(systemTime(SYSTEM_TIME_MONOTONIC) - ms2ns(1000), handler,
+            Message(MSG_TEST1));
+
+    StopWatch stopWatch("pollOnce");
+    int result = looper->pollOnce(100);
+    int32_t elapsedMillis = ns2ms(stopWatch.elapsedTime());
+
+    EXPECT_NEAR(0, elapsedMillis, TIMING_TOLERANCE_MS)
+            << "elapsed time should approx. zero because message was already sent";
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because message was sent";
+    EXPECT_EQ(size_t(1), handler->messages.size())
+            << "handled message";
+}
+
+TEST_F(LooperTest, SendMessageAtTime_WhenManyMessagesAreSentOutOfOrder_ShouldInvokeHandlerInTimeOrder) {
+    nsecs_t past = systemTime(SYSTEM_TIME_MONOTONIC) - ms2ns(1000);
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    sp<StubMessageHandler> otherHandler = new StubMessageHandler();
+    for (int i = 0; i < 100; i++) {
+        int t = (i * 37) % 100;
+        mLooper->sendMessageAtTime(past + t, handler, Message(t));
+        mLooper->sendMessageAtTime(past + t, otherHandler, Message(t));
+        mLooper->sendMessageAtTime(past + t, handler, Message(t + 100));
+    }
+    mLooper->removeMessages(otherHandler);
+    mLooper->removeMessages(handler, 50);
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    EXPECT_EQ(size_t(0), otherHandler->messages.size())
+            << "removed messages should not be handled";
+    ASSERT_EQ(size_t(199), handler->messages.size())
+            << "handled messages";
+    size_t n = 0;
+    for (int t = 0; t < 100; t++) {
+        if (t != 50) {
+            EXPECT_EQ(t, handler->messages[n++].what)
+                    << "messages should be handled in time order";
+        }
+        EXPECT_EQ(t + 100, handler->messages[n++].what)
+                << "messages for the same time should be handled in the order sent";
+    }
+}
+
 TEST_F(LooperTest, RemoveMessage_WhenRemovingAllMessagesForHandler_ShouldRemoveThoseMessage) {
     sp<StubMessageHandler> handler = new StubMessageHandler();
     mLooper->sendMessage(handler, Message(MSG_TEST1));
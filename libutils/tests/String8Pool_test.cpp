@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "String8Pool_test"
+#include <utils/Log.h>
+#include <utils/String8Pool.h>
+#include <utils/Tokenizer.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+TEST(String8PoolTest, RecurringStringsShareABuffer) {
+    String8Pool pool;
+    String8 a = pool.get("keyboard.layout", 15);
+    String8 b = pool.get(String8("keyboard.layout"));
+    String8 c = pool.get("keyboard.layoutX", 15);
+
+    EXPECT_STREQ("keyboard.layout", a.string());
+    EXPECT_EQ(a.string(), b.string());
+    EXPECT_EQ(a.string(), c.string());
+    EXPECT_EQ(size_t(1), pool.size());
+}
+
+TEST(String8PoolTest, DistinctStringsArePooledSeparately) {
+    String8Pool pool;
+    const char* words[] = { "touch", "touch.deviceType", "a", "", "touch.device", "b", "a" };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        EXPECT_STREQ(words[i], pool.get(words[i], strlen(words[i])).string());
+    }
+    EXPECT_EQ(size_t(6), pool.size());
+
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        String8 word(words[i]);
+        EXPECT_EQ(word, pool.get(word));
+    }
+    EXPECT_EQ(size_t(6), pool.size());
+}
+
+TEST(String8PoolTest, CopiesOutliveThePool) {
+    String8 copy;
+    {
+        String8Pool pool;
+        copy = pool.get("cursor.mode", 11);
+    }
+    EXPECT_STREQ("cursor.mode", copy.string());
+
+    copy.append(".pointer");
+    EXPECT_STREQ("cursor.mode.pointer", copy.string());
+}
+
+TEST(String8PoolTest, LongStringsAreNotPooled) {
+    String8Pool pool;
+    String8 longString;
+    for (int i = 0; i <= String8Pool::MAX_LENGTH; i++) {
+        longString.append("x");
+    }
+    String8 a = pool.get(longString.string(), longString.length());
+    String8 b = pool.get(longString.string(), longString.length());
+
+    EXPECT_EQ(longString, a);
+    EXPECT_NE(a.string(), b.string());
+    EXPECT_EQ(size_t(0), pool.size());
+}
+
+TEST(String8PoolTest, TokenizerReturnsPooledTokens) {
+    String8Pool pool;
+    Tokenizer* tokenizer;
+    ASSERT_EQ(OK, Tokenizer::fromContents(String8("test"), "key = key\nkey", &tokenizer));
+
+    String8 first = tokenizer->nextToken(" =", &pool);
+    tokenizer->skipDelimiters(" =");
+    String8 second = tokenizer->nextToken(" =", &pool);
+    tokenizer->nextLine();
+    String8 third = tokenizer->nextToken(" =", &pool);
+    delete tokenizer;
+
+    EXPECT_STREQ("key", first.string());
+    EXPECT_EQ(first.string(), second.string());
+    EXPECT_EQ(first.string(), third.string());
+}
+
+} // namespace android
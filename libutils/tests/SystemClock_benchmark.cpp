@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the cost of one call to each systemTime() clock and to the
+// SystemClock functions, and the resolution of the coarse clocks.
+//
+//   libutils_systemclock_benchmark [iterations]
+
+#include <utils/SystemClock.h>
+#include <utils/Timers.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+using namespace android;
+
+static volatile int64_t sink;
+
+static void report(const char* name, nsecs_t elapsed, int iterations) {
+    printf("%-28s %8.1f ns\n", name, double(elapsed) / iterations);
+}
+
+static void measureClock(const char* name, int clock, int iterations) {
+    nsecs_t start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        sink = systemTime(clock);
+    }
+    report(name, systemTime() - start, iterations);
+}
+
+static void measureResolution(const char* name, clockid_t clock) {
+    struct timespec ts;
+    if (clock_getres(clock, &ts) == 0) {
+        printf("%-28s %8.1f ns\n", name, double(ts.tv_sec) * 1e9 + ts.tv_nsec);
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    measureClock("systemTime(MONOTONIC)", SYSTEM_TIME_MONOTONIC, iterations);
+    measureClock("systemTime(MONOTONIC_COARSE)", SYSTEM_TIME_MONOTONIC_COARSE, iterations);
+    measureClock("systemTime(REALTIME)", SYSTEM_TIME_REALTIME, iterations);
+    measureClock("systemTime(REALTIME_COARSE)", SYSTEM_TIME_REALTIME_COARSE, iterations);
+    measureClock("systemTime(BOOTTIME)", SYSTEM_TIME_BOOTTIME, iterations);
+
+    nsecs_t start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        sink = uptimeMillis();
+    }
+    report("uptimeMillis()", systemTime() - start, iterations);
+
+    start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        sink = elapsedRealtimeNano();
+    }
+    report("elapsedRealtimeNano()", systemTime() - start, iterations);
+
+    measureResolution("CLOCK_MONOTONIC resolution", CLOCK_MONOTONIC);
+    measureResolution("CLOCK_MONOTONIC_COARSE res.", CLOCK_MONOTONIC_COARSE);
+    return 0;
+}
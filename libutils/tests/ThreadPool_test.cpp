@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ThreadPool_test"
+
+#include <utils/ThreadPool.h>
+#include <utils/Atomic.h>
+#include <utils/Log.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+class CountingItem : public WorkItem {
+public:
+    explicit CountingItem(volatile int32_t* counter) : mCounter(counter) { }
+
+    ThreadPool* pool;
+
+protected:
+    virtual void run() {
+        pool = ThreadPool::getForThread();
+        android_atomic_inc(mCounter);
+    }
+
+private:
+    volatile int32_t* mCounter;
+};
+
+// Blocks its worker until released.
+class GateItem : public WorkItem {
+public:
+    GateItem() : mStarted(false), mOpen(false) { }
+
+    void waitUntilStarted() {
+        AutoMutex _l(mGateLock);
+        while (!mStarted) {
+            mGateCondition.wait(mGateLock);
+        }
+    }
+
+    void open() {
+        AutoMutex _l(mGateLock);
+        mOpen = true;
+        mGateCondition.broadcast();
+    }
+
+protected:
+    virtual void run() {
+        AutoMutex _l(mGateLock);
+        mStarted = true;
+        mGateCondition.broadcast();
+        while (!mOpen) {
+            mGateCondition.wait(mGateLock);
+        }
+    }
+
+private:
+    Mutex mGateLock;
+    Condition mGateCondition;
+    bool mStarted;
+    bool mOpen;
+};
+
+struct MarkRange {
+    volatile int32_t* marks;
+
+    void operator()(size_t begin, size_t end) const {
+        for (size_t i = begin; i < end; i++) {
+            android_atomic_inc(&marks[i]);
+        }
+    }
+};
+
+// Runs a parallelFor from inside a worker.
+class NestedItem : public WorkItem {
+public:
+    NestedItem(ThreadPool* pool, volatile int32_t* marks, size_t count) :
+            mPool(pool), mCount(count) {
+        mBody.marks = marks;
+    }
+
+protected:
+    virtual void run() {
+        mPool->parallelFor(0, mCount, 1, mBody);
+    }
+
+private:
+    ThreadPool* mPool;
+    size_t mCount;
+    MarkRange mBody;
+};
+
+// Submits a child item to its own pool and waits for it.
+class ParentItem : public WorkItem {
+public:
+    ParentItem(ThreadPool* pool, volatile int32_t* counter) :
+            mPool(pool), mCounter(counter), childRan(false) { }
+
+    bool childRan;
+
+protected:
+    virtual void run() {
+        sp<CountingItem> child = new CountingItem(mCounter);
+        mPool->submit(child);
+        childRan = mPool->waitFor(child);
+    }
+
+private:
+    ThreadPool* mPool;
+    volatile int32_t* mCounter;
+};
+
+TEST(ThreadPoolTest, RunsSubmittedItems) {
+    ThreadPool pool("test", 4);
+    EXPECT_EQ(4U, pool.getThreadCount());
+    EXPECT_EQ(NULL, ThreadPool::getForThread());
+
+    volatile int32_t counter = 0;
+    Vector<sp<CountingItem> > items;
+    for (int i = 0; i < 1000; i++) {
+        sp<CountingItem> item = new CountingItem(&counter);
+        items.add(item);
+        ASSERT_EQ(NO_ERROR, pool.submit(item));
+    }
+    for (size_t i = 0; i < items.size(); i++) {
+        EXPECT_TRUE(items[i]->wait());
+        EXPECT_TRUE(items[i]->isDone());
+        EXPECT_EQ(&pool, items[i]->pool);
+    }
+    EXPECT_EQ(1000, counter);
+}
+
+TEST(ThreadPoolTest, ItemsCanBeSubmittedOnlyOnce) {
+    ThreadPool pool("test", 1);
+    volatile int32_t counter = 0;
+    sp<CountingItem> item = new CountingItem(&counter);
+    EXPECT_EQ(NO_ERROR, pool.submit(item));
+    EXPECT_EQ(INVALID_OPERATION, pool.submit(item));
+    EXPECT_TRUE(item->wait());
+    EXPECT_EQ(INVALID_OPERATION, pool.submit(item));
+    EXPECT_EQ(1, counter);
+}
+
+TEST(ThreadPoolTest, CancelledItemsDoNotRun) {
+    ThreadPool pool("test", 1);
+    sp<GateItem> gate = new GateItem();
+    pool.submit(gate);
+    gate->waitUntilStarted();
+
+    volatile int32_t counter = 0;
+    sp<CountingItem> item = new CountingItem(&counter);
+    pool.submit(item);
+    EXPECT_FALSE(item->isDone());
+    EXPECT_TRUE(item->cancel());
+    EXPECT_TRUE(item->isDone());
+    EXPECT_FALSE(gate->cancel());
+
+    gate->open();
+    EXPECT_TRUE(gate->wait());
+    EXPECT_FALSE(item->wait());
+    EXPECT_EQ(0, counter);
+}
+
+TEST(ThreadPoolTest, DestructorRunsQueuedItems) {
+    volatile int32_t counter = 0;
+    {
+        ThreadPool pool("test", 2);
+        for (int i = 0; i < 100; i++) {
+            pool.submit(new CountingItem(&counter));
+        }
+    }
+    EXPECT_EQ(100, counter);
+}
+
+TEST(ThreadPoolTest, ParallelForCoversRangeOnce) {
+    ThreadPool pool("test", 4);
+    const size_t count = 10007;
+    volatile int32_t marks[count];
+    memset((void*) marks, 0, sizeof(marks));
+
+    MarkRange body;
+    body.marks = marks;
+    pool.parallelFor(3, count, 16, body);
+    pool.parallelFor(5, 5, 16, body);
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(i < 3 ? 0 : 1, marks[i]) << i;
+    }
+
+    pool.parallelFor(0, 10, 0, body);
+    for (size_t i = 0; i < 10; i++) {
+        ASSERT_EQ(i < 3 ? 1 : 2, marks[i]) << i;
+    }
+}
+
+TEST(ThreadPoolTest, WorkersCanWaitForTheirOwnPool) {
+    ThreadPool pool("test", 1);
+
+    const size_t count = 1000;
+    volatile int32_t marks[count];
+    memset((void*) marks, 0, sizeof(marks));
+    sp<NestedItem> nested = new NestedItem(&pool, marks, count);
+    pool.submit(nested);
+    EXPECT_TRUE(nested->wait());
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(1, marks[i]) << i;
+    }
+
+    volatile int32_t counter = 0;
+    sp<ParentItem> parent = new ParentItem(&pool, &counter);
+    pool.submit(parent);
+    EXPECT_TRUE(parent->wait());
+    EXPECT_TRUE(parent->childRan);
+    EXPECT_EQ(1, counter);
+}
+
+} // namespace android
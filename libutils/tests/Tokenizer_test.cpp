@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Tokenizer_test"
+#include <utils/Log.h>
+#include <utils/Tokenizer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace android {
+
+static const char* const DELIMITERS = " =\t";
+
+TEST(TokenizerTest, TokenViewsPointIntoTheBuffer) {
+    const char* contents = "key = value # comment\nnext";
+    Tokenizer* tokenizer;
+    ASSERT_EQ(OK, Tokenizer::fromContents(String8("test"), contents, &tokenizer));
+
+    TokenView key = tokenizer->nextTokenView(DELIMITERS);
+    tokenizer->skipDelimiters(DELIMITERS);
+    TokenView value = tokenizer->nextTokenView(DELIMITERS);
+    tokenizer->skipDelimiters(DELIMITERS);
+    TokenView rest = tokenizer->peekRemainderOfLineView();
+    tokenizer->nextLine();
+    TokenView next = tokenizer->nextTokenView(DELIMITERS);
+    TokenView end = tokenizer->nextTokenView(DELIMITERS);
+
+    EXPECT_EQ(contents, key.data);
+    EXPECT_TRUE(key == "key");
+    EXPECT_TRUE(key != "ke");
+    EXPECT_TRUE(key != "keys");
+    EXPECT_TRUE(value == "value");
+    EXPECT_TRUE(rest == "# comment");
+    EXPECT_STREQ("# comment", rest.toString8().string());
+    EXPECT_TRUE(next == "next");
+    EXPECT_EQ(2, tokenizer->getLineNumber());
+    EXPECT_TRUE(end.isEmpty());
+    EXPECT_TRUE(end == "");
+    EXPECT_TRUE(tokenizer->isEof());
+
+    delete tokenizer;
+}
+
+struct ParsedFiles {
+    Vector<String8> firstTokens;
+    Vector<int32_t> lineCounts;
+};
+
+static status_t parseFirstTokens(Tokenizer* tokenizer, void* cookie) {
+    ParsedFiles* parsed = static_cast<ParsedFiles*>(cookie);
+    parsed->firstTokens.push(tokenizer->nextTokenView(DELIMITERS).toString8());
+    while (!tokenizer->isEof()) {
+        tokenizer->nextLine();
+    }
+    parsed->lineCounts.push(tokenizer->getLineNumber());
+    return NO_ERROR;
+}
+
+static String8 writeTempFile(const String8& contents) {
+    char path[] = "/data/local/tmp/Tokenizer_test_XXXXXX";
+    char hostPath[] = "/tmp/Tokenizer_test_XXXXXX";
+    int fd = mkstemp(path);
+    char* name = path;
+    if (fd < 0) {
+        fd = mkstemp(hostPath);
+        name = hostPath;
+    }
+    if (fd < 0) {
+        return String8();
+    }
+    write(fd, contents.string(), contents.length());
+    close(fd);
+    return String8(name);
+}
+
+TEST(TokenizerTest, ParseFilesReusesOneBuffer) {
+    // larger than the initial buffer, so that it has to grow
+    String8 big("big\n");
+    for (int i = 0; i < 2000; i++) {
+        big.append("line\n");
+    }
+
+    String8 filenames[] = {
+        writeTempFile(String8("first = 1\nsecond = 2\n")),
+        writeTempFile(big),
+        String8("/nonexistent/Tokenizer_test"),
+        writeTempFile(String8("last")),
+    };
+    ASSERT_FALSE(filenames[0].isEmpty());
+    ASSERT_FALSE(filenames[1].isEmpty());
+    ASSERT_FALSE(filenames[3].isEmpty());
+
+    ParsedFiles parsed;
+    EXPECT_EQ(-ENOENT, Tokenizer::parseFiles(filenames, 4, parseFirstTokens, &parsed));
+
+    ASSERT_EQ(size_t(3), parsed.firstTokens.size());
+    EXPECT_STREQ("first", parsed.firstTokens[0].string());
+    EXPECT_STREQ("big", parsed.firstTokens[1].string());
+    EXPECT_STREQ("last", parsed.firstTokens[2].string());
+    EXPECT_EQ(3, parsed.lineCounts[0]);
+    EXPECT_EQ(2002, parsed.lineCounts[1]);
+    EXPECT_EQ(1, parsed.lineCounts[2]);
+
+    unlink(filenames[0].string());
+    unlink(filenames[1].string());
+    unlink(filenames[3].string());
+}
+
+} // namespace android
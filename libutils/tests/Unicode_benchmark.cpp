@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the UTF-8 <-> UTF-16 conversions behind String8(String16) and
+// String16(const char*) on strings shaped like the ones binder passes
+// around: short and long ASCII, mostly ASCII with some accented letters,
+// and CJK text.
+//
+//   libutils_unicode_benchmark [iterations]
+
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <utils/Timers.h>
+#include <utils/Unicode.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace android;
+
+static void repeat(String8* out, const char* piece, size_t length) {
+    while (out->length() < length) {
+        out->append(piece);
+    }
+}
+
+static void measure(const char* name, const String8& utf8, int iterations) {
+    String16 utf16(utf8);
+    const uint8_t* u8 = reinterpret_cast<const uint8_t*>(utf8.string());
+    size_t u8len = utf8.length();
+    size_t u16len = utf16.size();
+    char16_t* u16buf = new char16_t[u16len + 1];
+    char* u8buf = new char[u8len + 1];
+
+    nsecs_t start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        ssize_t length = utf8_to_utf16_length(u8, u8len);
+        utf8_to_utf16(u8, u8len, u16buf);
+        if (length != ssize_t(u16len)) {
+            abort();
+        }
+    }
+    nsecs_t toUtf16 = systemTime() - start;
+
+    start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        ssize_t length = utf16_to_utf8_length(utf16.string(), u16len);
+        utf16_to_utf8(utf16.string(), u16len, u8buf, u8len + 1);
+        if (length != ssize_t(u8len)) {
+            abort();
+        }
+    }
+    nsecs_t toUtf8 = systemTime() - start;
+
+    start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        String8 s(utf16);
+    }
+    nsecs_t string8 = systemTime() - start;
+
+    start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        String16 s(utf8);
+    }
+    nsecs_t string16 = systemTime() - start;
+
+    printf("%-12s %6zu bytes  to UTF-16 %8.1f ns  to UTF-8 %8.1f ns"
+            "  String8(String16) %8.1f ns  String16(String8) %8.1f ns\n",
+            name, u8len, double(toUtf16) / iterations, double(toUtf8) / iterations,
+            double(string8) / iterations, double(string16) / iterations);
+
+    delete[] u16buf;
+    delete[] u8buf;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    String8 shortAscii("android.os.IServiceManager");
+    String8 longAscii;
+    repeat(&longAscii, "/data/app/com.example.app-1/base.apk:", 1000);
+    String8 latin;
+    repeat(&latin, "Caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9" "e, s'il vous pla\xc3\xaet. ", 1000);
+    String8 cjk;
+    repeat(&cjk, "\xe8\xa8\xad\xe5\xae\x9a\xe3\x82\x92\xe9\x96\x8b\xe3\x81\x8f", 1000);
+
+    measure("short ascii", shortAscii, iterations);
+    measure("long ascii", longAscii, iterations / 10);
+    measure("latin", latin, iterations / 10);
+    measure("cjk", cjk, iterations / 10);
+    return 0;
+}
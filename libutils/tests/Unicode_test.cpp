@@ -112,4 +112,50 @@ TEST_F(UnicodeTest, UTF8toUTF16Normal) {
             << "should be NULL terminated";
 }
 
+TEST_F(UnicodeTest, LongASCIIRunsAroundOtherCharacters) {
+    // Put U+00E9 at every position of a 40 character ASCII string, so that
+    // it lands at every offset of the vector and word sized ASCII runs.
+    for (size_t pos = 0; pos < 40; pos++) {
+        uint8_t u8[41];
+        char16_t u16[40];
+        size_t u8len = 0;
+        for (size_t i = 0; i < 40; i++) {
+            if (i == pos) {
+                u8[u8len++] = 0xC3;
+                u8[u8len++] = 0xA9;
+                u16[i] = 0x00E9;
+            } else {
+                u8[u8len++] = 'a' + i % 26;
+                u16[i] = 'a' + i % 26;
+            }
+        }
+
+        EXPECT_EQ(40, utf8_to_utf16_length(u8, u8len)) << pos;
+        char16_t out16[41];
+        utf8_to_utf16(u8, u8len, out16);
+        EXPECT_EQ(0, memcmp(u16, out16, sizeof(u16))) << pos;
+        EXPECT_EQ(0, out16[40]) << pos;
+
+        EXPECT_EQ(41, utf16_to_utf8_length(u16, 40)) << pos;
+        char out8[42];
+        utf16_to_utf8(u16, 40, out8, sizeof(out8));
+        EXPECT_EQ(0, memcmp(u8, out8, u8len)) << pos;
+        EXPECT_EQ(0, out8[41]) << pos;
+    }
+}
+
+TEST_F(UnicodeTest, UTF8toUTF16nStopsAtEndOfOutput) {
+    const uint8_t str[] = "an ASCII string longer than the output";
+    char16_t output[21];
+    output[20] = 0xFFFF;
+
+    char16_t* end = utf8_to_utf16_n(str, sizeof(str) - 1, output, 20);
+
+    EXPECT_EQ(output + 20, end);
+    EXPECT_EQ('a', output[0]);
+    EXPECT_EQ('g', output[19]);
+    EXPECT_EQ(0xFFFF, output[20])
+            << "should not write past the end of the output";
+}
+
 }
@@ -18,6 +18,7 @@
 
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <cutils/log.h>
 #include <gtest/gtest.h>
@@ -36,6 +37,22 @@ protected:
 public:
 };
 
+// Counts how often it is copied and moved.
+struct Counted {
+    static int copies;
+    static int moves;
+
+    int value;
+    Counted() : value(0) { }
+    Counted(int v) : value(v) { }
+    Counted(const Counted& o) : value(o.value) { copies++; }
+    Counted(Counted&& o) : value(o.value) { o.value = -1; moves++; }
+    Counted& operator=(const Counted& o) { value = o.value; copies++; return *this; }
+};
+
+int Counted::copies = 0;
+int Counted::moves = 0;
+
 
 TEST_F(VectorTest, CopyOnWrite_CopyAndAddElements) {
 
@@ -149,4 +166,45 @@ TEST_F(VectorTest, editArray_Shared) {
   }
 }
 
+TEST_F(VectorTest, _grow_MovesItems) {
+  Vector<Counted> vector;
+  Counted::copies = 0;
+  Counted::moves = 0;
+  for (int i = 0; i < 100; i++) {
+    vector.insertAt(Counted(i), i / 2);
+  }
+  // Each item is copied in once; growing the storage only moves them.
+  EXPECT_EQ(100, Counted::copies);
+  EXPECT_LT(0, Counted::moves);
+
+  // A vector sharing the storage still has to copy it.
+  Vector<Counted> vector2 = vector;
+  Counted::copies = 0;
+  vector.setCapacity(1000);
+  EXPECT_EQ(100, Counted::copies);
+  for (size_t i = 0; i < vector.size(); ++i) {
+    EXPECT_EQ(vector[i].value, vector2[i].value);
+  }
+}
+
+TEST_F(VectorTest, _grow_TrivialMoveItemsWithSharedStorage) {
+  Vector<String8> vector1;
+  for (int i = 0; i < 64; i++) {
+    vector1.insertAt(String8::format("item %d", i), 0);
+  }
+  Vector<String8> vector2 = vector1;
+  vector1.insertAt(String8("first"), 0);
+  vector1.removeItemsAt(1, 60);
+  vector2.add(String8("last"));
+
+  ASSERT_EQ(5U, vector1.size());
+  EXPECT_STREQ("first", vector1[0].string());
+  EXPECT_STREQ("item 3", vector1[1].string());
+  EXPECT_STREQ("item 0", vector1[4].string());
+  ASSERT_EQ(65U, vector2.size());
+  EXPECT_STREQ("item 63", vector2[0].string());
+  EXPECT_STREQ("item 0", vector2[63].string());
+  EXPECT_STREQ("last", vector2[64].string());
+}
+
 } // namespace android
@@ -25,9 +25,16 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "base/file.h"
@@ -38,6 +45,10 @@
 #include "utils/FileMap.h"
 #include "zlib.h"
 
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 #include "entry_name_utils-inl.h"
 #include "ziparchive/zip_archive.h"
 
@@ -220,7 +231,9 @@ static const char* kErrorMessages[] = {
   "Inconsistent information",
   "Invalid entry name",
   "I/O Error",
-  "File mapping failed"
+  "File mapping failed",
+  "Entry is compressed",
+  "Entry data is misaligned"
 };
 
 static const int32_t kErrorMessageUpperBound = 0;
@@ -267,7 +280,32 @@ static const int32_t kIoError = -11;
 // We were not able to mmap the central directory or entry contents.
 static const int32_t kMmapFailed = -12;
 
-static const int32_t kErrorMessageLowerBound = -13;
+// The entry can not be used in place because it is compressed.
+static const int32_t kEntryCompressed = -13;
+
+// The entry can not be used in place because its data does not start at
+// the alignment asked for.
+static const int32_t kEntryMisaligned = -14;
+
+static const int32_t kErrorMessageLowerBound = -15;
+
+/*
+ * A slot of the hash table: the name of an entry, as its offset and
+ * length in the mapped central directory. Offsets rather than pointers
+ * let the table be saved in an index and mapped back.
+ */
+struct ZipEntrySlot {
+  uint32_t name_offset;
+  uint16_t name_length;
+};
+
+/*
+ * The occupied slots of the hash table in the order of their names, for
+ * iterating over the entries with a given prefix.
+ */
+struct SortedNames {
+  std::vector<uint32_t> slots;
+};
 
 /*
  * A Read-only Zip archive.
@@ -297,6 +335,9 @@ struct ZipArchive {
   off64_t directory_offset;
   android::FileMap directory_map;
 
+  /* the entries before the central directory, mapped on first use */
+  android::FileMap* data_map;
+
   /* number of entries in the Zip archive */
   uint16_t num_entries;
 
@@ -307,25 +348,75 @@ struct ZipArchive {
    * ((4 * UINT16_MAX) / 3 + 1) which can safely fit into a uint32_t.
    */
   uint32_t hash_table_size;
-  ZipEntryName* hash_table;
+  const ZipEntrySlot* hash_table;
+
+  /*
+   * The hash of the name in each slot of hash_table, or 0 if it is empty,
+   * kept apart so that probing stays within a few cache lines.
+   */
+  const uint32_t* hash_values;
+
+  /*
+   * What hash_values and hash_table point into: memory allocated by
+   * ParseZipArchive, or a mapped index (see OpenArchiveWithIndex).
+   */
+  void* hash_memory;
+  android::FileMap* index_map;
+
+  /* built by the first iteration with a prefix */
+  std::atomic<SortedNames*> sorted_names;
 
   ZipArchive(const int fd, bool assume_ownership) :
       fd(fd),
       close_file(assume_ownership),
       directory_offset(0),
+      data_map(NULL),
       num_entries(0),
       hash_table_size(0),
-      hash_table(NULL) {}
+      hash_table(NULL),
+      hash_values(NULL),
+      hash_memory(NULL),
+      index_map(NULL),
+      sorted_names(NULL) {}
 
   ~ZipArchive() {
     if (close_file && fd >= 0) {
       close(fd);
     }
 
-    free(hash_table);
+    delete data_map;
+    delete index_map;
+    delete sorted_names.load();
+    free(hash_memory);
   }
 };
 
+/*
+ * The bytes hash_values and hash_table take together, laid out one after
+ * the other, as they are both in memory and in an index.
+ */
+static size_t HashTableBytes(uint32_t hash_table_size) {
+  return hash_table_size * (sizeof(uint32_t) + sizeof(ZipEntrySlot));
+}
+
+/*
+ * The name in slot |ent|, checked to lie within the central directory
+ * after its record, since an index is not to be trusted.
+ */
+static bool GetEntryName(const ZipArchive* archive, uint32_t ent, ZipEntryName* name) {
+  const ZipEntrySlot& slot = archive->hash_table[ent];
+  const size_t cd_length = archive->directory_map.getDataLength();
+  if (slot.name_offset < sizeof(CentralDirectoryRecord) ||
+      slot.name_offset > cd_length || slot.name_length > cd_length - slot.name_offset) {
+    ALOGW("Zip: Invalid entry name offset %" PRIu32, slot.name_offset);
+    return false;
+  }
+  name->name = reinterpret_cast<const uint8_t*>(archive->directory_map.getDataPtr()) +
+      slot.name_offset;
+  name->name_length = slot.name_length;
+  return true;
+}
+
 /*
  * Round up to the next highest power of 2.
  *
@@ -343,32 +434,62 @@ static uint32_t RoundUpPower2(uint32_t val) {
   return val;
 }
 
+/*
+ * A MurmurHash64A-style hash, taking the name eight bytes at a time. Only
+ * the low 32 bits are kept; they pick the slot and are kept alongside it.
+ */
 static uint32_t ComputeHash(const ZipEntryName& name) {
-  uint32_t hash = 0;
-  uint16_t len = name.name_length;
+  static const uint64_t kMul = 0xc6a4a7935bd1e995ULL;
   const uint8_t* str = name.name;
-
-  while (len--) {
-    hash = hash * 31 + *str++;
+  size_t len = name.name_length;
+  uint64_t hash = len * kMul;
+
+  while (len >= sizeof(uint64_t)) {
+    uint64_t k;
+    memcpy(&k, str, sizeof(k));
+    k *= kMul;
+    k ^= k >> 47;
+    k *= kMul;
+    hash = (hash ^ k) * kMul;
+    str += sizeof(k);
+    len -= sizeof(k);
+  }
+  if (len > 0) {
+    uint64_t k = 0;
+    memcpy(&k, str, len);
+    hash = (hash ^ k) * kMul;
   }
 
-  return hash;
+  hash ^= hash >> 47;
+  hash *= kMul;
+  hash ^= hash >> 47;
+
+  // 0 marks an empty slot in hash_values.
+  const uint32_t result = static_cast<uint32_t>(hash);
+  return result != 0 ? result : 1;
 }
 
 /*
  * Convert a ZipEntry to a hash table index, verifying that it's in a
  * valid range.
+ *
+ * Probing only reads hash_values, sixteen slots to a cache line, and
+ * looks at a name in the central directory only when its hash matches.
  */
-static int64_t EntryToIndex(const ZipEntryName* hash_table,
-                            const uint32_t hash_table_size,
-                            const ZipEntryName& name) {
+static int64_t EntryToIndex(const ZipArchive* archive, const ZipEntryName& name) {
   const uint32_t hash = ComputeHash(name);
+  const uint32_t* hash_values = archive->hash_values;
+  const uint32_t hash_table_size = archive->hash_table_size;
 
-  // NOTE: (hash_table_size - 1) is guaranteed to be non-negative.
+  // NOTE: (hash_table_size - 1) is guaranteed to be non-negative. A table
+  // always has an empty slot, unless it came from a corrupt index.
   uint32_t ent = hash & (hash_table_size - 1);
-  while (hash_table[ent].name != NULL) {
-    if (hash_table[ent].name_length == name.name_length &&
-        memcmp(hash_table[ent].name, name.name, name.name_length) == 0) {
+  for (uint32_t probes = 0; hash_values[ent] != 0 && probes < hash_table_size; probes++) {
+    ZipEntryName slot_name;
+    if (hash_values[ent] == hash &&
+        archive->hash_table[ent].name_length == name.name_length &&
+        GetEntryName(archive, ent, &slot_name) &&
+        memcmp(slot_name.name, name.name, name.name_length) == 0) {
       return ent;
     }
 
@@ -382,18 +503,20 @@ static int64_t EntryToIndex(const ZipEntryName* hash_table,
 /*
  * Add a new entry to the hash table.
  */
-static int32_t AddToHash(ZipEntryName *hash_table, const uint64_t hash_table_size,
+static int32_t AddToHash(ZipEntrySlot* hash_table, uint32_t* hash_values,
+                         const uint64_t hash_table_size, const uint8_t* cd_ptr,
                          const ZipEntryName& name) {
-  const uint64_t hash = ComputeHash(name);
+  const uint32_t hash = ComputeHash(name);
   uint32_t ent = hash & (hash_table_size - 1);
 
   /*
    * We over-allocated the table, so we're guaranteed to find an empty slot.
    * Further, we guarantee that the hashtable size is not 0.
    */
-  while (hash_table[ent].name != NULL) {
-    if (hash_table[ent].name_length == name.name_length &&
-        memcmp(hash_table[ent].name, name.name, name.name_length) == 0) {
+  while (hash_values[ent] != 0) {
+    if (hash_values[ent] == hash &&
+        hash_table[ent].name_length == name.name_length &&
+        memcmp(cd_ptr + hash_table[ent].name_offset, name.name, name.name_length) == 0) {
       // We've found a duplicate entry. We don't accept it
       ALOGW("Zip: Found duplicate entry %.*s", name.name_length, name.name);
       return kDuplicateEntry;
@@ -401,8 +524,9 @@ static int32_t AddToHash(ZipEntryName *hash_table, const uint64_t hash_table_siz
     ent = (ent + 1) & (hash_table_size - 1);
   }
 
-  hash_table[ent].name = name.name;
+  hash_table[ent].name_offset = name.name - cd_ptr;
   hash_table[ent].name_length = name.name_length;
+  hash_values[ent] = hash;
   return 0;
 }
 
@@ -559,14 +683,26 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
   const size_t cd_length = archive->directory_map.getDataLength();
   const uint16_t num_entries = archive->num_entries;
 
+  // All of it is about to be read; ask for it in one go rather than
+  // fault by fault.
+  archive->directory_map.prefetch(0, cd_length);
+
   /*
    * Create hash table.  We have a minimum 75% load factor, possibly as
    * low as 50% after we round off to a power of 2.  There must be at
    * least one unused entry to avoid an infinite loop during creation.
    */
-  archive->hash_table_size = RoundUpPower2(1 + (num_entries * 4) / 3);
-  archive->hash_table = reinterpret_cast<ZipEntryName*>(calloc(archive->hash_table_size,
-      sizeof(ZipEntryName)));
+  const uint32_t hash_table_size = RoundUpPower2(1 + (num_entries * 4) / 3);
+  archive->hash_memory = calloc(HashTableBytes(hash_table_size), 1);
+  if (archive->hash_memory == NULL) {
+    ALOGW("Zip: unable to allocate the hash table for %" PRIu16 " entries", num_entries);
+    return -1;
+  }
+  uint32_t* hash_values = reinterpret_cast<uint32_t*>(archive->hash_memory);
+  ZipEntrySlot* hash_table = reinterpret_cast<ZipEntrySlot*>(hash_values + hash_table_size);
+  archive->hash_table_size = hash_table_size;
+  archive->hash_values = hash_values;
+  archive->hash_table = hash_table;
 
   /*
    * Walk through the central directory, adding entries to the hash
@@ -608,8 +744,8 @@ static int32_t ParseZipArchive(ZipArchive* archive) {
     ZipEntryName entry_name;
     entry_name.name = file_name;
     entry_name.name_length = file_name_length;
-    const int add_result = AddToHash(archive->hash_table,
-        archive->hash_table_size, entry_name);
+    const int add_result = AddToHash(hash_table, hash_values, hash_table_size, cd_ptr,
+        entry_name);
     if (add_result != 0) {
       ALOGW("Zip: Error adding entry to hash table %d", add_result);
       return add_result;
@@ -662,33 +798,153 @@ int32_t OpenArchive(const char* fileName, ZipArchiveHandle* handle) {
 }
 
 /*
- * Close a ZipArchive, closing the file and freeing the contents.
+ * An index holds the hash table of an archive, hash_values then
+ * hash_table, after this header. It belongs to the archive with the
+ * device, inode, size and modification time in the header, and is only
+ * used if the central directory is still where and as big as it was.
  */
-void CloseArchive(ZipArchiveHandle handle) {
-  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
-  ALOGV("Closing archive %p", archive);
-  delete archive;
+struct IndexHeader {
+  static const uint32_t kMagic = 0x5844495a;  // "ZIDX"
+  static const uint32_t kVersion = 1;
+
+  uint32_t magic;
+  uint32_t version;
+  uint64_t dev;
+  uint64_t ino;
+  int64_t size;
+  int64_t mtime;
+  int64_t directory_offset;
+  uint32_t directory_length;
+  uint32_t num_entries;
+  uint32_t hash_table_size;
+  uint32_t reserved;
+};
+
+static void FillIndexHeader(const ZipArchive* archive, const struct stat& st,
+                            IndexHeader* header) {
+  memset(header, 0, sizeof(*header));
+  header->magic = IndexHeader::kMagic;
+  header->version = IndexHeader::kVersion;
+  header->dev = st.st_dev;
+  header->ino = st.st_ino;
+  header->size = st.st_size;
+  header->mtime = st.st_mtime;
+  header->directory_offset = archive->directory_offset;
+  header->directory_length = archive->directory_map.getDataLength();
+  header->num_entries = archive->num_entries;
+  header->hash_table_size = RoundUpPower2(1 + (archive->num_entries * 4) / 3);
 }
 
-static int32_t UpdateEntryFromDataDescriptor(int fd,
-                                             ZipEntry *entry) {
-  uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
-  ssize_t actual = TEMP_FAILURE_RETRY(read(fd, ddBuf, sizeof(ddBuf)));
-  if (actual != sizeof(ddBuf)) {
+/*
+ * Maps the index at |index_path| as the hash table of |archive| if it
+ * matches |expected|.
+ */
+static bool MapIndex(ZipArchive* archive, const char* index_path,
+                     const IndexHeader& expected) {
+  const int fd = open(index_path, O_RDONLY | O_BINARY);
+  if (fd < 0) {
+    return false;
+  }
+
+  const size_t length = sizeof(IndexHeader) + HashTableBytes(expected.hash_table_size);
+  struct stat st;
+  android::FileMap* map = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size == static_cast<off64_t>(length)) {
+    map = new android::FileMap();
+    if (!map->create(index_path, fd, 0, length, true /* read only */)) {
+      delete map;
+      map = NULL;
+    }
+  }
+  close(fd);
+
+  if (map == NULL) {
+    return false;
+  }
+  if (memcmp(map->getDataPtr(), &expected, sizeof(expected)) != 0) {
+    ALOGV("Zip: index %s is out of date", index_path);
+    delete map;
+    return false;
+  }
+
+  const uint32_t* hash_values = reinterpret_cast<const uint32_t*>(
+      reinterpret_cast<const uint8_t*>(map->getDataPtr()) + sizeof(IndexHeader));
+  archive->index_map = map;
+  archive->hash_table_size = expected.hash_table_size;
+  archive->hash_values = hash_values;
+  archive->hash_table = reinterpret_cast<const ZipEntrySlot*>(
+      hash_values + expected.hash_table_size);
+  return true;
+}
+
+/*
+ * Saves the hash table ParseZipArchive built for |archive| at |index_path|.
+ * It is written to a file of its own and renamed into place, so that other
+ * processes never map part of one.
+ */
+static void WriteIndex(const ZipArchive* archive, const char* index_path,
+                       const IndexHeader& header) {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%d.tmp", getpid());
+  const std::string temp_path = std::string(index_path) + suffix;
+
+  unlink(temp_path.c_str());
+  const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+  if (fd < 0) {
+    ALOGW("Zip: unable to create index %s: %s", temp_path.c_str(), strerror(errno));
+    return;
+  }
+  const bool written =
+      android::base::WriteFully(fd, &header, sizeof(header)) &&
+      android::base::WriteFully(fd, archive->hash_memory, HashTableBytes(header.hash_table_size));
+  if (close(fd) != 0 || !written || rename(temp_path.c_str(), index_path) != 0) {
+    ALOGW("Zip: unable to write index %s: %s", index_path, strerror(errno));
+    unlink(temp_path.c_str());
+  }
+}
+
+int32_t OpenArchiveWithIndex(const char* fileName, const char* index_path,
+                             ZipArchiveHandle* handle) {
+  const int fd = open(fileName, O_RDONLY | O_BINARY, 0);
+  ZipArchive* archive = new ZipArchive(fd, true);
+  *handle = archive;
+
+  if (fd < 0) {
+    ALOGW("Unable to open '%s': %s", fileName, strerror(errno));
     return kIoError;
   }
 
-  const uint32_t ddSignature = *(reinterpret_cast<const uint32_t*>(ddBuf));
-  const uint16_t offset = (ddSignature == DataDescriptor::kOptSignature) ? 4 : 0;
-  const DataDescriptor* descriptor = reinterpret_cast<const DataDescriptor*>(ddBuf + offset);
+  int32_t result;
+  if ((result = MapCentralDirectory(fd, fileName, archive))) {
+    return result;
+  }
 
-  entry->crc32 = descriptor->crc32;
-  entry->compressed_length = descriptor->compressed_size;
-  entry->uncompressed_length = descriptor->uncompressed_size;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return ParseZipArchive(archive);
+  }
+  IndexHeader header;
+  FillIndexHeader(archive, st, &header);
+  if (MapIndex(archive, index_path, header)) {
+    return 0;
+  }
 
+  if ((result = ParseZipArchive(archive))) {
+    return result;
+  }
+  WriteIndex(archive, index_path, header);
   return 0;
 }
 
+/*
+ * Close a ZipArchive, closing the file and freeing the contents.
+ */
+void CloseArchive(ZipArchiveHandle handle) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+  ALOGV("Closing archive %p", archive);
+  delete archive;
+}
+
 // Attempts to read |len| bytes into |buf| at offset |off|.
 //
 // This method uses pread64 on platforms that support it and
@@ -712,29 +968,47 @@ static inline ssize_t ReadAtOffset(int fd, uint8_t* buf, size_t len,
 #endif
 }
 
+static int32_t UpdateEntryFromDataDescriptor(int fd, off64_t dd_offset,
+                                             ZipEntry *entry) {
+  uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
+  ssize_t actual = ReadAtOffset(fd, ddBuf, sizeof(ddBuf), dd_offset);
+  if (actual != sizeof(ddBuf)) {
+    return kIoError;
+  }
+
+  const uint32_t ddSignature = *(reinterpret_cast<const uint32_t*>(ddBuf));
+  const uint16_t offset = (ddSignature == DataDescriptor::kOptSignature) ? 4 : 0;
+  const DataDescriptor* descriptor = reinterpret_cast<const DataDescriptor*>(ddBuf + offset);
+
+  entry->crc32 = descriptor->crc32;
+  entry->compressed_length = descriptor->compressed_size;
+  entry->uncompressed_length = descriptor->uncompressed_size;
+
+  return 0;
+}
+
 static int32_t FindEntry(const ZipArchive* archive, const int ent,
                          ZipEntry* data) {
-  const uint16_t nameLen = archive->hash_table[ent].name_length;
+  // The name in the hash table has to lie within the mapped central
+  // directory, after the fixed-size record it is part of.
+  ZipEntryName entry_name;
+  if (!GetEntryName(archive, ent, &entry_name)) {
+    return kInvalidOffset;
+  }
+  const uint16_t nameLen = entry_name.name_length;
 
   // Recover the start of the central directory entry from the filename
   // pointer.  The filename is the first entry past the fixed-size data,
   // so we can just subtract back from that.
-  const uint8_t* ptr = archive->hash_table[ent].name;
-  ptr -= sizeof(CentralDirectoryRecord);
-
-  // This is the base of our mmapped region, we have to sanity check that
-  // the name that's in the hash table is a pointer to a location within
-  // this mapped region.
-  const uint8_t* base_ptr = reinterpret_cast<const uint8_t*>(
-    archive->directory_map.getDataPtr());
-  if (ptr < base_ptr || ptr > base_ptr + archive->directory_map.getDataLength()) {
+  const uint8_t* ptr = entry_name.name - sizeof(CentralDirectoryRecord);
+  const CentralDirectoryRecord *cdr =
+      reinterpret_cast<const CentralDirectoryRecord*>(ptr);
+  if (cdr->record_signature != CentralDirectoryRecord::kSignature ||
+      cdr->file_name_length != nameLen) {
     ALOGW("Zip: Invalid entry pointer");
     return kInvalidOffset;
   }
 
-  const CentralDirectoryRecord *cdr =
-      reinterpret_cast<const CentralDirectoryRecord*>(ptr);
-
   // The offset of the start of the central directory in the zipfile.
   // We keep this lying around so that we can sanity check all our lengths
   // and our per-file structures.
@@ -811,7 +1085,7 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent,
       return kIoError;
     }
 
-    if (memcmp(archive->hash_table[ent].name, name_buf, nameLen)) {
+    if (memcmp(entry_name.name, name_buf, nameLen)) {
       free(name_buf);
       return kInconsistentInformation;
     }
@@ -849,6 +1123,10 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent,
 
 struct IterationHandle {
   uint32_t position;
+  // With a prefix, position is in sorted->slots, from start, the first
+  // name not before the prefix. Otherwise it's a slot of the hash table.
+  const SortedNames* sorted;
+  uint32_t start;
   // We're not using vector here because this code is used in the Windows SDK
   // where the STL is not available.
   const uint8_t* prefix;
@@ -881,6 +1159,44 @@ struct IterationHandle {
   }
 };
 
+// Orders names as memcmp would, a prefix before the names it starts.
+static int CompareNames(const ZipEntryName& a, const ZipEntryName& b) {
+  const int result = memcmp(a.name, b.name, std::min(a.name_length, b.name_length));
+  if (result != 0) {
+    return result;
+  }
+  return a.name_length - b.name_length;
+}
+
+static const SortedNames* GetSortedNames(ZipArchive* archive) {
+  SortedNames* sorted = archive->sorted_names.load();
+  if (sorted != NULL) {
+    return sorted;
+  }
+
+  sorted = new SortedNames();
+  for (uint32_t i = 0; i < archive->hash_table_size; i++) {
+    ZipEntryName name;
+    if (archive->hash_values[i] != 0 && GetEntryName(archive, i, &name)) {
+      sorted->slots.push_back(i);
+    }
+  }
+  std::sort(sorted->slots.begin(), sorted->slots.end(), [archive](uint32_t a, uint32_t b) {
+    ZipEntryName a_name, b_name;
+    GetEntryName(archive, a, &a_name);
+    GetEntryName(archive, b, &b_name);
+    return CompareNames(a_name, b_name) < 0;
+  });
+
+  // Another thread may have got there first.
+  SortedNames* expected = NULL;
+  if (!archive->sorted_names.compare_exchange_strong(expected, sorted)) {
+    delete sorted;
+    return expected;
+  }
+  return sorted;
+}
+
 int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr,
                        const ZipEntryName* optional_prefix,
                        const ZipEntryName* optional_suffix) {
@@ -893,8 +1209,25 @@ int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr,
 
   IterationHandle* cookie = new IterationHandle(optional_prefix, optional_suffix);
   cookie->position = 0;
+  cookie->sorted = NULL;
+  cookie->start = 0;
   cookie->archive = archive;
 
+  if (cookie->prefix_len > 0) {
+    cookie->sorted = GetSortedNames(archive);
+    const std::vector<uint32_t>& slots = cookie->sorted->slots;
+    ZipEntryName prefix;
+    prefix.name = cookie->prefix;
+    prefix.name_length = cookie->prefix_len;
+    cookie->start = std::lower_bound(slots.begin(), slots.end(), prefix,
+        [archive](uint32_t slot, const ZipEntryName& name) {
+          ZipEntryName slot_name;
+          GetEntryName(archive, slot, &slot_name);
+          return CompareNames(slot_name, name) < 0;
+        }) - slots.begin();
+    cookie->position = cookie->start;
+  }
+
   *cookie_ptr = cookie ;
   return 0;
 }
@@ -911,8 +1244,7 @@ int32_t FindEntry(const ZipArchiveHandle handle, const ZipEntryName& entryName,
     return kInvalidEntryName;
   }
 
-  const int64_t ent = EntryToIndex(archive->hash_table,
-    archive->hash_table_size, entryName);
+  const int64_t ent = EntryToIndex(archive, entryName);
 
   if (ent < 0) {
     ALOGV("Zip: Could not find entry %.*s", entryName.name_length, entryName.name);
@@ -934,25 +1266,55 @@ int32_t Next(void* cookie, ZipEntry* data, ZipEntryName* name) {
     return kInvalidHandle;
   }
 
+  if (handle->sorted != NULL) {
+    // Names with the prefix are together, from start.
+    const std::vector<uint32_t>& slots = handle->sorted->slots;
+    for (uint32_t i = handle->position; i < slots.size(); ++i) {
+      ZipEntryName entry_name;
+      GetEntryName(archive, slots[i], &entry_name);
+      if (entry_name.name_length < handle->prefix_len ||
+          memcmp(handle->prefix, entry_name.name, handle->prefix_len) != 0) {
+        break;
+      }
+      if (handle->suffix_len == 0 ||
+          (entry_name.name_length >= handle->suffix_len &&
+           memcmp(handle->suffix,
+                  entry_name.name + entry_name.name_length - handle->suffix_len,
+                  handle->suffix_len) == 0)) {
+        handle->position = (i + 1);
+        const int error = FindEntry(archive, slots[i], data);
+        if (!error) {
+          *name = entry_name;
+        }
+
+        return error;
+      }
+    }
+
+    handle->position = handle->start;
+    return kIterationEnd;
+  }
+
   const uint32_t currentOffset = handle->position;
   const uint32_t hash_table_length = archive->hash_table_size;
-  const ZipEntryName *hash_table = archive->hash_table;
+  const uint32_t* hash_values = archive->hash_values;
 
   for (uint32_t i = currentOffset; i < hash_table_length; ++i) {
-    if (hash_table[i].name != NULL &&
+    ZipEntryName entry_name;
+    if (hash_values[i] != 0 &&
+        GetEntryName(archive, i, &entry_name) &&
         (handle->prefix_len == 0 ||
-         (hash_table[i].name_length >= handle->prefix_len &&
-          memcmp(handle->prefix, hash_table[i].name, handle->prefix_len) == 0)) &&
+         (entry_name.name_length >= handle->prefix_len &&
+          memcmp(handle->prefix, entry_name.name, handle->prefix_len) == 0)) &&
         (handle->suffix_len == 0 ||
-         (hash_table[i].name_length >= handle->suffix_len &&
+         (entry_name.name_length >= handle->suffix_len &&
           memcmp(handle->suffix,
-                 hash_table[i].name + hash_table[i].name_length - handle->suffix_len,
+                 entry_name.name + entry_name.name_length - handle->suffix_len,
                  handle->suffix_len) == 0))) {
       handle->position = (i + 1);
       const int error = FindEntry(archive, i, data);
       if (!error) {
-        name->name = hash_table[i].name;
-        name->name_length = hash_table[i].name_length;
+        *name = entry_name;
       }
 
       return error;
@@ -1079,6 +1441,52 @@ class FileWriter : public Writer {
   size_t total_bytes_written_;
 };
 
+// Largest size of the buffers entries are read and inflated through,
+// smaller entries get buffers of their own size. Past 32K, the size of
+// the inflate window, larger buffers mostly save system calls and calls
+// into the writer.
+static const size_t kExtractBufSize = 128 * 1024;
+
+static size_t ExtractBufSize(uint32_t length) {
+  return std::max<size_t>(1, std::min<size_t>(kExtractBufSize, length));
+}
+
+// The zip CRC-32, computed with the ARMv8 CRC32 instructions where the
+// target has them and with zlib's tables otherwise.
+static uint32_t ComputeCrc32(uint32_t crc, const uint8_t* buf, size_t len) {
+#if defined(__ARM_FEATURE_CRC32)
+  crc = ~crc;
+  while (len > 0 && (reinterpret_cast<uintptr_t>(buf) & 7) != 0) {
+    crc = __crc32b(crc, *buf++);
+    len--;
+  }
+  for (; len >= 8; buf += 8, len -= 8) {
+    crc = __crc32d(crc, *reinterpret_cast<const uint64_t*>(buf));
+  }
+  while (len > 0) {
+    crc = __crc32b(crc, *buf++);
+    len--;
+  }
+  return ~crc;
+#else
+  return crc32(crc, buf, len);
+#endif
+}
+
+// Tells the kernel an entry is about to be read from start to end, so
+// that it reads ahead of us rather than a page cluster at a time.
+static void AdviseSequentialRead(int fd, off64_t offset, uint32_t length) {
+#if defined(__linux__)
+  if (length > kExtractBufSize) {
+    posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+  }
+#else
+  (void) fd;
+  (void) offset;
+  (void) length;
+#endif
+}
+
 // This method is using libz macros with old-style-casts
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wold-style-cast"
@@ -1089,9 +1497,10 @@ static inline int zlib_inflateInit2(z_stream* stream, int window_bits) {
 
 static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
                                     Writer* writer, uint64_t* crc_out) {
-  const size_t kBufSize = 32768;
-  std::vector<uint8_t> read_buf(kBufSize);
-  std::vector<uint8_t> write_buf(kBufSize);
+  const size_t read_buf_size = ExtractBufSize(entry->compressed_length);
+  const size_t write_buf_size = ExtractBufSize(entry->uncompressed_length);
+  std::vector<uint8_t> read_buf(read_buf_size);
+  std::vector<uint8_t> write_buf(write_buf_size);
   z_stream zstream;
   int zerr;
 
@@ -1105,7 +1514,7 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
   zstream.next_in = NULL;
   zstream.avail_in = 0;
   zstream.next_out = &write_buf[0];
-  zstream.avail_out = kBufSize;
+  zstream.avail_out = write_buf_size;
   zstream.data_type = Z_UNKNOWN;
 
   /*
@@ -1133,17 +1542,21 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
   const uint32_t uncompressed_length = entry->uncompressed_length;
 
   uint32_t compressed_length = entry->compressed_length;
+  off64_t offset = entry->offset;
+  AdviseSequentialRead(fd, offset, compressed_length);
+  uint32_t crc = 0;
   do {
     /* read as much as we can */
     if (zstream.avail_in == 0) {
-      const ZD_TYPE getSize = (compressed_length > kBufSize) ? kBufSize : compressed_length;
-      const ZD_TYPE actual = TEMP_FAILURE_RETRY(read(fd, &read_buf[0], getSize));
+      const ZD_TYPE getSize = std::min<size_t>(read_buf_size, compressed_length);
+      const ZD_TYPE actual = ReadAtOffset(fd, &read_buf[0], getSize, offset);
       if (actual != getSize) {
         ALOGW("Zip: inflate read failed (" ZD " vs " ZD ")", actual, getSize);
         return kIoError;
       }
 
       compressed_length -= getSize;
+      offset += getSize;
 
       zstream.next_in = &read_buf[0];
       zstream.avail_in = getSize;
@@ -1160,22 +1573,24 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
 
     /* write when we're full or when we're done */
     if (zstream.avail_out == 0 ||
-      (zerr == Z_STREAM_END && zstream.avail_out != kBufSize)) {
+      (zerr == Z_STREAM_END && zstream.avail_out != write_buf_size)) {
       const size_t write_size = zstream.next_out - &write_buf[0];
+      // Raw deflate streams carry no check value, so zlib computes none;
+      // do it here while the data is still in the cache.
+      crc = ComputeCrc32(crc, &write_buf[0], write_size);
       if (!writer->Append(&write_buf[0], write_size)) {
         // The file might have declared a bogus length.
         return kInconsistentInformation;
       }
 
       zstream.next_out = &write_buf[0];
-      zstream.avail_out = kBufSize;
+      zstream.avail_out = write_buf_size;
     }
   } while (zerr == Z_OK);
 
   assert(zerr == Z_STREAM_END);     /* other errors should've been caught */
 
-  // stream.adler holds the crc32 value for such streams.
-  *crc_out = zstream.adler;
+  *crc_out = crc;
 
   if (zstream.total_out != uncompressed_length || compressed_length != 0) {
     ALOGW("Zip: size mismatch on inflated file (%lu vs %" PRIu32 ")",
@@ -1188,29 +1603,30 @@ static int32_t InflateEntryToWriter(int fd, const ZipEntry* entry,
 
 static int32_t CopyEntryToWriter(int fd, const ZipEntry* entry, Writer* writer,
                                  uint64_t *crc_out) {
-  static const uint32_t kBufSize = 32768;
+  const uint32_t kBufSize = ExtractBufSize(entry->uncompressed_length);
   std::vector<uint8_t> buf(kBufSize);
 
   const uint32_t length = entry->uncompressed_length;
+  AdviseSequentialRead(fd, entry->offset, length);
   uint32_t count = 0;
-  uint64_t crc = 0;
+  uint32_t crc = 0;
   while (count < length) {
     uint32_t remaining = length - count;
 
     // Safe conversion because kBufSize is narrow enough for a 32 bit signed
     // value.
     const ssize_t block_size = (remaining > kBufSize) ? kBufSize : remaining;
-    const ssize_t actual = TEMP_FAILURE_RETRY(read(fd, &buf[0], block_size));
+    const ssize_t actual = ReadAtOffset(fd, &buf[0], block_size, entry->offset + count);
 
     if (actual != block_size) {
       ALOGW("CopyFileToFile: copy read failed (" ZD " vs " ZD ")", actual, block_size);
       return kIoError;
     }
 
+    crc = ComputeCrc32(crc, &buf[0], block_size);
     if (!writer->Append(&buf[0], block_size)) {
       return kIoError;
     }
-    crc = crc32(crc, &buf[0], block_size);
     count += block_size;
   }
 
@@ -1223,12 +1639,9 @@ int32_t ExtractToWriter(ZipArchiveHandle handle,
                         ZipEntry* entry, Writer* writer) {
   ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
   const uint16_t method = entry->method;
-  off64_t data_offset = entry->offset;
 
-  if (lseek64(archive->fd, data_offset, SEEK_SET) != data_offset) {
-    ALOGW("Zip: lseek to data at %" PRId64 " failed", static_cast<int64_t>(data_offset));
-    return kIoError;
-  }
+  // Everything is read at an offset, leaving that of archive->fd alone,
+  // so that entries can be extracted on several threads at once.
 
   // this should default to kUnknownCompressionMethod.
   int32_t return_value = -1;
@@ -1240,15 +1653,15 @@ int32_t ExtractToWriter(ZipArchiveHandle handle,
   }
 
   if (!return_value && entry->has_data_descriptor) {
-    return_value = UpdateEntryFromDataDescriptor(archive->fd, entry);
+    const off64_t data_end = entry->offset + (method == kCompressStored ?
+        entry->uncompressed_length : entry->compressed_length);
+    return_value = UpdateEntryFromDataDescriptor(archive->fd, data_end, entry);
     if (return_value) {
       return return_value;
     }
   }
 
-  // TODO: Fix this check by passing the right flags to inflate2 so that
-  // it calculates the CRC for us.
-  if (entry->crc32 != crc && false) {
+  if (!return_value && entry->crc32 != crc) {
     ALOGW("Zip: crc mismatch: expected %" PRIu32 ", was %" PRIu64, entry->crc32, crc);
     return kInconsistentInformation;
   }
@@ -1272,6 +1685,255 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle,
   return ExtractToWriter(handle, entry, writer.get());
 }
 
+int32_t MapStoredEntry(ZipArchiveHandle handle, const ZipEntry* entry,
+                       uint32_t alignment, const uint8_t** data, uint32_t* size) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+
+  if (entry->method != kCompressStored) {
+    return kEntryCompressed;
+  }
+  if (entry->compressed_length != entry->uncompressed_length) {
+    ALOGW("Zip: stored entry with compressed length %" PRIu32 " != uncompressed length %" PRIu32,
+          entry->compressed_length, entry->uncompressed_length);
+    return kInconsistentInformation;
+  }
+  if (alignment != 0 && (entry->offset % alignment) != 0) {
+    return kEntryMisaligned;
+  }
+
+  // FindEntry has checked that the data ends before the central directory.
+  if (archive->data_map == NULL) {
+    android::FileMap* map = new android::FileMap();
+    if (!map->create(NULL, archive->fd, 0, static_cast<size_t>(archive->directory_offset),
+                     true /* read only */)) {
+      delete map;
+      return kMmapFailed;
+    }
+    archive->data_map = map;
+  }
+
+  *data = reinterpret_cast<const uint8_t*>(archive->data_map->getDataPtr()) + entry->offset;
+  *size = entry->uncompressed_length;
+  return 0;
+}
+
+// The entries ExtractEntriesToFiles has been given, taken in turn by each
+// of its threads.
+struct ExtractionQueue {
+  ZipArchiveHandle handle;
+  ZipEntryExtraction* extractions;
+  size_t count;
+  std::atomic<size_t> next;
+};
+
+static void* ExtractQueued(void* cookie) {
+  ExtractionQueue* queue = reinterpret_cast<ExtractionQueue*>(cookie);
+  for (size_t i = queue->next++; i < queue->count; i = queue->next++) {
+    ZipEntryExtraction* extraction = &queue->extractions[i];
+    extraction->result = ExtractEntryToFile(queue->handle, extraction->entry, extraction->fd);
+  }
+  return NULL;
+}
+
+int32_t ExtractEntriesToFiles(ZipArchiveHandle handle, ZipEntryExtraction* extractions,
+                              size_t count, unsigned max_threads) {
+  ExtractionQueue queue;
+  queue.handle = handle;
+  queue.extractions = extractions;
+  queue.count = count;
+  queue.next = 0;
+
+#if !defined(_WIN32)
+  size_t threads = max_threads;
+  if (threads == 0) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? cpus : 1;
+  }
+  if (threads > count) {
+    threads = count;
+  }
+
+  // The calling thread is one of them. If a thread can't be started the
+  // others take its share.
+  std::vector<pthread_t> pool;
+  for (size_t i = 1; i < threads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ExtractQueued, &queue) != 0) {
+      break;
+    }
+    pool.push_back(thread);
+  }
+  ExtractQueued(&queue);
+  for (size_t i = 0; i < pool.size(); i++) {
+    pthread_join(pool[i], NULL);
+  }
+#else
+  // ReadAtOffset seeks here, so there's only the one thread.
+  UNUSED(max_threads);
+  ExtractQueued(&queue);
+#endif
+
+  for (size_t i = 0; i < count; i++) {
+    if (extractions[i].result != 0) {
+      return extractions[i].result;
+    }
+  }
+  return 0;
+}
+
+// What OpenEntryReader hands out: where the next compressed bytes are,
+// how much is left of them and of the entry, and for deflated entries the
+// inflate state and a buffer of input.
+struct EntryReader {
+  static const size_t kBufSize = 32768;
+
+  int fd;
+  uint16_t method;
+  off64_t offset;
+  uint32_t compressed_left;
+  uint32_t uncompressed_left;
+  bool zstream_open;
+  z_stream zstream;
+  std::vector<uint8_t> read_buf;
+
+  EntryReader() : zstream_open(false) {
+    memset(&zstream, 0, sizeof(zstream));
+  }
+
+  ~EntryReader() {
+    if (zstream_open) {
+      inflateEnd(&zstream);
+    }
+  }
+};
+
+int32_t OpenEntryReader(ZipArchiveHandle handle, const ZipEntry* entry, void** reader_ptr) {
+  ZipArchive* archive = reinterpret_cast<ZipArchive*>(handle);
+  if (entry->method != kCompressStored && entry->method != kCompressDeflated) {
+    ALOGW("Zip: unsupported compression method %" PRIu16, entry->method);
+    return kInconsistentInformation;
+  }
+
+  std::unique_ptr<EntryReader> reader(new EntryReader());
+  reader->fd = archive->fd;
+  reader->method = entry->method;
+  reader->offset = entry->offset;
+  reader->uncompressed_left = entry->uncompressed_length;
+  reader->compressed_left = (entry->method == kCompressStored) ?
+      entry->uncompressed_length : entry->compressed_length;
+
+  if (entry->method == kCompressDeflated) {
+    // As in InflateEntryToWriter, there's no zlib header.
+    const int zerr = zlib_inflateInit2(&reader->zstream, -MAX_WBITS);
+    if (zerr != Z_OK) {
+      ALOGW("Call to inflateInit2 failed (zerr=%d)", zerr);
+      return kZlibError;
+    }
+    reader->zstream_open = true;
+    reader->read_buf.resize(EntryReader::kBufSize);
+  }
+
+  *reader_ptr = reader.release();
+  return 0;
+}
+
+int32_t ReadEntry(void* cookie, uint8_t* buf, uint32_t len) {
+  EntryReader* reader = reinterpret_cast<EntryReader*>(cookie);
+  if (len > reader->uncompressed_left) {
+    len = reader->uncompressed_left;
+  }
+  if (len > INT32_MAX) {
+    len = INT32_MAX;
+  }
+  if (len == 0) {
+    return 0;
+  }
+
+  if (reader->method == kCompressStored) {
+    const ssize_t actual = ReadAtOffset(reader->fd, buf, len, reader->offset);
+    if (actual != static_cast<ssize_t>(len)) {
+      ALOGW("Zip: read of stored entry failed (" ZD " vs %" PRIu32 ")", actual, len);
+      return kIoError;
+    }
+    reader->offset += len;
+    reader->compressed_left -= len;
+    reader->uncompressed_left -= len;
+    return len;
+  }
+
+  z_stream* zstream = &reader->zstream;
+  zstream->next_out = buf;
+  zstream->avail_out = len;
+  while (zstream->avail_out > 0) {
+    if (zstream->avail_in == 0) {
+      if (reader->compressed_left == 0) {
+        ALOGW("Zip: inflated entry ended %" PRIu32 " bytes short",
+              reader->uncompressed_left - (len - zstream->avail_out));
+        return kInconsistentInformation;
+      }
+      const uint32_t get_size = (reader->compressed_left > EntryReader::kBufSize) ?
+          EntryReader::kBufSize : reader->compressed_left;
+      const ssize_t actual = ReadAtOffset(reader->fd, &reader->read_buf[0], get_size,
+                                          reader->offset);
+      if (actual != static_cast<ssize_t>(get_size)) {
+        ALOGW("Zip: inflate read failed (" ZD " vs %" PRIu32 ")", actual, get_size);
+        return kIoError;
+      }
+      reader->offset += get_size;
+      reader->compressed_left -= get_size;
+      zstream->next_in = &reader->read_buf[0];
+      zstream->avail_in = get_size;
+    }
+
+    const int zerr = inflate(zstream, Z_NO_FLUSH);
+    if (zerr == Z_STREAM_END) {
+      if (zstream->avail_out != 0) {
+        ALOGW("Zip: inflated entry ended %" PRIu32 " bytes short",
+              reader->uncompressed_left - (len - zstream->avail_out));
+        return kInconsistentInformation;
+      }
+      break;
+    }
+    if (zerr != Z_OK) {
+      ALOGW("Zip: inflate zerr=%d", zerr);
+      return kZlibError;
+    }
+  }
+
+  reader->uncompressed_left -= len;
+  return len;
+}
+
+int32_t SkipEntry(void* cookie, uint32_t len) {
+  EntryReader* reader = reinterpret_cast<EntryReader*>(cookie);
+  if (len > reader->uncompressed_left) {
+    len = reader->uncompressed_left;
+  }
+
+  if (reader->method == kCompressStored) {
+    reader->offset += len;
+    reader->compressed_left -= len;
+    reader->uncompressed_left -= len;
+    return len;
+  }
+
+  // Deflated data can only be skipped by inflating it.
+  uint8_t buf[4096];
+  uint32_t left = len;
+  while (left > 0) {
+    const int32_t result = ReadEntry(cookie, buf, left < sizeof(buf) ? left : sizeof(buf));
+    if (result < 0) {
+      return result;
+    }
+    left -= result;
+  }
+  return len;
+}
+
+void CloseEntryReader(void* cookie) {
+  delete reinterpret_cast<EntryReader*>(cookie);
+}
+
 const char* ErrorCodeString(int32_t error_code) {
   if (error_code > kErrorMessageLowerBound && error_code < kErrorMessageUpperBound) {
     return kErrorMessages[error_code * -1];
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures libziparchive on the archives given, or on two synthetic ones
+// written to $TMPDIR when none are:
+//
+//   resources  20000 small deflated entries, as in a resource heavy APK
+//   apk        a large deflated classes.dex, page aligned stored .so
+//              files and resources.arsc, and 2000 resources
+//
+// and reports, with the archive in the page cache:
+//
+//   open     OpenArchive() and CloseArchive(), -n times
+//   find     FindEntry() of every entry name and of as many missing
+//            names, in a random order, -n times
+//   extract  ExtractToMemory() of every stored and every deflated entry,
+//            reported separately by uncompressed size, -n times
+//
+//   ziparchive-benchmark [-m open,find,extract] [-n iterations] [archive...]
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ziparchive/zip_archive.h"
+
+static int iterations = 20;
+
+static double now_us() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static void check(int32_t result, const char* what) {
+  if (result != 0) {
+    fprintf(stderr, "%s failed: %s\n", what, ErrorCodeString(result));
+    exit(1);
+  }
+}
+
+// A minimal writer for the synthetic archives, there is none in the
+// library. Entries carry no data descriptors and the archive no comment.
+class ZipWriter {
+ public:
+  explicit ZipWriter(const std::string& path) : path_(path) {}
+
+  void Add(const std::string& name, const std::string& data, bool deflated,
+           uint32_t alignment) {
+    std::string compressed = deflated ? Deflate(data) : data;
+    uint32_t crc = crc32(0, reinterpret_cast<const Bytef*>(data.data()), data.size());
+    uint16_t method = deflated ? kCompressDeflated : kCompressStored;
+
+    // Stored entries are aligned with padding in the local extra field.
+    uint16_t padding = 0;
+    if (alignment > 1) {
+      size_t start = out_.size() + 30 + name.size();
+      padding = (alignment - start % alignment) % alignment;
+    }
+
+    std::string& cd = central_directory_;
+    Put32(&cd, 0x02014b50);
+    Put16(&cd, 20);
+    Put16(&cd, 20);
+    Put16(&cd, 0);
+    Put16(&cd, method);
+    Put32(&cd, 0);
+    Put32(&cd, crc);
+    Put32(&cd, compressed.size());
+    Put32(&cd, data.size());
+    Put16(&cd, name.size());
+    Put16(&cd, 0);
+    Put16(&cd, 0);
+    Put16(&cd, 0);
+    Put16(&cd, 0);
+    Put32(&cd, 0);
+    Put32(&cd, out_.size());
+    cd += name;
+    entries_++;
+
+    Put32(&out_, 0x04034b50);
+    Put16(&out_, 20);
+    Put16(&out_, 0);
+    Put16(&out_, method);
+    Put32(&out_, 0);
+    Put32(&out_, crc);
+    Put32(&out_, compressed.size());
+    Put32(&out_, data.size());
+    Put16(&out_, name.size());
+    Put16(&out_, padding);
+    out_ += name;
+    out_.append(padding, '\0');
+    out_ += compressed;
+  }
+
+  void Finish() {
+    uint32_t cd_offset = out_.size();
+    out_ += central_directory_;
+    Put32(&out_, 0x06054b50);
+    Put16(&out_, 0);
+    Put16(&out_, 0);
+    Put16(&out_, entries_);
+    Put16(&out_, entries_);
+    Put32(&out_, central_directory_.size());
+    Put32(&out_, cd_offset);
+    Put16(&out_, 0);
+
+    FILE* fp = fopen(path_.c_str(), "wb");
+    if (fp == NULL || fwrite(out_.data(), out_.size(), 1, fp) != 1 || fclose(fp) != 0) {
+      fprintf(stderr, "writing %s failed: %s\n", path_.c_str(), strerror(errno));
+      exit(1);
+    }
+  }
+
+ private:
+  static void Put16(std::string* s, uint16_t v) {
+    s->push_back(v & 0xff);
+    s->push_back(v >> 8);
+  }
+
+  static void Put32(std::string* s, uint32_t v) {
+    Put16(s, v & 0xffff);
+    Put16(s, v >> 16);
+  }
+
+  static std::string Deflate(const std::string& data) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+  }
+
+  std::string path_;
+  std::string out_;
+  std::string central_directory_;
+  uint16_t entries_ = 0;
+};
+
+// Words drawn from a small vocabulary, which deflates about as well as
+// dex files and resources do; incompressible bytes for native code would
+// make the deflated case meaningless.
+static std::string make_data(size_t len) {
+  static const char* const words[] = {
+    "android", "content", "layout", "drawable", "string", "Landroid/view/View;",
+    "Ljava/lang/Object;", "<init>", "onCreate", "\x12\x34\x00\x00", "\x6e\x10\x05",
+    "getResources", "width", "height", "0x7f0a00", "@style/Theme",
+  };
+  std::string s;
+  s.reserve(len + 32);
+  while (s.size() < len) {
+    s += words[random() % (sizeof(words) / sizeof(words[0]))];
+    s += static_cast<char>(random());
+  }
+  s.resize(len);
+  return s;
+}
+
+static std::string write_resources(const std::string& dir) {
+  std::string path = dir + "/ziparchive-benchmark-resources.zip";
+  ZipWriter writer(path);
+  char name[64];
+  for (int i = 0; i < 20000; i++) {
+    snprintf(name, sizeof(name), "res/drawable-xxhdpi-v4/ic_resource_%05d.png", i);
+    writer.Add(name, make_data(512 + random() % 4096), true, 0);
+  }
+  writer.Finish();
+  return path;
+}
+
+static std::string write_apk(const std::string& dir) {
+  std::string path = dir + "/ziparchive-benchmark-apk.zip";
+  ZipWriter writer(path);
+  char name[64];
+  writer.Add("AndroidManifest.xml", make_data(8192), true, 0);
+  writer.Add("classes.dex", make_data(16 * 1024 * 1024), true, 0);
+  writer.Add("resources.arsc", make_data(2 * 1024 * 1024), false, 4);
+  for (int i = 0; i < 4; i++) {
+    snprintf(name, sizeof(name), "lib/arm64-v8a/libnative%d.so", i);
+    writer.Add(name, make_data(4 * 1024 * 1024), false, 4096);
+  }
+  for (int i = 0; i < 2000; i++) {
+    snprintf(name, sizeof(name), "res/layout/activity_%04d.xml", i);
+    writer.Add(name, make_data(256 + random() % 8192), true, 0);
+  }
+  writer.Finish();
+  return path;
+}
+
+struct Entry {
+  std::string name;
+  ZipEntry entry;
+};
+
+static std::vector<Entry> list_entries(ZipArchiveHandle handle) {
+  std::vector<Entry> entries;
+  void* cookie;
+  check(StartIteration(handle, &cookie, NULL, NULL), "StartIteration");
+  Entry e;
+  ZipEntryName name;
+  int32_t result;
+  while ((result = Next(cookie, &e.entry, &name)) == 0) {
+    e.name.assign(reinterpret_cast<const char*>(name.name), name.name_length);
+    entries.push_back(e);
+  }
+  EndIteration(cookie);
+  if (result != -1) {
+    check(result, "Next");
+  }
+  return entries;
+}
+
+static void bench_open(const char* path) {
+  std::vector<double> times;
+  for (int i = 0; i < iterations; i++) {
+    ZipArchiveHandle handle;
+    double start = now_us();
+    check(OpenArchive(path, &handle), "OpenArchive");
+    CloseArchive(handle);
+    times.push_back(now_us() - start);
+  }
+  std::sort(times.begin(), times.end());
+  printf("  open: min %.1f us, median %.1f us\n", times.front(), times[times.size() / 2]);
+}
+
+static void bench_find(ZipArchiveHandle handle, const std::vector<Entry>& entries) {
+  std::vector<std::string> names;
+  for (const Entry& e : entries) {
+    names.push_back(e.name);
+    names.push_back(e.name + ".missing");
+  }
+  std::random_shuffle(names.begin(), names.end());
+
+  double start = now_us();
+  size_t found = 0;
+  for (int i = 0; i < iterations; i++) {
+    for (const std::string& name : names) {
+      ZipEntry entry;
+      if (FindEntry(handle, ZipEntryName(name.c_str()), &entry) == 0) {
+        found++;
+      }
+    }
+  }
+  double us = now_us() - start;
+  if (found != entries.size() * iterations) {
+    fprintf(stderr, "FindEntry found %zu of %zu entries\n", found, entries.size() * iterations);
+    exit(1);
+  }
+  printf("  find: %zu names, %.1f ns per lookup\n", names.size(),
+         us * 1000 / (names.size() * iterations));
+}
+
+static void bench_extract(ZipArchiveHandle handle, const std::vector<Entry>& entries,
+                          uint16_t method, const char* label) {
+  std::vector<uint8_t> buffer;
+  uint64_t bytes = 0;
+  size_t count = 0;
+  double start = now_us();
+  for (int i = 0; i < iterations; i++) {
+    for (const Entry& e : entries) {
+      if (e.entry.method != method) {
+        continue;
+      }
+      ZipEntry entry = e.entry;
+      buffer.resize(std::max<size_t>(buffer.size(), entry.uncompressed_length));
+      check(ExtractToMemory(handle, &entry, buffer.data(), entry.uncompressed_length),
+            "ExtractToMemory");
+      bytes += entry.uncompressed_length;
+      count++;
+    }
+  }
+  double us = now_us() - start;
+  if (count == 0) {
+    return;
+  }
+  printf("  extract %s: %zu entries, %.1f MiB in %.1f ms (%.1f MiB/s)\n", label,
+         count / iterations, bytes / 1048576.0, us / 1000, bytes / 1048576.0 / (us / 1e6));
+}
+
+static void bench(const char* path, bool open, bool find, bool extract) {
+  ZipArchiveHandle handle;
+  check(OpenArchive(path, &handle), "OpenArchive");
+  std::vector<Entry> entries = list_entries(handle);
+  printf("%s: %zu entries\n", path, entries.size());
+
+  if (open) {
+    bench_open(path);
+  }
+  if (find) {
+    bench_find(handle, entries);
+  }
+  if (extract) {
+    bench_extract(handle, entries, kCompressStored, "stored");
+    bench_extract(handle, entries, kCompressDeflated, "deflated");
+  }
+  CloseArchive(handle);
+}
+
+static void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-m open,find,extract] [-n iterations] [archive...]\n", name);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  std::string modes = "open,find,extract";
+  int c;
+  while ((c = getopt(argc, argv, "m:n:")) != -1) {
+    switch (c) {
+      case 'm': modes = optarg; break;
+      case 'n': iterations = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (iterations < 1) {
+    usage(argv[0]);
+  }
+  modes = "," + modes + ",";
+  bool open = modes.find(",open,") != std::string::npos;
+  bool find = modes.find(",find,") != std::string::npos;
+  bool extract = modes.find(",extract,") != std::string::npos;
+
+  std::vector<std::string> paths(argv + optind, argv + argc);
+  bool synthetic = paths.empty();
+  if (synthetic) {
+    const char* dir = getenv("TMPDIR");
+#if defined(__ANDROID__)
+    if (dir == NULL) dir = "/data/local/tmp";
+#else
+    if (dir == NULL) dir = "/tmp";
+#endif
+    srandom(1);
+    paths.push_back(write_resources(dir));
+    paths.push_back(write_apk(dir));
+  }
+
+  for (const std::string& path : paths) {
+    bench(path.c_str(), open, find, extract);
+  }
+
+  if (synthetic) {
+    for (const std::string& path : paths) {
+      unlink(path.c_str());
+    }
+  }
+  return 0;
+}
@@ -20,7 +20,9 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
 #include <vector>
 
 #include <base/file.h>
@@ -110,6 +112,67 @@ TEST(ziparchive, OpenDoNotAssumeFdOwnership) {
   close(fd);
 }
 
+static int CountEntries(ZipArchiveHandle handle) {
+  void* iteration_cookie;
+  if (StartIteration(handle, &iteration_cookie, NULL, NULL) != 0) {
+    return -1;
+  }
+  ZipEntry data;
+  ZipEntryName name;
+  int count = 0;
+  while (Next(iteration_cookie, &data, &name) == 0) {
+    count++;
+  }
+  EndIteration(iteration_cookie);
+  return count;
+}
+
+TEST(ziparchive, OpenWithIndex) {
+  char index_path[1024];
+  snprintf(index_path, sizeof(index_path), "/data/local/tmp/zip_archive_index_XXXXXX");
+  int fd = mkstemp(index_path);
+  if (fd == -1) {
+    snprintf(index_path, sizeof(index_path), "/tmp/zip_archive_index_XXXXXX");
+    fd = mkstemp(index_path);
+  }
+  ASSERT_NE(-1, fd);
+  close(fd);
+  const std::string zip_path = test_data_dir + "/" + kValidZip;
+
+  // An empty file is not an index; it's replaced by one. The second
+  // open maps that.
+  ZipEntryName a_name("a.txt");
+  ZipEntry data;
+  for (int i = 0; i < 2; i++) {
+    ZipArchiveHandle handle;
+    ASSERT_EQ(0, OpenArchiveWithIndex(zip_path.c_str(), index_path, &handle));
+    ASSERT_EQ(0, FindEntry(handle, a_name, &data));
+    ASSERT_EQ(static_cast<uint32_t>(sizeof(kATxtContents)), data.uncompressed_length);
+    ASSERT_EQ(5, CountEntries(handle));
+    CloseArchive(handle);
+  }
+
+  // A corrupt hash table, after the 64 byte header, must not take the
+  // archive down with it.
+  struct stat st;
+  ASSERT_EQ(0, stat(index_path, &st));
+  ASSERT_LT(64, st.st_size);
+  fd = open(index_path, O_WRONLY);
+  ASSERT_NE(-1, fd);
+  std::vector<uint8_t> garbage(st.st_size - 64, 0xff);
+  ASSERT_EQ(static_cast<ssize_t>(garbage.size()),
+            pwrite(fd, &garbage[0], garbage.size(), 64));
+  close(fd);
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWithIndex(zip_path.c_str(), index_path, &handle));
+  ASSERT_NE(0, FindEntry(handle, a_name, &data));
+  ASSERT_EQ(0, CountEntries(handle));
+  CloseArchive(handle);
+
+  unlink(index_path);
+}
+
 TEST(ziparchive, Iteration) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
@@ -120,26 +183,26 @@ TEST(ziparchive, Iteration) {
   ZipEntry data;
   ZipEntryName name;
 
-  // b/c.txt
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/c.txt", name);
-
-  // b/d.txt
+  // b.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/d.txt", name);
+  AssertNameEquals("b.txt", name);
 
   // a.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("a.txt", name);
 
-  // b.txt
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b.txt", name);
-
   // b/
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/", name);
 
+  // b/d.txt
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/d.txt", name);
+
+  // b/c.txt
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
+
   // End of iteration.
   ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
 
@@ -157,6 +220,11 @@ TEST(ziparchive, IterationWithPrefix) {
   ZipEntry data;
   ZipEntryName name;
 
+  // With a prefix, entries come in the order of their names.
+  // b/
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/", name);
+
   // b/c.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/c.txt", name);
@@ -165,10 +233,6 @@ TEST(ziparchive, IterationWithPrefix) {
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/d.txt", name);
 
-  // b/
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/", name);
-
   // End of iteration.
   ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
 
@@ -186,21 +250,21 @@ TEST(ziparchive, IterationWithSuffix) {
   ZipEntry data;
   ZipEntryName name;
 
-  // b/c.txt
-  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/c.txt", name);
-
-  // b/d.txt
+  // b.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b/d.txt", name);
+  AssertNameEquals("b.txt", name);
 
   // a.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("a.txt", name);
 
-  // b.txt
+  // b/d.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b.txt", name);
+  AssertNameEquals("b/d.txt", name);
+
+  // b/c.txt
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
 
   // End of iteration.
   ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
@@ -220,6 +284,10 @@ TEST(ziparchive, IterationWithPrefixAndSuffix) {
   ZipEntry data;
   ZipEntryName name;
 
+  // b.txt
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b.txt", name);
+
   // b/c.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/c.txt", name);
@@ -228,13 +296,34 @@ TEST(ziparchive, IterationWithPrefixAndSuffix) {
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
   AssertNameEquals("b/d.txt", name);
 
-  // b.txt
+  // End of iteration.
+  ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, IterationWithPrefixInside) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // A prefix that sorts between names, and matches only the one after.
+  void* iteration_cookie;
+  ZipEntryName prefix("b/c");
+  ASSERT_EQ(0, StartIteration(handle, &iteration_cookie, &prefix, NULL));
+
+  ZipEntry data;
+  ZipEntryName name;
+
+  // b/c.txt
   ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
-  AssertNameEquals("b.txt", name);
+  AssertNameEquals("b/c.txt", name);
 
-  // End of iteration.
+  // End of iteration, after which it starts over.
   ASSERT_EQ(-1, Next(iteration_cookie, &data, &name));
+  ASSERT_EQ(0, Next(iteration_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
 
+  EndIteration(iteration_cookie);
   CloseArchive(handle);
 }
 
@@ -330,6 +419,86 @@ TEST(ziparchive, ExtractToMemory) {
   CloseArchive(handle);
 }
 
+static std::vector<uint8_t> ReadInPieces(ZipArchiveHandle handle, ZipEntry* entry,
+                                         uint32_t piece) {
+  std::vector<uint8_t> contents;
+  void* reader;
+  if (OpenEntryReader(handle, entry, &reader) != 0) {
+    return contents;
+  }
+  std::vector<uint8_t> buf(piece);
+  int32_t n;
+  while ((n = ReadEntry(reader, &buf[0], piece)) > 0) {
+    contents.insert(contents.end(), buf.begin(), buf.begin() + n);
+  }
+  CloseEntryReader(reader);
+  return contents;
+}
+
+TEST(ziparchive, EntryReader) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // An entry that's deflated, then one that's stored.
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, ZipEntryName("a.txt"), &data));
+  std::vector<uint8_t> contents = ReadInPieces(handle, &data, 3);
+  ASSERT_EQ(std::vector<uint8_t>(kATxtContents, kATxtContents + sizeof(kATxtContents)),
+            contents);
+
+  ASSERT_EQ(0, FindEntry(handle, ZipEntryName("b.txt"), &data));
+  contents = ReadInPieces(handle, &data, 4);
+  ASSERT_EQ(std::vector<uint8_t>(kBTxtContents, kBTxtContents + sizeof(kBTxtContents)),
+            contents);
+
+  // Skipping part of each.
+  const char* names[] = { "a.txt", "b.txt" };
+  for (const char* name : names) {
+    ASSERT_EQ(0, FindEntry(handle, ZipEntryName(name), &data));
+    void* reader;
+    ASSERT_EQ(0, OpenEntryReader(handle, &data, &reader));
+    uint8_t buf[4];
+    ASSERT_EQ(2, SkipEntry(reader, 2));
+    ASSERT_EQ(4, ReadEntry(reader, buf, sizeof(buf)));
+    ASSERT_EQ(0, memcmp(buf, "cdef", 4));
+    ASSERT_EQ(static_cast<int32_t>(data.uncompressed_length - 6), SkipEntry(reader, 100));
+    ASSERT_EQ(0, ReadEntry(reader, buf, sizeof(buf)));
+    CloseEntryReader(reader);
+  }
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, MapStoredEntry) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // An entry that's stored.
+  ZipEntry data;
+  ZipEntryName b_name;
+  b_name.name = kBTxtName;
+  b_name.name_length = kBTxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, b_name, &data));
+  const uint8_t* ptr;
+  uint32_t size;
+  ASSERT_EQ(0, MapStoredEntry(handle, &data, 0, &ptr, &size));
+  ASSERT_EQ(sizeof(kBTxtContents), size);
+  ASSERT_EQ(0, memcmp(ptr, kBTxtContents, size));
+
+  // Its data starts at an odd offset.
+  ASSERT_EQ(1, data.offset % 2);
+  ASSERT_GT(0, MapStoredEntry(handle, &data, 4, &ptr, &size));
+
+  // An entry that's deflated.
+  ZipEntryName a_name;
+  a_name.name = kATxtName;
+  a_name.name_length = kATxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, a_name, &data));
+  ASSERT_GT(0, MapStoredEntry(handle, &data, 0, &ptr, &size));
+
+  CloseArchive(handle);
+}
+
 static const uint32_t kEmptyEntriesZip[] = {
       0x04034b50, 0x0000000a, 0x63600000, 0x00004438, 0x00000000, 0x00000000,
       0x00090000, 0x6d65001c, 0x2e797470, 0x55747874, 0x03000954, 0x52e25c13,
@@ -462,6 +631,9 @@ TEST(ziparchive, EntryLargerThan32K) {
   ASSERT_TRUE(android::base::ReadFully(output_fd, &file_contents[0], file_contents.size()));
   ASSERT_EQ(file_contents, buffer);
 
+  // Read it in pieces that don't line up with the inflate buffers.
+  ASSERT_EQ(buffer, ReadInPieces(handle, &entry, 5000));
+
   for (int i = 0; i < 90072; ++i) {
     const uint8_t* line = &file_contents[0] + (3 * i);
     ASSERT_EQ('a', line[0]);
@@ -473,6 +645,37 @@ TEST(ziparchive, EntryLargerThan32K) {
   close(output_fd);
 }
 
+TEST(ziparchive, ExtractWithBadCrc) {
+  std::vector<uint8_t> zip(reinterpret_cast<const uint8_t*>(kAbZip),
+                           reinterpret_cast<const uint8_t*>(kAbZip) + sizeof(kAbZip) - 1);
+  // The crc of ab.txt is in both its local header and the central directory.
+  static const uint8_t kCrc[] = { 0xb0, 0xc4, 0xda, 0x2c };
+  int changed = 0;
+  for (auto it = zip.begin();
+       (it = std::search(it, zip.end(), kCrc, kCrc + sizeof(kCrc))) != zip.end(); ++it) {
+    *it ^= 1;
+    changed++;
+  }
+  ASSERT_EQ(2, changed);
+
+  char temp_file_pattern[] = "extract_with_bad_crc_test_XXXXXX";
+  int fd = make_temporary_file(temp_file_pattern);
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(android::base::WriteFully(fd, &zip[0], zip.size()));
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd, "ExtractWithBadCrcTest", &handle));
+
+  ZipEntry entry;
+  ZipEntryName ab_name;
+  ab_name.name = kAbTxtName;
+  ab_name.name_length = kAbTxtNameLength;
+  ASSERT_EQ(0, FindEntry(handle, ab_name, &entry));
+  std::vector<uint8_t> buffer(kAbUncompressedSize);
+  ASSERT_GT(0, ExtractToMemory(handle, &entry, &buffer[0], buffer.size()));
+
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, TrailerAfterEOCD) {
   char temp_file_pattern[] = "trailer_after_eocd_test_XXXXXX";
   int fd = make_temporary_file(temp_file_pattern);
@@ -530,6 +733,41 @@ TEST(ziparchive, ExtractToFile) {
   close(fd);
 }
 
+TEST(ziparchive, ExtractEntriesToFiles) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // The deflated entries are a.txt and b/c.txt, the stored ones b.txt
+  // and b/d.txt. Each is extracted a few times over, to keep all the
+  // threads busy.
+  static const char* kNames[] = { "a.txt", "b.txt", "b/c.txt", "b/d.txt" };
+  static const size_t kCount = 16;
+  ZipEntry entries[kCount];
+  ZipEntryExtraction extractions[kCount];
+  for (size_t i = 0; i < kCount; i++) {
+    ASSERT_EQ(0, FindEntry(handle, ZipEntryName(kNames[i % 4]), &entries[i]));
+    char temp_file_pattern[] = "extract_entries_test_XXXXXX";
+    extractions[i].entry = &entries[i];
+    extractions[i].fd = make_temporary_file(temp_file_pattern);
+    ASSERT_NE(-1, extractions[i].fd);
+  }
+
+  ASSERT_EQ(0, ExtractEntriesToFiles(handle, extractions, kCount, 4));
+
+  for (size_t i = 0; i < kCount; i++) {
+    ASSERT_EQ(0, extractions[i].result);
+    const uint8_t* expected = (i % 2 == 0) ? kATxtContents : kBTxtContents;
+    const size_t expected_size = (i % 2 == 0) ? sizeof(kATxtContents) : sizeof(kBTxtContents);
+    std::vector<uint8_t> contents(expected_size + 1);
+    ASSERT_EQ(static_cast<ssize_t>(expected_size),
+              pread(extractions[i].fd, &contents[0], contents.size(), 0));
+    ASSERT_EQ(0, memcmp(&contents[0], expected, expected_size));
+    close(extractions[i].fd);
+  }
+
+  CloseArchive(handle);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
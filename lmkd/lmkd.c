@@ -18,6 +18,7 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,11 +27,13 @@
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <cutils/procfs.h>
 #include <cutils/sockets.h>
 #include <log/log.h>
 #include <processgroup/processgroup.h>
@@ -53,6 +56,7 @@ enum lmk_cmd {
     LMK_TARGET,
     LMK_PROCPRIO,
     LMK_PROCREMOVE,
+    LMK_GETSTATS,
 };
 
 #define MAX_TARGETS 6
@@ -62,6 +66,42 @@ enum lmk_cmd {
  */
 #define CTRL_PACKET_MAX (sizeof(int) * (MAX_TARGETS * 2 + 1))
 
+/*
+ * One record per memory pressure event that led to a kill, kept in a ring of
+ * the last STATS_MAX events and returned by LMK_GETSTATS.
+ */
+enum vmpressure_level {
+    VMPRESS_LEVEL_LOW,
+    VMPRESS_LEVEL_MEDIUM,
+    VMPRESS_LEVEL_CRITICAL,
+};
+
+struct event_stat {
+    int64_t time_ms;      /* CLOCK_MONOTONIC when the event was read */
+    int level;            /* enum vmpressure_level */
+    int evcount;          /* notifications coalesced into the event */
+    int scan_us;          /* from the event to the first kill() */
+    int kill_us;          /* spent in kill() and killProcessGroup() */
+    int kills;
+    int killed_kb;        /* resident size of the processes killed */
+    int reclaimed_kb;     /* growth of free and cached memory, -1 until measured */
+    int clear_ms;         /* until an event found nothing to kill, -1 until then */
+};
+
+#define STATS_MAX 64
+static struct event_stat event_stats[STATS_MAX];
+static int event_stats_next;
+static int event_stats_count;
+/* Free plus cached pages when the events still being measured started. */
+static int stats_pending_pages[STATS_MAX];
+
+/*
+ * LMK_GETSTATS reply: the command, the record count, then the fields of each
+ * record in order, oldest first.  time_ms is truncated to 32 bits.
+ */
+#define STATS_FIELDS 9
+#define STATS_PACKET_MAX (sizeof(int) * (2 + STATS_MAX * STATS_FIELDS))
+
 /* default to old in-kernel interface if no memory pressure events */
 static int use_inkernel_interface = 1;
 
@@ -108,6 +148,13 @@ struct proc {
     int pid;
     uid_t uid;
     int oomadj;
+    /*
+     * Opened and read when the process is registered, so that killing it
+     * takes no open or cmdline read.  The statm fd keeps referring to this
+     * process even if its pid is reused.
+     */
+    int statm_fd;
+    char *taskname;
     struct proc *pidhash_next;
 };
 
@@ -129,24 +176,12 @@ static time_t kill_lasttime;
 /* PAGE_SIZE / 1024 */
 static long page_k;
 
-static ssize_t read_all(int fd, char *buf, size_t max_len)
+static int64_t get_time_us(void)
 {
-    ssize_t ret = 0;
-
-    while (max_len > 0) {
-        ssize_t r = read(fd, buf, max_len);
-        if (r == 0) {
-            break;
-        }
-        if (r == -1) {
-            return -1;
-        }
-        ret += r;
-        buf += r;
-        max_len -= r;
-    }
+    struct timespec ts;
 
-    return ret;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 static int lowmem_oom_adj_to_oom_score_adj(int oom_adj)
@@ -184,12 +219,6 @@ static void adjslot_remove(struct adjslot_list *old)
     prev->next = next;
 }
 
-static struct adjslot_list *adjslot_tail(struct adjslot_list *head) {
-    struct adjslot_list *asl = head->prev;
-
-    return asl == head ? NULL : asl;
-}
-
 static void proc_slot(struct proc *procp) {
     int adjslot = ADJTOSLOT(procp->oomadj);
 
@@ -226,6 +255,9 @@ static int pid_remove(int pid) {
         prevp->pidhash_next = procp->pidhash_next;
 
     proc_unslot(procp);
+    if (procp->statm_fd != -1)
+        close(procp->statm_fd);
+    free(procp->taskname);
     free(procp);
     return 0;
 }
@@ -250,6 +282,31 @@ static void writefilestring(char *path, char *s) {
     close(fd);
 }
 
+static char *proc_read_name(int pid, char *line, size_t size) {
+    char *cp;
+
+    if (procfs_read(pid, 0, "cmdline", line, size) < 0)
+        return NULL;
+
+    cp = strchr(line, ' ');
+    if (cp)
+        *cp = '\0';
+
+    return line;
+}
+
+static void proc_open_files(struct proc *procp) {
+    char path[PATH_MAX];
+    char line[LINE_MAX];
+
+    snprintf(path, PATH_MAX, "/proc/%d/statm", procp->pid);
+    procp->statm_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    procp->taskname = NULL;
+    if (proc_read_name(procp->pid, line, sizeof(line)) && line[0])
+        procp->taskname = strdup(line);
+}
+
 static void cmd_procprio(int pid, int uid, int oomadj) {
     struct proc *procp;
     char path[80];
@@ -278,6 +335,7 @@ static void cmd_procprio(int pid, int uid, int oomadj) {
             procp->pid = pid;
             procp->uid = uid;
             procp->oomadj = oomadj;
+            proc_open_files(procp);
             proc_insert(procp);
     } else {
         proc_unslot(procp);
@@ -508,6 +566,32 @@ static int ctrl_data_read(char *buf, size_t bufsz) {
     return ret;
 }
 
+static void cmd_getstats(void) {
+    int obuf[STATS_PACKET_MAX / sizeof(int)];
+    int n = 0;
+    int i;
+
+    obuf[n++] = htonl(LMK_GETSTATS);
+    obuf[n++] = htonl(event_stats_count);
+    for (i = 0; i < event_stats_count; i++) {
+        struct event_stat *st =
+                &event_stats[(event_stats_next - event_stats_count + i + STATS_MAX) % STATS_MAX];
+
+        obuf[n++] = htonl((int)st->time_ms);
+        obuf[n++] = htonl(st->level);
+        obuf[n++] = htonl(st->evcount);
+        obuf[n++] = htonl(st->scan_us);
+        obuf[n++] = htonl(st->kill_us);
+        obuf[n++] = htonl(st->kills);
+        obuf[n++] = htonl(st->killed_kb);
+        obuf[n++] = htonl(st->reclaimed_kb);
+        obuf[n++] = htonl(st->clear_ms);
+    }
+
+    if (TEMP_FAILURE_RETRY(write(ctrl_dfd, obuf, n * sizeof(int))) == -1)
+        ALOGE("control data socket write failed; errno=%d", errno);
+}
+
 static void ctrl_command_handler(void) {
     int ibuf[CTRL_PACKET_MAX / sizeof(int)];
     int len;
@@ -542,6 +626,11 @@ static void ctrl_command_handler(void) {
             goto wronglen;
         cmd_procremove(ntohl(ibuf[1]));
         break;
+    case LMK_GETSTATS:
+        if (nargs != 0)
+            goto wronglen;
+        cmd_getstats();
+        break;
     default:
         ALOGE("Received unknown command code %d", cmd);
         return;
@@ -632,7 +721,8 @@ static void zoneinfo_parse_line(char *line, struct sysmeminfo *mip) {
 }
 
 static int zoneinfo_parse(struct sysmeminfo *mip) {
-    int fd;
+    /* Kept open, since it is read on every memory pressure event. */
+    static int fd = -1;
     ssize_t size;
     char buf[PAGE_SIZE];
     char *save_ptr;
@@ -640,97 +730,119 @@ static int zoneinfo_parse(struct sysmeminfo *mip) {
 
     memset(mip, 0, sizeof(struct sysmeminfo));
 
-    fd = open(ZONEINFO_PATH, O_RDONLY);
     if (fd == -1) {
-        ALOGE("%s open: errno=%d", ZONEINFO_PATH, errno);
-        return -1;
+        fd = open(ZONEINFO_PATH, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            ALOGE("%s open: errno=%d", ZONEINFO_PATH, errno);
+            return -1;
+        }
     }
 
-    size = read_all(fd, buf, sizeof(buf) - 1);
+    size = procfs_pread(fd, buf, sizeof(buf));
     if (size < 0) {
         ALOGE("%s read: errno=%d", ZONEINFO_PATH, errno);
         close(fd);
+        fd = -1;
         return -1;
     }
     ALOG_ASSERT((size_t)size < sizeof(buf) - 1, "/proc/zoneinfo too large");
-    buf[size] = 0;
 
     for (line = strtok_r(buf, "\n", &save_ptr); line; line = strtok_r(NULL, "\n", &save_ptr))
             zoneinfo_parse_line(line, mip);
 
-    close(fd);
     return 0;
 }
 
-static int proc_get_size(int pid) {
-    char path[PATH_MAX];
+/* Returns the resident size of the process in pages, 0 once it has exited. */
+static int proc_get_size(struct proc *procp) {
     char line[LINE_MAX];
-    int fd;
-    int rss = 0;
-    int total;
+    int fd = procp->statm_fd;
+    uint64_t total, rss;
     ssize_t ret;
 
-    snprintf(path, PATH_MAX, "/proc/%d/statm", pid);
-    fd = open(path, O_RDONLY);
     if (fd == -1)
-        return -1;
-
-    ret = read_all(fd, line, sizeof(line) - 1);
-    if (ret < 0) {
-        close(fd);
+        ret = procfs_read(procp->pid, 0, "statm", line, sizeof(line));
+    else
+        ret = procfs_pread(fd, line, sizeof(line));
+    if (ret < 0 || procfs_parse_statm(line, &total, &rss) < 0) {
         return -1;
     }
-
-    sscanf(line, "%d %d ", &total, &rss);
-    close(fd);
     return rss;
 }
 
-static char *proc_get_name(int pid) {
-    char path[PATH_MAX];
+static char *proc_get_name(struct proc *procp) {
     static char line[LINE_MAX];
-    int fd;
-    char *cp;
-    ssize_t ret;
 
-    snprintf(path, PATH_MAX, "/proc/%d/cmdline", pid);
-    fd = open(path, O_RDONLY);
-    if (fd == -1)
-        return NULL;
-    ret = read_all(fd, line, sizeof(line) - 1);
-    close(fd);
-    if (ret < 0) {
-        return NULL;
-    }
+    if (procp->taskname)
+        return procp->taskname;
+    return proc_read_name(procp->pid, line, sizeof(line));
+}
 
-    cp = strchr(line, ' ');
-    if (cp)
-        *cp = '\0';
+/* Returns the swapped out size of the process in kB, 0 if unknown. */
+static int proc_get_swap(struct proc *procp) {
+    char buf[1024];
+    const char *swap;
 
-    return line;
+    if (procfs_read(procp->pid, 0, "status", buf, sizeof(buf)) < 0)
+        return 0;
+    swap = procfs_status_value(buf, "VmSwap");
+    return swap ? atoi(swap) : 0;
 }
 
-static struct proc *proc_adj_lru(int oomadj) {
-    return (struct proc *)adjslot_tail(&procadjslot_list[ADJTOSLOT(oomadj)]);
+/*
+ * All processes at one oom_adj cost the user about the same to lose, so pick
+ * the one that frees the most memory, resident or swapped, among the
+ * VICTIM_SCAN_MAX least recently used.  Ties go to the least recently used.
+ * This takes fewer kills to get back above the minfree target than always
+ * killing the least recently used, which is often a small process.
+ */
+#define VICTIM_SCAN_MAX 8
+
+static struct proc *proc_adj_victim(int oomadj) {
+    struct adjslot_list *head = &procadjslot_list[ADJTOSLOT(oomadj)];
+    struct adjslot_list *asl;
+    struct proc *best = NULL;
+    long best_kb = -1;
+    int scanned = 0;
+
+    for (asl = head->prev; asl != head && scanned < VICTIM_SCAN_MAX; asl = asl->prev) {
+        struct proc *procp = (struct proc *)asl;
+        int rss = proc_get_size(procp);
+        long kb;
+
+        /* Gone already; let kill_one_process drop it. */
+        if (rss <= 0)
+            return procp;
+
+        kb = rss * page_k + proc_get_swap(procp);
+        if (kb > best_kb) {
+            best = procp;
+            best_kb = kb;
+        }
+        scanned++;
+    }
+
+    return best;
 }
 
 /* Kill one process specified by procp.  Returns the size of the process killed */
 static int kill_one_process(struct proc *procp, int other_free, int other_file,
-        int minfree, int min_score_adj, bool first)
+        int minfree, int min_score_adj, bool first, struct event_stat *st)
 {
+    int64_t start;
     int pid = procp->pid;
     uid_t uid = procp->uid;
     char *taskname;
     int tasksize;
     int r;
 
-    taskname = proc_get_name(pid);
+    taskname = proc_get_name(procp);
     if (!taskname) {
         pid_remove(pid);
         return -1;
     }
 
-    tasksize = proc_get_size(pid);
+    tasksize = proc_get_size(procp);
     if (tasksize <= 0) {
         pid_remove(pid);
         return -1;
@@ -742,14 +854,20 @@ static int kill_one_process(struct proc *procp, int other_free, int other_file,
           taskname, pid, uid, procp->oomadj, tasksize * page_k,
           first ? "" : "~", other_file * page_k, minfree * page_k, min_score_adj,
           first ? "" : "~", other_free * page_k, other_free >= 0 ? "above" : "below");
+    start = get_time_us();
+    if (!st->kills)
+        st->scan_us = start - st->time_ms * 1000;
     r = kill(pid, SIGKILL);
     killProcessGroup(uid, pid, SIGKILL);
+    st->kill_us += get_time_us() - start;
     pid_remove(pid);
 
     if (r) {
-        ALOGE("kill(%d): errno=%d", procp->pid, errno);
+        ALOGE("kill(%d): errno=%d", pid, errno);
         return -1;
     } else {
+        st->kills++;
+        st->killed_kb += tasksize * page_k;
         return tasksize;
     }
 }
@@ -758,7 +876,8 @@ static int kill_one_process(struct proc *procp, int other_free, int other_file,
  * Find a process to kill based on the current (possibly estimated) free memory
  * and cached memory sizes.  Returns the size of the killed processes.
  */
-static int find_and_kill_process(int other_free, int other_file, bool first)
+static int find_and_kill_process(int other_free, int other_file, bool first,
+        struct event_stat *st)
 {
     int i;
     int min_score_adj = OOM_ADJUST_MAX + 1;
@@ -780,10 +899,11 @@ static int find_and_kill_process(int other_free, int other_file, bool first)
         struct proc *procp;
 
 retry:
-        procp = proc_adj_lru(i);
+        procp = proc_adj_victim(i);
 
         if (procp) {
-            killed_size = kill_one_process(procp, other_free, other_file, minfree, min_score_adj, first);
+            killed_size = kill_one_process(procp, other_free, other_file, minfree, min_score_adj,
+                    first, st);
             if (killed_size < 0) {
                 goto retry;
             } else {
@@ -795,39 +915,81 @@ retry:
     return 0;
 }
 
+/*
+ * Completes the records of earlier events with what their kills freed, given
+ * the free and cached pages now, and with how long pressure lasted if this
+ * event found nothing to kill.
+ */
+static void stats_update(struct event_stat *st, int pages, bool cleared)
+{
+    int i;
+
+    for (i = 0; i < event_stats_count; i++) {
+        int slot = (event_stats_next - 1 - i + STATS_MAX) % STATS_MAX;
+        struct event_stat *prev = &event_stats[slot];
+
+        if (prev->reclaimed_kb == -1)
+            prev->reclaimed_kb = (pages - stats_pending_pages[slot]) * page_k;
+        if (cleared && prev->clear_ms == -1)
+            prev->clear_ms = st->time_ms - prev->time_ms;
+    }
+}
+
+static void stats_add(struct event_stat *st, int pages)
+{
+    stats_pending_pages[event_stats_next] = pages;
+    event_stats[event_stats_next] = *st;
+    event_stats_next = (event_stats_next + 1) % STATS_MAX;
+    if (event_stats_count < STATS_MAX)
+        event_stats_count++;
+}
+
 static void mp_event(uint32_t events __unused) {
     int ret;
     unsigned long long evcount;
     struct sysmeminfo mi;
+    struct event_stat st;
     int other_free;
     int other_file;
     int killed_size;
     bool first = true;
 
+    memset(&st, 0, sizeof(st));
+    st.time_ms = get_time_us() / 1000;
+    st.level = VMPRESS_LEVEL_MEDIUM;
+    st.reclaimed_kb = -1;
+    st.clear_ms = -1;
+
     ret = read(mpevfd, &evcount, sizeof(evcount));
     if (ret < 0)
         ALOGE("Error reading memory pressure event fd; errno=%d",
               errno);
+    else
+        st.evcount = evcount;
 
     if (time(NULL) - kill_lasttime < KILL_TIMEOUT)
         return;
 
     while (zoneinfo_parse(&mi) < 0) {
         // Failed to read /proc/zoneinfo, assume ENOMEM and kill something
-        find_and_kill_process(0, 0, true);
+        find_and_kill_process(0, 0, true, &st);
     }
 
     other_free = mi.nr_free_pages - mi.totalreserve_pages;
     other_file = mi.nr_file_pages - mi.nr_shmem;
 
     do {
-        killed_size = find_and_kill_process(other_free, other_file, first);
+        killed_size = find_and_kill_process(other_free, other_file, first, &st);
         if (killed_size > 0) {
             first = false;
             other_free += killed_size;
             other_file += killed_size;
         }
     } while (killed_size > 0);
+
+    stats_update(&st, mi.nr_free_pages + mi.nr_file_pages, !st.kills);
+    if (st.kills)
+        stats_add(&st, mi.nr_free_pages + mi.nr_file_pages);
 }
 
 static int init_mp(char *levelstr, void *event_handler)
@@ -893,9 +1055,16 @@ err_open_mpfd:
 
 static int init(void) {
     struct epoll_event epev;
+    struct rlimit rl;
     int i;
     int ret;
 
+    /* Each tracked process keeps an fd open. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
     page_k = sysconf(_SC_PAGESIZE);
     if (page_k == -1)
         page_k = PAGE_SIZE;
@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -35,6 +36,7 @@
 #include <log/logger.h>
 #include <log/logprint.h>
 #include <utils/threads.h>
+#include <zlib.h>
 
 #define DEFAULT_MAX_ROTATED_LOGS 4
 
@@ -75,6 +77,33 @@ static int g_outFD = -1;
 static size_t g_outByteCount = 0;
 static int g_printBinary = 0;
 static int g_devCount = 0;                              // >1 means multiple
+static bool g_compressRotated = false;
+
+// Asynchronous output, -A: the read loop formats lines into blocks and
+// hands them to a writer thread, which writes, rotates and compresses the
+// logs. Slow storage then stalls the writer, not the reads from logd.
+static const size_t ASYNC_BLOCK_SIZE = 64 * 1024;
+static const size_t ASYNC_BLOCKS = 8;   // bound on the blocks in flight
+
+struct async_block_t {
+    size_t len;
+    bool rotate;    // the log is to be rotated after this block
+    char data[ASYNC_BLOCK_SIZE];
+};
+
+static bool g_asyncOutput = false;
+static async_block_t *g_asyncBlocks;
+static pthread_t g_asyncThread;
+static pthread_mutex_t g_asyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_asyncCond = PTHREAD_COND_INITIALIZER;
+// g_asyncQueued blocks from g_asyncHead are the writer's, the one after
+// them is being filled by the read loop
+static size_t g_asyncHead = 0;
+static size_t g_asyncQueued = 0;
+static bool g_asyncDone = false;
+static async_block_t *g_asyncCurrent;
+// g_outByteCount belongs to the writer, the read loop keeps its own
+static size_t g_asyncByteCount = 0;
 
 __noreturn static void logcat_panic(bool showHelp, const char *fmt, ...) __printflike(2,3);
 
@@ -83,6 +112,48 @@ static int openLogFile (const char *pathname)
     return open(pathname, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
 }
 
+// Streams file into file.gz, removing file once that is complete
+static void compressLog(const char *file)
+{
+    char *gzName;
+    asprintf(&gzName, "%s.gz", file);
+    if (!gzName) {
+        perror("while compressing log file");
+        return;
+    }
+
+    int fd = open(file, O_RDONLY);
+    gzFile gz = (fd < 0) ? NULL : gzopen(gzName, "wb");
+    bool ok = gz != NULL;
+    if (ok) {
+        char buf[ASYNC_BLOCK_SIZE];
+        ssize_t len;
+        while ((len = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)))) > 0) {
+            if (gzwrite(gz, buf, len) != len) {
+                ok = false;
+                break;
+            }
+        }
+        if (len < 0) {
+            ok = false;
+        }
+        if (gzclose(gz) != Z_OK) {
+            ok = false;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (ok) {
+        unlink(file);
+    } else {
+        fprintf(stderr, "failed to compress %s\n", file);
+        unlink(gzName);
+    }
+    free(gzName);
+}
+
 static void rotateLogs()
 {
     int err;
@@ -99,15 +170,20 @@ static void rotateLogs()
     int maxRotationCountDigits =
             (g_maxRotatedLogs > 0) ? (int) (floor(log10(g_maxRotatedLogs) + 1)) : 0;
 
+    // Rotated logs keep their .gz suffix as they age
+    const char *suffix = g_compressRotated ? ".gz" : "";
+
     for (int i = g_maxRotatedLogs ; i > 0 ; i--) {
         char *file0, *file1;
 
-        asprintf(&file1, "%s.%.*d", g_outputFileName, maxRotationCountDigits, i);
+        asprintf(&file1, "%s.%.*d%s", g_outputFileName, maxRotationCountDigits, i,
+                 (i - 1 == 0) ? "" : suffix);
 
         if (i - 1 == 0) {
             asprintf(&file0, "%s", g_outputFileName);
         } else {
-            asprintf(&file0, "%s.%.*d", g_outputFileName, maxRotationCountDigits, i - 1);
+            asprintf(&file0, "%s.%.*d%s", g_outputFileName, maxRotationCountDigits, i - 1,
+                     suffix);
         }
 
         if (!file0 || !file1) {
@@ -133,13 +209,151 @@ static void rotateLogs()
 
     g_outByteCount = 0;
 
+    if (g_compressRotated && (g_maxRotatedLogs > 0)) {
+        char *file;
+        asprintf(&file, "%s.%.*d", g_outputFileName, maxRotationCountDigits, 1);
+        if (file) {
+            compressLog(file);
+            free(file);
+        }
+    }
+}
+
+static void asyncWriteLog(const async_block_t *block)
+{
+    for (size_t written = 0; written < block->len; ) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(g_outFD, block->data + written,
+                                               block->len - written));
+        if (ret <= 0) {
+            fprintf(stderr, "+++ LOG: write failed (errno=%d)\n", errno);
+            break;
+        }
+        written += ret;
+    }
+    g_outByteCount += block->len;
+
+    if (block->rotate) {
+        rotateLogs();
+    }
+}
+
+static void *asyncWriter(void *)
+{
+    pthread_mutex_lock(&g_asyncLock);
+    for (;;) {
+        while (!g_asyncQueued && !g_asyncDone) {
+            pthread_cond_wait(&g_asyncCond, &g_asyncLock);
+        }
+        if (!g_asyncQueued) {
+            break;
+        }
+        async_block_t *block = &g_asyncBlocks[g_asyncHead];
+        pthread_mutex_unlock(&g_asyncLock);
+
+        asyncWriteLog(block);
+
+        pthread_mutex_lock(&g_asyncLock);
+        g_asyncHead = (g_asyncHead + 1) % ASYNC_BLOCKS;
+        --g_asyncQueued;
+        pthread_cond_broadcast(&g_asyncCond);
+    }
+    pthread_mutex_unlock(&g_asyncLock);
+    return NULL;
+}
+
+// Hands the block being filled to the writer, waiting for a free one if
+// the writer is that far behind
+static void asyncFlush(bool rotate = false)
+{
+    if (!g_asyncCurrent->len && !rotate) {
+        return;
+    }
+    g_asyncCurrent->rotate = rotate;
+    pthread_mutex_lock(&g_asyncLock);
+    ++g_asyncQueued;
+    pthread_cond_broadcast(&g_asyncCond);
+    while (g_asyncQueued == ASYNC_BLOCKS) {
+        pthread_cond_wait(&g_asyncCond, &g_asyncLock);
+    }
+    g_asyncCurrent = &g_asyncBlocks[(g_asyncHead + g_asyncQueued) % ASYNC_BLOCKS];
+    pthread_mutex_unlock(&g_asyncLock);
+    g_asyncCurrent->len = 0;
+}
+
+static void asyncWrite(const char *buf, size_t len)
+{
+    while (len) {
+        size_t n = ASYNC_BLOCK_SIZE - g_asyncCurrent->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(g_asyncCurrent->data + g_asyncCurrent->len, buf, n);
+        g_asyncCurrent->len += n;
+        buf += n;
+        len -= n;
+        if (g_asyncCurrent->len == ASYNC_BLOCK_SIZE) {
+            asyncFlush();
+        }
+    }
+}
+
+// Lets the writer drain what is left and finish, also run at exit
+static void asyncFinish()
+{
+    if (!g_asyncOutput || pthread_equal(pthread_self(), g_asyncThread)) {
+        return;
+    }
+    asyncFlush();
+    pthread_mutex_lock(&g_asyncLock);
+    g_asyncDone = true;
+    pthread_cond_broadcast(&g_asyncCond);
+    pthread_mutex_unlock(&g_asyncLock);
+    pthread_join(g_asyncThread, NULL);
+    g_asyncOutput = false;
+}
+
+static void asyncStart()
+{
+    g_asyncBlocks = new async_block_t[ASYNC_BLOCKS];
+    g_asyncCurrent = &g_asyncBlocks[0];
+    g_asyncCurrent->len = 0;
+    g_asyncByteCount = g_outByteCount;
+    if (pthread_create(&g_asyncThread, NULL, asyncWriter, NULL)) {
+        logcat_panic(false, "couldn't start output thread\n");
+    }
+    atexit(asyncFinish);
+}
+
+// Binary output, -B: records are copied out as logd sent them, many to a
+// write. logd has already merged the buffers in time order.
+static const size_t BINARY_BUFFER_SIZE = 256 * 1024;
+static char g_binaryBuf[BINARY_BUFFER_SIZE];
+static size_t g_binaryLen = 0;
+
+static void flushBinary()
+{
+    size_t done = 0;
+
+    while (done < g_binaryLen) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(g_outFD, g_binaryBuf + done,
+                                               g_binaryLen - done));
+        if (ret <= 0) {
+            break;
+        }
+        done += ret;
+    }
+    g_binaryLen = 0;
 }
 
 void printBinary(struct log_msg *buf)
 {
     size_t size = buf->len();
 
-    TEMP_FAILURE_RETRY(write(g_outFD, buf, size));
+    if (g_binaryLen + size > sizeof(g_binaryBuf)) {
+        flushBinary();
+    }
+    memcpy(g_binaryBuf + g_binaryLen, buf, size);
+    g_binaryLen += size;
 }
 
 static void processBuffer(log_device_t* dev, struct log_msg *buf)
@@ -170,6 +384,39 @@ static void processBuffer(log_device_t* dev, struct log_msg *buf)
         goto error;
     }
 
+    if (g_asyncOutput) {
+        if (android_log_shouldPrintLine(g_logformat, entry.tag, entry.priority)) {
+            // Straight into the block when it fits
+            char *space = g_asyncCurrent->data + g_asyncCurrent->len;
+            size_t len;
+            char *line = android_log_formatLogLine(g_logformat, space,
+                                                   ASYNC_BLOCK_SIZE - g_asyncCurrent->len,
+                                                   &entry, &len);
+            if (!line) {
+                logcat_panic(false, "output error");
+            }
+            if (line == space) {
+                g_asyncCurrent->len += len;
+                if (g_asyncCurrent->len == ASYNC_BLOCK_SIZE) {
+                    asyncFlush();
+                }
+            } else {
+                asyncWrite(line, len);
+                free(line);
+            }
+            g_asyncByteCount += len;
+        }
+
+        // The writer rotates once it has written up to here
+        if (g_logRotateSizeKBytes > 0
+            && (g_asyncByteCount / 1024) >= g_logRotateSizeKBytes
+        ) {
+            g_asyncByteCount = 0;
+            asyncFlush(true);
+        }
+        return;
+    }
+
     if (android_log_shouldPrintLine(g_logformat, entry.tag, entry.priority)) {
         bytesWritten = android_log_printLogLine(g_logformat, g_outFD, &entry);
 
@@ -198,7 +445,9 @@ static void maybePrintStart(log_device_t* dev, bool printDividers) {
             snprintf(buf, sizeof(buf), "--------- %s %s\n",
                      dev->printed ? "switch to" : "beginning of",
                      dev->device);
-            if (write(g_outFD, buf, strlen(buf)) < 0) {
+            if (g_asyncOutput) {
+                asyncWrite(buf, strlen(buf));
+            } else if (write(g_outFD, buf, strlen(buf)) < 0) {
                 logcat_panic(false, "output error");
             }
         }
@@ -246,6 +495,10 @@ static void setupOutput()
 
         g_outByteCount = statbuf.st_size;
     }
+
+    if (g_asyncOutput) {
+        asyncStart();
+    }
 }
 
 static void show_help(const char *cmd)
@@ -258,6 +511,8 @@ static void show_help(const char *cmd)
                     "  -f <filename>   Log to file. Default is stdout\n"
                     "  -r <kbytes>     Rotate log every kbytes. Requires -f\n"
                     "  -n <count>      Sets max number of rotated logs to <count>, default 4\n"
+                    "  -A              Write and rotate the log on a background thread\n"
+                    "  -z              Compress rotated logs with gzip, implies -A. Requires -r\n"
                     "  -v <format>     Sets the log print format, where <format> is:\n\n"
                     "                      brief color long printable process raw tag thread\n"
                     "                      threadtime time usec\n\n"
@@ -411,6 +666,11 @@ static log_time lastLogTime(char *outputFileName) {
                         || !isdigit(dp->d_name[len+1])))) {
             continue;
         }
+        // Compressed logs are older than the plain ones
+        const char *gz = strrchr(dp->d_name, '.');
+        if (gz && !strcmp(gz, ".gz")) {
+            continue;
+        }
 
         std::string file_name = directory;
         file_name += "/";
@@ -492,7 +752,7 @@ int main(int argc, char **argv)
     for (;;) {
         int ret;
 
-        ret = getopt(argc, argv, ":cdDLt:T:gG:sQf:r:n:v:b:BSpP:");
+        ret = getopt(argc, argv, ":cdDLt:T:gG:sQf:r:n:v:b:BSpP:Az");
 
         if (ret < 0) {
             break;
@@ -668,6 +928,15 @@ int main(int argc, char **argv)
                 }
             break;
 
+            case 'A':
+                g_asyncOutput = true;
+            break;
+
+            case 'z':
+                g_asyncOutput = true;
+                g_compressRotated = true;
+            break;
+
             case 'v':
                 err = setLogFormat (optarg);
                 if (err < 0) {
@@ -775,6 +1044,15 @@ int main(int argc, char **argv)
         logcat_panic(true, "-r requires -f as well\n");
     }
 
+    if (g_compressRotated && g_logRotateSizeKBytes == 0) {
+        logcat_panic(true, "-z requires -r as well\n");
+    }
+
+    // Binary records go out as they are, unrotated
+    if (g_printBinary) {
+        g_asyncOutput = false;
+    }
+
     setupOutput();
 
     if (hasSetLogFormat == 0) {
@@ -956,10 +1234,20 @@ int main(int argc, char **argv)
 
     dev = NULL;
     log_device_t unexpected("unexpected", false);
+    log_device_t* devicesById[LOG_ID_MAX] = { NULL };
+    for (log_device_t* d = devices; d; d = d->next) {
+        log_id_t id = android_name_to_log_id(d->device);
+        if ((id < LOG_ID_MAX) && !devicesById[id]) {
+            devicesById[id] = d;
+        }
+    }
+    // Entries are taken from logd a batch at a time, bigger ones when
+    // they only have to be copied out
+    static struct log_msg log_msgs[64];
+    const size_t batch = g_printBinary ? 64 : 16;
     while (1) {
-        struct log_msg log_msg;
         log_device_t* d;
-        int ret = android_logger_list_read(logger_list, &log_msg);
+        int ret = android_logger_list_read_batch(logger_list, log_msgs, batch);
 
         if (ret == 0) {
             fprintf(stderr, "read: Unexpected EOF!\n");
@@ -981,28 +1269,43 @@ int main(int argc, char **argv)
             logcat_panic(false, "logcat read failure");
         }
 
-        for(d = devices; d; d = d->next) {
-            if (android_name_to_log_id(d->device) == log_msg.id()) {
-                break;
+        if (g_printBinary) {
+            for (int i = 0; i < ret; ++i) {
+                printBinary(&log_msgs[i]);
             }
-        }
-        if (!d) {
-            g_devCount = 2; // set to Multiple
-            d = &unexpected;
-            d->binary = log_msg.id() == LOG_ID_EVENTS;
+            // Caught up with logd, don't sit on what there is
+            if ((size_t)ret < batch) {
+                flushBinary();
+            }
+            continue;
         }
 
-        if (dev != d) {
-            dev = d;
-            maybePrintStart(dev, printDividers);
-        }
-        if (g_printBinary) {
-            printBinary(&log_msg);
-        } else {
+        for (int i = 0; i < ret; ++i) {
+            struct log_msg &log_msg = log_msgs[i];
+
+            log_id_t id = log_msg.id();
+            d = (id < LOG_ID_MAX) ? devicesById[id] : NULL;
+            if (!d) {
+                g_devCount = 2; // set to Multiple
+                d = &unexpected;
+                d->binary = log_msg.id() == LOG_ID_EVENTS;
+            }
+
+            if (dev != d) {
+                dev = d;
+                maybePrintStart(dev, printDividers);
+            }
             processBuffer(dev, &log_msg);
         }
+
+        // Caught up with logd, let the writer have what there is
+        if (g_asyncOutput && ((size_t)ret < batch)) {
+            asyncFlush();
+        }
     }
 
+    flushBinary();
+    asyncFinish();
     android_logger_list_free(logger_list);
 
     return EXIT_SUCCESS;
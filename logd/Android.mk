@@ -13,6 +13,13 @@ LOCAL_SRC_FILES := \
     FlushCommand.cpp \
     LogBuffer.cpp \
     LogBufferElement.cpp \
+    LogBufferChunk.cpp \
+    LogArena.cpp \
+    LogCompress.cpp \
+    LogFilter.cpp \
+    LogMetrics.cpp \
+    LogRing.cpp \
+    LogShmListener.cpp \
     LogTimes.cpp \
     LogStatistics.cpp \
     LogWhiteBlackList.cpp \
@@ -42,6 +42,7 @@ CommandListener::CommandListener(LogBuffer *buf, LogReader * /*reader*/,
     registerCmd(new SetBufSizeCmd(buf));
     registerCmd(new GetBufSizeUsedCmd(buf));
     registerCmd(new GetStatisticsCmd(buf));
+    registerCmd(new GetMetricsCmd(buf));
     registerCmd(new SetPruneListCmd(buf));
     registerCmd(new GetPruneListCmd(buf));
     registerCmd(new ReinitCmd());
@@ -243,6 +244,26 @@ int CommandListener::GetStatisticsCmd::runCommand(SocketClient *cli,
     return 0;
 }
 
+CommandListener::GetMetricsCmd::GetMetricsCmd(LogBuffer *buf) :
+        LogCommand("getMetrics"),
+        mBuf(*buf) {
+}
+
+int CommandListener::GetMetricsCmd::runCommand(SocketClient *cli,
+                                         int /*argc*/, char ** /*argv*/) {
+    setname();
+    char *buf = NULL;
+    mBuf.metrics().format(&buf);
+    if (!buf) {
+        cli->sendMsg("Failed");
+    } else {
+        package_string(&buf);
+        cli->sendMsg(buf);
+        free(buf);
+    }
+    return 0;
+}
+
 CommandListener::GetPruneListCmd::GetPruneListCmd(LogBuffer *buf) :
         LogCommand("getPruneList"),
         mBuf(*buf) {
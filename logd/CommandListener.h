@@ -61,6 +61,7 @@ private:
     LogBufferCmd(SetBufSize)
     LogBufferCmd(GetBufSizeUsed)
     LogBufferCmd(GetStatistics)
+    LogBufferCmd(GetMetrics)
     LogBufferCmd(GetPruneList)
     LogBufferCmd(SetPruneList)
 
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/user.h>
+
+#include "LogArena.h"
+
+// Tuned for the typical LogBufferElement plus payload sizes, roughly 25%
+// apart so that the internal fragmentation stays small. The last class
+// covers the element header plus LOGGER_ENTRY_MAX_PAYLOAD.
+const unsigned short LogArena::sizeClasses[] = {
+    64, 96, 128, 160, 192, 256, 320, 384, 512, 640,
+    768, 1024, 1280, 1536, 2048, 2560, 3072, 4096, 4608
+};
+const size_t LogArena::sizeClassCount =
+    sizeof(LogArena::sizeClasses) / sizeof(LogArena::sizeClasses[0]);
+
+struct LogArena::Slab {
+    LogArena *arena;
+    Slab *prev;          // mPartial linkage
+    Slab *next;
+    void *freeList;      // released blocks
+    char *unused;        // blocks never handed out begin here
+    size_t mapped;       // length of the mapping
+    size_t blockSize;
+    unsigned short sizeClass;
+    unsigned short inUse;
+    unsigned short capacity;
+};
+
+static inline size_t page_round(size_t size) {
+    return (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+LogArena::LogArena() : mSizeMapped(0), mSizeInUse(0) {
+    static_assert(sizeof(Slab) <= HEADER_SIZE, "LogArena::HEADER_SIZE too small");
+
+    pthread_mutex_init(&mLock, NULL);
+    for (size_t i = 0; i < SIZE_CLASS_MAX; ++i) {
+        mPartial[i] = NULL;
+        mEmpty[i] = NULL;
+    }
+    mEmpty[SIZE_CLASS_MAX] = NULL;
+}
+
+LogArena::~LogArena() {
+    for (size_t i = 0; i < SIZE_CLASS_MAX; ++i) {
+        while (mPartial[i]) {
+            Slab *slab = mPartial[i];
+            mPartial[i] = slab->next;
+            unmapSlab(slab);
+        }
+        if (mEmpty[i]) {
+            unmapSlab(mEmpty[i]);
+        }
+    }
+    if (mEmpty[SIZE_CLASS_MAX]) {
+        unmapSlab(mEmpty[SIZE_CLASS_MAX]);
+    }
+    pthread_mutex_destroy(&mLock);
+}
+
+// mLock must be held when calling this function.
+LogArena::Slab *LogArena::mapSlab(size_t sizeClass, size_t size) {
+    size_t len = SLAB_SIZE;
+    if (sizeClass == SIZE_CLASS_MAX) {
+        len = page_round(HEADER_SIZE + size);
+    }
+
+    // Over-map so that we can trim to a SLAB_SIZE aligned region
+    size_t over = len + SLAB_SIZE - PAGE_SIZE;
+    void *map = mmap(NULL, over, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(map);
+    uintptr_t aligned = (start + SLAB_SIZE - 1) & ~(SLAB_SIZE - 1);
+    if (aligned > start) {
+        munmap(map, aligned - start);
+    }
+    size_t tail = (start + over) - (aligned + len);
+    if (tail) {
+        munmap(reinterpret_cast<void *>(aligned + len), tail);
+    }
+
+    Slab *slab = reinterpret_cast<Slab *>(aligned);
+    slab->arena = this;
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->freeList = NULL;
+    slab->unused = reinterpret_cast<char *>(aligned) + HEADER_SIZE;
+    slab->mapped = len;
+    slab->blockSize = size;
+    slab->sizeClass = sizeClass;
+    slab->inUse = 0;
+    slab->capacity = (len - HEADER_SIZE) / size;
+
+    mSizeMapped += len;
+
+    return slab;
+}
+
+void LogArena::unmapSlab(Slab *slab) {
+    slab->arena->mSizeMapped -= slab->mapped;
+    munmap(slab, slab->mapped);
+}
+
+// mLock must be held when calling this function.
+void LogArena::link(Slab *slab) {
+    slab->prev = NULL;
+    slab->next = mPartial[slab->sizeClass];
+    if (slab->next) {
+        slab->next->prev = slab;
+    }
+    mPartial[slab->sizeClass] = slab;
+}
+
+// mLock must be held when calling this function.
+void LogArena::unlink(Slab *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        mPartial[slab->sizeClass] = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+void *LogArena::alloc(size_t size) {
+    size_t sizeClass = 0;
+    while ((sizeClass < sizeClassCount) && (sizeClasses[sizeClass] < size)) {
+        ++sizeClass;
+    }
+
+    pthread_mutex_lock(&mLock);
+
+    if (sizeClass >= sizeClassCount) {
+        // Jumbo, the mapping is private to this block
+        Slab *slab = mEmpty[SIZE_CLASS_MAX];
+        if (slab && (slab->mapped == page_round(HEADER_SIZE + size))) {
+            mEmpty[SIZE_CLASS_MAX] = NULL;
+            slab->blockSize = size;
+        } else {
+            slab = mapSlab(SIZE_CLASS_MAX, size);
+            if (!slab) {
+                pthread_mutex_unlock(&mLock);
+                return NULL;
+            }
+        }
+        slab->inUse = 1;
+        mSizeInUse += slab->blockSize;
+        pthread_mutex_unlock(&mLock);
+        return slab->unused;
+    }
+
+    Slab *slab = mPartial[sizeClass];
+    if (!slab) {
+        slab = mEmpty[sizeClass];
+        if (slab) {
+            mEmpty[sizeClass] = NULL;
+        } else {
+            slab = mapSlab(sizeClass, sizeClasses[sizeClass]);
+            if (!slab) {
+                pthread_mutex_unlock(&mLock);
+                return NULL;
+            }
+        }
+        link(slab);
+    }
+
+    void *block = slab->freeList;
+    if (block) {
+        slab->freeList = *reinterpret_cast<void **>(block);
+    } else {
+        block = slab->unused;
+        slab->unused += slab->blockSize;
+    }
+    if (++slab->inUse >= slab->capacity) {
+        unlink(slab);
+    }
+    mSizeInUse += slab->blockSize;
+
+    pthread_mutex_unlock(&mLock);
+
+    return block;
+}
+
+void LogArena::release(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    Slab *slab = reinterpret_cast<Slab *>(
+        reinterpret_cast<uintptr_t>(ptr) & ~(SLAB_SIZE - 1));
+    LogArena *arena = slab->arena;
+
+    pthread_mutex_lock(&arena->mLock);
+
+    arena->mSizeInUse -= slab->blockSize;
+
+    if (slab->sizeClass == SIZE_CLASS_MAX) {
+        slab->inUse = 0;
+        Slab *&empty = arena->mEmpty[SIZE_CLASS_MAX];
+        if (empty) {
+            arena->unmapSlab(empty);
+        }
+        empty = slab;
+        pthread_mutex_unlock(&arena->mLock);
+        return;
+    }
+
+    *reinterpret_cast<void **>(ptr) = slab->freeList;
+    slab->freeList = ptr;
+    if (slab->inUse-- >= slab->capacity) {
+        arena->link(slab);
+    }
+
+    if (!slab->inUse) {
+        arena->unlink(slab);
+        Slab *&empty = arena->mEmpty[slab->sizeClass];
+        if (empty) {
+            arena->unmapSlab(slab);
+        } else {
+            // Start afresh, the bump allocator keeps the blocks hot
+            slab->freeList = NULL;
+            slab->unused = reinterpret_cast<char *>(slab) + HEADER_SIZE;
+            empty = slab;
+        }
+    }
+
+    pthread_mutex_unlock(&arena->mLock);
+}
+
+size_t LogArena::sizeMapped() {
+    pthread_mutex_lock(&mLock);
+    size_t retval = mSizeMapped;
+    pthread_mutex_unlock(&mLock);
+    return retval;
+}
+
+size_t LogArena::sizeInUse() {
+    pthread_mutex_lock(&mLock);
+    size_t retval = mSizeInUse;
+    pthread_mutex_unlock(&mLock);
+    return retval;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_ARENA_H__
+#define _LOGD_LOG_ARENA_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Slab allocator backing the log buffer storage.
+//
+// Memory is mapped directly from the kernel in SLAB_SIZE aligned slabs,
+// each slab dedicated to a single size class. The owning slab (and arena)
+// of any block is found by masking its address, so release() needs no
+// size or arena argument. Blocks larger than the biggest size class get a
+// private mapping of their own with the same header, so the masking trick
+// still holds. Fully free slabs are unmapped, save for one per size class
+// (and one private mapping) that is retained to damp map/unmap cycles when
+// the log buffer storage cycles through its chunks.
+class LogArena {
+public:
+    static const size_t SLAB_SIZE = 64 * 1024;
+    // Bookkeeping ahead of each private mapping, a block of
+    // (n * PAGE_SIZE - HEADER_SIZE) bytes wastes no memory.
+    static const size_t HEADER_SIZE = 64;
+
+private:
+    struct Slab;
+
+    static const unsigned short sizeClasses[];
+    static const size_t sizeClassCount;
+    static const size_t SIZE_CLASS_MAX = 19;
+
+    pthread_mutex_t mLock;
+    Slab *mPartial[SIZE_CLASS_MAX]; // slabs with at least one free block
+    Slab *mEmpty[SIZE_CLASS_MAX + 1]; // retained completely free slab
+    size_t mSizeMapped;
+    size_t mSizeInUse;
+
+    Slab *mapSlab(size_t sizeClass, size_t size);
+    static void unmapSlab(Slab *slab);
+    void unlink(Slab *slab);
+    void link(Slab *slab);
+
+    // not copyable
+    LogArena(const LogArena &);
+    LogArena &operator=(const LogArena &);
+
+public:
+    LogArena();
+    ~LogArena();
+
+    // Returns NULL if the kernel refuses to map more memory
+    void *alloc(size_t size);
+    // Locates the owning arena from the block address
+    static void release(void *ptr);
+
+    // Helpers for statistics, take the arena lock
+    size_t sizeMapped();
+    size_t sizeInUse();
+};
+
+#endif // _LOGD_LOG_ARENA_H__
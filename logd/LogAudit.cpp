@@ -19,8 +19,11 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 #include <syslog.h>
 
@@ -37,41 +40,186 @@
     '0' + LOG_MAKEPRI(LOG_AUTH, LOG_PRI(PRI)) % 10, \
     '>'
 
-LogAudit::LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg) :
+// Messages taken off the netlink socket per recvmmsg()
+#define AUDIT_BATCH 8
+
+static const char audit_str[] = " audit(";
+
+LogAudit::LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg,
+                   bool summarize) :
         SocketListener(getLogSocket(), false),
         logbuf(buf),
         reader(reader),
         fdDmesg(fdDmesg),
-        initialized(false) {
+        initialized(false),
+        summarize(summarize),
+        duplicates(0) {
+    lastStr[AUDIT_HEADROOM] = '\0';
     static const char auditd_message[] = { KMSG_PRIORITY(LOG_INFO),
         'l', 'o', 'g', 'd', '.', 'a', 'u', 'd', 'i', 't', 'd', ':',
         ' ', 's', 't', 'a', 'r', 't', '\n' };
     write(fdDmesg, auditd_message, sizeof(auditd_message));
 }
 
+// Squeezes runs of spaces down to one, in a single pass
+static void squeezeSpaces(char *str) {
+    char *cp = strstr(str, "  ");
+    if (!cp) {
+        return;
+    }
+    char *out = cp;
+    for (; *cp; ++cp) {
+        if ((*cp != ' ') || (cp[1] != ' ')) {
+            *out++ = *cp;
+        }
+    }
+    *out = '\0';
+}
+
 bool LogAudit::onDataAvailable(SocketClient *cli) {
     if (!initialized) {
         prctl(PR_SET_NAME, "logd.auditd");
         initialized = true;
     }
 
-    struct audit_message rep;
-
-    rep.nlh.nlmsg_type = 0;
-    rep.nlh.nlmsg_len = 0;
-    rep.data[0] = '\0';
+    // Only the logd.auditd thread gets here
+    static char buffer[AUDIT_BATCH][AUDIT_HEADROOM + sizeof(struct audit_message) + 1]
+        __attribute__((aligned(8)));
+    static char mainBuf[AUDIT_BATCH][2 * AUDIT_STR_MAX + 2];
+
+    struct iovec iov[AUDIT_BATCH];
+    struct sockaddr_nl nladdr[AUDIT_BATCH];
+    struct mmsghdr hdr[AUDIT_BATCH];
+    memset(hdr, 0, sizeof(hdr));
+    for (size_t i = 0; i < AUDIT_BATCH; ++i) {
+        iov[i].iov_base = buffer[i] + AUDIT_HEADROOM;
+        iov[i].iov_len = sizeof(struct audit_message);
+        hdr[i].msg_hdr.msg_name = &nladdr[i];
+        hdr[i].msg_hdr.msg_namelen = sizeof(nladdr[i]);
+        hdr[i].msg_hdr.msg_iov = &iov[i];
+        hdr[i].msg_hdr.msg_iovlen = 1;
+    }
 
-    if (audit_get_reply(cli->getSocket(), &rep, GET_REPLY_BLOCKING, 0) < 0) {
-        SLOGE("Failed on audit_get_reply with error: %s", strerror(errno));
+    // poll() said there is at least one, take whatever else has queued up
+    int n = TEMP_FAILURE_RETRY(recvmmsg(cli->getSocket(), hdr, AUDIT_BATCH,
+                                        MSG_DONTWAIT, NULL));
+    if (n < 0) {
+        if (errno == EAGAIN) {
+            return true;
+        }
+        SLOGE("Failed on recvmmsg with error: %s", strerror(errno));
         return false;
     }
 
-    logPrint("type=%d %.*s",
-        rep.nlh.nlmsg_type, rep.nlh.nlmsg_len, rep.data);
+    LogBufferRecord events[AUDIT_BATCH];
+    LogBufferRecord mains[AUDIT_BATCH];
+    size_t count = 0;
+    bool notify = false;
+    for (int i = 0; i < n; ++i) {
+        struct audit_message *rep = reinterpret_cast<struct audit_message *>(
+                buffer[i] + AUDIT_HEADROOM);
+        size_t len = hdr[i].msg_len;
+
+        // Same checks as audit_get_reply()
+        if ((hdr[i].msg_hdr.msg_namelen != sizeof(nladdr[i]))
+                || nladdr[i].nl_pid
+                || !NLMSG_OK(&rep->nlh, len)) {
+            SLOGE("Invalid audit netlink message received");
+            continue;
+        }
+
+        // "type=%d %.*s", with the prefix written in front of the payload
+        // rather than the payload copied behind the prefix
+        char prefix[16];
+        int p = snprintf(prefix, sizeof(prefix), "type=%d ", rep->nlh.nlmsg_type);
+        size_t max = len - offsetof(struct audit_message, data);
+        if (max > rep->nlh.nlmsg_len) {
+            max = rep->nlh.nlmsg_len;
+        }
+        rep->data[strnlen(rep->data, max)] = '\0';
+        char *str = rep->data - p;
+        memcpy(str, prefix, p);
+
+        squeezeSpaces(str);
+
+        if (summarize) {
+            if (isDuplicate(str)) {
+                ++duplicates;
+                continue;
+            }
+            if (duplicates) {
+                // What came before the summary goes in first
+                notify |= logBatch(events, mains, count);
+                count = 0;
+                notify |= flushSummary();
+            }
+            remember(str);
+        }
+
+        prepare(str, mainBuf[i], sizeof(mainBuf[i]), events[count], mains[count]);
+        ++count;
+    }
+
+    notify |= logBatch(events, mains, count);
+
+    // A short batch means the socket has drained, the burst is over
+    if (duplicates && (n < AUDIT_BATCH)) {
+        notify |= flushSummary();
+    }
+
+    if (notify) {
+        reader->notifyNewLog();
+    }
 
     return true;
 }
 
+bool LogAudit::logBatch(const LogBufferRecord *events,
+                        const LogBufferRecord *mains, size_t count) {
+    if (!count) {
+        return false;
+    }
+    // Every event record before every main record, one lock run each
+    size_t logged = logbuf->log(events, count);
+    logged += logbuf->log(mains, count);
+    return logged != 0;
+}
+
+// Whether str repeats the last message logged but for its audit() stamp
+bool LogAudit::isDuplicate(const char *str) {
+    const char *last = lastStr + AUDIT_HEADROOM;
+    const char *a = strstr(str, audit_str);
+    const char *b = strstr(last, audit_str);
+    if (!a || !b || ((a - str) != (b - last)) || memcmp(str, last, a - str)) {
+        return false;
+    }
+    a = strchr(a, ')');
+    b = strchr(b, ')');
+    return a && b && !strcmp(a, b);
+}
+
+void LogAudit::remember(const char *str) {
+    strlcpy(lastStr + AUDIT_HEADROOM, str, AUDIT_STR_MAX);
+    duplicates = 0;
+}
+
+// Logs the last message again, with how many copies of it were dropped
+bool LogAudit::flushSummary() {
+    char *str = lastStr + AUDIT_HEADROOM;
+    size_t len = strlen(str);
+    snprintf(str + len, sizeof(lastStr) - AUDIT_HEADROOM - len,
+             " duplicates=%u", duplicates);
+    duplicates = 0;
+
+    LogBufferRecord event, main;
+    prepare(str, lastMain, sizeof(lastMain), event, main);
+    bool notify = logBatch(&event, &main, 1);
+
+    // prepare() rewrote it, and nothing repeats a summary
+    lastStr[AUDIT_HEADROOM] = '\0';
+    return notify;
+}
+
 int LogAudit::logPrint(const char *fmt, ...) {
     if (fmt == NULL) {
         return -EINVAL;
@@ -79,19 +227,35 @@ int LogAudit::logPrint(const char *fmt, ...) {
 
     va_list args;
 
-    char *str = NULL;
+    char buffer[AUDIT_HEADROOM + AUDIT_STR_MAX];
+    char *str = buffer + AUDIT_HEADROOM;
     va_start(args, fmt);
-    int rc = vasprintf(&str, fmt, args);
+    int rc = vsnprintf(str, AUDIT_STR_MAX, fmt, args);
     va_end(args);
 
     if (rc < 0) {
         return rc;
     }
 
-    char *cp;
-    while ((cp = strstr(str, "  "))) {
-        memmove(cp, cp + 1, strlen(cp + 1) + 1);
+    squeezeSpaces(str);
+
+    char mainBuf[2 * AUDIT_STR_MAX + 2];
+    LogBufferRecord event, main;
+    prepare(str, mainBuf, sizeof(mainBuf), event, main);
+    if (!logBatch(&event, &main, 1)) {
+        return -ENOMEM;
     }
+    reader->notifyNewLog();
+    return main.len;
+}
+
+// Copies str to dmesg, then rewrites it in place: the audit() stamp becomes
+// the record time and is zeroed, and " pid=N" attributes the record and is
+// dropped. The event record takes its header from the AUDIT_HEADROOM bytes
+// in front of str, the main record is built in mainBuf.
+void LogAudit::prepare(char *str, char *mainBuf, size_t mainSize,
+                       LogBufferRecord &event, LogBufferRecord &main) {
+    char *cp;
 
     bool info = strstr(str, " permissive=1") || strstr(str, " policy loaded ");
     if ((fdDmesg >= 0) && initialized) {
@@ -115,7 +279,6 @@ int LogAudit::logPrint(const char *fmt, ...) {
     uid_t uid = AID_LOGD;
     log_time now;
 
-    static const char audit_str[] = " audit(";
     char *timeptr = strstr(str, audit_str);
     if (timeptr
             && ((cp = now.strptime(timeptr + sizeof(audit_str) - 1, "%s.%q")))
@@ -156,32 +319,25 @@ int LogAudit::logPrint(const char *fmt, ...) {
     size_t l = strlen(str);
     size_t n = l + sizeof(android_log_event_string_t);
 
-    bool notify = false;
+    android_log_event_string_t *header = reinterpret_cast<android_log_event_string_t *>(
+        str - sizeof(android_log_event_string_t));
+    header->header.tag = htole32(AUDITD_LOG_TAG);
+    header->type = EVENT_TYPE_STRING;
+    header->length = htole32(l);
 
-    android_log_event_string_t *event = static_cast<android_log_event_string_t *>(malloc(n));
-    if (!event) {
-        rc = -ENOMEM;
-    } else {
-        event->header.tag = htole32(AUDITD_LOG_TAG);
-        event->type = EVENT_TYPE_STRING;
-        event->length = htole32(l);
-        memcpy(event->data, str, l);
-
-        rc = logbuf->log(LOG_ID_EVENTS, now, uid, pid, tid,
-                         reinterpret_cast<char *>(event),
-                         (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
-        free(event);
-
-        if (rc >= 0) {
-            notify = true;
-        }
-    }
+    event.log_id = LOG_ID_EVENTS;
+    event.realtime = now;
+    event.uid = uid;
+    event.pid = pid;
+    event.tid = tid;
+    event.msg = reinterpret_cast<char *>(header);
+    event.len = (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
 
     // log to main
 
     static const char comm_str[] = " comm=\"";
     const char *comm = strstr(str, comm_str);
-    const char *estr = str + strlen(str);
+    const char *estr = str + l;
     char *commfree = NULL;
     if (comm) {
         estr = comm;
@@ -206,41 +362,30 @@ int LogAudit::logPrint(const char *fmt, ...) {
         l = strlen(comm) + 1;
         ecomm = "";
     }
-    n = (estr - str) + strlen(ecomm) + l + 2;
-
-    char *newstr = static_cast<char *>(malloc(n));
-    if (!newstr) {
-        rc = -ENOMEM;
-    } else {
-        *newstr = info ? ANDROID_LOG_INFO : ANDROID_LOG_WARN;
-        strlcpy(newstr + 1, comm, l);
-        strncpy(newstr + 1 + l, str, estr - str);
-        strcpy(newstr + 1 + l + (estr - str), ecomm);
-
-        rc = logbuf->log(LOG_ID_MAIN, now, uid, pid, tid, newstr,
-                         (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
-        free(newstr);
-
-        if (rc >= 0) {
-            notify = true;
-        }
+    size_t rest = (estr - str) + strlen(ecomm) + 2;
+    if ((l + rest) > mainSize) {
+        l = mainSize - rest;
     }
+    n = l + rest;
 
-    free(commfree);
-    free(str);
+    *mainBuf = info ? ANDROID_LOG_INFO : ANDROID_LOG_WARN;
+    strlcpy(mainBuf + 1, comm, l);
+    memcpy(mainBuf + 1 + l, str, estr - str);
+    strcpy(mainBuf + 1 + l + (estr - str), ecomm);
 
-    if (notify) {
-        reader->notifyNewLog();
-        if (rc < 0) {
-            rc = n;
-        }
-    }
+    free(commfree);
 
-    return rc;
+    main.log_id = LOG_ID_MAIN;
+    main.realtime = now;
+    main.uid = uid;
+    main.pid = pid;
+    main.tid = tid;
+    main.msg = mainBuf;
+    main.len = (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
 }
 
 int LogAudit::log(char *buf) {
-    char *audit = strstr(buf, " audit(");
+    char *audit = strstr(buf, audit_str);
     if (!audit) {
         return 0;
     }
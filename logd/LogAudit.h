@@ -19,6 +19,13 @@
 
 #include <sysutils/SocketListener.h>
 #include "LogReader.h"
+#include "libaudit.h"
+
+// A message is formatted as "type=N <netlink payload>" with room in front
+// for the events header, so that both records are built without copying
+// the text more than once.
+#define AUDIT_HEADROOM 32
+#define AUDIT_STR_MAX (16 + MAX_AUDIT_MESSAGE_LENGTH + 1)
 
 class LogAudit : public SocketListener {
     LogBuffer *logbuf;
@@ -26,8 +33,18 @@ class LogAudit : public SocketListener {
     int fdDmesg;
     bool initialized;
 
+    // With summarize set, a message that repeats the last one logged but
+    // for its audit() stamp is dropped and counted, and the count is logged
+    // as " duplicates=N" on a copy of it once something else arrives or
+    // the socket drains.
+    bool summarize;
+    unsigned duplicates;
+    char lastStr[AUDIT_HEADROOM + AUDIT_STR_MAX + 32];
+    char lastMain[2 * AUDIT_STR_MAX + 32];
+
 public:
-    LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg);
+    LogAudit(LogBuffer *buf, LogReader *reader, int fdDmesg,
+             bool summarize = false);
     int log(char *buf);
 
 protected:
@@ -37,6 +54,13 @@ private:
     static int getLogSocket();
     int logPrint(const char *fmt, ...)
         __attribute__ ((__format__ (__printf__, 2, 3)));
+    void prepare(char *str, char *mainBuf, size_t mainSize,
+                 LogBufferRecord &event, LogBufferRecord &main);
+    bool logBatch(const LogBufferRecord *events,
+                  const LogBufferRecord *mains, size_t count);
+    bool isDuplicate(const char *str);
+    void remember(const char *str);
+    bool flushSummary();
 };
 
 #endif
@@ -35,6 +35,9 @@
 #define log_buffer_size(id) mMaxSize[id]
 #define LOG_BUFFER_MIN_SIZE (64 * 1024UL)
 #define LOG_BUFFER_MAX_SIZE (256 * 1024 * 1024UL)
+// Elements flushTo() may pass over under one buffer lock, filtered out or
+// just counted, before it lets writers in
+#define FLUSH_LOCK_BATCH 256
 
 static bool valid_size(unsigned long value) {
     if ((value < LOG_BUFFER_MIN_SIZE) || (LOG_BUFFER_MAX_SIZE < value)) {
@@ -126,102 +129,139 @@ void LogBuffer::init() {
             setSize(i, LOG_BUFFER_MIN_SIZE);
         }
     }
+
+    mRing.setSize(property_get_size("persist.logd.ring"));
 }
 
 LogBuffer::LogBuffer(LastLogTimes *times) : mTimes(*times) {
-    pthread_mutex_init(&mLogElementsLock, NULL);
+    log_id_for_each(i) {
+        pthread_mutex_init(&mLogElementsLock[i], NULL);
+    }
 
     init();
 }
 
-int LogBuffer::log(log_id_t log_id, log_time realtime,
-                   uid_t uid, pid_t pid, pid_t tid,
-                   const char *msg, unsigned short len) {
-    if ((log_id >= LOG_ID_MAX) || (log_id < 0)) {
-        return -EINVAL;
-    }
-
-    LogBufferElement *elem = new LogBufferElement(log_id, realtime,
-                                                  uid, pid, tid, msg, len);
+static bool isLoggable(log_id_t log_id, const char *msg, unsigned short len) {
     int prio = ANDROID_LOG_INFO;
     const char *tag = NULL;
     if (log_id == LOG_ID_EVENTS) {
-        tag = android::tagToName(elem->getTag());
+        tag = android::tagToName(LogBufferElement::getTag(log_id, msg, len));
     } else {
         prio = *msg;
         tag = msg + 1;
     }
-    if (!__android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE)) {
+    return __android_log_is_loggable(prio, tag, ANDROID_LOG_VERBOSE);
+}
+
+int LogBuffer::log(log_id_t log_id, log_time realtime,
+                   uid_t uid, pid_t pid, pid_t tid,
+                   const char *msg, unsigned short len) {
+    if ((log_id >= LOG_ID_MAX) || (log_id < 0)) {
+        return -EINVAL;
+    }
+
+    if (!isLoggable(log_id, msg, len)) {
         // Log traffic received to total
-        pthread_mutex_lock(&mLogElementsLock);
-        stats.add(elem);
-        stats.subtract(elem);
-        pthread_mutex_unlock(&mLogElementsLock);
-        delete elem;
+        pthread_mutex_lock(&mLogElementsLock[log_id]);
+        stats.addTotal(log_id, len);
+        pthread_mutex_unlock(&mLogElementsLock[log_id]);
         return -EACCES;
     }
 
-    pthread_mutex_lock(&mLogElementsLock);
+    lockElements(log_id);
+
+    // Records are appended in arrival order, the sequence number. Chunks
+    // are immutable once written so we no longer shuffle entries into
+    // realtime order; a writer with a skewed clock is reported as such.
+    LogBufferElement *elem = mLogElements[log_id].push_back(log_id, realtime,
+                                                            uid, pid, tid,
+                                                            msg, len);
+    if (!elem) {
+        pthread_mutex_unlock(&mLogElementsLock[log_id]);
+        return -ENOMEM;
+    }
 
-    // Insert elements in time sorted order if possible
-    //  NB: if end is region locked, place element at end of list
-    LogBufferElementCollection::iterator it = mLogElements.end();
-    LogBufferElementCollection::iterator last = it;
-    while (last != mLogElements.begin()) {
-        --it;
-        if ((*it)->getRealTime() <= realtime) {
-            break;
-        }
-        last = it;
+    stats.add(elem);
+    maybePrune(log_id);
+    pthread_mutex_unlock(&mLogElementsLock[log_id]);
+
+    mRing.log(log_id, realtime, uid, pid, tid, msg, len);
+
+    log_time now(CLOCK_REALTIME);
+    if (realtime < now) {
+        mMetrics.ingestLatency.add((now.nsec() - realtime.nsec()) / 1000);
     }
 
-    if (last == mLogElements.end()) {
-        mLogElements.push_back(elem);
-    } else {
-        uint64_t end = 1;
-        bool end_set = false;
-        bool end_always = false;
-
-        LogTimeEntry::lock();
-
-        LastLogTimes::iterator t = mTimes.begin();
-        while(t != mTimes.end()) {
-            LogTimeEntry *entry = (*t);
-            if (entry->owned_Locked()) {
-                if (!entry->mNonBlock) {
-                    end_always = true;
-                    break;
-                }
-                if (!end_set || (end <= entry->mEnd)) {
-                    end = entry->mEnd;
-                    end_set = true;
-                }
+    return len;
+}
+
+size_t LogBuffer::log(const LogBufferRecord *records, size_t count) {
+    size_t logged = 0;
+    int locked = -1;
+    log_time now(CLOCK_REALTIME);
+
+    for (size_t i = 0; i < count; ++i) {
+        const LogBufferRecord &r = records[i];
+        if ((r.log_id >= LOG_ID_MAX) || (r.log_id < 0)) {
+            continue;
+        }
+
+        // Property lookups are kept out from under the lock
+        bool loggable = isLoggable(r.log_id, r.msg, r.len);
+
+        if (locked != r.log_id) {
+            if (locked >= 0) {
+                pthread_mutex_unlock(&mLogElementsLock[locked]);
             }
-            t++;
+            locked = r.log_id;
+            lockElements(r.log_id);
+        }
+
+        if (!loggable) {
+            // Log traffic received to total
+            stats.addTotal(r.log_id, r.len);
+            continue;
         }
 
-        if (end_always
-                || (end_set && (end >= (*last)->getSequence()))) {
-            mLogElements.push_back(elem);
-        } else {
-            mLogElements.insert(last,elem);
+        LogBufferElement *elem = mLogElements[r.log_id].push_back(
+            r.log_id, r.realtime, r.uid, r.pid, r.tid, r.msg, r.len);
+        if (!elem) {
+            continue;
         }
 
-        LogTimeEntry::unlock();
+        stats.add(elem);
+        maybePrune(r.log_id);
+        ++logged;
+
+        mRing.log(r.log_id, r.realtime, r.uid, r.pid, r.tid, r.msg, r.len);
+
+        if (r.realtime < now) {
+            mMetrics.ingestLatency.add((now.nsec() - r.realtime.nsec()) / 1000);
+        }
     }
 
-    stats.add(elem);
-    maybePrune(log_id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    if (locked >= 0) {
+        pthread_mutex_unlock(&mLogElementsLock[locked]);
+    }
 
-    return len;
+    return logged;
+}
+
+// Takes mLogElementsLock[id], timing the wait should it be contended.
+void LogBuffer::lockElements(log_id_t id) {
+    if (!pthread_mutex_trylock(&mLogElementsLock[id])) {
+        return;
+    }
+    uint64_t start = LogMetrics::nsec();
+    pthread_mutex_lock(&mLogElementsLock[id]);
+    mMetrics.lockWait.add((LogMetrics::nsec() - start) / 1000);
 }
 
 // Prune at most 10% of the log entries or 256, whichever is less.
 //
-// mLogElementsLock must be held when this function is called.
+// mLogElementsLock[id] must be held when this function is called.
 void LogBuffer::maybePrune(log_id_t id) {
-    size_t sizes = stats.sizes(id);
+    size_t sizes = this->sizes(id);
     unsigned long maxSize = log_buffer_size(id);
     if (sizes > maxSize) {
         size_t sizeOver = sizes - ((maxSize * 9) / 10);
@@ -247,15 +287,36 @@ LogBufferElementCollection::iterator LogBuffer::erase(
     if ((f != mLastWorstUid[id].end()) && (it == f->second)) {
         mLastWorstUid[id].erase(f);
     }
-    it = mLogElements.erase(it);
     if (engageStats) {
         stats.subtract(e);
     } else {
         stats.erase(e);
     }
-    delete e;
+    return mLogElements[id].erase(it);
+}
+
+// Space charged against log_buffer_size(id). When compressing, the log
+// payload is discounted by the ratio the records achieve in storage, so
+// the same buffer size holds that much more history.
+//
+// mLogElementsLock[id] must be held when this function is called.
+size_t LogBuffer::sizes(log_id_t id) {
+    LogBufferElementCollection &list = mLogElements[id];
+    size_t written = list.sizeWritten();
+    if (!list.compressing() || !written) {
+        return stats.sizes(id);
+    }
+    return (uint64_t) stats.sizes(id) * list.sizeStored() / written;
+}
 
-    return it;
+// Reclaim the space held by expunged and tombstoned records.
+//
+// mLogElementsLock[id] must be held when this function is called.
+void LogBuffer::compact(log_id_t id) {
+    if (mLogElements[id].compact()) {
+        // Records moved, the watermarks no longer point at them
+        mLastWorstUid[id].clear();
+    }
 }
 
 // Define a temporary mechanism to report the last LogBufferElement pointer
@@ -283,9 +344,12 @@ class LogBufferElementLast {
 
     typedef std::unordered_map<uint64_t, LogBufferElement *> LogBufferElementMap;
     LogBufferElementMap map;
+    LogBufferElementCollection &list;
 
 public:
 
+    LogBufferElementLast(LogBufferElementCollection &l):list(l) { }
+
     bool merge(LogBufferElement *e, unsigned short dropped) {
         LogBufferElementKey key(e->getUid(), e->getPid(), e->getTid());
         LogBufferElementMap::iterator it = map.find(key.getKey());
@@ -295,6 +359,7 @@ public:
             if ((dropped + d) > USHRT_MAX) {
                 map.erase(it);
             } else {
+                list.modify(l);
                 l->setDropped(dropped + d);
                 return true;
             }
@@ -372,10 +437,12 @@ public:
 // The third thread is optional, and only gets hit if there was a whitelist
 // and more needs to be pruned against the backstop of the region lock.
 //
-// mLogElementsLock must be held when this function is called.
+// mLogElementsLock[id] must be held when this function is called.
 //
 void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
     LogTimeEntry *oldest = NULL;
+    uint64_t pruneStart = LogMetrics::nsec();
+    unsigned long scanned = 0;
 
     LogTimeEntry::lock();
 
@@ -390,21 +457,18 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         t++;
     }
 
+    LogBufferElementCollection &list = mLogElements[id];
     LogBufferElementCollection::iterator it;
 
     if (caller_uid != AID_ROOT) {
-        for(it = mLogElements.begin(); it != mLogElements.end();) {
+        for(it = list.begin(); it != list.end();) {
             LogBufferElement *e = *it;
+            ++scanned;
 
             if (oldest && (oldest->mStart <= e->getSequence())) {
                 break;
             }
 
-            if (e->getLogId() != id) {
-                ++it;
-                continue;
-            }
-
             if (e->getUid() == caller_uid) {
                 it = erase(it);
                 pruneRows--;
@@ -415,7 +479,10 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 ++it;
             }
         }
+        compact(id);
         LogTimeEntry::unlock();
+        mMetrics.pruneTime.add((LogMetrics::nsec() - pruneStart) / 1000);
+        mMetrics.pruneScanned.add(scanned);
         return;
     }
 
@@ -456,7 +523,7 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
         bool kick = false;
         bool leading = true;
-        it = mLogElements.begin();
+        it = list.begin();
         // Perform at least one mandatory garbage collection cycle in following
         // - clear leading chatty tags
         // - merge chatty tags
@@ -465,7 +532,7 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         if (!gc && (worst != (uid_t) -1)) {
             LogBufferIteratorMap::iterator f = mLastWorstUid[id].find(worst);
             if ((f != mLastWorstUid[id].end())
-                    && (f->second != mLogElements.end())) {
+                    && (f->second != list.end())) {
                 leading = false;
                 it = f->second;
             }
@@ -473,22 +540,34 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         static const timespec too_old = {
             EXPIRE_HOUR_THRESHOLD * 60 * 60, 0
         };
-        LogBufferElementCollection::iterator lastt;
-        lastt = mLogElements.end();
-        --lastt;
-        LogBufferElementLast last;
-        while (it != mLogElements.end()) {
+        LogBufferElement *newest = list.back();
+        if (!newest) {
+            break;
+        }
+        log_time lastt = newest->getRealTime();
+        LogBufferElementLast last(list);
+        while (it != list.end()) {
+            // Once past the leading drops, and with no blacklist to apply,
+            // only the records of the worst uid are of interest
+            if (!leading && !gc && !hasBlacklist) {
+                LogBufferElementCollection::iterator next = list.seekUid(it, worst);
+                if (next != it) {
+                    // Do not merge drops across what we skipped
+                    last.clear();
+                    it = next;
+                    if (it == list.end()) {
+                        break;
+                    }
+                }
+            }
+
             LogBufferElement *e = *it;
+            ++scanned;
 
             if (oldest && (oldest->mStart <= e->getSequence())) {
                 break;
             }
 
-            if (e->getLogId() != id) {
-                ++it;
-                continue;
-            }
-
             unsigned short dropped = e->getDropped();
 
             // remove any leading drops
@@ -505,6 +584,9 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
             if (hasBlacklist && mPrune.naughty(e)) {
                 last.clear(e);
+                // e may not outlive the erase
+                uid_t uid = e->getUid();
+                unsigned short len = e->getMsgLen();
                 it = erase(it);
                 if (dropped) {
                     continue;
@@ -515,18 +597,18 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                     break;
                 }
 
-                if (e->getUid() == worst) {
+                if (uid == worst) {
                     kick = true;
                     if (worst_sizes < second_worst_sizes) {
                         break;
                     }
-                    worst_sizes -= e->getMsgLen();
+                    worst_sizes -= len;
                 }
                 continue;
             }
 
-            if ((e->getRealTime() < ((*lastt)->getRealTime() - too_old))
-                    || (e->getRealTime() > (*lastt)->getRealTime())) {
+            if ((e->getRealTime() < (lastt - too_old))
+                    || (e->getRealTime() > lastt)) {
                 break;
             }
 
@@ -563,7 +645,7 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
                 it = erase(it);
             } else {
                 stats.drop(e);
-                e->setDropped(1);
+                list.drop(e);
                 if (last.merge(e, 1)) {
                     it = erase(it, false);
                 } else {
@@ -589,21 +671,17 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
     bool whitelist = false;
     bool hasWhitelist = mPrune.nice();
-    it = mLogElements.begin();
-    while((pruneRows > 0) && (it != mLogElements.end())) {
+    it = list.begin();
+    while((pruneRows > 0) && (it != list.end())) {
         LogBufferElement *e = *it;
-
-        if (e->getLogId() != id) {
-            it++;
-            continue;
-        }
+        ++scanned;
 
         if (oldest && (oldest->mStart <= e->getSequence())) {
             if (whitelist) {
                 break;
             }
 
-            if (stats.sizes(id) > (2 * log_buffer_size(id))) {
+            if (sizes(id) > (2 * log_buffer_size(id))) {
                 // kick a misbehaving log reader client off the island
                 oldest->release_Locked();
             } else {
@@ -624,17 +702,13 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
     // Do not save the whitelist if we are reader range limited
     if (whitelist && (pruneRows > 0)) {
-        it = mLogElements.begin();
-        while((it != mLogElements.end()) && (pruneRows > 0)) {
+        it = list.begin();
+        while((it != list.end()) && (pruneRows > 0)) {
             LogBufferElement *e = *it;
-
-            if (e->getLogId() != id) {
-                ++it;
-                continue;
-            }
+            ++scanned;
 
             if (oldest && (oldest->mStart <= e->getSequence())) {
-                if (stats.sizes(id) > (2 * log_buffer_size(id))) {
+                if (sizes(id) > (2 * log_buffer_size(id))) {
                     // kick a misbehaving log reader client off the island
                     oldest->release_Locked();
                 } else {
@@ -648,21 +722,26 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         }
     }
 
+    compact(id);
+
     LogTimeEntry::unlock();
+
+    mMetrics.pruneTime.add((LogMetrics::nsec() - pruneStart) / 1000);
+    mMetrics.pruneScanned.add(scanned);
 }
 
 // clear all rows of type "id" from the buffer.
 void LogBuffer::clear(log_id_t id, uid_t uid) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_mutex_lock(&mLogElementsLock[id]);
     prune(id, ULONG_MAX, uid);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_mutex_unlock(&mLogElementsLock[id]);
 }
 
 // get the used space associated with "id".
 unsigned long LogBuffer::getSizeUsed(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
-    size_t retval = stats.sizes(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_mutex_lock(&mLogElementsLock[id]);
+    size_t retval = sizes(id);
+    pthread_mutex_unlock(&mLogElementsLock[id]);
     return retval;
 }
 
@@ -672,57 +751,126 @@ int LogBuffer::setSize(log_id_t id, unsigned long size) {
     if (!valid_size(size)) {
         return -1;
     }
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_mutex_lock(&mLogElementsLock[id]);
     log_buffer_size(id) = size;
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_mutex_unlock(&mLogElementsLock[id]);
     return 0;
 }
 
 // get the total space allocated to "id"
 unsigned long LogBuffer::getSize(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_mutex_lock(&mLogElementsLock[id]);
     size_t retval = log_buffer_size(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_mutex_unlock(&mLogElementsLock[id]);
     return retval;
 }
 
 uint64_t LogBuffer::flushTo(
         SocketClient *reader, const uint64_t start, bool privileged,
-        int (*filter)(const LogBufferElement *element, void *arg), void *arg) {
-    LogBufferElementCollection::iterator it;
+        int (*filter)(const LogBufferElement *element, void *arg), void *arg,
+        unsigned int logMask) {
+    LogBufferElementCollection::iterator it[LOG_ID_MAX];
+    unsigned long generation[LOG_ID_MAX];
+    uint64_t next[LOG_ID_MAX]; // sequence at it[], or a lower bound thereof
     uint64_t max = start;
+    uint64_t last = start;     // sequence of the last element visited
     uid_t uid = reader->getUid();
 
-    pthread_mutex_lock(&mLogElementsLock);
+    // Elements are copied out so that they can be sent without holding
+    // a buffer lock. Only klogd and auditd go beyond the usual maximum.
+    char stackBuffer[sizeof(LogBufferElement) + LOGGER_ENTRY_MAX_PAYLOAD];
 
-    if (start <= 1) {
-        // client wants to start from the beginning
-        it = mLogElements.begin();
-    } else {
-        // Client wants to start from some specified time. Chances are
-        // we are better off starting from the end of the time sorted list.
-        for (it = mLogElements.end(); it != mLogElements.begin(); /* do nothing */) {
-            --it;
-            LogBufferElement *element = *it;
-            if (element->getSequence() <= start) {
-                it++;
-                break;
-            }
-        }
+    // Writers draw their sequence number with their buffer lock held, so
+    // once every buffer has been looked at under its lock, all elements
+    // numbered below the fence are in place. Merging up to the fence then
+    // needs only the lock of the buffer the next element comes from.
+    uint64_t fence = 0;
+    log_id_t locked = LOG_ID_MAX;
+    unsigned held = 0;         // elements visited since locking
+
+    log_id_for_each(i) {
+        next[i] = UINT64_MAX;
     }
 
-    for (; it != mLogElements.end(); ++it) {
-        LogBufferElement *element = *it;
+    for (;;) {
+        if ((locked != LOG_ID_MAX) && (held >= FLUSH_LOCK_BATCH)) {
+            pthread_mutex_unlock(&mLogElementsLock[locked]);
+            locked = LOG_ID_MAX;
+        }
 
-        if (!privileged && (element->getUid() != uid)) {
+        log_id_t id = LOG_ID_MAX;
+        log_id_for_each(i) {
+            if ((next[i] < fence) && ((id == LOG_ID_MAX) || (next[i] < next[id]))) {
+                id = i;
+            }
+        }
+
+        if (id == LOG_ID_MAX) {
+            // Caught up with the fence, move it to admit new arrivals
+            if (locked != LOG_ID_MAX) {
+                pthread_mutex_unlock(&mLogElementsLock[locked]);
+                locked = LOG_ID_MAX;
+            }
+            uint64_t current = LogBufferElement::getCurrentSequence();
+            if (current <= fence) {
+                break;
+            }
+            fence = current;
+            log_id_for_each(i) {
+                if (!(logMask & (1 << i))) {
+                    continue;
+                }
+                lockElements(i);
+                LogBufferElementCollection &list = mLogElements[i];
+                list.trim();
+                if ((next[i] == UINT64_MAX) || (generation[i] != list.getGeneration())) {
+                    it[i] = list.seek(last);
+                    generation[i] = list.getGeneration();
+                } else {
+                    it[i].settle();
+                }
+                next[i] = (it[i] != list.end()) ? (*it[i])->getSequence() : UINT64_MAX;
+                pthread_mutex_unlock(&mLogElementsLock[i]);
+            }
             continue;
         }
 
-        if (element->getSequence() <= start) {
+        LogBufferElementCollection &list = mLogElements[id];
+        if (locked != id) {
+            if (locked != LOG_ID_MAX) {
+                pthread_mutex_unlock(&mLogElementsLock[locked]);
+            }
+            lockElements(id);
+            locked = id;
+            held = 0;
+            list.trim();
+
+            // Storage reclaimed while unlocked, resume by sequence number
+            if (generation[id] != list.getGeneration()) {
+                it[id] = list.seek(last);
+                generation[id] = list.getGeneration();
+            } else {
+                it[id].settle();
+            }
+            uint64_t sequence = (it[id] != list.end()) ? (*it[id])->getSequence() : UINT64_MAX;
+            if (sequence != next[id]) {
+                // Pruned, which only ever moves us forward; choose again
+                next[id] = sequence;
+                continue;
+            }
+        }
+
+        LogBufferElement *element = *it[id];
+        ++it[id];
+        next[id] = (it[id] != list.end()) ? (*it[id])->getSequence() : UINT64_MAX;
+        last = element->getSequence();
+        ++held;
+
+        if (!privileged && (element->getUid() != uid)) {
             continue;
         }
 
-        // NB: calling out to another object with mLogElementsLock held (safe)
+        // NB: calling out to another object with mLogElementsLock[id] held (safe)
         if (filter) {
             int ret = (*filter)(element, arg);
             if (ret == false) {
@@ -733,26 +881,114 @@ uint64_t LogBuffer::flushTo(
             }
         }
 
-        pthread_mutex_unlock(&mLogElementsLock);
+        size_t len = sizeof(LogBufferElement) + element->getMsgLen();
+        char *buffer = stackBuffer;
+        if (len > sizeof(stackBuffer)) {
+            buffer = static_cast<char *>(malloc(len));
+            if (!buffer) {
+                continue;
+            }
+        }
+        LogBufferElement *copy = element->copyTo(buffer);
 
-        // range locking in LastLogTimes looks after us
-        max = element->flushTo(reader, this);
+        pthread_mutex_unlock(&mLogElementsLock[id]);
+        locked = LOG_ID_MAX;
 
-        if (max == element->FLUSH_ERROR) {
-            return max;
+        max = copy->flushTo(reader, this);
+
+        if (buffer != stackBuffer) {
+            free(buffer);
         }
 
-        pthread_mutex_lock(&mLogElementsLock);
+        if (max == LogBufferElement::FLUSH_ERROR) {
+            return max;
+        }
+    }
+    if (locked != LOG_ID_MAX) {
+        pthread_mutex_unlock(&mLogElementsLock[locked]);
     }
-    pthread_mutex_unlock(&mLogElementsLock);
 
     return max;
 }
 
+uint64_t LogBuffer::seekTime(log_time start, unsigned int logMask) {
+    uint64_t sequence = UINT64_MAX;
+
+    log_id_for_each(i) {
+        if (!(logMask & (1 << i))) {
+            continue;
+        }
+        pthread_mutex_lock(&mLogElementsLock[i]);
+        uint64_t s = mLogElements[i].seekTime(start);
+        pthread_mutex_unlock(&mLogElementsLock[i]);
+        if (s < sequence) {
+            sequence = s;
+        }
+    }
+
+    if (sequence == UINT64_MAX) {
+        // Nothing that recent, flushTo() comes up empty
+        sequence = LogBufferElement::getCurrentSequence();
+    }
+    return sequence;
+}
+
+uint64_t LogBuffer::seekTail(unsigned long count, unsigned int logMask) {
+    uint64_t sequence = UINT64_MAX;
+
+    // The last count of all the logs merged are among the last count of
+    // each, so start where the earliest of those does
+    log_id_for_each(i) {
+        if (!(logMask & (1 << i))) {
+            continue;
+        }
+        pthread_mutex_lock(&mLogElementsLock[i]);
+        uint64_t s = mLogElements[i].seekTail(count);
+        pthread_mutex_unlock(&mLogElementsLock[i]);
+        if (s < sequence) {
+            sequence = s;
+        }
+    }
+
+    if (sequence == UINT64_MAX) {
+        sequence = LogBufferElement::getCurrentSequence();
+    }
+    return sequence;
+}
+
 void LogBuffer::formatStatistics(char **strp, uid_t uid, unsigned int logMask) {
-    pthread_mutex_lock(&mLogElementsLock);
+    // Always in log_id order, against deadlock
+    log_id_for_each(i) {
+        pthread_mutex_lock(&mLogElementsLock[i]);
+    }
+    stats.lock();
 
+    log_id_for_each(i) {
+        const LogBufferElementCollection &list = mLogElements[i];
+        if (list.compressing()) {
+            stats.storage(i, list.sizeStored(),
+                          list.sizeInflated(), list.sizeDeflated());
+        }
+    }
     stats.format(strp, uid, logMask);
 
-    pthread_mutex_unlock(&mLogElementsLock);
+    stats.unlock();
+    for (log_id_t i = LOG_ID_MAX; i > LOG_ID_MIN; ) {
+        i = (log_id_t) (i - 1);
+        pthread_mutex_unlock(&mLogElementsLock[i]);
+    }
+}
+
+int LogBuffer::initPrune(char *cp) {
+    log_id_for_each(i) {
+        pthread_mutex_lock(&mLogElementsLock[i]);
+    }
+
+    int ret = mPrune.init(cp);
+
+    for (log_id_t i = LOG_ID_MAX; i > LOG_ID_MIN; ) {
+        i = (log_id_t) (i - 1);
+        pthread_mutex_unlock(&mLogElementsLock[i]);
+    }
+    return ret;
 }
@@ -19,25 +19,41 @@
 
 #include <sys/types.h>
 
-#include <list>
-
 #include <log/log.h>
 #include <sysutils/SocketClient.h>
 
 #include <private/android_filesystem_config.h>
 
+#include "LogBufferChunk.h"
 #include "LogBufferElement.h"
+#include "LogMetrics.h"
+#include "LogRing.h"
 #include "LogTimes.h"
 #include "LogStatistics.h"
 #include "LogWhiteBlackList.h"
 
-typedef std::list<LogBufferElement *> LogBufferElementCollection;
+// One entry of a batch handed to LogBuffer::log()
+struct LogBufferRecord {
+    log_id_t log_id;
+    log_time realtime;
+    uid_t uid;
+    pid_t pid;
+    pid_t tid;
+    const char *msg;
+    unsigned short len;
+};
 
 class LogBuffer {
-    LogBufferElementCollection mLogElements;
-    pthread_mutex_t mLogElementsLock;
+    // Each log buffer is kept in sequence order, flushTo() merges them.
+    // mLogElementsLock[id] protects mLogElements[id] along with the other
+    // per log buffer state below and in stats. Take several only in
+    // log_id order.
+    LogBufferElementCollection mLogElements[LOG_ID_MAX];
+    pthread_mutex_t mLogElementsLock[LOG_ID_MAX];
 
     LogStatistics stats;
+    LogMetrics mMetrics;
+    LogRing mRing;
 
     PruneList mPrune;
     // watermark of any worst/chatty uid processing
@@ -57,10 +73,19 @@ public:
     int log(log_id_t log_id, log_time realtime,
             uid_t uid, pid_t pid, pid_t tid,
             const char *msg, unsigned short len);
+    // Logs a batch, holding each buffer lock across a run of records
+    // for that buffer. Returns the number of records logged.
+    size_t log(const LogBufferRecord *records, size_t count);
     uint64_t flushTo(SocketClient *writer, const uint64_t start,
                      bool privileged,
                      int (*filter)(const LogBufferElement *element, void *arg) = NULL,
-                     void *arg = NULL);
+                     void *arg = NULL, unsigned int logMask = -1);
+    // Sequence to hand flushTo() so it starts no later than the first
+    // element logged at or after realtime start.
+    uint64_t seekTime(log_time start, unsigned int logMask = -1);
+    // Sequence to hand flushTo() so it visits at least the last count
+    // elements of each log in logMask, and not many more.
+    uint64_t seekTail(unsigned long count, unsigned int logMask = -1);
 
     void clear(log_id_t id, uid_t uid = AID_ROOT);
     unsigned long getSize(log_id_t id);
@@ -69,11 +94,19 @@ public:
     // *strp uses malloc, use free to release.
     void formatStatistics(char **strp, uid_t uid, unsigned int logMask);
 
+    LogMetrics &metrics() { return mMetrics; }
+
     void enableStatistics() {
         stats.enableStatistics();
     }
+    // Compress older records, trading reader CPU for more history
+    void enableCompression() {
+        log_id_for_each(i) {
+            mLogElements[i].enableCompression();
+        }
+    }
 
-    int initPrune(char *cp) { return mPrune.init(cp); }
+    int initPrune(char *cp);
     // *strp uses malloc, use free to release.
     void formatPrune(char **strp) { mPrune.format(strp); }
 
@@ -81,14 +114,17 @@ public:
     char *pidToName(pid_t pid) { return stats.pidToName(pid); }
     uid_t pidToUid(pid_t pid) { return stats.pidToUid(pid); }
     char *uidToName(uid_t uid) { return stats.uidToName(uid); }
-    void lock() { pthread_mutex_lock(&mLogElementsLock); }
-    void unlock() { pthread_mutex_unlock(&mLogElementsLock); }
+    void lock() { stats.lock(); }
+    void unlock() { stats.unlock(); }
 
 private:
+    void lockElements(log_id_t id);
     void maybePrune(log_id_t id);
     void prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
     LogBufferElementCollection::iterator erase(
         LogBufferElementCollection::iterator it, bool engageStats = true);
+    void compact(log_id_t id);
+    size_t sizes(log_id_t id);
 };
 
 #endif // _LOGD_LOG_BUFFER_H__
@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+
+#include "LogBufferChunk.h"
+#include "LogCompress.h"
+
+// Drop tombstones, and the payload of records that have been expunged,
+// sliding the survivors down to the start of the record area.
+bool LogBufferChunk::squeeze() {
+    bool moved = false;
+    size_t to = 0;
+    size_t offset = mFirst;
+    while (offset < mWritten) {
+        LogBufferElement *e = at(offset);
+        size_t size = e->recordSize();
+        if (!e->mErased) {
+            if (e->mDropped && e->mMsgLen) {
+                e->mMsgLen = 0;
+                moved = true;
+            }
+            size_t len = e->recordSize();
+            if (to != offset) {
+                memmove(data() + to, e, len);
+                moved = true;
+            }
+            mLast = to;
+            to += len;
+        }
+        offset += size;
+    }
+    if (to != mWritten) {
+        moved = true;
+    }
+    mFirst = 0;
+    mWritten = to;
+    mRecords = mLive;
+    return moved;
+}
+
+LogBufferElementCollection::LogBufferElementCollection() :
+        mHead(NULL),
+        mTail(NULL),
+        mCacheHead(NULL),
+        mCacheTail(NULL),
+        mGeneration(0),
+        mCompress(false),
+        mCached(0),
+        mSizeWritten(0),
+        mSizeStored(0),
+        mSizeInflated(0),
+        mSizeDeflated(0) {
+}
+
+LogBufferElementCollection::~LogBufferElementCollection() {
+    while (mHead) {
+        LogBufferChunk *chunk = mHead;
+        mHead = chunk->mNext;
+        LogArena::release(chunk->mData);
+        LogArena::release(chunk->mCompressed);
+        LogArena::release(chunk);
+    }
+}
+
+LogBufferChunk *LogBufferElementCollection::newChunk(size_t recordSize) {
+    size_t size = LogBufferChunk::CHUNK_SIZE - LogArena::HEADER_SIZE;
+    if (size < recordSize) {
+        // Oversized record, give it a chunk of its own
+        size = recordSize;
+    }
+
+    LogBufferChunk *chunk = static_cast<LogBufferChunk *>(
+        mArena.alloc(sizeof(LogBufferChunk)));
+    if (!chunk) {
+        return NULL;
+    }
+    char *data = static_cast<char *>(mArena.alloc(size));
+    if (!data) {
+        LogArena::release(chunk);
+        return NULL;
+    }
+
+    chunk->mOwner = this;
+    chunk->mPrev = mTail;
+    chunk->mNext = NULL;
+    chunk->mCachePrev = NULL;
+    chunk->mCacheNext = NULL;
+    chunk->mData = data;
+    chunk->mCompressed = NULL;
+    chunk->mCompressedSize = 0;
+    chunk->mSize = size;
+    chunk->mFirst = 0;
+    chunk->mLast = 0;
+    chunk->mWritten = 0;
+    chunk->mRecords = 0;
+    chunk->mLive = 0;
+    chunk->mFirstSequence = 0;
+    chunk->mLastSequence = 0;
+    chunk->mMaxRealTime = mTail ? mTail->mMaxRealTime : log_time::EPOCH;
+    chunk->mIncompressible = false;
+    memset(chunk->mUidRecords, 0, sizeof(chunk->mUidRecords));
+
+    if (mTail) {
+        mTail->mNext = chunk;
+    } else {
+        mHead = chunk;
+    }
+    mTail = chunk;
+    mIndex.push_back(chunk);
+
+    return chunk;
+}
+
+void LogBufferElementCollection::freeChunk(LogBufferChunk *chunk) {
+    if (chunk == mHead) {
+        mIndex.pop_front();
+    } else if (chunk == mTail) {
+        mIndex.pop_back();
+    } else {
+        // A chunk is never empty, so its last sequence finds it, unless
+        // compact() just handed that sequence on to its predecessor
+        index_t::iterator it = mIndex.begin() +
+            (lookup(chunk->mLastSequence - 1) - mIndex.begin());
+        while (*it != chunk) {
+            ++it;
+        }
+        mIndex.erase(it);
+    }
+
+    if (chunk->mPrev) {
+        chunk->mPrev->mNext = chunk->mNext;
+    } else {
+        mHead = chunk->mNext;
+    }
+    if (chunk->mNext) {
+        chunk->mNext->mPrev = chunk->mPrev;
+    } else {
+        mTail = chunk->mPrev;
+    }
+
+    mSizeWritten -= chunk->mWritten;
+    if (chunk->mCompressed) {
+        if (chunk->mData) {
+            cacheUnlink(chunk);
+        }
+        mSizeStored -= chunk->mCompressedSize;
+        mSizeInflated -= chunk->mWritten;
+        mSizeDeflated -= chunk->mCompressedSize;
+        LogArena::release(chunk->mCompressed);
+    } else {
+        mSizeStored -= chunk->mWritten;
+    }
+    LogArena::release(chunk->mData);
+    LogArena::release(chunk);
+    ++mGeneration;
+}
+
+void LogBufferElementCollection::cacheUnlink(LogBufferChunk *chunk) {
+    if (chunk->mCachePrev) {
+        chunk->mCachePrev->mCacheNext = chunk->mCacheNext;
+    } else {
+        mCacheHead = chunk->mCacheNext;
+    }
+    if (chunk->mCacheNext) {
+        chunk->mCacheNext->mCachePrev = chunk->mCachePrev;
+    } else {
+        mCacheTail = chunk->mCachePrev;
+    }
+    chunk->mCachePrev = NULL;
+    chunk->mCacheNext = NULL;
+    --mCached;
+}
+
+char *LogBufferElementCollection::inflate(LogBufferChunk *chunk) {
+    char *data = static_cast<char *>(mArena.alloc(chunk->mSize));
+    if (!data) {
+        return NULL;
+    }
+    if (!LogCompress::decompress(chunk->mCompressed, chunk->mCompressedSize,
+                                 data, chunk->mWritten)) {
+        LogArena::release(data);
+        return NULL;
+    }
+    chunk->mData = data;
+
+    chunk->mCachePrev = mCacheTail;
+    chunk->mCacheNext = NULL;
+    if (mCacheTail) {
+        mCacheTail->mCacheNext = chunk;
+    } else {
+        mCacheHead = chunk;
+    }
+    mCacheTail = chunk;
+    ++mCached;
+
+    return data;
+}
+
+// Trade the record area of a sealed chunk for a compressed copy.
+bool LogBufferElementCollection::deflate(LogBufferChunk *chunk) {
+    // Not worth it unless we save an eighth
+    char buffer[LogBufferChunk::CHUNK_SIZE];
+    size_t len = LogCompress::compress(chunk->mData, chunk->mWritten, buffer,
+        std::min(sizeof(buffer), chunk->mWritten - (chunk->mWritten / 8)));
+    if (!len) {
+        chunk->mIncompressible = true;
+        return false;
+    }
+    char *compressed = static_cast<char *>(mArena.alloc(len));
+    if (!compressed) {
+        return false;
+    }
+    memcpy(compressed, buffer, len);
+
+    LogArena::release(chunk->mData);
+    chunk->mData = NULL;
+    chunk->mCompressed = compressed;
+    chunk->mCompressedSize = len;
+
+    mSizeStored -= chunk->mWritten - len;
+    mSizeInflated += chunk->mWritten;
+    mSizeDeflated += len;
+    return true;
+}
+
+bool LogBufferElementCollection::squeeze(LogBufferChunk *chunk) {
+    size_t written = chunk->mWritten;
+    if (!chunk->squeeze()) {
+        return false;
+    }
+    mSizeWritten -= written - chunk->mWritten;
+    mSizeStored -= written - chunk->mWritten;
+    return true;
+}
+
+void LogBufferElementCollection::evict(LogBufferChunk *chunk) {
+    cacheUnlink(chunk);
+    LogArena::release(chunk->mData);
+    chunk->mData = NULL;
+}
+
+// The record area is about to change, the compressed copy goes stale.
+void LogBufferElementCollection::dirty(LogBufferChunk *chunk) {
+    // Records are only ever modified after being looked up, so a
+    // compressed chunk is inflated by now
+    if (!chunk->mCompressed || !chunk->mData) {
+        return;
+    }
+    cacheUnlink(chunk);
+    mSizeStored += chunk->mWritten - chunk->mCompressedSize;
+    mSizeInflated -= chunk->mWritten;
+    mSizeDeflated -= chunk->mCompressedSize;
+    LogArena::release(chunk->mCompressed);
+    chunk->mCompressed = NULL;
+    chunk->mCompressedSize = 0;
+}
+
+LogBufferElement *LogBufferElementCollection::push_back(
+        log_id_t log_id, log_time realtime,
+        uid_t uid, pid_t pid, pid_t tid,
+        const char *msg, unsigned short len) {
+    size_t size = LogBufferElement::recordSize(len);
+
+    LogBufferChunk *chunk = mTail;
+    if (!chunk || chunk->mCompressed
+            || ((chunk->mWritten + size) > chunk->mSize)) {
+        chunk = newChunk(size);
+        if (!chunk) {
+            return NULL;
+        }
+    }
+
+    LogBufferElement *e = new (chunk->mData + chunk->mWritten)
+        LogBufferElement(log_id, realtime, uid, pid, tid, msg, len);
+    chunk->mLast = chunk->mWritten;
+    chunk->mWritten += size;
+    mSizeWritten += size;
+    mSizeStored += size;
+    if (!chunk->mRecords++) {
+        chunk->mFirstSequence = e->getSequence();
+    }
+    ++chunk->mLive;
+    ++chunk->mUidRecords[LogBufferChunk::uidBucket(uid)];
+    chunk->mLastSequence = e->getSequence();
+    if (chunk->mMaxRealTime < realtime) {
+        chunk->mMaxRealTime = realtime;
+    }
+
+    return e;
+}
+
+LogBufferElementCollection::iterator LogBufferElementCollection::erase(
+        iterator it) {
+    LogBufferChunk *chunk = it.mChunk;
+    LogBufferElement *e = *it;
+
+    if (chunk->mLive > 1) {
+        dirty(chunk);
+    }
+    e->mErased = true;
+    --chunk->mLive;
+    if (!e->mDropped) {
+        --chunk->mUidRecords[LogBufferChunk::uidBucket(e->getUid())];
+    }
+
+    iterator next(it);
+    next.settle();
+
+    if (!chunk->mLive) {
+        freeChunk(chunk);
+    } else if (it.mOffset == chunk->mFirst) {
+        chunk->mFirst = chunk->live(chunk->mFirst);
+    }
+
+    return next;
+}
+
+void LogBufferElementCollection::modify(const LogBufferElement *e) {
+    index_t::const_iterator found = lookup(e->getSequence() - 1);
+    if (found != mIndex.end()) {
+        dirty(*found);
+    }
+}
+
+void LogBufferElementCollection::drop(LogBufferElement *e) {
+    index_t::const_iterator found = lookup(e->getSequence() - 1);
+    if (found != mIndex.end()) {
+        dirty(*found);
+        if (!e->mDropped) {
+            --(*found)->mUidRecords[LogBufferChunk::uidBucket(e->getUid())];
+        }
+    }
+    e->setDropped(1);
+}
+
+LogBufferElement *LogBufferElementCollection::back() const {
+    if (!mTail || !mTail->data()) {
+        return NULL;
+    }
+    LogBufferElement *e = mTail->at(mTail->mLast);
+    if (e->mErased) {
+        // Rare, walk the tail chunk for the last survivor
+        e = NULL;
+        for (size_t offset = mTail->mFirst; offset < mTail->mWritten;) {
+            LogBufferElement *l = mTail->at(offset);
+            if (!l->mErased) {
+                e = l;
+            }
+            offset += l->recordSize();
+        }
+    }
+    return e;
+}
+
+bool LogBufferElementCollection::sequenceBefore(uint64_t start,
+                                                const LogBufferChunk *chunk) {
+    return start < chunk->mLastSequence;
+}
+
+bool LogBufferElementCollection::timeBefore(const LogBufferChunk *chunk,
+                                           const log_time &start) {
+    return chunk->mMaxRealTime < start;
+}
+
+LogBufferElementCollection::index_t::const_iterator
+LogBufferElementCollection::lookup(uint64_t start) const {
+    return std::upper_bound(mIndex.begin(), mIndex.end(), start, sequenceBefore);
+}
+
+LogBufferElementCollection::iterator LogBufferElementCollection::seek(
+        uint64_t start) const {
+    index_t::const_iterator found = lookup(start);
+    if (found == mIndex.end()) {
+        return end();
+    }
+    LogBufferChunk *chunk = *found;
+    iterator it(chunk, chunk->mFirst);
+    while ((it.mChunk == chunk) && ((*it)->getSequence() <= start)) {
+        ++it;
+    }
+    return it;
+}
+
+LogBufferElementCollection::iterator LogBufferElementCollection::seekUid(
+        iterator it, uid_t uid) const {
+    size_t bucket = LogBufferChunk::uidBucket(uid);
+    LogBufferChunk *chunk = it.mChunk;
+    if (!chunk || chunk->mUidRecords[bucket]) {
+        return it;
+    }
+    do {
+        chunk = chunk->mNext;
+    } while (chunk && !chunk->mUidRecords[bucket]);
+    return chunk ? iterator(chunk, chunk->mFirst) : end();
+}
+
+uint64_t LogBufferElementCollection::seekTime(log_time start) const {
+    // mMaxRealTime never decreases along the index
+    index_t::const_iterator found = std::lower_bound(
+        mIndex.begin(), mIndex.end(), start, timeBefore);
+    if (found == mIndex.end()) {
+        return UINT64_MAX;
+    }
+    if (found == mIndex.begin()) {
+        return (*found)->mFirstSequence - 1;
+    }
+    return (*(found - 1))->mLastSequence;
+}
+
+uint64_t LogBufferElementCollection::seekTail(size_t count) const {
+    if (!mTail) {
+        return UINT64_MAX;
+    }
+    size_t seen = 0;
+    LogBufferChunk *chunk = mTail;
+    while ((seen + chunk->mLive) < count) {
+        seen += chunk->mLive;
+        chunk = chunk->mPrev;
+        if (!chunk) {
+            return 0;
+        }
+    }
+    return chunk->mFirstSequence - 1;
+}
+
+bool LogBufferElementCollection::compact() {
+    bool moved = false;
+
+    // The tail chunk is still being written, leave it be
+    LogBufferChunk *chunk = mHead;
+    while (chunk && (chunk != mTail)) {
+        LogBufferChunk *next = chunk->mNext;
+
+        if (!chunk->mCompressed) {
+            if (chunk->sparse() && squeeze(chunk)) {
+                moved = true;
+            }
+
+            LogBufferChunk *prev = chunk->mPrev;
+            if (prev && !prev->mCompressed
+                    && ((prev->mWritten + chunk->mWritten) <= prev->mSize)) {
+                memcpy(prev->mData + prev->mWritten, chunk->mData, chunk->mWritten);
+                prev->mLast = prev->mWritten + chunk->mLast;
+                prev->mWritten += chunk->mWritten;
+                prev->mRecords += chunk->mRecords;
+                prev->mLive += chunk->mLive;
+                prev->mLastSequence = chunk->mLastSequence;
+                prev->mMaxRealTime = chunk->mMaxRealTime;
+                prev->mIncompressible = false;
+                for (size_t i = 0; i < LogBufferChunk::UID_BUCKETS; ++i) {
+                    prev->mUidRecords[i] += chunk->mUidRecords[i];
+                }
+                // freeChunk() takes back what prev now holds
+                mSizeWritten += chunk->mWritten;
+                mSizeStored += chunk->mWritten;
+                freeChunk(chunk);
+                moved = true;
+            }
+        }
+
+        chunk = next;
+    }
+
+    if (mCompress) {
+        // Newest first, the oldest are the next to be pruned anyway
+        chunk = mTail;
+        for (size_t i = 0; chunk && (i < PLAIN_CHUNKS); ++i) {
+            chunk = chunk->mPrev;
+        }
+        size_t batch = 0;
+        while (chunk && (batch < COMPRESS_BATCH)) {
+            if (!chunk->mCompressed && !chunk->mIncompressible) {
+                if (squeeze(chunk)) {
+                    moved = true;
+                }
+                deflate(chunk);
+                ++batch;
+            }
+            chunk = chunk->mPrev;
+        }
+    }
+
+    trim();
+
+    if (moved) {
+        ++mGeneration;
+    }
+    return moved;
+}
+
+void LogBufferElementCollection::trim() {
+    while (mCached > CACHED_CHUNKS) {
+        evict(mCacheHead);
+    }
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_CHUNK_H__
+#define _LOGD_LOG_BUFFER_CHUNK_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+
+#include "LogArena.h"
+#include "LogBufferElement.h"
+
+class LogBufferElementCollection;
+
+// Fixed-size contiguous block of packed LogBufferElement records, kept in
+// sequence order. Records are appended at mWritten and tombstoned when
+// erased; the chunk is handed back to the arena once none are live.
+//
+// A sealed chunk may be compressed, mCompressed then holds the one true
+// copy of the record area and mData is at most a clean cache of it that
+// is inflated on first access. Modifying a record drops mCompressed.
+class LogBufferChunk {
+    friend class LogBufferElementCollection;
+
+    LogBufferElementCollection *mOwner;
+    LogBufferChunk *mPrev;
+    LogBufferChunk *mNext;
+    LogBufferChunk *mCachePrev; // inflated compressed chunks, oldest first
+    LogBufferChunk *mCacheNext;
+    char *mData;            // record area, NULL if only compressed
+    char *mCompressed;      // immutable copy of the record area, or NULL
+    size_t mCompressedSize;
+    size_t mSize;           // capacity of the record area
+    size_t mFirst;          // offset of the first live record
+    size_t mLast;           // offset of the last record appended
+    size_t mWritten;        // offset past the last record
+    size_t mRecords;        // records in the record area, erased included
+    size_t mLive;           // records not erased
+    uint64_t mFirstSequence; // sequence of the first record appended
+    uint64_t mLastSequence; // sequence of the record at mLast
+    log_time mMaxRealTime;  // newest realtime here or in any older chunk
+    bool mIncompressible;
+
+    // Live records still carrying their payload, by uid bucket, so that
+    // pruning a chatty uid skips over chunks with nothing left to drop
+    static const size_t UID_BUCKETS = 32;
+    unsigned short mUidRecords[UID_BUCKETS];
+
+    static size_t uidBucket(uid_t uid) { return uid % UID_BUCKETS; }
+
+    // Inflates a compressed chunk, NULL if that fails
+    inline char *data() const;
+
+    LogBufferElement *at(size_t offset) const {
+        return reinterpret_cast<LogBufferElement *>(data() + offset);
+    }
+
+    // Offset of the first live record at or after offset, else mWritten
+    size_t live(size_t offset) const {
+        if (!data()) {
+            return mWritten;
+        }
+        while (offset < mWritten) {
+            const LogBufferElement *e = at(offset);
+            if (!e->mErased) {
+                break;
+            }
+            offset += e->recordSize();
+        }
+        return offset;
+    }
+
+    // Mostly tombstones, worth squeezing
+    bool sparse() const { return (mLive * 4) < mRecords; }
+
+    // Returns true if any record moved
+    bool squeeze();
+
+public:
+    // Allocation size of the record area, arena bookkeeping included
+    static const size_t CHUNK_SIZE = 16 * 1024;
+};
+
+// Storage for one log buffer: a list of LogBufferChunks that grows at the
+// tail and is reclaimed a whole chunk at a time, wherever the chunk ends
+// up with no live records. Offers the subset of the std::list interface
+// LogBuffer relies on, iterators step over erased records.
+//
+// Iterators remain valid across erase() of other records. Reclaiming or
+// compacting chunks invalidates them and bumps getGeneration(), callers
+// that drop the LogBuffer lock while holding an iterator must check it.
+//
+// mIndex holds the chunks in list order so that seek() and seekTime()
+// can binary search them, readers resume without walking from the head.
+//
+// With compression enabled, compact() compresses sealed chunks that have
+// aged out of the tail. A compressed chunk is inflated again when an
+// iterator reaches it; the inflated copies are only a cache, trim() frees
+// all but the most recent few. Element pointers into a compressed chunk
+// are thus only good until the next trim() or compact(), and a record
+// found that way must be passed to modify() before it is changed.
+class LogBufferElementCollection {
+    friend class LogBufferChunk;
+
+    typedef std::deque<LogBufferChunk *> index_t;
+
+    // Inflated copies of compressed chunks kept around for readers
+    static const size_t CACHED_CHUNKS = 4;
+    // Chunks at the tail left alone, where tailing readers are active
+    static const size_t PLAIN_CHUNKS = 2;
+    // Bound on the chunks compressed per compact(), a writer pays for it
+    static const size_t COMPRESS_BATCH = 16;
+
+    LogArena mArena;
+    LogBufferChunk *mHead;
+    LogBufferChunk *mTail;
+    LogBufferChunk *mCacheHead;
+    LogBufferChunk *mCacheTail;
+    index_t mIndex;
+    unsigned long mGeneration;
+    bool mCompress;
+    size_t mCached;
+    size_t mSizeWritten;    // bytes of records
+    size_t mSizeStored;     // ... as stored, compressed where they are
+    size_t mSizeInflated;   // bytes of records held compressed ...
+    size_t mSizeDeflated;   // ... and what they compressed to
+
+    static bool sequenceBefore(uint64_t start, const LogBufferChunk *chunk);
+    static bool timeBefore(const LogBufferChunk *chunk, const log_time &start);
+    // First chunk holding a sequence greater than start
+    index_t::const_iterator lookup(uint64_t start) const;
+    LogBufferChunk *newChunk(size_t recordSize);
+    void freeChunk(LogBufferChunk *chunk);
+
+    char *inflate(LogBufferChunk *chunk);
+    bool deflate(LogBufferChunk *chunk);
+    bool squeeze(LogBufferChunk *chunk);
+    void evict(LogBufferChunk *chunk);
+    void dirty(LogBufferChunk *chunk);
+    void cacheUnlink(LogBufferChunk *chunk);
+
+    // not copyable
+    LogBufferElementCollection(const LogBufferElementCollection &);
+    LogBufferElementCollection &operator=(const LogBufferElementCollection &);
+
+public:
+    class iterator {
+        friend class LogBufferElementCollection;
+
+        LogBufferChunk *mChunk; // NULL is end()
+        size_t mOffset;
+
+        iterator(LogBufferChunk *chunk, size_t offset):
+                mChunk(chunk),
+                mOffset(offset) {
+            settle();
+        }
+
+    public:
+        iterator():mChunk(NULL),mOffset(0) { }
+
+        LogBufferElement *operator*() const { return mChunk->at(mOffset); }
+
+        iterator &operator++() {
+            mOffset += mChunk->at(mOffset)->recordSize();
+            settle();
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator retval(*this);
+            ++*this;
+            return retval;
+        }
+
+        // Step over any records erased since the iterator was taken
+        void settle() {
+            while (mChunk) {
+                mOffset = mChunk->live(mOffset);
+                if (mOffset < mChunk->mWritten) {
+                    return;
+                }
+                mChunk = mChunk->mNext;
+                mOffset = mChunk ? mChunk->mFirst : 0;
+            }
+            mOffset = 0;
+        }
+
+        bool operator==(const iterator &rhs) const {
+            return (mChunk == rhs.mChunk) && (mOffset == rhs.mOffset);
+        }
+        bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    };
+
+    LogBufferElementCollection();
+    ~LogBufferElementCollection();
+
+    iterator begin() const { return iterator(mHead, mHead ? mHead->mFirst : 0); }
+    iterator end() const { return iterator(); }
+    bool empty() const { return !mHead; }
+
+    // Returns NULL if out of memory
+    LogBufferElement *push_back(log_id_t log_id, log_time realtime,
+                                uid_t uid, pid_t pid, pid_t tid,
+                                const char *msg, unsigned short len);
+
+    // Tombstones the record, returns the next live record
+    iterator erase(iterator it);
+
+    // The record is about to be changed in place
+    void modify(const LogBufferElement *e);
+    // Expunge the payload of the record, leaving a chatty placeholder
+    void drop(LogBufferElement *e);
+
+    // Newest live record, NULL if empty
+    LogBufferElement *back() const;
+
+    // First live record with a sequence greater than start
+    iterator seek(uint64_t start) const;
+    // it, unless nothing from it on in its chunk can belong to uid and
+    // carry a payload, then the first live record of the next chunk that
+    // may hold one. Does not inflate the chunks stepped over.
+    iterator seekUid(iterator it, uid_t uid) const;
+    // A sequence such that every record with a realtime at or after start
+    // lies beyond it, UINT64_MAX if there are no such records
+    uint64_t seekTime(log_time start) const;
+    // A sequence such that the last count live records lie beyond it,
+    // counted by chunk so that none is inflated; it may let in up to a
+    // chunk more. 0 if there are fewer, UINT64_MAX if there are none.
+    uint64_t seekTail(size_t count) const;
+
+    // Squeeze expunged payloads and tombstones out of sparse sealed chunks,
+    // folding them into their predecessor where they fit, then compress
+    // some of the older chunks if enabled. Returns true if any records
+    // moved.
+    bool compact();
+    // Release inflated copies of compressed chunks beyond the cache limit
+    void trim();
+
+    void enableCompression() { mCompress = true; }
+    bool compressing() const { return mCompress; }
+
+    unsigned long getGeneration() const { return mGeneration; }
+    size_t sizeStorage() { return mArena.sizeMapped(); }
+    // Space taken by the records, and as stored compressed where they are
+    size_t sizeWritten() const { return mSizeWritten; }
+    size_t sizeStored() const { return mSizeStored; }
+    // Records held compressed, before and after
+    size_t sizeInflated() const { return mSizeInflated; }
+    size_t sizeDeflated() const { return mSizeDeflated; }
+};
+
+char *LogBufferChunk::data() const {
+    return mData ? mData : mOwner->inflate(const_cast<LogBufferChunk *>(this));
+}
+
+#endif // _LOGD_LOG_BUFFER_CHUNK_H__
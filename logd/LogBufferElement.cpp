@@ -35,26 +35,34 @@ atomic_int_fast64_t LogBufferElement::sequence(1);
 LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
                                    uid_t uid, pid_t pid, pid_t tid,
                                    const char *msg, unsigned short len) :
-        mLogId(log_id),
+        mSequence(sequence.fetch_add(1, memory_order_relaxed)),
+        mRealTime(realtime),
         mUid(uid),
         mPid(pid),
         mTid(tid),
         mMsgLen(len),
-        mSequence(sequence.fetch_add(1, memory_order_relaxed)),
-        mRealTime(realtime) {
-    mMsg = new char[len];
-    memcpy(mMsg, msg, len);
+        mDropped(0),
+        mLogId(log_id),
+        mErased(false) {
+    memcpy(this->msg(), msg, len);
 }
 
-LogBufferElement::~LogBufferElement() {
-    delete [] mMsg;
+uint32_t LogBufferElement::getTag(log_id_t log_id, const char *msg,
+                                  unsigned short len) {
+    if ((log_id != LOG_ID_EVENTS) || !msg || (len < sizeof(uint32_t))) {
+        return 0;
+    }
+    return le32toh(reinterpret_cast<const android_event_header_t *>(msg)->tag);
 }
 
 uint32_t LogBufferElement::getTag() const {
-    if ((mLogId != LOG_ID_EVENTS) || !mMsg || (mMsgLen < sizeof(uint32_t))) {
-        return 0;
-    }
-    return le32toh(reinterpret_cast<android_event_header_t *>(mMsg)->tag);
+    return getTag(getLogId(), getMsg(), getMsgLen());
+}
+
+LogBufferElement *LogBufferElement::copyTo(void *buffer) const {
+    size_t len = sizeof(LogBufferElement) + getMsgLen();
+    memcpy(buffer, this, len);
+    return reinterpret_cast<LogBufferElement *>(buffer);
 }
 
 // caller must own and free character string
@@ -101,7 +109,7 @@ char *android::tidToName(pid_t tid) {
     return retval;
 }
 
-// assumption: mMsg == NULL
+// assumption: mDropped != 0
 size_t LogBufferElement::populateDroppedMessage(char *&buffer,
         LogBuffer *parent) {
     static const char tag[] = "chatty";
@@ -208,7 +216,7 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent) {
 
     char *buffer = NULL;
 
-    if (!mMsg) {
+    if (mDropped) {
         entry.len = populateDroppedMessage(buffer, parent);
         if (!entry.len) {
             return mSequence;
@@ -216,7 +224,7 @@ uint64_t LogBufferElement::flushTo(SocketClient *reader, LogBuffer *parent) {
         iovec[1].iov_base = buffer;
     } else {
         entry.len = mMsgLen;
-        iovec[1].iov_base = mMsg;
+        iovec[1].iov_base = msg();
     }
     iovec[1].iov_len = entry.len;
 
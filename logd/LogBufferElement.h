@@ -25,6 +25,7 @@
 #include <log/log.h>
 #include <log/log_read.h>
 
+
 // Hijack this header as a common include file used by most all sources
 // to report some utilities defined here and there.
 
@@ -54,48 +55,66 @@ class LogBuffer;
                                  // chatty for the temporal expire messages
 #define EXPIRE_RATELIMIT 10      // maximum rate in seconds to report expiration
 
+// A record in the chunked log buffer storage. The payload is packed
+// directly behind the header inside a LogBufferChunk; elements are only
+// created by LogBufferElementCollection::push_back() and are never
+// destroyed individually, the chunk holding them is.
 class LogBufferElement {
-    const log_id_t mLogId;
+    friend class LogBufferChunk;
+    friend class LogBufferElementCollection;
+
+    const uint64_t mSequence;
+    const log_time mRealTime;
     const uid_t mUid;
     const pid_t mPid;
     const pid_t mTid;
-    char *mMsg;
-    union {
-        const unsigned short mMsgLen; // mMSg != NULL
-        unsigned short mDropped;      // mMsg == NULL
-    };
-    const uint64_t mSequence;
-    const log_time mRealTime;
+    unsigned short mMsgLen;       // payload bytes following the header
+    unsigned short mDropped;      // payload expunged if not zero
+    const unsigned char mLogId;
+    bool mErased;                 // tombstone until the chunk is reclaimed
     static atomic_int_fast64_t sequence;
 
-    // assumption: mMsg == NULL
+    char *msg() const {
+        return const_cast<char *>(reinterpret_cast<const char *>(this + 1));
+    }
+
+    // Record footprint inside a chunk, keeps the headers 8 byte aligned
+    static size_t recordSize(unsigned short len) {
+        return (sizeof(LogBufferElement) + len + 7) & ~7;
+    }
+    size_t recordSize() const { return recordSize(mMsgLen); }
+
+    // assumption: mDropped != 0
     size_t populateDroppedMessage(char *&buffer,
                                   LogBuffer *parent);
 
-public:
     LogBufferElement(log_id_t log_id, log_time realtime,
                      uid_t uid, pid_t pid, pid_t tid,
                      const char *msg, unsigned short len);
-    virtual ~LogBufferElement();
 
-    log_id_t getLogId() const { return mLogId; }
+public:
+    log_id_t getLogId() const { return static_cast<log_id_t>(mLogId); }
     uid_t getUid(void) const { return mUid; }
     pid_t getPid(void) const { return mPid; }
     pid_t getTid(void) const { return mTid; }
-    unsigned short getDropped(void) const { return mMsg ? 0 : mDropped; }
+    unsigned short getDropped(void) const { return mDropped; }
+    // The payload space is reclaimed when the chunk is compacted
     unsigned short setDropped(unsigned short value) {
-        if (mMsg) {
-            free(mMsg);
-            mMsg = NULL;
-        }
         return mDropped = value;
     }
-    unsigned short getMsgLen() const { return mMsg ? mMsgLen : 0; }
+    unsigned short getMsgLen() const { return mDropped ? 0 : mMsgLen; }
+    const char *getMsg() const { return mDropped ? NULL : msg(); }
     uint64_t getSequence(void) const { return mSequence; }
     static uint64_t getCurrentSequence(void) { return sequence.load(memory_order_relaxed); }
     log_time getRealTime(void) const { return mRealTime; }
 
     uint32_t getTag(void) const;
+    static uint32_t getTag(log_id_t log_id, const char *msg, unsigned short len);
+
+    // Copy of this record, including any payload, into buffer; which must
+    // be at least recordSize() bytes. The copy may be flushed without
+    // holding the LogBuffer lock.
+    LogBufferElement *copyTo(void *buffer) const;
 
     static const uint64_t FLUSH_ERROR;
     uint64_t flushTo(SocketClient *writer, LogBuffer *parent);
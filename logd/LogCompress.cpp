@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "LogCompress.h"
+
+// The stream is a series of sequences, each a token byte holding a literal
+// length (high nibble) and a match length less MIN_MATCH (low nibble), an
+// extension of either length in 255 steps when the nibble is saturated,
+// the literals, then a 16 bit little endian match offset. The last
+// sequence is literals only and ends the stream.
+
+static const size_t MIN_MATCH = 4;
+static const unsigned HASH_BITS = 12;
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline size_t hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static inline size_t extraLength(size_t len) {
+    return (len < 15) ? 0 : (((len - 15) / 255) + 1);
+}
+
+static inline uint8_t *putLength(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+// Emits one sequence, match length 0 marks the final literal run.
+static uint8_t *putSequence(uint8_t *op, const uint8_t *oend,
+                            const uint8_t *literals, size_t lit,
+                            size_t offset, size_t match) {
+    size_t mlen = match ? (match - MIN_MATCH) : 0;
+    size_t need = 1 + extraLength(lit) + lit;
+    if (match) {
+        need += 2 + extraLength(mlen);
+    }
+    if (need > static_cast<size_t>(oend - op)) {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    *token = ((lit < 15) ? lit : 15) << 4;
+    if (lit >= 15) {
+        op = putLength(op, lit - 15);
+    }
+    memcpy(op, literals, lit);
+    op += lit;
+
+    if (match) {
+        *token |= (mlen < 15) ? mlen : 15;
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        if (mlen >= 15) {
+            op = putLength(op, mlen - 15);
+        }
+    }
+    return op;
+}
+
+size_t LogCompress::compress(const void *src, size_t len,
+                             void *dst, size_t capacity) {
+    if (len > MAX_SOURCE) {
+        return 0;
+    }
+
+    const uint8_t *base = static_cast<const uint8_t *>(src);
+    const uint8_t *end = base + len;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    uint8_t *op = static_cast<uint8_t *>(dst);
+    const uint8_t *oend = op + capacity;
+
+    uint16_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    while ((ip + MIN_MATCH) <= end) {
+        uint32_t v = read32(ip);
+        size_t h = hash(v);
+        const uint8_t *ref = base + table[h];
+        table[h] = ip - base;
+
+        if ((ref >= ip) || (read32(ref) != v)) {
+            // Step up over incompressible stretches
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        const uint8_t *m = ip + MIN_MATCH;
+        const uint8_t *r = ref + MIN_MATCH;
+        while ((m < end) && (*m == *r)) {
+            ++m;
+            ++r;
+        }
+
+        op = putSequence(op, oend, anchor, ip - anchor, ip - ref, m - ip);
+        if (!op) {
+            return 0;
+        }
+        ip = anchor = m;
+    }
+
+    op = putSequence(op, oend, anchor, end - anchor, 0, 0);
+    if (!op) {
+        return 0;
+    }
+    return op - static_cast<uint8_t *>(dst);
+}
+
+static inline bool getLength(const uint8_t *&ip, const uint8_t *iend,
+                             size_t &len) {
+    uint8_t b;
+    do {
+        if (ip >= iend) {
+            return false;
+        }
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool LogCompress::decompress(const void *src, size_t srcLen,
+                             void *dst, size_t len) {
+    const uint8_t *ip = static_cast<const uint8_t *>(src);
+    const uint8_t *iend = ip + srcLen;
+    uint8_t *base = static_cast<uint8_t *>(dst);
+    uint8_t *op = base;
+    uint8_t *oend = base + len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if ((lit == 15) && !getLength(ip, iend, lit)) {
+            return false;
+        }
+        if ((lit > static_cast<size_t>(iend - ip))
+                || (lit > static_cast<size_t>(oend - op))) {
+            return false;
+        }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if (ip == iend) {
+            break;
+        }
+
+        if ((iend - ip) < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || (offset > static_cast<size_t>(op - base))) {
+            return false;
+        }
+
+        size_t match = token & 15;
+        if ((match == 15) && !getLength(ip, iend, match)) {
+            return false;
+        }
+        match += MIN_MATCH;
+        if (match > static_cast<size_t>(oend - op)) {
+            return false;
+        }
+
+        const uint8_t *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            // Overlapping, the match repeats the offset bytes
+            while (match--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op == oend;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_COMPRESS_H__
+#define _LOGD_LOG_COMPRESS_H__
+
+#include <stddef.h>
+
+// Byte oriented LZ77 codec for sealed log buffer chunks, in the spirit of
+// LZ4: no entropy coding, so that decompression in the reader path costs
+// little more than a memcpy. Inputs are limited to MAX_SOURCE bytes, which
+// keeps match offsets to 16 bits.
+class LogCompress {
+public:
+    static const size_t MAX_SOURCE = 64 * 1024 - 1;
+
+    // Returns the compressed length, or 0 if the result would not fit
+    // in capacity bytes.
+    static size_t compress(const void *src, size_t len,
+                           void *dst, size_t capacity);
+    // Returns false if src is corrupt or does not expand to exactly len
+    // bytes.
+    static bool decompress(const void *src, size_t srcLen,
+                           void *dst, size_t len);
+};
+
+#endif // _LOGD_LOG_COMPRESS_H__
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "LogFilter.h"
+
+LogFilter::LogFilter() : mDefaultPrio(ANDROID_LOG_VERBOSE) {
+}
+
+static int priorityFromChar(char c) {
+    switch (toupper(c)) {
+    case 'V': return ANDROID_LOG_VERBOSE;
+    case 'D': return ANDROID_LOG_DEBUG;
+    case 'I': return ANDROID_LOG_INFO;
+    case 'W': return ANDROID_LOG_WARN;
+    case 'E': return ANDROID_LOG_ERROR;
+    case 'F': return ANDROID_LOG_FATAL;
+    case 'S': return ANDROID_LOG_SILENT;
+    }
+    return ANDROID_LOG_UNKNOWN;
+}
+
+static bool isEnd(char c) {
+    return (c == '\0') || (c == ' ');
+}
+
+int LogFilter::init(const char *tags, const char *uids) {
+    while (tags && !isEnd(*tags)) {
+        const char *colon = tags;
+        while (!isEnd(*colon) && (*colon != ',') && (*colon != ':')) {
+            ++colon;
+        }
+        // A tag alone means all priorities, as for logcat
+        int prio = ANDROID_LOG_VERBOSE;
+        const char *cp = colon;
+        if (*cp == ':') {
+            prio = priorityFromChar(*++cp);
+            if (prio == ANDROID_LOG_UNKNOWN) {
+                goto invalid;
+            }
+            ++cp;
+        }
+        if ((colon == tags) || (!isEnd(*cp) && (*cp != ','))) {
+            goto invalid;
+        }
+
+        if (((colon - tags) == 1) && (*tags == '*')) {
+            mDefaultPrio = prio;
+        } else {
+            Rule rule;
+            rule.tag.assign(tags, colon - tags);
+            rule.prio = prio;
+            mRules.push_back(rule);
+        }
+
+        tags = (*cp == ',') ? cp + 1 : cp;
+    }
+
+    while (uids && !isEnd(*uids)) {
+        if (!isdigit(*uids)) {
+            goto invalid;
+        }
+        char *cp;
+        mUids.push_back(strtoul(uids, &cp, 10));
+        if (!isEnd(*cp) && (*cp != ',')) {
+            goto invalid;
+        }
+        uids = (*cp == ',') ? cp + 1 : cp;
+    }
+
+    return 0;
+
+invalid:
+    mRules.clear();
+    mUids.clear();
+    mDefaultPrio = ANDROID_LOG_VERBOSE;
+    return -EINVAL;
+}
+
+// Tags and priorities are taken as the reader would see them, chatty
+// summaries of expired records and the binary events at info.
+bool LogFilter::match(const LogBufferElement *element) const {
+    if (!mUids.empty() && (std::find(mUids.begin(), mUids.end(),
+                                     element->getUid()) == mUids.end())) {
+        return false;
+    }
+    if (mRules.empty() && (mDefaultPrio == ANDROID_LOG_VERBOSE)) {
+        return true;
+    }
+
+    int prio = ANDROID_LOG_INFO;
+    const char *tag;
+    size_t len;
+    if (element->getDropped()) {
+        tag = "chatty";
+        len = strlen(tag);
+    } else if (element->getLogId() == LOG_ID_EVENTS) {
+        tag = android::tagToName(element->getTag());
+        len = tag ? strlen(tag) : 0;
+    } else {
+        const char *msg = element->getMsg();
+        unsigned short msgLen = element->getMsgLen();
+        if (!msg || (msgLen < 1)) {
+            return mDefaultPrio == ANDROID_LOG_VERBOSE;
+        }
+        prio = msg[0];
+        tag = msg + 1;
+        len = strnlen(tag, msgLen - 1);
+    }
+
+    int threshold = mDefaultPrio;
+    for (std::vector<Rule>::const_iterator it = mRules.begin();
+            it != mRules.end(); ++it) {
+        if ((it->tag.length() == len) && !memcmp(it->tag.data(), tag, len)) {
+            threshold = it->prio;
+            break;
+        }
+    }
+    return prio >= threshold;
+}
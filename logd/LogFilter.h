@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_FILTER_H__
+#define _LOGD_LOG_FILTER_H__
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "LogBufferElement.h"
+
+// Tag, priority and uid selection that a reader pushes down to logd, so
+// that records it would discard are never formatted or sent. Tag rules
+// use the logcat filterspec syntax, comma separated, with "*" setting the
+// priority for all other tags:
+//
+//     filter=ActivityManager:I,MyApp:D,*:S uids=1000,10023
+class LogFilter {
+    struct Rule {
+        std::string tag;
+        int prio;
+    };
+
+    std::vector<Rule> mRules;
+    std::vector<uid_t> mUids;
+    int mDefaultPrio;
+
+public:
+    LogFilter();
+
+    // Each argument runs up to a space or the end of the string, NULL if
+    // absent. Returns -EINVAL, leaving the filter passing everything, if
+    // either is malformed.
+    int init(const char *tags, const char *uids);
+
+    bool enabled() const {
+        return !mRules.empty() || !mUids.empty()
+            || (mDefaultPrio != ANDROID_LOG_VERBOSE);
+    }
+    bool match(const LogBufferElement *element) const;
+};
+
+#endif // _LOGD_LOG_FILTER_H__
@@ -172,13 +172,15 @@ char *log_strtok_r(char *s, char **last) {
 
 log_time LogKlog::correction = log_time(CLOCK_REALTIME) - log_time(CLOCK_MONOTONIC);
 
-LogKlog::LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead, bool auditd) :
+LogKlog::LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead,
+                 bool auditd, bool records) :
         SocketListener(fdRead, false),
         logbuf(buf),
         reader(reader),
         signature(CLOCK_MONOTONIC),
         fdWrite(fdWrite),
         fdRead(fdRead),
+        records(records),
         initialized(false),
         enableLogging(true),
         auditd(auditd) {
@@ -193,7 +195,13 @@ bool LogKlog::onDataAvailable(SocketClient *cli) {
     if (!initialized) {
         prctl(PR_SET_NAME, "logd.klogd");
         initialized = true;
-        enableLogging = false;
+        // /dev/kmsg starts us at the oldest record, there is no
+        // KLOG_ACTION_READ_ALL pass to catch up with.
+        enableLogging = records;
+    }
+
+    if (records) {
+        return readRecords(cli->getSocket());
     }
 
     char buffer[LOGGER_ENTRY_MAX_PAYLOAD];
@@ -233,6 +241,101 @@ bool LogKlog::onDataAvailable(SocketClient *cli) {
 }
 
 
+// Each read() of /dev/kmsg returns one record, "<PRI>,<SEQ>,<USEC>,<FLAGS>;"
+// followed by the message and any "\n KEY=value" dictionary lines. The
+// records decoded per wakeup go into the log buffer as a batch, one lock
+// round trip and one reader notification for the lot, and the timestamp is
+// taken from the header rather than by parsing the text.
+bool LogKlog::readRecords(int fd) {
+    static const size_t KLOG_BATCH = 32;
+    LogBufferRecord batch[KLOG_BATCH];
+    size_t count = 0;
+    size_t logged = 0;
+    // CONSOLE_EXT_LOG_MAX, read() of a larger record fails with EINVAL
+    char buffer[8192];
+    int err = EAGAIN;
+
+    for (;;) {
+        ssize_t retval = read(fd, buffer, sizeof(buffer) - 1);
+        if (retval < 0) {
+            if ((errno == EPIPE) || (errno == EINTR)) {
+                // EPIPE: overwritten before we got to them, the next
+                // read() resumes at the oldest record
+                continue;
+            }
+            err = errno;
+            break;
+        }
+        if (retval == 0) {
+            break;
+        }
+        buffer[retval] = '\0';
+
+        if (parseRecord(batch[count], buffer) > 0) {
+            if (++count >= KLOG_BATCH) {
+                logged += flushRecords(batch, count);
+                count = 0;
+            }
+        }
+    }
+    logged += flushRecords(batch, count);
+
+    // notify readers
+    if (logged) {
+        reader->notifyNewLog();
+    }
+
+    // keep listening unless the device went away
+    return (err == EAGAIN) || (err == EWOULDBLOCK);
+}
+
+size_t LogKlog::flushRecords(LogBufferRecord *batch, size_t count) {
+    if (!count) {
+        return 0;
+    }
+    size_t logged = logbuf->log(batch, count);
+    for (size_t i = 0; i < count; ++i) {
+        free(const_cast<char *>(batch[i].msg));
+    }
+    return logged;
+}
+
+// Decode one /dev/kmsg record into record, returns as prepare()
+int LogKlog::parseRecord(LogBufferRecord &record, char *buf) {
+    char *cp;
+    int pri = strtol(buf, &cp, 10);
+    if (*cp != ',') {
+        return 0;
+    }
+    strtoull(cp + 1, &cp, 10); // sequence number, unused
+    if (*cp != ',') {
+        return 0;
+    }
+    unsigned long long usec = strtoull(cp + 1, &cp, 10);
+    cp = strchr(cp, ';');
+    if (!cp) {
+        return 0;
+    }
+    ++cp;
+    // The dictionary is escaped, the first newline ends the message
+    char *ep = strchr(cp, '\n');
+    if (ep) {
+        *ep = '\0';
+    }
+
+    if (auditd && strstr(cp, " audit(")) {
+        return 0;
+    }
+
+    log_time now;
+    now.tv_sec = usec / 1000000ULL;
+    now.tv_nsec = (usec % 1000000ULL) * 1000;
+    sniffCorrection(now, cp, false);
+    convertMonotonicToReal(now);
+
+    return prepare(record, pri, now, cp);
+}
+
 void LogKlog::calculateCorrection(const log_time &monotonic,
                                   const char *real_string) {
     log_time real;
@@ -254,41 +357,10 @@ void LogKlog::calculateCorrection(const log_time &monotonic,
 void LogKlog::sniffTime(log_time &now, const char **buf, bool reverse) {
     const char *cp;
     if ((cp = now.strptime(*buf, "[ %s.%q]"))) {
-        static const char suspend[] = "PM: suspend entry ";
-        static const char resume[] = "PM: suspend exit ";
-        static const char healthd[] = "healthd: battery ";
-        static const char suspended[] = "Suspended for ";
-
         if (isspace(*cp)) {
             ++cp;
         }
-        if (!strncmp(cp, suspend, sizeof(suspend) - 1)) {
-            calculateCorrection(now, cp + sizeof(suspend) - 1);
-        } else if (!strncmp(cp, resume, sizeof(resume) - 1)) {
-            calculateCorrection(now, cp + sizeof(resume) - 1);
-        } else if (!strncmp(cp, healthd, sizeof(healthd) - 1)) {
-            // look for " 2???-??-?? ??:??:??.????????? ???"
-            const char *tp;
-            for (tp = cp + sizeof(healthd) - 1; *tp && (*tp != '\n'); ++tp) {
-                if ((tp[0] == ' ') && (tp[1] == '2') && (tp[5] == '-')) {
-                    calculateCorrection(now, tp + 1);
-                    break;
-                }
-            }
-        } else if (!strncmp(cp, suspended, sizeof(suspended) - 1)) {
-            log_time real;
-            char *endp;
-            real.tv_sec = strtol(cp + sizeof(suspended) - 1, &endp, 10);
-            if (*endp == '.') {
-                real.tv_nsec = strtol(endp + 1, &endp, 10) * 1000000L;
-                if (reverse) {
-                    correction -= real;
-                } else {
-                    correction += real;
-                }
-            }
-        }
-
+        sniffCorrection(now, cp, reverse);
         convertMonotonicToReal(now);
         *buf = cp;
     } else {
@@ -296,6 +368,42 @@ void LogKlog::sniffTime(log_time &now, const char **buf, bool reverse) {
     }
 }
 
+// Follow the monotonic to realtime correction across suspend and resume
+// reports, now is the monotonic timestamp of the message at cp.
+void LogKlog::sniffCorrection(const log_time &now, const char *cp, bool reverse) {
+    static const char suspend[] = "PM: suspend entry ";
+    static const char resume[] = "PM: suspend exit ";
+    static const char healthd[] = "healthd: battery ";
+    static const char suspended[] = "Suspended for ";
+
+    if (!strncmp(cp, suspend, sizeof(suspend) - 1)) {
+        calculateCorrection(now, cp + sizeof(suspend) - 1);
+    } else if (!strncmp(cp, resume, sizeof(resume) - 1)) {
+        calculateCorrection(now, cp + sizeof(resume) - 1);
+    } else if (!strncmp(cp, healthd, sizeof(healthd) - 1)) {
+        // look for " 2???-??-?? ??:??:??.????????? ???"
+        const char *tp;
+        for (tp = cp + sizeof(healthd) - 1; *tp && (*tp != '\n'); ++tp) {
+            if ((tp[0] == ' ') && (tp[1] == '2') && (tp[5] == '-')) {
+                calculateCorrection(now, tp + 1);
+                break;
+            }
+        }
+    } else if (!strncmp(cp, suspended, sizeof(suspended) - 1)) {
+        log_time real;
+        char *endp;
+        real.tv_sec = strtol(cp + sizeof(suspended) - 1, &endp, 10);
+        if (*endp == '.') {
+            real.tv_nsec = strtol(endp + 1, &endp, 10) * 1000000L;
+            if (reverse) {
+                correction -= real;
+            } else {
+                correction += real;
+            }
+        }
+    }
+}
+
 pid_t LogKlog::sniffPid(const char *cp) {
     while (*cp) {
         // Mediatek kernels with modified printk
@@ -433,6 +541,32 @@ int LogKlog::log(const char *buf) {
     log_time now;
     sniffTime(now, &buf, false);
 
+    LogBufferRecord record;
+    int rc = prepare(record, pri, now, buf);
+    if (rc <= 0) {
+        return rc;
+    }
+
+    // Log message
+    rc = logbuf->log(record.log_id, record.realtime,
+                     record.uid, record.pid, record.tid,
+                     record.msg, record.len);
+    free(const_cast<char *>(record.msg));
+
+    // notify readers
+    if (rc > 0) {
+        reader->notifyNewLog();
+    }
+
+    return rc;
+}
+
+// Interpret the message following the <PRI>[<TIME>] prefix per the rules
+// above into record, with the payload in a malloc'd buffer the caller is to
+// free. Returns the payload length, 0 if there is nothing to log, or as
+// log() on error and for the signature.
+int LogKlog::prepare(LogBufferRecord &record, int pri,
+                     const log_time &now, const char *buf) {
     // sniff for start marker
     const char klogd_message[] = "logd.klogd: ";
     const char *start = strstr(buf, klogd_message);
@@ -456,7 +590,12 @@ int LogKlog::log(const char *buf) {
     // Parse pid, tid and uid
     const pid_t pid = sniffPid(buf);
     const pid_t tid = pid;
-    const uid_t uid = pid ? logbuf->pidToUid(pid) : 0;
+    uid_t uid = 0;
+    if (pid) {
+        logbuf->lock();
+        uid = logbuf->pidToUid(pid);
+        logbuf->unlock();
+    }
 
     // Parse (rules at top) to pull out a tag from the incoming kernel message.
     // Some may view the following as an ugly heuristic, the desire is to
@@ -633,15 +772,13 @@ int LogKlog::log(const char *buf) {
     strncpy(np, buf, b);
     np[b] = '\0';
 
-    // Log message
-    rc = logbuf->log(LOG_ID_KERNEL, now, uid, pid, tid, newstr,
-                     (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
-    free(newstr);
-
-    // notify readers
-    if (!rc) {
-        reader->notifyNewLog();
-    }
+    record.log_id = LOG_ID_KERNEL;
+    record.realtime = now;
+    record.uid = uid;
+    record.pid = pid;
+    record.tid = tid;
+    record.msg = newstr;
+    record.len = (n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
 
     return rc;
 }
@@ -28,7 +28,9 @@ class LogKlog : public SocketListener {
     LogReader *reader;
     const log_time signature;
     const int fdWrite; // /dev/kmsg
-    const int fdRead;  // /proc/kmsg
+    const int fdRead;  // /proc/kmsg, or /dev/kmsg if records
+    // fdRead hands us one structured record per read()
+    const bool records;
     // Set once thread is started, separates KLOG_ACTION_READ_ALL
     // and KLOG_ACTION_READ phases.
     bool initialized;
@@ -41,16 +43,24 @@ class LogKlog : public SocketListener {
     static log_time correction;
 
 public:
-    LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead, bool auditd);
+    LogKlog(LogBuffer *buf, LogReader *reader, int fdWrite, int fdRead,
+            bool auditd, bool records = false);
     int log(const char *buf);
     void synchronize(const char *buf);
+    bool readsRecords() const { return records; }
 
     static void convertMonotonicToReal(log_time &real) { real += correction; }
 
 protected:
     void sniffTime(log_time &now, const char **buf, bool reverse);
+    void sniffCorrection(const log_time &now, const char *buf, bool reverse);
     pid_t sniffPid(const char *buf);
     void calculateCorrection(const log_time &monotonic, const char *real_string);
+    int prepare(LogBufferRecord &record, int pri,
+                const log_time &now, const char *buf);
+    int parseRecord(LogBufferRecord &record, char *buf);
+    size_t flushRecords(LogBufferRecord *batch, size_t count);
+    bool readRecords(int fd);
     virtual bool onDataAvailable(SocketClient *cli);
 
 };
@@ -15,6 +15,7 @@
  */
 
 #include <limits.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -28,52 +29,44 @@
 
 #include "LogListener.h"
 
-LogListener::LogListener(LogBuffer *buf, LogReader *reader) :
+LogListener::LogListener(LogBuffer *buf, LogReader *reader,
+                         LogShmListener *rings) :
         SocketListener(getLogSocket(), false),
         logbuf(buf),
-        reader(reader) {
+        reader(reader),
+        rings(rings) {
 }
 
-bool LogListener::onDataAvailable(SocketClient *cli) {
-    static bool name_set;
-    if (!name_set) {
-        prctl(PR_SET_NAME, "logd.writer");
-        name_set = true;
-    }
-
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time)
-        + LOGGER_ENTRY_MAX_PAYLOAD];
-    struct iovec iov = { buffer, sizeof(buffer) };
-    memset(buffer, 0, sizeof(buffer));
+// Datagrams drained from the socket per wakeup
+static const size_t LOG_LISTENER_BATCH = 32;
 
-    char control[CMSG_SPACE(sizeof(struct ucred))];
-    struct msghdr hdr = {
-        NULL,
-        0,
-        &iov,
-        1,
-        control,
-        sizeof(control),
-        0,
-    };
-
-    int socket = cli->getSocket();
-
-    ssize_t n = recvmsg(socket, &hdr, 0);
-    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
-        return false;
-    }
+static const size_t LOG_LISTENER_BUFFER = sizeof_log_id_t + sizeof(uint16_t)
+    + sizeof(log_time) + LOGGER_ENTRY_MAX_PAYLOAD;
 
+// Validates a received datagram and fills in record, false if it is to be
+// dropped.
+static bool parseRecord(struct msghdr *hdr, char *buffer, ssize_t n,
+                        LogBufferRecord &record, LogMetrics &metrics) {
     struct ucred *cred = NULL;
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
     while (cmsg != NULL) {
-        if (cmsg->cmsg_level == SOL_SOCKET
-                && cmsg->cmsg_type  == SCM_CREDENTIALS) {
-            cred = (struct ucred *)CMSG_DATA(cmsg);
-            break;
+        if (cmsg->cmsg_level == SOL_SOCKET) {
+            if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+                cred = (struct ucred *)CMSG_DATA(cmsg);
+            } else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+                // Running total of datagrams the socket had no room for
+                uint32_t overflowed;
+                memcpy(&overflowed, CMSG_DATA(cmsg), sizeof(overflowed));
+                metrics.datagramsOverflowed.store(overflowed,
+                                                  memory_order_relaxed);
+            }
         }
-        cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        cmsg = CMSG_NXTHDR(hdr, cmsg);
+    }
+
+    if (n <= (ssize_t)(sizeof(android_log_header_t))) {
+        return false;
     }
 
     if (cred == NULL) {
@@ -92,15 +85,115 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
-    char *msg = ((char *)buffer) + sizeof(android_log_header_t);
+    // The buffer has room for this, the tag is always terminated
+    buffer[n] = '\0';
     n -= sizeof(android_log_header_t);
 
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // NB: hdr->msg_flags & MSG_TRUNC is not tested, silently passing a
     // truncated message to the logs.
 
-    if (logbuf->log((log_id_t)header->id, header->realtime,
-            cred->uid, cred->pid, header->tid, msg,
-            ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX) >= 0) {
+    record.log_id = (log_id_t)header->id;
+    record.realtime = header->realtime;
+    record.uid = cred->uid;
+    record.pid = cred->pid;
+    record.tid = header->tid;
+    record.msg = buffer + sizeof(android_log_header_t);
+    record.len = ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
+    return true;
+}
+
+bool LogListener::takeRing(struct msghdr *hdr, const char *buffer, ssize_t n) {
+    struct ucred *cred = NULL;
+    int fds[2];
+    size_t nfds = 0;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+            cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET) {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_CREDENTIALS) {
+            cred = (struct ucred *)CMSG_DATA(cmsg);
+        } else if (cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                if (nfds < (sizeof(fds) / sizeof(fds[0]))) {
+                    fds[nfds++] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+    }
+    if (!nfds) {
+        return false;
+    }
+
+    android_log_ring_register_t reg;
+    if (rings && cred && (nfds == 2) && (n == (ssize_t)sizeof(reg))) {
+        memcpy(&reg, buffer, sizeof(reg));
+        if (reg.magic == LOGGER_RING_MAGIC) {
+            rings->registerRing(fds[0], fds[1], reg.size, *cred);
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < nfds; ++i) {
+        close(fds[i]);
+    }
+    return true;
+}
+
+bool LogListener::onDataAvailable(SocketClient *cli) {
+    static bool name_set;
+    if (!name_set) {
+        prctl(PR_SET_NAME, "logd.writer");
+        name_set = true;
+    }
+
+    // Only ever used from the logd.writer thread
+    static char buffer[LOG_LISTENER_BATCH][LOG_LISTENER_BUFFER + 1];
+    static char control[LOG_LISTENER_BATCH][CMSG_SPACE(sizeof(struct ucred))
+                                            + CMSG_SPACE(sizeof(uint32_t))
+                                            + CMSG_SPACE(sizeof(int) * 2)];
+
+    struct iovec iov[LOG_LISTENER_BATCH];
+    struct mmsghdr hdr[LOG_LISTENER_BATCH];
+    memset(hdr, 0, sizeof(hdr));
+    for (size_t i = 0; i < LOG_LISTENER_BATCH; ++i) {
+        iov[i].iov_base = buffer[i];
+        iov[i].iov_len = LOG_LISTENER_BUFFER;
+        hdr[i].msg_hdr.msg_iov = &iov[i];
+        hdr[i].msg_hdr.msg_iovlen = 1;
+        hdr[i].msg_hdr.msg_control = control[i];
+        hdr[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    int socket = cli->getSocket();
+
+    // Take whatever has queued up, poll() said there is at least one
+    int n = recvmmsg(socket, hdr, LOG_LISTENER_BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+        return false;
+    }
+
+    LogBufferRecord records[LOG_LISTENER_BATCH];
+    size_t count = 0;
+    for (int i = 0; i < n; ++i) {
+        if (takeRing(&hdr[i].msg_hdr, buffer[i], hdr[i].msg_len)) {
+            continue;
+        }
+        if (parseRecord(&hdr[i].msg_hdr, buffer[i], hdr[i].msg_len,
+                        records[count], logbuf->metrics())) {
+            ++count;
+        } else {
+            logbuf->metrics().datagramsRejected.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    if (count && logbuf->log(records, count)) {
         reader->notifyNewLog();
     }
 
@@ -121,5 +214,7 @@ int LogListener::getLogSocket() {
     if (setsockopt(sock, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) < 0) {
         return -1;
     }
+    // Only feeds the metrics, not fatal if unsupported
+    setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
     return sock;
 }
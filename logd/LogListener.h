@@ -19,19 +19,23 @@
 
 #include <sysutils/SocketListener.h>
 #include "LogReader.h"
+#include "LogShmListener.h"
 
 class LogListener : public SocketListener {
     LogBuffer *logbuf;
     LogReader *reader;
+    LogShmListener *rings;
 
 public:
-    LogListener(LogBuffer *buf, LogReader *reader);
+    LogListener(LogBuffer *buf, LogReader *reader, LogShmListener *rings = NULL);
 
 protected:
     virtual bool onDataAvailable(SocketClient *cli);
 
 private:
     static int getLogSocket();
+    // True if the datagram passed descriptors, a ring registration
+    bool takeRing(struct msghdr *hdr, const char *buffer, ssize_t n);
 };
 
 #endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "LogMetrics.h"
+
+LogHistogram::LogHistogram() : mSum(0) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        atomic_init(&mBuckets[i], 0);
+    }
+}
+
+void LogHistogram::add(uint64_t value) {
+    size_t bucket = 0;
+    while ((bucket < (BUCKETS - 1)) && (value >= (1ULL << bucket))) {
+        ++bucket;
+    }
+    mBuckets[bucket].fetch_add(1, memory_order_relaxed);
+    mSum.fetch_add(value, memory_order_relaxed);
+}
+
+void LogHistogram::format(android::String8 &output, const char *name) const {
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        counts[i] = mBuckets[i].load(memory_order_relaxed);
+        total += counts[i];
+    }
+
+    output.appendFormat("%-22s%10llu", name, (unsigned long long) total);
+    if (!total) {
+        output.appendFormat("\n");
+        return;
+    }
+    output.appendFormat("%10llu", (unsigned long long)
+                        (mSum.load(memory_order_relaxed) / total));
+
+    static const unsigned percentiles[] = { 50, 90, 99, 100 };
+    size_t bucket = 0;
+    uint64_t seen = counts[0];
+    for (size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); ++p) {
+        uint64_t want = (total * percentiles[p] + 99) / 100;
+        while ((seen < want) && (bucket < (BUCKETS - 1))) {
+            seen += counts[++bucket];
+        }
+        char bound[24];
+        snprintf(bound, sizeof(bound), "<%llu",
+                 (unsigned long long) (1ULL << bucket));
+        output.appendFormat("%10s", bound);
+    }
+    output.appendFormat("\n");
+}
+
+LogMetrics::LogMetrics() :
+        datagramsRejected(0),
+        datagramsOverflowed(0) {
+}
+
+void LogMetrics::format(char **strp) const {
+    android::String8 output("Histograms of logd internals, times in usec:\n");
+    output.appendFormat("%-22s%10s%10s%10s%10s%10s%10s\n",
+                        "", "count", "mean", "p50", "p90", "p99", "max");
+    ingestLatency.format(output, "ingest latency");
+    lockWait.format(output, "lock wait");
+    pruneTime.format(output, "prune time");
+    pruneScanned.format(output, "prune scanned");
+    flushTime.format(output, "reader flush time");
+    flushBacklog.format(output, "reader backlog");
+    output.appendFormat("\nDatagrams rejected %llu, overflowed %llu\n",
+                        (unsigned long long)
+                            datagramsRejected.load(memory_order_relaxed),
+                        (unsigned long long)
+                            datagramsOverflowed.load(memory_order_relaxed));
+
+    *strp = strdup(output.string());
+}
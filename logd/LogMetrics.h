@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_METRICS_H__
+#define _LOGD_LOG_METRICS_H__
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <utils/String8.h>
+
+// Power of two bucketed histogram. Updates are a relaxed atomic add, so
+// it may be fed from any thread on the hot paths without a lock; readers
+// just see a slightly moving picture.
+class LogHistogram {
+    // Bucket i counts values below 2^i, and at least 2^(i-1) for i > 0
+    static const size_t BUCKETS = 32;
+    atomic_uint_fast64_t mBuckets[BUCKETS];
+    atomic_uint_fast64_t mSum;
+
+    // not copyable
+    LogHistogram(const LogHistogram &);
+    LogHistogram &operator=(const LogHistogram &);
+
+public:
+    LogHistogram();
+
+    void add(uint64_t value);
+
+    // One row: count, mean, then the bucket bounds of p50, p90, p99 and max
+    void format(android::String8 &output, const char *name) const;
+};
+
+// logd internals, reported by the getMetrics command. Times are in
+// microseconds.
+struct LogMetrics {
+    LogHistogram ingestLatency;   // record realtime to LogBuffer::log()
+    LogHistogram lockWait;        // contended mLogElementsLock acquisitions
+    LogHistogram pruneTime;       // per LogBuffer::prune() call
+    LogHistogram pruneScanned;    // records visited per prune() call
+    LogHistogram flushTime;       // per reader flushTo() pass
+    LogHistogram flushBacklog;    // records a reader is behind at wakeup
+    atomic_uint_fast64_t datagramsRejected; // malformed or uncredentialed
+    atomic_uint_fast64_t datagramsOverflowed; // dropped by the socket
+
+    LogMetrics();
+
+    static uint64_t nsec() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+    }
+
+    // *strp uses malloc, use free to release.
+    void format(char **strp) const;
+};
+
+#endif // _LOGD_LOG_METRICS_H__
@@ -18,24 +18,93 @@
 #include <poll.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
+#include <cutils/properties.h>
 #include <cutils/sockets.h>
 
 #include "LogReader.h"
 #include "FlushCommand.h"
 
+// Default milliseconds over which new log notifications are coalesced
+#define LOG_READER_LATENCY 5
+
 LogReader::LogReader(LogBuffer *logbuf) :
         SocketListener(getLogSocket(), true),
-        mLogbuf(*logbuf) {
+        mLogbuf(*logbuf),
+        mNotifyPending(false) {
+    int32_t latency = property_get_int32("logd.reader.latency",
+                                         LOG_READER_LATENCY);
+    mLatency = (latency > 0) ? latency : 0;
+
+    pthread_mutex_init(&mNotifyLock, NULL);
+    pthread_cond_init(&mNotifyCondition, NULL);
+
+    if (mLatency) {
+        pthread_attr_t attr;
+        if (!pthread_attr_init(&attr)) {
+            if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)
+                    || pthread_create(&mNotifyThread, &attr,
+                                      LogReader::notifyThread, this)) {
+                // Fall back to waking the readers on every log
+                mLatency = 0;
+            }
+            pthread_attr_destroy(&attr);
+        } else {
+            mLatency = 0;
+        }
+    }
 }
 
 // When we are notified a new log entry is available, inform
 // all of our listening sockets.
 void LogReader::notifyNewLog() {
+    if (!mLatency) {
+        notifyReaders();
+        return;
+    }
+
+    pthread_mutex_lock(&mNotifyLock);
+    if (!mNotifyPending) {
+        mNotifyPending = true;
+        pthread_cond_signal(&mNotifyCondition);
+    }
+    pthread_mutex_unlock(&mNotifyLock);
+}
+
+void LogReader::notifyReaders() {
     FlushCommand command(*this);
     runOnEachSocket(&command);
 }
 
+void *LogReader::notifyThread(void *obj) {
+    prctl(PR_SET_NAME, "logd.reader.ntf");
+
+    LogReader *me = reinterpret_cast<LogReader *>(obj);
+
+    pthread_mutex_lock(&me->mNotifyLock);
+    for (;;) {
+        while (!me->mNotifyPending) {
+            pthread_cond_wait(&me->mNotifyCondition, &me->mNotifyLock);
+        }
+        pthread_mutex_unlock(&me->mNotifyLock);
+
+        // Let the rest of the burst arrive
+        usleep(me->mLatency * 1000);
+
+        // Logs arriving from here on call for another round
+        pthread_mutex_lock(&me->mNotifyLock);
+        me->mNotifyPending = false;
+        pthread_mutex_unlock(&me->mNotifyLock);
+
+        me->notifyReaders();
+
+        pthread_mutex_lock(&me->mNotifyLock);
+    }
+
+    return NULL;
+}
+
 bool LogReader::onDataAvailable(SocketClient *cli) {
     static bool name_set;
     if (!name_set) {
@@ -43,7 +112,7 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         name_set = true;
     }
 
-    char buffer[255];
+    char buffer[1024];
 
     int len = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
     if (len <= 0) {
@@ -94,6 +163,15 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         pid = atol(cp + sizeof(_pid) - 1);
     }
 
+    // Malformed filters are ignored, the reader filters for itself anyway
+    static const char _filter[] = " filter=";
+    static const char _uids[] = " uids=";
+    const char *tags = strstr(buffer, _filter);
+    const char *uids = strstr(buffer, _uids);
+    LogFilter filter;
+    filter.init(tags ? tags + sizeof(_filter) - 1 : NULL,
+                uids ? uids + sizeof(_uids) - 1 : NULL);
+
     bool nonBlock = false;
     if (strncmp(buffer, "dumpAndClose", 12) == 0) {
         // Allow writer to get some cycles, and wait for pending notifications
@@ -107,18 +185,23 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     uint64_t sequence = 1;
     // Convert realtime to sequence number
     if (start != log_time::EPOCH) {
+        sequence = logbuf().seekTime(start, logMask);
+
         class LogFindStart {
             const pid_t mPid;
             const unsigned mLogMask;
+            const LogFilter &mFilter;
             bool startTimeSet;
             log_time &start;
             uint64_t &sequence;
             uint64_t last;
 
         public:
-            LogFindStart(unsigned logMask, pid_t pid, log_time &start, uint64_t &sequence) :
+            LogFindStart(unsigned logMask, pid_t pid, const LogFilter &filter,
+                         log_time &start, uint64_t &sequence) :
                     mPid(pid),
                     mLogMask(logMask),
+                    mFilter(filter),
                     startTimeSet(false),
                     start(start),
                     sequence(sequence),
@@ -128,7 +211,8 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
             static int callback(const LogBufferElement *element, void *obj) {
                 LogFindStart *me = reinterpret_cast<LogFindStart *>(obj);
                 if ((!me->mPid || (me->mPid == element->getPid()))
-                        && (me->mLogMask & (1 << element->getLogId()))) {
+                        && (me->mLogMask & (1 << element->getLogId()))
+                        && (!me->mFilter.enabled() || me->mFilter.match(element))) {
                     if (me->start == element->getRealTime()) {
                         me->sequence = element->getSequence();
                         me->startTimeSet = true;
@@ -146,10 +230,10 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
             }
 
             bool found() { return startTimeSet; }
-        } logFindStart(logMask, pid, start, sequence);
+        } logFindStart(logMask, pid, filter, start, sequence);
 
         logbuf().flushTo(cli, sequence, FlushCommand::hasReadLogs(cli),
-                         logFindStart.callback, &logFindStart);
+                         logFindStart.callback, &logFindStart, logMask);
 
         if (!logFindStart.found()) {
             if (nonBlock) {
@@ -160,7 +244,7 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         }
     }
 
-    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence);
+    FlushCommand command(*this, nonBlock, tail, logMask, pid, sequence, &filter);
     command.runSocketCommand(cli);
     return true;
 }
@@ -17,6 +17,8 @@
 #ifndef _LOGD_LOG_WRITER_H__
 #define _LOGD_LOG_WRITER_H__
 
+#include <pthread.h>
+
 #include <sysutils/SocketListener.h>
 #include "LogBuffer.h"
 #include "LogTimes.h"
@@ -24,6 +26,15 @@
 class LogReader : public SocketListener {
     LogBuffer &mLogbuf;
 
+    // notifyNewLog() only flags new logs, notifyThread() wakes the
+    // readers at most once per mLatency milliseconds so that a burst of
+    // log lines costs each reader a single wakeup.
+    unsigned int mLatency;
+    bool mNotifyPending;
+    pthread_mutex_t mNotifyLock;
+    pthread_cond_t mNotifyCondition;
+    pthread_t mNotifyThread;
+
 public:
     LogReader(LogBuffer *logbuf);
     void notifyNewLog();
@@ -35,6 +46,8 @@ protected:
 
 private:
     static int getLogSocket();
+    static void *notifyThread(void *obj);
+    void notifyReaders();
 
     void doSocketDelete(SocketClient *cli);
 
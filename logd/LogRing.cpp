@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/user.h>
+#include <unistd.h>
+
+#include <log/logger.h>
+#include <private/android_logger.h>
+
+#include "LogRing.h"
+
+const char LogRing::RING_FILE[] = "/data/misc/logd_ring/ring";
+const char LogRing::LAST_FILE[] = "/data/misc/logd_ring/ring.last";
+
+#define LOG_RING_MAGIC 0x676e6952 // "Ring"
+#define LOG_RING_RETRY 10         // seconds between attempts to open the ring
+
+// Records live in [head, mEnd) followed by [0, tail) once wrapped, or
+// in [head, tail) if not. head, tail and the wrapped flag share mState
+// so that they change together in a single store.
+struct LogRing::Header {
+    uint32_t mMagic;
+    uint32_t mSize;         // of the record area
+    uint32_t mEnd;          // end of the records before the wrap
+    uint32_t mReserved;
+    uint64_t mState;
+
+    static const uint64_t WRAPPED = 1ULL << 63;
+
+    static uint64_t state(uint32_t head, uint32_t tail, bool wrapped) {
+        return (wrapped ? WRAPPED : 0) | ((uint64_t)head << 32) | tail;
+    }
+    static uint32_t head(uint64_t state) { return (state & ~WRAPPED) >> 32; }
+    static uint32_t tail(uint64_t state) { return state; }
+    static bool wrapped(uint64_t state) { return state & WRAPPED; }
+
+    void publish(uint32_t head, uint32_t tail, bool wrapped) {
+        __atomic_store_n(&mState, state(head, tail, wrapped), __ATOMIC_RELEASE);
+    }
+};
+
+struct __attribute__((__packed__)) LogRingRecord {
+    android_pmsg_log_header_t p;
+    android_log_header_t l;
+};
+
+LogRing::LogRing() :
+        mHeader(NULL),
+        mData(NULL),
+        mSize(0),
+        mRetry(0),
+        mUnrolled(false) {
+    pthread_mutex_init(&mLock, NULL);
+}
+
+LogRing::~LogRing() {
+    close();
+    pthread_mutex_destroy(&mLock);
+}
+
+void LogRing::setSize(size_t size) {
+    pthread_mutex_lock(&mLock);
+    if (size != mSize) {
+        // Takes effect on the next open, modulo the page rounding
+        close();
+        mSize = size;
+        mRetry = 0;
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+static bool writeAll(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(fd, buf, len));
+        if (ret <= 0) {
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+// Copy the contents of a mapped ring left by our predecessor into
+// LAST_FILE, oldest first.
+void LogRing::unroll(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) || (st.st_size < (off_t)sizeof(Header))) {
+        return;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    const Header *h = static_cast<const Header *>(map);
+    const char *data = static_cast<const char *>(map) + sizeof(Header);
+    size_t size = st.st_size - sizeof(Header);
+    uint64_t state = h->mState;
+    uint32_t head = Header::head(state);
+    uint32_t tail = Header::tail(state);
+    if ((h->mMagic == LOG_RING_MAGIC) && (h->mSize <= size)
+            && (head <= h->mSize) && (tail <= h->mSize)
+            && (h->mEnd <= h->mSize)) {
+        int last = TEMP_FAILURE_RETRY(::open(LAST_FILE,
+            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640));
+        if (last >= 0) {
+            bool ok;
+            if (Header::wrapped(state)) {
+                ok = (head <= h->mEnd) && (tail <= head)
+                    && writeAll(last, data + head, h->mEnd - head)
+                    && writeAll(last, data, tail);
+            } else {
+                ok = (head <= tail)
+                    && writeAll(last, data + head, tail - head);
+            }
+            ::close(last);
+            if (!ok) {
+                unlink(LAST_FILE);
+            }
+        }
+    }
+
+    munmap(map, st.st_size);
+}
+
+// mLock must be held when calling this function.
+bool LogRing::open() {
+    int fd = TEMP_FAILURE_RETRY(::open(RING_FILE,
+        O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0640));
+    if (fd < 0) {
+        return false;
+    }
+
+    // Only what our predecessor left, not our own ring on a resize
+    if (!mUnrolled) {
+        unroll(fd);
+        mUnrolled = true;
+    }
+
+    size_t len = (sizeof(Header) + mSize + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (ftruncate(fd, len)) {
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    mHeader = static_cast<Header *>(map);
+    mData = static_cast<char *>(map) + sizeof(Header);
+    mHeader->mMagic = 0;
+    __sync_synchronize();
+    mHeader->mSize = len - sizeof(Header);
+    mHeader->mEnd = 0;
+    mHeader->mReserved = 0;
+    mHeader->publish(0, 0, false);
+    __sync_synchronize();
+    mHeader->mMagic = LOG_RING_MAGIC;
+    return true;
+}
+
+// mLock must be held when calling this function.
+void LogRing::close() {
+    if (mHeader) {
+        munmap(mHeader, sizeof(Header) + mHeader->mSize);
+        mHeader = NULL;
+        mData = NULL;
+    }
+}
+
+void LogRing::log(log_id_t log_id, log_time realtime,
+                  uid_t uid, pid_t pid, pid_t tid,
+                  const char *msg, unsigned short len) {
+    size_t size = sizeof(LogRingRecord) + len;
+    if (!mSize || (size > (sizeof(LogRingRecord) + LOGGER_ENTRY_MAX_PAYLOAD))) {
+        return;
+    }
+
+    pthread_mutex_lock(&mLock);
+
+    if (!mHeader) {
+        time_t now = time(NULL);
+        if (!mSize || (now < mRetry) || !open()) {
+            if (now >= mRetry) {
+                mRetry = now + LOG_RING_RETRY;
+            }
+            pthread_mutex_unlock(&mLock);
+            return;
+        }
+    }
+
+    Header *h = mHeader;
+    uint64_t state = h->mState;
+    uint32_t head = Header::head(state);
+    uint32_t tail = Header::tail(state);
+    bool wrapped = Header::wrapped(state);
+
+    // Make room, dropping the oldest records
+    for (;;) {
+        if (!wrapped) {
+            if ((tail + size) <= h->mSize) {
+                break;
+            }
+            if (head == tail) {
+                // Empty, start over at the beginning
+                head = tail = 0;
+                continue;
+            }
+            // Only consulted once wrapped
+            h->mEnd = tail;
+            tail = 0;
+            wrapped = true;
+            continue;
+        }
+        if ((tail + size) <= head) {
+            break;
+        }
+        const LogRingRecord *oldest =
+            reinterpret_cast<const LogRingRecord *>(mData + head);
+        head += oldest->p.len;
+        if (head >= h->mEnd) {
+            head = 0;
+            wrapped = false;
+            // Before mEnd may be reused
+            h->publish(head, tail, wrapped);
+        }
+    }
+    // The space we are about to write over is no longer part of the ring
+    h->publish(head, tail, wrapped);
+
+    LogRingRecord record;
+    record.p.magic = LOGGER_MAGIC;
+    record.p.len = size;
+    record.p.uid = uid;
+    record.p.pid = pid;
+    record.l.id = log_id;
+    record.l.tid = tid;
+    record.l.realtime = realtime;
+    memcpy(mData + tail, &record, sizeof(record));
+    memcpy(mData + tail + sizeof(record), msg, len);
+
+    h->publish(head, tail + size, wrapped);
+
+    pthread_mutex_unlock(&mLock);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_RING_H__
+#define _LOGD_LOG_RING_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <log/log.h>
+#include <log/log_read.h>
+
+// Persistent copy of the logs in a memory mapped ring file, so that what
+// led up to a reboot or a logd crash survives it without a logcat -f
+// process formatting every line. Records are kept in the pmsg pstore
+// format; when logd next opens the ring it first unrolls the previous
+// contents, oldest first, into LAST_FILE which liblog reads with the
+// ANDROID_LOG_PSTORE mode when there is no pmsg pstore.
+//
+// The header is always updated to exclude space before it is written
+// over, and to include a record only once it is complete, so a crash at
+// any point leaves a consistent ring behind.
+class LogRing {
+    struct Header;
+
+    pthread_mutex_t mLock;
+    Header *mHeader;        // start of the mapping, NULL if not open
+    char *mData;            // record area following the header
+    size_t mSize;           // requested size of the ring, 0 if disabled
+    time_t mRetry;          // when to next try opening the ring
+    bool mUnrolled;         // LAST_FILE written
+
+    void unroll(int fd);
+    bool open();
+    void close();
+
+    // not copyable
+    LogRing(const LogRing &);
+    LogRing &operator=(const LogRing &);
+
+public:
+    static const char RING_FILE[];
+    static const char LAST_FILE[];
+
+    LogRing();
+    ~LogRing();
+
+    // 0 disables. The ring is opened on the next log() once /data is up.
+    void setSize(size_t size);
+
+    void log(log_id_t log_id, log_time realtime,
+             uid_t uid, pid_t pid, pid_t tid,
+             const char *msg, unsigned short len);
+};
+
+#endif // _LOGD_LOG_RING_H__
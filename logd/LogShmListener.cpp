@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/ashmem.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <log/logger.h>
+#include <private/android_filesystem_config.h>
+
+#include "LogShmListener.h"
+
+LogShmListener::LogShmListener(LogBuffer *buf, LogReader *reader) :
+        logbuf(buf),
+        reader(reader),
+        mCount(0),
+        mWakeup(-1) {
+    pthread_mutex_init(&mLock, NULL);
+}
+
+int LogShmListener::startListener() {
+    mWakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (mWakeup < 0) {
+        return -1;
+    }
+
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr)) {
+        return -1;
+    }
+    int ret = 0;
+    if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)
+            || pthread_create(&mThread, &attr, LogShmListener::threadStart, this)) {
+        close(mWakeup);
+        mWakeup = -1;
+        ret = -1;
+    }
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+void LogShmListener::registerRing(int fd, int doorbell, size_t size,
+                                  const struct ucred &cred) {
+    Ring r;
+    r.ring = NULL;
+    r.doorbell = doorbell;
+    r.uid = cred.uid;
+    r.pid = cred.pid;
+    r.size = size;
+    r.tail = 0;
+    r.mapped = sizeof(android_log_ring_t) + size;
+
+    // Only ashmem, which can not be shrunk from under our mapping
+    int ashmem = ioctl(fd, ASHMEM_GET_SIZE, NULL);
+
+    bool ok = (mWakeup >= 0)
+        && (cred.uid != AID_LOGD)
+        && (size >= LOGGER_RING_MIN) && (size <= LOGGER_RING_MAX)
+        && !(size & (size - 1))
+        && (ashmem >= 0) && ((size_t)ashmem >= r.mapped);
+    if (ok) {
+        void *map = mmap(NULL, r.mapped, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            r.ring = reinterpret_cast<android_log_ring_t *>(map);
+            r.data = reinterpret_cast<char *>(r.ring + 1);
+        }
+        ok = r.ring
+            && (__atomic_load_n(&r.ring->magic, __ATOMIC_ACQUIRE) == LOGGER_RING_MAGIC)
+            && (r.ring->size == size)
+            && !r.ring->tail;
+    }
+    close(fd);
+
+    if (ok) {
+        pthread_mutex_lock(&mLock);
+        ok = mCount < MAX_RINGS;
+        if (ok) {
+            ++mCount;
+            mPending.push_back(r);
+        }
+        pthread_mutex_unlock(&mLock);
+    }
+
+    if (!ok) {
+        if (r.ring) {
+            munmap(r.ring, r.mapped);
+        }
+        close(doorbell);
+        return;
+    }
+
+    uint64_t one = 1;
+    write(mWakeup, &one, sizeof(one));
+
+    // The acknowledgement, the process waits for it before using the ring
+    fcntl(doorbell, F_SETFL, O_NONBLOCK);
+    char c = 0;
+    send(doorbell, &c, sizeof(c), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+void LogShmListener::release(Ring &r) {
+    munmap(r.ring, r.mapped);
+    close(r.doorbell);
+
+    pthread_mutex_lock(&mLock);
+    --mCount;
+    pthread_mutex_unlock(&mLock);
+}
+
+// The process can scribble over the ring at any time, so every length is
+// taken once into a local and checked before use, and nothing is read
+// back from the ring after the checks.
+ssize_t LogShmListener::drain(Ring &r) {
+    const uint32_t mask = r.size - 1;
+    uint32_t tail = r.tail;
+    uint32_t head = __atomic_load_n(&r.ring->head, __ATOMIC_ACQUIRE);
+
+    if ((head - tail) > r.size) {
+        return -1;
+    }
+
+    LogBufferRecord records[DRAIN_BATCH];
+    size_t count = 0;
+
+    while ((tail != head) && (count < DRAIN_BATCH)) {
+        uint32_t off = tail & mask;
+        uint32_t contig = r.size - off;
+        uint16_t len;
+
+        if (contig < sizeof(len)) {
+            tail += contig;
+            continue;
+        }
+        memcpy(&len, r.data + off, sizeof(len));
+        if (len == LOGGER_RING_PAD) {
+            tail += contig;
+            continue;
+        }
+        if ((len <= sizeof(android_log_header_t))
+                || ((sizeof(len) + len) > contig)
+                || ((sizeof(len) + len) > (head - tail))) {
+            return -1;
+        }
+
+        android_log_header_t header;
+        memcpy(&header, r.data + off + sizeof(len), sizeof(header));
+        size_t n = len - sizeof(header);
+        tail += sizeof(len) + len;
+
+        if ((header.id >= LOG_ID_MAX) || (header.id == LOG_ID_KERNEL)
+                || (n > LOGGER_ENTRY_MAX_PAYLOAD)) {
+            logbuf->metrics().datagramsRejected.fetch_add(1, memory_order_relaxed);
+            continue;
+        }
+
+        LogBufferRecord &record = records[count++];
+        record.log_id = (log_id_t)header.id;
+        record.realtime = header.realtime;
+        record.uid = r.uid;
+        record.pid = r.pid;
+        record.tid = header.tid;
+        record.msg = r.data + off + sizeof(len) + sizeof(header);
+        record.len = n;
+    }
+
+    size_t logged = count ? logbuf->log(records, count) : 0;
+
+    // Only now, the records pointed into the ring until logged
+    r.tail = tail;
+    __atomic_store_n(&r.ring->tail, tail, __ATOMIC_RELEASE);
+
+    return logged;
+}
+
+bool LogShmListener::empty(const Ring &r) {
+    return r.tail == __atomic_load_n(&r.ring->head, __ATOMIC_SEQ_CST);
+}
+
+void *LogShmListener::threadStart(void *obj) {
+    prctl(PR_SET_NAME, "logd.shm");
+
+    LogShmListener *me = reinterpret_cast<LogShmListener *>(obj);
+    std::vector<struct pollfd> fds;
+
+    for (;;) {
+        // Serve each ring a batch at a time until all are empty
+        bool busy;
+        do {
+            busy = false;
+            size_t logged = 0;
+            for (size_t i = 0; i < me->mRings.size(); ) {
+                Ring &r = me->mRings[i];
+                ssize_t ret = me->drain(r);
+                if (ret < 0) {
+                    me->release(r);
+                    me->mRings.erase(me->mRings.begin() + i);
+                    continue;
+                }
+                logged += ret;
+                if (!empty(r)) {
+                    busy = true;
+                }
+                ++i;
+            }
+            if (logged) {
+                me->reader->notifyNewLog();
+            }
+        } while (busy);
+
+        // Arm the doorbells, then check for records we might have missed
+        for (size_t i = 0; i < me->mRings.size(); ++i) {
+            Ring &r = me->mRings[i];
+            __atomic_store_n(&r.ring->waiting, 1, __ATOMIC_SEQ_CST);
+            if (!empty(r)) {
+                busy = true;
+            }
+        }
+        if (busy) {
+            continue;
+        }
+
+        fds.resize(me->mRings.size() + 1);
+        fds[0].fd = me->mWakeup;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (size_t i = 0; i < me->mRings.size(); ++i) {
+            fds[i + 1].fd = me->mRings[i].doorbell;
+            fds[i + 1].events = POLLIN;
+            fds[i + 1].revents = 0;
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            continue;
+        }
+
+        // Gone processes get a last drain, then the ring is dropped
+        for (size_t i = me->mRings.size(); i > 0; --i) {
+            short revents = fds[i].revents;
+            Ring &r = me->mRings[i - 1];
+            if (revents & POLLIN) {
+                char buffer[64];
+                while (recv(r.doorbell, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+            }
+            if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                // Bounded, the process could be writing still
+                size_t logged = 0;
+                ssize_t ret;
+                for (size_t passes = r.size / DRAIN_BATCH;
+                        passes && !empty(r) && ((ret = me->drain(r)) >= 0);
+                        --passes) {
+                    logged += ret;
+                }
+                if (logged) {
+                    me->reader->notifyNewLog();
+                }
+                me->release(r);
+                me->mRings.erase(me->mRings.begin() + (i - 1));
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t value;
+            read(me->mWakeup, &value, sizeof(value));
+            pthread_mutex_lock(&me->mLock);
+            me->mRings.insert(me->mRings.end(), me->mPending.begin(), me->mPending.end());
+            me->mPending.clear();
+            pthread_mutex_unlock(&me->mLock);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_SHM_LISTENER_H__
+#define _LOGD_LOG_SHM_LISTENER_H__
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <private/android_logger.h>
+
+#include "LogReader.h"
+
+// Drains the shared memory rings writer processes register through the
+// logdw socket (see android_logger.h) into the LogBuffer, on a thread of
+// its own. Records are attributed to the credentials the ring was
+// registered with, whatever the writer puts in the ring.
+class LogShmListener {
+    // Bound on the processes logging through a ring
+    static const size_t MAX_RINGS = 64;
+    // Records taken from a ring per pass, the rings are served in turn
+    static const size_t DRAIN_BATCH = 32;
+
+    struct Ring {
+        android_log_ring_t *ring;
+        char *data;
+        size_t size;     // bytes of ring data, as registered
+        uint32_t tail;   // ours, the copy in the ring is for the process
+        size_t mapped;
+        int doorbell;
+        uid_t uid;
+        pid_t pid;
+    };
+
+    LogBuffer *logbuf;
+    LogReader *reader;
+
+    pthread_mutex_t mLock;
+    std::vector<Ring> mPending; // registered, not yet picked up by the thread
+    size_t mCount;              // rings registered all told
+    int mWakeup;                // eventfd, kicks the thread for mPending
+    pthread_t mThread;
+
+    std::vector<Ring> mRings;   // only touched by the thread
+
+    // Returns the records logged, -1 if the ring is corrupt
+    ssize_t drain(Ring &r);
+    static bool empty(const Ring &r);
+    void release(Ring &r);
+    static void *threadStart(void *me);
+
+public:
+    LogShmListener(LogBuffer *buf, LogReader *reader);
+
+    int startListener();
+
+    // Takes ownership of the ashmem region and doorbell passed in by
+    // the process with credentials cred, closing them if refused.
+    void registerRing(int fd, int doorbell, size_t size, const struct ucred &cred);
+};
+
+#endif
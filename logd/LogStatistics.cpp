@@ -27,11 +27,15 @@
 #include "LogStatistics.h"
 
 LogStatistics::LogStatistics() : enable(false) {
+    pthread_mutex_init(&mLock, NULL);
     log_id_for_each(id) {
         mSizes[id] = 0;
         mElements[id] = 0;
         mSizesTotal[id] = 0;
         mElementsTotal[id] = 0;
+        mSizesStored[id] = 0;
+        mSizesInflated[id] = 0;
+        mSizesDeflated[id] = 0;
     }
 }
 
@@ -82,6 +86,7 @@ void LogStatistics::add(LogBufferElement *e) {
         return;
     }
 
+    lock();
     pidTable.add(e->getPid(), e);
     tidTable.add(e->getTid(), e);
 
@@ -89,6 +94,7 @@ void LogStatistics::add(LogBufferElement *e) {
     if (tag) {
         tagTable.add(tag, e);
     }
+    unlock();
 }
 
 void LogStatistics::subtract(LogBufferElement *e) {
@@ -107,6 +113,7 @@ void LogStatistics::subtract(LogBufferElement *e) {
         return;
     }
 
+    lock();
     pidTable.subtract(e->getPid(), e);
     tidTable.subtract(e->getTid(), e);
 
@@ -114,6 +121,7 @@ void LogStatistics::subtract(LogBufferElement *e) {
     if (tag) {
         tagTable.subtract(tag, e);
     }
+    unlock();
 }
 
 // Atomically set an entry to drop
@@ -129,8 +137,10 @@ void LogStatistics::drop(LogBufferElement *e) {
         return;
     }
 
+    lock();
     pidTable.drop(e->getPid(), e);
     tidTable.drop(e->getTid(), e);
+    unlock();
 }
 
 // caller must own and free character string
@@ -264,6 +274,38 @@ void LogStatistics::format(char **buf, uid_t uid, unsigned int logMask) {
         spaces += spaces_total;
     }
 
+    // Compressed storage, with the ratio achieved on the older records
+    bool compressed = false;
+    log_id_for_each(id) {
+        if ((logMask & (1 << id)) && mSizesStored[id]) {
+            compressed = true;
+        }
+    }
+    if (compressed) {
+        spaces = 3;
+        output.appendFormat("\nStored");
+
+        log_id_for_each(id) {
+            if (!(logMask & (1 << id))) {
+                continue;
+            }
+
+            size_t stored = mSizesStored[id];
+            if (stored) {
+                oldLength = output.length();
+                if (spaces < 0) {
+                    spaces = 0;
+                }
+                size_t deflated = mSizesDeflated[id];
+                size_t ratio = deflated ? (mSizesInflated[id] * 10 / deflated) : 10;
+                output.appendFormat("%*s%zu/%zu.%zux", spaces, "",
+                                    stored, ratio / 10, ratio % 10);
+                spaces -= output.length() - oldLength;
+            }
+            spaces += spaces_total;
+        }
+    }
+
     // Report on Chattiest
 
     // Chattiest by application (UID)
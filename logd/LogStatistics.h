@@ -18,10 +18,12 @@
 #define _LOGD_LOG_STATISTICS_H__
 
 #include <memory>
+#include <pthread.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
 #include <unordered_map>
+#include <vector>
 
 #include <log/log.h>
 
@@ -35,10 +37,76 @@ class LogHashtable {
 
     std::unordered_map<TKey, TEntry> map;
 
+    // Entries kept in a binary max-heap by size as they are updated, so
+    // that the chattiest are at hand without sorting the whole table.
+    // Each entry records its own position in the heap.
+    std::vector<TEntry *> heap;
+
+    void swap(size_t a, size_t b) {
+        TEntry *t = heap[a];
+        heap[a] = heap[b];
+        heap[b] = t;
+        heap[a]->position = a;
+        heap[b]->position = b;
+    }
+
+    void up(size_t i) {
+        while (i) {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent]->getSizes() >= heap[i]->getSizes()) {
+                break;
+            }
+            swap(i, parent);
+            i = parent;
+        }
+    }
+
+    void down(size_t i) {
+        for (;;) {
+            size_t largest = i;
+            size_t child = (2 * i) + 1;
+            if ((child < heap.size())
+                    && (heap[child]->getSizes() > heap[largest]->getSizes())) {
+                largest = child;
+            }
+            ++child;
+            if ((child < heap.size())
+                    && (heap[child]->getSizes() > heap[largest]->getSizes())) {
+                largest = child;
+            }
+            if (largest == i) {
+                break;
+            }
+            swap(i, largest);
+            i = largest;
+        }
+    }
+
+    void push(TEntry &entry) {
+        entry.position = heap.size();
+        heap.push_back(&entry);
+        up(entry.position);
+    }
+
+    void remove(TEntry &entry) {
+        size_t i = entry.position;
+        size_t last = heap.size() - 1;
+        if (i != last) {
+            swap(i, last);
+        }
+        heap.pop_back();
+        if (i < heap.size()) {
+            up(i);
+            down(i);
+        }
+    }
+
 public:
 
     typedef typename std::unordered_map<TKey, TEntry>::iterator iterator;
 
+    // Best first walk down the heap, no entry outranks its parent. Costs
+    // O(n * n) in the number of entries asked for, not the table size.
     std::unique_ptr<const TEntry *[]> sort(size_t n) {
         if (!n) {
             std::unique_ptr<const TEntry *[]> sorted(NULL);
@@ -48,18 +116,28 @@ public:
         const TEntry **retval = new const TEntry* [n];
         memset(retval, 0, sizeof(*retval) * n);
 
-        for(iterator it = map.begin(); it != map.end(); ++it) {
-            const TEntry &entry = it->second;
-            size_t s = entry.getSizes();
-            ssize_t i = n - 1;
-            while ((!retval[i] || (s > retval[i]->getSizes())) && (--i >= 0))
-                ;
-            if (++i < (ssize_t)n) {
-                size_t b = n - i - 1;
-                if (b) {
-                    memmove(&retval[i+1], &retval[i], b * sizeof(retval[0]));
+        std::vector<size_t> frontier;
+        if (!heap.empty()) {
+            frontier.push_back(0);
+        }
+        for (size_t i = 0; (i < n) && !frontier.empty(); ++i) {
+            size_t best = 0;
+            for (size_t f = 1; f < frontier.size(); ++f) {
+                if (heap[frontier[f]]->getSizes() > heap[frontier[best]]->getSizes()) {
+                    best = f;
                 }
-                retval[i] = &entry;
+            }
+            size_t index = frontier[best];
+            frontier[best] = frontier.back();
+            frontier.pop_back();
+
+            retval[i] = heap[index];
+            size_t child = (2 * index) + 1;
+            if (child < heap.size()) {
+                frontier.push_back(child);
+            }
+            if (++child < heap.size()) {
+                frontier.push_back(child);
             }
         }
         std::unique_ptr<const TEntry *[]> sorted(retval);
@@ -80,8 +158,10 @@ public:
         iterator it = map.find(key);
         if (it == map.end()) {
             it = map.insert(std::make_pair(key, TEntry(e))).first;
+            push(it->second);
         } else {
             it->second.add(e);
+            up(it->second.position);
         }
         return it;
     }
@@ -90,6 +170,7 @@ public:
         iterator it = map.find(key);
         if (it == map.end()) {
             it = map.insert(std::make_pair(key, TEntry(key))).first;
+            push(it->second);
         } else {
             it->second.add(key);
         }
@@ -98,8 +179,14 @@ public:
 
     void subtract(TKey key, LogBufferElement *e) {
         iterator it = map.find(key);
-        if ((it != map.end()) && it->second.subtract(e)) {
+        if (it == map.end()) {
+            return;
+        }
+        if (it->second.subtract(e)) {
+            remove(it->second);
             map.erase(it);
+        } else {
+            down(it->second.position);
         }
     }
 
@@ -107,6 +194,7 @@ public:
         iterator it = map.find(key);
         if (it != map.end()) {
             it->second.drop(e);
+            down(it->second.position);
         }
     }
 
@@ -117,9 +205,10 @@ public:
 
 struct EntryBase {
     size_t size;
+    size_t position; // in the LogHashtable heap
 
-    EntryBase():size(0) { }
-    EntryBase(LogBufferElement *e):size(e->getMsgLen()) { }
+    EntryBase():size(0),position(0) { }
+    EntryBase(LogBufferElement *e):size(e->getMsgLen()),position(0) { }
 
     size_t getSizes() const { return size; }
 
@@ -293,8 +382,18 @@ class LogStatistics {
     size_t mElements[LOG_ID_MAX];
     size_t mSizesTotal[LOG_ID_MAX];
     size_t mElementsTotal[LOG_ID_MAX];
+    // Storage reported by compressing LogBuffers
+    size_t mSizesStored[LOG_ID_MAX];
+    size_t mSizesInflated[LOG_ID_MAX];
+    size_t mSizesDeflated[LOG_ID_MAX];
     bool enable;
 
+    // Per log_id state above and below is protected by the caller's
+    // LogBuffer lock for that log_id. The pid, tid and tag tables are
+    // shared by all log_ids and are protected by mLock instead, taken
+    // last, after any LogBuffer locks.
+    pthread_mutex_t mLock;
+
     // uid to size list
     typedef LogHashtable<uid_t, UidEntry> uidTable_t;
     uidTable_t uidTable[LOG_ID_MAX];
@@ -317,6 +416,11 @@ public:
     void enableStatistics() { enable = true; }
 
     void add(LogBufferElement *entry);
+    // Log traffic received but not retained
+    void addTotal(log_id_t log_id, unsigned short size) {
+        mSizesTotal[log_id] += size;
+        ++mElementsTotal[log_id];
+    }
     void subtract(LogBufferElement *entry);
     // entry->setDropped(1) must follow this call
     void drop(LogBufferElement *entry);
@@ -325,6 +429,12 @@ public:
 
     std::unique_ptr<const UidEntry *[]> sort(size_t n, log_id i) { return uidTable[i].sort(n); }
 
+    void storage(log_id_t id, size_t stored, size_t inflated, size_t deflated) {
+        mSizesStored[id] = stored;
+        mSizesInflated[id] = inflated;
+        mSizesDeflated[id] = deflated;
+    }
+
     // fast track current value by id only
     size_t sizes(log_id_t id) const { return mSizes[id]; }
     size_t elements(log_id_t id) const { return mElements[id]; }
@@ -334,7 +444,10 @@ public:
     // *strp = malloc, balance with free
     void format(char **strp, uid_t uid, unsigned int logMask);
 
-    // helper (must be locked directly or implicitly by mLogElementsLock)
+    void lock() { pthread_mutex_lock(&mLock); }
+    void unlock() { pthread_mutex_unlock(&mLock); }
+
+    // helper (must be locked directly or implicitly by lock())
     char *pidToName(pid_t pid);
     uid_t pidToUid(pid_t pid);
     char *uidToName(uid_t uid);
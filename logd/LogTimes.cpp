@@ -26,7 +26,7 @@ pthread_mutex_t LogTimeEntry::timesLock = PTHREAD_MUTEX_INITIALIZER;
 LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
                            bool nonBlock, unsigned long tail,
                            unsigned int logMask, pid_t pid,
-                           uint64_t start) :
+                           uint64_t start, const LogFilter &filter) :
         mRefCount(1),
         mRelease(false),
         mError(false),
@@ -35,6 +35,7 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
         mReader(reader),
         mLogMask(logMask),
         mPid(pid),
+        mFilter(filter),
         mCount(0),
         mTail(tail),
         mIndex(0),
@@ -133,11 +134,28 @@ void *LogTimeEntry::threadStart(void *obj) {
 
         unlock();
 
+        LogMetrics &metrics = logbuf.metrics();
+        uint64_t flushStart = LogMetrics::nsec();
+        uint64_t current = LogBufferElement::getCurrentSequence();
+        metrics.flushBacklog.add((current > start) ? (current - start - 1) : 0);
+
         if (me->mTail) {
-            logbuf.flushTo(client, start, privileged, FilterFirstPass, me);
+            // When every element counts, only the last mTail of each log
+            // can be sent, count from the earliest of those on
+            if (privileged && !me->mPid && !me->mFilter.enabled()) {
+                uint64_t tail = logbuf.seekTail(me->mTail, me->mLogMask);
+                if (tail > start) {
+                    start = tail;
+                }
+            }
+            logbuf.flushTo(client, start, privileged,
+                           FilterFirstPass, me, me->mLogMask);
             me->leadingDropped = true;
         }
-        start = logbuf.flushTo(client, start, privileged, FilterSecondPass, me);
+        start = logbuf.flushTo(client, start, privileged,
+                               FilterSecondPass, me, me->mLogMask);
+
+        metrics.flushTime.add((LogMetrics::nsec() - flushStart) / 1000);
 
         lock();
 
@@ -179,8 +197,7 @@ int LogTimeEntry::FilterFirstPass(const LogBufferElement *element, void *obj) {
         me->mStart = element->getSequence();
     }
 
-    if ((!me->mPid || (me->mPid == element->getPid()))
-            && (me->isWatching(element->getLogId()))) {
+    if (me->isWatching(element->getLogId()) && me->isSelected(element)) {
         ++me->mCount;
     }
 
@@ -218,7 +235,7 @@ int LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj) {
         goto skip;
     }
 
-    if (me->mPid && (me->mPid != element->getPid())) {
+    if (!me->isSelected(element)) {
         goto skip;
     }
 
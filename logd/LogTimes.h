@@ -26,6 +26,8 @@
 #include <sysutils/SocketClient.h>
 #include <log/log.h>
 
+#include "LogFilter.h"
+
 class LogReader;
 
 class LogTimeEntry {
@@ -42,6 +44,7 @@ class LogTimeEntry {
     static void threadStop(void *me);
     const unsigned int mLogMask;
     const pid_t mPid;
+    const LogFilter mFilter;
     unsigned int skipAhead[LOG_ID_MAX];
     unsigned long mCount;
     unsigned long mTail;
@@ -50,7 +53,7 @@ class LogTimeEntry {
 public:
     LogTimeEntry(LogReader &reader, SocketClient *client, bool nonBlock,
                  unsigned long tail, unsigned int logMask, pid_t pid,
-                 uint64_t start);
+                 uint64_t start, const LogFilter &filter);
 
     SocketClient *mClient;
     uint64_t mStart;
@@ -104,6 +107,10 @@ public:
         delete this;
     }
     bool isWatching(log_id_t id) { return (mLogMask & (1<<id)) != 0; }
+    bool isSelected(const LogBufferElement *element) const {
+        return (!mPid || (mPid == element->getPid()))
+            && (!mFilter.enabled() || mFilter.match(element));
+    }
     // flushTo filter callbacks
     static int FilterFirstPass(const LogBufferElement *element, void *me);
     static int FilterSecondPass(const LogBufferElement *element, void *me);
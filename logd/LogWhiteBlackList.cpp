@@ -49,6 +49,27 @@ void Prune::format(char **strp) {
     }
 }
 
+void PruneMatch::compile(const PruneCollection &list) {
+    mUids.clear();
+    mPids.clear();
+    mUidPids.clear();
+    for (const Prune &p : list) {
+        if (p.getPid() == Prune::pid_all) {
+            mUids.insert(p.getUid());
+        } else if (p.getUid() == Prune::uid_all) {
+            mPids.insert(p.getPid());
+        } else {
+            mUidPids.insert(key(p.getUid(), p.getPid()));
+        }
+    }
+}
+
+bool PruneMatch::match(uid_t uid, pid_t pid) const {
+    return (!mUids.empty() && (mUids.find(uid) != mUids.end()))
+        || (!mPids.empty() && (mPids.find(pid) != mPids.end()))
+        || (!mUidPids.empty() && (mUidPids.find(key(uid, pid)) != mUidPids.end()));
+}
+
 PruneList::PruneList() : mWorstUidEnabled(true) {
 }
 
@@ -63,6 +84,14 @@ PruneList::~PruneList() {
 }
 
 int PruneList::init(char *str) {
+    int ret = parse(str);
+    // even a rejected string leaves the rules parsed ahead of the error
+    mNiceMatch.compile(mNice);
+    mNaughtyMatch.compile(mNaughty);
+    return ret;
+}
+
+int PruneList::parse(char *str) {
     mWorstUidEnabled = true;
     PruneCollection::iterator it;
     for (it = mNice.begin(); it != mNice.end();) {
@@ -210,26 +239,10 @@ void PruneList::format(char **strp) {
     *strp = strdup(string.string());
 }
 
-// ToDo: Lists are in sorted order, Prune->cmp() returns + or -
-// If there is scaling issues, resort to a better algorithm than linear
-// based on these assumptions.
-
 bool PruneList::naughty(LogBufferElement *element) {
-    PruneCollection::iterator it;
-    for (it = mNaughty.begin(); it != mNaughty.end(); ++it) {
-        if (!(*it).cmp(element)) {
-            return true;
-        }
-    }
-    return false;
+    return mNaughtyMatch.match(element->getUid(), element->getPid());
 }
 
 bool PruneList::nice(LogBufferElement *element) {
-    PruneCollection::iterator it;
-    for (it = mNice.begin(); it != mNice.end(); ++it) {
-        if (!(*it).cmp(element)) {
-            return true;
-        }
-    }
-    return false;
+    return mNiceMatch.match(element->getUid(), element->getPid());
 }
@@ -17,9 +17,11 @@
 #ifndef _LOGD_LOG_WHITE_BLACK_LIST_H__
 #define _LOGD_LOG_WHITE_BLACK_LIST_H__
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <list>
+#include <unordered_set>
 
 #include <LogBufferElement.h>
 
@@ -49,11 +51,32 @@ public:
 
 typedef std::list<Prune> PruneCollection;
 
+// A PruneCollection compiled for lookup: a rule is matched by uid alone,
+// by pid alone, or by both, so each kind gets its own hash set and an
+// element is checked against all of them in constant time.
+class PruneMatch {
+    std::unordered_set<uid_t> mUids;
+    std::unordered_set<pid_t> mPids;
+    std::unordered_set<uint64_t> mUidPids;
+
+    static uint64_t key(uid_t uid, pid_t pid) {
+        return (static_cast<uint64_t>(uid) << 32) | static_cast<uint32_t>(pid);
+    }
+
+public:
+    void compile(const PruneCollection &list);
+    bool match(uid_t uid, pid_t pid) const;
+};
+
 class PruneList {
     PruneCollection mNaughty;
     PruneCollection mNice;
+    PruneMatch mNaughtyMatch;
+    PruneMatch mNiceMatch;
     bool mWorstUidEnabled;
 
+    int parse(char *str);
+
 public:
     PruneList();
     ~PruneList();
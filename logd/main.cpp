@@ -314,7 +314,7 @@ static void readDmesg(LogAudit *al, LogKlog *kl) {
         if (al) {
             rc = al->log(tok);
         }
-        if (kl) {
+        if (kl && !kl->readsRecords()) {
             rc = kl->log(tok);
         }
     }
@@ -329,8 +329,14 @@ static void readDmesg(LogAudit *al, LogKlog *kl) {
 int main(int argc, char *argv[]) {
     int fdPmesg = -1;
     bool klogd = property_get_bool_svelte("logd.klogd");
+    bool kmsgRecords = false;
     if (klogd) {
-        fdPmesg = open("/proc/kmsg", O_RDONLY | O_NDELAY);
+        // Prefer the record interface, fall back to the text stream
+        fdPmesg = open("/dev/kmsg", O_RDONLY | O_NDELAY);
+        kmsgRecords = fdPmesg >= 0;
+        if (!kmsgRecords) {
+            fdPmesg = open("/proc/kmsg", O_RDONLY | O_NDELAY);
+        }
     }
     fdDmesg = open("/dev/kmsg", O_WRONLY);
 
@@ -412,6 +418,10 @@ int main(int argc, char *argv[]) {
         logBuf->enableStatistics();
     }
 
+    if (property_get_bool("logd.compress", false)) {
+        logBuf->enableCompression();
+    }
+
     // LogReader listens on /dev/socket/logdr. When a client
     // connects, log entries in the LogBuffer are written to the client.
 
@@ -424,7 +434,16 @@ int main(int argc, char *argv[]) {
     // initiated log messages. New log entries are added to LogBuffer
     // and LogReader is notified to send updates to connected clients.
 
-    LogListener *swl = new LogListener(logBuf, reader);
+    // LogShmListener drains the shared memory rings processes may
+    // register through /dev/socket/logdw instead of sending datagrams.
+
+    LogShmListener *shm = new LogShmListener(logBuf, reader);
+    if (shm->startListener()) {
+        delete shm;
+        shm = NULL;
+    }
+
+    LogListener *swl = new LogListener(logBuf, reader, shm);
     // Backlog and /proc/sys/net/unix/max_dgram_qlen set to large value
     if (swl->startListener(300)) {
         exit(1);
@@ -447,12 +466,14 @@ int main(int argc, char *argv[]) {
     LogAudit *al = NULL;
     if (auditd) {
         bool dmesg = property_get_bool("logd.auditd.dmesg", true);
-        al = new LogAudit(logBuf, reader, dmesg ? fdDmesg : -1);
+        bool summarize = property_get_bool("logd.auditd.summarize", false);
+        al = new LogAudit(logBuf, reader, dmesg ? fdDmesg : -1, summarize);
     }
 
     LogKlog *kl = NULL;
     if (klogd) {
-        kl = new LogKlog(logBuf, reader, fdDmesg, fdPmesg, al != NULL);
+        kl = new LogKlog(logBuf, reader, fdDmesg, fdPmesg, al != NULL,
+                         kmsgRecords);
     }
 
     readDmesg(al, kl);
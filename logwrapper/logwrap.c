@@ -52,6 +52,13 @@ do {                                                                          \
 
 #define MAX_KLOG_TAG 16
 
+/* Lines for the Android log are gathered into entries of up to this many
+ * bytes, one line after another, so that a chatty command costs a write to
+ * logd every few kilobytes rather than every line.  logcat still shows each
+ * line on its own.  What is left of LOGGER_ENTRY_MAX_PAYLOAD is for the tag.
+ */
+#define ALOG_BATCH_SIZE 3072
+
 /* This is a simple buffer that holds up to the first beginning_buf->buf_size
  * bytes of output from a command.
  */
@@ -95,6 +102,8 @@ struct log_info {
     bool abbreviated;
     FILE *fp;
     struct abbr_buf a_buf;
+    char alog_batch[ALOG_BATCH_SIZE];
+    size_t alog_batch_len;
 };
 
 /* Forware declaration */
@@ -154,13 +163,43 @@ static void add_line_to_circular_buf(struct ending_buf *e_buf,
     e_buf->write = (e_buf->write + line_len) % e_buf->buf_size;
 }
 
-/* Log directly to the specified log */
+static void flush_alog_batch(struct log_info *log_info) {
+    if (log_info->alog_batch_len == 0) {
+        return;
+    }
+    /* The last newline becomes the terminator */
+    log_info->alog_batch[log_info->alog_batch_len - 1] = '\0';
+    __android_log_write(ANDROID_LOG_INFO, log_info->btag, log_info->alog_batch);
+    log_info->alog_batch_len = 0;
+}
+
+static void add_line_to_alog_batch(struct log_info *log_info, const char *line) {
+    size_t len = strlen(line);
+
+    if (len > 0 && line[len - 1] == '\n') {
+        len--;
+    }
+    if (log_info->alog_batch_len + len + 1 > sizeof(log_info->alog_batch)) {
+        flush_alog_batch(log_info);
+        if (len + 1 > sizeof(log_info->alog_batch)) {
+            ALOG(LOG_INFO, log_info->btag, "%s", line);
+            return;
+        }
+    }
+    memcpy(log_info->alog_batch + log_info->alog_batch_len, line, len);
+    log_info->alog_batch_len += len;
+    log_info->alog_batch[log_info->alog_batch_len++] = '\n';
+}
+
+/* Log directly to the specified log; Android log lines are batched and only
+ * written out by flush_alog_batch().
+ */
 static void do_log_line(struct log_info *log_info, char *line) {
     if (log_info->log_target & LOG_KLOG) {
         klog_write(6, log_info->klog_fmt, line);
     }
     if (log_info->log_target & LOG_ALOG) {
-        ALOG(LOG_INFO, log_info->btag, "%s", line);
+        add_line_to_alog_batch(log_info, line);
     }
     if (log_info->log_target & LOG_FILE) {
         fprintf(log_info->fp, "%s\n", line);
@@ -171,6 +210,23 @@ static void do_log_line(struct log_info *log_info, char *line) {
  * via do_log_line() above.
  */
 static void log_line(struct log_info *log_info, char *line, int len) {
+    char *cr = memchr(line, '\r', len);
+
+    if (cr) {
+        if (log_info->abbreviated) {
+            /* The abbreviated logging code uses newline as the line
+             * separator.  Luckily, the pty layer helpfully cooks the output
+             * of the command being run and inserts a CR before NL.  So
+             * change it to NL here when doing abbreviated logging.
+             */
+            do {
+                *cr = '\n';
+                cr = memchr(cr + 1, '\r', len - (cr + 1 - line));
+            } while (cr);
+        } else {
+            *cr = '\0';
+        }
+    }
     if (log_info->abbreviated) {
         add_line_to_abbr_buf(&log_info->a_buf, line, len);
     } else {
@@ -187,26 +243,28 @@ static void log_line(struct log_info *log_info, char *line, int len) {
  */
 static void print_buf_lines(struct log_info *log_info, char *buf, int buf_size)
 {
-    char *line_start;
+    char *line_start = buf;
+    char *end = memchr(buf, '\0', buf_size);
+    char *nul = end;
+    char *nl;
     char c;
-    int i;
-
-    line_start = buf;
-    for (i = 0; i < buf_size; i++) {
-        if (*(buf + i) == '\n') {
-            /* Found a line ending, print the line and compute new line_start */
-            /* Save the next char and replace with \0 */
-            c = *(buf + i + 1);
-            *(buf + i + 1) = '\0';
-            do_log_line(log_info, line_start);
-            /* Restore the saved char */
-            *(buf + i + 1) = c;
-            line_start = buf + i + 1;
-        } else if (*(buf + i) == '\0') {
-            /* The end of the buffer, print the last bit */
-            do_log_line(log_info, line_start);
-            break;
-        }
+
+    if (!end) {
+        end = buf + buf_size;
+    }
+    while ((nl = memchr(line_start, '\n', end - line_start)) != NULL) {
+        /* Found a line ending, print the line and compute new line_start */
+        /* Save the next char and replace with \0 */
+        c = *(nl + 1);
+        *(nl + 1) = '\0';
+        do_log_line(log_info, line_start);
+        /* Restore the saved char */
+        *(nl + 1) = c;
+        line_start = nl + 1;
+    }
+    if (nul) {
+        /* The end of the buffer, print the last bit */
+        do_log_line(log_info, line_start);
     }
     /* If the buffer was completely full, and didn't end with a newline, just
      * ignore the partial last line.
@@ -305,8 +363,10 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
     struct log_info log_info;
 
-    int a = 0;  // start index of unprocessed data
-    int b = 0;  // end index of unprocessed data
+    int b = 0;  // end of unprocessed data, which starts at buffer[0]
+    int scanned = 0;  // how much of it is known to have no newline
+    char *line_start;
+    char *nl;
     int sz;
     bool found_child = false;
     char tmpbuf[256];
@@ -346,6 +406,7 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
     log_info.log_target = log_target;
     log_info.abbreviated = abbreviated;
+    log_info.alog_batch_len = 0;
 
     while (!found_child) {
         if (TEMP_FAILURE_RETRY(poll(poll_fds, ARRAY_SIZE(poll_fds), -1)) < 0) {
@@ -356,44 +417,31 @@ static int parent(const char *tag, int parent_read, pid_t pid,
 
         if (poll_fds[0].revents & POLLIN) {
             sz = read(parent_read, &buffer[b], sizeof(buffer) - 1 - b);
+            if (sz > 0) {
+                b += sz;
+            }
 
-            sz += b;
             // Log one line at a time
-            for (b = 0; b < sz; b++) {
-                if (buffer[b] == '\r') {
-                    if (abbreviated) {
-                        /* The abbreviated logging code uses newline as
-                         * the line separator.  Lucikly, the pty layer
-                         * helpfully cooks the output of the command
-                         * being run and inserts a CR before NL.  So
-                         * I just change it to NL here when doing
-                         * abbreviated logging.
-                         */
-                        buffer[b] = '\n';
-                    } else {
-                        buffer[b] = '\0';
-                    }
-                } else if (buffer[b] == '\n') {
-                    buffer[b] = '\0';
-                    log_line(&log_info, &buffer[a], b - a);
-                    a = b + 1;
-                }
+            line_start = buffer;
+            while ((nl = memchr(&buffer[scanned], '\n', b - scanned)) != NULL) {
+                *nl = '\0';
+                log_line(&log_info, line_start, nl - line_start);
+                line_start = nl + 1;
+                scanned = line_start - buffer;
             }
 
-            if (a == 0 && b == sizeof(buffer) - 1) {
+            if (line_start == buffer && b == sizeof(buffer) - 1) {
                 // buffer is full, flush
                 buffer[b] = '\0';
-                log_line(&log_info, &buffer[a], b - a);
+                log_line(&log_info, buffer, b);
                 b = 0;
-            } else if (a != b) {
-                // Keep left-overs
-                b -= a;
-                memmove(buffer, &buffer[a], b);
-                a = 0;
             } else {
-                a = 0;
-                b = 0;
+                // Keep left-overs
+                b -= line_start - buffer;
+                memmove(buffer, line_start, b);
             }
+            scanned = b;
+            flush_alog_batch(&log_info);
         }
 
         if (poll_fds[0].revents & POLLHUP) {
@@ -421,9 +469,9 @@ static int parent(const char *tag, int parent_read, pid_t pid,
     }
 
     // Flush remaining data
-    if (a != b) {
+    if (b != 0) {
       buffer[b] = '\0';
-      log_line(&log_info, &buffer[a], b - a);
+      log_line(&log_info, buffer, b);
     }
 
     /* All the output has been processed, time to dump the abbreviated output */
@@ -450,6 +498,7 @@ static int parent(const char *tag, int parent_read, pid_t pid,
     }
 
 err_waitpid:
+    flush_alog_batch(&log_info);
 err_poll:
     if (log_target & LOG_FILE) {
         fclose(log_info.fp); /* Also closes underlying fd */
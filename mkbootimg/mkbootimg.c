@@ -22,37 +22,68 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 #include "mincrypt/sha.h"
 #include "bootimg.h"
 
-static void *load_file(const char *fn, unsigned *_sz)
+#define COPY_CHUNK_SIZE (1024 * 1024)
+
+static int open_file(const char *fn, unsigned *_sz)
 {
-    char *data;
-    int sz;
+    struct stat st;
     int fd;
 
-    data = 0;
     fd = open(fn, O_RDONLY);
-    if(fd < 0) return 0;
-
-    sz = lseek(fd, 0, SEEK_END);
-    if(sz < 0) goto oops;
+    if(fd < 0) return -1;
 
-    if(lseek(fd, 0, SEEK_SET) != 0) goto oops;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > UINT32_MAX) {
+        close(fd);
+        return -1;
+    }
 
-    data = (char*) malloc(sz);
-    if(data == 0) goto oops;
+    *_sz = st.st_size;
+    return fd;
+}
 
-    if(read(fd, data, sz) != sz) goto oops;
-    close(fd);
+static int write_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
 
-    if(_sz) *_sz = sz;
-    return data;
+    while(len > 0) {
+        ssize_t n = write(fd, p, len);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
 
-oops:
-    close(fd);
-    if(data != 0) free(data);
+/* Copies size bytes from in_fd to out_fd a chunk at a time, adding them to
+ * the hash on the way, so that a component is only read once and never
+ * held in memory whole.
+ */
+static int copy_file(int out_fd, int in_fd, unsigned size, void *buf, SHA_CTX *ctx)
+{
+    while(size > 0) {
+        ssize_t n = read(in_fd, buf, size < COPY_CHUNK_SIZE ? size : COPY_CHUNK_SIZE);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        if(n == 0) {
+            /* The file shrank since it was measured. */
+            errno = EIO;
+            return -1;
+        }
+        SHA_update(ctx, buf, n);
+        if(write_all(out_fd, buf, n)) return -1;
+        size -= n;
+    }
     return 0;
 }
 
@@ -107,11 +138,13 @@ int main(int argc, char **argv)
     boot_img_hdr hdr;
 
     char *kernel_fn = NULL;
-    void *kernel_data = NULL;
+    int kernel_fd = -1;
     char *ramdisk_fn = NULL;
-    void *ramdisk_data = NULL;
+    int ramdisk_fd = -1;
     char *second_fn = NULL;
-    void *second_data = NULL;
+    int second_fd = -1;
+    unsigned size;
+    void *buf;
     char *cmdline = "";
     char *bootimg = NULL;
     char *board = "";
@@ -218,44 +251,38 @@ int main(int argc, char **argv)
         strncpy((char *)hdr.extra_cmdline, cmdline, BOOT_EXTRA_ARGS_SIZE);
     }
 
-    kernel_data = load_file(kernel_fn, &hdr.kernel_size);
-    if(kernel_data == 0) {
+    kernel_fd = open_file(kernel_fn, &size);
+    if(kernel_fd < 0) {
         fprintf(stderr,"error: could not load kernel '%s'\n", kernel_fn);
         return 1;
     }
+    hdr.kernel_size = size;
 
     if(ramdisk_fn == 0) {
-        ramdisk_data = 0;
         hdr.ramdisk_size = 0;
     } else {
-        ramdisk_data = load_file(ramdisk_fn, &hdr.ramdisk_size);
-        if(ramdisk_data == 0) {
+        ramdisk_fd = open_file(ramdisk_fn, &size);
+        if(ramdisk_fd < 0) {
             fprintf(stderr,"error: could not load ramdisk '%s'\n", ramdisk_fn);
             return 1;
         }
+        hdr.ramdisk_size = size;
     }
 
     if(second_fn) {
-        second_data = load_file(second_fn, &hdr.second_size);
-        if(second_data == 0) {
+        second_fd = open_file(second_fn, &size);
+        if(second_fd < 0) {
             fprintf(stderr,"error: could not load secondstage '%s'\n", second_fn);
             return 1;
         }
+        hdr.second_size = size;
     }
 
-    /* put a hash of the contents in the header so boot images can be
-     * differentiated based on their first 2k.
-     */
-    SHA_init(&ctx);
-    SHA_update(&ctx, kernel_data, hdr.kernel_size);
-    SHA_update(&ctx, &hdr.kernel_size, sizeof(hdr.kernel_size));
-    SHA_update(&ctx, ramdisk_data, hdr.ramdisk_size);
-    SHA_update(&ctx, &hdr.ramdisk_size, sizeof(hdr.ramdisk_size));
-    SHA_update(&ctx, second_data, hdr.second_size);
-    SHA_update(&ctx, &hdr.second_size, sizeof(hdr.second_size));
-    sha = SHA_final(&ctx);
-    memcpy(hdr.id, sha,
-           SHA_DIGEST_SIZE > sizeof(hdr.id) ? sizeof(hdr.id) : SHA_DIGEST_SIZE);
+    buf = malloc(COPY_CHUNK_SIZE);
+    if(buf == 0) {
+        fprintf(stderr,"error: out of memory\n");
+        return 1;
+    }
 
     fd = open(bootimg, O_CREAT | O_TRUNC | O_WRONLY, 0644);
     if(fd < 0) {
@@ -263,19 +290,39 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) goto fail;
+    /* The header holds a hash of the contents so boot images can be
+     * differentiated based on their first 2k.  The components are hashed
+     * as they are copied, and the header is written again at the end with
+     * the hash filled in.
+     */
+    SHA_init(&ctx);
+
+    if(write_all(fd, &hdr, sizeof(hdr))) goto fail;
     if(write_padding(fd, pagesize, sizeof(hdr))) goto fail;
 
-    if(write(fd, kernel_data, hdr.kernel_size) != (ssize_t) hdr.kernel_size) goto fail;
+    if(copy_file(fd, kernel_fd, hdr.kernel_size, buf, &ctx)) goto fail;
     if(write_padding(fd, pagesize, hdr.kernel_size)) goto fail;
+    SHA_update(&ctx, &hdr.kernel_size, sizeof(hdr.kernel_size));
 
-    if(write(fd, ramdisk_data, hdr.ramdisk_size) != (ssize_t) hdr.ramdisk_size) goto fail;
+    if(ramdisk_fd >= 0 && copy_file(fd, ramdisk_fd, hdr.ramdisk_size, buf, &ctx)) goto fail;
     if(write_padding(fd, pagesize, hdr.ramdisk_size)) goto fail;
+    SHA_update(&ctx, &hdr.ramdisk_size, sizeof(hdr.ramdisk_size));
 
-    if(second_data) {
-        if(write(fd, second_data, hdr.second_size) != (ssize_t) hdr.second_size) goto fail;
+    if(second_fd >= 0) {
+        if(copy_file(fd, second_fd, hdr.second_size, buf, &ctx)) goto fail;
         if(write_padding(fd, pagesize, hdr.second_size)) goto fail;
     }
+    SHA_update(&ctx, &hdr.second_size, sizeof(hdr.second_size));
+
+    sha = SHA_final(&ctx);
+    memcpy(hdr.id, sha,
+           SHA_DIGEST_SIZE > sizeof(hdr.id) ? sizeof(hdr.id) : SHA_DIGEST_SIZE);
+
+    if(pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) goto fail;
+    if(close(fd)) {
+        fd = -1;
+        goto fail;
+    }
 
     if (get_id) {
         print_id((uint8_t *) hdr.id, sizeof(hdr.id));
@@ -285,7 +332,7 @@ int main(int argc, char **argv)
 
 fail:
     unlink(bootimg);
-    close(fd);
+    if(fd >= 0) close(fd);
     fprintf(stderr,"error: failed writing '%s': %s\n", bootimg,
             strerror(errno));
     return 1;
@@ -0,0 +1,22 @@
+# Copyright 2015 The Android Open Source Project
+
+LOCAL_PATH:= $(call my-dir)
+
+# Device side benchmarks of liblog, logd, property_set and libsparse.
+include $(CLEAR_VARS)
+LOCAL_MODULE := core_perf
+LOCAL_CFLAGS := -Werror -Wall
+LOCAL_SRC_FILES := core_perf.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libsparse/include
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_STATIC_LIBRARIES := libsparse_static libz
+include $(BUILD_EXECUTABLE)
+
+# Runs core_perf, ziparchive-benchmark and adb_benchmark, and compares the
+# results with a baseline.
+include $(CLEAR_VARS)
+LOCAL_MODULE := run_perf.py
+LOCAL_SRC_FILES := run_perf.py
+LOCAL_MODULE_CLASS := EXECUTABLES
+LOCAL_IS_HOST_MODULE := true
+include $(BUILD_PREBUILT)
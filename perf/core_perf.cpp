@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the parts of the platform that have no benchmark of their own,
+// on the device, for run_perf.py to track over time:
+//
+//   liblog    cost of __android_log_buf_write(), -n writes
+//   logd      -n messages from the first write until logd hands the last
+//             one back, and the rate at which logd dumps the main buffer
+//   property  latency of property_set() until property_get() sees the
+//             value, -p times
+//   sparse    img2simg and simg2img of a -S MiB image, and writing a
+//             sparse image made of data, fill and hole chunks
+//
+// Each result is a line of tab separated fields: the metric name, its
+// value, the unit, and whether "higher" or "lower" is better.
+//
+//   core_perf [-m liblog,logd,property,sparse] [-n messages]
+//             [-p properties] [-S MiB]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <log/logger.h>
+#include <sparse/sparse.h>
+
+#define TAG "core_perf"
+#define PROPERTY "debug.core_perf.counter"
+#define MiB (1024 * 1024)
+#define BLOCK_SIZE 4096
+
+static int messages = 10000;
+static int properties = 200;
+static int megabytes = 64;
+
+static double now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static void die(const char* what) {
+    fprintf(stderr, "%s failed: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static void report(const char* name, double value, const char* unit, bool higher) {
+    printf("%s\t%.3f\t%s\t%s\n", name, value, unit, higher ? "higher" : "lower");
+    fflush(stdout);
+}
+
+static std::string temp_path(const char* name) {
+    const char* dir = getenv("TMPDIR");
+    if (dir == NULL) dir = "/data/local/tmp";
+    return std::string(dir) + "/" + name;
+}
+
+static void bench_liblog() {
+    static const char msg[] = "core_perf liblog write cost, a message of typical length";
+    double start = now_us();
+    for (int i = 0; i < messages; i++) {
+        __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO, TAG, msg);
+    }
+    report("liblog.write", (now_us() - start) * 1000 / messages, "ns", false);
+}
+
+static void bench_logd() {
+    // Messages of earlier runs must not end this one.
+    char marker[64];
+    snprintf(marker, sizeof(marker), "core_perf end %d %.0f", getpid(), now_us());
+
+    struct logger_list* list = android_logger_list_open(LOG_ID_MAIN, ANDROID_LOG_RDONLY,
+                                                        0, getpid());
+    if (!list) {
+        die("android_logger_list_open");
+    }
+
+    double start = now_us();
+    for (int i = 0; i < messages; i++) {
+        __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO, TAG, "core_perf ingest %d", i);
+    }
+    __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO, TAG, marker);
+
+    for (;;) {
+        struct log_msg msg;
+        if (android_logger_list_read(list, &msg) <= 0) {
+            die("android_logger_list_read");
+        }
+        // The payload is the priority, then the tag and message as strings.
+        const char* payload = msg.msg();
+        const char* text = payload + 1 + strlen(payload + 1) + 1;
+        if (!strcmp(text, marker)) {
+            break;
+        }
+    }
+    double us = now_us() - start;
+    android_logger_list_close(list);
+    report("logd.ingest", (messages + 1) / (us / 1e6), "msgs/s", true);
+
+    list = android_logger_list_open(LOG_ID_MAIN, ANDROID_LOG_RDONLY | ANDROID_LOG_NONBLOCK,
+                                    0, 0);
+    if (!list) {
+        die("android_logger_list_open");
+    }
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    start = now_us();
+    for (;;) {
+        struct log_msg msg;
+        if (android_logger_list_read(list, &msg) <= 0) {
+            break;
+        }
+        entries++;
+        bytes += msg.len();
+    }
+    us = now_us() - start;
+    android_logger_list_close(list);
+    if (entries) {
+        report("logd.read_entries", entries / (us / 1e6), "entries/s", true);
+        report("logd.read_bandwidth", bytes / double(MiB) / (us / 1e6), "MiB/s", true);
+    }
+}
+
+static void bench_property() {
+    std::vector<double> times;
+    char expected[PROPERTY_VALUE_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    for (int i = 0; i < properties; i++) {
+        snprintf(expected, sizeof(expected), "%d.%d", getpid(), i);
+        double start = now_us();
+        if (property_set(PROPERTY, expected) < 0) {
+            die("property_set " PROPERTY);
+        }
+        do {
+            property_get(PROPERTY, value, "");
+        } while (strcmp(value, expected));
+        times.push_back(now_us() - start);
+    }
+    property_set(PROPERTY, "");
+
+    std::sort(times.begin(), times.end());
+    report("property.set_median", times[times.size() / 2], "us", false);
+    report("property.set_p99", times[times.size() * 99 / 100], "us", false);
+}
+
+// A raw image of a quarter zeroes, a quarter filled with a pattern and the
+// rest random, in runs of 16 blocks, as a filesystem image might be.
+static void write_raw_image(const std::string& path, uint64_t size) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        die(path.c_str());
+    }
+    std::vector<uint32_t> run(16 * BLOCK_SIZE / sizeof(uint32_t));
+    srandom(1);
+    for (uint64_t written = 0; written < size; written += run.size() * sizeof(uint32_t)) {
+        int kind = random() % 4;
+        for (size_t i = 0; i < run.size(); i++) {
+            run[i] = (kind == 0) ? 0 : (kind == 1) ? 0xdeadbeef : random();
+        }
+        if (write(fd, run.data(), run.size() * sizeof(uint32_t)) == -1) {
+            die("write");
+        }
+    }
+    close(fd);
+}
+
+static void bench_sparse() {
+    uint64_t size = uint64_t(megabytes) * MiB;
+    std::string raw = temp_path("core_perf.img");
+    std::string sparse = temp_path("core_perf.simg");
+    write_raw_image(raw, size);
+
+    // img2simg
+    double start = now_us();
+    int in = open(raw.c_str(), O_RDONLY | O_CLOEXEC);
+    int out = open(sparse.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (in == -1 || out == -1) {
+        die("open");
+    }
+    struct sparse_file* s = sparse_file_new(BLOCK_SIZE, size);
+    if (!s || sparse_file_read(s, in, false, false) < 0 ||
+        sparse_file_write(s, out, false, true, false) < 0) {
+        die("img2simg");
+    }
+    sparse_file_destroy(s);
+    close(in);
+    close(out);
+    report("sparse.img2simg", megabytes / ((now_us() - start) / 1e6), "MiB/s", true);
+
+    // simg2img
+    start = now_us();
+    in = open(sparse.c_str(), O_RDONLY | O_CLOEXEC);
+    out = open(raw.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (in == -1 || out == -1) {
+        die("open");
+    }
+    s = sparse_file_import(in, false, false);
+    if (!s || sparse_file_write(s, out, false, false, false) < 0) {
+        die("simg2img");
+    }
+    sparse_file_destroy(s);
+    close(in);
+    close(out);
+    report("sparse.simg2img", megabytes / ((now_us() - start) / 1e6), "MiB/s", true);
+
+    // A sparse image put together from chunks, as make_ext4fs does.
+    std::vector<char> data(MiB);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = random();
+    }
+    start = now_us();
+    out = open(sparse.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (out == -1) {
+        die("open");
+    }
+    s = sparse_file_new(BLOCK_SIZE, size);
+    unsigned int blocks = MiB / BLOCK_SIZE;
+    for (unsigned int block = 0; block + 2 * blocks <= size / BLOCK_SIZE; block += 3 * blocks) {
+        sparse_file_add_data(s, data.data(), MiB, block);
+        sparse_file_add_fill(s, 0xdeadbeef, MiB, block + blocks);
+    }
+    if (sparse_file_write(s, out, false, true, false) < 0) {
+        die("sparse_file_write");
+    }
+    sparse_file_destroy(s);
+    close(out);
+    report("sparse.write", megabytes / ((now_us() - start) / 1e6), "MiB/s", true);
+
+    unlink(raw.c_str());
+    unlink(sparse.c_str());
+}
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [-m liblog,logd,property,sparse] [-n messages] [-p properties]\n"
+            "       [-S MiB]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    std::string modes = "liblog,logd,property,sparse";
+    int c;
+    while ((c = getopt(argc, argv, "m:n:p:S:")) != -1) {
+        switch (c) {
+        case 'm': modes = optarg; break;
+        case 'n': messages = atoi(optarg); break;
+        case 'p': properties = atoi(optarg); break;
+        case 'S': megabytes = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || messages < 1 || properties < 1 || megabytes < 1) {
+        usage(argv[0]);
+    }
+    modes = "," + modes + ",";
+
+    if (modes.find(",liblog,") != std::string::npos) {
+        bench_liblog();
+    }
+    if (modes.find(",logd,") != std::string::npos) {
+        bench_logd();
+    }
+    if (modes.find(",property,") != std::string::npos) {
+        bench_property();
+    }
+    if (modes.find(",sparse,") != std::string::npos) {
+        bench_sparse();
+    }
+    return 0;
+}
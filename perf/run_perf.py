@@ -0,0 +1,182 @@
+#!/usr/bin/env python2
+"""Runs the system/core benchmarks and checks them against a baseline.
+
+On the device given as with adb (-s, or $ANDROID_SERIAL), runs core_perf
+(liblog, logd, property_set and libsparse) and ziparchive-benchmark, and on
+the host runs adb_benchmark for push and pull through the adb server. The
+binaries are taken from $ANDROID_PRODUCT_OUT and $ANDROID_HOST_OUT unless
+given.
+
+Every result is a metric with a value, a unit and whether higher or lower is
+better. They are written as JSON with --output, and with --baseline, a
+metric that is more than --tolerance percent worse than in the baseline (a
+file written with --output before) is reported and makes the exit status 1.
+
+  run_perf.py --output current.json
+  run_perf.py --baseline last_good.json --tolerance 10
+"""
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+
+DEVICE_DIR = '/data/local/tmp'
+
+
+class Metrics(object):
+    """The results of a run, by metric name."""
+
+    def __init__(self):
+        self.metrics = {}
+
+    def add(self, name, value, unit, better):
+        self.metrics[name] = {
+            'value': float(value),
+            'unit': unit,
+            'better': better,
+        }
+
+
+def parse_core_perf(output, metrics):
+    """Reads core_perf's lines of name, value, unit and higher|lower."""
+    for line in output.splitlines():
+        fields = line.split('\t')
+        if len(fields) == 4 and fields[3] in ('higher', 'lower'):
+            metrics.add(fields[0], fields[1], fields[2], fields[3])
+
+
+def parse_ziparchive(output, metrics):
+    """Reads the find lookups of each synthetic archive."""
+    archive = None
+    for line in output.splitlines():
+        match = re.match(r'(\S+): \d+ entries$', line)
+        if match:
+            archive = os.path.basename(match.group(1))
+            archive = re.sub(r'^ziparchive-benchmark-|\.zip$', '', archive)
+            continue
+        match = re.match(r'\s+find: \d+ names, ([\d.]+) ns per lookup', line)
+        if match and archive:
+            metrics.add('ziparchive.find.' + archive, match.group(1), 'ns',
+                        'lower')
+
+
+def parse_adb(output, metrics):
+    """Reads adb_benchmark's push and pull bandwidth."""
+    for line in output.splitlines():
+        match = re.match(r'(push|pull): [\d.]+ MiB in [\d.]+ ms '
+                         r'\(([\d.]+) MiB/s\)', line)
+        if match:
+            metrics.add('adb.' + match.group(1), match.group(2), 'MiB/s',
+                        'higher')
+
+
+def run(cmd):
+    """Runs cmd and returns its stdout, exiting if it fails."""
+    process = subprocess.Popen(cmd, stdout=subprocess.PIPE)
+    stdout, _ = process.communicate()
+    if process.returncode != 0:
+        sys.exit('%s failed with status %d' % (' '.join(cmd),
+                                              process.returncode))
+    return stdout.decode('utf-8', 'replace')
+
+
+def run_on_device(adb, path, args):
+    """Pushes the binary at path and runs it with args on the device."""
+    target = DEVICE_DIR + '/' + os.path.basename(path)
+    run(adb + ['push', path, target])
+    try:
+        return run(adb + ['shell', target] + args)
+    finally:
+        subprocess.call(adb + ['shell', 'rm', '-f', target])
+
+
+def compare(metrics, baseline, tolerance):
+    """Returns the descriptions of the metrics worse than in baseline."""
+    regressions = []
+    for name in sorted(metrics):
+        if name not in baseline:
+            continue
+        new = metrics[name]['value']
+        old = baseline[name]['value']
+        if old <= 0:
+            continue
+        change = (new - old) * 100.0 / old
+        if metrics[name]['better'] == 'higher':
+            worse = -change
+        else:
+            worse = change
+        if worse > tolerance:
+            regressions.append('%s: %.3f %s, was %.3f (%.1f%% worse)' % (
+                name, new, metrics[name]['unit'], old, worse))
+    return regressions
+
+
+def main():
+    product_out = os.environ.get('ANDROID_PRODUCT_OUT', '')
+    host_out = os.environ.get('ANDROID_HOST_OUT', '')
+
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('-s', '--serial', help='device to run on')
+    parser.add_argument('--adb', default='adb', help='adb to use')
+    parser.add_argument('--core-perf', default=os.path.join(
+        product_out, 'system/bin/core_perf'))
+    parser.add_argument('--ziparchive-benchmark', default=os.path.join(
+        product_out, 'system/bin/ziparchive-benchmark'))
+    parser.add_argument('--adb-benchmark', default=os.path.join(
+        host_out, 'bin/adb_benchmark'))
+    parser.add_argument('--skip', default='',
+                        help='comma separated benchmarks not to run, of '
+                        'core_perf, ziparchive and adb')
+    parser.add_argument('--output', help='file to write the results to')
+    parser.add_argument('--baseline', help='results to compare with')
+    parser.add_argument('--tolerance', type=float, default=10.0,
+                        help='percent a metric may get worse by')
+    args = parser.parse_args()
+
+    adb = [args.adb]
+    if args.serial:
+        adb += ['-s', args.serial]
+    skip = args.skip.split(',')
+
+    metrics = Metrics()
+    if 'core_perf' not in skip:
+        parse_core_perf(run_on_device(adb, args.core_perf, []), metrics)
+    if 'ziparchive' not in skip:
+        parse_ziparchive(run_on_device(adb, args.ziparchive_benchmark,
+                                       ['-m', 'find']), metrics)
+    if 'adb' not in skip:
+        adb_benchmark = [args.adb_benchmark]
+        if args.serial:
+            adb_benchmark += ['-s', args.serial]
+        parse_adb(run(adb_benchmark + ['-m', 'push,pull']), metrics)
+
+    for name in sorted(metrics.metrics):
+        metric = metrics.metrics[name]
+        print('%-32s %14.3f %s' % (name, metric['value'], metric['unit']))
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(metrics.metrics, f, indent=2, sort_keys=True)
+            f.write('\n')
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = compare(metrics.metrics, baseline, args.tolerance)
+        if regressions:
+            print('\nregressions:', file=sys.stderr)
+            for regression in regressions:
+                print('  ' + regression, file=sys.stderr)
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
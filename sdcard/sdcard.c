@@ -99,6 +99,31 @@
  * the largest possible data payload. */
 #define MAX_REQUEST_SIZE (sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in) + MAX_WRITE)
 
+/* Default number of threads serving each view.  Backend I/O is done outside
+ * the global lock, so a slow read only holds up the thread doing it; more
+ * threads let other requests on the same view proceed meanwhile. */
+#define DEFAULT_NUM_THREADS 4
+
+/* Default attribute and entry timeouts, in seconds. */
+#define DEFAULT_ATTR_TIMEOUT 10
+#define DEFAULT_ENTRY_TIMEOUT 10
+#define MAX_NUM_THREADS 32
+
+/* Number of threads doing fsync() and the close() of written files for all
+ * views, so that a burst of them does not tie up the handler threads. */
+#define NUM_IO_THREADS 2
+
+/* Sequential reads in a row after which a handle that was seeking around is
+ * given sequential readahead again, and non-sequential ones in a row after
+ * which it loses it. */
+#define READAHEAD_SEQUENTIAL_RUN 4
+#define READAHEAD_RANDOM_RUN 2
+
+/* Number of children at which a directory gets a hash index of their names,
+ * and the initial size of that index. */
+#define CHILD_INDEX_THRESHOLD 64
+#define CHILD_INDEX_MIN_SIZE 256
+
 /* Pseudo-error constant used to indicate that no fuse status is needed
  * or that a reply has already been written. */
 #define NO_STATUS 1
@@ -131,10 +156,34 @@ typedef enum {
 
 struct handle {
     int fd;
+    /* The node the file was opened at, and whether it has been written to
+     * since, so that the other views can be told to drop its attributes. */
+    __u64 nid;
+    bool written;
+    /* Readahead hint given for fd, and where the next read is expected.
+     * Concurrent reads may race on these; at worst a hint is off. */
+    bool sequential;
+    __u32 run;
+    __u64 next_read;
+};
+
+/* fsync() or close() of a file, done by an I/O thread.  Unless unique is 0,
+ * the result is sent as the status of that request. */
+struct io_job {
+    struct io_job* next;
+    struct fuse* fuse;
+    __u64 unique;
+    int fd;
+    enum { IO_FSYNC, IO_FDATASYNC, IO_CLOSE } op;
 };
 
 struct dirhandle {
     DIR *d;
+    /* Offset of the next entry to return; entry n has offset n + 1.  An
+     * entry that was read but did not fit in the last reply is kept in
+     * pending, which stays valid until the next readdir() of d. */
+    __u64 next_off;
+    struct dirent *pending;
 };
 
 struct node {
@@ -154,9 +203,20 @@ struct node {
     bool under_android;
 
     struct node *next;          /* per-dir sibling list */
+    struct node *prev;
     struct node *child;         /* first contained file by this dir */
     struct node *parent;        /* containing directory */
 
+    /* Once a directory has CHILD_INDEX_THRESHOLD children, they are also
+     * chained by name hash into child_index, so that lookups do not have to
+     * walk the sibling list.  name_hash is the hash of name when the node was
+     * added to its parent. */
+    size_t child_count;
+    struct node **child_index;
+    size_t child_index_size;
+    struct node *hash_next;
+    __u32 name_hash;
+
     size_t namelen;
     char *name;
     /* If non-null, this is the real name of the file in the underlying storage.
@@ -171,6 +231,13 @@ struct node {
     char* graft_path;
     size_t graft_pathlen;
 
+    /* The path of this node in the underlying storage, as last built by
+     * get_node_path_locked(), valid while path_generation matches the one in
+     * fuse_global. */
+    char* path;
+    size_t pathlen;
+    __u32 path_generation;
+
     bool deleted;
 };
 
@@ -218,9 +285,32 @@ struct fuse_global {
      */
     __u32 inode_ctr;
 
+    /* Bumped whenever a node's name or place in the tree changes, which
+     * invalidates every cached node path.  Accesses must be guarded by
+     * |lock|. */
+    __u32 path_generation;
+
+    /* How long the kernel may cache attributes and entries, in seconds.
+     * Changes made through one view are pushed to the other views with
+     * invalidation notifications. */
+    __u64 attr_timeout;
+    __u64 entry_timeout;
+
+    /* Largest read and write requests, negotiated with the kernel.  At most
+     * MAX_READ and MAX_WRITE. */
+    __u32 max_read;
+    __u32 max_write;
+
     struct fuse* fuse_default;
     struct fuse* fuse_read;
     struct fuse* fuse_write;
+
+    /* Jobs waiting for the I/O threads, oldest first.  Accesses must be
+     * guarded by |io_lock|. */
+    pthread_mutex_t io_lock;
+    pthread_cond_t io_cond;
+    struct io_job* io_head;
+    struct io_job* io_tail;
 };
 
 /* Single FUSE mount */
@@ -240,6 +330,16 @@ struct fuse_handler {
     struct fuse* fuse;
     int token;
 
+    /* When use_splice is set, requests are spliced from /dev/fuse into
+     * in_pipe, and the data of FUSE_READ replies goes from the file through
+     * in_pipe and out_pipe back to /dev/fuse, so that it is never copied
+     * into this process.  write_pending is the number of FUSE_WRITE payload
+     * bytes still in in_pipe. */
+    bool use_splice;
+    int in_pipe[2];
+    int out_pipe[2];
+    size_t write_pending;
+
     /* To save memory, we never use the contents of the request buffer and the read
      * buffer at the same time.  This allows us to share the underlying storage. */
     union {
@@ -279,6 +379,8 @@ static void release_node_locked(struct node* node)
             memset(node->name, 0xef, node->namelen);
             free(node->name);
             free(node->actual_name);
+            free(node->child_index);
+            free(node->path);
             memset(node, 0xfc, sizeof(*node));
             free(node);
         }
@@ -287,28 +389,83 @@ static void release_node_locked(struct node* node)
     }
 }
 
+static __u32 child_name_hash(const char* name, size_t namelen) {
+    return hashmapHash((void*) name, namelen);
+}
+
+/* (Re)builds the child index of parent with the given number of buckets.
+ * Nodes with the same name stay in sibling list order within a bucket, so
+ * lookups find the same node as a walk of the list would. */
+static void build_child_index_locked(struct node* parent, size_t size) {
+    struct node** index = calloc(size, sizeof(*index));
+    struct node* node;
+    if (!index) {
+        /* Lookups keep working from the sibling list. */
+        return;
+    }
+    free(parent->child_index);
+    parent->child_index = index;
+    parent->child_index_size = size;
+    for (node = parent->child; node; node = node->next) {
+        struct node** slot = &index[node->name_hash & (size - 1)];
+        while (*slot) {
+            slot = &(*slot)->hash_next;
+        }
+        node->hash_next = NULL;
+        *slot = node;
+    }
+}
+
 static void add_node_to_parent_locked(struct node *node, struct node *parent) {
     node->parent = parent;
+    node->prev = NULL;
     node->next = parent->child;
+    if (node->next) {
+        node->next->prev = node;
+    }
     parent->child = node;
+    parent->child_count++;
+
+    node->name_hash = child_name_hash(node->name, node->namelen);
+    if (parent->child_index) {
+        /* Newest first, like the sibling list. */
+        struct node** slot = &parent->child_index[node->name_hash & (parent->child_index_size - 1)];
+        node->hash_next = *slot;
+        *slot = node;
+        if (parent->child_count > 2 * parent->child_index_size) {
+            build_child_index_locked(parent, 2 * parent->child_index_size);
+        }
+    } else if (parent->child_count >= CHILD_INDEX_THRESHOLD) {
+        build_child_index_locked(parent, CHILD_INDEX_MIN_SIZE);
+    }
     acquire_node_locked(parent);
 }
 
 static void remove_node_from_parent_locked(struct node* node)
 {
-    if (node->parent) {
-        if (node->parent->child == node) {
-            node->parent->child = node->parent->child->next;
+    struct node* parent = node->parent;
+    if (parent) {
+        if (node->prev) {
+            node->prev->next = node->next;
         } else {
-            struct node *node2;
-            node2 = node->parent->child;
-            while (node2->next != node)
-                node2 = node2->next;
-            node2->next = node->next;
+            parent->child = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+        parent->child_count--;
+        if (parent->child_index) {
+            struct node** slot = &parent->child_index[node->name_hash & (parent->child_index_size - 1)];
+            while (*slot != node) {
+                slot = &(*slot)->hash_next;
+            }
+            *slot = node->hash_next;
         }
-        release_node_locked(node->parent);
+        release_node_locked(parent);
         node->parent = NULL;
         node->next = NULL;
+        node->prev = NULL;
+        node->hash_next = NULL;
     }
 }
 
@@ -317,9 +474,18 @@ static void remove_node_from_parent_locked(struct node* node)
  * Populates 'buf' with the path and returns the length of the path on success,
  * or returns -1 if the path is too long for the provided buffer.
  */
-static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize) {
+static ssize_t get_node_path_locked(struct fuse* fuse, struct node* node,
+        char* buf, size_t bufsize) {
     const char* name;
     size_t namelen;
+
+    if (node->path && node->path_generation == fuse->global->path_generation) {
+        if (bufsize < node->pathlen + 1) {
+            return -1;
+        }
+        memcpy(buf, node->path, node->pathlen + 1);
+        return node->pathlen;
+    }
     if (node->graft_path) {
         name = node->graft_path;
         namelen = node->graft_pathlen;
@@ -337,7 +503,7 @@ static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize
 
     ssize_t pathlen = 0;
     if (node->parent && node->graft_path == NULL) {
-        pathlen = get_node_path_locked(node->parent, buf, bufsize - namelen - 1);
+        pathlen = get_node_path_locked(fuse, node->parent, buf, bufsize - namelen - 1);
         if (pathlen < 0) {
             return -1;
         }
@@ -345,7 +511,17 @@ static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize
     }
 
     memcpy(buf + pathlen, name, namelen + 1); /* include trailing \0 */
-    return pathlen + namelen;
+    pathlen += namelen;
+
+    /* Cache it; parents were cached on the way. */
+    char* path = realloc(node->path, pathlen + 1);
+    if (path) {
+        memcpy(path, buf, pathlen + 1);
+        node->path = path;
+        node->pathlen = pathlen;
+        node->path_generation = fuse->global->path_generation;
+    }
+    return pathlen;
 }
 
 /* Finds the absolute path of a file within a given directory.
@@ -489,8 +665,11 @@ static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
             /* App-specific directories inside; let anyone traverse */
             node->perm = PERM_ANDROID_OBB;
             /* Single OBB directory is always shared */
-            node->graft_path = fuse->global->obb_path;
-            node->graft_pathlen = strlen(fuse->global->obb_path);
+            if (node->graft_path != fuse->global->obb_path) {
+                node->graft_path = fuse->global->obb_path;
+                node->graft_pathlen = strlen(fuse->global->obb_path);
+                fuse->global->path_generation++;
+            }
         } else if (!strcasecmp(node->name, "media")) {
             /* App-specific directories inside; let anyone traverse */
             node->perm = PERM_ANDROID_MEDIA;
@@ -592,7 +771,7 @@ struct node *create_node_locked(struct fuse* fuse,
     return node;
 }
 
-static int rename_node_locked(struct node *node, const char *name,
+static int rename_node_locked(struct fuse* fuse, struct node *node, const char *name,
         const char* actual_name)
 {
     size_t namelen = strlen(name);
@@ -630,6 +809,7 @@ static int rename_node_locked(struct node *node, const char *name,
     }
     memcpy(node->name, name, namelen + 1);
     node->namelen = namelen;
+    fuse->global->path_generation++;
     return 0;
 }
 
@@ -646,7 +826,7 @@ static struct node* lookup_node_and_path_by_id_locked(struct fuse* fuse, __u64 n
         char* buf, size_t bufsize)
 {
     struct node* node = lookup_node_by_id_locked(fuse, nid);
-    if (node && get_node_path_locked(node, buf, bufsize) < 0) {
+    if (node && get_node_path_locked(fuse, node, buf, bufsize) < 0) {
         node = NULL;
     }
     return node;
@@ -654,11 +834,23 @@ static struct node* lookup_node_and_path_by_id_locked(struct fuse* fuse, __u64 n
 
 static struct node *lookup_child_by_name_locked(struct node *node, const char *name)
 {
+    /* use exact string comparison, nodes that differ by case
+     * must be considered distinct even if they refer to the same
+     * underlying file as otherwise operations such as "mv x x"
+     * will not work because the source and target nodes are the same. */
+    if (node->child_index) {
+        size_t namelen = strlen(name);
+        __u32 hash = child_name_hash(name, namelen);
+        for (node = node->child_index[hash & (node->child_index_size - 1)]; node;
+                node = node->hash_next) {
+            if (node->name_hash == hash && node->namelen == namelen
+                    && !strcmp(name, node->name) && !node->deleted) {
+                return node;
+            }
+        }
+        return 0;
+    }
     for (node = node->child; node; node = node->next) {
-        /* use exact string comparison, nodes that differ by case
-         * must be considered distinct even if they refer to the same
-         * underlying file as otherwise operations such as "mv x x"
-         * will not work because the source and target nodes are the same. */
         if (!strcmp(name, node->name) && !node->deleted) {
             return node;
         }
@@ -709,12 +901,12 @@ static void fuse_reply(struct fuse *fuse, __u64 unique, void *data, int len)
     }
 }
 
-static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
-        struct node* parent, const char* name, const char* actual_name,
-        const char* path)
+/* Looks up a child like LOOKUP does, taking a reference on its node for the
+ * kernel, and fills in out. */
+static int fill_entry(struct fuse* fuse, struct node* parent, const char* name,
+        const char* actual_name, const char* path, struct fuse_entry_out* out)
 {
     struct node* node;
-    struct fuse_entry_out out;
     struct stat s;
 
     if (lstat(path, &s) < 0) {
@@ -727,29 +919,43 @@ static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
         pthread_mutex_unlock(&fuse->global->lock);
         return -ENOMEM;
     }
-    memset(&out, 0, sizeof(out));
-    attr_from_stat(fuse, &out.attr, &s, node);
-    out.attr_valid = 10;
-    out.entry_valid = 10;
-    out.nodeid = node->nid;
-    out.generation = node->gen;
+    memset(out, 0, sizeof(*out));
+    attr_from_stat(fuse, &out->attr, &s, node);
+    out->attr_valid = fuse->global->attr_timeout;
+    out->entry_valid = fuse->global->entry_timeout;
+    out->nodeid = node->nid;
+    out->generation = node->gen;
     pthread_mutex_unlock(&fuse->global->lock);
+    return 0;
+}
+
+static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
+        struct node* parent, const char* name, const char* actual_name,
+        const char* path)
+{
+    struct fuse_entry_out out;
+    int res = fill_entry(fuse, parent, name, actual_name, path, &out);
+    if (res < 0) {
+        return res;
+    }
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
 
+/* Replies with the attributes of node, taken from fd if it is open, or else
+ * from path. */
 static int fuse_reply_attr(struct fuse* fuse, __u64 unique, const struct node* node,
-        const char* path)
+        const char* path, int fd)
 {
     struct fuse_attr_out out;
     struct stat s;
 
-    if (lstat(path, &s) < 0) {
+    if ((fd >= 0 ? fstat(fd, &s) : lstat(path, &s)) < 0) {
         return -errno;
     }
     memset(&out, 0, sizeof(out));
     attr_from_stat(fuse, &out.attr, &s, node);
-    out.attr_valid = 10;
+    out.attr_valid = fuse->global->attr_timeout;
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
@@ -785,6 +991,91 @@ static void fuse_notify_delete(struct fuse* fuse, const __u64 parent,
     }
 }
 
+static void fuse_notify_inval_inode(struct fuse* fuse, __u64 nid) {
+    struct fuse_out_header hdr;
+    struct fuse_notify_inval_inode_out data;
+    struct iovec vec[2];
+    int res;
+
+    hdr.len = sizeof(hdr) + sizeof(data);
+    hdr.error = FUSE_NOTIFY_INVAL_INODE;
+    hdr.unique = 0;
+
+    /* The attributes, and all of the cached data. */
+    data.ino = nid;
+    data.off = 0;
+    data.len = 0;
+
+    vec[0].iov_base = &hdr;
+    vec[0].iov_len = sizeof(hdr);
+    vec[1].iov_base = &data;
+    vec[1].iov_len = sizeof(data);
+
+    res = writev(fuse->fd, vec, 2);
+    /* Ignore ENOENT, since other views may not have seen the inode */
+    if (res < 0 && errno != ENOENT) {
+        ERROR("*** NOTIFY FAILED *** %d\n", errno);
+    }
+}
+
+static void fuse_notify_inval_entry(struct fuse* fuse, __u64 parent, const char* name) {
+    struct fuse_out_header hdr;
+    struct fuse_notify_inval_entry_out data;
+    struct iovec vec[3];
+    size_t namelen = strlen(name);
+    int res;
+
+    hdr.len = sizeof(hdr) + sizeof(data) + namelen + 1;
+    hdr.error = FUSE_NOTIFY_INVAL_ENTRY;
+    hdr.unique = 0;
+
+    memset(&data, 0, sizeof(data));
+    data.parent = parent;
+    data.namelen = namelen;
+
+    vec[0].iov_base = &hdr;
+    vec[0].iov_len = sizeof(hdr);
+    vec[1].iov_base = &data;
+    vec[1].iov_len = sizeof(data);
+    vec[2].iov_base = (void*) name;
+    vec[2].iov_len = namelen + 1;
+
+    res = writev(fuse->fd, vec, 3);
+    /* Ignore ENOENT, since other views may not have seen the entry */
+    if (res < 0 && errno != ENOENT) {
+        ERROR("*** NOTIFY FAILED *** %d\n", errno);
+    }
+}
+
+/* The kernel keeps attributes and entries for up to the configured timeouts,
+ * so changes made through one view are pushed to the other two. */
+static void fuse_notify_other_views_inval_inode(struct fuse* fuse, __u64 nid) {
+    struct fuse_global* global = fuse->global;
+    if (fuse != global->fuse_default) {
+        fuse_notify_inval_inode(global->fuse_default, nid);
+    }
+    if (fuse != global->fuse_read) {
+        fuse_notify_inval_inode(global->fuse_read, nid);
+    }
+    if (fuse != global->fuse_write) {
+        fuse_notify_inval_inode(global->fuse_write, nid);
+    }
+}
+
+static void fuse_notify_other_views_inval_entry(struct fuse* fuse, __u64 parent,
+        const char* name) {
+    struct fuse_global* global = fuse->global;
+    if (fuse != global->fuse_default) {
+        fuse_notify_inval_entry(global->fuse_default, parent, name);
+    }
+    if (fuse != global->fuse_read) {
+        fuse_notify_inval_entry(global->fuse_read, parent, name);
+    }
+    if (fuse != global->fuse_write) {
+        fuse_notify_inval_entry(global->fuse_write, parent, name);
+    }
+}
+
 static int handle_lookup(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header *hdr, const char* name)
 {
@@ -830,6 +1121,34 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS; /* no reply */
 }
 
+static int handle_batch_forget(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header *hdr, const struct fuse_batch_forget_in *req,
+        size_t data_len)
+{
+    const struct fuse_forget_one* forgets = (const struct fuse_forget_one*) (req + 1);
+    __u32 count = req->count;
+    __u32 i;
+
+    if ((data_len - sizeof(*req)) / sizeof(*forgets) < count) {
+        ERROR("[%d] malformed BATCH_FORGET: count=%u\n", handler->token, count);
+        return NO_STATUS;
+    }
+
+    pthread_mutex_lock(&fuse->global->lock);
+    TRACE("[%d] BATCH_FORGET %u\n", handler->token, count);
+    for (i = 0; i < count; i++) {
+        struct node* node = lookup_node_by_id_locked(fuse, forgets[i].nodeid);
+        if (node) {
+            __u64 n = forgets[i].nlookup;
+            while (n--) {
+                release_node_locked(node);
+            }
+        }
+    }
+    pthread_mutex_unlock(&fuse->global->lock);
+    return NO_STATUS; /* no reply */
+}
+
 static int handle_getattr(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header *hdr, const struct fuse_getattr_in *req)
 {
@@ -849,7 +1168,12 @@ static int handle_getattr(struct fuse* fuse, struct fuse_handler* handler,
         return -EACCES;
     }
 
-    return fuse_reply_attr(fuse, hdr->unique, node, path);
+    if (req->getattr_flags & FUSE_GETATTR_FH) {
+        /* fstat on the open file saves resolving the path again. */
+        struct handle* h = id_to_ptr(req->fh);
+        return fuse_reply_attr(fuse, hdr->unique, node, path, h->fd);
+    }
+    return fuse_reply_attr(fuse, hdr->unique, node, path, -1);
 }
 
 static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
@@ -912,7 +1236,8 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
             return -errno;
         }
     }
-    return fuse_reply_attr(fuse, hdr->unique, node, path);
+    fuse_notify_other_views_inval_inode(fuse, node->nid);
+    return fuse_reply_attr(fuse, hdr->unique, node, path, -1);
 }
 
 static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
@@ -1100,6 +1425,9 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
     char old_child_path[PATH_MAX];
     char new_child_path[PATH_MAX];
     const char* new_actual_name;
+    __u64 old_parent_nid = 0;
+    __u64 new_parent_nid = 0;
+    bool renamed = false;
     int res;
 
     pthread_mutex_lock(&fuse->global->lock);
@@ -1124,7 +1452,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto lookup_error;
     }
     child_node = lookup_child_by_name_locked(old_parent_node, old_name);
-    if (!child_node || get_node_path_locked(child_node,
+    if (!child_node || get_node_path_locked(fuse, child_node,
             old_child_path, sizeof(old_child_path)) < 0) {
         res = -ENOENT;
         goto lookup_error;
@@ -1152,12 +1480,15 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
     }
 
     pthread_mutex_lock(&fuse->global->lock);
-    res = rename_node_locked(child_node, new_name, new_actual_name);
+    res = rename_node_locked(fuse, child_node, new_name, new_actual_name);
     if (!res) {
         remove_node_from_parent_locked(child_node);
         derive_permissions_locked(fuse, new_parent_node, child_node);
         derive_permissions_recursive_locked(fuse, child_node);
         add_node_to_parent_locked(child_node, new_parent_node);
+        old_parent_nid = old_parent_node->nid;
+        new_parent_nid = new_parent_node->nid;
+        renamed = true;
     }
     goto done;
 
@@ -1167,9 +1498,89 @@ done:
     release_node_locked(child_node);
 lookup_error:
     pthread_mutex_unlock(&fuse->global->lock);
+    if (renamed) {
+        /* Not under the lock: the kernel may be waiting on us for a request
+         * that holds the directory the notification needs. */
+        fuse_notify_other_views_inval_entry(fuse, old_parent_nid, old_name);
+        fuse_notify_other_views_inval_entry(fuse, new_parent_nid, new_name);
+    }
     return res;
 }
 
+/* Hands fd to the I/O threads.  Returns false if the job could not be
+ * queued, in which case the caller has to do it. */
+static bool queue_io_job(struct fuse* fuse, __u64 unique, int fd, int op)
+{
+    struct fuse_global* global = fuse->global;
+    struct io_job* job = malloc(sizeof(*job));
+    if (!job) {
+        return false;
+    }
+    job->next = NULL;
+    job->fuse = fuse;
+    job->unique = unique;
+    job->fd = fd;
+    job->op = op;
+
+    pthread_mutex_lock(&global->io_lock);
+    if (global->io_tail) {
+        global->io_tail->next = job;
+    } else {
+        global->io_head = job;
+    }
+    global->io_tail = job;
+    pthread_cond_signal(&global->io_cond);
+    pthread_mutex_unlock(&global->io_lock);
+    return true;
+}
+
+static void* start_io_thread(void* data)
+{
+    struct fuse_global* global = data;
+    for (;;) {
+        pthread_mutex_lock(&global->io_lock);
+        while (!global->io_head) {
+            pthread_cond_wait(&global->io_cond, &global->io_lock);
+        }
+        struct io_job* job = global->io_head;
+        global->io_head = job->next;
+        if (!global->io_head) {
+            global->io_tail = NULL;
+        }
+        pthread_mutex_unlock(&global->io_lock);
+
+        int res;
+        if (job->op == IO_CLOSE) {
+            res = close(job->fd);
+        } else {
+            res = job->op == IO_FDATASYNC ? fdatasync(job->fd) : fsync(job->fd);
+        }
+        if (job->unique) {
+            fuse_status(job->fuse, job->unique, res == -1 ? -errno : 0);
+        }
+        free(job);
+    }
+    return NULL;
+}
+
+/* Switches fd between sequential readahead and the default as its reads
+ * stop or start following each other. */
+static void update_readahead(struct handle* h, __u64 offset, __u32 size)
+{
+    bool in_order = (offset == h->next_read);
+    h->next_read = offset + size;
+    if (in_order == h->sequential) {
+        h->run = 0;
+        return;
+    }
+    if (++h->run < (h->sequential ? READAHEAD_RANDOM_RUN : READAHEAD_SEQUENTIAL_RUN)) {
+        return;
+    }
+    h->sequential = !h->sequential;
+    h->run = 0;
+    posix_fadvise(h->fd, 0, 0, h->sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+}
+
 static int open_flags_to_access_mode(int open_flags) {
     if ((open_flags & O_ACCMODE) == O_RDONLY) {
         return R_OK;
@@ -1212,6 +1623,16 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
         free(h);
         return -errno;
     }
+    h->nid = node->nid;
+    h->written = false;
+    /* Most files opened only for reading are read from start to end, so
+     * they get a larger readahead window until they seek around. */
+    h->sequential = (req->flags & O_ACCMODE) == O_RDONLY && !(req->flags & O_DIRECT);
+    h->run = 0;
+    h->next_read = 0;
+    if (h->sequential) {
+        posix_fadvise(h->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
     out.fh = ptr_to_id(h);
     out.open_flags = 0;
 
@@ -1225,6 +1646,86 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+/* Reads exactly size bytes from a pipe that already holds them. */
+static bool read_pipe(int fd, void* buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t res = TEMP_FAILURE_RETRY(read(fd, buf, size));
+        if (res <= 0) {
+            return false;
+        }
+        buf = (__u8*) buf + res;
+        size -= res;
+    }
+    return true;
+}
+
+/* Empties a (non-blocking) pipe after a failed splice. */
+static void drain_pipe(struct fuse_handler* handler, int fd)
+{
+    while (TEMP_FAILURE_RETRY(read(fd, handler->read_buffer, sizeof(handler->read_buffer))) > 0) {
+    }
+}
+
+/* Moves up to size bytes from fd_in to fd_out, stopping early only at the
+ * end of fd_in.  Returns the number of bytes moved, or -1. */
+static ssize_t splice_all(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t res = splice(fd_in, off_in, fd_out, off_out, size - done, SPLICE_F_MOVE);
+        if (res < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (res == 0) {
+            break;
+        }
+        done += res;
+    }
+    return done;
+}
+
+/* Replies to a FUSE_READ by splicing the data from the file through the
+ * handler's pipes into /dev/fuse.  Returns false, with the pipes empty, if
+ * the caller should read the data itself instead. */
+static bool splice_read_reply(struct fuse* fuse, struct fuse_handler* handler,
+        struct handle* h, __u64 unique, __u32 size, __u64 offset)
+{
+    struct fuse_out_header hdr;
+    loff_t file_offset = offset;
+    ssize_t len;
+
+    /* The reply must reach the pipe it is spliced from in one piece, header
+     * first, but its length is only known once the data has been read. */
+    len = splice_all(h->fd, &file_offset, handler->in_pipe[1], NULL, size);
+    if (len < 0) {
+        drain_pipe(handler, handler->in_pipe[0]);
+        return false;
+    }
+    hdr.len = sizeof(hdr) + len;
+    hdr.error = 0;
+    hdr.unique = unique;
+    if (TEMP_FAILURE_RETRY(write(handler->out_pipe[1], &hdr, sizeof(hdr))) != sizeof(hdr)
+            || splice_all(handler->in_pipe[0], NULL, handler->out_pipe[1], NULL, len) != len) {
+        drain_pipe(handler, handler->in_pipe[0]);
+        drain_pipe(handler, handler->out_pipe[0]);
+        return false;
+    }
+    if (splice_all(handler->out_pipe[0], NULL, fuse->fd, NULL, hdr.len) != (ssize_t) hdr.len) {
+        /* The device does not take spliced replies; send this one by hand. */
+        ERROR("[%d] splice to fuse device failed: %s\n", handler->token, strerror(errno));
+        handler->use_splice = false;
+        if (read_pipe(handler->out_pipe[0], handler->read_buffer, hdr.len)) {
+            write(fuse->fd, handler->read_buffer, hdr.len);
+        }
+        drain_pipe(handler, handler->out_pipe[0]);
+    }
+    return true;
+}
+
 static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_read_in* req)
 {
@@ -1241,9 +1742,13 @@ static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
 
     TRACE("[%d] READ %p(%d) %u@%"PRIu64"\n", handler->token,
             h, h->fd, size, (uint64_t) offset);
-    if (size > MAX_READ) {
+    if (size > fuse->global->max_read) {
         return -EINVAL;
     }
+    update_readahead(h, offset, size);
+    if (handler->use_splice && splice_read_reply(fuse, handler, h, unique, size, offset)) {
+        return NO_STATUS;
+    }
     res = pread64(h->fd, read_buffer, size, offset);
     if (res < 0) {
         return -errno;
@@ -1261,6 +1766,45 @@ static int handle_write(struct fuse* fuse, struct fuse_handler* handler,
     int res;
     __u8 aligned_buffer[req->size] __attribute__((__aligned__(PAGESIZE)));
 
+    h->written = true;
+    if (handler->write_pending) {
+        /* The payload is still in the pipe it was spliced into. */
+        size_t pending = handler->write_pending;
+        loff_t offset = req->offset;
+        ssize_t written = 0;
+
+        handler->write_pending = 0;
+        if (pending != req->size) {
+            drain_pipe(handler, handler->in_pipe[0]);
+            return -EINVAL;
+        }
+        TRACE("[%d] WRITE %p(%d) %u@%"PRIu64" (splice)\n", handler->token,
+                h, h->fd, req->size, req->offset);
+        if (!(req->flags & O_DIRECT)) {
+            /* splice advances offset by what it wrote, even on failure. */
+            written = splice_all(handler->in_pipe[0], NULL, h->fd, &offset, pending);
+        }
+        if (written < 0) {
+            written = offset - req->offset;
+        }
+        if ((size_t) written < pending) {
+            /* Write what splice did not take the usual way. */
+            if (!read_pipe(handler->in_pipe[0], aligned_buffer, pending - written)) {
+                drain_pipe(handler, handler->in_pipe[0]);
+                return -EIO;
+            }
+            res = pwrite64(h->fd, aligned_buffer, pending - written, offset);
+            if (res < 0) {
+                return -errno;
+            }
+            written += res;
+        }
+        out.size = written;
+        out.padding = 0;
+        fuse_reply(fuse, hdr->unique, &out, sizeof(out));
+        return NO_STATUS;
+    }
+
     if (req->flags & O_DIRECT) {
         memcpy(aligned_buffer, buffer, req->size);
         buffer = (const __u8*) aligned_buffer;
@@ -1288,7 +1832,7 @@ static int handle_statfs(struct fuse* fuse, struct fuse_handler* handler,
 
     pthread_mutex_lock(&fuse->global->lock);
     TRACE("[%d] STATFS\n", handler->token);
-    res = get_node_path_locked(&fuse->global->root, path, sizeof(path));
+    res = get_node_path_locked(fuse, &fuse->global->root, path, sizeof(path));
     pthread_mutex_unlock(&fuse->global->lock);
     if (res < 0) {
         return -ENOENT;
@@ -1315,7 +1859,16 @@ static int handle_release(struct fuse* fuse, struct fuse_handler* handler,
     struct handle *h = id_to_ptr(req->fh);
 
     TRACE("[%d] RELEASE %p(%d)\n", handler->token, h, h->fd);
-    close(h->fd);
+    if (h->written) {
+        /* Closing a file that was written may flush it, e.g. ext4 does when
+         * it replaced a file by truncating it; do not wait for that. */
+        if (!queue_io_job(fuse, 0, h->fd, IO_CLOSE)) {
+            close(h->fd);
+        }
+        fuse_notify_other_views_inval_inode(fuse, h->nid);
+    } else {
+        close(h->fd);
+    }
     free(h);
     return 0;
 }
@@ -1338,6 +1891,11 @@ static int handle_fsync(struct fuse* fuse, struct fuse_handler* handler,
     TRACE("[%d] %s %p(%d) is_data_sync=%d\n", handler->token,
             is_dir ? "FSYNCDIR" : "FSYNC",
             id_to_ptr(req->fh), fd, is_data_sync);
+    /* The file cannot be released while the caller waits for this reply,
+     * so fd stays open until the I/O thread is done with it. */
+    if (queue_io_job(fuse, hdr->unique, fd, is_data_sync ? IO_FDATASYNC : IO_FSYNC)) {
+        return NO_STATUS;
+    }
     int res = is_data_sync ? fdatasync(fd) : fsync(fd);
     if (res == -1) {
         return -errno;
@@ -1382,6 +1940,8 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
         free(h);
         return -errno;
     }
+    h->next_off = 0;
+    h->pending = NULL;
     out.fh = ptr_to_id(h);
     out.open_flags = 0;
 
@@ -1395,32 +1955,99 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+/* Returns the entry at h->next_off and advances past it. */
+static struct dirent* next_dirent(struct dirhandle* h)
+{
+    struct dirent* de = h->pending;
+    if (de) {
+        h->pending = NULL;
+    } else {
+        de = readdir(h->d);
+    }
+    if (de) {
+        h->next_off++;
+    }
+    return de;
+}
+
+/* Positions h at the entry with the given offset. */
+static void seek_dirhandle(struct dirhandle* h, __u64 offset)
+{
+    if (offset == h->next_off) {
+        return;
+    }
+    /* rewinddir() might have been called above us, so rewind here too; a
+     * seek elsewhere is rare and done by reading up to it again. */
+    rewinddir(h->d);
+    h->next_off = 0;
+    h->pending = NULL;
+    while (h->next_off < offset && next_dirent(h)) {
+    }
+}
+
+/* Fills a READDIR or READDIRPLUS reply with as many entries as fit. */
 static int handle_readdir(struct fuse* fuse, struct fuse_handler* handler,
-        const struct fuse_in_header* hdr, const struct fuse_read_in* req)
+        const struct fuse_in_header* hdr, const struct fuse_read_in* req, bool plus)
 {
     char buffer[8192];
-    struct fuse_dirent *fde = (struct fuse_dirent*) buffer;
+    size_t size = MIN(req->size, sizeof(buffer));
+    size_t used = 0;
     struct dirent *de;
     struct dirhandle *h = id_to_ptr(req->fh);
+    struct node* parent_node = NULL;
+    char parent_path[PATH_MAX];
+    char child_path[PATH_MAX];
 
-    TRACE("[%d] READDIR %p\n", handler->token, h);
-    if (req->offset == 0) {
-        /* rewinddir() might have been called above us, so rewind here too */
-        TRACE("[%d] calling rewinddir()\n", handler->token);
-        rewinddir(h->d);
-    }
-    de = readdir(h->d);
-    if (!de) {
-        return 0;
+    TRACE("[%d] %s %p @%"PRIu64"\n", handler->token, plus ? "READDIRPLUS" : "READDIR",
+            h, req->offset);
+    if (plus) {
+        pthread_mutex_lock(&fuse->global->lock);
+        parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
+                parent_path, sizeof(parent_path));
+        pthread_mutex_unlock(&fuse->global->lock);
+        if (!parent_node) {
+            return -ENOENT;
+        }
     }
-    fde->ino = FUSE_UNKNOWN_INO;
-    /* increment the offset so we can detect when rewinddir() seeks back to the beginning */
-    fde->off = req->offset + 1;
-    fde->type = de->d_type;
-    fde->namelen = strlen(de->d_name);
-    memcpy(fde->name, de->d_name, fde->namelen + 1);
-    fuse_reply(fuse, hdr->unique, fde,
-            FUSE_DIRENT_ALIGN(sizeof(struct fuse_dirent) + fde->namelen));
+
+    seek_dirhandle(h, req->offset);
+    while ((de = next_dirent(h)) != NULL) {
+        size_t namelen = strlen(de->d_name);
+        size_t entry_size = FUSE_DIRENT_ALIGN(namelen
+                + (plus ? FUSE_NAME_OFFSET_DIRENTPLUS : FUSE_NAME_OFFSET));
+        struct fuse_dirent *fde;
+
+        if (used + entry_size > size) {
+            /* Keep it for the next request. */
+            h->pending = de;
+            h->next_off--;
+            break;
+        }
+        memset(buffer + used, 0, entry_size);
+        if (plus) {
+            struct fuse_direntplus* fdp = (struct fuse_direntplus*) (buffer + used);
+            /* A zero nodeid makes the kernel look the entry up itself, as it
+             * must for "." and "..", and for names the caller may not see. */
+            if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..")
+                    && check_caller_access_to_name(fuse, hdr, parent_node, de->d_name, R_OK)
+                    && snprintf(child_path, sizeof(child_path), "%s/%s",
+                            parent_path, de->d_name) < (int) sizeof(child_path)) {
+                fill_entry(fuse, parent_node, de->d_name, de->d_name, child_path,
+                        &fdp->entry_out);
+            }
+            fde = &fdp->dirent;
+        } else {
+            fde = (struct fuse_dirent*) (buffer + used);
+        }
+        fde->ino = FUSE_UNKNOWN_INO;
+        /* increment the offset so we can detect when rewinddir() seeks back to the beginning */
+        fde->off = h->next_off;
+        fde->type = de->d_type;
+        fde->namelen = namelen;
+        memcpy(fde->name, de->d_name, namelen);
+        used += entry_size;
+    }
+    fuse_reply(fuse, hdr->unique, buffer, used);
     return NO_STATUS;
 }
 
@@ -1455,8 +2082,10 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
         return -1;
     }
 
-    /* We limit ourselves to 15 because we don't handle BATCH_FORGET yet */
-    out.minor = MIN(req->minor, 15);
+    /* 7.21 brings READDIRPLUS; nothing between 7.15 and 7.21 needs more
+     * than BATCH_FORGET, which we handle, and ENOSYS for new opcodes. */
+    memset(&out, 0, sizeof(out));
+    out.minor = MIN(req->minor, 21);
     fuse_struct_size = sizeof(out);
 #if defined(FUSE_COMPAT_22_INIT_OUT_SIZE)
     /* FUSE_KERNEL_VERSION >= 23. */
@@ -1477,9 +2106,12 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
     out.flags |= FUSE_STACKED_IO;
 #endif
 
+    /* Let the kernel choose READDIRPLUS where it expects lookups to follow. */
+    out.flags |= req->flags & (FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO);
+
     out.max_background = 32;
     out.congestion_threshold = 32;
-    out.max_write = MAX_WRITE;
+    out.max_write = fuse->global->max_write;
     fuse_reply(fuse, hdr->unique, &out, fuse_struct_size);
     return NO_STATUS;
 }
@@ -1498,6 +2130,14 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         return handle_forget(fuse, handler, hdr, req);
     }
 
+    case FUSE_BATCH_FORGET: {
+        const struct fuse_batch_forget_in *req = data;
+        if (data_len < sizeof(*req)) {
+            return NO_STATUS;
+        }
+        return handle_batch_forget(fuse, handler, hdr, req, data_len);
+    }
+
     case FUSE_GETATTR: { /* getattr_in -> attr_out */
         const struct fuse_getattr_in *req = data;
         return handle_getattr(fuse, handler, hdr, req);
@@ -1586,7 +2226,12 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
 
     case FUSE_READDIR: {
         const struct fuse_read_in *req = data;
-        return handle_readdir(fuse, handler, hdr, req);
+        return handle_readdir(fuse, handler, hdr, req, false);
+    }
+
+    case FUSE_READDIRPLUS: {
+        const struct fuse_read_in *req = data;
+        return handle_readdir(fuse, handler, hdr, req, true);
     }
 
     case FUSE_RELEASEDIR: { /* release_in -> */
@@ -1607,12 +2252,56 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
     }
 }
 
+/* Reads the next request into the request buffer, like read() on the fuse
+ * device.  When splicing, the payload of a FUSE_WRITE is left in in_pipe. */
+static ssize_t read_request(struct fuse_handler* handler)
+{
+    struct fuse* fuse = handler->fuse;
+    const struct fuse_in_header* hdr = (void*) handler->request_buffer;
+    size_t header_size = sizeof(struct fuse_in_header);
+    ssize_t len;
+
+    if (handler->use_splice) {
+        len = splice(fuse->fd, NULL, handler->in_pipe[1], NULL,
+                sizeof(handler->request_buffer), SPLICE_F_MOVE);
+        if (len < 0 && errno == EINVAL) {
+            ERROR("[%d] splice from fuse device failed, reading instead\n", handler->token);
+            handler->use_splice = false;
+        } else if (len < 0 || (size_t) len < header_size) {
+            if (len > 0) {
+                read_pipe(handler->in_pipe[0], handler->request_buffer, len);
+            }
+            return len;
+        } else {
+            if (!read_pipe(handler->in_pipe[0], handler->request_buffer, header_size)) {
+                drain_pipe(handler, handler->in_pipe[0]);
+                errno = EIO;
+                return -1;
+            }
+            if (hdr->opcode == FUSE_WRITE && hdr->len == (size_t) len
+                    && len >= (ssize_t) (header_size + sizeof(struct fuse_write_in))) {
+                header_size += sizeof(struct fuse_write_in);
+                handler->write_pending = len - header_size;
+            }
+            if (!read_pipe(handler->in_pipe[0], handler->request_buffer + sizeof(*hdr),
+                    len - sizeof(*hdr) - handler->write_pending)) {
+                handler->write_pending = 0;
+                drain_pipe(handler, handler->in_pipe[0]);
+                errno = EIO;
+                return -1;
+            }
+            return len;
+        }
+    }
+    return TEMP_FAILURE_RETRY(read(fuse->fd,
+            handler->request_buffer, sizeof(handler->request_buffer)));
+}
+
 static void handle_fuse_requests(struct fuse_handler* handler)
 {
     struct fuse* fuse = handler->fuse;
     for (;;) {
-        ssize_t len = TEMP_FAILURE_RETRY(read(fuse->fd,
-                handler->request_buffer, sizeof(handler->request_buffer)));
+        ssize_t len = read_request(handler);
         if (len < 0) {
             if (errno == ENODEV) {
                 ERROR("[%d] someone stole our marbles!\n", handler->token);
@@ -1642,6 +2331,12 @@ static void handle_fuse_requests(struct fuse_handler* handler)
         /* We do not access the request again after this point because the underlying
          * buffer storage may have been reused while processing the request. */
 
+        if (handler->write_pending) {
+            /* A write that was refused before its payload was consumed. */
+            handler->write_pending = 0;
+            drain_pipe(handler, handler->in_pipe[0]);
+        }
+
         if (res != NO_STATUS) {
             if (res) {
                 TRACE("[%d] ERROR %d\n", handler->token, res);
@@ -1651,6 +2346,34 @@ static void handle_fuse_requests(struct fuse_handler* handler)
     }
 }
 
+/* Sets up the pipes for splicing, which is only used if the kernel lets them
+ * hold a whole request. */
+static void handler_setup_splice(struct fuse_handler* handler)
+{
+    handler->use_splice = false;
+    handler->in_pipe[0] = handler->in_pipe[1] = -1;
+    handler->out_pipe[0] = handler->out_pipe[1] = -1;
+    if (pipe2(handler->in_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        return;
+    }
+    if (pipe2(handler->out_pipe, O_CLOEXEC | O_NONBLOCK) == -1
+            || fcntl(handler->in_pipe[0], F_SETPIPE_SZ, MAX_REQUEST_SIZE) < (int) MAX_REQUEST_SIZE
+            || fcntl(handler->out_pipe[0], F_SETPIPE_SZ, MAX_READ + PAGESIZE)
+                    < (int) (MAX_READ + sizeof(struct fuse_out_header))) {
+        ERROR("[%d] cannot set up splice: %s\n", handler->token, strerror(errno));
+        close(handler->in_pipe[0]);
+        close(handler->in_pipe[1]);
+        if (handler->out_pipe[0] != -1) {
+            close(handler->out_pipe[0]);
+            close(handler->out_pipe[1]);
+        }
+        handler->in_pipe[0] = handler->in_pipe[1] = -1;
+        handler->out_pipe[0] = handler->out_pipe[1] = -1;
+        return;
+    }
+    handler->use_splice = true;
+}
+
 static void* start_handler(void* data)
 {
     struct fuse_handler* handler = data;
@@ -1665,15 +2388,61 @@ static bool remove_str_to_int(void *key, void *value, void *context) {
     return true;
 }
 
-static int read_package_list(struct fuse_global* global) {
-    pthread_mutex_lock(&global->lock);
+struct package_diff {
+    Hashmap* other;
+    Hashmap* changed;
+};
 
-    hashmapForEach(global->package_to_appid, remove_str_to_int, global->package_to_appid);
+/* Adds each package whose appid differs in the other map to the changed set. */
+static bool diff_package(void *key, void *value, void *context) {
+    struct package_diff* diff = context;
+    if (hashmapGet(diff->other, key) != value) {
+        hashmapPut(diff->changed, key, key);
+    }
+    return true;
+}
+
+/* Re-derives the app directories of changed packages.  Only the nodes
+ * between the root and Android/{data,obb,media} are walked; everything else
+ * inherits from them. */
+static void derive_changed_packages_locked(struct fuse* fuse, struct node* parent,
+        Hashmap* changed) {
+    struct node* node;
+    for (node = parent->child; node; node = node->next) {
+        switch (parent->perm) {
+        case PERM_ANDROID_DATA:
+        case PERM_ANDROID_OBB:
+        case PERM_ANDROID_MEDIA:
+            if (hashmapContainsKey(changed, node->name)) {
+                derive_permissions_locked(fuse, parent, node);
+                derive_permissions_recursive_locked(fuse, node);
+            }
+            break;
+        case PERM_PRE_ROOT:
+        case PERM_ROOT:
+        case PERM_ANDROID:
+            if (node->perm != PERM_INHERIT) {
+                derive_changed_packages_locked(fuse, node, changed);
+            }
+            break;
+        default:
+            return;
+        }
+    }
+}
 
+static int read_package_list(struct fuse_global* global) {
+    /* Parse into a new map without holding the lock, so that requests keep
+     * being served meanwhile. */
     FILE* file = fopen(kPackagesListFile, "r");
     if (!file) {
         ERROR("failed to open package list: %s\n", strerror(errno));
-        pthread_mutex_unlock(&global->lock);
+        return -1;
+    }
+
+    Hashmap* package_to_appid = hashmapCreate(256, str_hash, str_icase_equals);
+    if (!package_to_appid) {
+        fclose(file);
         return -1;
     }
 
@@ -1684,19 +2453,52 @@ static int read_package_list(struct fuse_global* global) {
         char gids[512];
 
         if (sscanf(buf, "%s %d %*d %*s %*s %s", package_name, &appid, gids) == 3) {
-            char* package_name_dup = strdup(package_name);
-            hashmapPut(global->package_to_appid, package_name_dup, (void*) (uintptr_t) appid);
+            void* value = (void*) (uintptr_t) appid;
+            if (hashmapContainsKey(package_to_appid, package_name)) {
+                /* Only the value of an existing entry is replaced. */
+                hashmapPut(package_to_appid, package_name, value);
+            } else {
+                hashmapPut(package_to_appid, strdup(package_name), value);
+            }
         }
     }
 
-    TRACE("read_package_list: found %zu packages\n",
-            hashmapSize(global->package_to_appid));
+    TRACE("read_package_list: found %zu packages\n", hashmapSize(package_to_appid));
     fclose(file);
 
+    pthread_mutex_lock(&global->lock);
+
+    /* Packages that were added, removed or given another appid.  The keys
+     * belong to the two maps, which both outlive this set. */
+    Hashmap* old_package_to_appid = global->package_to_appid;
+    struct package_diff diff;
+    diff.changed = hashmapCreate(16, str_hash, str_icase_equals);
+    if (diff.changed) {
+        diff.other = old_package_to_appid;
+        hashmapForEach(package_to_appid, diff_package, &diff);
+        diff.other = package_to_appid;
+        hashmapForEach(old_package_to_appid, diff_package, &diff);
+    }
+
+    global->package_to_appid = package_to_appid;
+
     /* Regenerate ownership details using newly loaded mapping */
-    derive_permissions_recursive_locked(global->fuse_default, &global->root);
+    if (diff.changed) {
+        TRACE("read_package_list: %zu packages changed\n", hashmapSize(diff.changed));
+        if (hashmapSize(diff.changed)) {
+            derive_changed_packages_locked(global->fuse_default, &global->root, diff.changed);
+        }
+    } else {
+        derive_permissions_recursive_locked(global->fuse_default, &global->root);
+    }
 
     pthread_mutex_unlock(&global->lock);
+
+    if (diff.changed) {
+        hashmapFree(diff.changed);
+    }
+    hashmapForEach(old_package_to_appid, remove_str_to_int, old_package_to_appid);
+    hashmapFree(old_package_to_appid);
     return 0;
 }
 
@@ -1769,7 +2571,13 @@ static int usage() {
             "    -U: specify user ID that owns device\n"
             "    -m: source_path is multi-user\n"
             "    -w: runtime write mount has full write access\n"
-            "\n");
+            "    -t: number of threads serving each view (default %d)\n"
+            "    -R: largest read request in KiB (default and maximum %d)\n"
+            "    -W: largest write request in KiB (default and maximum %d)\n"
+            "    -a: attribute timeout in seconds (default %d)\n"
+            "    -e: entry timeout in seconds (default %d)\n"
+            "\n", DEFAULT_NUM_THREADS, MAX_READ / 1024, MAX_WRITE / 1024,
+            DEFAULT_ATTR_TIMEOUT, DEFAULT_ENTRY_TIMEOUT);
     return 1;
 }
 
@@ -1785,8 +2593,9 @@ static int fuse_setup(struct fuse* fuse, gid_t gid, mode_t mask) {
     umount2(fuse->dest_path, MNT_DETACH);
 
     snprintf(opts, sizeof(opts),
-            "fd=%i,rootmode=40000,default_permissions,allow_other,user_id=%d,group_id=%d",
-            fuse->fd, fuse->global->uid, fuse->global->gid);
+            "fd=%i,rootmode=40000,default_permissions,allow_other,user_id=%d,group_id=%d,"
+            "max_read=%u",
+            fuse->fd, fuse->global->uid, fuse->global->gid, fuse->global->max_read);
     if (mount("/dev/fuse", fuse->dest_path, "fuse", MS_NOSUID | MS_NODEV | MS_NOEXEC |
             MS_NOATIME, opts) != 0) {
         ERROR("failed to mount fuse filesystem: %s\n", strerror(errno));
@@ -1800,33 +2609,35 @@ static int fuse_setup(struct fuse* fuse, gid_t gid, mode_t mask) {
 }
 
 static void run(const char* source_path, const char* label, uid_t uid,
-        gid_t gid, userid_t userid, bool multi_user, bool full_write) {
+        gid_t gid, userid_t userid, bool multi_user, bool full_write,
+        int num_threads, __u32 max_read, __u32 max_write,
+        __u64 attr_timeout, __u64 entry_timeout) {
     struct fuse_global global;
     struct fuse fuse_default;
     struct fuse fuse_read;
     struct fuse fuse_write;
-    struct fuse_handler handler_default;
-    struct fuse_handler handler_read;
-    struct fuse_handler handler_write;
-    pthread_t thread_default;
-    pthread_t thread_read;
-    pthread_t thread_write;
+    struct fuse* views[3];
+    struct fuse_handler* handlers;
+    int i;
 
     memset(&global, 0, sizeof(global));
     memset(&fuse_default, 0, sizeof(fuse_default));
     memset(&fuse_read, 0, sizeof(fuse_read));
     memset(&fuse_write, 0, sizeof(fuse_write));
-    memset(&handler_default, 0, sizeof(handler_default));
-    memset(&handler_read, 0, sizeof(handler_read));
-    memset(&handler_write, 0, sizeof(handler_write));
 
     pthread_mutex_init(&global.lock, NULL);
+    pthread_mutex_init(&global.io_lock, NULL);
+    pthread_cond_init(&global.io_cond, NULL);
     global.package_to_appid = hashmapCreate(256, str_hash, str_icase_equals);
     global.uid = uid;
     global.gid = gid;
     global.multi_user = multi_user;
     global.next_generation = 0;
     global.inode_ctr = 1;
+    global.max_read = max_read;
+    global.max_write = max_write;
+    global.attr_timeout = attr_timeout;
+    global.entry_timeout = entry_timeout;
 
     memset(&global.root, 0, sizeof(global.root));
     global.root.nid = FUSE_ROOT_ID; /* 1 */
@@ -1859,13 +2670,21 @@ static void run(const char* source_path, const char* label, uid_t uid,
     snprintf(fuse_read.dest_path, PATH_MAX, "/mnt/runtime/read/%s", label);
     snprintf(fuse_write.dest_path, PATH_MAX, "/mnt/runtime/write/%s", label);
 
-    handler_default.fuse = &fuse_default;
-    handler_read.fuse = &fuse_read;
-    handler_write.fuse = &fuse_write;
-
-    handler_default.token = 0;
-    handler_read.token = 1;
-    handler_write.token = 2;
+    /* Each handler has its own request buffer, so they are too large for the
+     * stack.  Handler i serves view i / num_threads. */
+    views[0] = &fuse_default;
+    views[1] = &fuse_read;
+    views[2] = &fuse_write;
+    handlers = calloc(3 * num_threads, sizeof(*handlers));
+    if (!handlers) {
+        ERROR("failed to allocate handlers\n");
+        exit(1);
+    }
+    for (i = 0; i < 3 * num_threads; i++) {
+        handlers[i].fuse = views[i / num_threads];
+        handlers[i].token = i;
+        handler_setup_splice(&handlers[i]);
+    }
 
     umask(0);
 
@@ -1908,11 +2727,22 @@ static void run(const char* source_path, const char* label, uid_t uid,
         fs_prepare_dir(global.obb_path, 0775, uid, gid);
     }
 
-    if (pthread_create(&thread_default, NULL, start_handler, &handler_default)
-            || pthread_create(&thread_read, NULL, start_handler, &handler_read)
-            || pthread_create(&thread_write, NULL, start_handler, &handler_write)) {
-        ERROR("failed to pthread_create\n");
-        exit(1);
+    for (i = 0; i < NUM_IO_THREADS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, start_io_thread, &global)) {
+            ERROR("failed to pthread_create\n");
+            exit(1);
+        }
+    }
+
+    /* The kernel hands each request on a /dev/fuse fd to exactly one of the
+     * threads reading it. */
+    for (i = 0; i < 3 * num_threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, start_handler, &handlers[i])) {
+            ERROR("failed to pthread_create\n");
+            exit(1);
+        }
     }
 
     watch_package_list(&global);
@@ -1928,12 +2758,17 @@ int main(int argc, char **argv) {
     userid_t userid = 0;
     bool multi_user = false;
     bool full_write = false;
+    int num_threads = DEFAULT_NUM_THREADS;
+    __u32 max_read = MAX_READ;
+    __u32 max_write = MAX_WRITE;
+    __u64 attr_timeout = DEFAULT_ATTR_TIMEOUT;
+    __u64 entry_timeout = DEFAULT_ENTRY_TIMEOUT;
     int i;
     struct rlimit rlim;
     int fs_version;
 
     int opt;
-    while ((opt = getopt(argc, argv, "u:g:U:mw")) != -1) {
+    while ((opt = getopt(argc, argv, "u:g:U:mwt:R:W:a:e:")) != -1) {
         switch (opt) {
             case 'u':
                 uid = strtoul(optarg, NULL, 10);
@@ -1950,6 +2785,21 @@ int main(int argc, char **argv) {
             case 'w':
                 full_write = true;
                 break;
+            case 't':
+                num_threads = strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                max_read = strtoul(optarg, NULL, 10) * 1024;
+                break;
+            case 'W':
+                max_write = strtoul(optarg, NULL, 10) * 1024;
+                break;
+            case 'a':
+                attr_timeout = strtoul(optarg, NULL, 10);
+                break;
+            case 'e':
+                entry_timeout = strtoul(optarg, NULL, 10);
+                break;
             case '?':
             default:
                 return usage();
@@ -1980,6 +2830,16 @@ int main(int argc, char **argv) {
         ERROR("uid and gid must be nonzero\n");
         return usage();
     }
+    if (num_threads < 1 || num_threads > MAX_NUM_THREADS) {
+        ERROR("number of threads must be between 1 and %d\n", MAX_NUM_THREADS);
+        return usage();
+    }
+    if (max_read < PAGESIZE || max_read > MAX_READ
+            || max_write < PAGESIZE || max_write > MAX_WRITE) {
+        ERROR("read and write sizes must be between %d and %d/%d KiB\n",
+                PAGESIZE / 1024, MAX_READ / 1024, MAX_WRITE / 1024);
+        return usage();
+    }
 
     rlim.rlim_cur = 8192;
     rlim.rlim_max = 8192;
@@ -1992,6 +2852,7 @@ int main(int argc, char **argv) {
         sleep(1);
     }
 
-    run(source_path, label, uid, gid, userid, multi_user, full_write);
+    run(source_path, label, uid, gid, userid, multi_user, full_write, num_threads,
+            max_read, max_write, attr_timeout, entry_timeout);
     return 1;
 }
@@ -10,18 +10,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cutils/procfs.h>
 #include <cutils/sched_policy.h>
 
-static char *nexttoksep(char **strp, char *sep)
-{
-    char *p = strsep(strp,sep);
-    return (p == 0) ? "" : p;
-}
-static char *nexttok(char **strp)
-{
-    return nexttoksep(strp, " ");
-}
-
 #define SHOW_PRIO 1
 #define SHOW_TIME 2
 #define SHOW_POLICY 4
@@ -39,7 +30,7 @@ static char *nexttok(char **strp)
 static int display_flags = 0;
 static int ppid_filter = 0;
 
-static void print_exe_abi(int pid);
+static void print_exe_abi(int dirfd);
 
 static int ps_line(int pid, int tid, char *namefilter)
 {
@@ -48,8 +39,10 @@ static int ps_line(int pid, int tid, char *namefilter)
     char macline[1024];
     char user[32];
     struct stat stats;
-    int fd, r;
-    char *ptr, *name, *state;
+    struct procfs_stat st;
+    int dirfd;
+    const char *name;
+    char state[2];
     int ppid;
     unsigned rss, vss;
     uintptr_t eip;
@@ -57,90 +50,37 @@ static int ps_line(int pid, int tid, char *namefilter)
     int prio, nice, rtprio, sched, psr;
     struct passwd *pw;
 
-    sprintf(statline, "/proc/%d", pid);
-    stat(statline, &stats);
+    // All the files of this process or thread are read through one
+    // directory fd; its owner is the process's uid.
+    dirfd = procfs_open(pid, tid);
+    if(dirfd < 0) return -1;
+    fstat(dirfd, &stats);
 
-    if(tid) {
-        sprintf(statline, "/proc/%d/task/%d/stat", pid, tid);
-        cmdline[0] = 0;
-        snprintf(macline, sizeof(macline), "/proc/%d/task/%d/attr/current", pid, tid);
-    } else {
-        sprintf(statline, "/proc/%d/stat", pid);
-        sprintf(cmdline, "/proc/%d/cmdline", pid);
-        snprintf(macline, sizeof(macline), "/proc/%d/attr/current", pid);
-        fd = open(cmdline, O_RDONLY);
-        if(fd == 0) {
-            r = 0;
-        } else {
-            r = read(fd, cmdline, 1023);
-            close(fd);
-            if(r < 0) r = 0;
-        }
-        cmdline[r] = 0;
+    cmdline[0] = 0;
+    if(!tid) {
+        procfs_read_at(dirfd, "cmdline", cmdline, sizeof(cmdline));
     }
 
-    fd = open(statline, O_RDONLY);
-    if(fd == 0) return -1;
-    r = read(fd, statline, 1023);
-    close(fd);
-    if(r < 0) return -1;
-    statline[r] = 0;
-
-    ptr = statline;
-    nexttok(&ptr); // skip pid
-    ptr++;          // skip "("
-
-    name = ptr;
-    ptr = strrchr(ptr, ')'); // Skip to *last* occurence of ')',
-    *ptr++ = '\0';           // and null-terminate name.
-
-    ptr++;          // skip " "
-    state = nexttok(&ptr);
-    ppid = atoi(nexttok(&ptr));
-    nexttok(&ptr); // pgrp
-    nexttok(&ptr); // sid
-    nexttok(&ptr); // tty
-    nexttok(&ptr); // tpgid
-    nexttok(&ptr); // flags
-    nexttok(&ptr); // minflt
-    nexttok(&ptr); // cminflt
-    nexttok(&ptr); // majflt
-    nexttok(&ptr); // cmajflt
-#if 1
-    utime = atoi(nexttok(&ptr));
-    stime = atoi(nexttok(&ptr));
-#else
-    nexttok(&ptr); // utime
-    nexttok(&ptr); // stime
-#endif
-    nexttok(&ptr); // cutime
-    nexttok(&ptr); // cstime
-    prio = atoi(nexttok(&ptr));
-    nice = atoi(nexttok(&ptr));
-    nexttok(&ptr); // threads
-    nexttok(&ptr); // itrealvalue
-    nexttok(&ptr); // starttime
-    vss = strtoul(nexttok(&ptr), 0, 10); // vsize
-    rss = strtoul(nexttok(&ptr), 0, 10); // rss
-    nexttok(&ptr); // rlim
-    nexttok(&ptr); // startcode
-    nexttok(&ptr); // endcode
-    nexttok(&ptr); // startstack
-    nexttok(&ptr); // kstkesp
-    eip = strtoul(nexttok(&ptr), 0, 10); // kstkeip
-    nexttok(&ptr); // signal
-    nexttok(&ptr); // blocked
-    nexttok(&ptr); // sigignore
-    nexttok(&ptr); // sigcatch
-    nexttok(&ptr); // wchan
-    nexttok(&ptr); // nswap
-    nexttok(&ptr); // cnswap
-    nexttok(&ptr); // exit signal
-    psr = atoi(nexttok(&ptr)); // processor
-    rtprio = atoi(nexttok(&ptr)); // rt_priority
-    sched = atoi(nexttok(&ptr)); // scheduling policy
+    if(procfs_read_at(dirfd, "stat", statline, sizeof(statline)) < 0 ||
+       procfs_parse_stat(statline, &st) < 0) {
+        close(dirfd);
+        return -1;
+    }
 
-    nexttok(&ptr); // tty
+    name = st.comm;
+    state[0] = st.state;
+    state[1] = 0;
+    ppid = st.ppid;
+    utime = st.utime;
+    stime = st.stime;
+    prio = st.priority;
+    nice = st.nice;
+    vss = st.vsize;
+    rss = st.rss;
+    eip = st.kstkeip;
+    psr = st.processor;
+    rtprio = st.rt_priority;
+    sched = st.policy;
 
     if(tid != 0) {
         ppid = pid;
@@ -155,20 +95,16 @@ static int ps_line(int pid, int tid, char *namefilter)
     }
 
     if(ppid_filter != 0 && ppid != ppid_filter) {
+        close(dirfd);
         return 0;
     }
 
     if(!namefilter || !strncmp(cmdline[0] ? cmdline : name, namefilter, strlen(namefilter))) {
         if (display_flags & SHOW_MACLABEL) {
-            fd = open(macline, O_RDONLY);
-            strcpy(macline, "-");
-            if (fd >= 0) {
-                r = read(fd, macline, sizeof(macline)-1);
-                close(fd);
-                if (r > 0)
-                    macline[r] = 0;
-            }
+            if (procfs_read_at(dirfd, "attr/current", macline, sizeof(macline)) <= 0)
+                strcpy(macline, "-");
             printf("%-30s %-9s %-5d %-5d %s\n", macline, user, pid, ppid, cmdline[0] ? cmdline : name);
+            close(dirfd);
             return 0;
         }
 
@@ -184,18 +120,14 @@ static int ps_line(int pid, int tid, char *namefilter)
             else
                 printf(" %.2s ", get_sched_policy_name(p));
         }
-        char path[PATH_MAX];
-        snprintf(path, sizeof(path), "/proc/%d/wchan", pid);
-        char wchan[10];
-        int fd = open(path, O_RDONLY);
-        ssize_t wchan_len = read(fd, wchan, sizeof(wchan));
+        char wchan[11];
+        ssize_t wchan_len = procfs_read_at(dirfd, "wchan", wchan, sizeof(wchan));
         if (wchan_len == -1) {
             wchan[wchan_len = 0] = '\0';
         }
-        close(fd);
         printf(" %10.*s %0*" PRIxPTR " %s ", (int) wchan_len, wchan, (int) PC_WIDTH, eip, state);
         if (display_flags & SHOW_ABI) {
-            print_exe_abi(pid);
+            print_exe_abi(dirfd);
         }
         printf("%s", cmdline[0] ? cmdline : name);
         if(display_flags&SHOW_TIME)
@@ -203,23 +135,23 @@ static int ps_line(int pid, int tid, char *namefilter)
 
         printf("\n");
     }
+    close(dirfd);
     return 0;
 }
 
-static void print_exe_abi(int pid)
+static void print_exe_abi(int dirfd)
 {
     int fd, r;
-    char exeline[1024];
+    char exeline[5];
 
-    sprintf(exeline, "/proc/%d/exe", pid);
-    fd = open(exeline, O_RDONLY);
-    if(fd == 0) {
+    fd = openat(dirfd, "exe", O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
         printf("    ");
         return;
     }
     r = read(fd, exeline, 5 /* 4 byte ELFMAG + 1 byte EI_CLASS */);
     close(fd);
-    if(r < 0) {
+    if(r < 5) {
         printf("    ");
         return;
     }
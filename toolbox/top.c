@@ -36,10 +36,13 @@
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cutils/procfs.h>
 #include <cutils/sched_policy.h>
 
 struct cpu_info {
@@ -51,10 +54,24 @@ struct cpu_info {
 #define THREAD_NAME_LEN 32
 #define POLICY_NAME_LEN 4
 
+/*
+ * One per process, or per thread with -t, kept from one refresh to the next
+ * for as long as it exists: the stat file stays open and is re-read with
+ * pread, the previous times give the deltas, and the fields that only the
+ * printed rows need are read for those rows alone.
+ */
 struct proc_info {
     struct proc_info *next;
+    struct proc_info *hash_next;
     pid_t pid;
     pid_t tid;
+    int stat_fd;
+    unsigned generation;
+    uint64_t starttime;
+    int have_prev;
+    /* cmdline and status, valid while tname matches static_tname. */
+    int have_static;
+    char static_tname[THREAD_NAME_LEN];
     uid_t uid;
     gid_t gid;
     char name[PROC_NAME_LEN];
@@ -72,19 +89,22 @@ struct proc_info {
     char policy[POLICY_NAME_LEN];
 };
 
-struct proc_list {
-    struct proc_info **array;
-    int size;
-};
-
 #define die(...) { fprintf(stderr, __VA_ARGS__); exit(EXIT_FAILURE); }
 
 #define INIT_PROCS 50
 #define THREAD_MULT 8
-static struct proc_info **old_procs, **new_procs;
-static int num_old_procs, num_new_procs;
+#define PROC_HASH_SIZE 1024
+/* Descriptors left for everything other than the stat files we keep open. */
+#define RESERVED_FDS 32
+
+static struct proc_info **new_procs;
+static int num_new_procs, max_new_procs;
 static struct proc_info *free_procs;
 static int num_used_procs, num_free_procs;
+static struct proc_info *proc_hash[PROC_HASH_SIZE];
+static unsigned generation;
+static int open_stat_fds, max_stat_fds;
+static int cpu_stat_fd = -1;
 
 static int max_procs, delay, iterations, threads;
 
@@ -93,14 +113,17 @@ static struct cpu_info old_cpu, new_cpu;
 static struct proc_info *alloc_proc(void);
 static void free_proc(struct proc_info *proc);
 static void read_procs(void);
-static int read_stat(char *filename, struct proc_info *proc);
+static struct proc_info *get_proc(pid_t pid, pid_t tid);
+static struct proc_info *find_proc(pid_t pid, pid_t tid);
+static void drop_stale_procs(void);
+static int read_stat(struct proc_info *proc);
+static void read_static(struct proc_info *proc);
 static void read_policy(int pid, struct proc_info *proc);
-static void add_proc(int proc_num, struct proc_info *proc);
-static int read_cmdline(char *filename, struct proc_info *proc);
-static int read_status(char *filename, struct proc_info *proc);
+static void add_proc(struct proc_info *proc);
+static int read_cmdline(struct proc_info *proc);
+static int read_status(struct proc_info *proc);
+static void select_procs(int count);
 static void print_procs(void);
-static struct proc_info *find_old_proc(pid_t pid, pid_t tid);
-static void free_old_procs(void);
 static int (*proc_cmp)(const void *a, const void *b);
 static int proc_cpu_cmp(const void *a, const void *b);
 static int proc_vss_cmp(const void *a, const void *b);
@@ -175,18 +198,15 @@ int top_main(int argc, char *argv[]) {
 
     free_procs = NULL;
 
-    num_new_procs = num_old_procs = 0;
-    new_procs = old_procs = NULL;
+    num_new_procs = max_new_procs = 0;
+    new_procs = NULL;
 
     read_procs();
     while ((iterations == -1) || (iterations-- > 0)) {
-        old_procs = new_procs;
-        num_old_procs = num_new_procs;
         memcpy(&old_cpu, &new_cpu, sizeof(old_cpu));
         sleep(delay);
         read_procs();
         print_procs();
-        free_old_procs();
     }
 
     return 0;
@@ -223,59 +243,47 @@ static void read_procs(void) {
     DIR *proc_dir, *task_dir;
     struct dirent *pid_dir, *tid_dir;
     char filename[64];
-    FILE *file;
-    int proc_num;
+    char buf[MAX_LINE];
     struct proc_info *proc;
     pid_t pid, tid;
 
-    int i;
+    if (max_stat_fds == 0) {
+        struct rlimit rl;
+        max_stat_fds = INIT_PROCS;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur > 2 * RESERVED_FDS)
+            max_stat_fds = rl.rlim_cur - RESERVED_FDS;
+    }
 
     proc_dir = opendir("/proc");
     if (!proc_dir) die("Could not open /proc.\n");
 
-    new_procs = calloc(INIT_PROCS * (threads ? THREAD_MULT : 1), sizeof(struct proc_info *));
-    num_new_procs = INIT_PROCS * (threads ? THREAD_MULT : 1);
-
-    file = fopen("/proc/stat", "r");
-    if (!file) die("Could not open /proc/stat.\n");
-    fscanf(file, "cpu  %lu %lu %lu %lu %lu %lu %lu", &new_cpu.utime, &new_cpu.ntime, &new_cpu.stime,
+    if (!new_procs) {
+        max_new_procs = INIT_PROCS * (threads ? THREAD_MULT : 1);
+        new_procs = calloc(max_new_procs, sizeof(struct proc_info *));
+        if (!new_procs) die("Could not allocate procs array.\n");
+    }
+    num_new_procs = 0;
+    generation++;
+
+    if (cpu_stat_fd < 0)
+        cpu_stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    if (cpu_stat_fd < 0 || procfs_pread(cpu_stat_fd, buf, sizeof(buf)) < 0)
+        die("Could not read /proc/stat.\n");
+    sscanf(buf, "cpu  %lu %lu %lu %lu %lu %lu %lu", &new_cpu.utime, &new_cpu.ntime, &new_cpu.stime,
             &new_cpu.itime, &new_cpu.iowtime, &new_cpu.irqtime, &new_cpu.sirqtime);
-    fclose(file);
 
-    proc_num = 0;
     while ((pid_dir = readdir(proc_dir))) {
         if (!isdigit(pid_dir->d_name[0]))
             continue;
 
         pid = atoi(pid_dir->d_name);
 
-        struct proc_info cur_proc;
-
         if (!threads) {
-            proc = alloc_proc();
-
-            proc->pid = proc->tid = pid;
-
-            sprintf(filename, "/proc/%d/stat", pid);
-            read_stat(filename, proc);
-
-            sprintf(filename, "/proc/%d/cmdline", pid);
-            read_cmdline(filename, proc);
-
-            sprintf(filename, "/proc/%d/status", pid);
-            read_status(filename, proc);
-
-            read_policy(pid, proc);
-
-            proc->num_threads = 0;
-        } else {
-            sprintf(filename, "/proc/%d/cmdline", pid);
-            read_cmdline(filename, &cur_proc);
-
-            sprintf(filename, "/proc/%d/status", pid);
-            read_status(filename, &cur_proc);
-
-            proc = NULL;
+            /* The thread count comes from stat, so no need to list task/. */
+            proc = get_proc(pid, pid);
+            if (proc)
+                add_proc(proc);
+            continue;
         }
 
         sprintf(filename, "/proc/%d/task", pid);
@@ -286,103 +294,180 @@ static void read_procs(void) {
             if (!isdigit(tid_dir->d_name[0]))
                 continue;
 
-            if (threads) {
-                tid = atoi(tid_dir->d_name);
+            tid = atoi(tid_dir->d_name);
 
-                proc = alloc_proc();
+            proc = get_proc(pid, tid);
+            if (proc)
+                add_proc(proc);
+        }
 
-                proc->pid = pid; proc->tid = tid;
+        closedir(task_dir);
+    }
 
-                sprintf(filename, "/proc/%d/task/%d/stat", pid, tid);
-                read_stat(filename, proc);
+    closedir(proc_dir);
 
-                read_policy(tid, proc);
+    drop_stale_procs();
+}
 
-                strcpy(proc->name, cur_proc.name);
-                proc->uid = cur_proc.uid;
-                proc->gid = cur_proc.gid;
+static struct proc_info *find_proc(pid_t pid, pid_t tid) {
+    struct proc_info *proc;
 
-                add_proc(proc_num++, proc);
-            } else {
-                proc->num_threads++;
-            }
-        }
+    for (proc = proc_hash[tid % PROC_HASH_SIZE]; proc; proc = proc->hash_next)
+        if (proc->pid == pid && proc->tid == tid)
+            return proc;
 
-        closedir(task_dir);
+    return NULL;
+}
 
-        if (!threads)
-            add_proc(proc_num++, proc);
-    }
+static int open_stat(pid_t pid, pid_t tid) {
+    char filename[64];
 
-    for (i = proc_num; i < num_new_procs; i++)
-        new_procs[i] = NULL;
+    if (pid == tid)
+        sprintf(filename, "/proc/%d/stat", pid);
+    else
+        sprintf(filename, "/proc/%d/task/%d/stat", pid, tid);
+    return open(filename, O_RDONLY | O_CLOEXEC);
+}
 
-    closedir(proc_dir);
+static void close_stat(struct proc_info *proc) {
+    if (proc->stat_fd >= 0) {
+        close(proc->stat_fd);
+        proc->stat_fd = -1;
+        open_stat_fds--;
+    }
 }
 
-static int read_stat(char *filename, struct proc_info *proc) {
-    FILE *file;
-    char buf[MAX_LINE], *open_paren, *close_paren;
+/*
+ * Returns the entry for pid/tid with its stat read for this refresh, or NULL
+ * if it has gone away.  If the kept stat fd fails, the file is opened again
+ * in case the pid now belongs to another process; read_stat notices that
+ * from the start time.
+ */
+static struct proc_info *get_proc(pid_t pid, pid_t tid) {
+    struct proc_info *proc = find_proc(pid, tid);
+    int fd, ret;
+
+    if (!proc) {
+        proc = alloc_proc();
+        memset(proc, 0, sizeof(*proc));
+        proc->pid = pid;
+        proc->tid = tid;
+        proc->stat_fd = -1;
+        proc->hash_next = proc_hash[tid % PROC_HASH_SIZE];
+        proc_hash[tid % PROC_HASH_SIZE] = proc;
+    }
+    proc->generation = generation;
+
+    if (proc->stat_fd >= 0 && read_stat(proc) == 0)
+        return proc;
+
+    close_stat(proc);
+    fd = open_stat(pid, tid);
+    if (fd < 0) return NULL;
+    proc->stat_fd = fd;
+    ret = read_stat(proc);
+    if (open_stat_fds < max_stat_fds) {
+        open_stat_fds++;
+    } else {
+        /* Out of descriptors to keep: this one is opened every time. */
+        proc->stat_fd = -1;
+        close(fd);
+    }
+    return ret ? NULL : proc;
+}
 
-    file = fopen(filename, "r");
-    if (!file) return 1;
-    fgets(buf, MAX_LINE, file);
-    fclose(file);
+/* Forgets everything that was not seen in this refresh. */
+static void drop_stale_procs(void) {
+    struct proc_info **link, *proc;
+    int i;
 
-    /* Split at first '(' and last ')' to get process name. */
-    open_paren = strchr(buf, '(');
-    close_paren = strrchr(buf, ')');
-    if (!open_paren || !close_paren) return 1;
+    for (i = 0; i < PROC_HASH_SIZE; i++) {
+        link = &proc_hash[i];
+        while ((proc = *link)) {
+            if (proc->generation != generation) {
+                *link = proc->hash_next;
+                close_stat(proc);
+                free_proc(proc);
+            } else {
+                link = &proc->hash_next;
+            }
+        }
+    }
+}
 
-    *open_paren = *close_paren = '\0';
-    strncpy(proc->tname, open_paren + 1, THREAD_NAME_LEN);
-    proc->tname[THREAD_NAME_LEN-1] = 0;
+static int read_stat(struct proc_info *proc) {
+    char buf[MAX_LINE * 2];
+    struct procfs_stat st;
+
+    if (procfs_pread(proc->stat_fd, buf, sizeof(buf)) <= 0) return 1;
+    if (procfs_parse_stat(buf, &st)) return 1;
 
-    /* Scan rest of string. */
-    sscanf(close_paren + 1,
-           " %c " "%*d %*d %*d %*d %*d %*d %*d %*d %*d %*d "
-           "%" SCNu64
-           "%" SCNu64 "%*d %*d %*d %*d %*d %*d %*d "
-           "%" SCNu64
-           "%" SCNu64 "%*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d %*d "
-           "%d",
-           &proc->state,
-           &proc->utime,
-           &proc->stime,
-           &proc->vss,
-           &proc->rss,
-           &proc->prs);
+    strncpy(proc->tname, st.comm, THREAD_NAME_LEN);
+    proc->tname[THREAD_NAME_LEN-1] = 0;
+    proc->num_threads = st.num_threads;
+    proc->vss = st.vsize;
+    proc->rss = st.rss;
+    proc->prs = st.processor;
+
+    if (proc->have_prev && proc->starttime != st.starttime) {
+        /* Same pid, different process. */
+        proc->have_prev = 0;
+        proc->have_static = 0;
+    }
+    if (proc->have_prev) {
+        proc->delta_utime = st.utime - proc->utime;
+        proc->delta_stime = st.stime - proc->stime;
+    } else {
+        proc->delta_utime = 0;
+        proc->delta_stime = 0;
+    }
+    proc->delta_time = proc->delta_utime + proc->delta_stime;
+    proc->state = st.state;
+    proc->utime = st.utime;
+    proc->stime = st.stime;
+    proc->starttime = st.starttime;
+    proc->have_prev = 1;
 
     return 0;
 }
 
-static void add_proc(int proc_num, struct proc_info *proc) {
+/*
+ * Reads cmdline and status into proc, which is a process or the main thread
+ * of one.  They only change when the process execs or, for apps, when the
+ * zygote child takes on its new identity, and both of those rename the main
+ * thread, so they are read again only when its name changes.
+ */
+static void read_static(struct proc_info *proc) {
+    if (proc->have_static && !strcmp(proc->static_tname, proc->tname))
+        return;
+
+    read_cmdline(proc);
+    read_status(proc);
+
+    strcpy(proc->static_tname, proc->tname);
+    proc->have_static = 1;
+}
+
+static void add_proc(struct proc_info *proc) {
     int i;
 
-    if (proc_num >= num_new_procs) {
-        new_procs = realloc(new_procs, 2 * num_new_procs * sizeof(struct proc_info *));
+    if (num_new_procs >= max_new_procs) {
+        new_procs = realloc(new_procs, 2 * max_new_procs * sizeof(struct proc_info *));
         if (!new_procs) die("Could not expand procs array.\n");
-        for (i = num_new_procs; i < 2 * num_new_procs; i++)
+        for (i = max_new_procs; i < 2 * max_new_procs; i++)
             new_procs[i] = NULL;
-        num_new_procs = 2 * num_new_procs;
+        max_new_procs = 2 * max_new_procs;
     }
-    new_procs[proc_num] = proc;
+    new_procs[num_new_procs++] = proc;
 }
 
-static int read_cmdline(char *filename, struct proc_info *proc) {
-    FILE *file;
+static int read_cmdline(struct proc_info *proc) {
     char line[MAX_LINE];
 
-    line[0] = '\0';
-    file = fopen(filename, "r");
-    if (!file) return 1;
-    fgets(line, MAX_LINE, file);
-    fclose(file);
-    if (strlen(line) > 0) {
-        strncpy(proc->name, line, PROC_NAME_LEN);
-        proc->name[PROC_NAME_LEN-1] = 0;
-    } else
-        proc->name[0] = 0;
+    proc->name[0] = 0;
+    if (procfs_read(proc->pid, 0, "cmdline", line, MAX_LINE) < 0) return 1;
+    strncpy(proc->name, line, PROC_NAME_LEN);
+    proc->name[PROC_NAME_LEN-1] = 0;
     return 0;
 }
 
@@ -396,49 +481,68 @@ static void read_policy(int pid, struct proc_info *proc) {
     }
 }
 
-static int read_status(char *filename, struct proc_info *proc) {
-    FILE *file;
-    char line[MAX_LINE];
-    unsigned int uid, gid;
+static int read_status(struct proc_info *proc) {
+    char buf[MAX_LINE * 8];
+    const char *value;
 
-    file = fopen(filename, "r");
-    if (!file) return 1;
-    while (fgets(line, MAX_LINE, file)) {
-        sscanf(line, "Uid: %u", &uid);
-        sscanf(line, "Gid: %u", &gid);
-    }
-    fclose(file);
-    proc->uid = uid; proc->gid = gid;
+    if (procfs_read(proc->pid, 0, "status", buf, sizeof(buf)) < 0) return 1;
+    value = procfs_status_value(buf, "Uid");
+    proc->uid = value ? (uid_t) atoi(value) : 0;
+    value = procfs_status_value(buf, "Gid");
+    proc->gid = value ? (gid_t) atoi(value) : 0;
     return 0;
 }
 
+/*
+ * Puts the first count entries of new_procs in order, leaving the rest
+ * unsorted behind them: a quickselect narrows down the range that holds
+ * them, and only that range is sorted.
+ */
+static void select_procs(int count) {
+    int lo = 0, hi = num_new_procs - 1;
+
+    while (lo < hi) {
+        struct proc_info *pivot = new_procs[lo + (hi - lo) / 2], *tmp;
+        int i = lo, j = hi;
+
+        while (i <= j) {
+            while (proc_cmp(&new_procs[i], &pivot) < 0) i++;
+            while (proc_cmp(&new_procs[j], &pivot) > 0) j--;
+            if (i <= j) {
+                tmp = new_procs[i]; new_procs[i] = new_procs[j]; new_procs[j] = tmp;
+                i++; j--;
+            }
+        }
+        if (count - 1 <= j)
+            hi = j;
+        else if (count - 1 >= i)
+            lo = i;
+        else
+            break;
+    }
+
+    qsort(new_procs, count, sizeof(struct proc_info *), proc_cmp);
+}
+
 static void print_procs(void) {
-    int i;
-    struct proc_info *old_proc, *proc;
+    int i, count;
+    struct proc_info *proc, *main_thread;
     long unsigned total_delta_time;
     struct passwd *user;
     char *user_str, user_buf[20];
 
-    for (i = 0; i < num_new_procs; i++) {
-        if (new_procs[i]) {
-            old_proc = find_old_proc(new_procs[i]->pid, new_procs[i]->tid);
-            if (old_proc) {
-                new_procs[i]->delta_utime = new_procs[i]->utime - old_proc->utime;
-                new_procs[i]->delta_stime = new_procs[i]->stime - old_proc->stime;
-            } else {
-                new_procs[i]->delta_utime = 0;
-                new_procs[i]->delta_stime = 0;
-            }
-            new_procs[i]->delta_time = new_procs[i]->delta_utime + new_procs[i]->delta_stime;
-        }
-    }
-
     total_delta_time = (new_cpu.utime + new_cpu.ntime + new_cpu.stime + new_cpu.itime
                         + new_cpu.iowtime + new_cpu.irqtime + new_cpu.sirqtime)
                      - (old_cpu.utime + old_cpu.ntime + old_cpu.stime + old_cpu.itime
                         + old_cpu.iowtime + old_cpu.irqtime + old_cpu.sirqtime);
 
-    qsort(new_procs, num_new_procs, sizeof(struct proc_info *), proc_cmp);
+    count = num_new_procs;
+    if (max_procs && max_procs < count) {
+        count = max_procs;
+        select_procs(count);
+    } else {
+        qsort(new_procs, num_new_procs, sizeof(struct proc_info *), proc_cmp);
+    }
 
     printf("\n\n\n");
     printf("User %ld%%, System %ld%%, IOW %ld%%, IRQ %ld%%\n",
@@ -462,11 +566,24 @@ static void print_procs(void) {
     else
         printf("%5s %5s %2s %4s %1s %7s %7s %3s %-8s %-15s %s\n", "PID", "TID", "PR", "CPU%", "S", "VSS", "RSS", "PCY", "UID", "Thread", "Proc");
 
-    for (i = 0; i < num_new_procs; i++) {
+    for (i = 0; i < count; i++) {
         proc = new_procs[i];
 
-        if (!proc || (max_procs && (i >= max_procs)))
-            break;
+        /* Only the printed rows need these. */
+        main_thread = proc->tid == proc->pid ? proc : find_proc(proc->pid, proc->pid);
+        if (main_thread) {
+            read_static(main_thread);
+            if (main_thread != proc) {
+                strcpy(proc->name, main_thread->name);
+                proc->uid = main_thread->uid;
+                proc->gid = main_thread->gid;
+            }
+        } else {
+            proc->have_static = 0;
+            read_static(proc);
+        }
+        read_policy(proc->tid, proc);
+
         user  = getpwuid(proc->uid);
         if (user && user->pw_name) {
             user_str = user->pw_name;
@@ -486,26 +603,6 @@ static void print_procs(void) {
     }
 }
 
-static struct proc_info *find_old_proc(pid_t pid, pid_t tid) {
-    int i;
-
-    for (i = 0; i < num_old_procs; i++)
-        if (old_procs[i] && (old_procs[i]->pid == pid) && (old_procs[i]->tid == tid))
-            return old_procs[i];
-
-    return NULL;
-}
-
-static void free_old_procs(void) {
-    int i;
-
-    for (i = 0; i < num_old_procs; i++)
-        if (old_procs[i])
-            free_proc(old_procs[i]);
-
-    free(old_procs);
-}
-
 static int proc_cpu_cmp(const void *a, const void *b) {
     struct proc_info *pa, *pb;
 